@@ -152,6 +152,14 @@ check_include_files(pthread.h HAVE_PTHREAD_H)
 check_function_exists(getpwuid_r HAVE_GETPWUID_R)
 
 if(WITH_CRYPTO_BACKEND STREQUAL "mizaru")
+    # The chip does ECDSA on P-256, P-384 and P-521 itself
+    if(ENABLE_ECC)
+        set(WITH_ECC 1)
+        message(STATUS "Mizaru: Support for ECC is enabled")
+    else(ENABLE_ECC)
+        message(STATUS "Mizaru: Support for ECC is disabled")
+    endif(ENABLE_ECC)
+
     # # acx_openssl_ecc.m4
     # if(ENABLE_ECC)
     #     set(testfile ${CMAKE_SOURCE_DIR}/cmake/modules/tests/test_openssl_ecc.c)
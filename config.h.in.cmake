@@ -57,6 +57,9 @@
 /* Build with object store database backend. */
 #cmakedefine HAVE_OBJECTSTORE_BACKEND_DB @HAVE_OBJECTSTORE_BACKEND_DB@
 
+/* Build with object store log backend. */
+#cmakedefine HAVE_OBJECTSTORE_BACKEND_LOG @HAVE_OBJECTSTORE_BACKEND_LOG@
+
 /* Define to 1 if you have the <openssl/ssl.h> header file. */
 #cmakedefine HAVE_OPENSSL_SSL_H @HAVE_OPENSSL_SSL_H@
 
@@ -166,6 +169,9 @@
 /* Compile with Mizaru support */
 #cmakedefine WITH_MIZARU @WITH_MIZARU@
 
+/* Build with the simulated Mizar chip. */
+#cmakedefine HAVE_MIZAR_SIMULATOR @HAVE_MIZAR_SIMULATOR@
+
 /*
  * Remainder is specific for Windows build to
  * set some default that aren't configured from
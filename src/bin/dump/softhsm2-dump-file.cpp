@@ -40,6 +40,10 @@
 #define BYTES_ATTR		0x3
 #define ATTRMAP_ATTR		0x4
 #define MECHSET_ATTR		0x5
+#define DELETED_ATTR		0x6
+
+// Header of the record format (CKA_VENDOR_SOFTHSM + 'OF')
+#define FORMAT_MARKER		0x8000a28eULL
 
 // Maximum byte string length (1Gib)
 #define MAX_BYTES		0x3fffffff
@@ -350,6 +354,7 @@ void dump(FILE* stream)
 	dumpULong(gen);
 	printf("generation %lu\n", (unsigned long) gen);
 
+	bool first = true;
 	while (!feof(stream))
 	{
 		uint64_t p11type;
@@ -359,6 +364,22 @@ void dump(FILE* stream)
 			return;
 		}
 		dumpULong(p11type);
+		if (first && p11type == FORMAT_MARKER)
+		{
+			first = false;
+			printf("record format\n");
+
+			uint64_t version;
+			if (!readULong(stream, version))
+			{
+				corrupt(stream);
+				return;
+			}
+			dumpULong(version);
+			printf("version %lu\n", (unsigned long) version);
+			continue;
+		}
+		first = false;
 		if ((uint64_t)((uint32_t)p11type) != p11type)
 		{
 			printf("overflow attribute type\n");
@@ -393,12 +414,19 @@ void dump(FILE* stream)
 		case MECHSET_ATTR:
 			printf("mechanism set attribute\n");
 			break;
+		case DELETED_ATTR:
+			printf("deleted attribute\n");
+			break;
 		default:
 			printf("unknown attribute format\n");
 			break;
 		}
 
-		if (disktype == BOOLEAN_ATTR)
+		if (disktype == DELETED_ATTR)
+		{
+			continue;
+		}
+		else if (disktype == BOOLEAN_ATTR)
 		{
 			uint8_t value;
 			if (!readBool(stream, value))
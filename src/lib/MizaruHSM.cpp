@@ -39,6 +39,12 @@
 #include "SimpleConfigLoader.h"
 #include "MutexFactory.h"
 #include "SecureMemoryRegistry.h"
+#include "SecurePool.h"
+#include "Generation.h"
+#include "FileSync.h"
+#include "ObjectLoader.h"
+#include "ObjectFile.h"
+#include "BodyCache.h"
 #include "CryptoFactory.h"
 #include "AsymmetricAlgorithm.h"
 #include "SymmetricAlgorithm.h"
@@ -64,6 +70,12 @@
 #if defined(WITH_MIZARU)
 #include "mizar_api.h"
 #include "mizaru/MizaruCryptoFactory.h"
+#include "mizaru/MizaruDevicePool.h"
+#include "mizaru/MizaruOffload.h"
+#include "mizaru/MizaruRNG.h"
+#include "mizaru/MizaruIndexedAES.h"
+#include "mizaru/MizaruIndexedAsymmetricAlgorithm.h"
+#include "mizaru/MizaruZUCMac.h"
 #elif defined(WITH_OPENSSL)
 #include "OpenSSL/OSSLCryptoFactory.h"
 #elif defined(WITH_BOTAN)
@@ -72,6 +84,8 @@
 
 #include <stdlib.h>
 #include <algorithm>
+#include <map>
+#include <vector>
 #include <stdexcept>
 
 #ifdef _WIN32
@@ -87,6 +101,8 @@
 std::unique_ptr<MutexFactory> MutexFactory::instance(nullptr);
 std::unique_ptr<SecureMemoryRegistry> SecureMemoryRegistry::instance(nullptr);
 #if defined(WITH_MIZARU)
+std::unique_ptr<MizaruDevicePool> MizaruDevicePool::instance(nullptr);
+std::unique_ptr<MizaruOffload> MizaruOffload::instance(nullptr);
 std::unique_ptr<MizaruCryptoFactory> MizaruCryptoFactory::instance(nullptr);
 #elif defined(WITH_OPENSSL)
 // std::unique_ptr<OSSLCryptoFactory> OSSLCryptoFactory::instance(nullptr);
@@ -122,6 +138,8 @@ static CK_RV newP11Object(CK_OBJECT_CLASS objClass, CK_KEY_TYPE keyType, CK_CERT
 				*p11object = new P11RSAPublicKeyObj();
 			else if (keyType == CKK_EC)
 				*p11object = new P11ECPublicKeyObj();
+			else if (keyType == CKK_SM2)
+				*p11object = new P11SM2PublicKeyObj();
 			else
 				return CKR_ATTRIBUTE_VALUE_INVALID;
 			break;
@@ -131,6 +149,8 @@ static CK_RV newP11Object(CK_OBJECT_CLASS objClass, CK_KEY_TYPE keyType, CK_CERT
 				*p11object = new P11RSAPrivateKeyObj();
 			else if (keyType == CKK_EC)
 				*p11object = new P11ECPrivateKeyObj();
+			else if (keyType == CKK_SM2)
+				*p11object = new P11SM2PrivateKeyObj();
 			else
 				return CKR_ATTRIBUTE_VALUE_INVALID;
 			break;
@@ -146,6 +166,14 @@ static CK_RV newP11Object(CK_OBJECT_CLASS objClass, CK_KEY_TYPE keyType, CK_CERT
 			{
 				*p11object = new P11AESSecretKeyObj();
 			}
+			else if (keyType == CKK_SM4)
+			{
+				*p11object = new P11SM4SecretKeyObj();
+			}
+			else if (keyType == CKK_ZUC)
+			{
+				*p11object = new P11ZUCSecretKeyObj();
+			}
 			else if ((keyType == CKK_DES) ||
 				 (keyType == CKK_DES2) ||
 				 (keyType == CKK_DES3))
@@ -291,6 +319,14 @@ static CK_RV checkKeyLength(CK_KEY_TYPE keyType, size_t byteLen)
 				return CKR_ATTRIBUTE_VALUE_INVALID;
 			}
 			break;
+		case CKK_SM4:
+		case CKK_ZUC:
+			if (byteLen != 16)
+			{
+				INFO_MSG("CKA_VALUE_LEN must be 16");
+				return CKR_ATTRIBUTE_VALUE_INVALID;
+			}
+			break;
 		default:
 			return CKR_ATTRIBUTE_VALUE_INVALID;
 	}
@@ -375,6 +411,7 @@ void MizaruHSM::reset()
 	slotManager = NULL;
 	sessionManager = NULL;
 	handleManager = NULL;
+	asyncManager = NULL;
 	resetMutexFactoryCallbacks();
 #ifdef _WIN32
 	forkID = _getpid();
@@ -386,6 +423,13 @@ void MizaruHSM::reset()
 // Destructor
 MizaruHSM::~MizaruHSM()
 {
+	if (asyncManager != NULL)
+	{
+		// The workers are gone in a forked child
+		if (detectFork()) asyncManager->abandon();
+		delete asyncManager;
+	}
+	asyncManager = NULL;
 	if (handleManager != NULL) delete handleManager;
 	handleManager = NULL;
 	if (sessionManager != NULL) delete sessionManager;
@@ -414,6 +458,9 @@ CK_RV MizaruHSM::C_Initialize(CK_VOID_PTR pInitArgs)
 {
 	CK_C_INITIALIZE_ARGS_PTR args;
 
+	// Threads of our own also need mutexes to work with
+	bool canCreateThreads = false;
+
 	// Check if PKCS#11 is already initialized
 	if (isInitialised)
 	{
@@ -421,6 +468,10 @@ CK_RV MizaruHSM::C_Initialize(CK_VOID_PTR pInitArgs)
 		return CKR_CRYPTOKI_ALREADY_INITIALIZED;
 	}
 
+	// The secure pool may have taken mutexes before the library was
+	// initialised; drop them before the mutex factory is set up
+	SecurePool::reset();
+
 	// Do we have any arguments?
 	if (pInitArgs != NULL_PTR)
 	{
@@ -433,12 +484,13 @@ CK_RV MizaruHSM::C_Initialize(CK_VOID_PTR pInitArgs)
 			return CKR_ARGUMENTS_BAD;
 		}
 
-		// Can we spawn our own threads?
-		// if (args->flags & CKF_LIBRARY_CANT_CREATE_OS_THREADS)
-		// {
-		//	DEBUG_MSG("Cannot create threads if CKF_LIBRARY_CANT_CREATE_OS_THREADS is set");
-		//	return CKR_NEED_TO_CREATE_THREADS;
-		// }
+		// Can we spawn our own threads? If not, we do their work on the
+		// threads of the application
+		canCreateThreads = !(args->flags & CKF_LIBRARY_CANT_CREATE_OS_THREADS);
+		if (!canCreateThreads)
+		{
+			DEBUG_MSG("Not creating threads since CKF_LIBRARY_CANT_CREATE_OS_THREADS is set");
+		}
 
 		// Are we not supplied with mutex functions?
 		if
@@ -460,6 +512,7 @@ CK_RV MizaruHSM::C_Initialize(CK_VOID_PTR pInitArgs)
 			{
 				// The external application is not using threading
 				MutexFactory::i()->disable();
+				canCreateThreads = false;
 			}
 		}
 		else
@@ -501,6 +554,25 @@ CK_RV MizaruHSM::C_Initialize(CK_VOID_PTR pInitArgs)
 		return CKR_GENERAL_ERROR;
 	}
 
+	// (Re)load the configuration; the crypto backend reads it when it is built
+	if (!Configuration::i()->reload(SimpleConfigLoader::i()))
+	{
+		ERROR_MSG("Could not load the configuration");
+		return CKR_GENERAL_ERROR;
+	}
+
+	// Configure the log level
+	if (!setLogLevel(Configuration::i()->getString("log.level", DEFAULT_LOG_LEVEL)))
+	{
+		ERROR_MSG("Could not set the log level");
+		return CKR_GENERAL_ERROR;
+	}
+
+#if defined(WITH_MIZARU)
+	// Without threads of our own, the entropy pool is filled on demand
+	MizaruRNG::setRefillThread(canCreateThreads);
+#endif
+
 	// Build the CryptoFactory
 	if (CryptoFactory::i() == NULL)
 	{
@@ -525,27 +597,40 @@ CK_RV MizaruHSM::C_Initialize(CK_VOID_PTR pInitArgs)
 	}
 #endif
 
-	// (Re)load the configuration
-	if (!Configuration::i()->reload(SimpleConfigLoader::i()))
+	// Configure object store storage backend used by all tokens.
+	if (!ObjectStoreToken::selectBackend(Configuration::i()->getString("objectstore.backend", DEFAULT_OBJECTSTORE_BACKEND)))
 	{
-		ERROR_MSG("Could not load the configuration");
+		ERROR_MSG("Could not set the storage backend");
 		return CKR_GENERAL_ERROR;
 	}
 
-	// Configure the log level
-	if (!setLogLevel(Configuration::i()->getString("log.level", DEFAULT_LOG_LEVEL)))
-	{
-		ERROR_MSG("Could not set the log level");
-		return CKR_GENERAL_ERROR;
-	}
+	// Configure how often the file backend looks for changes made by other processes
+	int checkInterval = Configuration::i()->getInt("objectstore.check_interval", DEFAULT_GENERATION_CHECK_INTERVAL);
+	Generation::setCheckInterval(checkInterval > 0 ? (unsigned long) checkInterval : 0);
 
-	// Configure object store storage backend used by all tokens.
-	if (!ObjectStoreToken::selectBackend(Configuration::i()->getString("objectstore.backend", DEFAULT_OBJECTSTORE_BACKEND)))
+	// Configure how the file and log backends get their writes on disk
+	if (!FileSync::i()->setDurability(Configuration::i()->getString("objectstore.durability", DEFAULT_OBJECTSTORE_DURABILITY)))
 	{
-		ERROR_MSG("Could not set the storage backend");
+		ERROR_MSG("Could not set the durability level");
 		return CKR_GENERAL_ERROR;
 	}
 
+	// Configure how many threads load the tokens and their objects; without
+	// threads of our own, this thread loads them one after the other
+	int loadThreads = Configuration::i()->getInt("objectstore.load_threads", DEFAULT_OBJECTSTORE_LOAD_THREADS);
+	if (!canCreateThreads) loadThreads = 1;
+	ObjectLoader::setThreads(loadThreads > 0 ? (unsigned long) loadThreads : 0);
+
+	// Without threads of our own, the backends do their housekeeping in
+	// the thread that calls them
+	ObjectStoreToken::setBackgroundThreads(canCreateThreads);
+
+	// Configure whether the file backend reads attribute bodies on demand,
+	// and how many kilobytes of them it keeps
+	ObjectFile::setLazyLoading(Configuration::i()->getBool("objectstore.lazy_load", false));
+	int lazyBudget = Configuration::i()->getInt("objectstore.lazy_budget", DEFAULT_OBJECTSTORE_LAZY_BUDGET);
+	BodyCache::i()->setBudget(lazyBudget > 0 ? (size_t) lazyBudget * 1024 : 0);
+
 	sessionObjectStore = new SessionObjectStore();
 
 	// Load the object store
@@ -575,6 +660,18 @@ CK_RV MizaruHSM::C_Initialize(CK_VOID_PTR pInitArgs)
 	// Load the handle manager
 	handleManager = new HandleManager();
 
+	// Load the asynchronous operation manager; without threads of our own,
+	// the operations run when they are submitted
+	int workers = Configuration::i()->getInt("async.workers", DEFAULT_ASYNC_WORKERS);
+	if (workers < 1)
+	{
+		WARNING_MSG("Invalid number of asynchronous workers %i, using %i", workers, DEFAULT_ASYNC_WORKERS);
+
+		workers = DEFAULT_ASYNC_WORKERS;
+	}
+	if (!canCreateThreads) workers = 0;
+	asyncManager = new AsyncManager(workers);
+
 	// Set the state to initialised
 	isInitialised = true;
 
@@ -589,6 +686,9 @@ CK_RV MizaruHSM::C_Finalize(CK_VOID_PTR pReserved)
 	// Must be set to NULL_PTR in this version of PKCS#11
 	if (pReserved != NULL_PTR) return CKR_ARGUMENTS_BAD;
 
+	// Let the running asynchronous operations finish first
+	if (asyncManager != NULL) delete asyncManager;
+	asyncManager = NULL;
 	if (handleManager != NULL) delete handleManager;
 	handleManager = NULL;
 	if (sessionManager != NULL) delete sessionManager;
@@ -600,6 +700,9 @@ CK_RV MizaruHSM::C_Finalize(CK_VOID_PTR pReserved)
 	if (sessionObjectStore != NULL) delete sessionObjectStore;
 	sessionObjectStore = NULL;
 	CryptoFactory::reset();
+	FileSync::reset();
+	BodyCache::reset();
+	SecurePool::reset();
 	SecureMemoryRegistry::reset();
 
 // #if defined(WITH_MIZARU)
@@ -727,6 +830,9 @@ void MizaruHSM::prepareSupportedMecahnisms(std::map<std::string, CK_MECHANISM_TY
 	t["CKM_AES_CBC_PAD"]		= CKM_AES_CBC_PAD;
 	t["CKM_AES_CTR"]		= CKM_AES_CTR;
 	t["CKM_AES_GCM"]		= CKM_AES_GCM;
+#ifdef WITH_MIZARU
+	t["CKM_AES_CCM"]		= CKM_AES_CCM;
+#endif
 	t["CKM_AES_KEY_WRAP"]		= CKM_AES_KEY_WRAP;
 #ifdef HAVE_AES_KEY_WRAP_PAD
 	t["CKM_AES_KEY_WRAP_PAD"]	= CKM_AES_KEY_WRAP_PAD;
@@ -737,6 +843,24 @@ void MizaruHSM::prepareSupportedMecahnisms(std::map<std::string, CK_MECHANISM_TY
 #ifdef WITH_ECC
 	t["CKM_EC_KEY_PAIR_GEN"]	= CKM_EC_KEY_PAIR_GEN;
 	t["CKM_ECDSA"]			= CKM_ECDSA;
+#endif
+#ifdef WITH_MIZARU
+#ifdef WITH_ECC
+	t["CKM_SM2_KEY_PAIR_GEN"]	= CKM_SM2_KEY_PAIR_GEN;
+	t["CKM_SM2"]			= CKM_SM2;
+	t["CKM_SM2_SM3"]		= CKM_SM2_SM3;
+	t["CKM_SM2_ENCRYPT"]		= CKM_SM2_ENCRYPT;
+#endif
+	t["CKM_SM3"]			= CKM_SM3;
+	t["CKM_SM4_KEY_GEN"]		= CKM_SM4_KEY_GEN;
+	t["CKM_SM4_ECB"]		= CKM_SM4_ECB;
+	t["CKM_SM4_CBC"]		= CKM_SM4_CBC;
+	t["CKM_SM4_CBC_PAD"]		= CKM_SM4_CBC_PAD;
+	t["CKM_SM4_OFB"]		= CKM_SM4_OFB;
+	t["CKM_SM4_CTR"]		= CKM_SM4_CTR;
+	t["CKM_ZUC_KEY_GEN"]		= CKM_ZUC_KEY_GEN;
+	t["CKM_ZUC_EEA3"]		= CKM_ZUC_EEA3;
+	t["CKM_ZUC_EIA3"]		= CKM_ZUC_EIA3;
 #endif
 	t["CKM_CONCATENATE_DATA_AND_BASE"] = CKM_CONCATENATE_DATA_AND_BASE;
 	t["CKM_CONCATENATE_BASE_AND_DATA"] = CKM_CONCATENATE_BASE_AND_DATA;
@@ -968,6 +1092,9 @@ CK_RV MizaruHSM::C_GetMechanismInfo(CK_SLOT_ID slotID, CK_MECHANISM_TYPE type, C
 		case CKM_AES_ECB:
 		case CKM_AES_CTR:
 		case CKM_AES_GCM:
+#ifdef WITH_MIZARU
+		case CKM_AES_CCM:
+#endif
 			pInfo->ulMinKeySize = 16;
 			pInfo->ulMaxKeySize = 32;
 			pInfo->flags |= CKF_ENCRYPT | CKF_DECRYPT;
@@ -1014,6 +1141,53 @@ CK_RV MizaruHSM::C_GetMechanismInfo(CK_SLOT_ID slotID, CK_MECHANISM_TYPE type, C
 			pInfo->ulMaxKeySize = ecdsaMaxSize;
 			pInfo->flags = CKF_SIGN | CKF_VERIFY | CKF_EC_COMMOM;
 			break;
+#endif
+#ifdef WITH_MIZARU
+#ifdef WITH_ECC
+		case CKM_SM2_KEY_PAIR_GEN:
+			pInfo->ulMinKeySize = 256;
+			pInfo->ulMaxKeySize = 256;
+			pInfo->flags = CKF_GENERATE_KEY_PAIR | CKF_EC_COMMOM;
+			break;
+		case CKM_SM2:
+		case CKM_SM2_SM3:
+			pInfo->ulMinKeySize = 256;
+			pInfo->ulMaxKeySize = 256;
+			pInfo->flags = CKF_SIGN | CKF_VERIFY | CKF_EC_COMMOM;
+			break;
+		case CKM_SM2_ENCRYPT:
+			pInfo->ulMinKeySize = 256;
+			pInfo->ulMaxKeySize = 256;
+			pInfo->flags = CKF_ENCRYPT | CKF_DECRYPT | CKF_EC_COMMOM;
+			break;
+#endif
+		case CKM_SM3:
+			// Key size is not in use
+			pInfo->ulMinKeySize = 0;
+			pInfo->ulMaxKeySize = 0;
+			pInfo->flags = CKF_DIGEST;
+			break;
+		case CKM_SM4_KEY_GEN:
+		case CKM_ZUC_KEY_GEN:
+			pInfo->ulMinKeySize = 16;
+			pInfo->ulMaxKeySize = 16;
+			pInfo->flags = CKF_GENERATE;
+			break;
+		case CKM_SM4_ECB:
+		case CKM_SM4_CBC:
+		case CKM_SM4_CBC_PAD:
+		case CKM_SM4_OFB:
+		case CKM_SM4_CTR:
+		case CKM_ZUC_EEA3:
+			pInfo->ulMinKeySize = 16;
+			pInfo->ulMaxKeySize = 16;
+			pInfo->flags = CKF_ENCRYPT | CKF_DECRYPT;
+			break;
+		case CKM_ZUC_EIA3:
+			pInfo->ulMinKeySize = 16;
+			pInfo->ulMaxKeySize = 16;
+			pInfo->flags = CKF_SIGN | CKF_VERIFY;
+			break;
 #endif
 	    case CKM_CONCATENATE_DATA_AND_BASE:
 	    case CKM_CONCATENATE_BASE_AND_DATA:
@@ -1135,7 +1309,13 @@ CK_RV MizaruHSM::C_OpenSession(CK_SLOT_ID slotID, CK_FLAGS flags, CK_VOID_PTR pA
 	// Get a pointer to the session object and store it in the handle manager.
 	Session* session = sessionManager->getSession(*phSession);
 	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
-	*phSession = handleManager->addSession(slotID,session);
+	CK_SESSION_HANDLE hSession = handleManager->addSession(slotID,session);
+	if (hSession == CK_INVALID_HANDLE)
+	{
+		sessionManager->closeSession(*phSession);
+		return CKR_SESSION_COUNT;
+	}
+	*phSession = hSession;
 
 	return CKR_OK;
 }
@@ -1149,6 +1329,9 @@ CK_RV MizaruHSM::C_CloseSession(CK_SESSION_HANDLE hSession)
 	Session* session = (Session*)handleManager->getSession(hSession);
 	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
 
+	// Release the asynchronous operations of the session.
+	asyncManager->sessionClosed(hSession);
+
 	// Tell the handle manager the session has been closed.
 	handleManager->sessionClosed(hSession);
 
@@ -1173,6 +1356,9 @@ CK_RV MizaruHSM::C_CloseAllSessions(CK_SLOT_ID slotID)
 	Token* token = slot->getToken();
 	if (token == NULL) return CKR_TOKEN_NOT_PRESENT;
 
+	// Release the asynchronous operations of the sessions.
+	asyncManager->allSessionsClosed(slotID);
+
 	// Tell the handle manager all sessions were closed for the given slotID.
 	// The handle manager should then remove all session and object handles for this slot.
 	handleManager->allSessionsClosed(slotID);
@@ -1298,12 +1484,75 @@ CK_RV MizaruHSM::C_Logout(CK_SESSION_HANDLE hSession)
 	return CKR_OK;
 }
 
+// Add the indexed attributes of a token object to the index of the token;
+// returns false if the object cannot be indexed
+static bool indexTokenObject(Token* token, OSObject* object)
+{
+	// Take the revision first so a concurrent change leaves the entry stale
+	unsigned long revision = object->getRevision();
+	bool isPrivate = object->getBooleanValue(CKA_PRIVATE, true);
+
+	static const CK_ATTRIBUTE_TYPE indexed[] = { CKA_CLASS, CKA_KEY_TYPE, CKA_ID, CKA_LABEL };
+	std::vector<std::pair<CK_ATTRIBUTE_TYPE, ByteString> > values;
+
+	for (size_t i = 0; i < sizeof(indexed) / sizeof(indexed[0]); i++)
+	{
+		if (!object->attributeExists(indexed[i])) continue;
+
+		OSAttribute attr = object->getAttribute(indexed[i]);
+
+		if (ObjectIndex::isUnsignedLong(indexed[i]))
+		{
+			if (!attr.isUnsignedLongAttribute()) return false;
+
+			CK_ULONG value = attr.getUnsignedLongValue();
+			values.push_back(std::make_pair(indexed[i], ByteString((const unsigned char*) &value, sizeof(value))));
+		}
+		else
+		{
+			if (!attr.isByteStringAttribute()) return false;
+
+			ByteString value;
+			if (isPrivate && attr.getByteStringValue().size() != 0)
+			{
+				if (!token->decrypt(attr.getByteStringValue(), value)) return false;
+			}
+			else
+			{
+				value = attr.getByteStringValue();
+			}
+			values.push_back(std::make_pair(indexed[i], value));
+		}
+	}
+
+	token->getObjectIndex()->update(object, revision, values);
+
+	return true;
+}
+
+// Bring the index entries of a token object up to date after it has been
+// created or changed
+static void updateObjectIndex(Token* token, OSObject* object)
+{
+	if (!indexTokenObject(token, object))
+	{
+		// Objects that cannot be indexed are matched in full
+		token->getObjectIndex()->exclude(object);
+	}
+}
+
 // Create a new object on the token in the specified session using the given attribute template
 CK_RV MizaruHSM::C_CreateObject(CK_SESSION_HANDLE hSession, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, CK_OBJECT_HANDLE_PTR phObject)
 {
 	return this->CreateObject(hSession,pTemplate,ulCount,phObject,OBJECT_OP_CREATE);
 }
 
+// Check if the key material of an object is held in a Mizar key slot
+static bool isHardwareResident(OSObject* key)
+{
+	return key->getUnsignedLongValue(CKA_MIZAR_KEY_INDEX, CK_UNAVAILABLE_INFORMATION) != CK_UNAVAILABLE_INFORMATION;
+}
+
 // Create a copy of the object with the specified handle
 CK_RV MizaruHSM::C_CopyObject(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, CK_OBJECT_HANDLE_PTR phNewObject)
 {
@@ -1346,6 +1595,9 @@ CK_RV MizaruHSM::C_CopyObject(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObje
 	CK_BBOOL isCopyable = object->getBooleanValue(CKA_COPYABLE, true);
 	if (!isCopyable) return CKR_ACTION_PROHIBITED;
 
+	// A Mizar key slot belongs to one key object
+	if (isHardwareResident(object)) return CKR_ACTION_PROHIBITED;
+
 	// Extract critical information from the template
 	CK_BBOOL isOnToken = wasOnToken;
 	CK_BBOOL isPrivate = wasPrivate;
@@ -1471,6 +1723,7 @@ CK_RV MizaruHSM::C_CopyObject(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObje
 	// Set handle
 	if (isOnToken)
 	{
+		updateObjectIndex(token, newobject);
 		*phNewObject = handleManager->addTokenObject(slot->getSlotID(), isPrivate != CK_FALSE, newobject);
 	}
 	else
@@ -1517,13 +1770,24 @@ CK_RV MizaruHSM::C_DestroyObject(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hO
 	CK_BBOOL isDestroyable = object->getBooleanValue(CKA_DESTROYABLE, true);
 	if (!isDestroyable) return CKR_ACTION_PROHIBITED;
 
+	CK_KEY_TYPE keyType = object->getUnsignedLongValue(CKA_KEY_TYPE, CKK_VENDOR_DEFINED);
+	CK_ULONG keyIndex = object->getUnsignedLongValue(CKA_MIZAR_KEY_INDEX, CK_UNAVAILABLE_INFORMATION);
+
 	// Tell the handleManager to forget about the object.
 	handleManager->destroyObject(hObject);
 
+	// Drop any decrypted key material and index entries of the object
+	token->getKeyCache()->remove(object);
+	token->getObjectIndex()->remove(object);
+
 	// Destroy the object
 	if (!object->destroyObject())
 		return CKR_FUNCTION_FAILED;
 
+	// The key in the Mizar key slot of the object goes with it
+	if (keyIndex != CK_UNAVAILABLE_INFORMATION && token->ownsKeySlot(keyType, keyIndex))
+		token->removeKeySlot(keyType, keyIndex);
+
 	return CKR_OK;
 }
 
@@ -1646,6 +1910,11 @@ CK_RV MizaruHSM::C_SetAttributeValue(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDL
 	// Ask the P11Object to save the template with attribute values.
 	rv = p11object->saveTemplate(token, isPrivate != CK_FALSE, pTemplate,ulCount,OBJECT_OP_SET);
 	delete p11object;
+
+	// Drop any decrypted key material and index the new values
+	token->getKeyCache()->remove(object);
+	if (isOnToken) updateObjectIndex(token, object);
+
 	return rv;
 }
 
@@ -1663,17 +1932,6 @@ CK_RV MizaruHSM::C_FindObjectsInit(CK_SESSION_HANDLE hSession, CK_ATTRIBUTE_PTR
 	Slot* slot = session->getSlot();
 	if (slot == NULL_PTR) return CKR_GENERAL_ERROR;
 
-	// Determine whether we have a public session or not.
-	bool isPublicSession;
-	switch (session->getState()) {
-		case CKS_RO_USER_FUNCTIONS:
-		case CKS_RW_USER_FUNCTIONS:
-			isPublicSession = false;
-			break;
-		default:
-			isPublicSession = true;
-	}
-
 	// Get the token
 	Token* token = session->getToken();
 	if (token == NULL_PTR) return CKR_GENERAL_ERROR;
@@ -1688,114 +1946,110 @@ CK_RV MizaruHSM::C_FindObjectsInit(CK_SESSION_HANDLE hSession, CK_ATTRIBUTE_PTR
 	if (findOp == NULL_PTR) return CKR_HOST_MEMORY;
 
 	std::set<OSObject*> allObjects;
-	token->getObjects(allObjects);
-	sessionObjectStore->getObjects(slot->getSlotID(),allObjects);
+	std::set<OSObject*> tokenObjects;
+	token->getObjects(tokenObjects);
+
+	// Use the attribute index of the token to narrow down the token objects.
+	// The index follows the objects that are created, changed or destroyed
+	// through this library. Checking the validity picks up the changes of
+	// other processes, which show as a new revision; objects the index has
+	// not seen at their current revision are indexed here and the ones that
+	// were deleted are dropped.
+	if (ObjectIndex::canLookup(pTemplate, ulCount))
+	{
+		ObjectIndex* objectIndex = token->getObjectIndex();
+		std::map<OSObject*, unsigned long> revisions;
+		for (std::set<OSObject*>::iterator i = tokenObjects.begin(); i != tokenObjects.end(); i++)
+		{
+			if ((*i)->isValid()) revisions[*i] = (*i)->getRevision();
+		}
 
-	std::set<CK_OBJECT_HANDLE> handles;
-	std::set<OSObject*>::iterator it;
-	for (it=allObjects.begin(); it != allObjects.end(); ++it)
-	{
-		// Refresh object and check if it is valid
-		if (!(*it)->isValid()) {
-			DEBUG_MSG("Object is not valid, skipping");
-			continue;
+		std::vector<OSObject*> stale;
+		objectIndex->sync(revisions, stale);
+		for (size_t i = 0; i < stale.size(); i++)
+		{
+			updateObjectIndex(token, stale[i]);
 		}
 
-		// Determine if the object has CKA_PRIVATE set to CK_TRUE
-		bool isPrivateObject = (*it)->getBooleanValue(CKA_PRIVATE, true);
+		objectIndex->lookup(pTemplate, ulCount, allObjects);
+	}
+	else
+	{
+		allObjects = tokenObjects;
+	}
 
-		// If the object is private, and we are in a public session then skip it !
-		if (isPublicSession && isPrivateObject)
-			continue; // skip object
+	sessionObjectStore->getObjects(slot->getSlotID(),allObjects);
 
-		// Perform the actual attribute matching.
-		bool bAttrMatch = true; // We let an empty template match everything.
-		for (CK_ULONG i=0; i<ulCount; ++i)
-		{
-			bAttrMatch = false;
+	// The objects are matched as the caller asks for them. Objects that
+	// are destroyed in the meantime are no longer valid and are skipped.
+	findOp->setObjects(allObjects);
+	findOp->setTemplate(pTemplate, ulCount);
 
-			if (!(*it)->attributeExists(pTemplate[i].type))
-				break;
+	session->setFindOp(findOp);
+
+	return CKR_OK;
+}
+
+// Match an object against the attributes in a search template
+static CK_RV matchObject(Token* token, OSObject* object, bool isPrivateObject, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, bool& bAttrMatch)
+{
+	bAttrMatch = true; // We let an empty template match everything.
+	for (CK_ULONG i=0; i<ulCount; ++i)
+	{
+		bAttrMatch = false;
+
+		if (!object->attributeExists(pTemplate[i].type))
+			break;
 
-			OSAttribute attr = (*it)->getAttribute(pTemplate[i].type);
+		OSAttribute attr = object->getAttribute(pTemplate[i].type);
 
-			if (attr.isBooleanAttribute())
+		if (attr.isBooleanAttribute())
+		{
+			if (sizeof(CK_BBOOL) != pTemplate[i].ulValueLen)
+				break;
+			bool bTemplateValue = (*(CK_BBOOL*)pTemplate[i].pValue == CK_TRUE);
+			if (attr.getBooleanValue() != bTemplateValue)
+				break;
+		}
+		else
+		{
+			if (attr.isUnsignedLongAttribute())
 			{
-				if (sizeof(CK_BBOOL) != pTemplate[i].ulValueLen)
+				if (sizeof(CK_ULONG) != pTemplate[i].ulValueLen)
 					break;
-				bool bTemplateValue = (*(CK_BBOOL*)pTemplate[i].pValue == CK_TRUE);
-				if (attr.getBooleanValue() != bTemplateValue)
+				CK_ULONG ulTemplateValue = *(CK_ULONG_PTR)pTemplate[i].pValue;
+				if (attr.getUnsignedLongValue() != ulTemplateValue)
 					break;
 			}
 			else
 			{
-				if (attr.isUnsignedLongAttribute())
-				{
-					if (sizeof(CK_ULONG) != pTemplate[i].ulValueLen)
-						break;
-					CK_ULONG ulTemplateValue = *(CK_ULONG_PTR)pTemplate[i].pValue;
-					if (attr.getUnsignedLongValue() != ulTemplateValue)
-						break;
-				}
-				else
+				if (attr.isByteStringAttribute())
 				{
-					if (attr.isByteStringAttribute())
+					// Compare in place; only private values need a copy
+					ByteString bsAttrValue;
+					ByteStringView attrValue(attr.getByteStringValue());
+					if (isPrivateObject && attrValue.size() != 0)
 					{
-						ByteString bsAttrValue;
-						if (isPrivateObject && attr.getByteStringValue().size() != 0)
+						if (!token->decrypt(attr.getByteStringValue(), bsAttrValue))
 						{
-							if (!token->decrypt(attr.getByteStringValue(), bsAttrValue))
-							{
-								delete findOp;
-								return CKR_GENERAL_ERROR;
-							}
-						}
-						else
-							bsAttrValue = attr.getByteStringValue();
-
-						if (bsAttrValue.size() != pTemplate[i].ulValueLen)
-							break;
-						if (pTemplate[i].ulValueLen != 0)
-						{
-							ByteString bsTemplateValue((const unsigned char*)pTemplate[i].pValue, pTemplate[i].ulValueLen);
-							if (bsAttrValue != bsTemplateValue)
-								break;
+							return CKR_GENERAL_ERROR;
 						}
+						attrValue = ByteStringView(bsAttrValue);
 					}
-					else
+
+					if (attrValue.size() != pTemplate[i].ulValueLen)
+						break;
+					if (attrValue != ByteStringView((const unsigned char*)pTemplate[i].pValue, pTemplate[i].ulValueLen))
 						break;
 				}
+				else
+					break;
 			}
-			// The attribute matched !
-			bAttrMatch = true;
-		}
-
-		if (bAttrMatch)
-		{
-			CK_SLOT_ID slotID = slot->getSlotID();
-			bool isOnToken = (*it)->getBooleanValue(CKA_TOKEN, false);
-			bool isPrivate = (*it)->getBooleanValue(CKA_PRIVATE, true);
-			// Create an object handle for every returned object.
-			CK_OBJECT_HANDLE hObject;
-			if (isOnToken)
-				hObject = handleManager->addTokenObject(slotID,isPrivate,*it);
-			else
-				hObject = handleManager->addSessionObject(slotID,hSession,isPrivate,*it);
-			if (hObject == CK_INVALID_HANDLE)
-			{
-				delete findOp;
-				return CKR_GENERAL_ERROR;
-			}
-			handles.insert(hObject);
 		}
+		// The attribute matched !
+		bAttrMatch = true;
 	}
 
-	// Storing the object handles for the find will protect the library
-	// whenever a stale object handle is used to access the library.
-	findOp->setHandles(handles);
-
-	session->setFindOp(findOp);
-
 	return CKR_OK;
 }
 
@@ -1813,15 +2067,66 @@ CK_RV MizaruHSM::C_FindObjects(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE_PTR
 	// Check if we are doing the correct operation
 	if (session->getOpType() != SESSION_OP_FIND) return CKR_OPERATION_NOT_INITIALIZED;
 
-	// return the object handles that have been added to the find operation.
 	FindOperation *findOp = session->getFindOp();
 	if (findOp == NULL) return CKR_GENERAL_ERROR;
 
-	// Ask the find operation to retrieve the object handles
-	*pulObjectCount = findOp->retrieveHandles(phObject,ulMaxObjectCount);
+	// Get the slot
+	Slot* slot = session->getSlot();
+	if (slot == NULL_PTR) return CKR_GENERAL_ERROR;
+
+	// Get the token
+	Token* token = session->getToken();
+	if (token == NULL_PTR) return CKR_GENERAL_ERROR;
+
+	// Determine whether we have a public session or not.
+	bool isPublicSession;
+	switch (session->getState()) {
+		case CKS_RO_USER_FUNCTIONS:
+		case CKS_RW_USER_FUNCTIONS:
+			isPublicSession = false;
+			break;
+		default:
+			isPublicSession = true;
+	}
+
+	// Match objects until we have enough of them or there are no more
+	CK_SLOT_ID slotID = slot->getSlotID();
+	CK_ULONG ulReturn = 0;
+	OSObject* object;
+	while (ulReturn < ulMaxObjectCount && findOp->nextObject(object))
+	{
+		// Refresh object and check if it is valid
+		if (!object->isValid()) {
+			DEBUG_MSG("Object is not valid, skipping");
+			continue;
+		}
+
+		// Determine if the object has CKA_PRIVATE set to CK_TRUE
+		bool isPrivateObject = object->getBooleanValue(CKA_PRIVATE, true);
+
+		// If the object is private, and we are in a public session then skip it !
+		if (isPublicSession && isPrivateObject)
+			continue; // skip object
+
+		// Perform the actual attribute matching.
+		bool bAttrMatch;
+		CK_RV rv = matchObject(token, object, isPrivateObject, findOp->getTemplate(), findOp->getTemplateCount(), bAttrMatch);
+		if (rv != CKR_OK) return rv;
+		if (!bAttrMatch) continue;
+
+		bool isOnToken = object->getBooleanValue(CKA_TOKEN, false);
+		// Create an object handle for every returned object.
+		CK_OBJECT_HANDLE hObject;
+		if (isOnToken)
+			hObject = handleManager->addTokenObject(slotID,isPrivateObject,object);
+		else
+			hObject = handleManager->addSessionObject(slotID,hSession,isPrivateObject,object);
+		if (hObject == CK_INVALID_HANDLE) return CKR_GENERAL_ERROR;
+
+		phObject[ulReturn++] = hObject;
+	}
 
-	// Erase the object handles from the find operation.
-	findOp->eraseHandles(0,*pulObjectCount);
+	*pulObjectCount = ulReturn;
 
 	return CKR_OK;
 }
@@ -1859,35 +2164,246 @@ static bool isSymMechanism(CK_MECHANISM_PTR pMechanism)
 		case CKM_AES_CBC_PAD:
 		case CKM_AES_CTR:
 		case CKM_AES_GCM:
+		case CKM_AES_CCM:
+#ifdef WITH_MIZARU
+		case CKM_SM4_ECB:
+		case CKM_SM4_CBC:
+		case CKM_SM4_CBC_PAD:
+		case CKM_SM4_OFB:
+		case CKM_SM4_CTR:
+		case CKM_ZUC_EEA3:
+#endif
 			return true;
 		default:
 			return false;
 	}
 }
 
-// SymAlgorithm version of C_EncryptInit
-CK_RV MizaruHSM::SymEncryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey)
+// Create a cipher and a key that use the Mizar key slot of the object
+static CK_RV newIndexedSymmetric(Token* token, OSObject* key, SymAlgo::Type algo, SymMode::Type mode, SymmetricAlgorithm** cipher, SymmetricKey** secretkey)
 {
-	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+#ifdef WITH_MIZARU
+	if (algo != SymAlgo::AES || !MizaruIndexedAES::isSupportedMode(mode))
+	{
+		DEBUG_MSG("Mechanism not supported with a Mizar key slot");
+		return CKR_MECHANISM_INVALID;
+	}
 
-	if (pMechanism == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	CK_ULONG index = key->getUnsignedLongValue(CKA_MIZAR_KEY_INDEX, CK_UNAVAILABLE_INFORMATION);
+	if (!token->ownsKeySlot(CKK_AES, index))
+	{
+		ERROR_MSG("Mizar key slot %lu is not claimed by the token", index);
+		return CKR_KEY_FUNCTION_NOT_PERMITTED;
+	}
 
-	// Get the session
-	Session* session = (Session*)handleManager->getSession(hSession);
-	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
+	MizaruIndexedSymmetricKey* indexedKey = new MizaruIndexedSymmetricKey(algo, index);
+	if (!indexedKey->load())
+	{
+		delete indexedKey;
+		return CKR_GENERAL_ERROR;
+	}
 
-	// Check if we have another operation
-	if (session->getOpType() != SESSION_OP_NONE) return CKR_OPERATION_ACTIVE;
+	*cipher = MizaruCryptoFactory::i()->getIndexedSymmetricAlgorithm(algo);
+	if (*cipher == NULL)
+	{
+		delete indexedKey;
+		return CKR_MECHANISM_INVALID;
+	}
 
-	// Get the token
-	Token* token = session->getToken();
-	if (token == NULL) return CKR_GENERAL_ERROR;
+	*secretkey = indexedKey;
 
-	// Check the key handle.
-	OSObject *key = (OSObject *)handleManager->getObject(hKey);
-	if (key == NULL_PTR || !key->isValid()) return CKR_OBJECT_HANDLE_INVALID;
+	return CKR_OK;
+#else
+	(void) token; (void) key; (void) algo; (void) mode; (void) cipher; (void) secretkey;
 
-	CK_BBOOL isOnToken = key->getBooleanValue(CKA_TOKEN, false);
+	ERROR_MSG("Keys in Mizar key slots need a Mizaru build");
+	return CKR_KEY_FUNCTION_NOT_PERMITTED;
+#endif
+}
+
+// Create an asymmetric algorithm and a private key that use the Mizar key slot of the object
+static CK_RV newIndexedPrivateKey(Token* token, OSObject* key, AsymMech::Type mechanism, bool isSign, AsymmetricAlgorithm** asymCrypto, PrivateKey** privateKey)
+{
+#ifdef WITH_MIZARU
+	CK_KEY_TYPE keyType = key->getUnsignedLongValue(CKA_KEY_TYPE, CKK_VENDOR_DEFINED);
+	AsymAlgo::Type algo;
+	switch (keyType)
+	{
+		case CKK_RSA:
+			algo = AsymAlgo::RSA;
+			break;
+		case CKK_EC:
+			algo = AsymAlgo::ECDSA;
+			break;
+		default:
+			return CKR_KEY_TYPE_INCONSISTENT;
+	}
+
+	if (isSign ? !MizaruIndexedAsymmetricAlgorithm::isSignMechanism(algo, mechanism)
+		   : !MizaruIndexedAsymmetricAlgorithm::isDecryptMechanism(algo, mechanism))
+	{
+		DEBUG_MSG("Mechanism not supported with a Mizar key slot");
+		return CKR_MECHANISM_INVALID;
+	}
+
+	CK_ULONG index = key->getUnsignedLongValue(CKA_MIZAR_KEY_INDEX, CK_UNAVAILABLE_INFORMATION);
+	if (!token->ownsKeySlot(keyType, index))
+	{
+		ERROR_MSG("Mizar key slot %lu is not claimed by the token", index);
+		return CKR_KEY_FUNCTION_NOT_PERMITTED;
+	}
+
+	MizaruIndexedPrivateKey* indexedKey = new MizaruIndexedPrivateKey(algo, index);
+	if (!indexedKey->load())
+	{
+		delete indexedKey;
+		return CKR_GENERAL_ERROR;
+	}
+
+	*asymCrypto = MizaruCryptoFactory::i()->getIndexedAsymmetricAlgorithm(algo);
+	if (*asymCrypto == NULL)
+	{
+		delete indexedKey;
+		return CKR_MECHANISM_INVALID;
+	}
+
+	*privateKey = indexedKey;
+
+	return CKR_OK;
+#else
+	(void) token; (void) key; (void) mechanism; (void) isSign; (void) asymCrypto; (void) privateKey;
+
+	ERROR_MSG("Keys in Mizar key slots need a Mizaru build");
+	return CKR_KEY_FUNCTION_NOT_PERMITTED;
+#endif
+}
+
+// Find the Mizar key slot that a key generation template asks for, if any;
+// such a key is generated on the chip, in a slot claimed by the token
+static CK_RV getRequestedKeySlot(CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, CK_BBOOL isOnToken, CK_ULONG& index)
+{
+	index = CK_UNAVAILABLE_INFORMATION;
+
+	for (CK_ULONG i = 0; i < ulCount; i++)
+	{
+		if (pTemplate[i].type != CKA_MIZAR_KEY_INDEX) continue;
+
+		if (pTemplate[i].pValue == NULL_PTR || pTemplate[i].ulValueLen != sizeof(CK_ULONG))
+		{
+			INFO_MSG("CKA_MIZAR_KEY_INDEX does not have the size of CK_ULONG");
+			return CKR_ATTRIBUTE_VALUE_INVALID;
+		}
+
+		index = *(CK_ULONG*)pTemplate[i].pValue;
+		if (index == CK_UNAVAILABLE_INFORMATION) return CKR_ATTRIBUTE_VALUE_INVALID;
+	}
+
+	if (index == CK_UNAVAILABLE_INFORMATION) return CKR_OK;
+
+#ifdef WITH_MIZARU
+	// The claim on the slot is kept by the token
+	if (!isOnToken)
+	{
+		INFO_MSG("A key in a Mizar key slot must be a token object");
+		return CKR_TEMPLATE_INCONSISTENT;
+	}
+
+	return CKR_OK;
+#else
+	(void) isOnToken;
+
+	ERROR_MSG("Keys in Mizar key slots need a Mizaru build");
+	return CKR_ATTRIBUTE_TYPE_INVALID;
+#endif
+}
+
+// Claim a Mizar key slot for the token and generate an AES key in it
+static CK_RV generateIndexedAES(Token* token, CK_ULONG index, size_t keyLen, SymmetricKey** key)
+{
+#ifdef WITH_MIZARU
+	if (!token->claimKeySlot(CKK_AES, index)) return CKR_ATTRIBUTE_VALUE_INVALID;
+
+	MizaruIndexedSymmetricKey* indexedKey = new MizaruIndexedSymmetricKey(SymAlgo::AES, index);
+	if (!indexedKey->generate(keyLen))
+	{
+		delete indexedKey;
+		token->releaseKeySlot(CKK_AES, index);
+		return CKR_FUNCTION_FAILED;
+	}
+
+	*key = indexedKey;
+
+	return CKR_OK;
+#else
+	(void) token; (void) index; (void) keyLen; (void) key;
+
+	return CKR_GENERAL_ERROR;
+#endif
+}
+
+// Claim a Mizar key slot for the token and generate an RSA key pair in it
+static CK_RV generateIndexedRSA(Token* token, CK_ULONG index, size_t bitLen, const ByteString& exponent, ByteString& modulus)
+{
+#ifdef WITH_MIZARU
+	if (!token->claimKeySlot(CKK_RSA, index)) return CKR_ATTRIBUTE_VALUE_INVALID;
+
+	if (!MizaruIndexedPrivateKey(AsymAlgo::RSA, index).generateRSA(bitLen, exponent, modulus))
+	{
+		token->releaseKeySlot(CKK_RSA, index);
+		return CKR_FUNCTION_FAILED;
+	}
+
+	return CKR_OK;
+#else
+	(void) token; (void) index; (void) bitLen; (void) exponent; (void) modulus;
+
+	return CKR_GENERAL_ERROR;
+#endif
+}
+
+// Claim a Mizar key slot for the token and generate an EC key pair in it
+static CK_RV generateIndexedEC(Token* token, CK_ULONG index, const ByteString& params, ByteString& point)
+{
+#ifdef WITH_MIZARU
+	if (!token->claimKeySlot(CKK_EC, index)) return CKR_ATTRIBUTE_VALUE_INVALID;
+
+	if (!MizaruIndexedPrivateKey(AsymAlgo::ECDSA, index).generateEC(params, point))
+	{
+		token->releaseKeySlot(CKK_EC, index);
+		return CKR_FUNCTION_FAILED;
+	}
+
+	return CKR_OK;
+#else
+	(void) token; (void) index; (void) params; (void) point;
+
+	return CKR_GENERAL_ERROR;
+#endif
+}
+
+// SymAlgorithm version of C_EncryptInit
+CK_RV MizaruHSM::SymEncryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey)
+{
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	if (pMechanism == NULL_PTR) return CKR_ARGUMENTS_BAD;
+
+	// Get the session
+	Session* session = (Session*)handleManager->getSession(hSession);
+	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
+
+	// Check if we have another operation
+	if (session->getOpType() != SESSION_OP_NONE) return CKR_OPERATION_ACTIVE;
+
+	// Get the token
+	Token* token = session->getToken();
+	if (token == NULL) return CKR_GENERAL_ERROR;
+
+	// Check the key handle.
+	OSObject *key = (OSObject *)handleManager->getObject(hKey);
+	if (key == NULL_PTR || !key->isValid()) return CKR_OBJECT_HANDLE_INVALID;
+
+	CK_BBOOL isOnToken = key->getBooleanValue(CKA_TOKEN, false);
 	CK_BBOOL isPrivate = key->getBooleanValue(CKA_PRIVATE, true);
 
 	// Check read user credentials
@@ -2078,23 +2594,117 @@ CK_RV MizaruHSM::SymEncryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMe
 			}
 			tagBytes = tagBytes / 8;
 			break;
+		case CKM_AES_CCM:
+			if (keyType != CKK_AES)
+				return CKR_KEY_TYPE_INCONSISTENT;
+			algo = SymAlgo::AES;
+			mode = SymMode::CCM;
+			if (pMechanism->pParameter == NULL_PTR ||
+			    pMechanism->ulParameterLen != sizeof(CK_CCM_PARAMS))
+			{
+				DEBUG_MSG("CCM mode requires parameters");
+				return CKR_ARGUMENTS_BAD;
+			}
+			iv.resize(CK_CCM_PARAMS_PTR(pMechanism->pParameter)->ulNonceLen);
+			if (CK_CCM_PARAMS_PTR(pMechanism->pParameter)->ulNonceLen > 0)
+				memcpy(&iv[0], CK_CCM_PARAMS_PTR(pMechanism->pParameter)->pNonce, CK_CCM_PARAMS_PTR(pMechanism->pParameter)->ulNonceLen);
+			aad.resize(CK_CCM_PARAMS_PTR(pMechanism->pParameter)->ulAADLen);
+			if (CK_CCM_PARAMS_PTR(pMechanism->pParameter)->ulAADLen > 0)
+				memcpy(&aad[0], CK_CCM_PARAMS_PTR(pMechanism->pParameter)->pAAD, CK_CCM_PARAMS_PTR(pMechanism->pParameter)->ulAADLen);
+			tagBytes = CK_CCM_PARAMS_PTR(pMechanism->pParameter)->ulMACLen;
+			if (tagBytes < 4 || tagBytes > 16 || tagBytes % 2 != 0)
+			{
+				DEBUG_MSG("Invalid ulMACLen value");
+				return CKR_ARGUMENTS_BAD;
+			}
+			break;
+#ifdef WITH_MIZARU
+		case CKM_SM4_ECB:
+			if (keyType != CKK_SM4)
+				return CKR_KEY_TYPE_INCONSISTENT;
+			algo = SymAlgo::SM4;
+			mode = SymMode::ECB;
+			break;
+		case CKM_SM4_CBC:
+		case CKM_SM4_CBC_PAD:
+		case CKM_SM4_OFB:
+			if (keyType != CKK_SM4)
+				return CKR_KEY_TYPE_INCONSISTENT;
+			algo = SymAlgo::SM4;
+			mode = pMechanism->mechanism == CKM_SM4_OFB ? SymMode::OFB : SymMode::CBC;
+			padding = pMechanism->mechanism == CKM_SM4_CBC_PAD;
+			if (pMechanism->pParameter == NULL_PTR ||
+			    pMechanism->ulParameterLen == 0)
+			{
+				DEBUG_MSG("SM4 mode requires an init vector");
+				return CKR_ARGUMENTS_BAD;
+			}
+			iv.resize(pMechanism->ulParameterLen);
+			memcpy(&iv[0], pMechanism->pParameter, pMechanism->ulParameterLen);
+			break;
+		case CKM_SM4_CTR:
+			if (keyType != CKK_SM4)
+				return CKR_KEY_TYPE_INCONSISTENT;
+			algo = SymAlgo::SM4;
+			mode = SymMode::CTR;
+			if (pMechanism->pParameter == NULL_PTR ||
+			    pMechanism->ulParameterLen != sizeof(CK_AES_CTR_PARAMS))
+			{
+				DEBUG_MSG("CTR mode requires a counter block");
+				return CKR_ARGUMENTS_BAD;
+			}
+			counterBits = CK_AES_CTR_PARAMS_PTR(pMechanism->pParameter)->ulCounterBits;
+			if (counterBits == 0 || counterBits > 128)
+			{
+				DEBUG_MSG("Invalid ulCounterBits");
+				return CKR_MECHANISM_PARAM_INVALID;
+			}
+			iv.resize(16);
+			memcpy(&iv[0], CK_AES_CTR_PARAMS_PTR(pMechanism->pParameter)->cb, 16);
+			break;
+		case CKM_ZUC_EEA3:
+			if (keyType != CKK_ZUC)
+				return CKR_KEY_TYPE_INCONSISTENT;
+			algo = SymAlgo::ZUC;
+			if (pMechanism->pParameter == NULL_PTR ||
+			    pMechanism->ulParameterLen != sizeof(CK_ZUC_PARAMS))
+			{
+				DEBUG_MSG("ZUC requires parameters");
+				return CKR_ARGUMENTS_BAD;
+			}
+			// The init vector is COUNT || BEARER || DIRECTION
+			iv.resize(sizeof(CK_ZUC_PARAMS));
+			memcpy(&iv[0], pMechanism->pParameter, sizeof(CK_ZUC_PARAMS));
+			break;
+#endif
 		default:
 			return CKR_MECHANISM_INVALID;
 	}
-	SymmetricAlgorithm* cipher = CryptoFactory::i()->getSymmetricAlgorithm(algo);
-	if (cipher == NULL) return CKR_MECHANISM_INVALID;
+	SymmetricAlgorithm* cipher = NULL;
+	SymmetricKey* secretkey = NULL;
 
-	SymmetricKey* secretkey = new SymmetricKey();
-
-	if (getSymmetricKey(secretkey, token, key) != CKR_OK)
+	if (isHardwareResident(key))
 	{
-		cipher->recycleKey(secretkey);
-		CryptoFactory::i()->recycleSymmetricAlgorithm(cipher);
-		return CKR_GENERAL_ERROR;
+		rv = newIndexedSymmetric(token, key, algo, mode, &cipher, &secretkey);
+		if (rv != CKR_OK) return rv;
 	}
+	else
+	{
+		cipher = CryptoFactory::i()->getSymmetricAlgorithm(algo);
+		if (cipher == NULL) return CKR_MECHANISM_INVALID;
 
-	// adjust key bit length
-	secretkey->setBitLen(secretkey->getKeyBits().size() * bb);
+		secretkey = new SymmetricKey();
+
+		if (getSymmetricKey(secretkey, token, key) != CKR_OK)
+		{
+			cipher->recycleKey(secretkey);
+			CryptoFactory::i()->recycleSymmetricAlgorithm(cipher);
+			return CKR_GENERAL_ERROR;
+		}
+
+		// adjust key bit length
+		secretkey->setBitLen(secretkey->getKeyBits().size() * bb);
+	}
 
 	// Initialize encryption
 	if (!cipher->encryptInit(secretkey, mode, iv, padding, counterBits, aad, tagBytes))
@@ -2181,6 +2791,13 @@ CK_RV MizaruHSM::AsymEncryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pM
 			mechanism = AsymMech::RSA_PKCS_OAEP;
 			isRSA = true;
 			break;
+#if defined(WITH_MIZARU) && defined(WITH_ECC)
+		case CKM_SM2_ENCRYPT:
+			if (keyType != CKK_SM2)
+				return CKR_KEY_TYPE_INCONSISTENT;
+			mechanism = AsymMech::SM2_ENCRYPT;
+			break;
+#endif
 		default:
 			return CKR_MECHANISM_INVALID;
 	}
@@ -2206,6 +2823,27 @@ CK_RV MizaruHSM::AsymEncryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pM
 			return CKR_GENERAL_ERROR;
 		}
 	}
+#ifdef WITH_ECC
+	else if (mechanism == AsymMech::SM2_ENCRYPT)
+	{
+		asymCrypto = CryptoFactory::i()->getAsymmetricAlgorithm(AsymAlgo::SM2);
+		if (asymCrypto == NULL) return CKR_MECHANISM_INVALID;
+
+		publicKey = asymCrypto->newPublicKey();
+		if (publicKey == NULL)
+		{
+			CryptoFactory::i()->recycleAsymmetricAlgorithm(asymCrypto);
+			return CKR_HOST_MEMORY;
+		}
+
+		if (getECPublicKey((ECPublicKey*)publicKey, token, key) != CKR_OK)
+		{
+			asymCrypto->recyclePublicKey(publicKey);
+			CryptoFactory::i()->recycleAsymmetricAlgorithm(asymCrypto);
+			return CKR_GENERAL_ERROR;
+		}
+	}
+#endif
 	else
 	{
 		return CKR_MECHANISM_INVALID;
@@ -2230,6 +2868,10 @@ CK_RV MizaruHSM::C_EncryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMec
 		return AsymEncryptInit(hSession, pMechanism, hKey);
 }
 
+// An SM2 ciphertext is longer than the data by C1, an uncompressed point on
+// the curve, and C3, an SM3 digest
+#define SM2_CIPHERTEXT_OVERHEAD	(65 + 32)
+
 // SymAlgorithm version of C_Encrypt
 static CK_RV SymEncrypt(Session* session, CK_BYTE_PTR pData, CK_ULONG ulDataLen, CK_BYTE_PTR pEncryptedData, CK_ULONG_PTR pulEncryptedDataLen)
 {
@@ -2322,6 +2964,8 @@ static CK_RV AsymEncrypt(Session* session, CK_BYTE_PTR pData, CK_ULONG ulDataLen
 
 	// Size of the encrypted data
 	CK_ULONG size = publicKey->getOutputLength();
+	if (mechanism == AsymMech::SM2_ENCRYPT)
+		size = ulDataLen + SM2_CIPHERTEXT_OVERHEAD;
 
 	if (pEncryptedData == NULL_PTR)
 	{
@@ -2808,23 +3452,117 @@ CK_RV MizaruHSM::SymDecryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMe
 			}
 			tagBytes = tagBytes / 8;
 			break;
+		case CKM_AES_CCM:
+			if (keyType != CKK_AES)
+				return CKR_KEY_TYPE_INCONSISTENT;
+			algo = SymAlgo::AES;
+			mode = SymMode::CCM;
+			if (pMechanism->pParameter == NULL_PTR ||
+			    pMechanism->ulParameterLen != sizeof(CK_CCM_PARAMS))
+			{
+				DEBUG_MSG("CCM mode requires parameters");
+				return CKR_ARGUMENTS_BAD;
+			}
+			iv.resize(CK_CCM_PARAMS_PTR(pMechanism->pParameter)->ulNonceLen);
+			if (CK_CCM_PARAMS_PTR(pMechanism->pParameter)->ulNonceLen > 0)
+				memcpy(&iv[0], CK_CCM_PARAMS_PTR(pMechanism->pParameter)->pNonce, CK_CCM_PARAMS_PTR(pMechanism->pParameter)->ulNonceLen);
+			aad.resize(CK_CCM_PARAMS_PTR(pMechanism->pParameter)->ulAADLen);
+			if (CK_CCM_PARAMS_PTR(pMechanism->pParameter)->ulAADLen > 0)
+				memcpy(&aad[0], CK_CCM_PARAMS_PTR(pMechanism->pParameter)->pAAD, CK_CCM_PARAMS_PTR(pMechanism->pParameter)->ulAADLen);
+			tagBytes = CK_CCM_PARAMS_PTR(pMechanism->pParameter)->ulMACLen;
+			if (tagBytes < 4 || tagBytes > 16 || tagBytes % 2 != 0)
+			{
+				DEBUG_MSG("Invalid ulMACLen value");
+				return CKR_ARGUMENTS_BAD;
+			}
+			break;
+#ifdef WITH_MIZARU
+		case CKM_SM4_ECB:
+			if (keyType != CKK_SM4)
+				return CKR_KEY_TYPE_INCONSISTENT;
+			algo = SymAlgo::SM4;
+			mode = SymMode::ECB;
+			break;
+		case CKM_SM4_CBC:
+		case CKM_SM4_CBC_PAD:
+		case CKM_SM4_OFB:
+			if (keyType != CKK_SM4)
+				return CKR_KEY_TYPE_INCONSISTENT;
+			algo = SymAlgo::SM4;
+			mode = pMechanism->mechanism == CKM_SM4_OFB ? SymMode::OFB : SymMode::CBC;
+			padding = pMechanism->mechanism == CKM_SM4_CBC_PAD;
+			if (pMechanism->pParameter == NULL_PTR ||
+			    pMechanism->ulParameterLen == 0)
+			{
+				DEBUG_MSG("SM4 mode requires an init vector");
+				return CKR_ARGUMENTS_BAD;
+			}
+			iv.resize(pMechanism->ulParameterLen);
+			memcpy(&iv[0], pMechanism->pParameter, pMechanism->ulParameterLen);
+			break;
+		case CKM_SM4_CTR:
+			if (keyType != CKK_SM4)
+				return CKR_KEY_TYPE_INCONSISTENT;
+			algo = SymAlgo::SM4;
+			mode = SymMode::CTR;
+			if (pMechanism->pParameter == NULL_PTR ||
+			    pMechanism->ulParameterLen != sizeof(CK_AES_CTR_PARAMS))
+			{
+				DEBUG_MSG("CTR mode requires a counter block");
+				return CKR_ARGUMENTS_BAD;
+			}
+			counterBits = CK_AES_CTR_PARAMS_PTR(pMechanism->pParameter)->ulCounterBits;
+			if (counterBits == 0 || counterBits > 128)
+			{
+				DEBUG_MSG("Invalid ulCounterBits");
+				return CKR_MECHANISM_PARAM_INVALID;
+			}
+			iv.resize(16);
+			memcpy(&iv[0], CK_AES_CTR_PARAMS_PTR(pMechanism->pParameter)->cb, 16);
+			break;
+		case CKM_ZUC_EEA3:
+			if (keyType != CKK_ZUC)
+				return CKR_KEY_TYPE_INCONSISTENT;
+			algo = SymAlgo::ZUC;
+			if (pMechanism->pParameter == NULL_PTR ||
+			    pMechanism->ulParameterLen != sizeof(CK_ZUC_PARAMS))
+			{
+				DEBUG_MSG("ZUC requires parameters");
+				return CKR_ARGUMENTS_BAD;
+			}
+			// The init vector is COUNT || BEARER || DIRECTION
+			iv.resize(sizeof(CK_ZUC_PARAMS));
+			memcpy(&iv[0], pMechanism->pParameter, sizeof(CK_ZUC_PARAMS));
+			break;
+#endif
 		default:
 			return CKR_MECHANISM_INVALID;
 	}
-	SymmetricAlgorithm* cipher = CryptoFactory::i()->getSymmetricAlgorithm(algo);
-	if (cipher == NULL) return CKR_MECHANISM_INVALID;
+	SymmetricAlgorithm* cipher = NULL;
+	SymmetricKey* secretkey = NULL;
 
-	SymmetricKey* secretkey = new SymmetricKey();
-
-	if (getSymmetricKey(secretkey, token, key) != CKR_OK)
+	if (isHardwareResident(key))
 	{
-		cipher->recycleKey(secretkey);
-		CryptoFactory::i()->recycleSymmetricAlgorithm(cipher);
-		return CKR_GENERAL_ERROR;
+		rv = newIndexedSymmetric(token, key, algo, mode, &cipher, &secretkey);
+		if (rv != CKR_OK) return rv;
 	}
+	else
+	{
+		cipher = CryptoFactory::i()->getSymmetricAlgorithm(algo);
+		if (cipher == NULL) return CKR_MECHANISM_INVALID;
 
-	// adjust key bit length
-	secretkey->setBitLen(secretkey->getKeyBits().size() * bb);
+		secretkey = new SymmetricKey();
+
+		if (getSymmetricKey(secretkey, token, key) != CKR_OK)
+		{
+			cipher->recycleKey(secretkey);
+			CryptoFactory::i()->recycleSymmetricAlgorithm(cipher);
+			return CKR_GENERAL_ERROR;
+		}
+
+		// adjust key bit length
+		secretkey->setBitLen(secretkey->getKeyBits().size() * bb);
+	}
 
 	// Initialize decryption
 	if (!cipher->decryptInit(secretkey, mode, iv, padding, counterBits, aad, tagBytes))
@@ -2928,13 +3666,25 @@ CK_RV MizaruHSM::AsymDecryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pM
 			mechanism = AsymMech::RSA_PKCS_OAEP;
 			isRSA = true;
 			break;
+#if defined(WITH_MIZARU) && defined(WITH_ECC)
+		case CKM_SM2_ENCRYPT:
+			if (keyType != CKK_SM2)
+				return CKR_KEY_TYPE_INCONSISTENT;
+			mechanism = AsymMech::SM2_ENCRYPT;
+			break;
+#endif
 		default:
 			return CKR_MECHANISM_INVALID;
 	}
 
 	AsymmetricAlgorithm* asymCrypto = NULL;
 	PrivateKey* privateKey = NULL;
-	if (isRSA)
+	if (isHardwareResident(key))
+	{
+		rv = newIndexedPrivateKey(token, key, mechanism, false, &asymCrypto, &privateKey);
+		if (rv != CKR_OK) return rv;
+	}
+	else if (isRSA)
 	{
 		asymCrypto = CryptoFactory::i()->getAsymmetricAlgorithm(AsymAlgo::RSA);
 		if (asymCrypto == NULL) return CKR_MECHANISM_INVALID;
@@ -2953,6 +3703,27 @@ CK_RV MizaruHSM::AsymDecryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pM
 			return CKR_GENERAL_ERROR;
 		}
 	}
+#ifdef WITH_ECC
+	else if (mechanism == AsymMech::SM2_ENCRYPT)
+	{
+		asymCrypto = CryptoFactory::i()->getAsymmetricAlgorithm(AsymAlgo::SM2);
+		if (asymCrypto == NULL) return CKR_MECHANISM_INVALID;
+
+		privateKey = asymCrypto->newPrivateKey();
+		if (privateKey == NULL)
+		{
+			CryptoFactory::i()->recycleAsymmetricAlgorithm(asymCrypto);
+			return CKR_HOST_MEMORY;
+		}
+
+		if (getECPrivateKey((ECPrivateKey*)privateKey, token, key) != CKR_OK)
+		{
+			asymCrypto->recyclePrivateKey(privateKey);
+			CryptoFactory::i()->recycleAsymmetricAlgorithm(asymCrypto);
+			return CKR_GENERAL_ERROR;
+		}
+	}
+#endif
 	else
 	{
 		return CKR_MECHANISM_INVALID;
@@ -3074,6 +3845,15 @@ static CK_RV AsymDecrypt(Session* session, CK_BYTE_PTR pEncryptedData, CK_ULONG
 
 	// Size of the data
 	CK_ULONG size = privateKey->getOutputLength();
+	if (mechanism == AsymMech::SM2_ENCRYPT)
+	{
+		if (ulEncryptedDataLen <= SM2_CIPHERTEXT_OVERHEAD)
+		{
+			session->resetOp();
+			return CKR_ENCRYPTED_DATA_LEN_RANGE;
+		}
+		size = ulEncryptedDataLen - SM2_CIPHERTEXT_OVERHEAD;
+	}
 	if (pData == NULL_PTR)
 	{
 		*pulDataLen = size;
@@ -3364,6 +4144,11 @@ CK_RV MizaruHSM::C_DigestInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMech
 		case CKM_SHA256:
 			algo = HashAlgo::SHA256;
 			break;
+#ifdef WITH_MIZARU
+		case CKM_SM3:
+			algo = HashAlgo::SM3;
+			break;
+#endif
 		default:
 			return CKR_MECHANISM_INVALID;
 	}
@@ -3515,7 +4300,8 @@ CK_RV MizaruHSM::C_DigestKey(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObjec
 	    algo != HashAlgo::SHA224 &&
 	    algo != HashAlgo::SHA256 &&
 	    algo != HashAlgo::SHA384 &&
-	    algo != HashAlgo::SHA512)
+	    algo != HashAlgo::SHA512 &&
+	    algo != HashAlgo::SM3)
 	{
 		// Parano...
 		if (!key->getBooleanValue(CKA_EXTRACTABLE, false))
@@ -3609,6 +4395,9 @@ static bool isMacMechanism(CK_MECHANISM_PTR pMechanism)
 		case CKM_SHA256_HMAC:
 		case CKM_DES3_CMAC:
 		case CKM_AES_CMAC:
+#ifdef WITH_MIZARU
+		case CKM_ZUC_EIA3:
+#endif
 			return true;
 		default:
 			return false;
@@ -3684,12 +4473,35 @@ CK_RV MizaruHSM::MacSignInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMecha
 				return CKR_KEY_TYPE_INCONSISTENT;
 			algo = MacAlgo::CMAC_AES;
 			break;
+#ifdef WITH_MIZARU
+		case CKM_ZUC_EIA3:
+			if (keyType != CKK_ZUC)
+				return CKR_KEY_TYPE_INCONSISTENT;
+			if (pMechanism->pParameter == NULL_PTR ||
+			    pMechanism->ulParameterLen != sizeof(CK_ZUC_PARAMS))
+			{
+				DEBUG_MSG("ZUC requires parameters");
+				return CKR_ARGUMENTS_BAD;
+			}
+			algo = MacAlgo::ZUC_EIA3;
+			break;
+#endif
 		default:
 			return CKR_MECHANISM_INVALID;
 	}
 	MacAlgorithm* mac = CryptoFactory::i()->getMacAlgorithm(algo);
 	if (mac == NULL) return CKR_MECHANISM_INVALID;
 
+#ifdef WITH_MIZARU
+	// The init vector is COUNT || BEARER || DIRECTION
+	if (algo == MacAlgo::ZUC_EIA3 &&
+	    !((MizaruZUCMac*) mac)->setIV(ByteString((unsigned char*) pMechanism->pParameter, sizeof(CK_ZUC_PARAMS))))
+	{
+		CryptoFactory::i()->recycleMacAlgorithm(mac);
+		return CKR_MECHANISM_PARAM_INVALID;
+	}
+#endif
+
 	SymmetricKey* privkey = new SymmetricKey();
 
 	if (getSymmetricKey(privkey, token, key) != CKR_OK)
@@ -3779,6 +4591,7 @@ CK_RV MizaruHSM::AsymSignInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMech
 	bool isRSA = false;
 #ifdef WITH_ECC
 	bool isECDSA = false;
+	bool isSM2 = false;
 #endif
 	switch(pMechanism->mechanism) {
 		case CKM_RSA_PKCS:
@@ -3802,14 +4615,42 @@ CK_RV MizaruHSM::AsymSignInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMech
 			bAllowMultiPartOp = false;
 			isECDSA = true;
 			break;
+#ifdef WITH_MIZARU
+		case CKM_SM2:
+			mechanism = AsymMech::SM2;
+			bAllowMultiPartOp = false;
+			isSM2 = true;
+			break;
+		case CKM_SM2_SM3:
+			// The optional parameter is the signer ID
+			mechanism = AsymMech::SM2_SM3;
+			bAllowMultiPartOp = true;
+			isSM2 = true;
+			if (pMechanism->pParameter != NULL_PTR && pMechanism->ulParameterLen > 0)
+			{
+				param = pMechanism->pParameter;
+				paramLen = pMechanism->ulParameterLen;
+			}
+			break;
+#endif
 #endif
 		default:
 			return CKR_MECHANISM_INVALID;
 	}
 
+#ifdef WITH_ECC
+	if (isSM2 != (key->getUnsignedLongValue(CKA_KEY_TYPE, CKK_VENDOR_DEFINED) == CKK_SM2))
+		return CKR_KEY_TYPE_INCONSISTENT;
+#endif
+
 	AsymmetricAlgorithm* asymCrypto = NULL;
 	PrivateKey* privateKey = NULL;
-	if (isRSA)
+	if (isHardwareResident(key))
+	{
+		rv = newIndexedPrivateKey(token, key, mechanism, true, &asymCrypto, &privateKey);
+		if (rv != CKR_OK) return rv;
+	}
+	else if (isRSA)
 	{
 		asymCrypto = CryptoFactory::i()->getAsymmetricAlgorithm(AsymAlgo::RSA);
 		if (asymCrypto == NULL) return CKR_MECHANISM_INVALID;
@@ -3841,6 +4682,25 @@ CK_RV MizaruHSM::AsymSignInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMech
 			return CKR_HOST_MEMORY;
 		}
 
+		if (getECPrivateKey((ECPrivateKey*)privateKey, token, key) != CKR_OK)
+		{
+			asymCrypto->recyclePrivateKey(privateKey);
+			CryptoFactory::i()->recycleAsymmetricAlgorithm(asymCrypto);
+			return CKR_GENERAL_ERROR;
+		}
+	}
+	else if (isSM2)
+	{
+		asymCrypto = CryptoFactory::i()->getAsymmetricAlgorithm(AsymAlgo::SM2);
+		if (asymCrypto == NULL) return CKR_MECHANISM_INVALID;
+
+		privateKey = asymCrypto->newPrivateKey();
+		if (privateKey == NULL)
+		{
+			CryptoFactory::i()->recycleAsymmetricAlgorithm(asymCrypto);
+			return CKR_HOST_MEMORY;
+		}
+
 		if (getECPrivateKey((ECPrivateKey*)privateKey, token, key) != CKR_OK)
 		{
 			asymCrypto->recyclePrivateKey(privateKey);
@@ -3989,7 +4849,11 @@ static CK_RV AsymSign(Session* session, CK_BYTE_PTR pData, CK_ULONG ulDataLen, C
 		data.wipe(size-ulDataLen);
 	}
 
-	data += ByteString(pData, ulDataLen);
+	// Append the input in place rather than through a temporary copy
+	size_t offset = data.size();
+	data.resize(offset + ulDataLen);
+	if (ulDataLen > 0)
+		memcpy(data.byte_str() + offset, pData, ulDataLen);
 	ByteString signature;
 
 	// Sign the data
@@ -4341,12 +5205,35 @@ CK_RV MizaruHSM::MacVerifyInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMec
 				return CKR_KEY_TYPE_INCONSISTENT;
 			algo = MacAlgo::CMAC_AES;
 			break;
+#ifdef WITH_MIZARU
+		case CKM_ZUC_EIA3:
+			if (keyType != CKK_ZUC)
+				return CKR_KEY_TYPE_INCONSISTENT;
+			if (pMechanism->pParameter == NULL_PTR ||
+			    pMechanism->ulParameterLen != sizeof(CK_ZUC_PARAMS))
+			{
+				DEBUG_MSG("ZUC requires parameters");
+				return CKR_ARGUMENTS_BAD;
+			}
+			algo = MacAlgo::ZUC_EIA3;
+			break;
+#endif
 		default:
 			return CKR_MECHANISM_INVALID;
 	}
 	MacAlgorithm* mac = CryptoFactory::i()->getMacAlgorithm(algo);
 	if (mac == NULL) return CKR_MECHANISM_INVALID;
 
+#ifdef WITH_MIZARU
+	// The init vector is COUNT || BEARER || DIRECTION
+	if (algo == MacAlgo::ZUC_EIA3 &&
+	    !((MizaruZUCMac*) mac)->setIV(ByteString((unsigned char*) pMechanism->pParameter, sizeof(CK_ZUC_PARAMS))))
+	{
+		CryptoFactory::i()->recycleMacAlgorithm(mac);
+		return CKR_MECHANISM_PARAM_INVALID;
+	}
+#endif
+
 	SymmetricKey* pubkey = new SymmetricKey();
 
 	if (getSymmetricKey(pubkey, token, key) != CKR_OK)
@@ -4436,6 +5323,7 @@ CK_RV MizaruHSM::AsymVerifyInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMe
 	bool isRSA = false;
 #ifdef WITH_ECC
 	bool isECDSA = false;
+	bool isSM2 = false;
 #endif
 	switch(pMechanism->mechanism) {
 		case CKM_RSA_PKCS:
@@ -4459,11 +5347,34 @@ CK_RV MizaruHSM::AsymVerifyInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMe
 			bAllowMultiPartOp = false;
 			isECDSA = true;
 			break;
+#ifdef WITH_MIZARU
+		case CKM_SM2:
+			mechanism = AsymMech::SM2;
+			bAllowMultiPartOp = false;
+			isSM2 = true;
+			break;
+		case CKM_SM2_SM3:
+			// The optional parameter is the signer ID
+			mechanism = AsymMech::SM2_SM3;
+			bAllowMultiPartOp = true;
+			isSM2 = true;
+			if (pMechanism->pParameter != NULL_PTR && pMechanism->ulParameterLen > 0)
+			{
+				param = pMechanism->pParameter;
+				paramLen = pMechanism->ulParameterLen;
+			}
+			break;
+#endif
 #endif
 		default:
 			return CKR_MECHANISM_INVALID;
 	}
 
+#ifdef WITH_ECC
+	if (isSM2 != (key->getUnsignedLongValue(CKA_KEY_TYPE, CKK_VENDOR_DEFINED) == CKK_SM2))
+		return CKR_KEY_TYPE_INCONSISTENT;
+#endif
+
 	AsymmetricAlgorithm* asymCrypto = NULL;
 	PublicKey* publicKey = NULL;
 	if (isRSA)
@@ -4498,6 +5409,25 @@ CK_RV MizaruHSM::AsymVerifyInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMe
 			return CKR_HOST_MEMORY;
 		}
 
+		if (getECPublicKey((ECPublicKey*)publicKey, token, key) != CKR_OK)
+		{
+			asymCrypto->recyclePublicKey(publicKey);
+			CryptoFactory::i()->recycleAsymmetricAlgorithm(asymCrypto);
+			return CKR_GENERAL_ERROR;
+		}
+	}
+	else if (isSM2)
+	{
+		asymCrypto = CryptoFactory::i()->getAsymmetricAlgorithm(AsymAlgo::SM2);
+		if (asymCrypto == NULL) return CKR_MECHANISM_INVALID;
+
+		publicKey = asymCrypto->newPublicKey();
+		if (publicKey == NULL)
+		{
+			CryptoFactory::i()->recycleAsymmetricAlgorithm(asymCrypto);
+			return CKR_HOST_MEMORY;
+		}
+
 		if (getECPublicKey((ECPublicKey*)publicKey, token, key) != CKR_OK)
 		{
 			asymCrypto->recyclePublicKey(publicKey);
@@ -4943,6 +5873,16 @@ CK_RV MizaruHSM::C_GenerateKey(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMec
 			objClass = CKO_SECRET_KEY;
 			keyType = CKK_GENERIC_SECRET;
 			break;
+#ifdef WITH_MIZARU
+		case CKM_SM4_KEY_GEN:
+			objClass = CKO_SECRET_KEY;
+			keyType = CKK_SM4;
+			break;
+		case CKM_ZUC_KEY_GEN:
+			objClass = CKO_SECRET_KEY;
+			keyType = CKK_ZUC;
+			break;
+#endif
 		default:
 			return CKR_MECHANISM_INVALID;
 	}
@@ -4975,6 +5915,12 @@ CK_RV MizaruHSM::C_GenerateKey(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMec
 	if (pMechanism->mechanism == CKM_GENERIC_SECRET_KEY_GEN &&
 	    (objClass != CKO_SECRET_KEY || keyType != CKK_GENERIC_SECRET))
 		return CKR_TEMPLATE_INCONSISTENT;
+	if (pMechanism->mechanism == CKM_SM4_KEY_GEN &&
+	    (objClass != CKO_SECRET_KEY || keyType != CKK_SM4))
+		return CKR_TEMPLATE_INCONSISTENT;
+	if (pMechanism->mechanism == CKM_ZUC_KEY_GEN &&
+	    (objClass != CKO_SECRET_KEY || keyType != CKK_ZUC))
+		return CKR_TEMPLATE_INCONSISTENT;
 
 	// Check authorization
 	CK_RV rv = haveWrite(session->getState(), isOnToken, isPrivate);
@@ -5018,6 +5964,12 @@ CK_RV MizaruHSM::C_GenerateKey(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMec
 		return this->generateGeneric(hSession, pTemplate, ulCount, phKey, isOnToken, isPrivate);
 	}
 
+	// Generate SM4 or ZUC secret key
+	if (pMechanism->mechanism == CKM_SM4_KEY_GEN || pMechanism->mechanism == CKM_ZUC_KEY_GEN)
+	{
+		return this->generateGM(hSession, pTemplate, ulCount, phKey, isOnToken, isPrivate, keyType);
+	}
+
 	return CKR_GENERAL_ERROR;
 }
 
@@ -5057,6 +6009,11 @@ CK_RV MizaruHSM::C_GenerateKeyPair
 		case CKM_EC_KEY_PAIR_GEN:
 			keyType = CKK_EC;
 			break;
+#ifdef WITH_MIZARU
+		case CKM_SM2_KEY_PAIR_GEN:
+			keyType = CKK_SM2;
+			break;
+#endif
 #endif
 		default:
 			return CKR_MECHANISM_INVALID;
@@ -5077,6 +6034,8 @@ CK_RV MizaruHSM::C_GenerateKeyPair
 		return CKR_TEMPLATE_INCONSISTENT;
 	if (pMechanism->mechanism == CKM_EC_KEY_PAIR_GEN && keyType != CKK_EC)
 		return CKR_TEMPLATE_INCONSISTENT;
+	if (pMechanism->mechanism == CKM_SM2_KEY_PAIR_GEN && keyType != CKK_SM2)
+		return CKR_TEMPLATE_INCONSISTENT;
 
 	// Extract information from the private key template that is needed to create the object.
 	CK_OBJECT_CLASS privateKeyClass = CKO_PRIVATE_KEY;
@@ -5092,6 +6051,8 @@ CK_RV MizaruHSM::C_GenerateKeyPair
 		return CKR_TEMPLATE_INCONSISTENT;
 	if (pMechanism->mechanism == CKM_EC_KEY_PAIR_GEN && keyType != CKK_EC)
 		return CKR_TEMPLATE_INCONSISTENT;
+	if (pMechanism->mechanism == CKM_SM2_KEY_PAIR_GEN && keyType != CKK_SM2)
+		return CKR_TEMPLATE_INCONSISTENT;
 
 	// Check user credentials
 	CK_RV rv = haveWrite(session->getState(), ispublicKeyToken || isprivateKeyToken, ispublicKeyPrivate || isprivateKeyPrivate);
@@ -5115,14 +6076,15 @@ CK_RV MizaruHSM::C_GenerateKeyPair
 									 ispublicKeyToken, ispublicKeyPrivate, isprivateKeyToken, isprivateKeyPrivate);
 	}
 
-	// Generate EC keys
-	if (pMechanism->mechanism == CKM_EC_KEY_PAIR_GEN)
+	// Generate EC or SM2 keys
+	if (pMechanism->mechanism == CKM_EC_KEY_PAIR_GEN || pMechanism->mechanism == CKM_SM2_KEY_PAIR_GEN)
 	{
 			return this->generateEC(hSession,
 									 pPublicKeyTemplate, ulPublicKeyAttributeCount,
 									 pPrivateKeyTemplate, ulPrivateKeyAttributeCount,
 									 phPublicKey, phPrivateKey,
-									 ispublicKeyToken, ispublicKeyPrivate, isprivateKeyToken, isprivateKeyPrivate);
+									 ispublicKeyToken, ispublicKeyPrivate, isprivateKeyToken, isprivateKeyPrivate,
+									 keyType);
 	}
 
 	return CKR_GENERAL_ERROR;
@@ -5589,6 +6551,7 @@ CK_RV MizaruHSM::C_WrapKey
 				break;
 #ifdef WITH_ECC
 			case CKK_EC:
+			case CKK_SM2:
 				// can be ecdh too but it doesn't matter
 				alg = AsymAlgo::ECDSA;
 				break;
@@ -5613,6 +6576,7 @@ CK_RV MizaruHSM::C_WrapKey
 				break;
 #ifdef WITH_ECC
 			case CKK_EC:
+			case CKK_SM2:
 				rv = getECPrivateKey((ECPrivateKey*)privateKey, token, key);
 				break;
 #endif
@@ -6094,7 +7058,7 @@ CK_RV MizaruHSM::C_UnwrapKey
 				bOK = bOK && setRSAPrivateKey(osobject, keydata, token, isPrivate != CK_FALSE);
 			}
 #ifdef WITH_ECC
-			else if (keyType == CKK_EC)
+			else if (keyType == CKK_EC || keyType == CKK_SM2)
 			{
 				bOK = bOK && setECPrivateKey(osobject, keydata, token, isPrivate != CK_FALSE);
 			}
@@ -6338,7 +7302,7 @@ CK_RV MizaruHSM::C_GenerateRandom(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pRando
 	return CKR_OK;
 }
 
-// Legacy function
+// Legacy function; tells if the session has asynchronous operations running
 CK_RV MizaruHSM::C_GetFunctionStatus(CK_SESSION_HANDLE hSession)
 {
 	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
@@ -6347,36 +7311,562 @@ CK_RV MizaruHSM::C_GetFunctionStatus(CK_SESSION_HANDLE hSession)
 	Session* session = (Session*)handleManager->getSession(hSession);
 	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
 
+	if (asyncManager->getPending(hSession) > 0) return CKR_MIZARU_PENDING;
+
 	return CKR_FUNCTION_NOT_PARALLEL;
 }
 
-// Legacy function
-CK_RV MizaruHSM::C_CancelFunction(CK_SESSION_HANDLE hSession)
-{
-	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+// Legacy function; cancels the queued asynchronous operations of the session
+CK_RV MizaruHSM::C_CancelFunction(CK_SESSION_HANDLE hSession)
+{
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	// Get the session
+	Session* session = (Session*)handleManager->getSession(hSession);
+	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
+
+	if (asyncManager->getPending(hSession) == 0) return CKR_FUNCTION_NOT_PARALLEL;
+
+	asyncManager->cancel(hSession);
+
+	return CKR_OK;
+}
+
+// Wait or poll for a slot event on the specified slot
+CK_RV MizaruHSM::C_WaitForSlotEvent(CK_FLAGS flags, CK_SLOT_ID_PTR /*pSlot*/, CK_VOID_PTR /*pReserved*/)
+{
+	if (!(flags & CKF_DONT_BLOCK)) return CKR_FUNCTION_NOT_SUPPORTED;
+
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	// MizaruHSM slots don't change after it's initialised. With the
+	// exception of when a slot is initialised and then getSlotList() is
+	// called. However, at this point the caller has been updated with the
+	// new slot list already so no event needs to be triggered.
+	return CKR_NO_EVENT;
+}
+
+// Verify a batch of independent single part signatures. The batch does not
+// use the operation state of the session.
+CK_RV MizaruHSM::C_VerifyBatch
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_ULONG ulCount,
+	CK_OBJECT_HANDLE_PTR phKeys,
+	CK_BYTE_PTR* ppData,
+	CK_ULONG_PTR pulDataLen,
+	CK_BYTE_PTR* ppSignature,
+	CK_ULONG_PTR pulSignatureLen,
+	CK_RV* pResults
+)
+{
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	if (pMechanism == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if (ulCount > 0 &&
+	    (phKeys == NULL_PTR || ppData == NULL_PTR || pulDataLen == NULL_PTR ||
+	     ppSignature == NULL_PTR || pulSignatureLen == NULL_PTR || pResults == NULL_PTR))
+	{
+		return CKR_ARGUMENTS_BAD;
+	}
+
+	// Get the session
+	Session* session = (Session*)handleManager->getSession(hSession);
+	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
+
+	// Get the token
+	Token* token = session->getToken();
+	if (token == NULL) return CKR_GENERAL_ERROR;
+
+	AsymMech::Type mechanism;
+	AsymAlgo::Type algorithm;
+	switch (pMechanism->mechanism)
+	{
+#ifdef WITH_ECC
+		case CKM_ECDSA:
+			mechanism = AsymMech::ECDSA;
+			algorithm = AsymAlgo::ECDSA;
+			break;
+#endif
+		default:
+			return CKR_MECHANISM_INVALID;
+	}
+
+	AsymmetricAlgorithm* asymCrypto = CryptoFactory::i()->getAsymmetricAlgorithm(algorithm);
+	if (asymCrypto == NULL) return CKR_MECHANISM_INVALID;
+
+	// The keys are looked up once, V2X bursts often reuse them
+	std::map<CK_OBJECT_HANDLE, PublicKey*> keys;
+	std::map<CK_OBJECT_HANDLE, CK_RV> keyErrors;
+	std::vector<AsymVerifyItem> items;
+	std::vector<CK_ULONG> positions;
+
+	for (CK_ULONG i = 0; i < ulCount; i++)
+	{
+		if (ppData[i] == NULL_PTR || ppSignature[i] == NULL_PTR)
+		{
+			pResults[i] = CKR_ARGUMENTS_BAD;
+			continue;
+		}
+
+		CK_OBJECT_HANDLE hKey = phKeys[i];
+
+		if (keys.find(hKey) == keys.end() && keyErrors.find(hKey) == keyErrors.end())
+		{
+			CK_RV rv = CKR_OK;
+			OSObject* key = (OSObject*)handleManager->getObject(hKey);
+
+			if (key == NULL_PTR || !key->isValid())
+			{
+				rv = CKR_OBJECT_HANDLE_INVALID;
+			}
+			else
+			{
+				CK_BBOOL isOnToken = key->getBooleanValue(CKA_TOKEN, false);
+				CK_BBOOL isPrivate = key->getBooleanValue(CKA_PRIVATE, true);
+
+				// Check read user credentials
+				rv = haveRead(session->getState(), isOnToken, isPrivate);
+			}
+
+			// Check if key can be used for verifying with the mechanism
+			if (rv == CKR_OK && !key->getBooleanValue(CKA_VERIFY, false))
+				rv = CKR_KEY_FUNCTION_NOT_PERMITTED;
+			if (rv == CKR_OK && !isMechanismPermitted(key, pMechanism))
+				rv = CKR_MECHANISM_INVALID;
+			if (rv == CKR_OK &&
+			    (key->getUnsignedLongValue(CKA_CLASS, CKO_VENDOR_DEFINED) != CKO_PUBLIC_KEY ||
+			     key->getUnsignedLongValue(CKA_KEY_TYPE, CKK_VENDOR_DEFINED) != CKK_EC))
+				rv = CKR_KEY_TYPE_INCONSISTENT;
+
+			PublicKey* publicKey = NULL;
+			if (rv == CKR_OK)
+			{
+				publicKey = asymCrypto->newPublicKey();
+				if (publicKey == NULL)
+				{
+					rv = CKR_HOST_MEMORY;
+				}
+#ifdef WITH_ECC
+				else if (getECPublicKey((ECPublicKey*)publicKey, token, key) != CKR_OK)
+				{
+					asymCrypto->recyclePublicKey(publicKey);
+					rv = CKR_GENERAL_ERROR;
+				}
+#endif
+			}
+
+			if (rv == CKR_OK)
+				keys[hKey] = publicKey;
+			else
+				keyErrors[hKey] = rv;
+		}
+
+		if (keyErrors.find(hKey) != keyErrors.end())
+		{
+			pResults[i] = keyErrors[hKey];
+			continue;
+		}
+
+		PublicKey* publicKey = keys[hKey];
+
+		if (pulSignatureLen[i] != publicKey->getOutputLength())
+		{
+			pResults[i] = CKR_SIGNATURE_LEN_RANGE;
+			continue;
+		}
+
+		AsymVerifyItem item;
+		item.publicKey = publicKey;
+		item.data = ByteString(ppData[i], pulDataLen[i]);
+		item.signature = ByteString(ppSignature[i], pulSignatureLen[i]);
+		item.valid = false;
+
+		items.push_back(item);
+		positions.push_back(i);
+	}
+
+	CK_RV rv = CKR_OK;
+
+	if (!items.empty() && !asymCrypto->verifyBatch(items, mechanism))
+	{
+		rv = CKR_FUNCTION_FAILED;
+	}
+
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		if (rv != CKR_OK)
+			pResults[positions[i]] = rv;
+		else
+			pResults[positions[i]] = items[i].valid ? CKR_OK : CKR_SIGNATURE_INVALID;
+	}
+
+	for (std::map<CK_OBJECT_HANDLE, PublicKey*>::iterator it = keys.begin(); it != keys.end(); ++it)
+	{
+		asymCrypto->recyclePublicKey(it->second);
+	}
+	CryptoFactory::i()->recycleAsymmetricAlgorithm(asymCrypto);
+
+	return rv;
+}
+
+// Queue a single part signature
+CK_RV MizaruHSM::C_SignAsync(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey, CK_BYTE_PTR pData, CK_ULONG ulDataLen, CK_ULONG_PTR pulTicket)
+{
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	if (pData == NULL_PTR) return CKR_ARGUMENTS_BAD;
+
+	ByteString data(pData, ulDataLen);
+
+	return submitAsync(hSession, pMechanism, pulTicket,
+		[this, hKey, data](CK_SESSION_HANDLE hWorker, CK_MECHANISM_PTR pWorkerMechanism, ByteString& output)
+	{
+		CK_RV rv = C_SignInit(hWorker, pWorkerMechanism, hKey);
+		if (rv != CKR_OK) return rv;
+
+		ByteString in(data);
+		CK_ULONG ulSignatureLen = 0;
+
+		// Get the size first
+		rv = C_Sign(hWorker, in.byte_str(), in.size(), NULL_PTR, &ulSignatureLen);
+		if (rv != CKR_OK) return rv;
+
+		output.resize(ulSignatureLen);
+		rv = C_Sign(hWorker, in.byte_str(), in.size(), output.byte_str(), &ulSignatureLen);
+		output.resize(ulSignatureLen);
+
+		return rv;
+	});
+}
+
+// Queue a single part verification
+CK_RV MizaruHSM::C_VerifyAsync(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey, CK_BYTE_PTR pData, CK_ULONG ulDataLen, CK_BYTE_PTR pSignature, CK_ULONG ulSignatureLen, CK_ULONG_PTR pulTicket)
+{
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	if (pData == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if (pSignature == NULL_PTR) return CKR_ARGUMENTS_BAD;
+
+	ByteString data(pData, ulDataLen);
+	ByteString signature(pSignature, ulSignatureLen);
+
+	return submitAsync(hSession, pMechanism, pulTicket,
+		[this, hKey, data, signature](CK_SESSION_HANDLE hWorker, CK_MECHANISM_PTR pWorkerMechanism, ByteString& /*output*/)
+	{
+		CK_RV rv = C_VerifyInit(hWorker, pWorkerMechanism, hKey);
+		if (rv != CKR_OK) return rv;
+
+		ByteString in(data);
+		ByteString sig(signature);
+
+		return C_Verify(hWorker, in.byte_str(), in.size(), sig.byte_str(), sig.size());
+	});
+}
+
+// Queue a single part encryption
+CK_RV MizaruHSM::C_EncryptAsync(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey, CK_BYTE_PTR pData, CK_ULONG ulDataLen, CK_ULONG_PTR pulTicket)
+{
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	if (pData == NULL_PTR) return CKR_ARGUMENTS_BAD;
+
+	ByteString data(pData, ulDataLen);
+
+	return submitAsync(hSession, pMechanism, pulTicket,
+		[this, hKey, data](CK_SESSION_HANDLE hWorker, CK_MECHANISM_PTR pWorkerMechanism, ByteString& output)
+	{
+		CK_RV rv = C_EncryptInit(hWorker, pWorkerMechanism, hKey);
+		if (rv != CKR_OK) return rv;
+
+		ByteString in(data);
+		CK_ULONG ulEncryptedDataLen = 0;
+
+		// Get the size first
+		rv = C_Encrypt(hWorker, in.byte_str(), in.size(), NULL_PTR, &ulEncryptedDataLen);
+		if (rv != CKR_OK) return rv;
+
+		output.resize(ulEncryptedDataLen);
+		rv = C_Encrypt(hWorker, in.byte_str(), in.size(), output.byte_str(), &ulEncryptedDataLen);
+		output.resize(ulEncryptedDataLen);
+
+		return rv;
+	});
+}
+
+// Collect the result of a queued operation if it has completed
+CK_RV MizaruHSM::C_PollAsync(CK_SESSION_HANDLE hSession, CK_ULONG ulTicket, CK_BYTE_PTR pOutput, CK_ULONG_PTR pulOutputLen)
+{
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	// Get the session
+	Session* session = (Session*)handleManager->getSession(hSession);
+	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
+
+	return asyncManager->poll(hSession, ulTicket, pOutput, pulOutputLen);
+}
+
+// Wait for the result of a queued operation
+CK_RV MizaruHSM::C_WaitAsync(CK_SESSION_HANDLE hSession, CK_ULONG ulTicket, CK_ULONG ulTimeout, CK_BYTE_PTR pOutput, CK_ULONG_PTR pulOutputLen)
+{
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	// Get the session
+	Session* session = (Session*)handleManager->getSession(hSession);
+	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
+
+	return asyncManager->wait(hSession, ulTicket, ulTimeout, pOutput, pulOutputLen);
+}
+
+// Return the routing of an operation of the Mizaru backend
+CK_RV MizaruHSM::C_GetOffloadInfo(CK_ULONG ulOperation, CK_MIZARU_OFFLOAD_INFO_PTR pInfo)
+{
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+#ifdef WITH_MIZARU
+	if (pInfo == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if (ulOperation >= MizaruOffload::OPERATION_COUNT) return CKR_ARGUMENTS_BAD;
+
+	MizaruOffload* offload = MizaruOffload::i();
+	MizaruOffload::Operation op = (MizaruOffload::Operation) ulOperation;
+
+	memset(pInfo, 0, sizeof(*pInfo));
+	strncpy((char*) pInfo->name, MizaruOffload::getName(op), sizeof(pInfo->name) - 1);
+	pInfo->crossover = offload->getCrossover(op);
+	pInfo->ulChipCount = offload->getCount(op, MizaruOffload::CHIP);
+	pInfo->ulSoftwareCount = offload->getCount(op, MizaruOffload::SOFTWARE);
+	pInfo->ulFallbackCount = offload->getCount(op, MizaruOffload::FALLBACK);
+
+	return CKR_OK;
+#else
+	(void) ulOperation;
+	(void) pInfo;
+
+	return CKR_FUNCTION_NOT_SUPPORTED;
+#endif
+}
+
+// Queue an operation that runs in a session of its own on the slot of the
+// given session, so that many operations can be in flight at once
+CK_RV MizaruHSM::submitAsync(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_ULONG_PTR pulTicket, const AsyncOperation& operation)
+{
+	if (pMechanism == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if (pulTicket == NULL_PTR) return CKR_ARGUMENTS_BAD;
+
+	// Get the session
+	Session* session = (Session*)handleManager->getSession(hSession);
+	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
+
+	CK_SLOT_ID slotID = session->getSlot()->getSlotID();
+	bool isRW = session->isRW();
+
+	// The caller may free the mechanism as soon as we return
+	AsyncMechanism mechanism;
+	CK_RV rv = mechanism.set(pMechanism);
+	if (rv != CKR_OK) return rv;
+
+	AsyncManager::Job job = [this, slotID, isRW, mechanism, operation](ByteString& output)
+	{
+		Slot* slot = slotManager->getSlot(slotID);
+		if (slot == NULL) return (CK_RV) CKR_SLOT_ID_INVALID;
+
+		// The worker session is not one of the application's, so the
+		// session manager does not count it and C_CloseAllSessions does
+		// not free it
+		Session* worker = new Session(slot, isRW, NULL_PTR, NULL_PTR);
+		CK_SESSION_HANDLE hWorker = handleManager->addSession(slotID, worker);
+		if (hWorker == CK_INVALID_HANDLE)
+		{
+			delete worker;
+			return (CK_RV) CKR_SESSION_COUNT;
+		}
+
+		AsyncMechanism workerMechanism(mechanism);
+		CK_RV rv = operation(hWorker, workerMechanism.get(), output);
+
+		handleManager->sessionClosed(hWorker);
+		delete worker;
+
+		return rv;
+	};
+
+	return asyncManager->submit(slotID, hSession, job, pulTicket);
+}
+
+CK_RV MizaruHSM::generateGeneric
+(CK_SESSION_HANDLE hSession,
+	CK_ATTRIBUTE_PTR pTemplate,
+	CK_ULONG ulCount,
+	CK_OBJECT_HANDLE_PTR phKey,
+	CK_BBOOL isOnToken,
+	CK_BBOOL isPrivate)
+{
+	*phKey = CK_INVALID_HANDLE;
+
+	// Get the session
+	Session* session = (Session*)handleManager->getSession(hSession);
+	if (session == NULL)
+		return CKR_SESSION_HANDLE_INVALID;
+
+	// Get the token
+	Token* token = session->getToken();
+	if (token == NULL)
+		return CKR_GENERAL_ERROR;
+
+	// Extract desired parameter information
+	size_t keyLen = 0;
+	bool checkValue = true;
+	for (CK_ULONG i = 0; i < ulCount; i++)
+	{
+		switch (pTemplate[i].type)
+		{
+			case CKA_VALUE_LEN:
+				if (pTemplate[i].ulValueLen != sizeof(CK_ULONG))
+				{
+					INFO_MSG("CKA_VALUE_LEN does not have the size of CK_ULONG");
+					return CKR_ATTRIBUTE_VALUE_INVALID;
+				}
+				keyLen = *(CK_ULONG*)pTemplate[i].pValue;
+				break;
+			case CKA_CHECK_VALUE:
+				if (pTemplate[i].ulValueLen > 0)
+				{
+					INFO_MSG("CKA_CHECK_VALUE must be a no-value (0 length) entry");
+					return CKR_ATTRIBUTE_VALUE_INVALID;
+				}
+				checkValue = false;
+				break;
+			default:
+				break;
+		}
+	}
+
+	// CKA_VALUE_LEN must be specified
+	if (keyLen == 0)
+	{
+		INFO_MSG("Missing CKA_VALUE_LEN in pTemplate");
+		return CKR_TEMPLATE_INCOMPLETE;
+	}
+
+	// Check keyLen
+	if (keyLen < 1 || keyLen > 0x8000000)
+	{
+		INFO_MSG("bad generic key length");
+		return CKR_ATTRIBUTE_VALUE_INVALID;
+	}
+
+	// Generate the secret key
+	RNG* rng = CryptoFactory::i()->getRNG();
+	if (rng == NULL) return CKR_GENERAL_ERROR;
+	ByteString key;
+	if (!rng->generateRandom(key, keyLen)) return CKR_GENERAL_ERROR;
+
+        CK_RV rv = CKR_OK;
+
+	// Create the secret key object using C_CreateObject
+	const CK_ULONG maxAttribs = 32;
+	CK_OBJECT_CLASS objClass = CKO_SECRET_KEY;
+	CK_KEY_TYPE keyType = CKK_GENERIC_SECRET;
+	CK_ATTRIBUTE keyAttribs[maxAttribs] = {
+		{ CKA_CLASS, &objClass, sizeof(objClass) },
+		{ CKA_TOKEN, &isOnToken, sizeof(isOnToken) },
+		{ CKA_PRIVATE, &isPrivate, sizeof(isPrivate) },
+		{ CKA_KEY_TYPE, &keyType, sizeof(keyType) },
+	};
+	CK_ULONG keyAttribsCount = 4;
+
+	// Add the additional
+	if (ulCount > (maxAttribs - keyAttribsCount))
+		rv = CKR_TEMPLATE_INCONSISTENT;
+	for (CK_ULONG i=0; i < ulCount && rv == CKR_OK; ++i)
+	{
+		switch (pTemplate[i].type)
+		{
+			case CKA_CLASS:
+			case CKA_TOKEN:
+			case CKA_PRIVATE:
+			case CKA_KEY_TYPE:
+			case CKA_CHECK_VALUE:
+				continue;
+			default:
+				keyAttribs[keyAttribsCount++] = pTemplate[i];
+				break;
+		}
+	}
+
+	if (rv == CKR_OK)
+		rv = CreateObject(hSession, keyAttribs, keyAttribsCount, phKey, OBJECT_OP_GENERATE);
+
+	// Store the attributes that are being supplied
+	if (rv == CKR_OK)
+	{
+		OSObject* osobject = (OSObject*)handleManager->getObject(*phKey);
+		if (osobject == NULL_PTR || !osobject->isValid()) {
+			rv = CKR_FUNCTION_FAILED;
+		} else if (osobject->startTransaction()) {
+			bool bOK = true;
+
+			// Common Attributes
+			bOK = bOK && osobject->setAttribute(CKA_LOCAL,true);
+			CK_ULONG ulKeyGenMechanism = (CK_ULONG)CKM_GENERIC_SECRET_KEY_GEN;
+			bOK = bOK && osobject->setAttribute(CKA_KEY_GEN_MECHANISM,ulKeyGenMechanism);
+
+			// Common Secret Key Attributes
+			bool bAlwaysSensitive = osobject->getBooleanValue(CKA_SENSITIVE, false);
+			bOK = bOK && osobject->setAttribute(CKA_ALWAYS_SENSITIVE,bAlwaysSensitive);
+			bool bNeverExtractable = osobject->getBooleanValue(CKA_EXTRACTABLE, false) == false;
+			bOK = bOK && osobject->setAttribute(CKA_NEVER_EXTRACTABLE, bNeverExtractable);
 
-	// Get the session
-	Session* session = (Session*)handleManager->getSession(hSession);
-	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
+			// Generic Secret Key Attributes
+			ByteString value;
+			ByteString kcv;
+			SymmetricKey symKey;
+			symKey.setKeyBits(key);
+			symKey.setBitLen(keyLen);
+			if (isPrivate)
+			{
+				token->encrypt(symKey.getKeyBits(), value);
+				token->encrypt(symKey.getKeyCheckValue(), kcv);
+			}
+			else
+			{
+				value = symKey.getKeyBits();
+				kcv = symKey.getKeyCheckValue();
+			}
+			bOK = bOK && osobject->setAttribute(CKA_VALUE, value);
+			if (checkValue)
+				bOK = bOK && osobject->setAttribute(CKA_CHECK_VALUE, kcv);
 
-	return CKR_FUNCTION_NOT_PARALLEL;
-}
+			if (bOK)
+				bOK = osobject->commitTransaction();
+			else
+				osobject->abortTransaction();
 
-// Wait or poll for a slot event on the specified slot
-CK_RV MizaruHSM::C_WaitForSlotEvent(CK_FLAGS flags, CK_SLOT_ID_PTR /*pSlot*/, CK_VOID_PTR /*pReserved*/)
-{
-	if (!(flags & CKF_DONT_BLOCK)) return CKR_FUNCTION_NOT_SUPPORTED;
+			if (!bOK)
+				rv = CKR_FUNCTION_FAILED;
+		} else
+			rv = CKR_FUNCTION_FAILED;
+	}
 
-	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+	// Clean up
+	// Remove the key that may have been created already when the function fails.
+	if (rv != CKR_OK)
+	{
+		if (*phKey != CK_INVALID_HANDLE)
+		{
+			OSObject* oskey = (OSObject*)handleManager->getObject(*phKey);
+			handleManager->destroyObject(*phKey);
+			if (oskey) oskey->destroyObject();
+			*phKey = CK_INVALID_HANDLE;
+		}
+	}
 
-	// MizaruHSM slots don't change after it's initialised. With the
-	// exception of when a slot is initialised and then getSlotList() is
-	// called. However, at this point the caller has been updated with the
-	// new slot list already so no event needs to be triggered.
-	return CKR_NO_EVENT;
+	return rv;
 }
 
-CK_RV MizaruHSM::generateGeneric
+// Generate an AES secret key
+CK_RV MizaruHSM::generateAES
 (CK_SESSION_HANDLE hSession,
 	CK_ATTRIBUTE_PTR pTemplate,
 	CK_ULONG ulCount,
@@ -6431,25 +7921,60 @@ CK_RV MizaruHSM::generateGeneric
 		return CKR_TEMPLATE_INCOMPLETE;
 	}
 
-	// Check keyLen
-	if (keyLen < 1 || keyLen > 0x8000000)
+	// keyLen must be 16, 24, or 32
+	if (keyLen != 16 && keyLen != 24 && keyLen != 32)
 	{
-		INFO_MSG("bad generic key length");
+		INFO_MSG("bad AES key length");
 		return CKR_ATTRIBUTE_VALUE_INVALID;
 	}
 
-	// Generate the secret key
-	RNG* rng = CryptoFactory::i()->getRNG();
-	if (rng == NULL) return CKR_GENERAL_ERROR;
-	ByteString key;
-	if (!rng->generateRandom(key, keyLen)) return CKR_GENERAL_ERROR;
+	// A key asked for in a Mizar key slot is generated on the chip
+	CK_ULONG keyIndex;
+	CK_RV rv = getRequestedKeySlot(pTemplate, ulCount, isOnToken, keyIndex);
+	if (rv != CKR_OK)
+		return rv;
 
-        CK_RV rv = CKR_OK;
+	// Generate the secret key
+	SymmetricKey* key = NULL;
+	SymmetricAlgorithm* aes = CryptoFactory::i()->getSymmetricAlgorithm(SymAlgo::AES);
+	if (aes == NULL)
+	{
+		ERROR_MSG("Could not get SymmetricAlgorithm");
+		return CKR_GENERAL_ERROR;
+	}
+	if (keyIndex != CK_UNAVAILABLE_INFORMATION)
+	{
+		rv = generateIndexedAES(token, keyIndex, keyLen, &key);
+		if (rv != CKR_OK)
+		{
+			CryptoFactory::i()->recycleSymmetricAlgorithm(aes);
+			return rv;
+		}
+	}
+	else
+	{
+		key = new AESKey(keyLen * 8);
+		RNG* rng = CryptoFactory::i()->getRNG();
+		if (rng == NULL)
+		{
+			ERROR_MSG("Could not get RNG");
+			aes->recycleKey(key);
+			CryptoFactory::i()->recycleSymmetricAlgorithm(aes);
+			return CKR_GENERAL_ERROR;
+		}
+		if (!aes->generateKey(*key, rng))
+		{
+			ERROR_MSG("Could not generate AES secret key");
+			aes->recycleKey(key);
+			CryptoFactory::i()->recycleSymmetricAlgorithm(aes);
+			return CKR_GENERAL_ERROR;
+		}
+	}
 
 	// Create the secret key object using C_CreateObject
 	const CK_ULONG maxAttribs = 32;
 	CK_OBJECT_CLASS objClass = CKO_SECRET_KEY;
-	CK_KEY_TYPE keyType = CKK_GENERIC_SECRET;
+	CK_KEY_TYPE keyType = CKK_AES;
 	CK_ATTRIBUTE keyAttribs[maxAttribs] = {
 		{ CKA_CLASS, &objClass, sizeof(objClass) },
 		{ CKA_TOKEN, &isOnToken, sizeof(isOnToken) },
@@ -6470,28 +7995,31 @@ CK_RV MizaruHSM::generateGeneric
 			case CKA_PRIVATE:
 			case CKA_KEY_TYPE:
 			case CKA_CHECK_VALUE:
+			case CKA_MIZAR_KEY_INDEX:
 				continue;
-			default:
-				keyAttribs[keyAttribsCount++] = pTemplate[i];
-				break;
+		default:
+			keyAttribs[keyAttribsCount++] = pTemplate[i];
 		}
 	}
 
 	if (rv == CKR_OK)
-		rv = CreateObject(hSession, keyAttribs, keyAttribsCount, phKey, OBJECT_OP_GENERATE);
+		rv = this->CreateObject(hSession, keyAttribs, keyAttribsCount, phKey,OBJECT_OP_GENERATE);
 
 	// Store the attributes that are being supplied
 	if (rv == CKR_OK)
 	{
 		OSObject* osobject = (OSObject*)handleManager->getObject(*phKey);
-		if (osobject == NULL_PTR || !osobject->isValid()) {
+		if (osobject == NULL_PTR || !osobject->isValid()) 
+        {
 			rv = CKR_FUNCTION_FAILED;
-		} else if (osobject->startTransaction()) {
+		} 
+        else if (osobject->startTransaction()) 
+        {
 			bool bOK = true;
 
 			// Common Attributes
 			bOK = bOK && osobject->setAttribute(CKA_LOCAL,true);
-			CK_ULONG ulKeyGenMechanism = (CK_ULONG)CKM_GENERIC_SECRET_KEY_GEN;
+			CK_ULONG ulKeyGenMechanism = (CK_ULONG)CKM_AES_KEY_GEN;
 			bOK = bOK && osobject->setAttribute(CKA_KEY_GEN_MECHANISM,ulKeyGenMechanism);
 
 			// Common Secret Key Attributes
@@ -6500,23 +8028,28 @@ CK_RV MizaruHSM::generateGeneric
 			bool bNeverExtractable = osobject->getBooleanValue(CKA_EXTRACTABLE, false) == false;
 			bOK = bOK && osobject->setAttribute(CKA_NEVER_EXTRACTABLE, bNeverExtractable);
 
-			// Generic Secret Key Attributes
+			// AES Secret Key Attributes
 			ByteString value;
 			ByteString kcv;
-			SymmetricKey symKey;
-			symKey.setKeyBits(key);
-			symKey.setBitLen(keyLen);
 			if (isPrivate)
 			{
-				token->encrypt(symKey.getKeyBits(), value);
-				token->encrypt(symKey.getKeyCheckValue(), kcv);
+				token->encrypt(key->getKeyBits(), value);
+				token->encrypt(key->getKeyCheckValue(), kcv);
 			}
 			else
 			{
-				value = symKey.getKeyBits();
-				kcv = symKey.getKeyCheckValue();
+				value = key->getKeyBits();
+				kcv = key->getKeyCheckValue();
+			}
+			if (keyIndex != CK_UNAVAILABLE_INFORMATION)
+			{
+				// The key material stays in the Mizar key slot
+				bOK = bOK && osobject->setAttribute(CKA_MIZAR_KEY_INDEX, keyIndex);
+			}
+			else
+			{
+				bOK = bOK && osobject->setAttribute(CKA_VALUE, value);
 			}
-			bOK = bOK && osobject->setAttribute(CKA_VALUE, value);
 			if (checkValue)
 				bOK = bOK && osobject->setAttribute(CKA_CHECK_VALUE, kcv);
 
@@ -6532,6 +8065,9 @@ CK_RV MizaruHSM::generateGeneric
 	}
 
 	// Clean up
+	aes->recycleKey(key);
+	CryptoFactory::i()->recycleSymmetricAlgorithm(aes);
+
 	// Remove the key that may have been created already when the function fails.
 	if (rv != CKR_OK)
 	{
@@ -6542,19 +8078,23 @@ CK_RV MizaruHSM::generateGeneric
 			if (oskey) oskey->destroyObject();
 			*phKey = CK_INVALID_HANDLE;
 		}
+
+		if (keyIndex != CK_UNAVAILABLE_INFORMATION)
+			token->removeKeySlot(CKK_AES, keyIndex);
 	}
 
 	return rv;
 }
 
-// Generate an AES secret key
-CK_RV MizaruHSM::generateAES
+// Generate an SM4 or a ZUC secret key
+CK_RV MizaruHSM::generateGM
 (CK_SESSION_HANDLE hSession,
 	CK_ATTRIBUTE_PTR pTemplate,
 	CK_ULONG ulCount,
 	CK_OBJECT_HANDLE_PTR phKey,
 	CK_BBOOL isOnToken,
-	CK_BBOOL isPrivate)
+	CK_BBOOL isPrivate,
+	CK_KEY_TYPE keyType)
 {
 	*phKey = CK_INVALID_HANDLE;
 
@@ -6570,7 +8110,6 @@ CK_RV MizaruHSM::generateAES
 
 	// Extract desired parameter information
 	size_t keyLen = 0;
-	bool checkValue = true;
 	for (CK_ULONG i = 0; i < ulCount; i++)
 	{
 		switch (pTemplate[i].type)
@@ -6589,7 +8128,6 @@ CK_RV MizaruHSM::generateAES
 					INFO_MSG("CKA_CHECK_VALUE must be a no-value (0 length) entry");
 					return CKR_ATTRIBUTE_VALUE_INVALID;
 				}
-				checkValue = false;
 				break;
 			default:
 				break;
@@ -6603,17 +8141,17 @@ CK_RV MizaruHSM::generateAES
 		return CKR_TEMPLATE_INCOMPLETE;
 	}
 
-	// keyLen must be 16, 24, or 32
-	if (keyLen != 16 && keyLen != 24 && keyLen != 32)
+	// Both ciphers have 128-bit keys
+	if (keyLen != 16)
 	{
-		INFO_MSG("bad AES key length");
+		INFO_MSG("CKA_VALUE_LEN must be 16");
 		return CKR_ATTRIBUTE_VALUE_INVALID;
 	}
 
 	// Generate the secret key
-	AESKey* key = new AESKey(keyLen * 8);
-	SymmetricAlgorithm* aes = CryptoFactory::i()->getSymmetricAlgorithm(SymAlgo::AES);
-	if (aes == NULL)
+	SymmetricKey* key = new SymmetricKey(keyLen * 8);
+	SymmetricAlgorithm* cipher = CryptoFactory::i()->getSymmetricAlgorithm(keyType == CKK_SM4 ? SymAlgo::SM4 : SymAlgo::ZUC);
+	if (cipher == NULL)
 	{
 		ERROR_MSG("Could not get SymmetricAlgorithm");
 		delete key;
@@ -6623,15 +8161,15 @@ CK_RV MizaruHSM::generateAES
 	if (rng == NULL)
 	{
 		ERROR_MSG("Could not get RNG");
-		aes->recycleKey(key);
-		CryptoFactory::i()->recycleSymmetricAlgorithm(aes);
+		cipher->recycleKey(key);
+		CryptoFactory::i()->recycleSymmetricAlgorithm(cipher);
 		return CKR_GENERAL_ERROR;
 	}
-	if (!aes->generateKey(*key, rng))
+	if (!cipher->generateKey(*key, rng))
 	{
-		ERROR_MSG("Could not generate AES secret key");
-		aes->recycleKey(key);
-		CryptoFactory::i()->recycleSymmetricAlgorithm(aes);
+		ERROR_MSG("Could not generate secret key");
+		cipher->recycleKey(key);
+		CryptoFactory::i()->recycleSymmetricAlgorithm(cipher);
 		return CKR_GENERAL_ERROR;
 	}
 
@@ -6640,7 +8178,6 @@ CK_RV MizaruHSM::generateAES
 	// Create the secret key object using C_CreateObject
 	const CK_ULONG maxAttribs = 32;
 	CK_OBJECT_CLASS objClass = CKO_SECRET_KEY;
-	CK_KEY_TYPE keyType = CKK_AES;
 	CK_ATTRIBUTE keyAttribs[maxAttribs] = {
 		{ CKA_CLASS, &objClass, sizeof(objClass) },
 		{ CKA_TOKEN, &isOnToken, sizeof(isOnToken) },
@@ -6674,17 +8211,17 @@ CK_RV MizaruHSM::generateAES
 	if (rv == CKR_OK)
 	{
 		OSObject* osobject = (OSObject*)handleManager->getObject(*phKey);
-		if (osobject == NULL_PTR || !osobject->isValid()) 
-        {
+		if (osobject == NULL_PTR || !osobject->isValid())
+		{
 			rv = CKR_FUNCTION_FAILED;
-		} 
-        else if (osobject->startTransaction()) 
-        {
+		}
+		else if (osobject->startTransaction())
+		{
 			bool bOK = true;
 
 			// Common Attributes
 			bOK = bOK && osobject->setAttribute(CKA_LOCAL,true);
-			CK_ULONG ulKeyGenMechanism = (CK_ULONG)CKM_AES_KEY_GEN;
+			CK_ULONG ulKeyGenMechanism = (CK_ULONG)(keyType == CKK_SM4 ? CKM_SM4_KEY_GEN : CKM_ZUC_KEY_GEN);
 			bOK = bOK && osobject->setAttribute(CKA_KEY_GEN_MECHANISM,ulKeyGenMechanism);
 
 			// Common Secret Key Attributes
@@ -6693,22 +8230,17 @@ CK_RV MizaruHSM::generateAES
 			bool bNeverExtractable = osobject->getBooleanValue(CKA_EXTRACTABLE, false) == false;
 			bOK = bOK && osobject->setAttribute(CKA_NEVER_EXTRACTABLE, bNeverExtractable);
 
-			// AES Secret Key Attributes
+			// Secret Key Attributes; these keys have no check value
 			ByteString value;
-			ByteString kcv;
 			if (isPrivate)
 			{
 				token->encrypt(key->getKeyBits(), value);
-				token->encrypt(key->getKeyCheckValue(), kcv);
 			}
 			else
 			{
 				value = key->getKeyBits();
-				kcv = key->getKeyCheckValue();
 			}
 			bOK = bOK && osobject->setAttribute(CKA_VALUE, value);
-			if (checkValue)
-				bOK = bOK && osobject->setAttribute(CKA_CHECK_VALUE, kcv);
 
 			if (bOK)
 				bOK = osobject->commitTransaction();
@@ -6722,8 +8254,8 @@ CK_RV MizaruHSM::generateAES
 	}
 
 	// Clean up
-	aes->recycleKey(key);
-	CryptoFactory::i()->recycleSymmetricAlgorithm(aes);
+	cipher->recycleKey(key);
+	CryptoFactory::i()->recycleSymmetricAlgorithm(cipher);
 
 	// Remove the key that may have been created already when the function fails.
 	if (rv != CKR_OK)
@@ -7298,6 +8830,12 @@ CK_RV MizaruHSM::generateRSA
 		return CKR_TEMPLATE_INCOMPLETE;
 	}
 
+	// A key pair asked for in a Mizar key slot is generated on the chip
+	CK_ULONG keyIndex;
+	CK_RV rv = getRequestedKeySlot(pPrivateKeyTemplate, ulPrivateKeyAttributeCount, isPrivateKeyOnToken, keyIndex);
+	if (rv != CKR_OK)
+		return rv;
+
 	// Set the parameters
 	RSAParameters p;
 	p.setE(exponent);
@@ -7308,17 +8846,34 @@ CK_RV MizaruHSM::generateRSA
 	AsymmetricAlgorithm* rsa = CryptoFactory::i()->getAsymmetricAlgorithm(AsymAlgo::RSA);
 	if (rsa == NULL)
 		return CKR_GENERAL_ERROR;
-	if (!rsa->generateKeyPair(&kp, &p))
+
+	RSAPrivateKey* priv = NULL;
+	ByteString n;
+	ByteString e;
+	if (keyIndex != CK_UNAVAILABLE_INFORMATION)
 	{
-		ERROR_MSG("Could not generate key pair");
-		CryptoFactory::i()->recycleAsymmetricAlgorithm(rsa);
-		return CKR_GENERAL_ERROR;
+		rv = generateIndexedRSA(token, keyIndex, bitLen, exponent, n);
+		if (rv != CKR_OK)
+		{
+			CryptoFactory::i()->recycleAsymmetricAlgorithm(rsa);
+			return rv;
+		}
+		e = exponent;
 	}
+	else
+	{
+		if (!rsa->generateKeyPair(&kp, &p))
+		{
+			ERROR_MSG("Could not generate key pair");
+			CryptoFactory::i()->recycleAsymmetricAlgorithm(rsa);
+			return CKR_GENERAL_ERROR;
+		}
 
-	RSAPublicKey* pub = (RSAPublicKey*) kp->getPublicKey();
-	RSAPrivateKey* priv = (RSAPrivateKey*) kp->getPrivateKey();
-
-	CK_RV rv = CKR_OK;
+		RSAPublicKey* pub = (RSAPublicKey*) kp->getPublicKey();
+		priv = (RSAPrivateKey*) kp->getPrivateKey();
+		n = pub->getN();
+		e = pub->getE();
+	}
 
 	// Create a public key using C_CreateObject
 	if (rv == CKR_OK)
@@ -7374,13 +8929,13 @@ CK_RV MizaruHSM::generateRSA
 				ByteString publicExponent;
 				if (isPublicKeyPrivate)
 				{
-					token->encrypt(pub->getN(), modulus);
-					token->encrypt(pub->getE(), publicExponent);
+					token->encrypt(n, modulus);
+					token->encrypt(e, publicExponent);
 				}
 				else
 				{
-					modulus = pub->getN();
-					publicExponent = pub->getE();
+					modulus = n;
+					publicExponent = e;
 				}
 				bOK = bOK && osobject->setAttribute(CKA_MODULUS, modulus);
 				bOK = bOK && osobject->setAttribute(CKA_PUBLIC_EXPONENT, publicExponent);
@@ -7420,6 +8975,7 @@ CK_RV MizaruHSM::generateRSA
 				case CKA_TOKEN:
 				case CKA_PRIVATE:
 				case CKA_KEY_TYPE:
+				case CKA_MIZAR_KEY_INDEX:
 					continue;
 				default:
 					privateKeyAttribs[privateKeyAttribsCount++] = pPrivateKeyTemplate[i];
@@ -7450,44 +9006,66 @@ CK_RV MizaruHSM::generateRSA
 				bOK = bOK && osobject->setAttribute(CKA_NEVER_EXTRACTABLE, bNeverExtractable);
 
 				// RSA Private Key Attributes
-				ByteString modulus;
-				ByteString publicExponent;
-				ByteString privateExponent;
-				ByteString prime1;
-				ByteString prime2;
-				ByteString exponent1;
-				ByteString exponent2;
-				ByteString coefficient;
-				if (isPrivateKeyPrivate)
+				if (keyIndex != CK_UNAVAILABLE_INFORMATION)
 				{
-					token->encrypt(priv->getN(), modulus);
-					token->encrypt(priv->getE(), publicExponent);
-					token->encrypt(priv->getD(), privateExponent);
-					token->encrypt(priv->getP(), prime1);
-					token->encrypt(priv->getQ(), prime2);
-					token->encrypt(priv->getDP1(), exponent1);
-					token->encrypt(priv->getDQ1(), exponent2);
-					token->encrypt(priv->getPQ(), coefficient);
+					// The private key stays in the Mizar key slot
+					ByteString modulus;
+					ByteString publicExponent;
+					if (isPrivateKeyPrivate)
+					{
+						token->encrypt(n, modulus);
+						token->encrypt(e, publicExponent);
+					}
+					else
+					{
+						modulus = n;
+						publicExponent = e;
+					}
+					bOK = bOK && osobject->setAttribute(CKA_MODULUS, modulus);
+					bOK = bOK && osobject->setAttribute(CKA_PUBLIC_EXPONENT, publicExponent);
+					bOK = bOK && osobject->setAttribute(CKA_MIZAR_KEY_INDEX, keyIndex);
 				}
 				else
 				{
-					modulus = priv->getN();
-					publicExponent = priv->getE();
-					privateExponent = priv->getD();
-					prime1 = priv->getP();
-					prime2 = priv->getQ();
-					exponent1 =  priv->getDP1();
-					exponent2 = priv->getDQ1();
-					coefficient = priv->getPQ();
+					ByteString modulus;
+					ByteString publicExponent;
+					ByteString privateExponent;
+					ByteString prime1;
+					ByteString prime2;
+					ByteString exponent1;
+					ByteString exponent2;
+					ByteString coefficient;
+					if (isPrivateKeyPrivate)
+					{
+						token->encrypt(priv->getN(), modulus);
+						token->encrypt(priv->getE(), publicExponent);
+						token->encrypt(priv->getD(), privateExponent);
+						token->encrypt(priv->getP(), prime1);
+						token->encrypt(priv->getQ(), prime2);
+						token->encrypt(priv->getDP1(), exponent1);
+						token->encrypt(priv->getDQ1(), exponent2);
+						token->encrypt(priv->getPQ(), coefficient);
+					}
+					else
+					{
+						modulus = priv->getN();
+						publicExponent = priv->getE();
+						privateExponent = priv->getD();
+						prime1 = priv->getP();
+						prime2 = priv->getQ();
+						exponent1 =  priv->getDP1();
+						exponent2 = priv->getDQ1();
+						coefficient = priv->getPQ();
+					}
+					bOK = bOK && osobject->setAttribute(CKA_MODULUS, modulus);
+					bOK = bOK && osobject->setAttribute(CKA_PUBLIC_EXPONENT, publicExponent);
+					bOK = bOK && osobject->setAttribute(CKA_PRIVATE_EXPONENT, privateExponent);
+					bOK = bOK && osobject->setAttribute(CKA_PRIME_1, prime1);
+					bOK = bOK && osobject->setAttribute(CKA_PRIME_2, prime2);
+					bOK = bOK && osobject->setAttribute(CKA_EXPONENT_1,exponent1);
+					bOK = bOK && osobject->setAttribute(CKA_EXPONENT_2, exponent2);
+					bOK = bOK && osobject->setAttribute(CKA_COEFFICIENT, coefficient);
 				}
-				bOK = bOK && osobject->setAttribute(CKA_MODULUS, modulus);
-				bOK = bOK && osobject->setAttribute(CKA_PUBLIC_EXPONENT, publicExponent);
-				bOK = bOK && osobject->setAttribute(CKA_PRIVATE_EXPONENT, privateExponent);
-				bOK = bOK && osobject->setAttribute(CKA_PRIME_1, prime1);
-				bOK = bOK && osobject->setAttribute(CKA_PRIME_2, prime2);
-				bOK = bOK && osobject->setAttribute(CKA_EXPONENT_1,exponent1);
-				bOK = bOK && osobject->setAttribute(CKA_EXPONENT_2, exponent2);
-				bOK = bOK && osobject->setAttribute(CKA_COEFFICIENT, coefficient);
 
 				if (bOK)
 					bOK = osobject->commitTransaction();
@@ -7523,12 +9101,15 @@ CK_RV MizaruHSM::generateRSA
 			if (ospub) ospub->destroyObject();
 			*phPublicKey = CK_INVALID_HANDLE;
 		}
+
+		if (keyIndex != CK_UNAVAILABLE_INFORMATION)
+			token->removeKeySlot(CKK_RSA, keyIndex);
 	}
 
 	return rv;
 }
 
-// Generate an EC key pair
+// Generate an EC or an SM2 key pair
 CK_RV MizaruHSM::generateEC
 (CK_SESSION_HANDLE hSession,
 	CK_ATTRIBUTE_PTR pPublicKeyTemplate,
@@ -7540,7 +9121,8 @@ CK_RV MizaruHSM::generateEC
 	CK_BBOOL isPublicKeyOnToken,
 	CK_BBOOL isPublicKeyPrivate,
 	CK_BBOOL isPrivateKeyOnToken,
-	CK_BBOOL isPrivateKeyPrivate)
+	CK_BBOOL isPrivateKeyPrivate,
+	CK_KEY_TYPE keyType)
 {
 	*phPublicKey = CK_INVALID_HANDLE;
 	*phPrivateKey = CK_INVALID_HANDLE;
@@ -7575,32 +9157,57 @@ CK_RV MizaruHSM::generateEC
 		return CKR_TEMPLATE_INCOMPLETE;
 	}
 
+	// A key pair asked for in a Mizar key slot is generated on the chip
+	CK_ULONG keyIndex;
+	CK_RV rv = getRequestedKeySlot(pPrivateKeyTemplate, ulPrivateKeyAttributeCount, isPrivateKeyOnToken, keyIndex);
+	if (rv != CKR_OK)
+		return rv;
+	if (keyIndex != CK_UNAVAILABLE_INFORMATION && keyType != CKK_EC)
+	{
+		INFO_MSG("Only EC keys can be generated in a Mizar key slot");
+		return CKR_TEMPLATE_INCONSISTENT;
+	}
+
 	// Set the parameters
 	ECParameters p;
 	p.setEC(params);
 
 	// Generate key pair
 	AsymmetricKeyPair* kp = NULL;
-	AsymmetricAlgorithm* ec = CryptoFactory::i()->getAsymmetricAlgorithm(AsymAlgo::ECDSA);
+	AsymmetricAlgorithm* ec = CryptoFactory::i()->getAsymmetricAlgorithm(keyType == CKK_SM2 ? AsymAlgo::SM2 : AsymAlgo::ECDSA);
 	if (ec == NULL) return CKR_GENERAL_ERROR;
-	if (!ec->generateKeyPair(&kp, &p))
+
+	ECPrivateKey* priv = NULL;
+	ByteString q;
+	if (keyIndex != CK_UNAVAILABLE_INFORMATION)
 	{
-		ERROR_MSG("Could not generate key pair");
-		CryptoFactory::i()->recycleAsymmetricAlgorithm(ec);
-		return CKR_GENERAL_ERROR;
+		rv = generateIndexedEC(token, keyIndex, params, q);
+		if (rv != CKR_OK)
+		{
+			CryptoFactory::i()->recycleAsymmetricAlgorithm(ec);
+			return rv;
+		}
 	}
+	else
+	{
+		if (!ec->generateKeyPair(&kp, &p))
+		{
+			ERROR_MSG("Could not generate key pair");
+			CryptoFactory::i()->recycleAsymmetricAlgorithm(ec);
+			return CKR_GENERAL_ERROR;
+		}
 
-	ECPublicKey* pub = (ECPublicKey*) kp->getPublicKey();
-	ECPrivateKey* priv = (ECPrivateKey*) kp->getPrivateKey();
-
-	CK_RV rv = CKR_OK;
+		ECPublicKey* pub = (ECPublicKey*) kp->getPublicKey();
+		priv = (ECPrivateKey*) kp->getPrivateKey();
+		q = pub->getQ();
+	}
 
 	// Create a public key using C_CreateObject
 	if (rv == CKR_OK)
 	{
 		const CK_ULONG maxAttribs = 32;
 		CK_OBJECT_CLASS publicKeyClass = CKO_PUBLIC_KEY;
-		CK_KEY_TYPE publicKeyType = CKK_EC;
+		CK_KEY_TYPE publicKeyType = keyType;
 		CK_ATTRIBUTE publicKeyAttribs[maxAttribs] = {
 			{ CKA_CLASS, &publicKeyClass, sizeof(publicKeyClass) },
 			{ CKA_TOKEN, &isPublicKeyOnToken, sizeof(isPublicKeyOnToken) },
@@ -7640,18 +9247,18 @@ CK_RV MizaruHSM::generateEC
 
 				// Common Key Attributes
 				bOK = bOK && osobject->setAttribute(CKA_LOCAL,true);
-				CK_ULONG ulKeyGenMechanism = (CK_ULONG)CKM_EC_KEY_PAIR_GEN;
+				CK_ULONG ulKeyGenMechanism = (CK_ULONG)(keyType == CKK_SM2 ? CKM_SM2_KEY_PAIR_GEN : CKM_EC_KEY_PAIR_GEN);
 				bOK = bOK && osobject->setAttribute(CKA_KEY_GEN_MECHANISM,ulKeyGenMechanism);
 
 				// EC Public Key Attributes
 				ByteString point;
 				if (isPublicKeyPrivate)
 				{
-					token->encrypt(pub->getQ(), point);
+					token->encrypt(q, point);
 				}
 				else
 				{
-					point = pub->getQ();
+					point = q;
 				}
 				bOK = bOK && osobject->setAttribute(CKA_EC_POINT, point);
 
@@ -7672,7 +9279,7 @@ CK_RV MizaruHSM::generateEC
 	{
 		const CK_ULONG maxAttribs = 32;
 		CK_OBJECT_CLASS privateKeyClass = CKO_PRIVATE_KEY;
-		CK_KEY_TYPE privateKeyType = CKK_EC;
+		CK_KEY_TYPE privateKeyType = keyType;
 		CK_ATTRIBUTE privateKeyAttribs[maxAttribs] = {
 			{ CKA_CLASS, &privateKeyClass, sizeof(privateKeyClass) },
 			{ CKA_TOKEN, &isPrivateKeyOnToken, sizeof(isPrivateKeyOnToken) },
@@ -7690,6 +9297,7 @@ CK_RV MizaruHSM::generateEC
 				case CKA_TOKEN:
 				case CKA_PRIVATE:
 				case CKA_KEY_TYPE:
+				case CKA_MIZAR_KEY_INDEX:
 					continue;
 				default:
 					privateKeyAttribs[privateKeyAttribsCount++] = pPrivateKeyTemplate[i];
@@ -7710,7 +9318,7 @@ CK_RV MizaruHSM::generateEC
 
 				// Common Key Attributes
 				bOK = bOK && osobject->setAttribute(CKA_LOCAL,true);
-				CK_ULONG ulKeyGenMechanism = (CK_ULONG)CKM_EC_KEY_PAIR_GEN;
+				CK_ULONG ulKeyGenMechanism = (CK_ULONG)(keyType == CKK_SM2 ? CKM_SM2_KEY_PAIR_GEN : CKM_EC_KEY_PAIR_GEN);
 				bOK = bOK && osobject->setAttribute(CKA_KEY_GEN_MECHANISM,ulKeyGenMechanism);
 
 				// Common Private Key Attributes
@@ -7720,20 +9328,38 @@ CK_RV MizaruHSM::generateEC
 				bOK = bOK && osobject->setAttribute(CKA_NEVER_EXTRACTABLE, bNeverExtractable);
 
 				// EC Private Key Attributes
-				ByteString group;
-				ByteString value;
-				if (isPrivateKeyPrivate)
+				if (keyIndex != CK_UNAVAILABLE_INFORMATION)
 				{
-					token->encrypt(priv->getEC(), group);
-					token->encrypt(priv->getD(), value);
+					// The private key stays in the Mizar key slot
+					ByteString group;
+					if (isPrivateKeyPrivate)
+					{
+						token->encrypt(params, group);
+					}
+					else
+					{
+						group = params;
+					}
+					bOK = bOK && osobject->setAttribute(CKA_EC_PARAMS, group);
+					bOK = bOK && osobject->setAttribute(CKA_MIZAR_KEY_INDEX, keyIndex);
 				}
 				else
 				{
-					group = priv->getEC();
-					value = priv->getD();
+					ByteString group;
+					ByteString value;
+					if (isPrivateKeyPrivate)
+					{
+						token->encrypt(priv->getEC(), group);
+						token->encrypt(priv->getD(), value);
+					}
+					else
+					{
+						group = priv->getEC();
+						value = priv->getD();
+					}
+					bOK = bOK && osobject->setAttribute(CKA_EC_PARAMS, group);
+					bOK = bOK && osobject->setAttribute(CKA_VALUE, value);
 				}
-				bOK = bOK && osobject->setAttribute(CKA_EC_PARAMS, group);
-				bOK = bOK && osobject->setAttribute(CKA_VALUE, value);
 
 				if (bOK)
 					bOK = osobject->commitTransaction();
@@ -7769,6 +9395,9 @@ CK_RV MizaruHSM::generateEC
 			if (ospub) ospub->destroyObject();
 			*phPublicKey = CK_INVALID_HANDLE;
 		}
+
+		if (keyIndex != CK_UNAVAILABLE_INFORMATION)
+			token->removeKeySlot(CKK_EC, keyIndex);
 	}
 
 	return rv;
@@ -8486,6 +10115,7 @@ CK_RV MizaruHSM::CreateObject(CK_SESSION_HANDLE hSession, CK_ATTRIBUTE_PTR pTemp
 
 	if (isOnToken)
 	{
+		updateObjectIndex(token, object);
 		*phObject = handleManager->addTokenObject(slot->getSlotID(), isPrivate != CK_FALSE, object);
 	} else {
 		*phObject = handleManager->addSessionObject(slot->getSlotID(), hSession, isPrivate != CK_FALSE, object);
@@ -8500,6 +10130,9 @@ CK_RV MizaruHSM::getRSAPrivateKey(RSAPrivateKey* privateKey, Token* token, OSObj
 	if (token == NULL) return CKR_ARGUMENTS_BAD;
 	if (key == NULL) return CKR_ARGUMENTS_BAD;
 
+	// The key material of a hardware resident key never leaves the chip
+	if (isHardwareResident(key)) return CKR_KEY_FUNCTION_NOT_PERMITTED;
+
 	// Get the CKA_PRIVATE attribute, when the attribute is not present use default false
 	bool isKeyPrivate = key->getBooleanValue(CKA_PRIVATE, false);
 
@@ -8512,8 +10145,15 @@ CK_RV MizaruHSM::getRSAPrivateKey(RSAPrivateKey* privateKey, Token* token, OSObj
 	ByteString exponent1;
 	ByteString exponent2;
 	ByteString coefficient;
+	unsigned long revision = 0;
 	if (isKeyPrivate)
 	{
+		// Reuse the decrypted key material if the key has not changed
+		ByteString cached;
+		revision = key->getRevision();
+		if (token->getKeyCache()->get(key, revision, cached) && privateKey->deserialise(cached))
+			return CKR_OK;
+
 		bool bOK = true;
 		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_MODULUS), modulus);
 		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_PUBLIC_EXPONENT), publicExponent);
@@ -8547,6 +10187,9 @@ CK_RV MizaruHSM::getRSAPrivateKey(RSAPrivateKey* privateKey, Token* token, OSObj
 	privateKey->setDQ1(exponent2);
 	privateKey->setPQ(coefficient);
 
+	if (isKeyPrivate)
+		token->getKeyCache()->put(key, revision, privateKey->serialise());
+
 	return CKR_OK;
 }
 
@@ -8588,14 +10231,24 @@ CK_RV MizaruHSM::getECPrivateKey(ECPrivateKey* privateKey, Token* token, OSObjec
 	if (token == NULL) return CKR_ARGUMENTS_BAD;
 	if (key == NULL) return CKR_ARGUMENTS_BAD;
 
+	// The key material of a hardware resident key never leaves the chip
+	if (isHardwareResident(key)) return CKR_KEY_FUNCTION_NOT_PERMITTED;
+
 	// Get the CKA_PRIVATE attribute, when the attribute is not present use default false
 	bool isKeyPrivate = key->getBooleanValue(CKA_PRIVATE, false);
 
 	// EC Private Key Attributes
 	ByteString group;
 	ByteString value;
+	unsigned long revision = 0;
 	if (isKeyPrivate)
 	{
+		// Reuse the decrypted key material if the key has not changed
+		ByteString cached;
+		revision = key->getRevision();
+		if (token->getKeyCache()->get(key, revision, cached) && privateKey->deserialise(cached))
+			return CKR_OK;
+
 		bool bOK = true;
 		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_EC_PARAMS), group);
 		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_VALUE), value);
@@ -8611,6 +10264,9 @@ CK_RV MizaruHSM::getECPrivateKey(ECPrivateKey* privateKey, Token* token, OSObjec
 	privateKey->setEC(group);
 	privateKey->setD(value);
 
+	if (isKeyPrivate)
+		token->getKeyCache()->put(key, revision, privateKey->serialise());
+
 	return CKR_OK;
 }
 
@@ -8652,14 +10308,24 @@ CK_RV MizaruHSM::getSymmetricKey(SymmetricKey* skey, Token* token, OSObject* key
 	if (token == NULL) return CKR_ARGUMENTS_BAD;
 	if (key == NULL) return CKR_ARGUMENTS_BAD;
 
+	// The key material of a hardware resident key never leaves the chip
+	if (isHardwareResident(key)) return CKR_KEY_FUNCTION_NOT_PERMITTED;
+
 	// Get the CKA_PRIVATE attribute, when the attribute is not present use default false
 	bool isKeyPrivate = key->getBooleanValue(CKA_PRIVATE, false);
 
 	ByteString keybits;
 	if (isKeyPrivate)
 	{
-		if (!token->decrypt(key->getByteStringValue(CKA_VALUE), keybits))
-			return CKR_GENERAL_ERROR;
+		// Reuse the decrypted key material if the key has not changed
+		unsigned long revision = key->getRevision();
+		if (!token->getKeyCache()->get(key, revision, keybits))
+		{
+			if (!token->decrypt(key->getByteStringValue(CKA_VALUE), keybits))
+				return CKR_GENERAL_ERROR;
+
+			token->getKeyCache()->put(key, revision, keybits);
+		}
 	}
 	else
 	{
@@ -35,9 +35,11 @@
 #include "config.h"
 #include "log.h"
 #include "cryptoki.h"
+#include "vendor_defines.h"
 #include "SessionObjectStore.h"
 #include "ObjectStore.h"
 #include "SessionManager.h"
+#include "AsyncManager.h"
 #include "SlotManager.h"
 #include "HandleManager.h"
 #include "RSAPublicKey.h"
@@ -45,6 +47,7 @@
 #include "ECPublicKey.h"
 #include "ECPrivateKey.h"
 
+#include <functional>
 #include <memory>
 
 class MizaruHSM
@@ -164,6 +167,26 @@ public:
 	CK_RV C_CancelFunction(CK_SESSION_HANDLE hSession);
 	CK_RV C_WaitForSlotEvent(CK_FLAGS flags, CK_SLOT_ID_PTR pSlot, CK_VOID_PTR pReserved);
 
+	// Vendor extensions
+	CK_RV C_VerifyBatch
+	(
+		CK_SESSION_HANDLE hSession,
+		CK_MECHANISM_PTR pMechanism,
+		CK_ULONG ulCount,
+		CK_OBJECT_HANDLE_PTR phKeys,
+		CK_BYTE_PTR* ppData,
+		CK_ULONG_PTR pulDataLen,
+		CK_BYTE_PTR* ppSignature,
+		CK_ULONG_PTR pulSignatureLen,
+		CK_RV* pResults
+	);
+	CK_RV C_SignAsync(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey, CK_BYTE_PTR pData, CK_ULONG ulDataLen, CK_ULONG_PTR pulTicket);
+	CK_RV C_VerifyAsync(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey, CK_BYTE_PTR pData, CK_ULONG ulDataLen, CK_BYTE_PTR pSignature, CK_ULONG ulSignatureLen, CK_ULONG_PTR pulTicket);
+	CK_RV C_EncryptAsync(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey, CK_BYTE_PTR pData, CK_ULONG ulDataLen, CK_ULONG_PTR pulTicket);
+	CK_RV C_PollAsync(CK_SESSION_HANDLE hSession, CK_ULONG ulTicket, CK_BYTE_PTR pOutput, CK_ULONG_PTR pulOutputLen);
+	CK_RV C_WaitAsync(CK_SESSION_HANDLE hSession, CK_ULONG ulTicket, CK_ULONG ulTimeout, CK_BYTE_PTR pOutput, CK_ULONG_PTR pulOutputLen);
+	CK_RV C_GetOffloadInfo(CK_ULONG ulOperation, CK_MIZARU_OFFLOAD_INFO_PTR pInfo);
+
 private:
 	// Constructor
 	MizaruHSM();
@@ -184,6 +207,7 @@ private:
 	SlotManager* slotManager;
 	SessionManager* sessionManager;
 	HandleManager* handleManager;
+	AsyncManager* asyncManager;
 
 	// A list with the supported mechanisms
 	std::map<std::string, CK_MECHANISM_TYPE> mechanisms_table;
@@ -241,6 +265,16 @@ private:
 		CK_BBOOL isOnToken,
 		CK_BBOOL isPrivate
 	);
+	CK_RV generateGM
+	(
+		CK_SESSION_HANDLE hSession,
+		CK_ATTRIBUTE_PTR pTemplate,
+		CK_ULONG ulCount,
+		CK_OBJECT_HANDLE_PTR phKey,
+		CK_BBOOL isOnToken,
+		CK_BBOOL isPrivate,
+		CK_KEY_TYPE keyType
+	);
 	CK_RV generateRSA
 	(CK_SESSION_HANDLE hSession,
 		CK_ATTRIBUTE_PTR pPublicKeyTemplate,
@@ -266,7 +300,8 @@ private:
 		CK_BBOOL isPublicKeyOnToken,
 		CK_BBOOL isPublicKeyPrivate,
 		CK_BBOOL isPrivateKeyOnToken,
-		CK_BBOOL isPrivateKeyPrivate
+		CK_BBOOL isPrivateKeyPrivate,
+		CK_KEY_TYPE keyType
 	);
 	CK_RV generateGeneric
 	(
@@ -302,6 +337,10 @@ private:
 	CK_RV getRSAPublicKey(RSAPublicKey* publicKey, Token* token, OSObject* key);
 	CK_RV getECPrivateKey(ECPrivateKey* privateKey, Token* token, OSObject* key);
 	CK_RV getECPublicKey(ECPublicKey* publicKey, Token* token, OSObject* key);
+
+	// An asynchronous operation, run in an internal worker session with a copy of the mechanism
+	typedef std::function<CK_RV(CK_SESSION_HANDLE hWorker, CK_MECHANISM_PTR pMechanism, ByteString& output)> AsyncOperation;
+	CK_RV submitAsync(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_ULONG_PTR pulTicket, const AsyncOperation& operation);
 	CK_RV getSymmetricKey(SymmetricKey* skey, Token* token, OSObject* key);
 
 	bool setRSAPrivateKey(OSObject* key, const ByteString &ber, Token* token, bool isPrivate) const;
@@ -2523,3 +2523,22 @@ CK_RV P11AttrAllowedMechanisms::updateAttr(Token* /*token*/, bool /*isPrivate*/,
 	osobject->setAttribute(type, OSAttribute(data));
 	return CKR_OK;
 }
+
+/*****************************************
+ * CKA_MIZAR_KEY_INDEX
+ *****************************************/
+
+// Set default value
+bool P11AttrMizarKeyIndex::setDefault()
+{
+	OSAttribute attr((unsigned long)CK_UNAVAILABLE_INFORMATION);
+	return osobject->setAttribute(type, attr);
+}
+
+// Update the value if allowed
+CK_RV P11AttrMizarKeyIndex::updateAttr(Token* /*token*/, bool /*isPrivate*/, CK_VOID_PTR /*pValue*/, CK_ULONG /*ulValueLen*/, int /*op*/)
+{
+	// Only the generation of a key in a Mizar key slot sets the index,
+	// after the token has claimed the slot
+	return CKR_ATTRIBUTE_READ_ONLY;
+}
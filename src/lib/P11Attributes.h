@@ -34,6 +34,7 @@
 #define _SOFTHSM_V2_P11ATTRIBUTES_H
 
 #include "cryptoki.h"
+#include "vendor_defines.h"
 #include "OSObject.h"
 #include "Token.h"
 
@@ -1261,4 +1262,22 @@ protected:
 	virtual CK_RV updateAttr(Token *token, bool isPrivate, CK_VOID_PTR pValue, CK_ULONG ulValueLen, int op);
 };
 
+/*****************************************
+ * CKA_MIZAR_KEY_INDEX
+ *****************************************/
+
+class P11AttrMizarKeyIndex : public P11Attribute
+{
+public:
+	// Constructor
+	P11AttrMizarKeyIndex(OSObject* inobject) : P11Attribute(inobject) { type = CKA_MIZAR_KEY_INDEX; size = sizeof(CK_ULONG); checks = ck2|ck4|ck6; }
+
+protected:
+	// Set the default value of the attribute
+	virtual bool setDefault();
+
+	// Update the value if allowed
+	virtual CK_RV updateAttr(Token *token, bool isPrivate, CK_VOID_PTR pValue, CK_ULONG ulValueLen, int op);
+};
+
 #endif // !_SOFTHSM_V2_P11ATTRIBUTES_H
@@ -885,6 +885,51 @@ bool P11ECPublicKeyObj::init(OSObject *inobject)
 	return true;
 }
 
+// Constructor
+P11SM2PublicKeyObj::P11SM2PublicKeyObj()
+{
+	initialized = false;
+}
+
+// Add attributes
+bool P11SM2PublicKeyObj::init(OSObject *inobject)
+{
+	if (initialized) return true;
+	if (inobject == NULL) return false;
+
+	if (!inobject->attributeExists(CKA_KEY_TYPE) || inobject->getUnsignedLongValue(CKA_KEY_TYPE, CKK_VENDOR_DEFINED) != CKK_SM2) {
+		OSAttribute setKeyType((unsigned long)CKK_SM2);
+		inobject->setAttribute(CKA_KEY_TYPE, setKeyType);
+	}
+
+	// Create parent
+	if (!P11PublicKeyObj::init(inobject)) return false;
+
+	// Create attributes
+	P11Attribute* attrEcParams = new P11AttrEcParams(osobject,P11Attribute::ck3);
+	P11Attribute* attrEcPoint = new P11AttrEcPoint(osobject);
+
+	// Initialize the attributes
+	if
+	(
+		!attrEcParams->init() ||
+		!attrEcPoint->init()
+	)
+	{
+		ERROR_MSG("Could not initialize the attribute");
+		delete attrEcParams;
+		delete attrEcPoint;
+		return false;
+	}
+
+	// Add them to the map
+	attributes[attrEcParams->getType()] = attrEcParams;
+	attributes[attrEcPoint->getType()] = attrEcPoint;
+
+	initialized = true;
+	return true;
+}
+
 // Constructor
 P11EDPublicKeyObj::P11EDPublicKeyObj()
 {
@@ -1068,6 +1113,7 @@ bool P11PrivateKeyObj::init(OSObject *inobject)
 	P11Attribute* attrAlwaysAuthenticate = new P11AttrAlwaysAuthenticate(osobject);
 	// TODO: CKA_PUBLIC_KEY_INFO is accepted, but we do not calculate it
 	P11Attribute* attrPublicKeyInfo = new P11AttrPublicKeyInfo(osobject,P11Attribute::ck8);
+	P11Attribute* attrMizarKeyIndex = new P11AttrMizarKeyIndex(osobject);
 
 	// Initialize the attributes
 	if
@@ -1084,7 +1130,8 @@ bool P11PrivateKeyObj::init(OSObject *inobject)
 		!attrWrapWithTrusted->init() ||
 		!attrUnwrapTemplate->init() ||
 		!attrAlwaysAuthenticate->init() ||
-		!attrPublicKeyInfo->init()
+		!attrPublicKeyInfo->init() ||
+		!attrMizarKeyIndex->init()
 	)
 	{
 		ERROR_MSG("Could not initialize the attribute");
@@ -1101,6 +1148,7 @@ bool P11PrivateKeyObj::init(OSObject *inobject)
 		delete attrUnwrapTemplate;
 		delete attrAlwaysAuthenticate;
 		delete attrPublicKeyInfo;
+		delete attrMizarKeyIndex;
 		return false;
 	}
 
@@ -1118,6 +1166,7 @@ bool P11PrivateKeyObj::init(OSObject *inobject)
 	attributes[attrUnwrapTemplate->getType()] = attrUnwrapTemplate;
 	attributes[attrAlwaysAuthenticate->getType()] = attrAlwaysAuthenticate;
 	attributes[attrPublicKeyInfo->getType()] = attrPublicKeyInfo;
+	attributes[attrMizarKeyIndex->getType()] = attrMizarKeyIndex;
 
 	initialized = true;
 	return true;
@@ -1290,6 +1339,51 @@ bool P11ECPrivateKeyObj::init(OSObject *inobject)
 	return true;
 }
 
+// Constructor
+P11SM2PrivateKeyObj::P11SM2PrivateKeyObj()
+{
+	initialized = false;
+}
+
+// Add attributes
+bool P11SM2PrivateKeyObj::init(OSObject *inobject)
+{
+	if (initialized) return true;
+	if (inobject == NULL) return false;
+
+	if (!inobject->attributeExists(CKA_KEY_TYPE) || inobject->getUnsignedLongValue(CKA_KEY_TYPE, CKK_VENDOR_DEFINED) != CKK_SM2) {
+		OSAttribute setKeyType((unsigned long)CKK_SM2);
+		inobject->setAttribute(CKA_KEY_TYPE, setKeyType);
+	}
+
+	// Create parent
+	if (!P11PrivateKeyObj::init(inobject)) return false;
+
+	// Create attributes
+	P11Attribute* attrEcParams = new P11AttrEcParams(osobject,P11Attribute::ck4|P11Attribute::ck6);
+	P11Attribute* attrValue = new P11AttrValue(osobject,P11Attribute::ck1|P11Attribute::ck4|P11Attribute::ck6|P11Attribute::ck7);
+
+	// Initialize the attributes
+	if
+	(
+		!attrEcParams->init() ||
+		!attrValue->init()
+	)
+	{
+		ERROR_MSG("Could not initialize the attribute");
+		delete attrEcParams;
+		delete attrValue;
+		return false;
+	}
+
+	// Add them to the map
+	attributes[attrEcParams->getType()] = attrEcParams;
+	attributes[attrValue->getType()] = attrValue;
+
+	initialized = true;
+	return true;
+}
+
 // Constructor
 P11EDPrivateKeyObj::P11EDPrivateKeyObj()
 {
@@ -1477,6 +1571,7 @@ bool P11SecretKeyObj::init(OSObject *inobject)
 	P11Attribute* attrTrusted = new P11AttrTrusted(osobject);
 	P11Attribute* attrWrapTemplate = new P11AttrWrapTemplate(osobject);
 	P11Attribute* attrUnwrapTemplate = new P11AttrUnwrapTemplate(osobject);
+	P11Attribute* attrMizarKeyIndex = new P11AttrMizarKeyIndex(osobject);
 
 	// Initialize the attributes
 	if
@@ -1495,7 +1590,8 @@ bool P11SecretKeyObj::init(OSObject *inobject)
 		!attrWrapWithTrusted->init() ||
 		!attrTrusted->init() ||
 		!attrWrapTemplate->init() ||
-		!attrUnwrapTemplate->init()
+		!attrUnwrapTemplate->init() ||
+		!attrMizarKeyIndex->init()
 	)
 	{
 		ERROR_MSG("Could not initialize the attribute");
@@ -1514,6 +1610,7 @@ bool P11SecretKeyObj::init(OSObject *inobject)
 		delete attrTrusted;
 		delete attrWrapTemplate;
 		delete attrUnwrapTemplate;
+		delete attrMizarKeyIndex;
 		return false;
 	}
 
@@ -1533,6 +1630,7 @@ bool P11SecretKeyObj::init(OSObject *inobject)
 	attributes[attrTrusted->getType()] = attrTrusted;
 	attributes[attrWrapTemplate->getType()] = attrWrapTemplate;
 	attributes[attrUnwrapTemplate->getType()] = attrUnwrapTemplate;
+	attributes[attrMizarKeyIndex->getType()] = attrMizarKeyIndex;
 
 	initialized = true;
 	return true;
@@ -1647,6 +1745,96 @@ bool P11AESSecretKeyObj::init(OSObject *inobject)
 	return true;
 }
 
+// Constructor
+P11SM4SecretKeyObj::P11SM4SecretKeyObj()
+{
+	initialized = false;
+}
+
+// Add attributes
+bool P11SM4SecretKeyObj::init(OSObject *inobject)
+{
+	if (initialized) return true;
+	if (inobject == NULL) return false;
+
+	if (!inobject->attributeExists(CKA_KEY_TYPE) || inobject->getUnsignedLongValue(CKA_KEY_TYPE, CKK_VENDOR_DEFINED) != CKK_SM4) {
+		OSAttribute setKeyType((unsigned long)CKK_SM4);
+		inobject->setAttribute(CKA_KEY_TYPE, setKeyType);
+	}
+
+	// Create parent
+	if (!P11SecretKeyObj::init(inobject)) return false;
+
+	// Create attributes
+	P11Attribute* attrValue = new P11AttrValue(osobject,P11Attribute::ck1|P11Attribute::ck4|P11Attribute::ck6|P11Attribute::ck7);
+	P11Attribute* attrValueLen = new P11AttrValueLen(osobject,P11Attribute::ck6);
+
+	// Initialize the attributes
+	if
+	(
+		!attrValue->init() ||
+		!attrValueLen->init()
+	)
+	{
+		ERROR_MSG("Could not initialize the attribute");
+		delete attrValue;
+		delete attrValueLen;
+		return false;
+	}
+
+	// Add them to the map
+	attributes[attrValue->getType()] = attrValue;
+	attributes[attrValueLen->getType()] = attrValueLen;
+
+	initialized = true;
+	return true;
+}
+
+// Constructor
+P11ZUCSecretKeyObj::P11ZUCSecretKeyObj()
+{
+	initialized = false;
+}
+
+// Add attributes
+bool P11ZUCSecretKeyObj::init(OSObject *inobject)
+{
+	if (initialized) return true;
+	if (inobject == NULL) return false;
+
+	if (!inobject->attributeExists(CKA_KEY_TYPE) || inobject->getUnsignedLongValue(CKA_KEY_TYPE, CKK_VENDOR_DEFINED) != CKK_ZUC) {
+		OSAttribute setKeyType((unsigned long)CKK_ZUC);
+		inobject->setAttribute(CKA_KEY_TYPE, setKeyType);
+	}
+
+	// Create parent
+	if (!P11SecretKeyObj::init(inobject)) return false;
+
+	// Create attributes
+	P11Attribute* attrValue = new P11AttrValue(osobject,P11Attribute::ck1|P11Attribute::ck4|P11Attribute::ck6|P11Attribute::ck7);
+	P11Attribute* attrValueLen = new P11AttrValueLen(osobject,P11Attribute::ck6);
+
+	// Initialize the attributes
+	if
+	(
+		!attrValue->init() ||
+		!attrValueLen->init()
+	)
+	{
+		ERROR_MSG("Could not initialize the attribute");
+		delete attrValue;
+		delete attrValueLen;
+		return false;
+	}
+
+	// Add them to the map
+	attributes[attrValue->getType()] = attrValue;
+	attributes[attrValueLen->getType()] = attrValueLen;
+
+	initialized = true;
+	return true;
+}
+
 // Constructor
 P11DESSecretKeyObj::P11DESSecretKeyObj()
 {
@@ -185,6 +185,19 @@ protected:
 	bool initialized;
 };
 
+class P11SM2PublicKeyObj : public P11PublicKeyObj
+{
+public:
+	// Constructor
+	P11SM2PublicKeyObj();
+
+	// Add attributes
+	virtual bool init(OSObject *inobject);
+
+protected:
+	bool initialized;
+};
+
 class P11EDPublicKeyObj : public P11PublicKeyObj
 {
 public:
@@ -274,6 +287,19 @@ protected:
 	bool initialized;
 };
 
+class P11SM2PrivateKeyObj : public P11PrivateKeyObj
+{
+public:
+	// Constructor
+	P11SM2PrivateKeyObj();
+
+	// Add attributes
+	virtual bool init(OSObject *inobject);
+
+protected:
+	bool initialized;
+};
+
 class P11EDPrivateKeyObj : public P11PrivateKeyObj
 {
 public:
@@ -355,6 +381,32 @@ protected:
 	bool initialized;
 };
 
+class P11SM4SecretKeyObj : public P11SecretKeyObj
+{
+public:
+	// Constructor
+	P11SM4SecretKeyObj();
+
+	// Add attributes
+	virtual bool init(OSObject *inobject);
+
+protected:
+	bool initialized;
+};
+
+class P11ZUCSecretKeyObj : public P11SecretKeyObj
+{
+public:
+	// Constructor
+	P11ZUCSecretKeyObj();
+
+	// Add attributes
+	virtual bool init(OSObject *inobject);
+
+protected:
+	bool initialized;
+};
+
 class P11DESSecretKeyObj : public P11SecretKeyObj
 {
 public:
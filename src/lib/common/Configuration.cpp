@@ -47,10 +47,33 @@ const struct config Configuration::valid_config[] = {
 	{ "directories.tokendir",	CONFIG_TYPE_STRING },
 	{ "objectstore.backend",	CONFIG_TYPE_STRING },
 	{ "objectstore.umask",		CONFIG_TYPE_INT_OCTAL },
+	{ "objectstore.check_interval",	CONFIG_TYPE_INT },
+	{ "objectstore.durability",	CONFIG_TYPE_STRING },
+	{ "objectstore.load_threads",	CONFIG_TYPE_INT },
+	{ "objectstore.lazy_load",	CONFIG_TYPE_BOOL },
+	{ "objectstore.lazy_budget",	CONFIG_TYPE_INT },
 	{ "log.level",			CONFIG_TYPE_STRING },
 	{ "slots.removable",		CONFIG_TYPE_BOOL },
 	{ "slots.mechanisms",		CONFIG_TYPE_STRING },
 	{ "library.reset_on_fork",	CONFIG_TYPE_BOOL },
+	{ "keycache.size",		CONFIG_TYPE_INT },
+	{ "mizaru.channels",		CONFIG_TYPE_INT },
+	{ "mizaru.rng.pool_size",	CONFIG_TYPE_INT },
+	{ "mizaru.rng.reseed_interval",	CONFIG_TYPE_INT },
+	{ "mizaru.offload.aes",		CONFIG_TYPE_INT },
+	{ "mizaru.offload.des",		CONFIG_TYPE_INT },
+	{ "mizaru.offload.sha256",	CONFIG_TYPE_INT },
+	{ "mizaru.offload.rsa_private",	CONFIG_TYPE_INT },
+	{ "mizaru.offload.rsa_public",	CONFIG_TYPE_INT },
+	{ "mizaru.offload.ecdsa_sign",	CONFIG_TYPE_INT },
+	{ "mizaru.offload.ecdsa_verify",	CONFIG_TYPE_INT },
+	{ "mizaru.offload.sm4",		CONFIG_TYPE_INT },
+	{ "mizaru.offload.sm3",		CONFIG_TYPE_INT },
+	{ "mizaru.offload.sm2",		CONFIG_TYPE_INT },
+	{ "mizaru.offload.calibrate",	CONFIG_TYPE_BOOL },
+	{ "mizaru.offload.calibration_file",	CONFIG_TYPE_STRING },
+	{ "mizaru.certificates",	CONFIG_TYPE_BOOL },
+	{ "async.workers",		CONFIG_TYPE_INT },
 	{ "",				CONFIG_TYPE_UNSUPPORTED }
 };
 
@@ -36,6 +36,7 @@
 #include "log.h"
 #include "fatal.h"
 #include "SecureMemoryRegistry.h"
+#include "SecurePool.h"
 #include "cryptoki.h"
 
 void FatalException(void)
@@ -50,6 +51,7 @@ void FatalException(void)
 
 	// Wipe as much of the securely allocated memory as possible
 	SecureMemoryRegistry::i()->wipe();
+	SecurePool::i()->wipe();
 
 	try
 	{
@@ -101,6 +101,17 @@ bool AsymmetricAlgorithm::verify(PublicKey* publicKey, const ByteString& origina
 	return (verifyInit(publicKey, mechanism, param, paramLen) && verifyUpdate(originalData) && verifyFinal(signature));
 }
 
+// Verify independent signatures, one at a time unless a backend can do better
+bool AsymmetricAlgorithm::verifyBatch(std::vector<AsymVerifyItem>& items, const AsymMech::Type mechanism)
+{
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		items[i].valid = verify(items[i].publicKey, items[i].data, items[i].signature, mechanism);
+	}
+
+	return true;
+}
+
 bool AsymmetricAlgorithm::verifyInit(PublicKey* publicKey, const AsymMech::Type mechanism,
 				     const void* /* param = NULL */, const size_t /* paramLen = 0 */)
 {
@@ -41,6 +41,7 @@
 #include "PrivateKey.h"
 #include "RNG.h"
 #include "SymmetricKey.h"
+#include <vector>
 
 struct AsymAlgo
 {
@@ -53,7 +54,8 @@ struct AsymAlgo
 		ECDH,
 		ECDSA,
 		GOST,
-		EDDSA
+		EDDSA,
+		SM2
         };
 };
 
@@ -87,7 +89,10 @@ struct AsymMech
 		ECDSA,
 		GOST,
 		GOST_GOST,
-		EDDSA
+		EDDSA,
+		SM2,
+		SM2_SM3,
+		SM2_ENCRYPT
 	};
 };
 
@@ -111,6 +116,17 @@ struct RSA_PKCS_PSS_PARAMS
 	size_t sLen;
 };
 
+// One signature of a batch verification
+struct AsymVerifyItem
+{
+	PublicKey* publicKey;
+	ByteString data;
+	ByteString signature;
+
+	// Set by verifyBatch
+	bool valid;
+};
+
 class AsymmetricAlgorithm
 {
 public:
@@ -132,6 +148,11 @@ public:
 	virtual bool verifyUpdate(const ByteString& originalData);
 	virtual bool verifyFinal(const ByteString& signature);
 
+	// Verify independent signatures made with the same mechanism; returns
+	// false if the batch could not be processed, the outcome of each
+	// signature is in its valid flag
+	virtual bool verifyBatch(std::vector<AsymVerifyItem>& items, const AsymMech::Type mechanism);
+
 	// Encryption functions
 	virtual bool encrypt(PublicKey* publicKey, const ByteString& data, ByteString& encryptedData, const AsymMech::Type padding) = 0;
 
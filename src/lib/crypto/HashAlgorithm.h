@@ -47,7 +47,8 @@ struct HashAlgo
 		SHA256,
 		SHA384,
 		SHA512,
-		GOST
+		GOST,
+		SM3
 	};
 };
 
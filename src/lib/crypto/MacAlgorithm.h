@@ -51,7 +51,8 @@ struct MacAlgo
 		HMAC_SHA512,
 		HMAC_GOST,
 		CMAC_DES,
-		CMAC_AES
+		CMAC_AES,
+		ZUC_EIA3
 	};
 };
 
@@ -206,6 +206,7 @@ bool SymmetricAlgorithm::isStreamCipher()
 		case SymMode::CTR:
 		case SymMode::GCM:
 		case SymMode::OFB:
+		case SymMode::CCM:
 			return true;
 		default:
 			break;
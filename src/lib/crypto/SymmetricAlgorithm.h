@@ -45,7 +45,9 @@ struct SymAlgo
 		Unknown,
 		AES,
 		DES,
-		DES3
+		DES3,
+		SM4,
+		ZUC
 	};
 };
 
@@ -59,7 +61,8 @@ struct SymMode
 		CTR,
 		ECB,
 		GCM,
-		OFB
+		OFB,
+		CCM
 	};
 };
 
@@ -0,0 +1,2040 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizarSimDevice.cpp
+
+ A software model of the Mizar security chip
+ *****************************************************************************/
+
+#include "MizarSimDevice.h"
+#include "mizar_errcode.h"
+#include "mizar_key_manager.h"
+#include "mizar_cert_manager.h"
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <openssl/ec.h>
+#include <openssl/rand.h>
+#include <openssl/rsa.h>
+
+// The private key index range of the chip
+#define MAX_RSA_NUM 300
+
+// The symmetric algorithms of the key store
+#define SYMM_ALG_DES 1
+#define SYMM_ALG_AES 2
+#define SYMM_ALG_SM4 3
+
+// The names used in MIZAR_SIM_LATENCY
+static const struct
+{
+	const char* name;
+	MizarSimIns ins;
+}
+insNames[] =
+{
+	{ "state", MIZAR_INS_GET_STATE },
+	{ "rnd", MIZAR_INS_GEN_RND },
+	{ "sha_init", MIZAR_INS_SHA_INIT },
+	{ "sha_update", MIZAR_INS_SHA_UPDATE },
+	{ "sha_final", MIZAR_INS_SHA_FINAL },
+	{ "rsa_gen", MIZAR_INS_GEN_RSA_KEY },
+	{ "rsa_sk", MIZAR_INS_RSA_SK_INDEX },
+	{ "rsa_pk", MIZAR_INS_RSA_PK },
+	{ "rsa_sk_ext", MIZAR_INS_RSA_SK },
+	{ "ecc_gen", MIZAR_INS_GEN_ECC_KEY },
+	{ "ecc_sign", MIZAR_INS_ECC_SIGN_INDEX },
+	{ "ecc_verify", MIZAR_INS_ECC_VERIFY },
+	{ "ecc_sign_ext", MIZAR_INS_ECC_SIGN },
+	{ "sm2_sign", MIZAR_INS_SM2_SIGN },
+	{ "sm2_verify", MIZAR_INS_SM2_VERIFY },
+	{ "sm2_enc", MIZAR_INS_SM2_ENC },
+	{ "sm2_dec", MIZAR_INS_SM2_DEC },
+	{ "symm_import", MIZAR_INS_IMPORT_SYMM_KEY },
+	{ "symm_gen", MIZAR_INS_GEN_SYMM_KEY },
+	{ "symm", MIZAR_INS_SYMM_INDEX },
+	{ "symm_ext", MIZAR_INS_SYMM },
+	{ "aes_ccm", MIZAR_INS_AES_CCM },
+	{ "zuc_enc", MIZAR_INS_ZUC_ENC },
+	{ "zuc_mac", MIZAR_INS_ZUC_MAC },
+	{ "cert_import", MIZAR_INS_IMPORT_CERT },
+	{ "cert_get", MIZAR_INS_GET_CERT },
+	{ "cert_list", MIZAR_INS_GET_CERT_LIST }
+};
+
+/*****************************************************************************
+ Message bodies
+ *****************************************************************************/
+
+MizarSimWriter::MizarSimWriter(TMizarMsg* inMsg, mizar_uint32 inMaxBody)
+{
+	msg = inMsg;
+	maxBody = inMaxBody;
+	overflow = false;
+	MizarSimDevice::setBodyLength(msg, 0);
+}
+
+void MizarSimWriter::u32(mizar_uint32 value)
+{
+	mizar_uint32 len = MizarSimDevice::bodyLength(msg);
+
+	if (len + 4 > maxBody)
+	{
+		overflow = true;
+		return;
+	}
+
+	msg->body[len] = (mizar_uint8) (value >> 24);
+	msg->body[len + 1] = (mizar_uint8) (value >> 16);
+	msg->body[len + 2] = (mizar_uint8) (value >> 8);
+	msg->body[len + 3] = (mizar_uint8) value;
+	MizarSimDevice::setBodyLength(msg, len + 4);
+}
+
+void MizarSimWriter::bytes(const mizar_uint8* data, mizar_uint32 len)
+{
+	u32(len);
+
+	mizar_uint32 bodyLen = MizarSimDevice::bodyLength(msg);
+
+	if (overflow || bodyLen + len > maxBody)
+	{
+		overflow = true;
+		return;
+	}
+
+	if (len > 0) memcpy(&msg->body[bodyLen], data, len);
+	MizarSimDevice::setBodyLength(msg, bodyLen + len);
+}
+
+bool MizarSimWriter::ok() const
+{
+	return !overflow;
+}
+
+MizarSimReader::MizarSimReader(const TMizarMsg* inMsg)
+{
+	msg = inMsg;
+	pos = 0;
+}
+
+bool MizarSimReader::u32(mizar_uint32& value)
+{
+	if (pos + 4 > MizarSimDevice::bodyLength(msg)) return false;
+
+	value = ((mizar_uint32) msg->body[pos] << 24) |
+		((mizar_uint32) msg->body[pos + 1] << 16) |
+		((mizar_uint32) msg->body[pos + 2] << 8) |
+		(mizar_uint32) msg->body[pos + 3];
+	pos += 4;
+
+	return true;
+}
+
+bool MizarSimReader::bytes(const mizar_uint8*& data, mizar_uint32& len)
+{
+	if (!u32(len) || pos + len > MizarSimDevice::bodyLength(msg)) return false;
+
+	data = &msg->body[pos];
+	pos += len;
+
+	return true;
+}
+
+bool MizarSimReader::copy(mizar_uint8* out, mizar_uint32* pLen)
+{
+	const mizar_uint8* data;
+	mizar_uint32 len;
+
+	if (!bytes(data, len) || pLen == NULL || len > *pLen || (out == NULL && len > 0)) return false;
+
+	if (len > 0) memcpy(out, data, len);
+	*pLen = len;
+
+	return true;
+}
+
+/*****************************************************************************
+ Framing
+ *****************************************************************************/
+
+// The message length covers ins, p1, p2, retcode and the body
+mizar_uint32 MizarSimDevice::bodyLength(const TMizarMsg* msg)
+{
+	return msg->len < 4 ? 0 : msg->len - 4;
+}
+
+void MizarSimDevice::setBodyLength(TMizarMsg* msg, mizar_uint32 len)
+{
+	msg->len = (mizar_uint16) (len + 4);
+}
+
+// CRC-16/CCITT-FALSE
+mizar_uint16 MizarSimDevice::crc16(const mizar_uint8* data, mizar_uint32 len)
+{
+	mizar_uint16 crc = 0xFFFF;
+
+	for (mizar_uint32 i = 0; i < len; i++)
+	{
+		crc ^= (mizar_uint16) data[i] << 8;
+
+		for (int bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 0x8000) ? (mizar_uint16) ((crc << 1) ^ 0x1021) : (mizar_uint16) (crc << 1);
+		}
+	}
+
+	return crc;
+}
+
+// Serialises a message and sets its CRC; returns the length on the wire
+mizar_uint32 MizarSimDevice::encode(TMizarMsg* msg, mizar_uint8* wire)
+{
+	mizar_uint32 len = msg->len;
+
+	wire[4] = msg->ins;
+	wire[5] = msg->p1;
+	wire[6] = msg->p2;
+	wire[7] = msg->retcode;
+	if (len > 4) memcpy(&wire[MSG_HEAD_LEN], msg->body, len - 4);
+
+	msg->crc16 = crc16(&wire[MSG_HEAD_DATA_OFFSET], len);
+
+	wire[0] = (mizar_uint8) (len >> 8);
+	wire[1] = (mizar_uint8) len;
+	wire[2] = (mizar_uint8) (msg->crc16 >> 8);
+	wire[3] = (mizar_uint8) msg->crc16;
+
+	return MSG_HEAD_DATA_OFFSET + len;
+}
+
+mizar_uint32 MizarSimDevice::decode(const mizar_uint8* wire, mizar_uint32 wireLen, TMizarMsg* msg)
+{
+	if (wireLen < MSG_HEAD_LEN) return ERR_MSG_LEN;
+
+	mizar_uint32 len = ((mizar_uint32) wire[0] << 8) | wire[1];
+
+	if (len < 4 || len > MAX_SDIO_BODY_LEN + 4 || MSG_HEAD_DATA_OFFSET + len != wireLen) return ERR_MSG_LEN;
+
+	msg->len = (mizar_uint16) len;
+	msg->crc16 = (mizar_uint16) (((mizar_uint32) wire[2] << 8) | wire[3]);
+
+	if (crc16(&wire[MSG_HEAD_DATA_OFFSET], len) != msg->crc16) return ERR_MSG_CRC;
+
+	msg->ins = wire[4];
+	msg->p1 = wire[5];
+	msg->p2 = wire[6];
+	msg->retcode = wire[7];
+	if (len > 4) memcpy(msg->body, &wire[MSG_HEAD_LEN], len - 4);
+
+	return SUCCESS;
+}
+
+/*****************************************************************************
+ The chip
+ *****************************************************************************/
+
+// Return the chip on the given channel, NULL if there is none
+MizarSimDevice* MizarSimDevice::get(mizar_int32 nSn)
+{
+	// The chips are made on first use and never destroyed, they are still
+	// used by the static destructors of the library
+	static MizarSimDevice** devices = []
+	{
+		MizarSimDevice** all = new MizarSimDevice*[MIZAR_SIM_MAX_DEVICES];
+
+		for (int i = 0; i < MIZAR_SIM_MAX_DEVICES; i++)
+		{
+			all[i] = new MizarSimDevice();
+		}
+
+		return all;
+	}();
+
+	if (nSn < 0 || nSn >= MIZAR_SIM_MAX_DEVICES) return NULL;
+
+	return devices[nSn];
+}
+
+void MizarSimDevice::createLocks()
+{
+	for (int i = 0; i < MIZAR_SIM_MAX_DEVICES; i++)
+	{
+		MizarSimDevice* device = get(i);
+
+		if (device->busy == NULL)
+		{
+			device->busy = MutexFactory::i()->getMutex();
+			device->channelLock = MutexFactory::i()->getMutex();
+		}
+	}
+}
+
+void MizarSimDevice::releaseLocks()
+{
+	for (int i = 0; i < MIZAR_SIM_MAX_DEVICES; i++)
+	{
+		MizarSimDevice* device = get(i);
+
+		MutexFactory::i()->recycleMutex(device->busy);
+		MutexFactory::i()->recycleMutex(device->channelLock);
+		device->busy = NULL;
+		device->channelLock = NULL;
+	}
+}
+
+MizarSimDevice::MizarSimDevice()
+{
+	busy = NULL;
+	channelLock = NULL;
+	shaCTX = NULL;
+	spiHz = 0;
+	memset(latency, 0, sizeof(latency));
+	frameUs = 0;
+	commandCount = 0;
+	online = true;
+
+	configure();
+}
+
+MizarSimDevice::~MizarSimDevice()
+{
+	clearKeys();
+
+	EVP_MD_CTX_free(shaCTX);
+
+	MutexFactory::i()->recycleMutex(busy);
+	MutexFactory::i()->recycleMutex(channelLock);
+}
+
+// Clears all key and certificate slots
+void MizarSimDevice::clearKeys()
+{
+	MutexLocker lock(busy);
+
+	for (std::map<mizar_uint32, EVP_PKEY*>::iterator it = rsaSlots.begin(); it != rsaSlots.end(); ++it)
+	{
+		EVP_PKEY_free(it->second);
+	}
+	for (std::map<mizar_uint32, EVP_PKEY*>::iterator it = eccSlots.begin(); it != eccSlots.end(); ++it)
+	{
+		EVP_PKEY_free(it->second);
+	}
+	for (std::map<mizar_uint32, SymmSlot>::iterator it = symmSlots.begin(); it != symmSlots.end(); ++it)
+	{
+		OPENSSL_cleanse(&it->second.key[0], it->second.key.size());
+	}
+
+	rsaSlots.clear();
+	eccSlots.clear();
+	symmSlots.clear();
+	certSlots.clear();
+}
+
+// Reads MIZAR_SIM_SPI_HZ, MIZAR_SIM_FRAME_US and MIZAR_SIM_LATENCY
+void MizarSimDevice::configure()
+{
+	const char* hz = getenv("MIZAR_SIM_SPI_HZ");
+
+	if (hz != NULL)
+	{
+		spiHz = strtoul(hz, NULL, 10);
+	}
+
+	const char* frame = getenv("MIZAR_SIM_FRAME_US");
+
+	if (frame != NULL)
+	{
+		frameUs = strtoul(frame, NULL, 10);
+	}
+
+	const char* list = getenv("MIZAR_SIM_LATENCY");
+
+	if (list == NULL) return;
+
+	std::string entries(list);
+	size_t start = 0;
+
+	while (start < entries.size())
+	{
+		size_t end = entries.find(',', start);
+		if (end == std::string::npos) end = entries.size();
+
+		std::string entry = entries.substr(start, end - start);
+		size_t eq = entry.find('=');
+
+		if (eq != std::string::npos)
+		{
+			setLatency(entry.substr(0, eq), strtoul(entry.c_str() + eq + 1, NULL, 10));
+		}
+
+		start = end + 1;
+	}
+}
+
+void MizarSimDevice::setSpiSpeed(mizar_uint32 hz)
+{
+	MutexLocker lock(busy);
+
+	spiHz = hz;
+}
+
+void MizarSimDevice::setLatency(MizarSimIns ins, mizar_uint32 us)
+{
+	MutexLocker lock(busy);
+
+	latency[ins] = us;
+}
+
+bool MizarSimDevice::setLatency(const std::string& name, mizar_uint32 us)
+{
+	for (size_t i = 0; i < sizeof(insNames) / sizeof(insNames[0]); i++)
+	{
+		if (name == insNames[i].name)
+		{
+			setLatency(insNames[i].ins, us);
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void MizarSimDevice::setFrameOverhead(mizar_uint32 us)
+{
+	MutexLocker lock(busy);
+
+	frameUs = us;
+}
+
+void MizarSimDevice::setOnline(bool isOnline)
+{
+	online = isOnline;
+}
+
+mizar_uint64 MizarSimDevice::getCommandCount()
+{
+	MutexLocker lock(busy);
+
+	return commandCount;
+}
+
+// Waits for the modelled processing and transfer time
+void MizarSimDevice::delay(mizar_uint8 ins, mizar_uint32 bytes)
+{
+	mizar_uint64 us = frameUs + latency[ins];
+
+	if (spiHz > 0)
+	{
+		us += (mizar_uint64) bytes * 8 * 1000000 / spiHz;
+	}
+
+	if (us > 0)
+	{
+		std::this_thread::sleep_for(std::chrono::microseconds(us));
+	}
+}
+
+void MizarSimDevice::lockChannel()
+{
+	if (channelLock != NULL) channelLock->lock();
+}
+
+void MizarSimDevice::unlockChannel()
+{
+	if (channelLock != NULL) channelLock->unlock();
+}
+
+// Carries one framed command to the chip and its response back
+mizar_uint32 MizarSimDevice::transfer(const mizar_uint8* request, mizar_uint32 requestLen, mizar_uint8* response, mizar_uint32* responseLen)
+{
+	if (!online) return ERR_OPENDEV;
+
+	std::unique_ptr<TMizarMsg> in(new TMizarMsg);
+	std::unique_ptr<TMizarMsg> out(new TMizarMsg);
+
+	in->ins = in->p1 = in->p2 = 0;
+
+	mizar_uint32 rv = decode(request, requestLen, in.get());
+
+	out->ins = in->ins;
+	out->p1 = in->p1;
+	out->p2 = in->p2;
+	setBodyLength(out.get(), 0);
+
+	if (rv != SUCCESS)
+	{
+		// A damaged frame is answered without running the command
+		out->retcode = (mizar_uint8) rv;
+	}
+	else
+	{
+		MutexLocker lock(busy);
+
+		commandCount++;
+		execute(in.get(), out.get());
+		delay(in->ins, requestLen + MSG_HEAD_LEN + bodyLength(out.get()));
+	}
+
+	*responseLen = encode(out.get(), response);
+
+	return SUCCESS;
+}
+
+// Runs a command, the chip lock is held
+void MizarSimDevice::execute(const TMizarMsg* request, TMizarMsg* response)
+{
+	MizarSimReader in(request);
+	MizarSimWriter out(response, MAX_SDIO_BODY_LEN);
+	mizar_uint32 rv;
+
+	switch (request->ins)
+	{
+		case MIZAR_INS_GET_STATE:
+			out.u32(0);
+			rv = SUCCESS;
+			break;
+		case MIZAR_INS_GEN_RND:
+			rv = doGenRnd(in, out);
+			break;
+		case MIZAR_INS_SHA_INIT:
+		case MIZAR_INS_SHA_UPDATE:
+		case MIZAR_INS_SHA_FINAL:
+			rv = doSha(request->ins, in, out);
+			break;
+		case MIZAR_INS_GEN_RSA_KEY:
+			rv = doGenRsaKey(in, out);
+			break;
+		case MIZAR_INS_DEL_RSA_KEY:
+			rv = doDelKey(rsaSlots, in);
+			break;
+		case MIZAR_INS_QUERY_RSA_KEY:
+			rv = doQueryRsaKey(in, out);
+			break;
+		case MIZAR_INS_RSA_SK_INDEX:
+			rv = doRsaSkIndex(in, out);
+			break;
+		case MIZAR_INS_RSA_PK:
+			rv = doRsaPk(in, out);
+			break;
+		case MIZAR_INS_RSA_SK:
+			rv = doRsaSk(in, out);
+			break;
+		case MIZAR_INS_GEN_ECC_KEY:
+			rv = doGenEccKey(in, out);
+			break;
+		case MIZAR_INS_DEL_ECC_KEY:
+			rv = doDelKey(eccSlots, in);
+			break;
+		case MIZAR_INS_QUERY_ECC_KEY:
+			rv = doQueryEccKey(in, out);
+			break;
+		case MIZAR_INS_ECC_SIGN_INDEX:
+			rv = doEccSignIndex(in, out);
+			break;
+		case MIZAR_INS_ECC_VERIFY:
+			rv = doEccVerify(in, out);
+			break;
+		case MIZAR_INS_ECC_SIGN:
+			rv = doEccSign(in, out);
+			break;
+		case MIZAR_INS_SM2_SIGN:
+			rv = doSm2Sign(in, out);
+			break;
+		case MIZAR_INS_SM2_VERIFY:
+			rv = doSm2Verify(in, out);
+			break;
+		case MIZAR_INS_SM2_ENC:
+			rv = doSm2Enc(in, out);
+			break;
+		case MIZAR_INS_SM2_DEC:
+			rv = doSm2Dec(in, out);
+			break;
+		case MIZAR_INS_IMPORT_SYMM_KEY:
+			rv = doImportSymmKey(in, out);
+			break;
+		case MIZAR_INS_GEN_SYMM_KEY:
+			rv = doGenSymmKey(in, out);
+			break;
+		case MIZAR_INS_DEL_SYMM_KEY:
+			rv = doDelSymmKey(in, out);
+			break;
+		case MIZAR_INS_QUERY_SYMM_KEY:
+			rv = doQuerySymmKey(in, out);
+			break;
+		case MIZAR_INS_SYMM_INDEX:
+			rv = doSymmIndex(request->p1, request->p2, in, out);
+			break;
+		case MIZAR_INS_SYMM:
+			rv = doSymm(request->p1, request->p2, in, out);
+			break;
+		case MIZAR_INS_AES_CCM:
+			rv = doAesCcm(request->p1, in, out);
+			break;
+		case MIZAR_INS_ZUC_ENC:
+		case MIZAR_INS_ZUC_MAC:
+			rv = doZuc(request->ins, in, out);
+			break;
+		case MIZAR_INS_IMPORT_CERT:
+			rv = doImportCert(in, out);
+			break;
+		case MIZAR_INS_DEL_CERT:
+			rv = doDelCert(in, out);
+			break;
+		case MIZAR_INS_GET_CERT:
+			rv = doGetCert(in, out);
+			break;
+		case MIZAR_INS_GET_CERT_LIST:
+			rv = doGetCertList(in, out);
+			break;
+		default:
+			rv = ERR_NOT_SUPPORT;
+			break;
+	}
+
+	if (rv == SUCCESS && !out.ok()) rv = ERR_MSG_LEN;
+
+	// Errors carry no body
+	if (rv != SUCCESS) setBodyLength(response, 0);
+
+	response->retcode = (mizar_uint8) rv;
+}
+
+/*****************************************************************************
+ Helpers
+ *****************************************************************************/
+
+// Writes a big number left padded to len bytes, or unpadded if len is 0
+static bool writeBn(MizarSimWriter& out, const BIGNUM* bn, mizar_uint32 len)
+{
+	mizar_uint8 buf[512];
+
+	if (len == 0) len = BN_num_bytes(bn);
+	if (len > sizeof(buf) || BN_bn2binpad(bn, buf, len) < 0) return false;
+
+	out.bytes(buf, len);
+
+	return true;
+}
+
+// Writes the modulus of an RSA key left padded to len bytes, and its public
+// exponent unpadded if withExponent is set
+static bool writeRsaKey(MizarSimWriter& out, EVP_PKEY* pkey, mizar_uint32 len, bool withExponent)
+{
+	const RSA* rsa = EVP_PKEY_get0_RSA(pkey);
+	const BIGNUM* n = NULL;
+	const BIGNUM* e = NULL;
+
+	if (rsa == NULL) return false;
+
+	RSA_get0_key(rsa, &n, &e, NULL);
+
+	return writeBn(out, n, len) && (!withExponent || writeBn(out, e, 0));
+}
+
+// Writes the coordinates of the public point of an EC key, each left
+// padded to len bytes
+static bool writePoint(MizarSimWriter& out, EVP_PKEY* pkey, mizar_uint32 len)
+{
+	const EC_KEY* eckey = EVP_PKEY_get0_EC_KEY(pkey);
+	BIGNUM* x = BN_new();
+	BIGNUM* y = BN_new();
+	bool ok = eckey != NULL && x != NULL && y != NULL &&
+		EC_POINT_get_affine_coordinates(EC_KEY_get0_group(eckey), EC_KEY_get0_public_key(eckey), x, y, NULL) &&
+		writeBn(out, x, len) &&
+		writeBn(out, y, len);
+
+	BN_free(x);
+	BN_free(y);
+
+	return ok;
+}
+
+static mizar_uint32 eccCoordinateLength(EVP_PKEY* pkey)
+{
+	return (EVP_PKEY_bits(pkey) + 7) / 8;
+}
+
+// An EVP_PKEY for an EC key; one on the SM2 curve signs and encrypts with
+// SM2, which OpenSSL 1.1.1 has to be told
+static EVP_PKEY* eccKey(EC_KEY* eckey)
+{
+	EVP_PKEY* pkey = EVP_PKEY_new();
+
+	if (pkey == NULL || !EVP_PKEY_assign_EC_KEY(pkey, eckey))
+	{
+		EVP_PKEY_free(pkey);
+		EC_KEY_free(eckey);
+
+		return NULL;
+	}
+
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+	if (EC_GROUP_get_curve_name(EC_KEY_get0_group(eckey)) == NID_sm2 &&
+	    !EVP_PKEY_set_alias_type(pkey, EVP_PKEY_SM2))
+	{
+		EVP_PKEY_free(pkey);
+
+		return NULL;
+	}
+#endif
+
+	return pkey;
+}
+
+static EVP_PKEY* findSlot(std::map<mizar_uint32, EVP_PKEY*>& slots, mizar_uint32 index)
+{
+	std::map<mizar_uint32, EVP_PKEY*>::iterator it = slots.find(index);
+
+	return it == slots.end() ? NULL : it->second;
+}
+
+static void storeSlot(std::map<mizar_uint32, EVP_PKEY*>& slots, mizar_uint32 index, EVP_PKEY* pkey)
+{
+	EVP_PKEY_free(findSlot(slots, index));
+	slots[index] = pkey;
+}
+
+/*****************************************************************************
+ Commands
+ *****************************************************************************/
+
+mizar_uint32 MizarSimDevice::doGenRnd(MizarSimReader& in, MizarSimWriter& out)
+{
+	mizar_uint32 len;
+	mizar_uint8 buf[MAX_SDIO_BODY_LEN];
+
+	if (!in.u32(len) || len > MAX_SDIO_BODY_LEN - 4) return ERR_PARAMETER;
+	if (len > 0 && RAND_bytes(buf, len) != 1) return ERR_CALC;
+
+	out.bytes(buf, len);
+	OPENSSL_cleanse(buf, len);
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarSimDevice::doSha(mizar_uint8 ins, MizarSimReader& in, MizarSimWriter& out)
+{
+	if (ins == MIZAR_INS_SHA_INIT)
+	{
+		mizar_uint32 alg;
+		const EVP_MD* md;
+
+		if (!in.u32(alg)) return ERR_PARAMETER;
+
+		switch (alg)
+		{
+			case 1: md = EVP_sha1(); break;
+			case 2: md = EVP_sha224(); break;
+			case 3: md = EVP_sha256(); break;
+			case 16: md = EVP_sm3(); break;
+			default: return ERR_PARAMETER;
+		}
+
+		// A new digest replaces the one in progress
+		if (shaCTX == NULL) shaCTX = EVP_MD_CTX_new();
+		if (shaCTX == NULL || !EVP_DigestInit_ex(shaCTX, md, NULL))
+		{
+			EVP_MD_CTX_free(shaCTX);
+			shaCTX = NULL;
+			return ERR_CALC;
+		}
+
+		return SUCCESS;
+	}
+
+	if (shaCTX == NULL) return ERR_PARAMETER;
+
+	if (ins == MIZAR_INS_SHA_UPDATE)
+	{
+		const mizar_uint8* data;
+		mizar_uint32 len;
+
+		if (!in.bytes(data, len)) return ERR_PARAMETER;
+		if (!EVP_DigestUpdate(shaCTX, data, len)) return ERR_CALC;
+
+		return SUCCESS;
+	}
+
+	mizar_uint8 hash[EVP_MAX_MD_SIZE];
+	unsigned int hashLen = 0;
+	bool ok = EVP_DigestFinal_ex(shaCTX, hash, &hashLen);
+
+	EVP_MD_CTX_free(shaCTX);
+	shaCTX = NULL;
+
+	if (!ok) return ERR_CALC;
+
+	out.bytes(hash, hashLen);
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarSimDevice::doGenRsaKey(MizarSimReader& in, MizarSimWriter& out)
+{
+	mizar_uint32 index, modLen;
+	const mizar_uint8* e;
+	mizar_uint32 eLen;
+
+	if (!in.u32(index) || !in.u32(modLen) || !in.bytes(e, eLen)) return ERR_PARAMETER;
+	if (index >= MAX_RSA_NUM || modLen < 512 || modLen > 2048 || eLen == 0) return ERR_PARAMETER;
+
+	BIGNUM* exponent = BN_bin2bn(e, eLen, NULL);
+	EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+	EVP_PKEY* pkey = NULL;
+	bool ok = exponent != NULL && ctx != NULL &&
+		EVP_PKEY_keygen_init(ctx) > 0 &&
+		EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, modLen) > 0 &&
+		EVP_PKEY_CTX_set1_rsa_keygen_pubexp(ctx, exponent) > 0 &&
+		EVP_PKEY_keygen(ctx, &pkey) > 0;
+
+	BN_free(exponent);
+	EVP_PKEY_CTX_free(ctx);
+
+	if (!ok) return ERR_CALC;
+
+	if (!writeRsaKey(out, pkey, (modLen + 7) / 8, false))
+	{
+		EVP_PKEY_free(pkey);
+		return ERR_CALC;
+	}
+
+	storeSlot(rsaSlots, index, pkey);
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarSimDevice::doDelKey(std::map<mizar_uint32, EVP_PKEY*>& slots, MizarSimReader& in)
+{
+	mizar_uint32 index;
+
+	if (!in.u32(index)) return ERR_PARAMETER;
+
+	EVP_PKEY* pkey = findSlot(slots, index);
+	if (pkey == NULL) return ERR_PARAMETER;
+
+	EVP_PKEY_free(pkey);
+	slots.erase(index);
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarSimDevice::doQueryRsaKey(MizarSimReader& in, MizarSimWriter& out)
+{
+	mizar_uint32 index;
+
+	if (!in.u32(index)) return ERR_PARAMETER;
+
+	EVP_PKEY* pkey = findSlot(rsaSlots, index);
+	if (pkey == NULL) return ERR_PARAMETER;
+
+	if (!writeRsaKey(out, pkey, EVP_PKEY_size(pkey), true))
+	{
+		return ERR_CALC;
+	}
+
+	return SUCCESS;
+}
+
+// The raw RSA private key operation, p1 tells encryption from decryption
+// The raw RSA private key operation
+static mizar_uint32 rsaPrivate(EVP_PKEY* pkey, const mizar_uint8* data, mizar_uint32 len, MizarSimWriter& out)
+{
+	if (len != (mizar_uint32) EVP_PKEY_size(pkey)) return ERR_RSA_LEN;
+
+	mizar_uint8 result[512];
+	size_t resultLen = sizeof(result);
+	EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new(pkey, NULL);
+	bool ok = ctx != NULL &&
+		EVP_PKEY_decrypt_init(ctx) > 0 &&
+		EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_NO_PADDING) > 0 &&
+		EVP_PKEY_decrypt(ctx, result, &resultLen, data, len) > 0;
+
+	EVP_PKEY_CTX_free(ctx);
+
+	if (!ok) return ERR_CALC;
+
+	out.bytes(result, resultLen);
+	OPENSSL_cleanse(result, sizeof(result));
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarSimDevice::doRsaSkIndex(MizarSimReader& in, MizarSimWriter& out)
+{
+	mizar_uint32 index;
+	const mizar_uint8* data;
+	mizar_uint32 len;
+
+	if (!in.u32(index) || !in.bytes(data, len)) return ERR_PARAMETER;
+
+	EVP_PKEY* pkey = findSlot(rsaSlots, index);
+	if (pkey == NULL) return ERR_PARAMETER;
+
+	return rsaPrivate(pkey, data, len, out);
+}
+
+// The external private key is a DER encoded PKCS #1 RSAPrivateKey
+mizar_uint32 MizarSimDevice::doRsaSk(MizarSimReader& in, MizarSimWriter& out)
+{
+	const mizar_uint8 *key, *data;
+	mizar_uint32 keyLen, len;
+
+	if (!in.bytes(key, keyLen) || !in.bytes(data, len)) return ERR_PARAMETER;
+
+	const unsigned char* p = key;
+	EVP_PKEY* pkey = d2i_PrivateKey(EVP_PKEY_RSA, NULL, &p, keyLen);
+	if (pkey == NULL) return ERR_PARAMETER;
+
+	mizar_uint32 rv = rsaPrivate(pkey, data, len, out);
+	EVP_PKEY_free(pkey);
+
+	return rv;
+}
+
+// The raw RSA public key operation
+mizar_uint32 MizarSimDevice::doRsaPk(MizarSimReader& in, MizarSimWriter& out)
+{
+	const mizar_uint8 *n, *e, *data;
+	mizar_uint32 nLen, eLen, len;
+
+	if (!in.bytes(n, nLen) || !in.bytes(e, eLen) || !in.bytes(data, len)) return ERR_PARAMETER;
+	if (len != nLen) return ERR_RSA_LEN;
+
+	BN_CTX* ctx = BN_CTX_new();
+	BIGNUM* bnN = BN_bin2bn(n, nLen, NULL);
+	BIGNUM* bnE = BN_bin2bn(e, eLen, NULL);
+	BIGNUM* m = BN_bin2bn(data, len, NULL);
+	BIGNUM* c = BN_new();
+	bool ok = ctx != NULL && bnN != NULL && bnE != NULL && m != NULL && c != NULL &&
+		BN_cmp(m, bnN) < 0 &&
+		BN_mod_exp(c, m, bnE, bnN, ctx) &&
+		writeBn(out, c, nLen);
+
+	BN_free(c);
+	BN_free(m);
+	BN_free(bnE);
+	BN_free(bnN);
+	BN_CTX_free(ctx);
+
+	return ok ? SUCCESS : ERR_CALC;
+}
+
+mizar_uint32 MizarSimDevice::doGenEccKey(MizarSimReader& in, MizarSimWriter& out)
+{
+	mizar_uint32 index, group;
+
+	if (!in.u32(index) || !in.u32(group)) return ERR_PARAMETER;
+	if (index >= MAX_ECC_NUM) return ERR_PARAMETER;
+
+	EC_KEY* eckey = EC_KEY_new_by_curve_name(group);
+	if (eckey == NULL) return ERR_PARAMETER;
+
+	if (!EC_KEY_generate_key(eckey))
+	{
+		EC_KEY_free(eckey);
+		return ERR_CALC;
+	}
+
+	EVP_PKEY* pkey = eccKey(eckey);
+	if (pkey == NULL) return ERR_CALC;
+
+	if (!writePoint(out, pkey, eccCoordinateLength(pkey)))
+	{
+		EVP_PKEY_free(pkey);
+		return ERR_CALC;
+	}
+
+	storeSlot(eccSlots, index, pkey);
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarSimDevice::doQueryEccKey(MizarSimReader& in, MizarSimWriter& out)
+{
+	mizar_uint32 index;
+
+	if (!in.u32(index)) return ERR_PARAMETER;
+
+	EVP_PKEY* pkey = findSlot(eccSlots, index);
+	if (pkey == NULL) return ERR_PARAMETER;
+
+	const EC_KEY* eckey = EVP_PKEY_get0_EC_KEY(pkey);
+	if (eckey == NULL) return ERR_CALC;
+
+	out.u32(EC_GROUP_get_curve_name(EC_KEY_get0_group(eckey)));
+
+	if (!writePoint(out, pkey, eccCoordinateLength(pkey)))
+	{
+		return ERR_CALC;
+	}
+
+	return SUCCESS;
+}
+
+// Signs the data, or its digest if md is set; the signature is r || s
+static mizar_uint32 eccSign(EVP_PKEY* pkey, const EVP_MD* md, const mizar_uint8* data, mizar_uint32 len, MizarSimWriter& out)
+{
+	mizar_uint8 digest[EVP_MAX_MD_SIZE];
+	if (md != NULL)
+	{
+		unsigned int digestLen = 0;
+		if (!EVP_Digest(data, len, digest, &digestLen, md, NULL)) return ERR_CALC;
+		data = digest;
+		len = digestLen;
+	}
+
+	mizar_uint8 der[256];
+	size_t derLen = sizeof(der);
+	EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new(pkey, NULL);
+	bool ok = ctx != NULL &&
+		EVP_PKEY_sign_init(ctx) > 0 &&
+		EVP_PKEY_sign(ctx, der, &derLen, data, len) > 0;
+
+	EVP_PKEY_CTX_free(ctx);
+
+	if (!ok) return ERR_CALC;
+
+	const unsigned char* p = der;
+	ECDSA_SIG* sig = d2i_ECDSA_SIG(NULL, &p, derLen);
+	if (sig == NULL) return ERR_CALC;
+
+	mizar_uint32 coordLen = eccCoordinateLength(pkey);
+	ok = writeBn(out, ECDSA_SIG_get0_r(sig), coordLen) && writeBn(out, ECDSA_SIG_get0_s(sig), coordLen);
+	ECDSA_SIG_free(sig);
+
+	return ok ? SUCCESS : ERR_CALC;
+}
+
+// Verifies r || s over the data, or over its digest if md is set
+static mizar_uint32 eccVerify(EVP_PKEY* pkey, const EVP_MD* md, const mizar_uint8* r, mizar_uint32 rLen,
+    const mizar_uint8* s, mizar_uint32 sLen, const mizar_uint8* data, mizar_uint32 len)
+{
+	mizar_uint8 digest[EVP_MAX_MD_SIZE];
+	if (md != NULL)
+	{
+		unsigned int digestLen = 0;
+		if (!EVP_Digest(data, len, digest, &digestLen, md, NULL)) return ERR_CALC;
+		data = digest;
+		len = digestLen;
+	}
+
+	// DER encode r and s
+	ECDSA_SIG* sig = ECDSA_SIG_new();
+	BIGNUM* bnR = BN_bin2bn(r, rLen, NULL);
+	BIGNUM* bnS = BN_bin2bn(s, sLen, NULL);
+	mizar_uint8* der = NULL;
+	int derLen = -1;
+
+	if (sig != NULL && bnR != NULL && bnS != NULL && ECDSA_SIG_set0(sig, bnR, bnS))
+	{
+		bnR = bnS = NULL;
+		derLen = i2d_ECDSA_SIG(sig, &der);
+	}
+
+	BN_free(bnR);
+	BN_free(bnS);
+	ECDSA_SIG_free(sig);
+
+	int verified = 0;
+	EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new(pkey, NULL);
+
+	if (ctx != NULL && derLen > 0 && EVP_PKEY_verify_init(ctx) > 0)
+	{
+		verified = EVP_PKEY_verify(ctx, der, derLen, data, len);
+	}
+
+	EVP_PKEY_CTX_free(ctx);
+	OPENSSL_free(der);
+
+	return verified == 1 ? SUCCESS : ERR_CALC;
+}
+
+// An EC key on the curve from the big endian private scalar
+static EVP_PKEY* eccPrivateKey(int curve, const mizar_uint8* key, mizar_uint32 keyLen)
+{
+	EC_KEY* eckey = EC_KEY_new_by_curve_name(curve);
+	BIGNUM* d = BN_bin2bn(key, keyLen, NULL);
+	EC_POINT* pub = eckey != NULL ? EC_POINT_new(EC_KEY_get0_group(eckey)) : NULL;
+
+	// The public point comes with it
+	bool ok = d != NULL && pub != NULL &&
+		EC_KEY_set_private_key(eckey, d) &&
+		EC_POINT_mul(EC_KEY_get0_group(eckey), pub, d, NULL, NULL, NULL) &&
+		EC_KEY_set_public_key(eckey, pub);
+
+	EC_POINT_free(pub);
+	BN_clear_free(d);
+
+	if (!ok)
+	{
+		EC_KEY_free(eckey);
+
+		return NULL;
+	}
+
+	return eccKey(eckey);
+}
+
+// An EC key on the curve from the coordinates of the public point
+static EVP_PKEY* eccPublicKey(int curve, const mizar_uint8* x, const mizar_uint8* y, mizar_uint32 len)
+{
+	EC_KEY* eckey = EC_KEY_new_by_curve_name(curve);
+	BIGNUM* bnX = BN_bin2bn(x, len, NULL);
+	BIGNUM* bnY = BN_bin2bn(y, len, NULL);
+	bool ok = eckey != NULL && bnX != NULL && bnY != NULL &&
+		EC_KEY_set_public_key_affine_coordinates(eckey, bnX, bnY);
+
+	BN_free(bnX);
+	BN_free(bnY);
+
+	if (!ok)
+	{
+		EC_KEY_free(eckey);
+
+		return NULL;
+	}
+
+	return eccKey(eckey);
+}
+
+mizar_uint32 MizarSimDevice::doEccSignIndex(MizarSimReader& in, MizarSimWriter& out)
+{
+	mizar_uint32 index, hashFlag;
+	const mizar_uint8* data;
+	mizar_uint32 len;
+
+	if (!in.u32(index) || !in.u32(hashFlag) || !in.bytes(data, len)) return ERR_PARAMETER;
+
+	EVP_PKEY* pkey = findSlot(eccSlots, index);
+	if (pkey == NULL) return ERR_PARAMETER;
+
+	return eccSign(pkey, hashFlag ? EVP_sha256() : NULL, data, len, out);
+}
+
+// The external private key is the big endian private scalar
+mizar_uint32 MizarSimDevice::doEccSign(MizarSimReader& in, MizarSimWriter& out)
+{
+	mizar_uint32 group, hashFlag;
+	const mizar_uint8 *key, *data;
+	mizar_uint32 keyLen, len;
+
+	if (!in.u32(group) || !in.u32(hashFlag) || !in.bytes(key, keyLen) || !in.bytes(data, len)) return ERR_PARAMETER;
+
+	if (keyLen == 0 || keyLen > 66) return ERR_PARAMETER;
+
+	EVP_PKEY* pkey = eccPrivateKey(group, key, keyLen);
+	if (pkey == NULL) return ERR_PARAMETER;
+
+	mizar_uint32 rv = eccSign(pkey, hashFlag ? EVP_sha256() : NULL, data, len, out);
+	EVP_PKEY_free(pkey);
+
+	return rv;
+}
+
+mizar_uint32 MizarSimDevice::doEccVerify(MizarSimReader& in, MizarSimWriter& /*out*/)
+{
+	mizar_uint32 group, hashFlag;
+	const mizar_uint8 *x, *y, *r, *s, *data;
+	mizar_uint32 xLen, yLen, rLen, sLen, len;
+
+	if (!in.u32(group) || !in.u32(hashFlag) || !in.bytes(x, xLen) || !in.bytes(y, yLen) ||
+	    !in.bytes(r, rLen) || !in.bytes(s, sLen) || !in.bytes(data, len))
+	{
+		return ERR_PARAMETER;
+	}
+
+	if (xLen == 0 || xLen != yLen || xLen > 66) return ERR_PARAMETER;
+
+	EVP_PKEY* pkey = eccPublicKey(group, x, y, xLen);
+	if (pkey == NULL) return ERR_PARAMETER;
+
+	mizar_uint32 rv = eccVerify(pkey, hashFlag ? EVP_sha256() : NULL, r, rLen, s, sLen, data, len);
+	EVP_PKEY_free(pkey);
+
+	return rv;
+}
+
+/*****************************************************************************
+ SM2
+ *****************************************************************************/
+
+// The SM2 keys, coordinates and signature halves are 32 bytes
+#define SM2_LEN 32
+
+// A hash flag of 1 signs the SM3 digest of the data, 0 signs the data,
+// which is then the 32 byte digest e
+mizar_uint32 MizarSimDevice::doSm2Sign(MizarSimReader& in, MizarSimWriter& out)
+{
+	mizar_uint32 hashFlag;
+	const mizar_uint8 *key, *data;
+	mizar_uint32 keyLen, len;
+
+	if (!in.u32(hashFlag) || !in.bytes(key, keyLen) || !in.bytes(data, len)) return ERR_PARAMETER;
+	if (keyLen != SM2_LEN) return ERR_KEY_LEN;
+	if (!hashFlag && len != SM2_LEN) return ERR_DATA_LEN;
+
+	EVP_PKEY* pkey = eccPrivateKey(NID_sm2, key, keyLen);
+	if (pkey == NULL) return ERR_PARAMETER;
+
+	mizar_uint32 rv = eccSign(pkey, hashFlag ? EVP_sm3() : NULL, data, len, out);
+	EVP_PKEY_free(pkey);
+
+	return rv;
+}
+
+mizar_uint32 MizarSimDevice::doSm2Verify(MizarSimReader& in, MizarSimWriter& /*out*/)
+{
+	mizar_uint32 hashFlag;
+	const mizar_uint8 *x, *y, *r, *s, *data;
+	mizar_uint32 xLen, yLen, rLen, sLen, len;
+
+	if (!in.u32(hashFlag) || !in.bytes(x, xLen) || !in.bytes(y, yLen) ||
+	    !in.bytes(r, rLen) || !in.bytes(s, sLen) || !in.bytes(data, len))
+	{
+		return ERR_PARAMETER;
+	}
+
+	if (xLen != SM2_LEN || yLen != SM2_LEN) return ERR_KEY_LEN;
+	if (!hashFlag && len != SM2_LEN) return ERR_DATA_LEN;
+
+	EVP_PKEY* pkey = eccPublicKey(NID_sm2, x, y, xLen);
+	if (pkey == NULL) return ERR_PARAMETER;
+
+	mizar_uint32 rv = eccVerify(pkey, hashFlag ? EVP_sm3() : NULL, r, rLen, s, sLen, data, len);
+	EVP_PKEY_free(pkey);
+
+	return rv;
+}
+
+// The key derivation function of GM/T 0003.4: SM3 over Z || ct with a 32
+// bit counter from 1 on, XORed into the data. False if all the key bits
+// were zero
+static bool sm2Kdf(const mizar_uint8* z, mizar_uint32 zLen, mizar_uint8* data, mizar_uint32 len)
+{
+	mizar_uint8 nonZero = 0;
+
+	for (mizar_uint32 done = 0, ct = 1; done < len; ct++)
+	{
+		mizar_uint8 counter[4] = { (mizar_uint8) (ct >> 24), (mizar_uint8) (ct >> 16), (mizar_uint8) (ct >> 8), (mizar_uint8) ct };
+		mizar_uint8 t[SM2_LEN];
+		EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+		bool ok = ctx != NULL &&
+			EVP_DigestInit_ex(ctx, EVP_sm3(), NULL) &&
+			EVP_DigestUpdate(ctx, z, zLen) &&
+			EVP_DigestUpdate(ctx, counter, sizeof(counter)) &&
+			EVP_DigestFinal_ex(ctx, t, NULL);
+
+		EVP_MD_CTX_free(ctx);
+		if (!ok) return false;
+
+		for (mizar_uint32 i = 0; i < SM2_LEN && done < len; i++, done++)
+		{
+			nonZero |= t[i];
+			data[done] ^= t[i];
+		}
+	}
+
+	return nonZero != 0;
+}
+
+// C3 = SM3(x2 || M || y2)
+static bool sm2Hash(const mizar_uint8* x2y2, const mizar_uint8* msg, mizar_uint32 len, mizar_uint8* c3)
+{
+	EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+	bool ok = ctx != NULL &&
+		EVP_DigestInit_ex(ctx, EVP_sm3(), NULL) &&
+		EVP_DigestUpdate(ctx, x2y2, SM2_LEN) &&
+		EVP_DigestUpdate(ctx, msg, len) &&
+		EVP_DigestUpdate(ctx, x2y2 + SM2_LEN, SM2_LEN) &&
+		EVP_DigestFinal_ex(ctx, c3, NULL);
+
+	EVP_MD_CTX_free(ctx);
+
+	return ok;
+}
+
+// x2 || y2 of the point multiplied by k
+static bool sm2Multiply(const EC_GROUP* group, const EC_POINT* point, const BIGNUM* k, mizar_uint8* x2y2, BN_CTX* bnCtx)
+{
+	EC_POINT* product = EC_POINT_new(group);
+	BIGNUM* x = BN_new();
+	BIGNUM* y = BN_new();
+	bool ok = product != NULL && x != NULL && y != NULL &&
+		EC_POINT_mul(group, product, NULL, point, k, bnCtx) &&
+		!EC_POINT_is_at_infinity(group, product) &&
+		EC_POINT_get_affine_coordinates(group, product, x, y, bnCtx) &&
+		BN_bn2binpad(x, x2y2, SM2_LEN) == SM2_LEN &&
+		BN_bn2binpad(y, x2y2 + SM2_LEN, SM2_LEN) == SM2_LEN;
+
+	EC_POINT_free(product);
+	BN_free(x);
+	BN_free(y);
+
+	return ok;
+}
+
+// The ciphertext is C1 || C2 || C3, C1 the uncompressed point kG
+mizar_uint32 MizarSimDevice::doSm2Enc(MizarSimReader& in, MizarSimWriter& out)
+{
+	const mizar_uint8 *x, *y, *data;
+	mizar_uint32 xLen, yLen, len;
+
+	if (!in.bytes(x, xLen) || !in.bytes(y, yLen) || !in.bytes(data, len)) return ERR_PARAMETER;
+	if (xLen != SM2_LEN || yLen != SM2_LEN) return ERR_KEY_LEN;
+	if (len == 0 || len > MAX_SDIO_BODY_LEN) return ERR_DATA_LEN;
+
+	mizar_uint32 cipherLen = 1 + 3 * SM2_LEN + len;
+	std::unique_ptr<mizar_uint8[]> cipher(new mizar_uint8[cipherLen]);
+	mizar_uint8* c1 = cipher.get();
+	mizar_uint8* c2 = c1 + 1 + 2 * SM2_LEN;
+	mizar_uint8* c3 = c2 + len;
+
+	c1[0] = 0x04;
+	memcpy(c1 + 1, x, SM2_LEN);
+	memcpy(c1 + 1 + SM2_LEN, y, SM2_LEN);
+
+	EC_GROUP* group = EC_GROUP_new_by_curve_name(NID_sm2);
+	EC_POINT* pub = group != NULL ? EC_POINT_new(group) : NULL;
+	BN_CTX* bnCtx = BN_CTX_new();
+	BIGNUM* k = BN_new();
+	mizar_uint8 x2y2[2 * SM2_LEN];
+	mizar_uint32 rv = ERR_CALC;
+
+	if (pub == NULL || bnCtx == NULL || k == NULL)
+	{
+		rv = ERR_CALC;
+	}
+	else if (!EC_POINT_oct2point(group, pub, c1, 1 + 2 * SM2_LEN, bnCtx))
+	{
+		rv = ERR_UNCOMPRESS_PK;
+	}
+	else
+	{
+		// A key stream of zeros is rejected, with another k
+		for (int attempt = 0; attempt < 8 && rv != SUCCESS; attempt++)
+		{
+			memcpy(c2, data, len);
+
+			if (!BN_priv_rand_range(k, EC_GROUP_get0_order(group)) || BN_is_zero(k) ||
+			    !sm2Multiply(group, EC_GROUP_get0_generator(group), k, c1 + 1, bnCtx) ||
+			    !sm2Multiply(group, pub, k, x2y2, bnCtx))
+			{
+				break;
+			}
+
+			if (sm2Kdf(x2y2, sizeof(x2y2), c2, len) && sm2Hash(x2y2, data, len, c3))
+			{
+				rv = SUCCESS;
+			}
+		}
+	}
+
+	if (rv == SUCCESS) out.bytes(cipher.get(), cipherLen);
+
+	EC_POINT_free(pub);
+	EC_GROUP_free(group);
+	BN_CTX_free(bnCtx);
+	BN_clear_free(k);
+	OPENSSL_cleanse(x2y2, sizeof(x2y2));
+
+	return rv;
+}
+
+mizar_uint32 MizarSimDevice::doSm2Dec(MizarSimReader& in, MizarSimWriter& out)
+{
+	const mizar_uint8 *key, *data;
+	mizar_uint32 keyLen, len;
+
+	if (!in.bytes(key, keyLen) || !in.bytes(data, len)) return ERR_PARAMETER;
+	if (keyLen != SM2_LEN) return ERR_KEY_LEN;
+	if (len <= 1 + 3 * SM2_LEN) return ERR_DATA_LEN;
+
+	mizar_uint32 plainLen = len - 1 - 3 * SM2_LEN;
+	const mizar_uint8* c1 = data;
+	const mizar_uint8* c2 = c1 + 1 + 2 * SM2_LEN;
+	const mizar_uint8* c3 = c2 + plainLen;
+	std::unique_ptr<mizar_uint8[]> plain(new mizar_uint8[plainLen]);
+
+	EC_GROUP* group = EC_GROUP_new_by_curve_name(NID_sm2);
+	EC_POINT* point = group != NULL ? EC_POINT_new(group) : NULL;
+	BN_CTX* bnCtx = BN_CTX_new();
+	BIGNUM* d = BN_bin2bn(key, keyLen, NULL);
+	mizar_uint8 x2y2[2 * SM2_LEN];
+	mizar_uint8 hash[SM2_LEN];
+	mizar_uint32 rv = ERR_CALC;
+
+	memcpy(plain.get(), c2, plainLen);
+
+	if (point == NULL || bnCtx == NULL || d == NULL)
+	{
+		rv = ERR_CALC;
+	}
+	else if (c1[0] != 0x04 || !EC_POINT_oct2point(group, point, c1, 1 + 2 * SM2_LEN, bnCtx))
+	{
+		rv = ERR_UNCOMPRESS_PK;
+	}
+	else if (sm2Multiply(group, point, d, x2y2, bnCtx) &&
+		 sm2Kdf(x2y2, sizeof(x2y2), plain.get(), plainLen) &&
+		 sm2Hash(x2y2, plain.get(), plainLen, hash) &&
+		 CRYPTO_memcmp(hash, c3, SM2_LEN) == 0)
+	{
+		out.bytes(plain.get(), plainLen);
+		rv = SUCCESS;
+	}
+
+	EC_POINT_free(point);
+	EC_GROUP_free(group);
+	BN_CTX_free(bnCtx);
+	BN_clear_free(d);
+	OPENSSL_cleanse(x2y2, sizeof(x2y2));
+	OPENSSL_cleanse(plain.get(), plainLen);
+
+	return rv;
+}
+
+// Symmetric keys are imported as plaintext: 2 bytes length + key
+mizar_uint32 MizarSimDevice::doImportSymmKey(MizarSimReader& in, MizarSimWriter& /*out*/)
+{
+	mizar_uint32 alg, index, lock;
+	const mizar_uint8* key;
+	mizar_uint32 keyLen;
+
+	if (!in.u32(alg) || !in.u32(index) || !in.u32(lock) || !in.bytes(key, keyLen)) return ERR_PARAMETER;
+	if (keyLen < 2 || index >= MAX_SYMM_NUM) return ERR_PARAMETER;
+
+	mizar_uint32 len = ((mizar_uint32) key[0] << 8) | key[1];
+
+	if (len + 2 > keyLen) return ERR_KEY_LEN;
+	if ((alg == SYMM_ALG_AES && len != 16 && len != 24 && len != 32) ||
+	    (alg == SYMM_ALG_SM4 && len != 16) ||
+	    (alg == SYMM_ALG_DES && len != 8 && len != 16 && len != 24) ||
+	    len == 0 || len > 32)
+	{
+		return ERR_KEY_LEN;
+	}
+
+	std::map<mizar_uint32, SymmSlot>::iterator it = symmSlots.find(index);
+	if (it != symmSlots.end() && it->second.lock) return ERR_ACCESS_DENY;
+
+	SymmSlot& slot = symmSlots[index];
+	slot.alg = alg;
+	slot.lock = lock;
+	slot.key.assign(key + 2, len);
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarSimDevice::doGenSymmKey(MizarSimReader& in, MizarSimWriter& out)
+{
+	mizar_uint32 alg, index, lock, keyLen;
+
+	if (!in.u32(alg) || !in.u32(index) || !in.u32(lock) || !in.u32(keyLen)) return ERR_PARAMETER;
+	if (keyLen == 0 || keyLen > 32) return ERR_KEY_LEN;
+
+	// Reuse the import path with a fresh plaintext key
+	TMizarMsg* msg = new TMizarMsg;
+	MizarSimWriter writer(msg, MAX_SDIO_BODY_LEN);
+	mizar_uint8 plain[34];
+
+	plain[0] = 0;
+	plain[1] = (mizar_uint8) keyLen;
+
+	if (RAND_bytes(plain + 2, keyLen) != 1)
+	{
+		delete msg;
+		return ERR_CALC;
+	}
+
+	writer.u32(alg);
+	writer.u32(index);
+	writer.u32(lock);
+	writer.bytes(plain, keyLen + 2);
+	OPENSSL_cleanse(plain, sizeof(plain));
+
+	MizarSimReader reader(msg);
+	mizar_uint32 rv = doImportSymmKey(reader, out);
+
+	OPENSSL_cleanse(msg->body, bodyLength(msg));
+	delete msg;
+
+	return rv;
+}
+
+mizar_uint32 MizarSimDevice::doDelSymmKey(MizarSimReader& in, MizarSimWriter& /*out*/)
+{
+	mizar_uint32 index;
+
+	if (!in.u32(index)) return ERR_PARAMETER;
+
+	std::map<mizar_uint32, SymmSlot>::iterator it = symmSlots.find(index);
+	if (it == symmSlots.end()) return ERR_PARAMETER;
+	if (it->second.lock) return ERR_ACCESS_DENY;
+
+	OPENSSL_cleanse(&it->second.key[0], it->second.key.size());
+	symmSlots.erase(it);
+
+	return SUCCESS;
+}
+
+// Picks the OpenSSL cipher for a key slot
+static const EVP_CIPHER* slotCipher(mizar_uint32 alg, size_t keyLen, mizar_uint8 mode)
+{
+	bool cbc = mode == MIZAR_SIM_MODE_CBC;
+
+	// Only SM4 has the stream modes
+	if (mode > MIZAR_SIM_MODE_CBC && alg != SYMM_ALG_SM4) return NULL;
+
+	switch (alg)
+	{
+		case SYMM_ALG_AES:
+			if (keyLen == 16) return cbc ? EVP_aes_128_cbc() : EVP_aes_128_ecb();
+			if (keyLen == 24) return cbc ? EVP_aes_192_cbc() : EVP_aes_192_ecb();
+			if (keyLen == 32) return cbc ? EVP_aes_256_cbc() : EVP_aes_256_ecb();
+			return NULL;
+		case SYMM_ALG_SM4:
+			if (keyLen != 16) return NULL;
+			if (mode == MIZAR_SIM_MODE_OFB) return EVP_sm4_ofb();
+			if (mode == MIZAR_SIM_MODE_CTR) return EVP_sm4_ctr();
+			return cbc ? EVP_sm4_cbc() : EVP_sm4_ecb();
+		case SYMM_ALG_DES:
+			if (keyLen == 8) return cbc ? EVP_des_cbc() : EVP_des_ecb();
+			if (keyLen == 16) return cbc ? EVP_des_ede_cbc() : EVP_des_ede_ecb();
+			if (keyLen == 24) return cbc ? EVP_des_ede3_cbc() : EVP_des_ede3_ecb();
+			return NULL;
+		default:
+			return NULL;
+	}
+}
+
+mizar_uint32 MizarSimDevice::doQuerySymmKey(MizarSimReader& in, MizarSimWriter& out)
+{
+	mizar_uint32 index;
+
+	if (!in.u32(index)) return ERR_PARAMETER;
+
+	std::map<mizar_uint32, SymmSlot>::iterator it = symmSlots.find(index);
+	if (it == symmSlots.end()) return ERR_PARAMETER;
+
+	// The check value is the first 3 bytes of an encrypted zero block
+	mizar_uint8 cv[3] = { 0, 0, 0 };
+	const EVP_CIPHER* cipher = slotCipher(it->second.alg, it->second.key.size(), MIZAR_SIM_MODE_ECB);
+
+	if (cipher != NULL)
+	{
+		mizar_uint8 zero[16] = { 0 };
+		mizar_uint8 block[32];
+		int blockLen = 0;
+		EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+
+		if (ctx != NULL &&
+		    EVP_EncryptInit_ex(ctx, cipher, NULL, it->second.key.data(), NULL) &&
+		    EVP_CIPHER_CTX_set_padding(ctx, 0) &&
+		    EVP_EncryptUpdate(ctx, block, &blockLen, zero, EVP_CIPHER_block_size(cipher)))
+		{
+			memcpy(cv, block, sizeof(cv));
+		}
+
+		EVP_CIPHER_CTX_free(ctx);
+	}
+
+	out.u32(it->second.key.size());
+	out.u32(it->second.alg);
+	out.u32(it->second.lock);
+	out.bytes(cv, sizeof(cv));
+
+	return SUCCESS;
+}
+
+// Encryption (p1 0) or decryption (p1 1) in the mode given by p2
+static mizar_uint32 symmCrypt(mizar_uint8 p1, mizar_uint8 p2, mizar_uint32 alg, const mizar_uint8* key, size_t keyLen,
+    const mizar_uint8* iv, mizar_uint32 ivLen, const mizar_uint8* data, mizar_uint32 len, MizarSimWriter& out)
+{
+	if (p1 > 1 || p2 > MIZAR_SIM_MODE_CTR) return ERR_PARAMETER;
+
+	bool hasIV = p2 != MIZAR_SIM_MODE_ECB;
+	const EVP_CIPHER* cipher = slotCipher(alg, keyLen, p2);
+	if (cipher == NULL) return ERR_NOT_SUPPORT;
+
+	// The stream modes have a block size of 1
+	mizar_uint32 blockSize = EVP_CIPHER_block_size(cipher);
+	if (len % blockSize != 0 || (hasIV && ivLen != (mizar_uint32) EVP_CIPHER_iv_length(cipher)))
+	{
+		return ERR_DATA_LEN;
+	}
+
+	mizar_uint8 result[MAX_SDIO_BODY_LEN];
+	int resultLen = 0;
+	EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+	bool ok = ctx != NULL && len <= sizeof(result) &&
+		EVP_CipherInit_ex(ctx, cipher, NULL, key, hasIV ? iv : NULL, p1 == 0) &&
+		EVP_CIPHER_CTX_set_padding(ctx, 0) &&
+		EVP_CipherUpdate(ctx, result, &resultLen, data, len);
+
+	EVP_CIPHER_CTX_free(ctx);
+
+	if (!ok) return ERR_CALC;
+
+	out.bytes(result, resultLen);
+	OPENSSL_cleanse(result, resultLen);
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarSimDevice::doSymmIndex(mizar_uint8 p1, mizar_uint8 p2, MizarSimReader& in, MizarSimWriter& out)
+{
+	mizar_uint32 alg, index;
+	const mizar_uint8 *iv, *data;
+	mizar_uint32 ivLen, len;
+
+	if (!in.u32(alg) || !in.u32(index) || !in.bytes(iv, ivLen) || !in.bytes(data, len)) return ERR_PARAMETER;
+
+	std::map<mizar_uint32, SymmSlot>::iterator it = symmSlots.find(index);
+	if (it == symmSlots.end() || it->second.alg != alg) return ERR_PARAMETER;
+
+	return symmCrypt(p1, p2, alg, it->second.key.data(), it->second.key.size(), iv, ivLen, data, len, out);
+}
+
+// The same with the key in the message
+mizar_uint32 MizarSimDevice::doSymm(mizar_uint8 p1, mizar_uint8 p2, MizarSimReader& in, MizarSimWriter& out)
+{
+	mizar_uint32 alg;
+	const mizar_uint8 *key, *iv, *data;
+	mizar_uint32 keyLen, ivLen, len;
+
+	if (!in.u32(alg) || !in.bytes(key, keyLen) || !in.bytes(iv, ivLen) || !in.bytes(data, len)) return ERR_PARAMETER;
+
+	return symmCrypt(p1, p2, alg, key, keyLen, iv, ivLen, data, len, out);
+}
+
+// AES-CCM with a 12 byte nonce, a 16 byte tag and no associated data;
+// encryption (p1 0) returns ciphertext || tag, decryption (p1 1) takes it
+mizar_uint32 MizarSimDevice::doAesCcm(mizar_uint8 p1, MizarSimReader& in, MizarSimWriter& out)
+{
+	const mizar_uint8 *key, *nonce, *data;
+	mizar_uint32 keyLen, nonceLen, len;
+
+	if (p1 > 1 || !in.bytes(key, keyLen) || !in.bytes(nonce, nonceLen) || !in.bytes(data, len)) return ERR_PARAMETER;
+	if (nonceLen != 12) return ERR_PARAMETER;
+
+	const EVP_CIPHER* cipher;
+	switch (keyLen)
+	{
+		case 16: cipher = EVP_aes_128_ccm(); break;
+		case 24: cipher = EVP_aes_192_ccm(); break;
+		case 32: cipher = EVP_aes_256_ccm(); break;
+		default: return ERR_KEY_LEN;
+	}
+
+	const mizar_uint32 tagLen = 16;
+	bool encrypt = p1 == 0;
+
+	if (encrypt ? (len < 1 || len > 1024) : (len < 1 + tagLen || len > 1024 + tagLen)) return ERR_DATA_LEN;
+
+	mizar_uint32 textLen = encrypt ? len : len - tagLen;
+	mizar_uint8 result[1024 + 16];
+	int resultLen = 0;
+	EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+	bool ok = ctx != NULL &&
+		EVP_CipherInit_ex(ctx, cipher, NULL, NULL, NULL, encrypt) &&
+		EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_CCM_SET_IVLEN, nonceLen, NULL) &&
+		EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_CCM_SET_TAG, tagLen, encrypt ? NULL : (void*) (data + textLen)) &&
+		EVP_CipherInit_ex(ctx, NULL, NULL, key, nonce, encrypt) &&
+		EVP_CipherUpdate(ctx, NULL, &resultLen, NULL, textLen);
+
+	// A wrong tag fails the update of a decryption
+	ok = ok && EVP_CipherUpdate(ctx, result, &resultLen, data, textLen);
+
+	if (ok && encrypt)
+	{
+		ok = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_CCM_GET_TAG, tagLen, result + textLen);
+		resultLen = textLen + tagLen;
+	}
+
+	EVP_CIPHER_CTX_free(ctx);
+
+	if (!ok)
+	{
+		OPENSSL_cleanse(result, sizeof(result));
+		return ERR_CALC;
+	}
+
+	out.bytes(result, resultLen);
+	OPENSSL_cleanse(result, sizeof(result));
+
+	return SUCCESS;
+}
+
+/*****************************************************************************
+ ZUC, 128-EEA3 and 128-EIA3 of 3GPP TS 35.221
+ *****************************************************************************/
+
+static const mizar_uint8 zucS0[256] =
+{
+	0x3e, 0x72, 0x5b, 0x47, 0xca, 0xe0, 0x00, 0x33, 0x04, 0xd1, 0x54, 0x98, 0x09, 0xb9, 0x6d, 0xcb,
+	0x7b, 0x1b, 0xf9, 0x32, 0xaf, 0x9d, 0x6a, 0xa5, 0xb8, 0x2d, 0xfc, 0x1d, 0x08, 0x53, 0x03, 0x90,
+	0x4d, 0x4e, 0x84, 0x99, 0xe4, 0xce, 0xd9, 0x91, 0xdd, 0xb6, 0x85, 0x48, 0x8b, 0x29, 0x6e, 0xac,
+	0xcd, 0xc1, 0xf8, 0x1e, 0x73, 0x43, 0x69, 0xc6, 0xb5, 0xbd, 0xfd, 0x39, 0x63, 0x20, 0xd4, 0x38,
+	0x76, 0x7d, 0xb2, 0xa7, 0xcf, 0xed, 0x57, 0xc5, 0xf3, 0x2c, 0xbb, 0x14, 0x21, 0x06, 0x55, 0x9b,
+	0xe3, 0xef, 0x5e, 0x31, 0x4f, 0x7f, 0x5a, 0xa4, 0x0d, 0x82, 0x51, 0x49, 0x5f, 0xba, 0x58, 0x1c,
+	0x4a, 0x16, 0xd5, 0x17, 0xa8, 0x92, 0x24, 0x1f, 0x8c, 0xff, 0xd8, 0xae, 0x2e, 0x01, 0xd3, 0xad,
+	0x3b, 0x4b, 0xda, 0x46, 0xeb, 0xc9, 0xde, 0x9a, 0x8f, 0x87, 0xd7, 0x3a, 0x80, 0x6f, 0x2f, 0xc8,
+	0xb1, 0xb4, 0x37, 0xf7, 0x0a, 0x22, 0x13, 0x28, 0x7c, 0xcc, 0x3c, 0x89, 0xc7, 0xc3, 0x96, 0x56,
+	0x07, 0xbf, 0x7e, 0xf0, 0x0b, 0x2b, 0x97, 0x52, 0x35, 0x41, 0x79, 0x61, 0xa6, 0x4c, 0x10, 0xfe,
+	0xbc, 0x26, 0x95, 0x88, 0x8a, 0xb0, 0xa3, 0xfb, 0xc0, 0x18, 0x94, 0xf2, 0xe1, 0xe5, 0xe9, 0x5d,
+	0xd0, 0xdc, 0x11, 0x66, 0x64, 0x5c, 0xec, 0x59, 0x42, 0x75, 0x12, 0xf5, 0x74, 0x9c, 0xaa, 0x23,
+	0x0e, 0x86, 0xab, 0xbe, 0x2a, 0x02, 0xe7, 0x67, 0xe6, 0x44, 0xa2, 0x6c, 0xc2, 0x93, 0x9f, 0xf1,
+	0xf6, 0xfa, 0x36, 0xd2, 0x50, 0x68, 0x9e, 0x62, 0x71, 0x15, 0x3d, 0xd6, 0x40, 0xc4, 0xe2, 0x0f,
+	0x8e, 0x83, 0x77, 0x6b, 0x25, 0x05, 0x3f, 0x0c, 0x30, 0xea, 0x70, 0xb7, 0xa1, 0xe8, 0xa9, 0x65,
+	0x8d, 0x27, 0x1a, 0xdb, 0x81, 0xb3, 0xa0, 0xf4, 0x45, 0x7a, 0x19, 0xdf, 0xee, 0x78, 0x34, 0x60
+};
+
+static const mizar_uint8 zucS1[256] =
+{
+	0x55, 0xc2, 0x63, 0x71, 0x3b, 0xc8, 0x47, 0x86, 0x9f, 0x3c, 0xda, 0x5b, 0x29, 0xaa, 0xfd, 0x77,
+	0x8c, 0xc5, 0x94, 0x0c, 0xa6, 0x1a, 0x13, 0x00, 0xe3, 0xa8, 0x16, 0x72, 0x40, 0xf9, 0xf8, 0x42,
+	0x44, 0x26, 0x68, 0x96, 0x81, 0xd9, 0x45, 0x3e, 0x10, 0x76, 0xc6, 0xa7, 0x8b, 0x39, 0x43, 0xe1,
+	0x3a, 0xb5, 0x56, 0x2a, 0xc0, 0x6d, 0xb3, 0x05, 0x22, 0x66, 0xbf, 0xdc, 0x0b, 0xfa, 0x62, 0x48,
+	0xdd, 0x20, 0x11, 0x06, 0x36, 0xc9, 0xc1, 0xcf, 0xf6, 0x27, 0x52, 0xbb, 0x69, 0xf5, 0xd4, 0x87,
+	0x7f, 0x84, 0x4c, 0xd2, 0x9c, 0x57, 0xa4, 0xbc, 0x4f, 0x9a, 0xdf, 0xfe, 0xd6, 0x8d, 0x7a, 0xeb,
+	0x2b, 0x53, 0xd8, 0x5c, 0xa1, 0x14, 0x17, 0xfb, 0x23, 0xd5, 0x7d, 0x30, 0x67, 0x73, 0x08, 0x09,
+	0xee, 0xb7, 0x70, 0x3f, 0x61, 0xb2, 0x19, 0x8e, 0x4e, 0xe5, 0x4b, 0x93, 0x8f, 0x5d, 0xdb, 0xa9,
+	0xad, 0xf1, 0xae, 0x2e, 0xcb, 0x0d, 0xfc, 0xf4, 0x2d, 0x46, 0x6e, 0x1d, 0x97, 0xe8, 0xd1, 0xe9,
+	0x4d, 0x37, 0xa5, 0x75, 0x5e, 0x83, 0x9e, 0xab, 0x82, 0x9d, 0xb9, 0x1c, 0xe0, 0xcd, 0x49, 0x89,
+	0x01, 0xb6, 0xbd, 0x58, 0x24, 0xa2, 0x5f, 0x38, 0x78, 0x99, 0x15, 0x90, 0x50, 0xb8, 0x95, 0xe4,
+	0xd0, 0x91, 0xc7, 0xce, 0xed, 0x0f, 0xb4, 0x6f, 0xa0, 0xcc, 0xf0, 0x02, 0x4a, 0x79, 0xc3, 0xde,
+	0xa3, 0xef, 0xea, 0x51, 0xe6, 0x6b, 0x18, 0xec, 0x1b, 0x2c, 0x80, 0xf7, 0x74, 0xe7, 0xff, 0x21,
+	0x5a, 0x6a, 0x54, 0x1e, 0x41, 0x31, 0x92, 0x35, 0xc4, 0x33, 0x07, 0x0a, 0xba, 0x7e, 0x0e, 0x34,
+	0x88, 0xb1, 0x98, 0x7c, 0xf3, 0x3d, 0x60, 0x6c, 0x7b, 0xca, 0xd3, 0x1f, 0x32, 0x65, 0x04, 0x28,
+	0x64, 0xbe, 0x85, 0x9b, 0x2f, 0x59, 0x8a, 0xd7, 0xb0, 0x25, 0xac, 0xaf, 0x12, 0x03, 0xe2, 0xf2
+};
+
+static const mizar_uint32 zucD[16] =
+{
+	0x44d7, 0x26bc, 0x626b, 0x135e, 0x5789, 0x35e2, 0x7135, 0x09af,
+	0x4d78, 0x2f13, 0x6bc4, 0x1af1, 0x5e26, 0x3c4d, 0x789a, 0x47ac
+};
+
+class ZucKeystream
+{
+public:
+	ZucKeystream(const mizar_uint8* key, const mizar_uint8* iv)
+	{
+		r1 = r2 = 0;
+
+		for (int i = 0; i < 16; i++)
+		{
+			s[i] = ((mizar_uint32) key[i] << 23) | (zucD[i] << 8) | iv[i];
+		}
+
+		for (int i = 0; i < 32; i++)
+		{
+			bitReorganization();
+			lfsr(f() >> 1);
+		}
+
+		bitReorganization();
+		f();
+		lfsr(0);
+	}
+
+	~ZucKeystream()
+	{
+		OPENSSL_cleanse(s, sizeof(s));
+		OPENSSL_cleanse(x, sizeof(x));
+		r1 = r2 = 0;
+	}
+
+	mizar_uint32 next()
+	{
+		bitReorganization();
+		mizar_uint32 z = f() ^ x[3];
+		lfsr(0);
+
+		return z;
+	}
+
+private:
+	static mizar_uint32 addMod(mizar_uint32 a, mizar_uint32 b)
+	{
+		mizar_uint32 c = a + b;
+
+		return (c & 0x7fffffff) + (c >> 31);
+	}
+
+	static mizar_uint32 mulPow2(mizar_uint32 a, int k)
+	{
+		return ((a << k) | (a >> (31 - k))) & 0x7fffffff;
+	}
+
+	static mizar_uint32 rot(mizar_uint32 a, int k)
+	{
+		return (a << k) | (a >> (32 - k));
+	}
+
+	static mizar_uint32 l1(mizar_uint32 a)
+	{
+		return a ^ rot(a, 2) ^ rot(a, 10) ^ rot(a, 18) ^ rot(a, 24);
+	}
+
+	static mizar_uint32 l2(mizar_uint32 a)
+	{
+		return a ^ rot(a, 8) ^ rot(a, 14) ^ rot(a, 22) ^ rot(a, 30);
+	}
+
+	static mizar_uint32 sbox(mizar_uint32 a)
+	{
+		return ((mizar_uint32) zucS0[a >> 24] << 24) | ((mizar_uint32) zucS1[(a >> 16) & 0xff] << 16) |
+		       ((mizar_uint32) zucS0[(a >> 8) & 0xff] << 8) | zucS1[a & 0xff];
+	}
+
+	// u is 0 in working mode
+	void lfsr(mizar_uint32 u)
+	{
+		mizar_uint32 v = s[0];
+
+		v = addMod(v, mulPow2(s[0], 8));
+		v = addMod(v, mulPow2(s[4], 20));
+		v = addMod(v, mulPow2(s[10], 21));
+		v = addMod(v, mulPow2(s[13], 17));
+		v = addMod(v, mulPow2(s[15], 15));
+		v = addMod(v, u);
+		if (v == 0) v = 0x7fffffff;
+
+		for (int i = 0; i < 15; i++)
+		{
+			s[i] = s[i + 1];
+		}
+		s[15] = v;
+	}
+
+	void bitReorganization()
+	{
+		x[0] = ((s[15] & 0x7fff8000) << 1) | (s[14] & 0xffff);
+		x[1] = ((s[11] & 0xffff) << 16) | (s[9] >> 15);
+		x[2] = ((s[7] & 0xffff) << 16) | (s[5] >> 15);
+		x[3] = ((s[2] & 0xffff) << 16) | (s[0] >> 15);
+	}
+
+	mizar_uint32 f()
+	{
+		mizar_uint32 w = (x[0] ^ r1) + r2;
+		mizar_uint32 w1 = r1 + x[1];
+		mizar_uint32 w2 = r2 ^ x[2];
+
+		r1 = sbox(l1((w1 << 16) | (w2 >> 16)));
+		r2 = sbox(l2((w2 << 16) | (w1 >> 16)));
+
+		return w;
+	}
+
+	mizar_uint32 s[16];
+	mizar_uint32 x[4];
+	mizar_uint32 r1, r2;
+};
+
+// 128-EEA3: XORs len bytes of data with the key stream
+static void zucEncrypt(const mizar_uint8* key, const mizar_uint8* count, mizar_uint32 bearer, mizar_uint32 direction,
+    const mizar_uint8* data, mizar_uint32 len, mizar_uint8* result)
+{
+	mizar_uint8 iv[16];
+	memcpy(iv, count, 4);
+	iv[4] = (mizar_uint8) ((bearer << 3) | (direction << 2));
+	memset(iv + 5, 0, 3);
+	memcpy(iv + 8, iv, 8);
+
+	ZucKeystream zuc(key, iv);
+
+	for (mizar_uint32 i = 0; i < len; i += 4)
+	{
+		mizar_uint32 z = zuc.next();
+
+		for (mizar_uint32 j = 0; j < 4 && i + j < len; j++)
+		{
+			result[i + j] = data[i + j] ^ (mizar_uint8) (z >> (24 - 8 * j));
+		}
+	}
+}
+
+// 128-EIA3: the MAC of the first bits of data
+static mizar_uint32 zucMac(const mizar_uint8* key, const mizar_uint8* count, mizar_uint32 bearer, mizar_uint32 direction,
+    const mizar_uint8* data, mizar_uint64 bits)
+{
+	mizar_uint8 iv[16];
+	memcpy(iv, count, 4);
+	iv[4] = (mizar_uint8) (bearer << 3);
+	memset(iv + 5, 0, 3);
+	iv[8] = iv[0] ^ (mizar_uint8) (direction << 7);
+	memcpy(iv + 9, iv + 1, 5);
+	iv[14] = iv[6] ^ (mizar_uint8) (direction << 7);
+	iv[15] = iv[7];
+
+	// The key stream word at bit i spans the words hi and lo
+	ZucKeystream zuc(key, iv);
+	mizar_uint32 mac = 0;
+	mizar_uint32 hi = zuc.next();
+	mizar_uint32 lo = zuc.next();
+
+	for (mizar_uint64 i = 0; i < bits; i++)
+	{
+		mizar_uint32 shift = i % 32;
+
+		if (data[i / 8] & (0x80 >> (i % 8)))
+		{
+			mac ^= shift == 0 ? hi : (hi << shift) | (lo >> (32 - shift));
+		}
+
+		if (shift == 31)
+		{
+			hi = lo;
+			lo = zuc.next();
+		}
+	}
+
+	// The word at bit LENGTH, then the last word of the key stream
+	mizar_uint32 shift = bits % 32;
+
+	mac ^= shift == 0 ? hi : (hi << shift) | (lo >> (32 - shift));
+	mac ^= shift == 0 ? lo : zuc.next();
+
+	return mac;
+}
+
+// The body is the key, COUNT, BEARER, DIRECTION and the data, whose
+// length is in bytes. MIZAR_INS_ZUC_ENC returns the data XORed with the
+// 128-EEA3 key stream, MIZAR_INS_ZUC_MAC the 4 byte 128-EIA3 MAC
+mizar_uint32 MizarSimDevice::doZuc(mizar_uint8 ins, MizarSimReader& in, MizarSimWriter& out)
+{
+	const mizar_uint8 *key, *count, *data;
+	mizar_uint32 keyLen, countLen, bearer, direction, len;
+
+	if (!in.bytes(key, keyLen) || !in.bytes(count, countLen) || !in.u32(bearer) || !in.u32(direction) ||
+	    !in.bytes(data, len))
+	{
+		return ERR_PARAMETER;
+	}
+
+	if (keyLen != 16) return ERR_KEY_LEN;
+	if (countLen != 4 || bearer > 0x1f || direction > 1) return ERR_PARAMETER;
+	if (len > MAX_SDIO_BODY_LEN) return ERR_DATA_LEN;
+
+	if (ins == MIZAR_INS_ZUC_ENC)
+	{
+		std::unique_ptr<mizar_uint8[]> result(new mizar_uint8[len + 1]);
+
+		zucEncrypt(key, count, bearer, direction, data, len, result.get());
+		out.bytes(result.get(), len);
+		OPENSSL_cleanse(result.get(), len);
+
+		return SUCCESS;
+	}
+
+	mizar_uint32 mac = zucMac(key, count, bearer, direction, data, (mizar_uint64) len * 8);
+	mizar_uint8 result[4] = { (mizar_uint8) (mac >> 24), (mizar_uint8) (mac >> 16), (mizar_uint8) (mac >> 8), (mizar_uint8) mac };
+
+	out.bytes(result, sizeof(result));
+
+	return SUCCESS;
+}
+
+/*****************************************************************************
+ Certificates
+ *****************************************************************************/
+
+// The certificate types of mizar_cert_manager.h; CAR certificates are short
+#define MIZAR_SIM_CERT_TYPES 6
+#define MIZAR_SIM_CERT_CAR 3
+#define MIZAR_SIM_CERT_PKI_MAX 2000
+#define MIZAR_SIM_CERT_CAR_MAX 392
+
+mizar_uint32 MizarSimDevice::doImportCert(MizarSimReader& in, MizarSimWriter& /*out*/)
+{
+	mizar_uint32 index, keyIndex, type;
+	const mizar_uint8* cert;
+	mizar_uint32 certLen;
+
+	if (!in.u32(index) || !in.u32(keyIndex) || !in.u32(type) || !in.bytes(cert, certLen)) return ERR_PARAMETER;
+	if (index >= MAX_CERT_NUM || keyIndex > 0xFF || type >= MIZAR_SIM_CERT_TYPES) return ERR_PARAMETER;
+	if (certLen == 0 || certLen > (type < MIZAR_SIM_CERT_CAR ? MIZAR_SIM_CERT_PKI_MAX : MIZAR_SIM_CERT_CAR_MAX)) return ERR_DATA_LEN;
+
+	CertSlot& slot = certSlots[index];
+	slot.keyIndex = keyIndex;
+	slot.type = type;
+	slot.cert.assign(cert, certLen);
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarSimDevice::doDelCert(MizarSimReader& in, MizarSimWriter& /*out*/)
+{
+	mizar_uint32 index, type;
+
+	if (!in.u32(index) || !in.u32(type)) return ERR_PARAMETER;
+
+	std::map<mizar_uint32, CertSlot>::iterator it = certSlots.find(index);
+	if (it == certSlots.end() || it->second.type != type) return ERR_PARAMETER;
+
+	certSlots.erase(it);
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarSimDevice::doGetCert(MizarSimReader& in, MizarSimWriter& out)
+{
+	mizar_uint32 index, type;
+
+	if (!in.u32(index) || !in.u32(type)) return ERR_PARAMETER;
+
+	std::map<mizar_uint32, CertSlot>::iterator it = certSlots.find(index);
+	if (it == certSlots.end() || it->second.type != type) return ERR_PARAMETER;
+
+	out.u32(it->second.keyIndex);
+	out.bytes(it->second.cert.data(), it->second.cert.size());
+
+	return SUCCESS;
+}
+
+// INDEX, KEY_INDEX and CERT_TYPE of every certificate, one byte each
+mizar_uint32 MizarSimDevice::doGetCertList(MizarSimReader& /*in*/, MizarSimWriter& out)
+{
+	mizar_uint8 list[MAX_CERT_NUM * 3];
+	mizar_uint32 len = 0;
+
+	for (std::map<mizar_uint32, CertSlot>::iterator it = certSlots.begin(); it != certSlots.end(); ++it)
+	{
+		list[len++] = (mizar_uint8) it->first;
+		list[len++] = (mizar_uint8) it->second.keyIndex;
+		list[len++] = (mizar_uint8) it->second.type;
+	}
+
+	out.bytes(list, len);
+
+	return SUCCESS;
+}
@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizarSimDevice.h
+
+ A software model of the Mizar security chip. The mizar_*.h API calls are
+ framed as TMizarMsg commands, carried over an in-process loopback channel
+ and executed by a simulated chip that holds its own key slots. Every
+ command can be given a processing latency and the SPI clock can be set,
+ so that the timing of a real chip is reproduced.
+
+ The latencies are read from the environment when a chip is created:
+
+   MIZAR_SIM_SPI_HZ   SPI clock in Hz, 0 (the default) for no transfer time
+   MIZAR_SIM_FRAME_US fixed cost of every message in microseconds, 0 by
+                      default
+   MIZAR_SIM_LATENCY  comma separated list of <command>=<microseconds>,
+                      for example "rsa_sk=12000,ecc_sign=1500"
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_MIZARSIMDEVICE_H
+#define _SOFTHSM_V2_MIZARSIMDEVICE_H
+
+#include "mizar_basetype.h"
+#include "mizar_msg.h"
+#include "MutexFactory.h"
+#include <atomic>
+#include <map>
+#include <string>
+#include <openssl/evp.h>
+
+// The number of chips that can be addressed through MizarSendRecvSn
+#define MIZAR_SIM_MAX_DEVICES 8
+
+// The commands understood by the simulated chip
+enum MizarSimIns
+{
+	MIZAR_INS_GET_STATE = 0x01,
+	MIZAR_INS_GEN_RND = 0x10,
+	MIZAR_INS_SHA_INIT = 0x20,
+	MIZAR_INS_SHA_UPDATE = 0x21,
+	MIZAR_INS_SHA_FINAL = 0x22,
+	MIZAR_INS_GEN_RSA_KEY = 0x30,
+	MIZAR_INS_DEL_RSA_KEY = 0x31,
+	MIZAR_INS_QUERY_RSA_KEY = 0x32,
+	MIZAR_INS_RSA_SK_INDEX = 0x33,
+	MIZAR_INS_RSA_PK = 0x34,
+	MIZAR_INS_RSA_SK = 0x35,
+	MIZAR_INS_GEN_ECC_KEY = 0x40,
+	MIZAR_INS_DEL_ECC_KEY = 0x41,
+	MIZAR_INS_QUERY_ECC_KEY = 0x42,
+	MIZAR_INS_ECC_SIGN_INDEX = 0x43,
+	MIZAR_INS_ECC_VERIFY = 0x44,
+	MIZAR_INS_ECC_SIGN = 0x45,
+	MIZAR_INS_SM2_SIGN = 0x46,
+	MIZAR_INS_SM2_VERIFY = 0x47,
+	MIZAR_INS_SM2_ENC = 0x48,
+	MIZAR_INS_SM2_DEC = 0x49,
+	MIZAR_INS_IMPORT_SYMM_KEY = 0x50,
+	MIZAR_INS_GEN_SYMM_KEY = 0x51,
+	MIZAR_INS_DEL_SYMM_KEY = 0x52,
+	MIZAR_INS_QUERY_SYMM_KEY = 0x53,
+	MIZAR_INS_SYMM_INDEX = 0x54,
+	MIZAR_INS_SYMM = 0x55,
+	MIZAR_INS_AES_CCM = 0x56,
+	MIZAR_INS_ZUC_ENC = 0x57,
+	MIZAR_INS_ZUC_MAC = 0x58,
+	MIZAR_INS_IMPORT_CERT = 0x70,
+	MIZAR_INS_DEL_CERT = 0x71,
+	MIZAR_INS_GET_CERT = 0x72,
+	MIZAR_INS_GET_CERT_LIST = 0x73
+};
+
+// The cipher modes of MIZAR_INS_SYMM_INDEX and MIZAR_INS_SYMM, carried in
+// p2; OFB and CTR are only known for SM4
+#define MIZAR_SIM_MODE_ECB 0
+#define MIZAR_SIM_MODE_CBC 1
+#define MIZAR_SIM_MODE_OFB 2
+#define MIZAR_SIM_MODE_CTR 3
+
+// Builds the body of a message; all integers are big endian
+class MizarSimWriter
+{
+public:
+	MizarSimWriter(TMizarMsg* inMsg, mizar_uint32 inMaxBody);
+
+	void u32(mizar_uint32 value);
+	void bytes(const mizar_uint8* data, mizar_uint32 len);
+
+	// False if the body did not fit
+	bool ok() const;
+
+private:
+	TMizarMsg* msg;
+	mizar_uint32 maxBody;
+	bool overflow;
+};
+
+// Reads the body of a message
+class MizarSimReader
+{
+public:
+	explicit MizarSimReader(const TMizarMsg* inMsg);
+
+	bool u32(mizar_uint32& value);
+
+	// Points into the message, valid as long as the message is
+	bool bytes(const mizar_uint8*& data, mizar_uint32& len);
+
+	// Copies into a caller buffer of *pLen bytes and sets *pLen
+	bool copy(mizar_uint8* out, mizar_uint32* pLen);
+
+private:
+	const TMizarMsg* msg;
+	mizar_uint32 pos;
+};
+
+class MizarSimDevice
+{
+public:
+	// Return the chip on the given channel, NULL if there is none
+	static MizarSimDevice* get(mizar_int32 nSn);
+
+	// The chips keep their key slots until the process exits, but their
+	// locks are made with the mutex functions of the library and live from
+	// C_Initialize to C_Finalize. Without locks the chips are not thread-safe.
+	static void createLocks();
+	static void releaseLocks();
+
+	// Message framing shared by the host and the chip
+	static mizar_uint32 bodyLength(const TMizarMsg* msg);
+	static void setBodyLength(TMizarMsg* msg, mizar_uint32 len);
+	static mizar_uint16 crc16(const mizar_uint8* data, mizar_uint32 len);
+	static mizar_uint32 encode(TMizarMsg* msg, mizar_uint8* wire);
+	static mizar_uint32 decode(const mizar_uint8* wire, mizar_uint32 wireLen, TMizarMsg* msg);
+
+	// The semaphore of the message channel, see MizarDevLock
+	void lockChannel();
+	void unlockChannel();
+
+	// Carries one framed command to the chip and its response back
+	mizar_uint32 transfer(const mizar_uint8* request, mizar_uint32 requestLen, mizar_uint8* response, mizar_uint32* responseLen);
+
+	// Timing model
+	void setSpiSpeed(mizar_uint32 hz);
+	void setLatency(MizarSimIns ins, mizar_uint32 us);
+	bool setLatency(const std::string& name, mizar_uint32 us);
+	void setFrameOverhead(mizar_uint32 us);
+
+	// The number of commands handled since the chip was created
+	mizar_uint64 getCommandCount();
+
+	// Clears all key and certificate slots
+	void clearKeys();
+
+	// An offline chip fails every transfer, as if the bus were broken
+	void setOnline(bool isOnline);
+
+	~MizarSimDevice();
+
+private:
+	MizarSimDevice();
+
+	// Runs a command, the chip lock is held
+	void execute(const TMizarMsg* request, TMizarMsg* response);
+
+	// Command handlers, return a Mizar error code
+	mizar_uint32 doGenRnd(MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doSha(mizar_uint8 ins, MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doGenRsaKey(MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doQueryRsaKey(MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doRsaSkIndex(MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doRsaPk(MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doRsaSk(MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doGenEccKey(MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doQueryEccKey(MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doEccSignIndex(MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doEccSign(MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doEccVerify(MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doSm2Sign(MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doSm2Verify(MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doSm2Enc(MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doSm2Dec(MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doImportSymmKey(MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doGenSymmKey(MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doDelSymmKey(MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doQuerySymmKey(MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doSymmIndex(mizar_uint8 p1, mizar_uint8 p2, MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doSymm(mizar_uint8 p1, mizar_uint8 p2, MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doAesCcm(mizar_uint8 p1, MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doZuc(mizar_uint8 ins, MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doDelKey(std::map<mizar_uint32, EVP_PKEY*>& slots, MizarSimReader& in);
+	mizar_uint32 doImportCert(MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doDelCert(MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doGetCert(MizarSimReader& in, MizarSimWriter& out);
+	mizar_uint32 doGetCertList(MizarSimReader& in, MizarSimWriter& out);
+
+	// Reads MIZAR_SIM_SPI_HZ, MIZAR_SIM_FRAME_US and MIZAR_SIM_LATENCY
+	void configure();
+
+	// Waits for the modelled processing and transfer time
+	void delay(mizar_uint8 ins, mizar_uint32 bytes);
+
+	struct SymmSlot
+	{
+		mizar_uint32 alg;
+		mizar_uint32 lock;
+		std::basic_string<mizar_uint8> key;
+	};
+
+	struct CertSlot
+	{
+		mizar_uint32 keyIndex;
+		mizar_uint32 type;
+		std::basic_string<mizar_uint8> cert;
+	};
+
+	// The chip handles one command at a time
+	Mutex* busy;
+
+	// Held by the user of the channel between MizarDevLock and MizarDevUnlock
+	Mutex* channelLock;
+
+	// Key slots
+	std::map<mizar_uint32, EVP_PKEY*> rsaSlots;
+	std::map<mizar_uint32, EVP_PKEY*> eccSlots;
+	std::map<mizar_uint32, SymmSlot> symmSlots;
+
+	// Certificate slots
+	std::map<mizar_uint32, CertSlot> certSlots;
+
+	// The digest in progress; like the real chip there is only one
+	EVP_MD_CTX* shaCTX;
+
+	// Timing
+	mizar_uint32 spiHz;
+	mizar_uint32 latency[INS_NUM];
+	mizar_uint32 frameUs;
+
+	mizar_uint64 commandCount;
+	std::atomic<bool> online;
+};
+
+#endif // !_SOFTHSM_V2_MIZARSIMDEVICE_H
@@ -27,11 +27,14 @@
 /*****************************************************************************
  MizaruAES.cpp
 
- OpenSSL AES implementation
+ Mizaru AES implementation
  *****************************************************************************/
 
 #include "config.h"
 #include "MizaruAES.h"
+#include "MizaruDevicePool.h"
+#include "MizaruOffload.h"
+#include "mizar_api.h"
 #include <algorithm>
 #include <openssl/aes.h>
 #include "salloc.h"
@@ -263,6 +266,19 @@ const EVP_CIPHER* MizaruAES::getCipher() const
 		};
 	}
 
+	else if (currentCipherMode == SymMode::CCM)
+	{
+		switch(currentKey->getBitLen())
+		{
+			case 128:
+				return EVP_aes_128_ccm();
+			case 192:
+				return EVP_aes_192_ccm();
+			case 256:
+				return EVP_aes_256_ccm();
+		};
+	}
+
 	ERROR_MSG("Invalid AES cipher mode %i", currentCipherMode);
 
 	return NULL;
@@ -273,3 +289,82 @@ size_t MizaruAES::getBlockSize() const
 	// The block size is 128 bits
 	return 128 >> 3;
 }
+
+// Runs whole ECB or CBC blocks on the chip
+bool MizaruAES::chipCrypt(bool encrypt, SymMode::Type mode, const ByteString& iv, const ByteString& in, ByteString& out)
+{
+	if (!MizaruOffload::i()->useChip(MizaruOffload::AES, in.size()))
+	{
+		return false;
+	}
+
+	// The chip does not change its inputs
+	mizar_uint8* key = (mizar_uint8*) currentKey->getKeyBits().const_byte_str();
+	mizar_uint32 keyLen = currentKey->getKeyBits().size();
+	mizar_uint8* data = (mizar_uint8*) in.const_byte_str();
+	mizar_uint8* chainIV = (mizar_uint8*) iv.const_byte_str();
+	mizar_uint32 mizarMode = encrypt ? 0 : 1;
+
+	out.resize(in.size());
+	mizar_uint32 outLen = out.size();
+	mizar_uint32 rv;
+
+	if (mode == SymMode::ECB)
+	{
+		rv = MizaruDevicePool::i()->run([&] { return MizarAesEcb(mizarMode, in.size(), data, keyLen, key, &outLen, &out[0]); });
+	}
+	else
+	{
+		rv = MizaruDevicePool::i()->run([&] { return MizarAesCbc(mizarMode, chainIV, in.size(), data, keyLen, key, &outLen, &out[0]); });
+	}
+
+	if (rv != 0 || outLen != in.size())
+	{
+		WARNING_MSG("AES operation on the Mizar chip failed (0x%08X), using OpenSSL", rv);
+
+		MizaruOffload::i()->fallBack(MizaruOffload::AES);
+
+		return false;
+	}
+
+	return true;
+}
+
+// Runs a whole CCM operation on the chip
+bool MizaruAES::chipCcm(bool encrypt, const ByteString& nonce, const ByteString& aad, size_t tagBytes, const ByteString& in, ByteString& out)
+{
+	// The chip takes a 12 byte nonce, no AAD and up to 1024 bytes of data,
+	// and uses a 16 byte tag
+	size_t dataLen = encrypt ? in.size() : in.size() - tagBytes;
+
+	if (nonce.size() != 12 || aad.size() != 0 || tagBytes != 16 ||
+	    dataLen == 0 || dataLen > 1024 ||
+	    !MizaruOffload::i()->useChip(MizaruOffload::AES, dataLen))
+	{
+		return false;
+	}
+
+	// The chip does not change its inputs
+	mizar_uint8* key = (mizar_uint8*) currentKey->getKeyBits().const_byte_str();
+	mizar_uint32 keyLen = currentKey->getKeyBits().size();
+	mizar_uint8* chipNonce = (mizar_uint8*) nonce.const_byte_str();
+	mizar_uint8* data = (mizar_uint8*) in.const_byte_str();
+
+	out.resize(encrypt ? in.size() + tagBytes : dataLen);
+	mizar_uint32 outLen = out.size();
+
+	mizar_uint32 rv = MizaruDevicePool::i()->run([&] { return MizarAesCcm(encrypt ? 0 : 1, key, keyLen, chipNonce, in.size(), data, &outLen, &out[0]); });
+
+	if (rv != 0 || outLen != out.size())
+	{
+		WARNING_MSG("AES-CCM operation on the Mizar chip failed (0x%08X), using OpenSSL", rv);
+
+		MizaruOffload::i()->fallBack(MizaruOffload::AES);
+
+		out.wipe();
+
+		return false;
+	}
+
+	return true;
+}
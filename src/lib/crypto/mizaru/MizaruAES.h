@@ -27,7 +27,9 @@
 /*****************************************************************************
  MizaruAES.h
 
- OpenSSL AES implementation
+ Mizaru AES implementation. ECB and CBC data from the crossover size on is
+ encrypted by the chip, as is CCM data the chip can take; everything else
+ is done by OpenSSL.
  *****************************************************************************/
 
 #ifndef _SOFTHSM_V2_MizaruAES_H
@@ -55,6 +57,12 @@ public:
 protected:
 	// Return the right EVP cipher for the operation
 	virtual const EVP_CIPHER* getCipher() const;
+
+	// Runs whole ECB or CBC blocks on the chip
+	virtual bool chipCrypt(bool encrypt, SymMode::Type mode, const ByteString& iv, const ByteString& in, ByteString& out);
+
+	// Runs a whole CCM operation on the chip
+	virtual bool chipCcm(bool encrypt, const ByteString& nonce, const ByteString& aad, size_t tagBytes, const ByteString& in, ByteString& out);
 	const EVP_CIPHER* getWrapCipher(const SymWrap::Type mode, const SymmetricKey* key) const;
 	bool wrapUnwrapKey(const SymmetricKey* key, const SymWrap::Type mode, const ByteString& in, ByteString& out, const int wrap) const;
 	bool checkLength(const int insize, const int minsize, const char * const operation) const;
@@ -25,9 +25,9 @@
  */
 
 /*****************************************************************************
- OSSLHMAC.cpp
+ MizaruCMAC.cpp
 
- OpenSSL HMAC implementation
+ Mizaru CMAC implementation; the chip has no MAC commands
  *****************************************************************************/
 
 #include "config.h"
@@ -25,9 +25,9 @@
  */
 
 /*****************************************************************************
- OSSLCMAC.h
+ MizaruCMAC.h
 
- OpenSSL CMAC implementation
+ Mizaru CMAC implementation; the chip has no MAC commands
  *****************************************************************************/
 
 #ifndef _SOFTHSM_V2_MIZARUCMAC_H
@@ -51,5 +51,5 @@ protected:
 	virtual size_t getMacSize() const;
 };
 
-#endif // !_SOFTHSM_V2_OSSLHMAC_H
+#endif // !_SOFTHSM_V2_MIZARUCMAC_H
 
@@ -0,0 +1,703 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruCalibration.cpp
+
+ Measures the Mizar chip against OpenSSL to find the crossover points
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "MizaruCalibration.h"
+#include "MizaruDevicePool.h"
+#include "MizaruHash.h"
+#include "mizar_api.h"
+#include <chrono>
+#include <functional>
+#include <stdio.h>
+#include <string.h>
+#include <openssl/bn.h>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/obj_mac.h>
+#include <openssl/rand.h>
+#include <openssl/rsa.h>
+
+// An operation is timed for at least this many calls and this long
+#define CALIBRATION_MIN_CALLS 3
+#define CALIBRATION_MAX_CALLS 1000
+#define CALIBRATION_MIN_TIME std::chrono::milliseconds(2)
+
+// The data sizes measured for ciphers and hashes
+static const unsigned long dataSizes[] = { 16, 64, 256, 1024, 4096, 16384 };
+#define MAX_DATA_SIZE 16384
+
+// The key sizes measured for RSA
+static const int rsaSizes[] = { 1024, 2048 };
+
+// The curves of the chip measured for ECDSA
+static const struct
+{
+	int nid;
+	size_t orderLength;
+}
+curves[] =
+{
+	{ NID_X9_62_prime256v1, 32 },
+	{ NID_secp384r1, 48 },
+	{ NID_secp521r1, 66 }
+};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+// Repeats a call until it can be timed, returns the mean time of a call in
+// microseconds or -1 if it failed
+static double timeCall(const std::function<bool()>& call)
+{
+	typedef std::chrono::steady_clock clock;
+
+	// The first call is not timed, it may set up caches
+	if (!call())
+	{
+		return -1;
+	}
+
+	clock::time_point start = clock::now();
+	clock::duration elapsed(0);
+	unsigned long count = 0;
+
+	do
+	{
+		if (!call())
+		{
+			return -1;
+		}
+
+		count++;
+		elapsed = clock::now() - start;
+	}
+	while (count < CALIBRATION_MIN_CALLS ||
+	       (elapsed < CALIBRATION_MIN_TIME && count < CALIBRATION_MAX_CALLS));
+
+	return std::chrono::duration<double, std::micro>(elapsed).count() / count;
+}
+
+// ECB encryption with AES-256, 3DES or SM4
+static bool measureCipher(MizaruOffload::Operation op, std::vector<MizaruOffloadSample>& samples)
+{
+	mizar_uint32 keyLen = op == MizaruOffload::AES ? 32 : (op == MizaruOffload::DES ? 24 : 16);
+	const EVP_CIPHER* cipher = op == MizaruOffload::AES ? EVP_aes_256_ecb() :
+				   (op == MizaruOffload::DES ? EVP_des_ede3_ecb() : EVP_sm4_ecb());
+	std::vector<unsigned char> key(keyLen), in(MAX_DATA_SIZE), out(MAX_DATA_SIZE);
+
+	EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+
+	if (ctx == NULL || cipher == NULL ||
+	    RAND_bytes(&key[0], key.size()) != 1 ||
+	    RAND_bytes(&in[0], in.size()) != 1)
+	{
+		EVP_CIPHER_CTX_free(ctx);
+
+		return false;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(dataSizes); i++)
+	{
+		mizar_uint32 size = dataSizes[i];
+		MizaruOffloadSample sample;
+
+		sample.size = size;
+		sample.chipTime = timeCall([&]
+		{
+			mizar_uint32 outLen = out.size();
+
+			return MizaruDevicePool::i()->run([&]
+			{
+				switch (op)
+				{
+					case MizaruOffload::AES:
+						return MizarAesEcb(0, size, &in[0], keyLen, &key[0], &outLen, &out[0]);
+					case MizaruOffload::DES:
+						return MizarDesEcb(0, size, &in[0], keyLen, &key[0], &outLen, &out[0]);
+					default:
+						return MizarSM4Ecb(0, &key[0], size, &in[0], &outLen, &out[0]);
+				}
+			}) == 0;
+		});
+		sample.softwareTime = timeCall([&]
+		{
+			int outLen = 0;
+
+			return EVP_EncryptInit_ex(ctx, cipher, NULL, &key[0], NULL) &&
+			       EVP_CIPHER_CTX_set_padding(ctx, 0) &&
+			       EVP_EncryptUpdate(ctx, &out[0], &outLen, &in[0], size);
+		});
+
+		samples.push_back(sample);
+	}
+
+	EVP_CIPHER_CTX_free(ctx);
+
+	return true;
+}
+
+// A hash of the given algorithm on the chip
+static bool measureHash(mizar_uint32 alg, const EVP_MD* md, std::vector<MizaruOffloadSample>& samples)
+{
+	std::vector<unsigned char> in(MAX_DATA_SIZE);
+	unsigned char hash[EVP_MAX_MD_SIZE];
+
+	if (RAND_bytes(&in[0], in.size()) != 1)
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(dataSizes); i++)
+	{
+		mizar_uint32 size = dataSizes[i];
+		MizaruOffloadSample sample;
+
+		sample.size = size;
+		sample.chipTime = timeCall([&]
+		{
+			mizar_uint32 hashLen = 0;
+
+			return MizaruHash::chipDigest(alg, &in[0], size, hash, &hashLen) == 0;
+		});
+		sample.softwareTime = timeCall([&]
+		{
+			return EVP_Digest(&in[0], size, hash, NULL, md, NULL) == 1;
+		});
+
+		samples.push_back(sample);
+	}
+
+	return true;
+}
+
+// Big-endian bytes of a key parameter, left padded to len if it is set
+static bool getParam(const BIGNUM* bn, size_t len, std::vector<unsigned char>& out)
+{
+	if (bn == NULL)
+	{
+		return false;
+	}
+
+	out.resize(len != 0 ? len : BN_num_bytes(bn));
+
+	return BN_bn2binpad(bn, &out[0], out.size()) >= 0;
+}
+
+// Big-endian bytes of the coordinates of the public point of an EC key
+static bool getPoint(const EC_KEY* eckey, size_t len, std::vector<unsigned char>& x, std::vector<unsigned char>& y)
+{
+	BIGNUM* bnX = BN_new();
+	BIGNUM* bnY = BN_new();
+	bool ok = bnX != NULL && bnY != NULL &&
+		  EC_POINT_get_affine_coordinates(EC_KEY_get0_group(eckey), EC_KEY_get0_public_key(eckey), bnX, bnY, NULL) &&
+		  getParam(bnX, len, x) &&
+		  getParam(bnY, len, y);
+
+	BN_free(bnX);
+	BN_free(bnY);
+
+	return ok;
+}
+
+// A new RSA key
+static EVP_PKEY* generateRSA(int bits)
+{
+	EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+	EVP_PKEY* pkey = NULL;
+
+	if (ctx == NULL ||
+	    EVP_PKEY_keygen_init(ctx) != 1 ||
+	    EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, bits) != 1 ||
+	    EVP_PKEY_keygen(ctx, &pkey) != 1)
+	{
+		pkey = NULL;
+	}
+
+	EVP_PKEY_CTX_free(ctx);
+
+	return pkey;
+}
+
+// A new EC key on the curve and its EVP_PKEY; one on the SM2 curve signs
+// with SM2, which OpenSSL 1.1.1 has to be told
+static EVP_PKEY* generateEC(int nid, EC_KEY*& eckey)
+{
+	EVP_PKEY* pkey = EVP_PKEY_new();
+
+	eckey = EC_KEY_new_by_curve_name(nid);
+
+	if (pkey == NULL || eckey == NULL ||
+	    !EC_KEY_generate_key(eckey) ||
+	    !EVP_PKEY_set1_EC_KEY(pkey, eckey)
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+	    || (nid == NID_sm2 && !EVP_PKEY_set_alias_type(pkey, EVP_PKEY_SM2))
+#endif
+	   )
+	{
+		EVP_PKEY_free(pkey);
+		EC_KEY_free(eckey);
+		eckey = NULL;
+
+		return NULL;
+	}
+
+	return pkey;
+}
+
+// Raw RSA operations with the private or the public key
+static bool measureRSA(bool isPrivate, std::vector<MizaruOffloadSample>& samples)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(rsaSizes); i++)
+	{
+		EVP_PKEY* pkey = generateRSA(rsaSizes[i]);
+		const RSA* rsa = pkey != NULL ? EVP_PKEY_get0_RSA(pkey) : NULL;
+		const BIGNUM* bnN = NULL;
+		const BIGNUM* bnE = NULL;
+		EVP_PKEY_CTX* ctx = pkey != NULL ? EVP_PKEY_CTX_new(pkey, NULL) : NULL;
+		unsigned char* der = NULL;
+		int derLen = pkey != NULL ? i2d_PrivateKey(pkey, &der) : 0;
+		mizar_uint32 len = rsaSizes[i] / 8;
+		std::vector<unsigned char> n, e, in(len), out(len);
+
+		// The input must be smaller than the modulus
+		if (rsa != NULL) RSA_get0_key(rsa, &bnN, &bnE, NULL);
+
+		bool ok = ctx != NULL && derLen > 0 &&
+			  getParam(bnN, 0, n) &&
+			  getParam(bnE, 0, e) &&
+			  RAND_bytes(&in[1], len - 1) == 1 &&
+			  (isPrivate ? EVP_PKEY_decrypt_init(ctx) : EVP_PKEY_encrypt_init(ctx)) == 1 &&
+			  EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_NO_PADDING) == 1;
+		in[0] = 0;
+
+		if (ok)
+		{
+			MizaruOffloadSample sample;
+
+			sample.size = rsaSizes[i];
+			sample.chipTime = timeCall([&]
+			{
+				mizar_uint32 outLen = len;
+
+				return MizaruDevicePool::i()->run([&]
+				{
+					return isPrivate ? MizarRsaSkDec(len, &in[0], derLen, der, &outLen, &out[0])
+							 : MizarRsaPkEnc(n.size(), &n[0], e.size(), &e[0], len, &in[0], &outLen, &out[0]);
+				}) == 0;
+			});
+			sample.softwareTime = timeCall([&]
+			{
+				size_t outLen = len;
+
+				return (isPrivate ? EVP_PKEY_decrypt(ctx, &out[0], &outLen, &in[0], len)
+						  : EVP_PKEY_encrypt(ctx, &out[0], &outLen, &in[0], len)) == 1;
+			});
+
+			samples.push_back(sample);
+		}
+
+		if (der != NULL) OPENSSL_clear_free(der, derLen);
+		EVP_PKEY_CTX_free(ctx);
+		EVP_PKEY_free(pkey);
+
+		if (!ok)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool measureECDSA(bool sign, std::vector<MizaruOffloadSample>& samples)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(curves); i++)
+	{
+		mizar_uint32 len = curves[i].orderLength;
+		EC_KEY* eckey = NULL;
+		EVP_PKEY* pkey = generateEC(curves[i].nid, eckey);
+		EVP_PKEY_CTX* ctx = pkey != NULL ? EVP_PKEY_CTX_new(pkey, NULL) : NULL;
+		std::vector<unsigned char> d, x, y, r(len), s(len);
+		unsigned char digest[32];
+		unsigned char signature[256];
+		size_t signatureLen = sizeof(signature);
+		mizar_uint32 rLen = len;
+		mizar_uint32 sLen = len;
+
+		// A signature of each to verify
+		bool ok = ctx != NULL &&
+			  getParam(EC_KEY_get0_private_key(eckey), len, d) &&
+			  getPoint(eckey, len, x, y) &&
+			  RAND_bytes(digest, sizeof(digest)) == 1 &&
+			  EVP_PKEY_sign_init(ctx) == 1 &&
+			  EVP_PKEY_sign(ctx, signature, &signatureLen, digest, sizeof(digest)) == 1 &&
+			  (sign || EVP_PKEY_verify_init(ctx) == 1);
+
+		if (ok)
+		{
+			MizaruOffloadSample sample;
+			mizar_uint32 rv = MizaruDevicePool::i()->run([&]
+			{
+				return MizarEccSign(curves[i].nid, 0, len, &d[0], sizeof(digest), digest, &rLen, &r[0], &sLen, &s[0]);
+			});
+
+			sample.size = len * 8;
+			if (rv != 0)
+			{
+				sample.chipTime = -1;
+			}
+			else if (sign)
+			{
+				sample.chipTime = timeCall([&]
+				{
+					rLen = sLen = len;
+
+					return MizaruDevicePool::i()->run([&]
+					{
+						return MizarEccSign(curves[i].nid, 0, len, &d[0], sizeof(digest), digest, &rLen, &r[0], &sLen, &s[0]);
+					}) == 0;
+				});
+			}
+			else
+			{
+				sample.chipTime = timeCall([&]
+				{
+					return MizaruDevicePool::i()->run([&]
+					{
+						return MizarEccVerify(curves[i].nid, 0, len, &x[0], len, &y[0], rLen, &r[0], sLen, &s[0], sizeof(digest), digest);
+					}) == 0;
+				});
+			}
+			sample.softwareTime = timeCall([&]
+			{
+				if (sign)
+				{
+					unsigned char out[256];
+					size_t outLen = sizeof(out);
+
+					return EVP_PKEY_sign(ctx, out, &outLen, digest, sizeof(digest)) == 1;
+				}
+
+				return EVP_PKEY_verify(ctx, signature, signatureLen, digest, sizeof(digest)) == 1;
+			});
+
+			samples.push_back(sample);
+		}
+
+		EVP_PKEY_CTX_free(ctx);
+		EVP_PKEY_free(pkey);
+		EC_KEY_free(eckey);
+
+		if (!ok)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// SM2 signing of a digest; the chip only knows the SM2 curve
+static bool measureSM2(std::vector<MizaruOffloadSample>& samples)
+{
+	EC_KEY* eckey = NULL;
+	EVP_PKEY* pkey = generateEC(NID_sm2, eckey);
+	EVP_PKEY_CTX* ctx = pkey != NULL ? EVP_PKEY_CTX_new(pkey, NULL) : NULL;
+	std::vector<unsigned char> d;
+	unsigned char digest[32];
+	unsigned char r[32], s[32];
+
+	bool ok = ctx != NULL &&
+		  getParam(EC_KEY_get0_private_key(eckey), 32, d) &&
+		  RAND_bytes(digest, sizeof(digest)) == 1 &&
+		  EVP_PKEY_sign_init(ctx) == 1;
+
+	if (ok)
+	{
+		MizaruOffloadSample sample;
+
+		sample.size = 256;
+		sample.chipTime = timeCall([&]
+		{
+			return MizaruDevicePool::i()->run([&]
+			{
+				return MizarSM2Sign(&d[0], 0, sizeof(digest), digest, r, s);
+			}) == 0;
+		});
+		sample.softwareTime = timeCall([&]
+		{
+			unsigned char out[128];
+			size_t outLen = sizeof(out);
+
+			return EVP_PKEY_sign(ctx, out, &outLen, digest, sizeof(digest)) == 1;
+		});
+
+		samples.push_back(sample);
+	}
+
+	EVP_PKEY_CTX_free(ctx);
+	EVP_PKEY_free(pkey);
+	EC_KEY_free(eckey);
+
+	return ok;
+}
+
+// Measures all operations and sets the samples and crossover points
+bool MizaruCalibration::run(MizaruOffload* offload)
+{
+	bool calibrated = false;
+
+	INFO_MSG("Calibrating the Mizar offload policy");
+
+	for (int op = 0; op < MizaruOffload::OPERATION_COUNT; op++)
+	{
+		MizaruOffload::Operation operation = (MizaruOffload::Operation) op;
+		std::vector<MizaruOffloadSample> samples;
+
+		if (!measure(operation, samples))
+		{
+			WARNING_MSG("Could not calibrate %s, keeping crossover %li",
+				    MizaruOffload::getName(operation), offload->getCrossover(operation));
+
+			continue;
+		}
+
+		offload->setSamples(operation, samples);
+		offload->setCrossover(operation, crossover(samples));
+		calibrated = true;
+
+		for (size_t i = 0; i < samples.size(); i++)
+		{
+			DEBUG_MSG("%s of size %lu: chip %.1f us, software %.1f us",
+				  MizaruOffload::getName(operation), samples[i].size,
+				  samples[i].chipTime, samples[i].softwareTime);
+		}
+
+		INFO_MSG("Mizar offload of %s from %li",
+			 MizaruOffload::getName(operation), offload->getCrossover(operation));
+	}
+
+	return calibrated;
+}
+
+// Measures one operation
+bool MizaruCalibration::measure(MizaruOffload::Operation op, std::vector<MizaruOffloadSample>& samples)
+{
+	samples.clear();
+
+	switch (op)
+	{
+		case MizaruOffload::AES:
+		case MizaruOffload::DES:
+		case MizaruOffload::SM4:
+			return measureCipher(op, samples);
+		case MizaruOffload::SHA256:
+			return measureHash(3, EVP_sha256(), samples);
+		case MizaruOffload::SM3:
+			return measureHash(MIZARU_HASH_SM3, EVP_sm3(), samples);
+		case MizaruOffload::RSA_PRIVATE:
+			return measureRSA(true, samples);
+		case MizaruOffload::RSA_PUBLIC:
+			return measureRSA(false, samples);
+		case MizaruOffload::ECDSA_SIGN:
+			return measureECDSA(true, samples);
+		case MizaruOffload::ECDSA_VERIFY:
+			return measureECDSA(false, samples);
+		case MizaruOffload::SM2:
+			return measureSM2(samples);
+		default:
+			return false;
+	}
+}
+
+static int findOperation(const char* name)
+{
+	for (int op = 0; op < MizaruOffload::OPERATION_COUNT; op++)
+	{
+		if (!strcmp(name, MizaruOffload::getName((MizaruOffload::Operation) op)))
+		{
+			return op;
+		}
+	}
+
+	return -1;
+}
+
+// Reads a calibration file, with a line "<operation> <size> <chip time>
+// <software time>" for each sample and "<operation> = <crossover>"
+bool MizaruCalibration::load(const std::string& path, MizaruOffload* offload)
+{
+	FILE* fp = fopen(path.c_str(), "r");
+
+	if (fp == NULL)
+	{
+		DEBUG_MSG("No Mizar calibration in %s", path.c_str());
+
+		return false;
+	}
+
+	std::vector<MizaruOffloadSample> samples[MizaruOffload::OPERATION_COUNT];
+	long crossovers[MizaruOffload::OPERATION_COUNT];
+	bool found[MizaruOffload::OPERATION_COUNT] = { false };
+	bool valid = true;
+	char line[256];
+	char name[64];
+
+	while (valid && fgets(line, sizeof(line), fp) != NULL)
+	{
+		MizaruOffloadSample sample;
+		long from;
+
+		if (line[0] == '#' || line[0] == '\n')
+		{
+			continue;
+		}
+
+		if (sscanf(line, "%63s = %ld", name, &from) == 2)
+		{
+			int op = findOperation(name);
+
+			if (op < 0 || from < MIZARU_OFFLOAD_NEVER)
+			{
+				valid = false;
+				break;
+			}
+
+			crossovers[op] = from;
+			found[op] = true;
+		}
+		else if (sscanf(line, "%63s %lu %lf %lf", name, &sample.size, &sample.chipTime, &sample.softwareTime) == 4)
+		{
+			int op = findOperation(name);
+
+			if (op < 0)
+			{
+				valid = false;
+				break;
+			}
+
+			samples[op].push_back(sample);
+		}
+		else
+		{
+			valid = false;
+		}
+	}
+
+	fclose(fp);
+
+	if (!valid)
+	{
+		WARNING_MSG("Invalid Mizar calibration in %s: %s", path.c_str(), line);
+
+		return false;
+	}
+
+	for (int op = 0; op < MizaruOffload::OPERATION_COUNT; op++)
+	{
+		if (found[op])
+		{
+			offload->setSamples((MizaruOffload::Operation) op, samples[op]);
+			offload->setCrossover((MizaruOffload::Operation) op, crossovers[op]);
+		}
+	}
+
+	INFO_MSG("Loaded the Mizar calibration from %s", path.c_str());
+
+	return true;
+}
+
+// Writes the calibrated operations to a file
+bool MizaruCalibration::save(const std::string& path, const MizaruOffload* offload)
+{
+	FILE* fp = fopen(path.c_str(), "w");
+
+	if (fp == NULL)
+	{
+		ERROR_MSG("Could not write the Mizar calibration to %s", path.c_str());
+
+		return false;
+	}
+
+	fprintf(fp, "# Mizar offload calibration, remove this file to calibrate again\n");
+	fprintf(fp, "# <operation> <size> <chip time in us> <software time in us>\n");
+
+	for (int op = 0; op < MizaruOffload::OPERATION_COUNT; op++)
+	{
+		MizaruOffload::Operation operation = (MizaruOffload::Operation) op;
+		const std::vector<MizaruOffloadSample>& samples = offload->getSamples(operation);
+
+		if (samples.empty())
+		{
+			continue;
+		}
+
+		for (size_t i = 0; i < samples.size(); i++)
+		{
+			fprintf(fp, "%s %lu %.3f %.3f\n", MizaruOffload::getName(operation),
+				samples[i].size, samples[i].chipTime, samples[i].softwareTime);
+		}
+
+		fprintf(fp, "%s = %li\n", MizaruOffload::getName(operation), offload->getCrossover(operation));
+	}
+
+	if (fclose(fp) != 0)
+	{
+		ERROR_MSG("Could not write the Mizar calibration to %s", path.c_str());
+
+		return false;
+	}
+
+	return true;
+}
+
+// The smallest size from which on the chip is faster
+long MizaruCalibration::crossover(const std::vector<MizaruOffloadSample>& samples)
+{
+	long from = MIZARU_OFFLOAD_NEVER;
+
+	for (size_t i = samples.size(); i > 0; i--)
+	{
+		const MizaruOffloadSample& sample = samples[i - 1];
+
+		if (sample.chipTime < 0 ||
+		    (sample.softwareTime >= 0 && sample.chipTime >= sample.softwareTime))
+		{
+			break;
+		}
+
+		// Sizes below the smallest measured one go to the chip as well
+		from = i == 1 ? 0 : sample.size;
+	}
+
+	return from;
+}
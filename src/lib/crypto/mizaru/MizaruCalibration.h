@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruCalibration.h
+
+ Measures how long each kind of operation takes on the Mizar chip and in
+ OpenSSL for a range of sizes, and sets the crossover points of the offload
+ policy to where the chip becomes faster. A calibration can be saved to a
+ file and loaded again at the next start.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_MIZARUCALIBRATION_H
+#define _SOFTHSM_V2_MIZARUCALIBRATION_H
+
+#include "config.h"
+#include "MizaruOffload.h"
+#include <string>
+#include <vector>
+
+class MizaruCalibration
+{
+public:
+	// Measures all operations and sets the samples and crossover points
+	static bool run(MizaruOffload* offload);
+
+	// Measures one operation
+	static bool measure(MizaruOffload::Operation op, std::vector<MizaruOffloadSample>& samples);
+
+	// Reads and writes a calibration file
+	static bool load(const std::string& path, MizaruOffload* offload);
+	static bool save(const std::string& path, const MizaruOffload* offload);
+
+	// The smallest size from which on the chip is faster for all larger
+	// sizes as well, MIZARU_OFFLOAD_NEVER if it is not faster for the
+	// largest size
+	static long crossover(const std::vector<MizaruOffloadSample>& samples);
+};
+
+#endif // !_SOFTHSM_V2_MIZARUCALIBRATION_H
@@ -32,18 +32,41 @@
 
 #include "config.h"
 #include "MutexFactory.h"
+#include "Configuration.h"
+#include "log.h"
 #include "MizaruCryptoFactory.h"
 #include "MizaruRNG.h"
-// #include "MizaruAES.h"
-// #include "MizaruDES.h"
+#include "MizaruDevicePool.h"
+#include "MizaruOffload.h"
+#include "MizaruAES.h"
+#include "MizaruDES.h"
+#include "MizaruSM4.h"
+#include "MizaruZUC.h"
+#include "MizaruZUCMac.h"
 #include "MizaruSHA256.h"
-// #include "MizaruCMAC.h"
-// #include "MizaruHMAC.h"
-// #include "MizaruRSA.h"
-// #include "MizaruECDSA.h"
+#include "MizaruSM3.h"
+#include "MizaruCMAC.h"
+#include "MizaruHMAC.h"
+#include "MizaruRSA.h"
+#ifdef WITH_ECC
+#include "MizaruECDSA.h"
+#include "MizaruSM2.h"
+#endif
+#include "MizaruIndexedAES.h"
+#include "MizaruIndexedAsymmetricAlgorithm.h"
+#ifdef HAVE_MIZAR_SIMULATOR
+#include "MizarSimDevice.h"
+#endif
 
 #include <algorithm>
 #include <string.h>
+#include <openssl/opensslv.h>
+
+// The backend is written against the OpenSSL 1.1.1 API, the first with
+// SM2, SM3 and SM4
+#if OPENSSL_VERSION_NUMBER < 0x10101000L || defined(LIBRESSL_VERSION_NUMBER)
+#error MizaruHSM needs OpenSSL 1.1.1 or later
+#endif
 
 static unsigned nlocks;
 static Mutex** locks;
@@ -59,8 +82,35 @@ MizaruCryptoFactory::MizaruCryptoFactory()
 	// 	locks[i] = MutexFactory::i()->getMutex();
 	// }
 
+#ifdef HAVE_MIZAR_SIMULATOR
+	// The simulated chips lock with the mutex functions of this C_Initialize
+	MizarSimDevice::createLocks();
+#endif
+
+	// The channels are used by every thread
+	MizaruDevicePool::i();
+
+	// So are the crossover points, which may be calibrated on the channels
+	MizaruOffload::i();
+
 	// Initialise the one-and-only RNG
-	rng = new MizaruRNG();
+	int poolSize = Configuration::i()->getInt("mizaru.rng.pool_size", DEFAULT_MIZARU_RNG_POOL_SIZE);
+	if (poolSize < 0)
+	{
+		WARNING_MSG("Invalid entropy pool size %i, using %i", poolSize, DEFAULT_MIZARU_RNG_POOL_SIZE);
+
+		poolSize = DEFAULT_MIZARU_RNG_POOL_SIZE;
+	}
+
+	int reseedInterval = Configuration::i()->getInt("mizaru.rng.reseed_interval", DEFAULT_MIZARU_RNG_RESEED_INTERVAL);
+	if (reseedInterval < 1)
+	{
+		WARNING_MSG("Invalid reseed interval %i, using %i", reseedInterval, DEFAULT_MIZARU_RNG_RESEED_INTERVAL);
+
+		reseedInterval = DEFAULT_MIZARU_RNG_RESEED_INTERVAL;
+	}
+
+	rng = new MizaruRNG(poolSize, reseedInterval);
 }
 
 // Destructor
@@ -71,6 +121,17 @@ MizaruCryptoFactory::~MizaruCryptoFactory()
 	// 	MutexFactory::i()->recycleMutex(locks[i]);
 	// }
 	// delete[] locks;
+
+	// Stops the entropy refill thread, which uses the channels
+	delete rng;
+
+	// The channel count and the crossover points are read again after a reset
+	MizaruDevicePool::reset();
+	MizaruOffload::reset();
+
+#ifdef HAVE_MIZAR_SIMULATOR
+	MizarSimDevice::releaseLocks();
+#endif
 }
 
 // Return the one-and-only instance
@@ -93,14 +154,20 @@ void MizaruCryptoFactory::reset()
 // Create a concrete instance of a symmetric algorithm
 SymmetricAlgorithm* MizaruCryptoFactory::getSymmetricAlgorithm(SymAlgo::Type algorithm)
 {
-	// switch (algorithm)
-	// {
-	// 	case SymAlgo::AES:
-	// 		return new MizaruAES();
-	// 	case SymAlgo::DES:
-	// 	case SymAlgo::DES3:
-	// 		return new MizaruDES();
-	// }
+	switch (algorithm)
+	{
+		case SymAlgo::AES:
+			return new MizaruAES();
+		case SymAlgo::DES:
+		case SymAlgo::DES3:
+			return new MizaruDES();
+		case SymAlgo::SM4:
+			return new MizaruSM4();
+		case SymAlgo::ZUC:
+			return new MizaruZUC();
+		default:
+			break;
+	}
 
 	// No algorithm implementation is available
 	ERROR_MSG("Unknown algorithm '%i'", algorithm);
@@ -110,15 +177,19 @@ SymmetricAlgorithm* MizaruCryptoFactory::getSymmetricAlgorithm(SymAlgo::Type alg
 // Create a concrete instance of an asymmetric algorithm
 AsymmetricAlgorithm* MizaruCryptoFactory::getAsymmetricAlgorithm(AsymAlgo::Type algorithm)
 {
-// 	switch (algorithm)
-// 	{
-// 		case AsymAlgo::RSA:
-// 			return new MizaruRSA();
-// #ifdef WITH_ECC
-// 		case AsymAlgo::ECDSA:
-// 			return new MizaruECDSA();
-// #endif
-// 	}
+	switch (algorithm)
+	{
+		case AsymAlgo::RSA:
+			return new MizaruRSA();
+#ifdef WITH_ECC
+		case AsymAlgo::ECDSA:
+			return new MizaruECDSA();
+		case AsymAlgo::SM2:
+			return new MizaruSM2();
+#endif
+		default:
+			break;
+	}
 
 	// No algorithm implementation is available
 	ERROR_MSG("Unknown algorithm '%i'", algorithm);
@@ -132,6 +203,10 @@ HashAlgorithm* MizaruCryptoFactory::getHashAlgorithm(HashAlgo::Type algorithm)
 	{
 		case HashAlgo::SHA256:
 			return new MizaruSHA256();
+		case HashAlgo::SM3:
+			return new MizaruSM3();
+		default:
+			break;
 	}
 
 	// No algorithm implementation is available
@@ -142,15 +217,19 @@ HashAlgorithm* MizaruCryptoFactory::getHashAlgorithm(HashAlgo::Type algorithm)
 // Create a concrete instance of a MAC algorithm
 MacAlgorithm* MizaruCryptoFactory::getMacAlgorithm(MacAlgo::Type algorithm)
 {
-	// switch (algorithm)
-	// {
-	// 	case MacAlgo::HMAC_SHA256:
-	// 		return new MizaruHMACSHA256();
-	// 	case MacAlgo::CMAC_DES:
-	// 		return new MizaruCMACDES();
-	// 	case MacAlgo::CMAC_AES:
-	// 		return new MizaruCMACAES();
-	// }
+	switch (algorithm)
+	{
+		case MacAlgo::HMAC_SHA256:
+			return new MizaruHMACSHA256();
+		case MacAlgo::CMAC_DES:
+			return new MizaruCMACDES();
+		case MacAlgo::CMAC_AES:
+			return new MizaruCMACAES();
+		case MacAlgo::ZUC_EIA3:
+			return new MizaruZUCMac();
+		default:
+			break;
+	}
 
 	// No algorithm implementation is available
 	ERROR_MSG("Unknown algorithm '%i'", algorithm);
@@ -173,3 +252,35 @@ RNG* MizaruCryptoFactory::getRNG(RNGImpl::Type name /* = RNGImpl::Default */)
 	}
 }
 
+
+// Create an algorithm that uses keys held in Mizar key slots
+SymmetricAlgorithm* MizaruCryptoFactory::getIndexedSymmetricAlgorithm(SymAlgo::Type algorithm)
+{
+	switch (algorithm)
+	{
+		case SymAlgo::AES:
+			return new MizaruIndexedAES();
+		default:
+			break;
+	}
+
+	// No algorithm implementation is available
+	ERROR_MSG("Unknown algorithm '%i' for Mizar key slots", algorithm);
+	return NULL;
+}
+
+AsymmetricAlgorithm* MizaruCryptoFactory::getIndexedAsymmetricAlgorithm(AsymAlgo::Type algorithm)
+{
+	switch (algorithm)
+	{
+		case AsymAlgo::RSA:
+		case AsymAlgo::ECDSA:
+			return new MizaruIndexedAsymmetricAlgorithm();
+		default:
+			break;
+	}
+
+	// No algorithm implementation is available
+	ERROR_MSG("Unknown algorithm '%i' for Mizar key slots", algorithm);
+	return NULL;
+}
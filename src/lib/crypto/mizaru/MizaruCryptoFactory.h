@@ -66,6 +66,10 @@ public:
 	// Get the global RNG (may be an unique RNG per thread)
 	virtual RNG* getRNG(RNGImpl::Type name = RNGImpl::Default);
 
+	// Create an algorithm that uses keys held in Mizar key slots
+	SymmetricAlgorithm* getIndexedSymmetricAlgorithm(SymAlgo::Type algorithm);
+	AsymmetricAlgorithm* getIndexedAsymmetricAlgorithm(AsymAlgo::Type algorithm);
+
 	// Destructor
 	virtual ~MizaruCryptoFactory();
 
@@ -27,11 +27,14 @@
 /*****************************************************************************
  MizaruDES.cpp
 
- OpenSSL (3)DES implementation
+ Mizaru (3)DES implementation
  *****************************************************************************/
 
 #include "config.h"
 #include "MizaruDES.h"
+#include "MizaruDevicePool.h"
+#include "MizaruOffload.h"
+#include "mizar_api.h"
 #include <algorithm>
 #include "odd.h"
 
@@ -163,3 +166,42 @@ size_t MizaruDES::getBlockSize() const
 	return 64 >> 3;
 }
 
+// Runs whole ECB or CBC blocks on the chip
+bool MizaruDES::chipCrypt(bool encrypt, SymMode::Type mode, const ByteString& iv, const ByteString& in, ByteString& out)
+{
+	if (!MizaruOffload::i()->useChip(MizaruOffload::DES, in.size()))
+	{
+		return false;
+	}
+
+	// The chip does not change its inputs
+	mizar_uint8* key = (mizar_uint8*) currentKey->getKeyBits().const_byte_str();
+	mizar_uint32 keyLen = currentKey->getKeyBits().size();
+	mizar_uint8* data = (mizar_uint8*) in.const_byte_str();
+	mizar_uint8* chainIV = (mizar_uint8*) iv.const_byte_str();
+	mizar_uint32 mizarMode = encrypt ? 0 : 1;
+
+	out.resize(in.size());
+	mizar_uint32 outLen = out.size();
+	mizar_uint32 rv;
+
+	if (mode == SymMode::ECB)
+	{
+		rv = MizaruDevicePool::i()->run([&] { return MizarDesEcb(mizarMode, in.size(), data, keyLen, key, &outLen, &out[0]); });
+	}
+	else
+	{
+		rv = MizaruDevicePool::i()->run([&] { return MizarDesCbc(mizarMode, chainIV, in.size(), data, keyLen, key, &outLen, &out[0]); });
+	}
+
+	if (rv != 0 || outLen != in.size())
+	{
+		WARNING_MSG("DES operation on the Mizar chip failed (0x%08X), using OpenSSL", rv);
+
+		MizaruOffload::i()->fallBack(MizaruOffload::DES);
+
+		return false;
+	}
+
+	return true;
+}
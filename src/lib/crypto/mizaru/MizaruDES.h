@@ -27,7 +27,8 @@
 /*****************************************************************************
  MizaruDES.h
 
- OpenSSL AES implementation
+ Mizaru DES implementation. ECB and CBC data from the crossover size on is
+ encrypted by the chip; everything else is done by OpenSSL.
  *****************************************************************************/
 
 #ifndef _SOFTHSM_V2_MIZARUDES_H
@@ -58,6 +59,9 @@ public:
 protected:
 	// Return the right EVP cipher for the operation
 	virtual const EVP_CIPHER* getCipher() const;
+
+	// Runs whole ECB or CBC blocks on the chip
+	virtual bool chipCrypt(bool encrypt, SymMode::Type mode, const ByteString& iv, const ByteString& in, ByteString& out);
 };
 
 #endif // !_SOFTHSM_V2_MIZARUDES_H
@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruDevicePool.cpp
+
+ Spreads independent chip operations over all Mizar message channels
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "Configuration.h"
+#include "MizaruDevicePool.h"
+#include "mizar_errcode.h"
+#include "mizar_msg.h"
+#include <chrono>
+
+// Return the one-and-only instance; it is created by MizaruCryptoFactory
+// before any thread can use it
+MizaruDevicePool* MizaruDevicePool::i()
+{
+	if (!instance.get())
+	{
+		int count = Configuration::i()->getInt("mizaru.channels", DEFAULT_MIZARU_CHANNELS);
+
+		if (count < 1)
+		{
+			WARNING_MSG("Invalid number of Mizar channels %i, using %i", count, DEFAULT_MIZARU_CHANNELS);
+
+			count = DEFAULT_MIZARU_CHANNELS;
+		}
+
+		if (count > MIZARU_MAX_CHANNELS)
+		{
+			WARNING_MSG("The Mizar SDK cannot address %i channels, using %i", count, MIZARU_MAX_CHANNELS);
+
+			count = MIZARU_MAX_CHANNELS;
+		}
+
+		instance.reset(new MizaruDevicePool(count));
+	}
+
+	return instance.get();
+}
+
+// This will destroy the one-and-only instance.
+void MizaruDevicePool::reset()
+{
+	instance.reset();
+}
+
+// Constructor
+MizaruDevicePool::MizaruDevicePool(unsigned nChannels) : nChannels(nChannels), channels(new Channel[nChannels])
+{
+	for (unsigned c = 0; c < nChannels; c++)
+	{
+		channels[c].outstanding = 0;
+		channels[c].completed = 0;
+		channels[c].failures = 0;
+		channels[c].retryAt = 0;
+	}
+
+	nextStart = 0;
+}
+
+// Destructor
+MizaruDevicePool::~MizaruDevicePool()
+{
+}
+
+long long MizaruDevicePool::now()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Errors of the message channel rather than of the command
+bool MizaruDevicePool::isTransportError(mizar_uint32 rv)
+{
+	switch (rv)
+	{
+		case ERR_MSG_CRC:
+		case ERR_CMD_SEND:
+		case ERR_CMD_TIMEOUT:
+		case ERR_COMM:
+		case ERR_MSG_CHECK:
+		case ERR_OPENDEV:
+		case ERR_SPI_IOCTL:
+		case ERR_I2C_FAULT:
+		case ERR_MSG_LEN:
+		case ERR_SPI_SN:
+			return true;
+		default:
+			return false;
+	}
+}
+
+unsigned MizaruDevicePool::getChannelCount()
+{
+	return nChannels;
+}
+
+bool MizaruDevicePool::isHealthy(int channel)
+{
+	if (channel < 0 || (unsigned) channel >= nChannels) return false;
+
+	return channels[channel].failures < MIZARU_CHANNEL_MAX_FAILURES || now() >= channels[channel].retryAt;
+}
+
+unsigned long MizaruDevicePool::getOutstanding(int channel)
+{
+	if (channel < 0 || (unsigned) channel >= nChannels) return 0;
+
+	return channels[channel].outstanding;
+}
+
+unsigned long long MizaruDevicePool::getCompleted(int channel)
+{
+	if (channel < 0 || (unsigned) channel >= nChannels) return 0;
+
+	return channels[channel].completed;
+}
+
+// Picks a channel not yet tried and counts the operation, -1 if none is usable
+int MizaruDevicePool::acquire(const std::vector<bool>& tried)
+{
+	unsigned start = nextStart++ % nChannels;
+	int best = -1;
+	unsigned long bestLoad = 0;
+
+	for (unsigned n = 0; n < nChannels; n++)
+	{
+		unsigned c = (start + n) % nChannels;
+
+		if (tried[c] || !isHealthy(c)) continue;
+
+		unsigned long load = channels[c].outstanding;
+
+		if (best == -1 || load < bestLoad)
+		{
+			best = c;
+			bestLoad = load;
+		}
+	}
+
+	if (best != -1)
+	{
+		channels[best].outstanding++;
+	}
+
+	return best;
+}
+
+// Results on which another channel is tried
+bool MizaruDevicePool::isRetryable(mizar_uint32 rv)
+{
+	return isTransportError(rv) || rv == ERR_CHIP_BUSY;
+}
+
+// Records the result of an operation
+void MizaruDevicePool::release(int channel, mizar_uint32 rv)
+{
+	Channel& ch = channels[channel];
+
+	ch.outstanding--;
+	ch.completed++;
+
+	if (isTransportError(rv))
+	{
+		unsigned failures = ++ch.failures;
+
+		if (failures >= MIZARU_CHANNEL_MAX_FAILURES)
+		{
+			ch.retryAt = now() + MIZARU_CHANNEL_RETRY_MS;
+
+			if (failures == MIZARU_CHANNEL_MAX_FAILURES)
+			{
+				WARNING_MSG("Mizar channel %i is out of service (0x%08X)", channel, rv);
+			}
+		}
+	}
+	else if (rv != ERR_CHIP_BUSY)
+	{
+		if (ch.failures.exchange(0) >= MIZARU_CHANNEL_MAX_FAILURES)
+		{
+			INFO_MSG("Mizar channel %i is back in service", channel);
+		}
+	}
+}
+
+// Runs an operation on a channel that has been acquired
+mizar_uint32 MizaruDevicePool::execute(int channel, const std::function<mizar_uint32()>& op)
+{
+	mizar_uint32 rv = MizarDevLock(channel);
+
+	if (rv == SUCCESS)
+	{
+		rv = op();
+
+		MizarDevUnlock(channel);
+	}
+
+	release(channel, rv);
+
+	return rv;
+}
+
+// Runs an operation on the least busy healthy channel
+mizar_uint32 MizaruDevicePool::run(const std::function<mizar_uint32()>& op, int* usedChannel /* = NULL */)
+{
+	std::vector<bool> tried(nChannels, false);
+	mizar_uint32 rv = ERR_OPENDEV;
+	bool ran = false;
+
+	for (;;)
+	{
+		int channel = acquire(tried);
+
+		if (channel < 0) break;
+
+		tried[channel] = true;
+		ran = true;
+		rv = execute(channel, op);
+
+		if (usedChannel != NULL) *usedChannel = channel;
+
+		// Command errors are final, the other chips would give the same answer
+		if (!isRetryable(rv)) break;
+	}
+
+	if (!ran)
+	{
+		ERROR_MSG("No Mizar channel is in service");
+	}
+
+	return rv;
+}
+
+// Runs an operation on the given channel
+mizar_uint32 MizaruDevicePool::runOn(int channel, const std::function<mizar_uint32()>& op)
+{
+	if (channel < 0 || (unsigned) channel >= nChannels) return ERR_SPI_SN;
+
+	channels[channel].outstanding++;
+
+	return execute(channel, op);
+}
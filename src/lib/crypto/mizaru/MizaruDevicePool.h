@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruDevicePool.h
+
+ Runs the chip operations on the Mizar message channels. Each operation
+ goes to the healthy channel with the fewest operations in flight. A
+ channel that keeps failing at the transport level is taken out of service
+ for a while and then tried again.
+
+ An operation holds its channel with MizarDevLock while it runs, so the
+ state of a chip, such as its single digest stream, belongs to one
+ operation at a time, also across processes.
+
+ The API calls of the SDK take no channel and all go to the default chip;
+ MizarDevLock only serialises them. Until the SDK can address a channel,
+ the pool of the backend therefore has one channel, whatever
+ mizaru.channels asks for.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_MIZARUDEVICEPOOL_H
+#define _SOFTHSM_V2_MIZARUDEVICEPOOL_H
+
+#include "config.h"
+#include "mizar_basetype.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// The default number of message channels
+#define DEFAULT_MIZARU_CHANNELS 1
+
+// The most message channels the API calls of the SDK can address
+#define MIZARU_MAX_CHANNELS 1
+
+// Consecutive transport failures before a channel is taken out of service
+#define MIZARU_CHANNEL_MAX_FAILURES 3
+
+// Milliseconds before a channel out of service is tried again
+#define MIZARU_CHANNEL_RETRY_MS 1000
+
+class MizaruDevicePool
+{
+public:
+	// Return the one-and-only instance, sized by mizaru.channels up to
+	// MIZARU_MAX_CHANNELS
+	static MizaruDevicePool* i();
+
+	// This will destroy the one-and-only instance.
+	static void reset();
+
+	// A pool over the channels 0 to nChannels - 1
+	explicit MizaruDevicePool(unsigned nChannels);
+
+	// Destructor
+	virtual ~MizaruDevicePool();
+
+	// Runs an operation on the least busy healthy channel and returns its
+	// Mizar return code. An operation that fails at the transport level is
+	// tried again on another channel. The channel that ran it is returned
+	// in *usedChannel.
+	mizar_uint32 run(const std::function<mizar_uint32()>& op, int* usedChannel = NULL);
+
+	// Runs an operation on the given channel
+	mizar_uint32 runOn(int channel, const std::function<mizar_uint32()>& op);
+
+	// Channel state
+	unsigned getChannelCount();
+	bool isHealthy(int channel);
+	unsigned long getOutstanding(int channel);
+	unsigned long long getCompleted(int channel);
+
+	// Results on which run() tries another channel: errors of the message
+	// channel and a busy chip
+	static bool isRetryable(mizar_uint32 rv);
+
+private:
+	struct Channel
+	{
+		// Operations in flight
+		std::atomic<unsigned long> outstanding;
+
+		// Operations finished
+		std::atomic<unsigned long long> completed;
+
+		// Consecutive transport failures
+		std::atomic<unsigned> failures;
+
+		// When a channel out of service may be tried again, in ms
+		std::atomic<long long> retryAt;
+	};
+
+	// Picks a channel not yet tried and counts the operation, -1 if none is usable
+	int acquire(const std::vector<bool>& tried);
+
+	// Records the result of an operation
+	void release(int channel, mizar_uint32 rv);
+
+	// Runs an operation on a channel that has been acquired
+	mizar_uint32 execute(int channel, const std::function<mizar_uint32()>& op);
+
+	// Errors of the message channel rather than of the command
+	static bool isTransportError(mizar_uint32 rv);
+
+	static long long now();
+
+	unsigned nChannels;
+	std::unique_ptr<Channel[]> channels;
+
+	// Rotates the starting point of the search between equally busy channels
+	std::atomic<unsigned> nextStart;
+
+	// The one-and-only instance
+#ifdef HAVE_CXX11
+	static std::unique_ptr<MizaruDevicePool> instance;
+#else
+	static std::auto_ptr<MizaruDevicePool> instance;
+#endif
+};
+
+#endif // !_SOFTHSM_V2_MIZARUDEVICEPOOL_H
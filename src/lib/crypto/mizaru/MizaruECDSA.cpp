@@ -27,351 +27,207 @@
 /*****************************************************************************
  MizaruECDSA.cpp
 
- OpenSSL ECDSA asymmetric algorithm implementation
+ Mizaru ECDSA asymmetric algorithm implementation
  *****************************************************************************/
 
 #include "config.h"
-#ifdef WITH_ECC
 #include "log.h"
 #include "MizaruECDSA.h"
-#include "CryptoFactory.h"
-#include "ECParameters.h"
-#include "OSSLECKeyPair.h"
-#include "OSSLComp.h"
-#include "OSSLUtil.h"
-#include <algorithm>
-#include <openssl/ecdsa.h>
-#include <openssl/pem.h>
-#include <openssl/err.h>
-#ifdef WITH_FIPS
-#include <openssl/fips.h>
-#endif
-#include <string.h>
-
-// Signing functions
-bool MizaruECDSA::sign(PrivateKey* privateKey, const ByteString& dataToSign,
-		     ByteString& signature, const AsymMech::Type mechanism,
-		     const void* /* param = NULL */, const size_t /* paramLen = 0 */)
+#include "MizaruECPrivateKey.h"
+#include "MizaruECPublicKey.h"
+#include "MizaruDevicePool.h"
+#include "MizaruOffload.h"
+#include "mizar_api.h"
+
+// Signs on the chip, false if the signature is left to OpenSSL
+bool MizaruECDSA::chipSign(PrivateKey* privateKey, const ByteString& dataToSign, ByteString& signature)
 {
-	if (mechanism != AsymMech::ECDSA)
-	{
-		ERROR_MSG("Invalid mechanism supplied (%i)", mechanism);
-		return false;
-	}
-
-	// Check if the private key is the right type
-	if (!privateKey->isOfType(OSSLECPrivateKey::type))
+	if (!privateKey->isOfType(MizaruECPrivateKey::type))
 	{
-		ERROR_MSG("Invalid key type supplied");
-
 		return false;
 	}
 
-	OSSLECPrivateKey* pk = (OSSLECPrivateKey*) privateKey;
-	EC_KEY* eckey = pk->getOSSLKey();
+	MizaruECPrivateKey* pk = (MizaruECPrivateKey*) privateKey;
 
-	if (eckey == NULL)
+	if (pk->getGroup() == 0 ||
+	    dataToSign.size() == 0 ||
+	    !MizaruOffload::i()->useChip(MizaruOffload::ECDSA_SIGN, pk->getBitLength()))
 	{
-		ERROR_MSG("Could not get the OpenSSL private key");
-
 		return false;
 	}
 
-	// Use the OpenSSL implementation and not any engine
-#if OPENSSL_VERSION_NUMBER < 0x10100000L || defined(LIBRESSL_VERSION_NUMBER)
-
-#ifdef WITH_FIPS
-	if (FIPS_mode())
-		ECDSA_set_method(eckey, FIPS_ecdsa_openssl());
-	else
-		ECDSA_set_method(eckey, ECDSA_OpenSSL());
-#else
-	ECDSA_set_method(eckey, ECDSA_OpenSSL());
-#endif
-
-#else
-	EC_KEY_set_method(eckey, EC_KEY_OpenSSL());
-#endif
-
-	// Perform the signature operation
 	size_t len = pk->getOrderLength();
-	if (len == 0)
+	ByteString d = pk->getPaddedD();
+	ByteString r, s;
+	r.resize(len);
+	s.resize(len);
+	mizar_uint32 rLen = len;
+	mizar_uint32 sLen = len;
+
+	// The chip does not change its inputs
+	mizar_uint32 rv = MizaruDevicePool::i()->run([&]
 	{
-		ERROR_MSG("Could not get the order length");
-		return false;
-	}
-	signature.resize(2 * len);
-	memset(&signature[0], 0, 2 * len);
-	ECDSA_SIG *sig = ECDSA_do_sign(dataToSign.const_byte_str(), dataToSign.size(), eckey);
-	if (sig == NULL)
-	{
-		ERROR_MSG("ECDSA sign failed (0x%08X)", ERR_get_error());
-		return false;
-	}
-	// Store the 2 values with padding
-	const BIGNUM* bn_r = NULL;
-	const BIGNUM* bn_s = NULL;
-	ECDSA_SIG_get0(sig, &bn_r, &bn_s);
-	BN_bn2bin(bn_r, &signature[len - BN_num_bytes(bn_r)]);
-	BN_bn2bin(bn_s, &signature[2 * len - BN_num_bytes(bn_s)]);
-	ECDSA_SIG_free(sig);
-	return true;
-}
+		return MizarEccSign(pk->getGroup(), 0, d.size(), &d[0], dataToSign.size(), (mizar_uint8*) dataToSign.const_byte_str(), &rLen, &r[0], &sLen, &s[0]);
+	});
 
-bool MizaruECDSA::signInit(PrivateKey* /*privateKey*/, const AsymMech::Type /*mechanism*/,
-			 const void* /* param = NULL */, const size_t /* paramLen = 0 */)
-{
-	ERROR_MSG("ECDSA does not support multi part signing");
-
-	return false;
-}
-
-bool MizaruECDSA::signUpdate(const ByteString& /*dataToSign*/)
-{
-	ERROR_MSG("ECDSA does not support multi part signing");
-
-	return false;
-}
-
-bool MizaruECDSA::signFinal(ByteString& /*signature*/)
-{
-	ERROR_MSG("ECDSA does not support multi part signing");
-
-	return false;
-}
-
-// Verification functions
-bool MizaruECDSA::verify(PublicKey* publicKey, const ByteString& originalData,
-		       const ByteString& signature, const AsymMech::Type mechanism,
-		       const void* /* param = NULL */, const size_t /* paramLen = 0 */)
-{
-	if (mechanism != AsymMech::ECDSA)
+	if (rv != 0 || rLen != len || sLen != len)
 	{
-		ERROR_MSG("Invalid mechanism supplied (%i)", mechanism);
-		return false;
-	}
-
-	// Check if the private key is the right type
-	if (!publicKey->isOfType(OSSLECPublicKey::type))
-	{
-		ERROR_MSG("Invalid key type supplied");
-
-		return false;
-	}
-
-	OSSLECPublicKey* pk = (OSSLECPublicKey*) publicKey;
-	EC_KEY* eckey = pk->getOSSLKey();
-
-	if (eckey == NULL)
-	{
-		ERROR_MSG("Could not get the OpenSSL public key");
-
-		return false;
-	}
+		WARNING_MSG("ECDSA signing on the Mizar chip failed (0x%08X), using OpenSSL", rv);
 
-	// Use the OpenSSL implementation and not any engine
-#if OPENSSL_VERSION_NUMBER < 0x10100000L || defined(LIBRESSL_VERSION_NUMBER)
+		MizaruOffload::i()->fallBack(MizaruOffload::ECDSA_SIGN);
 
-#ifdef WITH_FIPS
-	if (FIPS_mode())
-		ECDSA_set_method(eckey, FIPS_ecdsa_openssl());
-	else
-		ECDSA_set_method(eckey, ECDSA_OpenSSL());
-#else
-	ECDSA_set_method(eckey, ECDSA_OpenSSL());
-#endif
-
-#else
-	EC_KEY_set_method(eckey, EC_KEY_OpenSSL());
-#endif
-
-	// Perform the verify operation
-	size_t len = pk->getOrderLength();
-	if (len == 0)
-	{
-		ERROR_MSG("Could not get the order length");
 		return false;
 	}
-	if (signature.size() != 2 * len)
-	{
-		ERROR_MSG("Invalid buffer length");
-		return false;
-	}
-	ECDSA_SIG* sig = ECDSA_SIG_new();
-	if (sig == NULL)
-	{
-		ERROR_MSG("Could not create an ECDSA_SIG object");
-		return false;
-	}
-	const unsigned char *s = signature.const_byte_str();
-	BIGNUM* bn_r = BN_bin2bn(s, len, NULL);
-	BIGNUM* bn_s = BN_bin2bn(s + len, len, NULL);
-	if (bn_r == NULL || bn_s == NULL ||
-	    !ECDSA_SIG_set0(sig, bn_r, bn_s))
-	{
-		ERROR_MSG("Could not add data to the ECDSA_SIG object");
-		ECDSA_SIG_free(sig);
-		return false;
-	}
-	int ret = ECDSA_do_verify(originalData.const_byte_str(), originalData.size(), sig, eckey);
-	if (ret != 1)
-	{
-		if (ret < 0)
-			ERROR_MSG("ECDSA verify failed (0x%08X)", ERR_get_error());
 
-		ECDSA_SIG_free(sig);
-		return false;
-	}
+	signature = r + s;
 
-	ECDSA_SIG_free(sig);
 	return true;
 }
 
-bool MizaruECDSA::verifyInit(PublicKey* /*publicKey*/, const AsymMech::Type /*mechanism*/,
-			   const void* /* param = NULL */, const size_t /* paramLen = 0 */)
-{
-	ERROR_MSG("ECDSA does not support multi part verifying");
-
-	return false;
-}
-
-bool MizaruECDSA::verifyUpdate(const ByteString& /*originalData*/)
-{
-	ERROR_MSG("ECDSA does not support multi part verifying");
-
-	return false;
-}
-
-bool MizaruECDSA::verifyFinal(const ByteString& /*signature*/)
+// Signing functions
+bool MizaruECDSA::sign(PrivateKey* privateKey, const ByteString& dataToSign,
+		       ByteString& signature, const AsymMech::Type mechanism,
+		       const void* param /* = NULL */, const size_t paramLen /* = 0 */)
 {
-	ERROR_MSG("ECDSA does not support multi part verifying");
+	if (mechanism == AsymMech::ECDSA && privateKey != NULL && chipSign(privateKey, dataToSign, signature))
+	{
+		return true;
+	}
 
-	return false;
+	return OSSLECDSA::sign(privateKey, dataToSign, signature, mechanism, param, paramLen);
 }
 
-// Encryption functions
-bool MizaruECDSA::encrypt(PublicKey* /*publicKey*/, const ByteString& /*data*/,
-			ByteString& /*encryptedData*/, const AsymMech::Type /*padding*/)
+// Verification functions
+bool MizaruECDSA::verify(PublicKey* publicKey, const ByteString& originalData,
+			 const ByteString& signature, const AsymMech::Type mechanism,
+			 const void* /* param = NULL */, const size_t /* paramLen = 0 */)
 {
-	ERROR_MSG("ECDSA does not support encryption");
+	std::vector<AsymVerifyItem> items(1);
 
-	return false;
-}
-
-// Decryption functions
-bool MizaruECDSA::decrypt(PrivateKey* /*privateKey*/, const ByteString& /*encryptedData*/,
-			ByteString& /*data*/, const AsymMech::Type /*padding*/)
-{
-	ERROR_MSG("ECDSA does not support decryption");
+	items[0].publicKey = publicKey;
+	items[0].data = originalData;
+	items[0].signature = signature;
 
-	return false;
+	return verifyBatch(items, mechanism) && items[0].valid;
 }
 
-// Key factory
-bool MizaruECDSA::generateKeyPair(AsymmetricKeyPair** ppKeyPair, AsymmetricParameters* parameters, RNG* /*rng = NULL */)
+// Verifies all well formed signatures with keys the chip can use on one
+// channel, held once for all of them; OpenSSL verifies the others
+bool MizaruECDSA::verifyBatch(std::vector<AsymVerifyItem>& items, const AsymMech::Type mechanism)
 {
-	// Check parameters
-	if ((ppKeyPair == NULL) ||
-	    (parameters == NULL))
-	{
-		return false;
-	}
-
-	if (!parameters->areOfType(ECParameters::type))
+	if (mechanism != AsymMech::ECDSA)
 	{
-		ERROR_MSG("Invalid parameters supplied for ECDSA key generation");
+		ERROR_MSG("Invalid mechanism supplied (%i)", mechanism);
 
 		return false;
 	}
 
-	ECParameters* params = (ECParameters*) parameters;
+	std::vector<size_t> positions;
+	std::vector<size_t> software;
 
-	// Generate the key-pair
-	EC_KEY* eckey = EC_KEY_new();
-	if (eckey == NULL)
-	{
-		ERROR_MSG("Failed to instantiate OpenSSL ECDSA object");
+	positions.reserve(items.size());
 
-		return false;
-	}
-
-	EC_GROUP* grp = OSSL::byteString2grp(params->getEC());
-	EC_KEY_set_group(eckey, grp);
-	EC_GROUP_free(grp);
-
-	if (!EC_KEY_generate_key(eckey))
+	for (size_t i = 0; i < items.size(); i++)
 	{
-		ERROR_MSG("ECDSA key generation failed (0x%08X)", ERR_get_error());
+		AsymVerifyItem& item = items[i];
 
-		EC_KEY_free(eckey);
+		item.valid = false;
 
-		return false;
-	}
+		if (item.publicKey == NULL)
+		{
+			ERROR_MSG("Invalid key type supplied");
 
-	// Create an asymmetric key-pair object to return
-	OSSLECKeyPair* kp = new OSSLECKeyPair();
+			continue;
+		}
 
-	((OSSLECPublicKey*) kp->getPublicKey())->setFromOSSL(eckey);
-	((OSSLECPrivateKey*) kp->getPrivateKey())->setFromOSSL(eckey);
+		if (!item.publicKey->isOfType(MizaruECPublicKey::type))
+		{
+			software.push_back(i);
 
-	*ppKeyPair = kp;
+			continue;
+		}
 
-	// Release the key
-	EC_KEY_free(eckey);
+		MizaruECPublicKey* pk = (MizaruECPublicKey*) item.publicKey;
+		size_t len = pk->getOrderLength();
 
-	return true;
-}
+		if (pk->getGroup() == 0 || pk->getX().size() == 0 ||
+		    !MizaruOffload::i()->useChip(MizaruOffload::ECDSA_VERIFY, pk->getBitLength()))
+		{
+			software.push_back(i);
 
-unsigned long MizaruECDSA::getMinKeySize()
-{
-	// Smallest EC group is secp112r1
-	return 112;
-}
+			continue;
+		}
 
-unsigned long MizaruECDSA::getMaxKeySize()
-{
-	// Biggest EC group is secp521r1
-	return 521;
-}
+		if (item.signature.size() != 2 * len || item.data.size() == 0)
+		{
+			continue;
+		}
 
-bool MizaruECDSA::reconstructKeyPair(AsymmetricKeyPair** ppKeyPair, ByteString& serialisedData)
-{
-	// Check input
-	if ((ppKeyPair == NULL) ||
-	    (serialisedData.size() == 0))
-	{
-		return false;
+		positions.push_back(i);
 	}
 
-	ByteString dPub = ByteString::chainDeserialise(serialisedData);
-	ByteString dPriv = ByteString::chainDeserialise(serialisedData);
-
-	OSSLECKeyPair* kp = new OSSLECKeyPair();
-
-	bool rv = true;
-
-	if (!((ECPublicKey*) kp->getPublicKey())->deserialise(dPub))
-	{
-		rv = false;
-	}
-
-	if (!((ECPrivateKey*) kp->getPrivateKey())->deserialise(dPriv))
+	if (!positions.empty())
 	{
-		rv = false;
+		std::vector<mizar_uint32> results(positions.size(), ERR_CALC);
+
+		// A channel error ends the run, the pool then tries another channel
+		mizar_uint32 rv = MizaruDevicePool::i()->run([&]
+		{
+			for (size_t i = 0; i < positions.size(); i++)
+			{
+				AsymVerifyItem& item = items[positions[i]];
+				MizaruECPublicKey* pk = (MizaruECPublicKey*) item.publicKey;
+				mizar_uint32 len = pk->getOrderLength();
+
+				// The chip does not change its inputs
+				mizar_uint8* signature = (mizar_uint8*) item.signature.const_byte_str();
+
+				results[i] = MizarEccVerify(pk->getGroup(), 0,
+							    len, (mizar_uint8*) pk->getX().const_byte_str(),
+							    len, (mizar_uint8*) pk->getY().const_byte_str(),
+							    len, signature, len, signature + len,
+							    item.data.size(), (mizar_uint8*) item.data.const_byte_str());
+
+				if (MizaruDevicePool::isRetryable(results[i]))
+				{
+					return results[i];
+				}
+			}
+
+			return (mizar_uint32) SUCCESS;
+		});
+
+		if (rv == SUCCESS)
+		{
+			for (size_t i = 0; i < positions.size(); i++)
+			{
+				items[positions[i]].valid = results[i] == 0;
+			}
+		}
+		else
+		{
+			WARNING_MSG("MizarEccVerify failed (0x%08X), using OpenSSL", rv);
+
+			for (size_t i = 0; i < positions.size(); i++)
+			{
+				MizaruOffload::i()->fallBack(MizaruOffload::ECDSA_VERIFY);
+			}
+
+			software.insert(software.end(), positions.begin(), positions.end());
+		}
 	}
 
-	if (!rv)
+	for (size_t i = 0; i < software.size(); i++)
 	{
-		delete kp;
+		AsymVerifyItem& item = items[software[i]];
 
-		return false;
+		item.valid = OSSLECDSA::verify(item.publicKey, item.data, item.signature, mechanism);
 	}
 
-	*ppKeyPair = kp;
-
 	return true;
 }
 
+// Key factory
 bool MizaruECDSA::reconstructPublicKey(PublicKey** ppPublicKey, ByteString& serialisedData)
 {
 	// Check input
@@ -381,7 +237,7 @@ bool MizaruECDSA::reconstructPublicKey(PublicKey** ppPublicKey, ByteString& seri
 		return false;
 	}
 
-	OSSLECPublicKey* pub = new OSSLECPublicKey();
+	MizaruECPublicKey* pub = new MizaruECPublicKey();
 
 	if (!pub->deserialise(serialisedData))
 	{
@@ -404,7 +260,7 @@ bool MizaruECDSA::reconstructPrivateKey(PrivateKey** ppPrivateKey, ByteString& s
 		return false;
 	}
 
-	OSSLECPrivateKey* priv = new OSSLECPrivateKey();
+	MizaruECPrivateKey* priv = new MizaruECPrivateKey();
 
 	if (!priv->deserialise(serialisedData))
 	{
@@ -420,38 +276,10 @@ bool MizaruECDSA::reconstructPrivateKey(PrivateKey** ppPrivateKey, ByteString& s
 
 PublicKey* MizaruECDSA::newPublicKey()
 {
-	return (PublicKey*) new OSSLECPublicKey();
+	return (PublicKey*) new MizaruECPublicKey();
 }
 
 PrivateKey* MizaruECDSA::newPrivateKey()
 {
-	return (PrivateKey*) new OSSLECPrivateKey();
-}
-
-AsymmetricParameters* MizaruECDSA::newParameters()
-{
-	return (AsymmetricParameters*) new ECParameters();
-}
-
-bool MizaruECDSA::reconstructParameters(AsymmetricParameters** ppParams, ByteString& serialisedData)
-{
-	// Check input parameters
-	if ((ppParams == NULL) || (serialisedData.size() == 0))
-	{
-		return false;
-	}
-
-	ECParameters* params = new ECParameters();
-
-	if (!params->deserialise(serialisedData))
-	{
-		delete params;
-
-		return false;
-	}
-
-	*ppParams = params;
-
-	return true;
+	return (PrivateKey*) new MizaruECPrivateKey();
 }
-#endif
@@ -27,17 +27,19 @@
 /*****************************************************************************
  MizaruECDSA.h
 
- OpenSSL ECDSA asymmetric algorithm implementation
+ Mizaru ECDSA asymmetric algorithm implementation. Keys on a curve of the
+ chip are used by the chip from the crossover key size on, a batch of
+ signatures is verified on one channel, held once for the whole batch.
+ Everything else is done by OpenSSL.
  *****************************************************************************/
 
 #ifndef _SOFTHSM_V2_MIZARUECDSA_H
 #define _SOFTHSM_V2_MIZARUECDSA_H
 
 #include "config.h"
-#include "AsymmetricAlgorithm.h"
-#include <openssl/ecdsa.h>
+#include "OSSLECDSA.h"
 
-class MizaruECDSA : public AsymmetricAlgorithm
+class MizaruECDSA : public OSSLECDSA
 {
 public:
 	// Destructor
@@ -45,36 +47,20 @@ public:
 
 	// Signing functions
 	virtual bool sign(PrivateKey* privateKey, const ByteString& dataToSign, ByteString& signature, const AsymMech::Type mechanism, const void* param = NULL, const size_t paramLen = 0);
-	virtual bool signInit(PrivateKey* privateKey, const AsymMech::Type mechanism, const void* param = NULL, const size_t paramLen = 0);
-	virtual bool signUpdate(const ByteString& dataToSign);
-	virtual bool signFinal(ByteString& signature);
 
 	// Verification functions
 	virtual bool verify(PublicKey* publicKey, const ByteString& originalData, const ByteString& signature, const AsymMech::Type mechanism, const void* param = NULL, const size_t paramLen = 0);
-	virtual bool verifyInit(PublicKey* publicKey, const AsymMech::Type mechanism, const void* param = NULL, const size_t paramLen = 0);
-	virtual bool verifyUpdate(const ByteString& originalData);
-	virtual bool verifyFinal(const ByteString& signature);
-
-	// Encryption functions
-	virtual bool encrypt(PublicKey* publicKey, const ByteString& data, ByteString& encryptedData, const AsymMech::Type padding);
-
-	// Decryption functions
-	virtual bool decrypt(PrivateKey* privateKey, const ByteString& encryptedData, ByteString& data, const AsymMech::Type padding);
+	virtual bool verifyBatch(std::vector<AsymVerifyItem>& items, const AsymMech::Type mechanism);
 
 	// Key factory
-	virtual bool generateKeyPair(AsymmetricKeyPair** ppKeyPair, AsymmetricParameters* parameters, RNG* rng = NULL);
-	virtual unsigned long getMinKeySize();
-	virtual unsigned long getMaxKeySize();
-	virtual bool reconstructKeyPair(AsymmetricKeyPair** ppKeyPair, ByteString& serialisedData);
 	virtual bool reconstructPublicKey(PublicKey** ppPublicKey, ByteString& serialisedData);
 	virtual bool reconstructPrivateKey(PrivateKey** ppPrivateKey, ByteString& serialisedData);
-	virtual bool reconstructParameters(AsymmetricParameters** ppParams, ByteString& serialisedData);
 	virtual PublicKey* newPublicKey();
 	virtual PrivateKey* newPrivateKey();
-	virtual AsymmetricParameters* newParameters();
 
 private:
+	// Signs on the chip, false if the signature is left to OpenSSL
+	bool chipSign(PrivateKey* privateKey, const ByteString& dataToSign, ByteString& signature);
 };
 
 #endif // !_SOFTHSM_V2_MIZARUECDSA_H
-
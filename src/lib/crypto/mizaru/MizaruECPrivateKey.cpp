@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruECPrivateKey.cpp
+
+ Mizaru EC private key class
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "MizaruECPrivateKey.h"
+#include "MizaruECPublicKey.h"
+#include <string.h>
+
+// Set the type
+/*static*/ const char* MizaruECPrivateKey::type = "Mizaru EC Private Key";
+
+// Constructor
+MizaruECPrivateKey::MizaruECPrivateKey()
+{
+	group = 0;
+	orderLength = 0;
+}
+
+// Check if the key is of the given type
+bool MizaruECPrivateKey::isOfType(const char* inType)
+{
+	return !strcmp(type, inType) || OSSLECPrivateKey::isOfType(inType) || ECPrivateKey::isOfType(inType);
+}
+
+// Setters for the EC public key components
+void MizaruECPrivateKey::setEC(const ByteString& inEC)
+{
+	OSSLECPrivateKey::setEC(inEC);
+
+	orderLength = 0;
+	group = MizaruECPublicKey::findCurve(inEC, &orderLength);
+
+	if (group == 0)
+	{
+		DEBUG_MSG("The curve of the EC key is not supported by the chip");
+	}
+}
+
+mizar_uint32 MizaruECPrivateKey::getGroup() const
+{
+	return group;
+}
+
+// The private value left padded to the order length
+ByteString MizaruECPrivateKey::getPaddedD() const
+{
+	if (d.size() >= orderLength)
+	{
+		return d;
+	}
+
+	ByteString padded;
+	padded.wipe(orderLength - d.size());
+	padded += d;
+
+	return padded;
+}
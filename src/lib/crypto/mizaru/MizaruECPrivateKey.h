@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruECPrivateKey.h
+
+ Mizaru EC private key class. Keys on a curve of the chip can be handed to
+ it for signing; all other keys are used by OpenSSL.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_MIZARUECPRIVATEKEY_H
+#define _SOFTHSM_V2_MIZARUECPRIVATEKEY_H
+
+#include "config.h"
+#include "OSSLECPrivateKey.h"
+#include "mizar_basetype.h"
+
+class MizaruECPrivateKey : public OSSLECPrivateKey
+{
+public:
+	// Constructor
+	MizaruECPrivateKey();
+
+	// The type
+	static const char* type;
+
+	// Check if the key is of the given type
+	virtual bool isOfType(const char* inType);
+
+	// Setters for the EC public key components
+	virtual void setEC(const ByteString& inEC);
+
+	// The curve as a Mizar group ID, 0 if the chip does not know it
+	mizar_uint32 getGroup() const;
+
+	// The private value left padded to the order length
+	ByteString getPaddedD() const;
+
+private:
+	mizar_uint32 group;
+	unsigned long orderLength;
+};
+
+#endif // !_SOFTHSM_V2_MIZARUECPRIVATEKEY_H
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruECPublicKey.cpp
+
+ Mizaru EC public key class
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "DerUtil.h"
+#include "MizaruECPublicKey.h"
+#include <string.h>
+
+// The curves of the chip; the group IDs follow the OpenSSL NIDs
+static const struct
+{
+	const char* oid;
+	mizar_uint32 group;
+	unsigned long orderLength;
+}
+curves[] =
+{
+	{ "06082a8648ce3d030107", 415, 32 },		// P-256
+	{ "06052b81040022", 715, 48 },			// P-384
+	{ "06052b81040023", 716, 66 },			// P-521
+	{ "06052b8104000a", 714, 32 },			// secp256k1
+	{ "06092b2403030208010107", 927, 32 },		// brainpoolP256r1
+	{ "06082a811ccf5501822d", 1172, 32 }		// SM2
+};
+
+// Set the type
+/*static*/ const char* MizaruECPublicKey::type = "Mizaru EC Public Key";
+
+// Constructor
+MizaruECPublicKey::MizaruECPublicKey()
+{
+	group = 0;
+	orderLength = 0;
+}
+
+// Check if the key is of the given type
+bool MizaruECPublicKey::isOfType(const char* inType)
+{
+	return !strcmp(type, inType) || OSSLECPublicKey::isOfType(inType) || ECPublicKey::isOfType(inType);
+}
+
+// Get the base point order length
+unsigned long MizaruECPublicKey::getOrderLength() const
+{
+	return group != 0 ? orderLength : OSSLECPublicKey::getOrderLength();
+}
+
+// Look up a curve of the chip
+mizar_uint32 MizaruECPublicKey::findCurve(const ByteString& inEC, unsigned long* orderLength)
+{
+	for (size_t i = 0; i < sizeof(curves) / sizeof(curves[0]); i++)
+	{
+		if (inEC == ByteString(curves[i].oid))
+		{
+			if (orderLength != NULL) *orderLength = curves[i].orderLength;
+
+			return curves[i].group;
+		}
+	}
+
+	return 0;
+}
+
+// Setters for the EC public key components
+void MizaruECPublicKey::setEC(const ByteString& inEC)
+{
+	OSSLECPublicKey::setEC(inEC);
+
+	orderLength = 0;
+	group = findCurve(inEC, &orderLength);
+
+	if (group == 0)
+	{
+		DEBUG_MSG("The curve of the EC key is not supported by the chip");
+	}
+
+	decodeQ();
+}
+
+void MizaruECPublicKey::setQ(const ByteString& inQ)
+{
+	OSSLECPublicKey::setQ(inQ);
+
+	decodeQ();
+}
+
+// Splits the point once the curve is known
+void MizaruECPublicKey::decodeQ()
+{
+	x.wipe();
+	y.wipe();
+
+	if (orderLength == 0 || q.size() == 0) return;
+
+	ByteString point = DERUTIL::octet2Raw(q);
+
+	if (point.size() != 1 + 2 * orderLength || point[0] != 0x04)
+	{
+		DEBUG_MSG("The EC point is not an uncompressed point on the curve");
+
+		return;
+	}
+
+	x = point.substr(1, orderLength);
+	y = point.substr(1 + orderLength, orderLength);
+}
+
+mizar_uint32 MizaruECPublicKey::getGroup() const
+{
+	return group;
+}
+
+const ByteString& MizaruECPublicKey::getX() const
+{
+	return x;
+}
+
+const ByteString& MizaruECPublicKey::getY() const
+{
+	return y;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruECPublicKey.h
+
+ Mizaru EC public key class. For the chip the key is also kept as the
+ curve and the coordinates of the point; curves the chip does not know
+ are left to OpenSSL.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_MIZARUECPUBLICKEY_H
+#define _SOFTHSM_V2_MIZARUECPUBLICKEY_H
+
+#include "config.h"
+#include "OSSLECPublicKey.h"
+#include "mizar_basetype.h"
+
+class MizaruECPublicKey : public OSSLECPublicKey
+{
+public:
+	// Constructor
+	MizaruECPublicKey();
+
+	// The type
+	static const char* type;
+
+	// Check if the key is of the given type
+	virtual bool isOfType(const char* inType);
+
+	// Get the base point order length
+	virtual unsigned long getOrderLength() const;
+
+	// Setters for the EC public key components
+	virtual void setEC(const ByteString& inEC);
+	virtual void setQ(const ByteString& inQ);
+
+	// The curve as a Mizar group ID, 0 if the chip does not know it
+	mizar_uint32 getGroup() const;
+
+	// Look up the Mizar group ID and the order length of a curve given as
+	// DER encoded OID; 0 if the chip does not know it
+	static mizar_uint32 findCurve(const ByteString& inEC, unsigned long* orderLength);
+
+	// The coordinates of the point, empty unless it is an uncompressed point
+	// on a known curve
+	const ByteString& getX() const;
+	const ByteString& getY() const;
+
+private:
+	// Splits the point once the curve is known
+	void decodeQ();
+
+	mizar_uint32 group;
+	unsigned long orderLength;
+	ByteString x, y;
+};
+
+#endif // !_SOFTHSM_V2_MIZARUECPUBLICKEY_H
@@ -27,7 +27,7 @@
 /*****************************************************************************
  MizaruHMAC.cpp
 
- Mizaru HMAC implementation
+ Mizaru HMAC implementation; the chip has no MAC commands
  *****************************************************************************/
 
 #include "config.h"
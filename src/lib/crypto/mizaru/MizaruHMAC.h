@@ -27,7 +27,7 @@
 /*****************************************************************************
  MizaruHMAC.h
 
- OpenSSL HMAC implementation
+ Mizaru HMAC implementation; the chip has no MAC commands
  *****************************************************************************/
 
 #ifndef SOFTHSM_V2_MIZARU_HMAC_H
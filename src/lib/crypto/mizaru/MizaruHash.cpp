@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruHash.cpp
+
+ Hashing on the Mizar chip or in OpenSSL
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "MizaruHash.h"
+#include "MizaruDevicePool.h"
+#include "MizaruOffload.h"
+#include "mizar_api.h"
+
+// Constructor
+MizaruHash::MizaruHash(mizar_uint32 chipAlgorithm, const EVP_MD* md, MizaruOffload::Operation offloadOp, int hashSize) :
+	HashAlgorithm(),
+	chipAlgorithm(chipAlgorithm),
+	md(md),
+	offloadOp(offloadOp),
+	hashSize(hashSize)
+{
+	softCTX = NULL;
+}
+
+// Destructor
+MizaruHash::~MizaruHash()
+{
+	reset();
+}
+
+void MizaruHash::reset()
+{
+	EVP_MD_CTX_free(softCTX);
+	softCTX = NULL;
+
+	pending.wipe();
+}
+
+void MizaruHash::abort()
+{
+	reset();
+
+	ByteString dummy;
+	HashAlgorithm::hashFinal(dummy);
+}
+
+// Hashing functions
+bool MizaruHash::hashInit()
+{
+	if (!HashAlgorithm::hashInit())
+	{
+		return false;
+	}
+
+	reset();
+
+	// Nothing needs to be collected if the chip is not used
+	if (MizaruOffload::i()->getCrossover(offloadOp) == MIZARU_OFFLOAD_NEVER && !startSoftware())
+	{
+		abort();
+
+		return false;
+	}
+
+	return true;
+}
+
+bool MizaruHash::hashUpdate(const ByteString& data)
+{
+	if (!HashAlgorithm::hashUpdate(data))
+	{
+		return false;
+	}
+
+	if (data.size() == 0)
+	{
+		return true;
+	}
+
+	bool ok = true;
+
+	if (softCTX != NULL)
+	{
+		ok = EVP_DigestUpdate(softCTX, data.const_byte_str(), data.size());
+		if (!ok)
+		{
+			ERROR_MSG("EVP_DigestUpdate failed");
+		}
+	}
+	else
+	{
+		pending += data;
+
+		if (pending.size() > MIZARU_HASH_MAX_INPUT)
+		{
+			ok = startSoftware();
+		}
+	}
+
+	if (!ok)
+	{
+		abort();
+
+		return false;
+	}
+
+	return true;
+}
+
+bool MizaruHash::hashFinal(ByteString& hashedData)
+{
+	if (!HashAlgorithm::hashFinal(hashedData))
+	{
+		return false;
+	}
+
+	if (softCTX == NULL)
+	{
+		if (MizaruOffload::i()->useChip(offloadOp, pending.size()) && finalChip(hashedData))
+		{
+			reset();
+
+			return true;
+		}
+
+		if (!startSoftware())
+		{
+			reset();
+
+			return false;
+		}
+	}
+
+	unsigned int outLen = getHashSize();
+	hashedData.resize(outLen);
+
+	if (!EVP_DigestFinal_ex(softCTX, &hashedData[0], &outLen))
+	{
+		ERROR_MSG("EVP_DigestFinal failed");
+
+		reset();
+
+		return false;
+	}
+	hashedData.resize(outLen);
+
+	reset();
+
+	return true;
+}
+
+int MizaruHash::getHashSize()
+{
+	return hashSize;
+}
+
+// Hashes a message on the chip in one operation on a channel
+mizar_uint32 MizaruHash::chipDigest(mizar_uint32 chipAlgorithm, const unsigned char* in, size_t len, unsigned char* out, mizar_uint32* outLen)
+{
+	// The digest stream of the chip is not shared while the channel is held
+	return MizaruDevicePool::i()->run([&]
+	{
+		if (chipAlgorithm == MIZARU_HASH_SM3)
+		{
+			*outLen = 32;
+
+			return MizarSM3(len, (mizar_uint8*) in, out);
+		}
+
+		return MizarSHA(chipAlgorithm, len, (mizar_uint8*) in, outLen, out);
+	});
+}
+
+bool MizaruHash::finalChip(ByteString& hashedData)
+{
+	hashedData.resize(getHashSize());
+	mizar_uint32 outLen = 0;
+
+	if (0 != chipDigest(chipAlgorithm, pending.const_byte_str(), pending.size(), &hashedData[0], &outLen))
+	{
+		WARNING_MSG("The chip failed to hash, using OpenSSL");
+
+		MizaruOffload::i()->fallBack(offloadOp);
+
+		return false;
+	}
+	hashedData.resize(outLen);
+
+	return true;
+}
+
+// Continues in OpenSSL with the input collected so far
+bool MizaruHash::startSoftware()
+{
+	softCTX = EVP_MD_CTX_new();
+
+	if (softCTX == NULL ||
+	    !EVP_DigestInit_ex(softCTX, md, NULL) ||
+	    (pending.size() > 0 && !EVP_DigestUpdate(softCTX, pending.const_byte_str(), pending.size())))
+	{
+		ERROR_MSG("EVP_DigestInit failed");
+
+		return false;
+	}
+
+	pending.wipe();
+
+	return true;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruHash.h
+
+ Base of the Mizaru hash implementations. The chip has a single digest
+ stream per channel, so the state of a hash is kept here: the input is
+ collected and hashed on the chip in one operation at the end, when the
+ offload policy picks the chip for its size. Input that grows beyond
+ MIZARU_HASH_MAX_INPUT, and input the policy leaves to software, is hashed
+ by OpenSSL.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_MIZARUHASH_H
+#define _SOFTHSM_V2_MIZARUHASH_H
+
+#include "config.h"
+#include "HashAlgorithm.h"
+#include "MizaruOffload.h"
+#include "mizar_basetype.h"
+#include <openssl/evp.h>
+
+// The chip algorithm number of SM3; the others are those of MizarSHA
+#define MIZARU_HASH_SM3 16
+
+// The most input collected for a hash on the chip
+#define MIZARU_HASH_MAX_INPUT (1024 * 1024)
+
+class MizaruHash : public HashAlgorithm
+{
+public:
+	// Constructor, with the algorithm of the context on the chip, the
+	// OpenSSL digest and the operation of the offload policy
+	MizaruHash(mizar_uint32 chipAlgorithm, const EVP_MD* md, MizaruOffload::Operation offloadOp, int hashSize);
+
+	// Destructor
+	virtual ~MizaruHash();
+
+	// Hashing functions
+	virtual bool hashInit();
+	virtual bool hashUpdate(const ByteString& data);
+	virtual bool hashFinal(ByteString& hashedData);
+	
+	virtual int getHashSize();
+
+	// Hashes a message on the chip in one operation on a channel
+	static mizar_uint32 chipDigest(mizar_uint32 chipAlgorithm, const unsigned char* in, size_t len, unsigned char* out, mizar_uint32* outLen);
+
+private:
+	// Releases the OpenSSL context and the collected input
+	void reset();
+
+	// Continues in OpenSSL with the input collected so far
+	bool startSoftware();
+
+	// Hashes the collected input on the chip
+	bool finalChip(ByteString& hashedData);
+
+	// Aborts the operation
+	void abort();
+
+	// The algorithm
+	const mizar_uint32 chipAlgorithm;
+	const EVP_MD* const md;
+	const MizaruOffload::Operation offloadOp;
+	const int hashSize;
+
+	// Current hashing context in OpenSSL, NULL while input is collected
+	EVP_MD_CTX* softCTX;
+
+	// The input so far, while it may still be hashed on the chip
+	ByteString pending;
+};
+
+#endif // !_SOFTHSM_V2_MIZARUHASH_H
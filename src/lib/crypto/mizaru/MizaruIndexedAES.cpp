@@ -0,0 +1,353 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruIndexedAES.cpp
+
+ AES encryption and decryption with keys held in Mizar key slots
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "MizaruIndexedAES.h"
+#include "MizaruDevicePool.h"
+#include "mizar_api.h"
+#include <string.h>
+
+// The operation modes of the chip
+#define MIZAR_MODE_ENCRYPT 0
+#define MIZAR_MODE_DECRYPT 1
+
+#define AES_BLOCK_SIZE 16
+
+// Constructor
+MizaruIndexedAES::MizaruIndexedAES()
+{
+	currentIndex = 0;
+}
+
+bool MizaruIndexedAES::isSupportedMode(SymMode::Type mode)
+{
+	return mode == SymMode::ECB || mode == SymMode::CBC;
+}
+
+// Check the key and mode of a new operation
+bool MizaruIndexedAES::checkInit(const SymmetricKey* key, const SymMode::Type mode, const ByteString& IV)
+{
+	const MizaruIndexedSymmetricKey* indexedKey = dynamic_cast<const MizaruIndexedSymmetricKey*>(key);
+
+	if (indexedKey == NULL || indexedKey->getAlgorithm() != SymAlgo::AES)
+	{
+		ERROR_MSG("Invalid key supplied");
+
+		return false;
+	}
+
+	if (!isSupportedMode(mode))
+	{
+		ERROR_MSG("Invalid cipher mode %i for a Mizar key slot", mode);
+
+		return false;
+	}
+
+	if (mode == SymMode::CBC && IV.size() != AES_BLOCK_SIZE)
+	{
+		ERROR_MSG("Invalid IV size (%d bytes, expected %d bytes)", IV.size(), AES_BLOCK_SIZE);
+
+		return false;
+	}
+
+	currentIndex = indexedKey->getIndex();
+	currentIV = IV;
+	pending.wipe();
+
+	return true;
+}
+
+// Runs whole blocks through the chip and chains the IV
+bool MizaruIndexedAES::crypt(bool encrypt, const ByteString& in, ByteString& out)
+{
+	if (in.size() == 0)
+	{
+		out.wipe();
+
+		return true;
+	}
+
+	ByteString input = in;
+	out.resize(in.size());
+	mizar_uint32 outLen = out.size();
+	mizar_uint32 mode = encrypt ? MIZAR_MODE_ENCRYPT : MIZAR_MODE_DECRYPT;
+	mizar_uint32 rv;
+
+	if (currentCipherMode == SymMode::ECB)
+	{
+		rv = MizaruDevicePool::i()->run([&] { return MizarAesEcbIndex(mode, currentIndex, input.size(), &input[0], &outLen, &out[0]); });
+	}
+	else
+	{
+		rv = MizaruDevicePool::i()->run([&] { return MizarAesCbcIndex(mode, &currentIV[0], currentIndex, input.size(), &input[0], &outLen, &out[0]); });
+	}
+
+	if (rv != 0 || outLen != in.size())
+	{
+		ERROR_MSG("AES operation on Mizar key slot %lu failed (0x%08X)", currentIndex, rv);
+
+		return false;
+	}
+
+	// The next IV is the last ciphertext block
+	if (currentCipherMode == SymMode::CBC)
+	{
+		const ByteString& cipherText = encrypt ? out : in;
+
+		currentIV = cipherText.substr(cipherText.size() - AES_BLOCK_SIZE);
+	}
+
+	return true;
+}
+
+// Clears the state of the current operation
+void MizaruIndexedAES::clear()
+{
+	currentIndex = 0;
+	currentIV.wipe();
+	pending.wipe();
+}
+
+// Encryption functions
+bool MizaruIndexedAES::encryptInit(const SymmetricKey* key, const SymMode::Type mode /* = SymMode::CBC */, const ByteString& IV /* = ByteString() */, bool padding /* = true */, size_t counterBits /* = 0 */, const ByteString& aad /* = ByteString() */, size_t tagBytes /* = 0 */)
+{
+	if (!checkInit(key, mode, IV))
+	{
+		return false;
+	}
+
+	return SymmetricAlgorithm::encryptInit(key, mode, IV, padding, counterBits, aad, tagBytes);
+}
+
+bool MizaruIndexedAES::encryptUpdate(const ByteString& data, ByteString& encryptedData)
+{
+	if (!SymmetricAlgorithm::encryptUpdate(data, encryptedData))
+	{
+		clear();
+
+		return false;
+	}
+
+	pending += data;
+
+	size_t whole = pending.size() - pending.size() % AES_BLOCK_SIZE;
+
+	if (!crypt(true, pending.substr(0, whole), encryptedData))
+	{
+		ByteString dummy;
+		SymmetricAlgorithm::encryptFinal(dummy);
+		clear();
+
+		return false;
+	}
+
+	pending.split(whole);
+	currentBufferSize = pending.size();
+
+	return true;
+}
+
+bool MizaruIndexedAES::encryptFinal(ByteString& encryptedData)
+{
+	ByteString last = pending;
+	bool padding = currentPaddingMode;
+	SymMode::Type mode = currentCipherMode;
+
+	encryptedData.wipe();
+
+	if (!SymmetricAlgorithm::encryptFinal(encryptedData))
+	{
+		clear();
+
+		return false;
+	}
+
+	if (padding)
+	{
+		// PKCS #7 padding, a whole block if the data is block aligned
+		size_t padLen = AES_BLOCK_SIZE - last.size();
+
+		last.resize(AES_BLOCK_SIZE);
+		memset(&last[AES_BLOCK_SIZE - padLen], (int) padLen, padLen);
+	}
+	else if (last.size() != 0)
+	{
+		ERROR_MSG("Data is not a multiple of the block size");
+		clear();
+
+		return false;
+	}
+
+	// The base class has ended the operation, keep the mode for the last block
+	currentCipherMode = mode;
+	bool rv = crypt(true, last, encryptedData);
+	currentCipherMode = SymMode::Unknown;
+	clear();
+
+	return rv;
+}
+
+// Decryption functions
+bool MizaruIndexedAES::decryptInit(const SymmetricKey* key, const SymMode::Type mode /* = SymMode::CBC */, const ByteString& IV /* = ByteString() */, bool padding /* = true */, size_t counterBits /* = 0 */, const ByteString& aad /* = ByteString() */, size_t tagBytes /* = 0 */)
+{
+	if (!checkInit(key, mode, IV))
+	{
+		return false;
+	}
+
+	return SymmetricAlgorithm::decryptInit(key, mode, IV, padding, counterBits, aad, tagBytes);
+}
+
+bool MizaruIndexedAES::decryptUpdate(const ByteString& encryptedData, ByteString& data)
+{
+	if (!SymmetricAlgorithm::decryptUpdate(encryptedData, data))
+	{
+		clear();
+
+		return false;
+	}
+
+	// Only the padding check needs the data of earlier parts
+	currentAEADBuffer.wipe();
+	pending += encryptedData;
+
+	size_t whole = pending.size() - pending.size() % AES_BLOCK_SIZE;
+
+	// Hold back the last block, it may contain the padding
+	if (currentPaddingMode && whole == pending.size() && whole > 0)
+	{
+		whole -= AES_BLOCK_SIZE;
+	}
+
+	if (!crypt(false, pending.substr(0, whole), data))
+	{
+		ByteString dummy;
+		SymmetricAlgorithm::decryptFinal(dummy);
+		clear();
+
+		return false;
+	}
+
+	pending.split(whole);
+	currentBufferSize = pending.size();
+
+	return true;
+}
+
+bool MizaruIndexedAES::decryptFinal(ByteString& data)
+{
+	ByteString last = pending;
+	bool padding = currentPaddingMode;
+	SymMode::Type mode = currentCipherMode;
+
+	data.wipe();
+
+	if (!SymmetricAlgorithm::decryptFinal(data))
+	{
+		clear();
+
+		return false;
+	}
+
+	if (last.size() % AES_BLOCK_SIZE != 0 || (padding && last.size() != AES_BLOCK_SIZE))
+	{
+		ERROR_MSG("Encrypted data is not a multiple of the block size");
+		clear();
+
+		return false;
+	}
+
+	// The base class has ended the operation, keep the mode for the last block
+	currentCipherMode = mode;
+	bool rv = crypt(false, last, data);
+	currentCipherMode = SymMode::Unknown;
+	clear();
+
+	if (!rv || !padding)
+	{
+		return rv;
+	}
+
+	// Remove and check the PKCS #7 padding
+	size_t padLen = data[AES_BLOCK_SIZE - 1];
+
+	if (padLen == 0 || padLen > AES_BLOCK_SIZE)
+	{
+		ERROR_MSG("Invalid padding");
+		data.wipe();
+
+		return false;
+	}
+
+	for (size_t i = AES_BLOCK_SIZE - padLen; i < AES_BLOCK_SIZE; i++)
+	{
+		if (data[i] != padLen)
+		{
+			ERROR_MSG("Invalid padding");
+			data.wipe();
+
+			return false;
+		}
+	}
+
+	data.resize(AES_BLOCK_SIZE - padLen);
+
+	return true;
+}
+
+// Keys in Mizar key slots are not used for wrapping
+bool MizaruIndexedAES::wrapKey(const SymmetricKey* /*key*/, const SymWrap::Type /*mode*/, const ByteString& /*in*/, ByteString& /*out*/)
+{
+	ERROR_MSG("Key wrapping is not supported with a Mizar key slot");
+
+	return false;
+}
+
+bool MizaruIndexedAES::unwrapKey(const SymmetricKey* /*key*/, const SymWrap::Type /*mode*/, const ByteString& /*in*/, ByteString& /*out*/)
+{
+	ERROR_MSG("Key unwrapping is not supported with a Mizar key slot");
+
+	return false;
+}
+
+// Return cipher information
+size_t MizaruIndexedAES::getBlockSize() const
+{
+	return AES_BLOCK_SIZE;
+}
+
+// The chip has no limit on the amount of data for ECB and CBC
+bool MizaruIndexedAES::checkMaximumBytes(unsigned long /*bytes*/)
+{
+	return true;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruIndexedAES.h
+
+ AES encryption and decryption with keys held in Mizar key slots. Only the
+ ECB and CBC modes of the chip are available; padding is done on the host.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_MIZARUINDEXEDAES_H
+#define _SOFTHSM_V2_MIZARUINDEXEDAES_H
+
+#include "config.h"
+#include "SymmetricAlgorithm.h"
+#include "MizaruIndexedSymmetricKey.h"
+
+class MizaruIndexedAES : public SymmetricAlgorithm
+{
+public:
+	// Constructor
+	MizaruIndexedAES();
+
+	// Destructor
+	virtual ~MizaruIndexedAES() { }
+
+	// Encryption functions
+	virtual bool encryptInit(const SymmetricKey* key, const SymMode::Type mode = SymMode::CBC, const ByteString& IV = ByteString(), bool padding = true, size_t counterBits = 0, const ByteString& aad = ByteString(), size_t tagBytes = 0);
+	virtual bool encryptUpdate(const ByteString& data, ByteString& encryptedData);
+	virtual bool encryptFinal(ByteString& encryptedData);
+
+	// Decryption functions
+	virtual bool decryptInit(const SymmetricKey* key, const SymMode::Type mode = SymMode::CBC, const ByteString& IV = ByteString(), bool padding = true, size_t counterBits = 0, const ByteString& aad = ByteString(), size_t tagBytes = 0);
+	virtual bool decryptUpdate(const ByteString& encryptedData, ByteString& data);
+	virtual bool decryptFinal(ByteString& data);
+
+	// Keys in Mizar key slots are not used for wrapping
+	virtual bool wrapKey(const SymmetricKey* key, const SymWrap::Type mode, const ByteString& in, ByteString& out);
+	virtual bool unwrapKey(const SymmetricKey* key, const SymWrap::Type mode, const ByteString& in, ByteString& out);
+
+	// Return cipher information
+	virtual size_t getBlockSize() const;
+	virtual bool checkMaximumBytes(unsigned long bytes);
+
+	// Check if a mode can be used with a key in a Mizar key slot
+	static bool isSupportedMode(SymMode::Type mode);
+
+private:
+	// Check the key and mode of a new operation
+	bool checkInit(const SymmetricKey* key, const SymMode::Type mode, const ByteString& IV);
+
+	// Runs whole blocks through the chip and chains the IV
+	bool crypt(bool encrypt, const ByteString& in, ByteString& out);
+
+	// Clears the state of the current operation
+	void clear();
+
+	// The index of the current key
+	unsigned long currentIndex;
+
+	// The chained IV in CBC mode
+	ByteString currentIV;
+
+	// Data that does not yet fill a block
+	ByteString pending;
+};
+
+#endif // !_SOFTHSM_V2_MIZARUINDEXEDAES_H
@@ -0,0 +1,465 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruIndexedAsymmetricAlgorithm.cpp
+
+ Signing and decryption with private keys held in Mizar key slots
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "MizaruIndexedAsymmetricAlgorithm.h"
+#include "CryptoFactory.h"
+#include "MizaruDevicePool.h"
+#include "mizar_api.h"
+#include <string.h>
+
+// The DER encoded DigestInfo prefix of a SHA-256 digest
+static const unsigned char sha256DigestInfo[] =
+{
+	0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01,
+	0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20
+};
+
+// The minimum PKCS #1 v1.5 padding overhead
+#define PKCS1_PADDING_OVERHEAD 11
+
+// All bits set if a is zero, none otherwise; without branches
+static size_t ctIsZero(size_t a)
+{
+	return 0 - ((~a & (a - 1)) >> (sizeof(size_t) * 8 - 1));
+}
+
+// All bits set if a >= b, none otherwise; without branches
+static size_t ctGreaterEqual(size_t a, size_t b)
+{
+	return ~(0 - ((a ^ ((a ^ b) | ((a - b) ^ b))) >> (sizeof(size_t) * 8 - 1)));
+}
+
+// Removes PKCS #1 v1.5 encryption padding,
+// EM = 0x00 || 0x02 || PS (non-zero, at least 8 bytes) || 0x00 || data.
+// The whole block is examined in the same way whatever its contents, so
+// that a malformed block cannot be told from another by the time taken
+static bool unpadPKCS1(const ByteString& em, ByteString& data)
+{
+	size_t k = em.size();
+
+	if (k < PKCS1_PADDING_OVERHEAD)
+	{
+		return false;
+	}
+
+	const unsigned char* block = em.const_byte_str();
+	size_t good = ctIsZero(block[0]) & ctIsZero(block[1] ^ 0x02);
+	size_t lookingForSeparator = ~(size_t) 0;
+	size_t separator = 0;
+
+	for (size_t i = 2; i < k; i++)
+	{
+		size_t isZero = ctIsZero(block[i]);
+
+		separator |= lookingForSeparator & isZero & i;
+		lookingForSeparator &= ~isZero;
+	}
+
+	good &= ~lookingForSeparator;
+	good &= ctGreaterEqual(separator, PKCS1_PADDING_OVERHEAD - 1);
+
+	if (!good)
+	{
+		return false;
+	}
+
+	data = em.substr(separator + 1);
+
+	return true;
+}
+
+// Constructor
+MizaruIndexedAsymmetricAlgorithm::MizaruIndexedAsymmetricAlgorithm()
+{
+	currentHash = NULL;
+}
+
+// Destructor
+MizaruIndexedAsymmetricAlgorithm::~MizaruIndexedAsymmetricAlgorithm()
+{
+	if (currentHash != NULL)
+	{
+		CryptoFactory::i()->recycleHashAlgorithm(currentHash);
+	}
+}
+
+bool MizaruIndexedAsymmetricAlgorithm::isSignMechanism(AsymAlgo::Type algorithm, AsymMech::Type mechanism)
+{
+	switch (mechanism)
+	{
+		case AsymMech::RSA:
+		case AsymMech::RSA_PKCS:
+		case AsymMech::RSA_SHA256_PKCS:
+			return algorithm == AsymAlgo::RSA;
+		case AsymMech::ECDSA:
+			return algorithm == AsymAlgo::ECDSA;
+		default:
+			return false;
+	}
+}
+
+bool MizaruIndexedAsymmetricAlgorithm::isDecryptMechanism(AsymAlgo::Type algorithm, AsymMech::Type padding)
+{
+	switch (padding)
+	{
+		case AsymMech::RSA:
+		case AsymMech::RSA_PKCS:
+			return algorithm == AsymAlgo::RSA;
+		default:
+			return false;
+	}
+}
+
+// Signing functions
+bool MizaruIndexedAsymmetricAlgorithm::signInit(PrivateKey* privateKey, const AsymMech::Type mechanism,
+						const void* param /* = NULL */, const size_t paramLen /* = 0 */)
+{
+	if (privateKey == NULL || !privateKey->isOfType(MizaruIndexedPrivateKey::type))
+	{
+		ERROR_MSG("Invalid key type supplied");
+
+		return false;
+	}
+
+	MizaruIndexedPrivateKey* key = (MizaruIndexedPrivateKey*) privateKey;
+
+	if (!isSignMechanism(key->getAlgorithm(), mechanism))
+	{
+		ERROR_MSG("Invalid mechanism supplied (%i)", mechanism);
+
+		return false;
+	}
+
+	if (!AsymmetricAlgorithm::signInit(privateKey, mechanism, param, paramLen))
+	{
+		return false;
+	}
+
+	currentData.wipe();
+
+	if (mechanism == AsymMech::RSA_SHA256_PKCS)
+	{
+		currentHash = CryptoFactory::i()->getHashAlgorithm(HashAlgo::SHA256);
+
+		if (currentHash == NULL || !currentHash->hashInit())
+		{
+			ByteString dummy;
+			AsymmetricAlgorithm::signFinal(dummy);
+
+			if (currentHash != NULL)
+			{
+				CryptoFactory::i()->recycleHashAlgorithm(currentHash);
+				currentHash = NULL;
+			}
+
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool MizaruIndexedAsymmetricAlgorithm::signUpdate(const ByteString& dataToSign)
+{
+	if (!AsymmetricAlgorithm::signUpdate(dataToSign))
+	{
+		return false;
+	}
+
+	if (currentHash != NULL)
+	{
+		if (!currentHash->hashUpdate(dataToSign))
+		{
+			ByteString dummy;
+			signFinal(dummy);
+
+			return false;
+		}
+
+		return true;
+	}
+
+	currentData += dataToSign;
+
+	return true;
+}
+
+bool MizaruIndexedAsymmetricAlgorithm::signFinal(ByteString& signature)
+{
+	MizaruIndexedPrivateKey* key = (MizaruIndexedPrivateKey*) currentPrivateKey;
+	AsymMech::Type mechanism = currentMechanism;
+	HashAlgorithm* hash = currentHash;
+	ByteString data = currentData;
+
+	currentHash = NULL;
+	currentData.wipe();
+
+	if (!AsymmetricAlgorithm::signFinal(signature))
+	{
+		if (hash != NULL) CryptoFactory::i()->recycleHashAlgorithm(hash);
+
+		return false;
+	}
+
+	if (hash != NULL)
+	{
+		ByteString digest;
+		bool ok = hash->hashFinal(digest);
+
+		CryptoFactory::i()->recycleHashAlgorithm(hash);
+
+		if (!ok) return false;
+
+		data = ByteString(sha256DigestInfo, sizeof(sha256DigestInfo)) + digest;
+	}
+
+	size_t k = key->getOutputLength();
+
+	switch (mechanism)
+	{
+		case AsymMech::RSA:
+			if (data.size() != k)
+			{
+				ERROR_MSG("The data must be as long as the modulus");
+
+				return false;
+			}
+
+			return rsaPrivate(key, data, signature, true);
+
+		case AsymMech::RSA_PKCS:
+		case AsymMech::RSA_SHA256_PKCS:
+		{
+			if (data.size() + PKCS1_PADDING_OVERHEAD > k)
+			{
+				ERROR_MSG("Too much data supplied for RSA PKCS #1 signature");
+
+				return false;
+			}
+
+			// EM = 0x00 || 0x01 || PS (0xFF) || 0x00 || data
+			ByteString em;
+			em.resize(k);
+			memset(&em[0], 0xFF, k);
+			em[0] = 0x00;
+			em[1] = 0x01;
+			em[k - data.size() - 1] = 0x00;
+			memcpy(&em[k - data.size()], data.const_byte_str(), data.size());
+
+			return rsaPrivate(key, em, signature, true);
+		}
+
+		case AsymMech::ECDSA:
+		{
+			size_t len = k / 2;
+			ByteString r, s;
+			r.resize(len);
+			s.resize(len);
+			mizar_uint32 rLen = len;
+			mizar_uint32 sLen = len;
+
+			if (data.size() == 0)
+			{
+				ERROR_MSG("No data supplied for ECDSA signature");
+
+				return false;
+			}
+
+			mizar_uint32 rv = MizaruDevicePool::i()->run([&] { return MizarEccSignIndex(key->getIndex(), 0, data.size(), &data[0], &rLen, &r[0], &sLen, &s[0]); });
+			if (rv != 0 || rLen > len || sLen > len)
+			{
+				ERROR_MSG("MizarEccSignIndex failed (0x%08X)", rv);
+
+				return false;
+			}
+
+			// Left pad r and s to the coordinate length
+			signature.wipe(k);
+			memcpy(&signature[len - rLen], r.const_byte_str(), rLen);
+			memcpy(&signature[k - sLen], s.const_byte_str(), sLen);
+
+			return true;
+		}
+
+		default:
+			return false;
+	}
+}
+
+bool MizaruIndexedAsymmetricAlgorithm::verifyInit(PublicKey* /*publicKey*/, const AsymMech::Type /*mechanism*/,
+						  const void* /*param = NULL */, const size_t /*paramLen = 0 */)
+{
+	ERROR_MSG("Verification is not done with a Mizar key slot");
+
+	return false;
+}
+
+bool MizaruIndexedAsymmetricAlgorithm::encrypt(PublicKey* /*publicKey*/, const ByteString& /*data*/,
+					       ByteString& /*encryptedData*/, const AsymMech::Type /*padding*/)
+{
+	ERROR_MSG("Encryption is not done with a Mizar key slot");
+
+	return false;
+}
+
+// Decryption functions
+bool MizaruIndexedAsymmetricAlgorithm::decrypt(PrivateKey* privateKey, const ByteString& encryptedData,
+					       ByteString& data, const AsymMech::Type padding)
+{
+	if (privateKey == NULL || !privateKey->isOfType(MizaruIndexedPrivateKey::type))
+	{
+		ERROR_MSG("Invalid key type supplied");
+
+		return false;
+	}
+
+	MizaruIndexedPrivateKey* key = (MizaruIndexedPrivateKey*) privateKey;
+
+	if (!isDecryptMechanism(key->getAlgorithm(), padding))
+	{
+		ERROR_MSG("Invalid padding mechanism supplied (%i)", padding);
+
+		return false;
+	}
+
+	size_t k = key->getOutputLength();
+
+	if (encryptedData.size() != k)
+	{
+		ERROR_MSG("Invalid amount of input data supplied for RSA decryption");
+
+		return false;
+	}
+
+	ByteString em;
+
+	if (!rsaPrivate(key, encryptedData, em, false))
+	{
+		return false;
+	}
+
+	if (padding == AsymMech::RSA)
+	{
+		data = em;
+
+		return true;
+	}
+
+	// Every padding error is reported the same way
+	if (!unpadPKCS1(em, data))
+	{
+		ERROR_MSG("Invalid PKCS #1 encryption padding");
+
+		return false;
+	}
+
+	return true;
+}
+
+// Runs the raw RSA private key operation on the chip
+bool MizaruIndexedAsymmetricAlgorithm::rsaPrivate(MizaruIndexedPrivateKey* key, const ByteString& in, ByteString& out, bool isSign)
+{
+	ByteString input = in;
+	out.resize(key->getOutputLength());
+	mizar_uint32 outLen = out.size();
+	mizar_uint32 rv;
+
+	if (isSign)
+	{
+		rv = MizaruDevicePool::i()->run([&] { return MizarRsaSkEncIndex(key->getIndex(), input.size(), &input[0], &outLen, &out[0]); });
+	}
+	else
+	{
+		rv = MizaruDevicePool::i()->run([&] { return MizarRsaSkDecIndex(key->getIndex(), input.size(), &input[0], &outLen, &out[0]); });
+	}
+
+	if (rv != 0 || outLen > out.size())
+	{
+		ERROR_MSG("RSA private key operation on Mizar key slot %lu failed (0x%08X)", key->getIndex(), rv);
+
+		return false;
+	}
+
+	// Keep the result as long as the modulus
+	if (outLen < out.size())
+	{
+		size_t pad = out.size() - outLen;
+
+		memmove(&out[pad], &out[0], outLen);
+		memset(&out[0], 0x00, pad);
+	}
+
+	return true;
+}
+
+// Keys are created on the chip, not through this class
+bool MizaruIndexedAsymmetricAlgorithm::generateKeyPair(AsymmetricKeyPair** /*ppKeyPair*/, AsymmetricParameters* /*parameters*/, RNG* /*rng = NULL */)
+{
+	return false;
+}
+
+unsigned long MizaruIndexedAsymmetricAlgorithm::getMinKeySize()
+{
+	return 512;
+}
+
+unsigned long MizaruIndexedAsymmetricAlgorithm::getMaxKeySize()
+{
+	return 2048;
+}
+
+bool MizaruIndexedAsymmetricAlgorithm::reconstructKeyPair(AsymmetricKeyPair** /*ppKeyPair*/, ByteString& /*serialisedData*/)
+{
+	return false;
+}
+
+bool MizaruIndexedAsymmetricAlgorithm::reconstructPublicKey(PublicKey** /*ppPublicKey*/, ByteString& /*serialisedData*/)
+{
+	return false;
+}
+
+bool MizaruIndexedAsymmetricAlgorithm::reconstructPrivateKey(PrivateKey** /*ppPrivateKey*/, ByteString& /*serialisedData*/)
+{
+	return false;
+}
+
+PublicKey* MizaruIndexedAsymmetricAlgorithm::newPublicKey()
+{
+	return NULL;
+}
+
+PrivateKey* MizaruIndexedAsymmetricAlgorithm::newPrivateKey()
+{
+	return NULL;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruIndexedAsymmetricAlgorithm.h
+
+ Signing and decryption with private keys held in Mizar key slots. The
+ padding is applied on the host and the private key operation is done by
+ the chip, so the key is never reconstructed in host memory.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_MIZARUINDEXEDASYMMETRICALGORITHM_H
+#define _SOFTHSM_V2_MIZARUINDEXEDASYMMETRICALGORITHM_H
+
+#include "config.h"
+#include "AsymmetricAlgorithm.h"
+#include "HashAlgorithm.h"
+#include "MizaruIndexedPrivateKey.h"
+
+class MizaruIndexedAsymmetricAlgorithm : public AsymmetricAlgorithm
+{
+public:
+	// Constructor
+	MizaruIndexedAsymmetricAlgorithm();
+
+	// Destructor
+	virtual ~MizaruIndexedAsymmetricAlgorithm();
+
+	// Signing functions
+	virtual bool signInit(PrivateKey* privateKey, const AsymMech::Type mechanism, const void* param = NULL, const size_t paramLen = 0);
+	virtual bool signUpdate(const ByteString& dataToSign);
+	virtual bool signFinal(ByteString& signature);
+
+	// Verification is done with the public key object
+	virtual bool verifyInit(PublicKey* publicKey, const AsymMech::Type mechanism, const void* param = NULL, const size_t paramLen = 0);
+
+	// Encryption is done with the public key object
+	virtual bool encrypt(PublicKey* publicKey, const ByteString& data, ByteString& encryptedData, const AsymMech::Type padding);
+
+	// Decryption functions
+	virtual bool decrypt(PrivateKey* privateKey, const ByteString& encryptedData, ByteString& data, const AsymMech::Type padding);
+
+	// Keys are created on the chip, not through this class
+	virtual bool generateKeyPair(AsymmetricKeyPair** ppKeyPair, AsymmetricParameters* parameters, RNG* rng = NULL);
+	virtual unsigned long getMinKeySize();
+	virtual unsigned long getMaxKeySize();
+	virtual bool reconstructKeyPair(AsymmetricKeyPair** ppKeyPair, ByteString& serialisedData);
+	virtual bool reconstructPublicKey(PublicKey** ppPublicKey, ByteString& serialisedData);
+	virtual bool reconstructPrivateKey(PrivateKey** ppPrivateKey, ByteString& serialisedData);
+	virtual PublicKey* newPublicKey();
+	virtual PrivateKey* newPrivateKey();
+
+	// Check if a mechanism can be used with a key in a Mizar key slot
+	static bool isSignMechanism(AsymAlgo::Type algorithm, AsymMech::Type mechanism);
+	static bool isDecryptMechanism(AsymAlgo::Type algorithm, AsymMech::Type padding);
+
+private:
+	// Runs the raw RSA private key operation on the chip
+	bool rsaPrivate(MizaruIndexedPrivateKey* key, const ByteString& in, ByteString& out, bool isSign);
+
+	// The data of a single part mechanism or the digest of a hashing one
+	ByteString currentData;
+	HashAlgorithm* currentHash;
+};
+
+#endif // !_SOFTHSM_V2_MIZARUINDEXEDASYMMETRICALGORITHM_H
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruIndexedPrivateKey.cpp
+
+ A private key that lives in a Mizar key slot
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "MizaruIndexedPrivateKey.h"
+#include "MizaruDevicePool.h"
+#include "DerUtil.h"
+#include "OSSLUtil.h"
+#include "mizar_api.h"
+#include "mizar_errcode.h"
+#include <string.h>
+#include <openssl/ec.h>
+
+// The largest RSA modulus and EC coordinate handled by the chip
+#define MIZAR_MAX_COMPONENT 512
+
+// Set the type
+/*static*/ const char* MizaruIndexedPrivateKey::type = "Mizaru indexed private key";
+
+// Constructor
+MizaruIndexedPrivateKey::MizaruIndexedPrivateKey(AsymAlgo::Type inAlgorithm, unsigned long inIndex)
+{
+	algorithm = inAlgorithm;
+	index = inIndex;
+	componentLength = 0;
+	bitLength = 0;
+}
+
+// Query the key slot for the size of the key
+bool MizaruIndexedPrivateKey::load()
+{
+	mizar_uint8 x[MIZAR_MAX_COMPONENT];
+	mizar_uint8 y[MIZAR_MAX_COMPONENT];
+	mizar_uint32 xLen = sizeof(x);
+	mizar_uint32 yLen = sizeof(y);
+	mizar_uint32 rv;
+
+	switch (algorithm)
+	{
+		case AsymAlgo::RSA:
+			rv = MizarQueryRsaKey(index, &xLen, x, &yLen, y);
+			break;
+		case AsymAlgo::ECDSA:
+		{
+			mizar_uint32 group = 0;
+			rv = MizarQueryEccKey(index, &group, &xLen, x, &yLen, y);
+			break;
+		}
+		default:
+			ERROR_MSG("Unsupported algorithm %i for Mizar key slot %lu", algorithm, index);
+			return false;
+	}
+
+	if (rv != 0 || xLen == 0 || xLen > MIZAR_MAX_COMPONENT)
+	{
+		ERROR_MSG("Could not query Mizar key slot %lu (0x%08X)", index, rv);
+		return false;
+	}
+
+	componentLength = xLen;
+
+	if (algorithm == AsymAlgo::RSA)
+	{
+		// The modulus may have leading zero bits
+		bitLength = ByteString(x, xLen).bits();
+	}
+	else
+	{
+		bitLength = xLen * 8;
+	}
+
+	return true;
+}
+
+// Generate an RSA key pair in the empty key slot
+bool MizaruIndexedPrivateKey::generateRSA(unsigned long bits, const ByteString& e, ByteString& n)
+{
+	mizar_uint8 x[MIZAR_MAX_COMPONENT];
+	mizar_uint8 y[MIZAR_MAX_COMPONENT];
+	mizar_uint32 xLen = sizeof(x);
+	mizar_uint32 yLen = sizeof(y);
+	ByteString exponent(e);
+
+	if (algorithm != AsymAlgo::RSA || exponent.size() == 0) return false;
+
+	// The channel is held from the query to the generation, so that no
+	// other process can fill the slot in between
+	bool occupied = false;
+	mizar_uint32 rv = MizaruDevicePool::i()->run([&]
+	{
+		occupied = MizarQueryRsaKey(index, &xLen, x, &yLen, y) == SUCCESS;
+		if (occupied) return (mizar_uint32) SUCCESS;
+
+		xLen = sizeof(x);
+		return MizarGenRsaKeyIndex(index, bits, exponent.size(), &exponent[0], &xLen, x);
+	});
+
+	if (occupied)
+	{
+		ERROR_MSG("Mizar key slot %lu already holds an RSA key", index);
+		return false;
+	}
+
+	if (rv != SUCCESS || xLen == 0 || xLen > MIZAR_MAX_COMPONENT)
+	{
+		ERROR_MSG("Could not generate an RSA key in Mizar key slot %lu (0x%08X)", index, rv);
+		return false;
+	}
+
+	n = ByteString(x, xLen);
+
+	return load();
+}
+
+// Generate an EC key pair in the empty key slot
+bool MizaruIndexedPrivateKey::generateEC(const ByteString& ecParams, ByteString& point)
+{
+	mizar_uint8 x[MIZAR_MAX_COMPONENT];
+	mizar_uint8 y[MIZAR_MAX_COMPONENT];
+	mizar_uint32 xLen = sizeof(x);
+	mizar_uint32 yLen = sizeof(y);
+
+	if (algorithm != AsymAlgo::ECDSA) return false;
+
+	EC_GROUP* grp = OSSL::byteString2grp(ecParams);
+	if (grp == NULL)
+	{
+		ERROR_MSG("Unknown curve for Mizar key slot %lu", index);
+		return false;
+	}
+
+	mizar_uint32 group = EC_GROUP_get_curve_name(grp);
+	size_t coordinateLength = (EC_GROUP_get_degree(grp) + 7) / 8;
+	EC_GROUP_free(grp);
+
+	// The channel is held from the query to the generation, so that no
+	// other process can fill the slot in between
+	bool occupied = false;
+	mizar_uint32 rv = MizaruDevicePool::i()->run([&]
+	{
+		mizar_uint32 current = 0;
+		occupied = MizarQueryEccKey(index, &current, &xLen, x, &yLen, y) == SUCCESS;
+		if (occupied) return (mizar_uint32) SUCCESS;
+
+		xLen = sizeof(x);
+		yLen = sizeof(y);
+		return MizarGenEccKeyIndex(index, group, &xLen, x, &yLen, y);
+	});
+
+	if (occupied)
+	{
+		ERROR_MSG("Mizar key slot %lu already holds an EC key", index);
+		return false;
+	}
+
+	if (rv != SUCCESS || xLen > coordinateLength || yLen > coordinateLength)
+	{
+		ERROR_MSG("Could not generate an EC key in Mizar key slot %lu (0x%08X)", index, rv);
+		return false;
+	}
+
+	// An uncompressed point with coordinates of the field size
+	ByteString raw;
+	raw.resize(1 + 2 * coordinateLength);
+	raw[0] = 0x04;
+	memcpy(&raw[1 + coordinateLength - xLen], x, xLen);
+	memcpy(&raw[1 + 2 * coordinateLength - yLen], y, yLen);
+	point = DERUTIL::raw2Octet(raw);
+
+	return load();
+}
+
+// Delete the key pair in the key slot
+bool MizaruIndexedPrivateKey::remove()
+{
+	mizar_uint32 rv;
+
+	switch (algorithm)
+	{
+		case AsymAlgo::RSA:
+			rv = MizaruDevicePool::i()->run([&] { return MizarDeleteRsaKey(index); });
+			break;
+		case AsymAlgo::ECDSA:
+			rv = MizaruDevicePool::i()->run([&] { return MizarDeleteEccKey(index); });
+			break;
+		default:
+			return false;
+	}
+
+	if (rv != SUCCESS)
+	{
+		ERROR_MSG("Could not delete the key in Mizar key slot %lu (0x%08X)", index, rv);
+		return false;
+	}
+
+	return true;
+}
+
+// Check if the key is of the given type
+bool MizaruIndexedPrivateKey::isOfType(const char* inType)
+{
+	// Deliberately not an RSAPrivateKey or ECPrivateKey, as the components
+	// of the key are not available
+	return !strcmp(type, inType);
+}
+
+AsymAlgo::Type MizaruIndexedPrivateKey::getAlgorithm() const
+{
+	return algorithm;
+}
+
+unsigned long MizaruIndexedPrivateKey::getIndex() const
+{
+	return index;
+}
+
+// Get the bit length
+unsigned long MizaruIndexedPrivateKey::getBitLength() const
+{
+	return bitLength;
+}
+
+// Get the output length
+unsigned long MizaruIndexedPrivateKey::getOutputLength() const
+{
+	// An ECDSA signature is r || s
+	if (algorithm == AsymAlgo::ECDSA) return componentLength * 2;
+
+	return componentLength;
+}
+
+ByteString MizaruIndexedPrivateKey::PKCS8Encode()
+{
+	ERROR_MSG("The key in Mizar key slot %lu cannot be exported", index);
+
+	return ByteString();
+}
+
+bool MizaruIndexedPrivateKey::PKCS8Decode(const ByteString& /*ber*/)
+{
+	return false;
+}
+
+ByteString MizaruIndexedPrivateKey::serialise() const
+{
+	return ByteString();
+}
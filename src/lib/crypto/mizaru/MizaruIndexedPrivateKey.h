@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruIndexedPrivateKey.h
+
+ A private key that lives in a Mizar key slot. Only the slot index and the
+ size of the key are known on the host; the key material never leaves the
+ chip.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_MIZARUINDEXEDPRIVATEKEY_H
+#define _SOFTHSM_V2_MIZARUINDEXEDPRIVATEKEY_H
+
+#include "config.h"
+#include "AsymmetricAlgorithm.h"
+#include "PrivateKey.h"
+
+class MizaruIndexedPrivateKey : public PrivateKey
+{
+public:
+	// The type
+	static const char* type;
+
+	// Constructor
+	MizaruIndexedPrivateKey(AsymAlgo::Type inAlgorithm, unsigned long inIndex);
+
+	// Query the key slot for the size of the key
+	bool load();
+
+	// Generate an RSA key pair with the public exponent e in the key slot,
+	// which must be empty, and return its modulus
+	bool generateRSA(unsigned long bits, const ByteString& e, ByteString& n);
+
+	// Generate an EC key pair on the curve of the DER encoded parameters in
+	// the key slot, which must be empty, and return its public point as a
+	// DER encoded octet string
+	bool generateEC(const ByteString& ecParams, ByteString& point);
+
+	// Delete the key pair in the key slot
+	bool remove();
+
+	// Check if the key is of the given type
+	virtual bool isOfType(const char* inType);
+
+	// The algorithm and key slot of the key
+	AsymAlgo::Type getAlgorithm() const;
+	unsigned long getIndex() const;
+
+	// Get the bit length
+	virtual unsigned long getBitLength() const;
+
+	// Get the output length
+	virtual unsigned long getOutputLength() const;
+
+	// The key cannot be exported; these always fail
+	virtual ByteString PKCS8Encode();
+	virtual bool PKCS8Decode(const ByteString& ber);
+	virtual ByteString serialise() const;
+
+private:
+	AsymAlgo::Type algorithm;
+	unsigned long index;
+
+	// The modulus length (RSA) or coordinate length (EC) in bytes
+	unsigned long componentLength;
+	unsigned long bitLength;
+};
+
+#endif // !_SOFTHSM_V2_MIZARUINDEXEDPRIVATEKEY_H
@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruIndexedSymmetricKey.cpp
+
+ A secret key that lives in a Mizar key slot
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "MizaruIndexedSymmetricKey.h"
+#include "MizaruDevicePool.h"
+#include "mizar_api.h"
+#include "mizar_errcode.h"
+
+// The algorithm identifiers of the Mizar key store
+#define MIZAR_SYMM_ALG_DES 1
+#define MIZAR_SYMM_ALG_AES 2
+
+// Constructor
+MizaruIndexedSymmetricKey::MizaruIndexedSymmetricKey(SymAlgo::Type inAlgorithm, unsigned long inIndex)
+{
+	algorithm = inAlgorithm;
+	index = inIndex;
+}
+
+// Query the key slot for the length of the key
+bool MizaruIndexedSymmetricKey::load()
+{
+	mizar_uint32 keyLen = 0;
+	mizar_uint32 alg = 0;
+	mizar_uint32 lock = 0;
+	mizar_uint8 cv[3];
+
+	mizar_uint32 rv = MizarQuerySymmKey(index, &keyLen, &alg, &lock, cv);
+	if (rv != 0)
+	{
+		ERROR_MSG("Could not query Mizar key slot %lu (0x%08X)", index, rv);
+
+		return false;
+	}
+
+	mizar_uint32 expected = (algorithm == SymAlgo::AES) ? MIZAR_SYMM_ALG_AES : MIZAR_SYMM_ALG_DES;
+	if (alg != expected)
+	{
+		ERROR_MSG("Mizar key slot %lu holds a key of algorithm %u", index, alg);
+
+		return false;
+	}
+
+	setBitLen(keyLen * 8);
+	checkValue = ByteString(cv, sizeof(cv));
+
+	return true;
+}
+
+// Generate a key in the empty key slot
+bool MizaruIndexedSymmetricKey::generate(size_t bytes)
+{
+	mizar_uint32 alg = (algorithm == SymAlgo::AES) ? MIZAR_SYMM_ALG_AES : MIZAR_SYMM_ALG_DES;
+
+	// The channel is held from the query to the generation, so that no
+	// other process can fill the slot in between
+	bool occupied = false;
+	mizar_uint32 rv = MizaruDevicePool::i()->run([&]
+	{
+		mizar_uint32 keyLen = 0;
+		mizar_uint32 current = 0;
+		mizar_uint32 lock = 0;
+		mizar_uint8 cv[3];
+
+		occupied = MizarQuerySymmKey(index, &keyLen, &current, &lock, cv) == SUCCESS;
+		if (occupied) return (mizar_uint32) SUCCESS;
+
+		return MizarGenSymmKey(alg, index, 0, bytes, NULL);
+	});
+
+	if (occupied)
+	{
+		ERROR_MSG("Mizar key slot %lu already holds a secret key", index);
+		return false;
+	}
+
+	if (rv != SUCCESS)
+	{
+		ERROR_MSG("Could not generate a key in Mizar key slot %lu (0x%08X)", index, rv);
+		return false;
+	}
+
+	return load();
+}
+
+// Delete the key in the key slot
+bool MizaruIndexedSymmetricKey::remove()
+{
+	mizar_uint32 rv = MizaruDevicePool::i()->run([&] { return MizarDeleteSymmKey(index); });
+
+	if (rv != SUCCESS)
+	{
+		ERROR_MSG("Could not delete the key in Mizar key slot %lu (0x%08X)", index, rv);
+		return false;
+	}
+
+	return true;
+}
+
+bool MizaruIndexedSymmetricKey::setKeyBits(const ByteString& /*keybits*/)
+{
+	ERROR_MSG("The key in Mizar key slot %lu cannot be replaced", index);
+
+	return false;
+}
+
+// The check value is computed by the chip
+ByteString MizaruIndexedSymmetricKey::getKeyCheckValue() const
+{
+	return checkValue;
+}
+
+ByteString MizaruIndexedSymmetricKey::serialise() const
+{
+	return ByteString();
+}
+
+SymAlgo::Type MizaruIndexedSymmetricKey::getAlgorithm() const
+{
+	return algorithm;
+}
+
+unsigned long MizaruIndexedSymmetricKey::getIndex() const
+{
+	return index;
+}
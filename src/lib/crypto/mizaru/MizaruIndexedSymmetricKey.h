@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruIndexedSymmetricKey.h
+
+ A secret key that lives in a Mizar key slot. Only the slot index and the
+ key length are known on the host.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_MIZARUINDEXEDSYMMETRICKEY_H
+#define _SOFTHSM_V2_MIZARUINDEXEDSYMMETRICKEY_H
+
+#include "config.h"
+#include "SymmetricKey.h"
+#include "SymmetricAlgorithm.h"
+
+class MizaruIndexedSymmetricKey : public SymmetricKey
+{
+public:
+	// Constructor
+	MizaruIndexedSymmetricKey(SymAlgo::Type inAlgorithm, unsigned long inIndex);
+
+	// Query the key slot for the length of the key
+	bool load();
+
+	// Generate a key of the given length in the key slot, which must be empty
+	bool generate(size_t bytes);
+
+	// Delete the key in the key slot
+	bool remove();
+
+	// The key bits cannot be set or read
+	virtual bool setKeyBits(const ByteString& keybits);
+	virtual ByteString getKeyCheckValue() const;
+	virtual ByteString serialise() const;
+
+	SymAlgo::Type getAlgorithm() const;
+	unsigned long getIndex() const;
+
+private:
+	SymAlgo::Type algorithm;
+	unsigned long index;
+	ByteString checkValue;
+};
+
+#endif // !_SOFTHSM_V2_MIZARUINDEXEDSYMMETRICKEY_H
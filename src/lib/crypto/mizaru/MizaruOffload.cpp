@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruOffload.cpp
+
+ Decides whether an operation runs on the Mizar chip or in OpenSSL
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "Configuration.h"
+#include "MizaruOffload.h"
+#include "MizaruCalibration.h"
+#include <string>
+
+static const struct
+{
+	const char* name;
+	long crossover;
+}
+operations[MizaruOffload::OPERATION_COUNT] =
+{
+	{ "aes", DEFAULT_MIZARU_OFFLOAD_AES },
+	{ "des", DEFAULT_MIZARU_OFFLOAD_DES },
+	{ "sha256", DEFAULT_MIZARU_OFFLOAD_SHA256 },
+	{ "rsa_private", DEFAULT_MIZARU_OFFLOAD_RSA_PRIVATE },
+	{ "rsa_public", DEFAULT_MIZARU_OFFLOAD_RSA_PUBLIC },
+	{ "ecdsa_sign", DEFAULT_MIZARU_OFFLOAD_ECDSA_SIGN },
+	{ "ecdsa_verify", DEFAULT_MIZARU_OFFLOAD_ECDSA_VERIFY },
+	{ "sm4", DEFAULT_MIZARU_OFFLOAD_SM4 },
+	{ "sm3", DEFAULT_MIZARU_OFFLOAD_SM3 },
+	{ "sm2", DEFAULT_MIZARU_OFFLOAD_SM2 }
+};
+
+// Return the one-and-only instance; it is created by MizaruCryptoFactory
+// before any thread can use it
+MizaruOffload* MizaruOffload::i()
+{
+	if (!instance.get())
+	{
+		MizaruOffload* offload = new MizaruOffload();
+
+		// A saved calibration is used as is, a new one is saved
+		std::string path = Configuration::i()->getString("mizaru.offload.calibration_file", "");
+
+		if (path.empty() || !MizaruCalibration::load(path, offload))
+		{
+			if (Configuration::i()->getBool("mizaru.offload.calibrate", false) &&
+			    MizaruCalibration::run(offload) &&
+			    !path.empty())
+			{
+				MizaruCalibration::save(path, offload);
+			}
+		}
+
+		// Configured crossover points take precedence
+		for (int op = 0; op < OPERATION_COUNT; op++)
+		{
+			std::string key = std::string("mizaru.offload.") + operations[op].name;
+			long current = offload->getCrossover((Operation) op);
+			int size = Configuration::i()->getInt(key, current);
+
+			if (size < MIZARU_OFFLOAD_NEVER)
+			{
+				WARNING_MSG("Invalid value %i for %s, using %li", size, key.c_str(), current);
+
+				size = current;
+			}
+
+			offload->setCrossover((Operation) op, size);
+		}
+
+		instance.reset(offload);
+	}
+
+	return instance.get();
+}
+
+// This will destroy the one-and-only instance.
+void MizaruOffload::reset()
+{
+	if (instance.get())
+	{
+		instance->logStatistics();
+	}
+
+	instance.reset();
+}
+
+// Constructor
+MizaruOffload::MizaruOffload()
+{
+	for (int op = 0; op < OPERATION_COUNT; op++)
+	{
+		crossover[op] = operations[op].crossover;
+
+		for (int route = 0; route < ROUTE_COUNT; route++)
+		{
+			counters[op][route] = 0;
+		}
+	}
+}
+
+// True if an operation of the given size should run on the chip
+bool MizaruOffload::useChip(Operation op, unsigned long size)
+{
+	long from = crossover[op];
+	bool chip = from != MIZARU_OFFLOAD_NEVER && size >= (unsigned long) from;
+
+	counters[op][chip ? CHIP : SOFTWARE]++;
+
+	return chip;
+}
+
+// Counts an operation that failed on the chip and was done by OpenSSL
+void MizaruOffload::fallBack(Operation op)
+{
+	counters[op][FALLBACK]++;
+}
+
+unsigned long long MizaruOffload::getCount(Operation op, Route route) const
+{
+	return counters[op][route];
+}
+
+long MizaruOffload::getCrossover(Operation op) const
+{
+	return crossover[op];
+}
+
+void MizaruOffload::setCrossover(Operation op, long size)
+{
+	crossover[op] = size;
+}
+
+const std::vector<MizaruOffloadSample>& MizaruOffload::getSamples(Operation op) const
+{
+	return samples[op];
+}
+
+void MizaruOffload::setSamples(Operation op, const std::vector<MizaruOffloadSample>& samples)
+{
+	this->samples[op] = samples;
+}
+
+// Logs the crossover points and the counters
+void MizaruOffload::logStatistics() const
+{
+	for (int op = 0; op < OPERATION_COUNT; op++)
+	{
+		INFO_MSG("Mizar offload of %s: crossover %li, chip %llu, software %llu, fallback %llu",
+			 operations[op].name, getCrossover((Operation) op),
+			 getCount((Operation) op, CHIP),
+			 getCount((Operation) op, SOFTWARE),
+			 getCount((Operation) op, FALLBACK));
+	}
+}
+
+// The name of an operation in the configuration
+const char* MizaruOffload::getName(Operation op)
+{
+	return operations[op].name;
+}
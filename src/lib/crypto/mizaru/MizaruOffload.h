@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruOffload.h
+
+ Decides whether an operation runs on the Mizar chip or in OpenSSL. Every
+ message to the chip has a fixed cost, so small operations are faster on
+ the host. Each kind of operation has a crossover size from which on the
+ chip is used: a number of bytes for symmetric ciphers and hashes and a
+ key size in bits for public key operations. The crossover points can be
+ measured at startup (see MizaruCalibration), and are overridden by the
+ mizaru.offload.* configuration keys. The routing decisions are counted.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_MIZARUOFFLOAD_H
+#define _SOFTHSM_V2_MIZARUOFFLOAD_H
+
+#include "config.h"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// Crossover value of an operation that never goes to the chip
+#define MIZARU_OFFLOAD_NEVER -1
+
+// Default crossover points
+#define DEFAULT_MIZARU_OFFLOAD_AES 4096
+#define DEFAULT_MIZARU_OFFLOAD_DES 256
+#define DEFAULT_MIZARU_OFFLOAD_SHA256 4096
+#define DEFAULT_MIZARU_OFFLOAD_RSA_PRIVATE 2048
+#define DEFAULT_MIZARU_OFFLOAD_RSA_PUBLIC MIZARU_OFFLOAD_NEVER
+#define DEFAULT_MIZARU_OFFLOAD_ECDSA_SIGN 0
+#define DEFAULT_MIZARU_OFFLOAD_ECDSA_VERIFY 0
+#define DEFAULT_MIZARU_OFFLOAD_SM4 4096
+#define DEFAULT_MIZARU_OFFLOAD_SM3 4096
+#define DEFAULT_MIZARU_OFFLOAD_SM2 0
+
+// The time of one operation of a given size, in microseconds, on the chip
+// and in OpenSSL; a negative time means the operation failed
+struct MizaruOffloadSample
+{
+	unsigned long size;
+	double chipTime;
+	double softwareTime;
+};
+
+class MizaruOffload
+{
+public:
+	enum Operation
+	{
+		AES,
+		DES,
+		SHA256,
+		RSA_PRIVATE,
+		RSA_PUBLIC,
+		ECDSA_SIGN,
+		ECDSA_VERIFY,
+		SM4,
+		SM3,
+		SM2,
+		OPERATION_COUNT
+	};
+
+	enum Route
+	{
+		// Sent to the chip
+		CHIP,
+		// Done by OpenSSL because it is below the crossover
+		SOFTWARE,
+		// Done by OpenSSL after the chip failed
+		FALLBACK,
+		ROUTE_COUNT
+	};
+
+	// Return the one-and-only instance, set up from the calibration and
+	// the configuration
+	static MizaruOffload* i();
+
+	// This will destroy the one-and-only instance.
+	static void reset();
+
+	// Constructor, with the default crossover points
+	MizaruOffload();
+
+	// Destructor
+	virtual ~MizaruOffload() { }
+
+	// True if an operation of the given size should run on the chip,
+	// counts the decision
+	bool useChip(Operation op, unsigned long size);
+
+	// Counts an operation that failed on the chip and was done by OpenSSL
+	void fallBack(Operation op);
+
+	// The number of operations that took a route
+	unsigned long long getCount(Operation op, Route route) const;
+
+	// The crossover point of an operation, MIZARU_OFFLOAD_NEVER if the
+	// chip is not used
+	long getCrossover(Operation op) const;
+	void setCrossover(Operation op, long size);
+
+	// The measurements the crossover point was taken from, empty if the
+	// operation was not calibrated
+	const std::vector<MizaruOffloadSample>& getSamples(Operation op) const;
+	void setSamples(Operation op, const std::vector<MizaruOffloadSample>& samples);
+
+	// Logs the crossover points and the counters
+	void logStatistics() const;
+
+	// The name of an operation in the configuration, e.g. "aes"
+	static const char* getName(Operation op);
+
+private:
+	std::atomic<long> crossover[OPERATION_COUNT];
+
+	std::atomic<unsigned long long> counters[OPERATION_COUNT][ROUTE_COUNT];
+
+	// Only set before the instance is shared
+	std::vector<MizaruOffloadSample> samples[OPERATION_COUNT];
+
+	// The one-and-only instance
+#ifdef HAVE_CXX11
+	static std::unique_ptr<MizaruOffload> instance;
+#else
+	static std::auto_ptr<MizaruOffload> instance;
+#endif
+};
+
+#endif // !_SOFTHSM_V2_MIZARUOFFLOAD_H
@@ -31,8 +31,90 @@
  *****************************************************************************/
 
 #include "config.h"
+#include "log.h"
 #include "MizaruRNG.h"
+#include "MizaruDevicePool.h"
 #include "mizar_api.h"
+#include <chrono>
+#include <string.h>
+#include <system_error>
+#include <openssl/evp.h>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+// CTR_DRBG with AES-256
+#define DRBG_KEY_LEN 32
+#define DRBG_BLOCK_LEN 16
+#define DRBG_SEED_LEN (DRBG_KEY_LEN + DRBG_BLOCK_LEN)
+
+// The largest request served without updating the state in between
+#define DRBG_MAX_REQUEST 65536
+
+// Milliseconds the refill thread waits after the chip failed
+#define REFILL_RETRY_MS 100
+
+// Whether new instances start a refill thread
+bool MizaruRNG::refillThread = true;
+
+// Whether new instances fill the pool from a thread of their own
+/*static*/ void MizaruRNG::setRefillThread(bool enabled)
+{
+	refillThread = enabled;
+}
+
+// Constructor
+MizaruRNG::MizaruRNG(size_t poolSize, unsigned long reseedInterval)
+{
+	this->poolSize = poolSize;
+	this->reseedInterval = reseedInterval > 0 ? reseedInterval : 1;
+
+	// Keep enough for one reseed at least
+	if (poolSize > 0 && poolSize < DRBG_SEED_LEN) this->poolSize = DRBG_SEED_LEN;
+
+	drbgMutex = MutexFactory::i()->getMutex();
+	poolMutex = MutexFactory::i()->getMutex();
+	refillNeeded = new std::condition_variable_any();
+	instantiated = false;
+	requests = 0;
+	reseeds = 0;
+	useThread = refillThread;
+	refiller = NULL;
+	stopping = false;
+	pid = getpid();
+}
+
+// Destructor
+MizaruRNG::~MizaruRNG()
+{
+	// In a forked child that never used us, the thread and the locks are
+	// still the parent's
+	checkFork();
+
+	if (refiller != NULL)
+	{
+		{
+			MutexLocker lock(poolMutex);
+
+			stopping = true;
+		}
+
+		refillNeeded->notify_all();
+
+		refiller->join();
+		delete refiller;
+	}
+
+	pool.wipe();
+
+	delete refillNeeded;
+	MutexFactory::i()->recycleMutex(poolMutex);
+	MutexFactory::i()->recycleMutex(drbgMutex);
+}
 
 // Generate random data
 bool MizaruRNG::generateRandom(ByteString& data, const size_t len)
@@ -42,13 +124,301 @@ bool MizaruRNG::generateRandom(ByteString& data, const size_t len)
 	if (len == 0)
 		return true;
 
-	// bool ret = MizarGenRnd(0, len, &data[0]) == 0;
-	bool ret = MizarGenRnd(0, len, &data[0]) == 1; // OpenSSL RAND_bytes
-	return ret;
+	if (poolSize == 0)
+		return fetchEntropy(&data[0], len);
+
+	checkFork();
+
+	MutexLocker lock(drbgMutex);
+
+	if (!drbgGenerate(&data[0], len))
+	{
+		data.wipe(len);
+
+		return false;
+	}
+
+	return true;
 }
 
 // Seed the random pool
 void MizaruRNG::seed(ByteString& seedData)
 {
-	// RAND_seed(seedData.byte_str(), seedData.size());
-}
\ No newline at end of file
+	if (poolSize == 0 || seedData.size() == 0)
+		return;
+
+	checkFork();
+
+	MutexLocker lock(drbgMutex);
+
+	// Mixed in as additional input
+	if (!instantiated)
+		drbgReseed(seedData);
+	else
+		drbgUpdate(toSeedLength(seedData));
+}
+
+// The number of times the DRBG was seeded from the chip
+unsigned long MizaruRNG::getReseedCount()
+{
+	MutexLocker lock(drbgMutex);
+
+	return reseeds;
+}
+
+// The number of bytes of entropy in the pool
+size_t MizaruRNG::getPoolLevel()
+{
+	MutexLocker lock(poolMutex);
+
+	return pool.size();
+}
+
+// Fetches entropy from the chip
+bool MizaruRNG::fetchEntropy(unsigned char* out, size_t len)
+{
+	return MizaruDevicePool::i()->run([&] { return MizarGenRnd(0, len, out); }) == SUCCESS;
+}
+
+// Takes seed material from the pool, or from the chip if it is empty
+bool MizaruRNG::takeEntropy(ByteString& entropy)
+{
+	{
+		std::unique_lock<Mutex> guard(*poolMutex);
+
+		if (useThread && refiller == NULL && !stopping)
+		{
+			try
+			{
+				refiller = new std::thread(&MizaruRNG::refill, this);
+			}
+			catch (const std::system_error& e)
+			{
+				WARNING_MSG("Could not start the entropy refill thread: %s", e.what());
+
+				useThread = false;
+			}
+		}
+
+		// Without a refill thread, one round-trip fills the whole pool
+		if (refiller == NULL && pool.size() < DRBG_SEED_LEN)
+		{
+			fillPool(guard);
+		}
+
+		if (pool.size() >= DRBG_SEED_LEN)
+		{
+			size_t rest = pool.size() - DRBG_SEED_LEN;
+
+			entropy = pool.substr(rest);
+			memset(&pool[rest], 0, DRBG_SEED_LEN);
+			pool.resize(rest);
+
+			if (refiller != NULL && pool.size() < poolSize / 2) refillNeeded->notify_one();
+
+			return true;
+		}
+
+		if (refiller != NULL) refillNeeded->notify_one();
+	}
+
+	// The pool ran dry
+	entropy.wipe(DRBG_SEED_LEN);
+
+	return fetchEntropy(&entropy[0], entropy.size());
+}
+
+// Fills the pool from the chip
+bool MizaruRNG::fillPool(std::unique_lock<Mutex>& guard)
+{
+	// Fetch outside the lock, takeEntropy() can fall back to the chip
+	ByteString fresh;
+	fresh.wipe(poolSize - pool.size());
+
+	guard.unlock();
+	bool ok = fetchEntropy(&fresh[0], fresh.size());
+	guard.lock();
+
+	if (ok)
+	{
+		pool += fresh;
+		if (pool.size() > poolSize) pool.resize(poolSize);
+	}
+	else
+	{
+		WARNING_MSG("Could not refill the entropy pool");
+	}
+
+	fresh.wipe();
+
+	return ok;
+}
+
+// The loop of the refill thread
+void MizaruRNG::refill()
+{
+	std::unique_lock<Mutex> guard(*poolMutex);
+
+	while (!stopping)
+	{
+		if (pool.size() >= poolSize / 2)
+		{
+			refillNeeded->wait(guard);
+			continue;
+		}
+
+		if (!fillPool(guard) && !stopping)
+		{
+			refillNeeded->wait_for(guard, std::chrono::milliseconds(REFILL_RETRY_MS));
+		}
+	}
+}
+
+// Starts over after a fork
+void MizaruRNG::checkFork()
+{
+	if (pid == getpid()) return;
+
+	// The parent's thread may have held the locks or waited on the
+	// condition; destroying them could block, so they are left alone
+	drbgMutex = MutexFactory::i()->getMutex();
+	poolMutex = MutexFactory::i()->getMutex();
+	refillNeeded = new std::condition_variable_any();
+
+	key.wipe();
+	v.wipe();
+	instantiated = false;
+	requests = 0;
+
+	pool.wipe();
+	useThread = false;
+	refiller = NULL;
+	stopping = false;
+
+	pid = getpid();
+}
+
+// The CTR_DRBG update function
+bool MizaruRNG::drbgUpdate(const ByteString& providedData)
+{
+	unsigned char temp[DRBG_SEED_LEN];
+
+	if (!drbgBlocks(temp, DRBG_SEED_LEN / DRBG_BLOCK_LEN)) return false;
+
+	for (size_t i = 0; i < DRBG_SEED_LEN; i++)
+	{
+		temp[i] ^= providedData.const_byte_str()[i];
+	}
+
+	key = ByteString(temp, DRBG_KEY_LEN);
+	v = ByteString(temp + DRBG_KEY_LEN, DRBG_BLOCK_LEN);
+	memset(temp, 0, sizeof(temp));
+
+	return true;
+}
+
+// Seeds the DRBG with chip entropy; the first time this instantiates it
+bool MizaruRNG::drbgReseed(const ByteString& additionalInput)
+{
+	ByteString entropy;
+
+	if (!takeEntropy(entropy))
+	{
+		ERROR_MSG("Could not get entropy from the chip");
+
+		return false;
+	}
+
+	if (!instantiated)
+	{
+		key.wipe(DRBG_KEY_LEN);
+		v.wipe(DRBG_BLOCK_LEN);
+	}
+
+	bool ok = drbgUpdate(entropy ^ toSeedLength(additionalInput));
+	entropy.wipe();
+
+	if (!ok) return false;
+
+	instantiated = true;
+	requests = 0;
+	reseeds++;
+
+	return true;
+}
+
+// Generates output, reseeding when the interval is reached
+bool MizaruRNG::drbgGenerate(unsigned char* out, size_t len)
+{
+	ByteString noInput;
+	ByteString blocks;
+
+	noInput.wipe(DRBG_SEED_LEN);
+
+	while (len > 0)
+	{
+		if (!instantiated || requests >= reseedInterval)
+		{
+			if (!drbgReseed(ByteString())) return false;
+		}
+
+		size_t chunk = len < DRBG_MAX_REQUEST ? len : DRBG_MAX_REQUEST;
+
+		blocks.wipe((chunk + DRBG_BLOCK_LEN - 1) / DRBG_BLOCK_LEN * DRBG_BLOCK_LEN);
+		if (!drbgBlocks(&blocks[0], blocks.size() / DRBG_BLOCK_LEN)) return false;
+		memcpy(out, blocks.const_byte_str(), chunk);
+
+		// Backtracking resistance
+		if (!drbgUpdate(noInput)) return false;
+
+		requests++;
+		out += chunk;
+		len -= chunk;
+	}
+
+	blocks.wipe();
+
+	return true;
+}
+
+// Encrypts the next nBlocks values of the counter
+bool MizaruRNG::drbgBlocks(unsigned char* out, size_t nBlocks)
+{
+	for (size_t i = 0; i < nBlocks; i++)
+	{
+		// V = (V + 1) mod 2^128
+		for (int j = DRBG_BLOCK_LEN - 1; j >= 0; j--)
+		{
+			if (++v[j] != 0) break;
+		}
+
+		memcpy(out + i * DRBG_BLOCK_LEN, v.const_byte_str(), DRBG_BLOCK_LEN);
+	}
+
+	EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+	int outLen = 0;
+	bool ok = ctx != NULL &&
+		EVP_EncryptInit_ex(ctx, EVP_aes_256_ecb(), NULL, key.const_byte_str(), NULL) &&
+		EVP_CIPHER_CTX_set_padding(ctx, 0) &&
+		EVP_EncryptUpdate(ctx, out, &outLen, out, nBlocks * DRBG_BLOCK_LEN);
+
+	EVP_CIPHER_CTX_free(ctx);
+
+	if (!ok) ERROR_MSG("AES failed in the DRBG");
+
+	return ok;
+}
+
+// Folds input of any length into seed length
+ByteString MizaruRNG::toSeedLength(const ByteString& input)
+{
+	ByteString folded;
+	folded.wipe(DRBG_SEED_LEN);
+
+	for (size_t i = 0; i < input.size(); i++)
+	{
+		folded[i % DRBG_SEED_LEN] ^= input.const_byte_str()[i];
+	}
+
+	return folded;
+}
@@ -27,7 +27,13 @@
 /*****************************************************************************
  MizaruRNG.h
 
- Mizaru random number generator class
+ Mizaru random number generator class. Random data comes from a local
+ AES-256 CTR_DRBG (NIST SP 800-90A, without derivation function) that is
+ seeded and periodically reseeded with entropy from the chip. The entropy
+ is taken from a pool that a background thread keeps filled, so that small
+ requests such as IVs and salts do not each cost a chip round-trip. When the
+ library may not create threads, and in a forked child, the pool is filled
+ by the thread that finds it empty instead.
  *****************************************************************************/
 
 #ifndef _SOFTHSM_V2_MIZARURNG_H
@@ -36,16 +42,92 @@
 #include "config.h"
 #include "ByteString.h"
 #include "RNG.h"
+#include "MutexFactory.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// The default number of bytes of chip entropy kept in the pool
+#define DEFAULT_MIZARU_RNG_POOL_SIZE 4096
+
+// The default number of requests served between two reseeds
+#define DEFAULT_MIZARU_RNG_RESEED_INTERVAL 1024
 
 class MizaruRNG : public RNG
 {
 public:
+	// A pool size of 0 takes all random data from the chip
+	MizaruRNG(size_t poolSize = DEFAULT_MIZARU_RNG_POOL_SIZE,
+		  unsigned long reseedInterval = DEFAULT_MIZARU_RNG_RESEED_INTERVAL);
+
+	// Destructor
+	virtual ~MizaruRNG();
+
 	// Generate random data
 	virtual bool generateRandom(ByteString& data, const size_t len);
 
 	// Seed the random pool
 	virtual void seed(ByteString& seedData);
+
+	// The number of times the DRBG was seeded from the chip
+	unsigned long getReseedCount();
+
+	// The number of bytes of entropy in the pool
+	size_t getPoolLevel();
+
+	// Whether new instances fill the pool from a thread of their own
+	static void setRefillThread(bool enabled);
+
+private:
+	// Fetches entropy from the chip
+	static bool fetchEntropy(unsigned char* out, size_t len);
+
+	// Takes seed material from the pool, or from the chip if it is empty
+	bool takeEntropy(ByteString& entropy);
+
+	// Fills the pool from the chip; the pool lock must be held
+	bool fillPool(std::unique_lock<Mutex>& guard);
+
+	// The loop of the refill thread
+	void refill();
+
+	// Starts over after a fork; the DRBG state and the pool belong to the
+	// parent, and its refill thread and the locks it held do not exist in
+	// the child
+	void checkFork();
+
+	// CTR_DRBG; the DRBG lock must be held
+	bool drbgUpdate(const ByteString& providedData);
+	bool drbgReseed(const ByteString& additionalInput);
+	bool drbgGenerate(unsigned char* out, size_t len);
+	bool drbgBlocks(unsigned char* out, size_t nBlocks);
+
+	// Folds input of any length into seed length
+	static ByteString toSeedLength(const ByteString& input);
+
+	size_t poolSize;
+	unsigned long reseedInterval;
+
+	// Whether new instances start a refill thread
+	static bool refillThread;
+
+	// The DRBG state
+	Mutex* drbgMutex;
+	ByteString key;
+	ByteString v;
+	bool instantiated;
+	unsigned long requests;
+	unsigned long reseeds;
+
+	// The entropy pool; without a refill thread it is filled on demand
+	Mutex* poolMutex;
+	std::condition_variable_any* refillNeeded;
+	ByteString pool;
+	bool useThread;
+	std::thread* refiller;
+	bool stopping;
+
+	int pid;
 };
 
 #endif // !_SOFTHSM_V2_MIZARURNG_H
-
@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruRSAMethod.cpp
+
+ The OpenSSL RSA method of the Mizaru RSA keys
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "MizaruRSAMethod.h"
+#include "MizaruDevicePool.h"
+#include "MizaruOffload.h"
+#include "mizar_api.h"
+#include <vector>
+#include <string.h>
+#include <openssl/crypto.h>
+#include <openssl/x509.h>
+
+// The raw private key operation on the chip; the key is sent along as a
+// DER encoded RSAPrivateKey
+static bool chipPrivate(RSA* rsa, bool sign, const unsigned char* from, unsigned char* to)
+{
+	mizar_uint32 len = RSA_size(rsa);
+	unsigned char* der = NULL;
+	int derLen = i2d_RSAPrivateKey(rsa, &der);
+
+	if (derLen <= 0)
+	{
+		return false;
+	}
+
+	// The chip does not change its inputs
+	mizar_uint8* data = (mizar_uint8*) from;
+	mizar_uint32 outLen = len;
+	mizar_uint32 rv = MizaruDevicePool::i()->run([&]
+	{
+		return sign ? MizarRsaSkEnc(len, data, derLen, der, &outLen, to) : MizarRsaSkDec(len, data, derLen, der, &outLen, to);
+	});
+
+	OPENSSL_clear_free(der, derLen);
+
+	if (rv != 0 || outLen != len)
+	{
+		WARNING_MSG("RSA private key operation on the Mizar chip failed (0x%08X), using OpenSSL", rv);
+
+		MizaruOffload::i()->fallBack(MizaruOffload::RSA_PRIVATE);
+
+		return false;
+	}
+
+	return true;
+}
+
+// The raw public key operation on the chip
+static bool chipPublic(RSA* rsa, const unsigned char* from, unsigned char* to)
+{
+	const BIGNUM* bn_n = NULL;
+	const BIGNUM* bn_e = NULL;
+
+	RSA_get0_key(rsa, &bn_n, &bn_e, NULL);
+
+	mizar_uint32 len = RSA_size(rsa);
+	std::vector<mizar_uint8> n(len);
+	std::vector<mizar_uint8> e(BN_num_bytes(bn_e));
+
+	if (BN_bn2binpad(bn_n, &n[0], n.size()) < 0 || BN_bn2bin(bn_e, &e[0]) < 0)
+	{
+		return false;
+	}
+
+	mizar_uint8* data = (mizar_uint8*) from;
+	mizar_uint32 outLen = len;
+	mizar_uint32 rv = MizaruDevicePool::i()->run([&] { return MizarRsaPkEnc(n.size(), &n[0], e.size(), &e[0], len, data, &outLen, to); });
+
+	if (rv != 0 || outLen != len)
+	{
+		WARNING_MSG("RSA public key operation on the Mizar chip failed (0x%08X), using OpenSSL", rv);
+
+		MizaruOffload::i()->fallBack(MizaruOffload::RSA_PUBLIC);
+
+		return false;
+	}
+
+	return true;
+}
+
+static bool usePrivate(RSA* rsa)
+{
+	int bits = RSA_bits(rsa);
+
+	return bits <= MIZARU_RSA_MAX_CHIP_BITS && MizaruOffload::i()->useChip(MizaruOffload::RSA_PRIVATE, bits);
+}
+
+static bool usePublic(RSA* rsa)
+{
+	return MizaruOffload::i()->useChip(MizaruOffload::RSA_PUBLIC, RSA_bits(rsa));
+}
+
+static int privateEncrypt(int flen, const unsigned char* from, unsigned char* to, RSA* rsa, int padding)
+{
+	if (usePrivate(rsa))
+	{
+		int len = RSA_size(rsa);
+		std::vector<unsigned char> em(len);
+		int padded = 0;
+
+		if (padding == RSA_PKCS1_PADDING)
+		{
+			padded = RSA_padding_add_PKCS1_type_1(&em[0], len, from, flen);
+		}
+		else if (padding == RSA_NO_PADDING)
+		{
+			padded = RSA_padding_add_none(&em[0], len, from, flen);
+		}
+
+		if (padded == 1 && chipPrivate(rsa, true, &em[0], to))
+		{
+			return len;
+		}
+	}
+
+	return RSA_meth_get_priv_enc(RSA_PKCS1_OpenSSL())(flen, from, to, rsa, padding);
+}
+
+static int privateDecrypt(int flen, const unsigned char* from, unsigned char* to, RSA* rsa, int padding)
+{
+	int len = RSA_size(rsa);
+
+	if (flen == len && usePrivate(rsa) &&
+	    (padding == RSA_PKCS1_PADDING || padding == RSA_PKCS1_OAEP_PADDING || padding == RSA_NO_PADDING))
+	{
+		std::vector<unsigned char> em(len);
+
+		if (chipPrivate(rsa, false, from, &em[0]))
+		{
+			int rv;
+
+			switch (padding)
+			{
+				case RSA_PKCS1_PADDING:
+					rv = RSA_padding_check_PKCS1_type_2(to, len, &em[0], len, len);
+					break;
+				case RSA_PKCS1_OAEP_PADDING:
+					rv = RSA_padding_check_PKCS1_OAEP(to, len, &em[0], len, len, NULL, 0);
+					break;
+				default:
+					memcpy(to, &em[0], len);
+					rv = len;
+					break;
+			}
+
+			OPENSSL_cleanse(&em[0], len);
+
+			return rv;
+		}
+	}
+
+	return RSA_meth_get_priv_dec(RSA_PKCS1_OpenSSL())(flen, from, to, rsa, padding);
+}
+
+static int publicEncrypt(int flen, const unsigned char* from, unsigned char* to, RSA* rsa, int padding)
+{
+	if (usePublic(rsa))
+	{
+		int len = RSA_size(rsa);
+		std::vector<unsigned char> em(len);
+		int padded = 0;
+
+		switch (padding)
+		{
+			case RSA_PKCS1_PADDING:
+				padded = RSA_padding_add_PKCS1_type_2(&em[0], len, from, flen);
+				break;
+			case RSA_PKCS1_OAEP_PADDING:
+				padded = RSA_padding_add_PKCS1_OAEP(&em[0], len, from, flen, NULL, 0);
+				break;
+			case RSA_NO_PADDING:
+				padded = RSA_padding_add_none(&em[0], len, from, flen);
+				break;
+			default:
+				break;
+		}
+
+		if (padded == 1 && chipPublic(rsa, &em[0], to))
+		{
+			return len;
+		}
+	}
+
+	return RSA_meth_get_pub_enc(RSA_PKCS1_OpenSSL())(flen, from, to, rsa, padding);
+}
+
+static int publicDecrypt(int flen, const unsigned char* from, unsigned char* to, RSA* rsa, int padding)
+{
+	int len = RSA_size(rsa);
+
+	if (flen == len && usePublic(rsa) && (padding == RSA_PKCS1_PADDING || padding == RSA_NO_PADDING))
+	{
+		std::vector<unsigned char> em(len);
+
+		if (chipPublic(rsa, from, &em[0]))
+		{
+			if (padding == RSA_NO_PADDING)
+			{
+				memcpy(to, &em[0], len);
+
+				return len;
+			}
+
+			return RSA_padding_check_PKCS1_type_1(to, len, &em[0], len, len);
+		}
+	}
+
+	return RSA_meth_get_pub_dec(RSA_PKCS1_OpenSSL())(flen, from, to, rsa, padding);
+}
+
+static RSA_METHOD* createMethod()
+{
+	RSA_METHOD* method = RSA_meth_dup(RSA_PKCS1_OpenSSL());
+
+	if (method == NULL)
+	{
+		ERROR_MSG("Could not create the Mizaru RSA method");
+
+		return NULL;
+	}
+
+	RSA_meth_set1_name(method, "Mizaru RSA");
+	RSA_meth_set_priv_enc(method, privateEncrypt);
+	RSA_meth_set_priv_dec(method, privateDecrypt);
+	RSA_meth_set_pub_enc(method, publicEncrypt);
+	RSA_meth_set_pub_dec(method, publicDecrypt);
+
+	return method;
+}
+
+// Return the method, it lives as long as the process
+const RSA_METHOD* MizaruRSAMethod::get()
+{
+	static const RSA_METHOD* method = createMethod();
+
+	return method != NULL ? method : RSA_PKCS1_OpenSSL();
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruRSAMethod.h
+
+ The OpenSSL RSA method of the Mizaru RSA keys. The raw RSA operations run
+ on the Mizar chip from the crossover key size on and are otherwise done
+ by the OpenSSL implementation. Padding is always added and checked by
+ OpenSSL, so every RSA mechanism can use the chip.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_MIZARURSAMETHOD_H
+#define _SOFTHSM_V2_MIZARURSAMETHOD_H
+
+#include "config.h"
+#include <openssl/rsa.h>
+
+// The largest private key that fits in one message to the chip
+#define MIZARU_RSA_MAX_CHIP_BITS 2048
+
+class MizaruRSAMethod
+{
+public:
+	// Return the method, it lives as long as the process
+	static const RSA_METHOD* get();
+};
+
+#endif // !_SOFTHSM_V2_MIZARURSAMETHOD_H
@@ -35,6 +35,7 @@
 #include "OSSLComp.h"
 #include "MizaruRSAPrivateKey.h"
 #include "OSSLUtil.h"
+#include "MizaruRSAMethod.h"
 #include <openssl/bn.h>
 #include <openssl/x509.h>
 #ifdef WITH_FIPS
@@ -288,7 +289,8 @@ void MizaruRSAPrivateKey::createMizaruKey()
 		return;
 	}
 
-	// Use the OpenSSL implementation and not any engine
+	// Use the Mizaru method, which falls back to the OpenSSL
+	// implementation, and not any engine
 #if OPENSSL_VERSION_NUMBER < 0x10100000L || defined(LIBRESSL_VERSION_NUMBER)
 
 #ifdef WITH_FIPS
@@ -301,7 +303,7 @@ void MizaruRSAPrivateKey::createMizaruKey()
 #endif
 
 #else
-	RSA_set_method(rsa, RSA_PKCS1_OpenSSL());
+	RSA_set_method(rsa, MizaruRSAMethod::get());
 #endif
 
 	BIGNUM* bn_p = OSSL::byteString2bn(p);
@@ -35,6 +35,7 @@
 #include "OSSLComp.h"
 #include "MizaruRSAPublicKey.h"
 #include "OSSLUtil.h"
+#include "MizaruRSAMethod.h"
 #include <string.h>
 #include <openssl/bn.h>
 #ifdef WITH_FIPS
@@ -132,7 +133,8 @@ void MizaruRSAPublicKey::createMizaruKey()
 		return;
 	}
 
-	// Use the OpenSSL implementation and not any engine
+	// Use the Mizaru method, which falls back to the OpenSSL
+	// implementation, and not any engine
 #if OPENSSL_VERSION_NUMBER < 0x10100000L || defined(LIBRESSL_VERSION_NUMBER)
 
 #ifdef WITH_FIPS
@@ -145,7 +147,7 @@ void MizaruRSAPublicKey::createMizaruKey()
 #endif
 
 #else
-	RSA_set_method(rsa, RSA_PKCS1_OpenSSL());
+	RSA_set_method(rsa, MizaruRSAMethod::get());
 #endif
 
 	BIGNUM* bn_n = OSSL::byteString2bn(n);
@@ -25,84 +25,15 @@
  */
 
 /*****************************************************************************
- MizaruSHA256.h
+ MizaruSHA256.cpp
 
  Mizaru SHA256 implementation
  *****************************************************************************/
 
 #include "config.h"
 #include "MizaruSHA256.h"
-#include "mizaru/mizar_api.h"
 
-// Hashing functions
-bool MizaruSHA256::hashInit()
+// Base constructor
+MizaruSHA256::MizaruSHA256() : MizaruHash(3, EVP_sha256(), MizaruOffload::SHA256, 32)
 {
-	if (!HashAlgorithm::hashInit())
-	{
-		return false;
-	}
-
-	if (0 != MizarShaInit(3))
-	{
-		ERROR_MSG("MizarShaInit failed");
-
-		ByteString dummy;
-		HashAlgorithm::hashFinal(dummy);
-
-		return false;
-	}
-
-	return true;
-}
-
-bool MizaruSHA256::hashUpdate(const ByteString& data)
-{
-	if (!HashAlgorithm::hashUpdate(data))
-	{
-		return false;
-	}
-
-	if (data.size() == 0)
-	{
-		return true;
-	}
-
-	if (0 != MizarShaUpdate(3, data.size(), (mizar_uint8*) data.const_byte_str()))
-	{
-		ERROR_MSG("MizarShaUpdate failed");
-
-		ByteString dummy;
-		HashAlgorithm::hashFinal(dummy);
-
-		return false;
-	}
-
-	return true;
 }
-
-bool MizaruSHA256::hashFinal(ByteString& hashedData)
-{
-	if (!HashAlgorithm::hashFinal(hashedData))
-	{
-		return false;
-	}
-
-	hashedData.resize(getHashSize());
-	unsigned int outLen = 0;
-
-	if (0 != MizarShaFinal(3, &outLen, &hashedData[0]))
-	{
-		ERROR_MSG("MizarShaFinal failed");
-
-		return false;
-	}
-	hashedData.resize(outLen);
-
-	return true;
-}
-
-int MizaruSHA256::getHashSize()
-{
-	return 32;
-}
-
@@ -34,18 +34,13 @@
 #define _SOFTHSM_V2_MIZARUSHA256_H
 
 #include "config.h"
-#include "HashAlgorithm.h"
+#include "MizaruHash.h"
 
-class MizaruSHA256 : public HashAlgorithm
+class MizaruSHA256 : public MizaruHash
 {
 public:
-	// Hashing functions
-	virtual bool hashInit();
-	virtual bool hashUpdate(const ByteString& data);
-	virtual bool hashFinal(ByteString& hashedData);
-	
-	virtual int getHashSize();
+	// Base constructor
+	MizaruSHA256();
 };
 
 #endif // !_SOFTHSM_V2_MIZARUSHA256_H
-
@@ -0,0 +1,785 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruSM2.cpp
+
+ Mizaru SM2 asymmetric algorithm implementation
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "MizaruSM2.h"
+#include "MizaruECPrivateKey.h"
+#include "MizaruECPublicKey.h"
+#include "MizaruDevicePool.h"
+#include "MizaruOffload.h"
+#include "CryptoFactory.h"
+#include "ECParameters.h"
+#include "OSSLUtil.h"
+#include "mizar_api.h"
+#include <openssl/asn1.h>
+#include <openssl/bn.h>
+#include <openssl/ecdsa.h>
+#include <openssl/evp.h>
+#include <openssl/obj_mac.h>
+
+// The length of the coordinates, the digest and the signature halves
+#define SM2_LEN 32
+
+// The most data the chip encrypts in one message on either bus
+#define SM2_MAX_CHIP_DATA 1024
+
+// The signer ID of GM/T 0009 used when none is given
+static const char defaultID[] = "1234567812345678";
+
+// An EVP_PKEY of type SM2 for an EC key on the SM2 curve
+static EVP_PKEY* sm2Key(EC_KEY* eckey)
+{
+	if (eckey == NULL || EC_GROUP_get_curve_name(EC_KEY_get0_group(eckey)) != NID_sm2)
+	{
+		ERROR_MSG("The key is not on the SM2 curve");
+
+		return NULL;
+	}
+
+	EVP_PKEY* pkey = EVP_PKEY_new();
+
+	// On the SM2 curve the key becomes an SM2 key; OpenSSL 1.1.1 has to be
+	// told
+	if (pkey == NULL || !EVP_PKEY_set1_EC_KEY(pkey, eckey) ||
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+	    !EVP_PKEY_set_alias_type(pkey, EVP_PKEY_SM2) ||
+#endif
+	    EVP_PKEY_id(pkey) != EVP_PKEY_SM2)
+	{
+		ERROR_MSG("Could not create an SM2 key");
+
+		EVP_PKEY_free(pkey);
+
+		return NULL;
+	}
+
+	return pkey;
+}
+
+// Big-endian bytes of a number, left padded to SM2_LEN
+static void appendBn(ByteString& out, const BIGNUM* bn)
+{
+	ByteString padded;
+	padded.resize(SM2_LEN);
+	BN_bn2binpad(bn, &padded[0], SM2_LEN);
+	out += padded;
+}
+
+// Appends the coordinates of a point
+static bool appendPoint(ByteString& out, const EC_GROUP* grp, const EC_POINT* point)
+{
+	BIGNUM* x = BN_new();
+	BIGNUM* y = BN_new();
+	bool ok = x != NULL && y != NULL && EC_POINT_get_affine_coordinates(grp, point, x, y, NULL);
+
+	if (ok)
+	{
+		appendBn(out, x);
+		appendBn(out, y);
+	}
+
+	BN_free(x);
+	BN_free(y);
+
+	return ok;
+}
+
+// The input of Z: ENTL || ID || a || b || xG || yG || xA || yA. The public
+// point of a private key is computed from the private value.
+static bool zInput(EC_KEY* key, const ByteString& id, ByteString& out)
+{
+	const EC_GROUP* grp = EC_KEY_get0_group(key);
+	const EC_POINT* pub = EC_KEY_get0_public_key(key);
+	EC_POINT* derived = NULL;
+	BIGNUM* a = BN_new();
+	BIGNUM* b = BN_new();
+
+	if (pub == NULL && EC_KEY_get0_private_key(key) != NULL)
+	{
+		derived = EC_POINT_new(grp);
+
+		if (derived != NULL && EC_POINT_mul(grp, derived, EC_KEY_get0_private_key(key), NULL, NULL, NULL))
+		{
+			pub = derived;
+		}
+	}
+
+	size_t bits = id.size() * 8;
+	unsigned char entl[2] = { (unsigned char) (bits >> 8), (unsigned char) bits };
+
+	out = ByteString(entl, sizeof(entl)) + id;
+
+	bool ok = pub != NULL && a != NULL && b != NULL && bits <= 0xffff &&
+		  EC_GROUP_get_curve(grp, NULL, a, b, NULL);
+
+	if (ok)
+	{
+		appendBn(out, a);
+		appendBn(out, b);
+		ok = appendPoint(out, grp, EC_GROUP_get0_generator(grp)) && appendPoint(out, grp, pub);
+	}
+
+	EC_POINT_free(derived);
+	BN_free(a);
+	BN_free(b);
+
+	return ok;
+}
+
+// Converts between C1 || C2 || C3 and the DER sequence of OpenSSL with the
+// coordinates of C1, C3 and C2
+static bool rawToDer(const ByteString& raw, ByteString& der)
+{
+	if (raw.size() <= 1 + 3 * SM2_LEN || raw.const_byte_str()[0] != 0x04)
+	{
+		return false;
+	}
+
+	size_t c2Len = raw.size() - 1 - 3 * SM2_LEN;
+	const unsigned char* c2 = raw.const_byte_str() + 1 + 2 * SM2_LEN;
+	STACK_OF(ASN1_TYPE)* seq = sk_ASN1_TYPE_new_null();
+	bool ok = seq != NULL;
+
+	for (int i = 0; ok && i < 4; i++)
+	{
+		ASN1_TYPE* item = ASN1_TYPE_new();
+
+		if (item == NULL || !sk_ASN1_TYPE_push(seq, item))
+		{
+			ASN1_TYPE_free(item);
+			ok = false;
+			break;
+		}
+
+		if (i < 2)
+		{
+			BIGNUM* bn = BN_bin2bn(raw.const_byte_str() + 1 + i * SM2_LEN, SM2_LEN, NULL);
+			ASN1_INTEGER* value = bn != NULL ? BN_to_ASN1_INTEGER(bn, NULL) : NULL;
+
+			BN_free(bn);
+			ok = value != NULL;
+			if (ok) ASN1_TYPE_set(item, V_ASN1_INTEGER, value);
+		}
+		else
+		{
+			ASN1_OCTET_STRING* value = ASN1_OCTET_STRING_new();
+
+			ok = value != NULL && (i == 2 ? ASN1_OCTET_STRING_set(value, c2 + c2Len, SM2_LEN)
+						      : ASN1_OCTET_STRING_set(value, c2, c2Len));
+			if (ok) ASN1_TYPE_set(item, V_ASN1_OCTET_STRING, value);
+			else ASN1_OCTET_STRING_free(value);
+		}
+	}
+
+	unsigned char* buf = NULL;
+	int len = ok ? i2d_ASN1_SEQUENCE_ANY(seq, &buf) : -1;
+
+	if (len > 0)
+	{
+		der = ByteString(buf, len);
+		OPENSSL_free(buf);
+	}
+
+	sk_ASN1_TYPE_pop_free(seq, ASN1_TYPE_free);
+
+	return len > 0;
+}
+
+static bool derToRaw(const ByteString& der, ByteString& raw)
+{
+	const unsigned char* p = der.const_byte_str();
+	STACK_OF(ASN1_TYPE)* seq = d2i_ASN1_SEQUENCE_ANY(NULL, &p, der.size());
+	bool ok = seq != NULL && sk_ASN1_TYPE_num(seq) == 4;
+
+	unsigned char c1 = 0x04;
+	raw = ByteString(&c1, 1);
+
+	for (int i = 0; ok && i < 2; i++)
+	{
+		ASN1_TYPE* item = sk_ASN1_TYPE_value(seq, i);
+		BIGNUM* bn = item->type == V_ASN1_INTEGER ? ASN1_INTEGER_to_BN(item->value.integer, NULL) : NULL;
+
+		ok = bn != NULL;
+		if (ok) appendBn(raw, bn);
+		BN_free(bn);
+	}
+
+	if (ok)
+	{
+		ASN1_TYPE* c3 = sk_ASN1_TYPE_value(seq, 2);
+		ASN1_TYPE* c2 = sk_ASN1_TYPE_value(seq, 3);
+
+		ok = c3->type == V_ASN1_OCTET_STRING && c2->type == V_ASN1_OCTET_STRING &&
+		     ASN1_STRING_length(c3->value.octet_string) == SM2_LEN;
+
+		if (ok)
+		{
+			raw += ByteString(ASN1_STRING_get0_data(c2->value.octet_string), ASN1_STRING_length(c2->value.octet_string));
+			raw += ByteString(ASN1_STRING_get0_data(c3->value.octet_string), SM2_LEN);
+		}
+	}
+
+	sk_ASN1_TYPE_pop_free(seq, ASN1_TYPE_free);
+
+	return ok;
+}
+
+// Constructor
+MizaruSM2::MizaruSM2()
+{
+	pCurrentHash = NULL;
+}
+
+// Destructor
+MizaruSM2::~MizaruSM2()
+{
+	if (pCurrentHash != NULL)
+	{
+		delete pCurrentHash;
+	}
+}
+
+// Starts the SM3 hash of Z and the message for the key and signer ID
+bool MizaruSM2::hashInit(EC_KEY* key, const void* id, size_t idLen)
+{
+	ByteString signerID;
+
+	if (id != NULL && idLen > 0)
+	{
+		signerID = ByteString((const unsigned char*) id, idLen);
+	}
+	else
+	{
+		signerID = ByteString((const unsigned char*) defaultID, sizeof(defaultID) - 1);
+	}
+
+	ByteString input, z;
+
+	if (!zInput(key, signerID, input))
+	{
+		ERROR_MSG("Could not compute Z of the SM2 key");
+
+		return false;
+	}
+
+	pCurrentHash = CryptoFactory::i()->getHashAlgorithm(HashAlgo::SM3);
+
+	if (pCurrentHash == NULL ||
+	    !pCurrentHash->hashInit() || !pCurrentHash->hashUpdate(input) || !pCurrentHash->hashFinal(z) ||
+	    !pCurrentHash->hashInit() || !pCurrentHash->hashUpdate(z))
+	{
+		if (pCurrentHash != NULL)
+		{
+			delete pCurrentHash;
+			pCurrentHash = NULL;
+		}
+
+		return false;
+	}
+
+	return true;
+}
+
+// Signing functions
+bool MizaruSM2::sign(PrivateKey* privateKey, const ByteString& dataToSign,
+		     ByteString& signature, const AsymMech::Type mechanism,
+		     const void* param /* = NULL */, const size_t paramLen /* = 0 */)
+{
+	switch (mechanism)
+	{
+		case AsymMech::SM2:
+			return privateKey != NULL && signDigest(privateKey, dataToSign, signature);
+		case AsymMech::SM2_SM3:
+			return AsymmetricAlgorithm::sign(privateKey, dataToSign, signature, mechanism, param, paramLen);
+		default:
+			ERROR_MSG("Invalid mechanism supplied (%i)", mechanism);
+			return false;
+	}
+}
+
+bool MizaruSM2::signInit(PrivateKey* privateKey, const AsymMech::Type mechanism,
+			 const void* param /* = NULL */, const size_t paramLen /* = 0 */)
+{
+	if (!AsymmetricAlgorithm::signInit(privateKey, mechanism, param, paramLen))
+	{
+		return false;
+	}
+
+	if (mechanism != AsymMech::SM2_SM3 ||
+	    !privateKey->isOfType(OSSLECPrivateKey::type) ||
+	    !hashInit(((OSSLECPrivateKey*) privateKey)->getOSSLKey(), param, paramLen))
+	{
+		ERROR_MSG("Could not start an SM2 signature");
+
+		ByteString dummy;
+		AsymmetricAlgorithm::signFinal(dummy);
+
+		return false;
+	}
+
+	return true;
+}
+
+bool MizaruSM2::signUpdate(const ByteString& dataToSign)
+{
+	if (!AsymmetricAlgorithm::signUpdate(dataToSign))
+	{
+		return false;
+	}
+
+	if (!pCurrentHash->hashUpdate(dataToSign))
+	{
+		delete pCurrentHash;
+		pCurrentHash = NULL;
+
+		ByteString dummy;
+		AsymmetricAlgorithm::signFinal(dummy);
+
+		return false;
+	}
+
+	return true;
+}
+
+bool MizaruSM2::signFinal(ByteString& signature)
+{
+	// Save necessary state before calling super class signFinal
+	PrivateKey* privateKey = currentPrivateKey;
+
+	if (!AsymmetricAlgorithm::signFinal(signature))
+	{
+		return false;
+	}
+
+	ByteString digest;
+	bool ok = pCurrentHash->hashFinal(digest);
+
+	delete pCurrentHash;
+	pCurrentHash = NULL;
+
+	return ok && signDigest(privateKey, digest, signature);
+}
+
+// Signs a 32 byte digest, on the chip if possible
+bool MizaruSM2::signDigest(PrivateKey* privateKey, const ByteString& digest, ByteString& signature)
+{
+	if (digest.size() != SM2_LEN || !privateKey->isOfType(OSSLECPrivateKey::type))
+	{
+		ERROR_MSG("SM2 signs a %d byte digest with an EC key", SM2_LEN);
+
+		return false;
+	}
+
+	if (privateKey->isOfType(MizaruECPrivateKey::type) &&
+	    ((MizaruECPrivateKey*) privateKey)->getGroup() == NID_sm2 &&
+	    MizaruOffload::i()->useChip(MizaruOffload::SM2, privateKey->getBitLength()))
+	{
+		ByteString d = ((MizaruECPrivateKey*) privateKey)->getPaddedD();
+		ByteString r, s;
+		r.resize(SM2_LEN);
+		s.resize(SM2_LEN);
+
+		// The chip does not change its inputs
+		mizar_uint32 rv = MizaruDevicePool::i()->run([&]
+		{
+			return MizarSM2Sign(&d[0], 0, digest.size(), (mizar_uint8*) digest.const_byte_str(), &r[0], &s[0]);
+		});
+
+		if (rv == 0)
+		{
+			signature = r + s;
+
+			return true;
+		}
+
+		WARNING_MSG("SM2 signing on the Mizar chip failed (0x%08X), using OpenSSL", rv);
+
+		MizaruOffload::i()->fallBack(MizaruOffload::SM2);
+	}
+
+	EVP_PKEY* pkey = sm2Key(((OSSLECPrivateKey*) privateKey)->getOSSLKey());
+	EVP_PKEY_CTX* ctx = pkey != NULL ? EVP_PKEY_CTX_new(pkey, NULL) : NULL;
+	unsigned char der[128];
+	size_t derLen = sizeof(der);
+
+	bool ok = ctx != NULL &&
+		  EVP_PKEY_sign_init(ctx) == 1 &&
+		  EVP_PKEY_sign(ctx, der, &derLen, digest.const_byte_str(), digest.size()) == 1;
+
+	EVP_PKEY_CTX_free(ctx);
+	EVP_PKEY_free(pkey);
+
+	const unsigned char* p = der;
+	ECDSA_SIG* sig = ok ? d2i_ECDSA_SIG(NULL, &p, derLen) : NULL;
+
+	if (sig == NULL)
+	{
+		ERROR_MSG("SM2 signing failed");
+
+		return false;
+	}
+
+	signature.wipe();
+	appendBn(signature, ECDSA_SIG_get0_r(sig));
+	appendBn(signature, ECDSA_SIG_get0_s(sig));
+	ECDSA_SIG_free(sig);
+
+	return true;
+}
+
+// Verification functions
+bool MizaruSM2::verify(PublicKey* publicKey, const ByteString& originalData,
+		       const ByteString& signature, const AsymMech::Type mechanism,
+		       const void* param /* = NULL */, const size_t paramLen /* = 0 */)
+{
+	switch (mechanism)
+	{
+		case AsymMech::SM2:
+			return publicKey != NULL && verifyDigest(publicKey, originalData, signature);
+		case AsymMech::SM2_SM3:
+			return AsymmetricAlgorithm::verify(publicKey, originalData, signature, mechanism, param, paramLen);
+		default:
+			ERROR_MSG("Invalid mechanism supplied (%i)", mechanism);
+			return false;
+	}
+}
+
+bool MizaruSM2::verifyInit(PublicKey* publicKey, const AsymMech::Type mechanism,
+			   const void* param /* = NULL */, const size_t paramLen /* = 0 */)
+{
+	if (!AsymmetricAlgorithm::verifyInit(publicKey, mechanism, param, paramLen))
+	{
+		return false;
+	}
+
+	if (mechanism != AsymMech::SM2_SM3 ||
+	    !publicKey->isOfType(OSSLECPublicKey::type) ||
+	    !hashInit(((OSSLECPublicKey*) publicKey)->getOSSLKey(), param, paramLen))
+	{
+		ERROR_MSG("Could not start an SM2 verification");
+
+		ByteString dummy;
+		AsymmetricAlgorithm::verifyFinal(dummy);
+
+		return false;
+	}
+
+	return true;
+}
+
+bool MizaruSM2::verifyUpdate(const ByteString& originalData)
+{
+	if (!AsymmetricAlgorithm::verifyUpdate(originalData))
+	{
+		return false;
+	}
+
+	if (!pCurrentHash->hashUpdate(originalData))
+	{
+		delete pCurrentHash;
+		pCurrentHash = NULL;
+
+		ByteString dummy;
+		AsymmetricAlgorithm::verifyFinal(dummy);
+
+		return false;
+	}
+
+	return true;
+}
+
+bool MizaruSM2::verifyFinal(const ByteString& signature)
+{
+	// Save necessary state before calling super class verifyFinal
+	PublicKey* publicKey = currentPublicKey;
+
+	if (!AsymmetricAlgorithm::verifyFinal(signature))
+	{
+		return false;
+	}
+
+	ByteString digest;
+	bool ok = pCurrentHash->hashFinal(digest);
+
+	delete pCurrentHash;
+	pCurrentHash = NULL;
+
+	return ok && verifyDigest(publicKey, digest, signature);
+}
+
+// SM2 signatures are verified one at a time
+bool MizaruSM2::verifyBatch(std::vector<AsymVerifyItem>& items, const AsymMech::Type mechanism)
+{
+	return AsymmetricAlgorithm::verifyBatch(items, mechanism);
+}
+
+// Verifies a 32 byte digest, on the chip if possible
+bool MizaruSM2::verifyDigest(PublicKey* publicKey, const ByteString& digest, const ByteString& signature)
+{
+	if (digest.size() != SM2_LEN || signature.size() != 2 * SM2_LEN || !publicKey->isOfType(OSSLECPublicKey::type))
+	{
+		return false;
+	}
+
+	if (publicKey->isOfType(MizaruECPublicKey::type))
+	{
+		MizaruECPublicKey* pk = (MizaruECPublicKey*) publicKey;
+
+		if (pk->getGroup() == NID_sm2 && pk->getX().size() == SM2_LEN &&
+		    MizaruOffload::i()->useChip(MizaruOffload::SM2, pk->getBitLength()))
+		{
+			// The chip does not change its inputs
+			mizar_uint8* sig = (mizar_uint8*) signature.const_byte_str();
+			mizar_uint32 rv = MizaruDevicePool::i()->run([&]
+			{
+				return MizarSM2Verify(0, (mizar_uint8*) pk->getX().const_byte_str(), (mizar_uint8*) pk->getY().const_byte_str(),
+						      sig, sig + SM2_LEN, digest.size(), (mizar_uint8*) digest.const_byte_str());
+			});
+
+			if (rv == 0 || rv == ERR_CALC)
+			{
+				return rv == 0;
+			}
+
+			WARNING_MSG("SM2 verification on the Mizar chip failed (0x%08X), using OpenSSL", rv);
+
+			MizaruOffload::i()->fallBack(MizaruOffload::SM2);
+		}
+	}
+
+	ECDSA_SIG* sig = ECDSA_SIG_new();
+	BIGNUM* r = BN_bin2bn(signature.const_byte_str(), SM2_LEN, NULL);
+	BIGNUM* s = BN_bin2bn(signature.const_byte_str() + SM2_LEN, SM2_LEN, NULL);
+
+	if (sig == NULL || r == NULL || s == NULL || !ECDSA_SIG_set0(sig, r, s))
+	{
+		ECDSA_SIG_free(sig);
+		BN_free(r);
+		BN_free(s);
+
+		return false;
+	}
+
+	unsigned char* der = NULL;
+	int derLen = i2d_ECDSA_SIG(sig, &der);
+	ECDSA_SIG_free(sig);
+
+	EVP_PKEY* pkey = sm2Key(((OSSLECPublicKey*) publicKey)->getOSSLKey());
+	EVP_PKEY_CTX* ctx = pkey != NULL ? EVP_PKEY_CTX_new(pkey, NULL) : NULL;
+
+	bool ok = ctx != NULL && derLen > 0 &&
+		  EVP_PKEY_verify_init(ctx) == 1 &&
+		  EVP_PKEY_verify(ctx, der, derLen, digest.const_byte_str(), digest.size()) == 1;
+
+	OPENSSL_free(der);
+	EVP_PKEY_CTX_free(ctx);
+	EVP_PKEY_free(pkey);
+
+	return ok;
+}
+
+// Encryption functions
+bool MizaruSM2::encrypt(PublicKey* publicKey, const ByteString& data,
+			ByteString& encryptedData, const AsymMech::Type padding)
+{
+	if (padding != AsymMech::SM2_ENCRYPT || publicKey == NULL || !publicKey->isOfType(OSSLECPublicKey::type) || data.size() == 0)
+	{
+		ERROR_MSG("Invalid SM2 encryption");
+
+		return false;
+	}
+
+	if (publicKey->isOfType(MizaruECPublicKey::type))
+	{
+		MizaruECPublicKey* pk = (MizaruECPublicKey*) publicKey;
+
+		if (pk->getGroup() == NID_sm2 && pk->getX().size() == SM2_LEN &&
+		    data.size() <= SM2_MAX_CHIP_DATA &&
+		    MizaruOffload::i()->useChip(MizaruOffload::SM2, pk->getBitLength()))
+		{
+			encryptedData.resize(1 + 3 * SM2_LEN + data.size());
+			mizar_uint32 outLen = encryptedData.size();
+
+			// The chip does not change its inputs
+			mizar_uint32 rv = MizaruDevicePool::i()->run([&]
+			{
+				return MizarSM2PkEnc((mizar_uint8*) pk->getX().const_byte_str(), (mizar_uint8*) pk->getY().const_byte_str(),
+						     data.size(), (mizar_uint8*) data.const_byte_str(), &outLen, &encryptedData[0]);
+			});
+
+			if (rv == 0 && outLen == encryptedData.size())
+			{
+				return true;
+			}
+
+			WARNING_MSG("SM2 encryption on the Mizar chip failed (0x%08X), using OpenSSL", rv);
+
+			MizaruOffload::i()->fallBack(MizaruOffload::SM2);
+		}
+	}
+
+	EVP_PKEY* pkey = sm2Key(((OSSLECPublicKey*) publicKey)->getOSSLKey());
+	EVP_PKEY_CTX* ctx = pkey != NULL ? EVP_PKEY_CTX_new(pkey, NULL) : NULL;
+	ByteString der;
+	size_t derLen = 0;
+
+	bool ok = ctx != NULL &&
+		  EVP_PKEY_encrypt_init(ctx) == 1 &&
+		  EVP_PKEY_encrypt(ctx, NULL, &derLen, data.const_byte_str(), data.size()) == 1;
+
+	if (ok)
+	{
+		der.resize(derLen);
+		ok = EVP_PKEY_encrypt(ctx, &der[0], &derLen, data.const_byte_str(), data.size()) == 1;
+		der.resize(derLen);
+	}
+
+	EVP_PKEY_CTX_free(ctx);
+	EVP_PKEY_free(pkey);
+
+	if (!ok || !derToRaw(der, encryptedData))
+	{
+		ERROR_MSG("SM2 encryption failed");
+
+		return false;
+	}
+
+	return true;
+}
+
+// Decryption functions
+bool MizaruSM2::decrypt(PrivateKey* privateKey, const ByteString& encryptedData,
+			ByteString& data, const AsymMech::Type padding)
+{
+	if (padding != AsymMech::SM2_ENCRYPT || privateKey == NULL || !privateKey->isOfType(OSSLECPrivateKey::type) ||
+	    encryptedData.size() <= 1 + 3 * SM2_LEN)
+	{
+		ERROR_MSG("Invalid SM2 decryption");
+
+		return false;
+	}
+
+	if (privateKey->isOfType(MizaruECPrivateKey::type) &&
+	    ((MizaruECPrivateKey*) privateKey)->getGroup() == NID_sm2 &&
+	    encryptedData.size() <= 1 + 3 * SM2_LEN + SM2_MAX_CHIP_DATA &&
+	    MizaruOffload::i()->useChip(MizaruOffload::SM2, privateKey->getBitLength()))
+	{
+		ByteString d = ((MizaruECPrivateKey*) privateKey)->getPaddedD();
+		data.resize(encryptedData.size() - 1 - 3 * SM2_LEN);
+		mizar_uint32 outLen = data.size();
+
+		// The chip does not change its inputs
+		mizar_uint32 rv = MizaruDevicePool::i()->run([&]
+		{
+			return MizarSM2SkDec(&d[0], encryptedData.size(), (mizar_uint8*) encryptedData.const_byte_str(), &outLen, &data[0]);
+		});
+
+		if (rv == 0 && outLen == data.size())
+		{
+			return true;
+		}
+
+		WARNING_MSG("SM2 decryption on the Mizar chip failed (0x%08X), using OpenSSL", rv);
+
+		MizaruOffload::i()->fallBack(MizaruOffload::SM2);
+	}
+
+	ByteString der;
+
+	if (!rawToDer(encryptedData, der))
+	{
+		ERROR_MSG("Invalid SM2 ciphertext");
+
+		return false;
+	}
+
+	EVP_PKEY* pkey = sm2Key(((OSSLECPrivateKey*) privateKey)->getOSSLKey());
+	EVP_PKEY_CTX* ctx = pkey != NULL ? EVP_PKEY_CTX_new(pkey, NULL) : NULL;
+	size_t dataLen = der.size();
+
+	data.resize(dataLen);
+
+	bool ok = ctx != NULL &&
+		  EVP_PKEY_decrypt_init(ctx) == 1 &&
+		  EVP_PKEY_decrypt(ctx, &data[0], &dataLen, der.const_byte_str(), der.size()) == 1;
+
+	EVP_PKEY_CTX_free(ctx);
+	EVP_PKEY_free(pkey);
+
+	if (!ok)
+	{
+		ERROR_MSG("SM2 decryption failed");
+
+		data.wipe();
+
+		return false;
+	}
+
+	data.resize(dataLen);
+
+	return true;
+}
+
+// Key factory
+bool MizaruSM2::generateKeyPair(AsymmetricKeyPair** ppKeyPair, AsymmetricParameters* parameters, RNG* rng /* = NULL */)
+{
+	if (parameters == NULL || !parameters->areOfType(ECParameters::type))
+	{
+		ERROR_MSG("Invalid parameters supplied for SM2 key generation");
+
+		return false;
+	}
+
+	EC_GROUP* grp = OSSL::byteString2grp(((ECParameters*) parameters)->getEC());
+	bool sm2 = grp != NULL && EC_GROUP_get_curve_name(grp) == NID_sm2;
+	EC_GROUP_free(grp);
+
+	if (!sm2)
+	{
+		ERROR_MSG("SM2 keys are on the SM2 curve");
+
+		return false;
+	}
+
+	return MizaruECDSA::generateKeyPair(ppKeyPair, parameters, rng);
+}
+
+unsigned long MizaruSM2::getMinKeySize()
+{
+	return 256;
+}
+
+unsigned long MizaruSM2::getMaxKeySize()
+{
+	return 256;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruSM2.h
+
+ Mizaru SM2 asymmetric algorithm implementation (GB/T 32918). Keys are EC
+ keys on the SM2 curve. A signature is over a 32 byte digest, or with SM3
+ over the message and the signer ID; the ciphertext is C1 || C2 || C3 with
+ an uncompressed C1. The chip is used from the crossover key size on;
+ OpenSSL does everything else.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_MIZARUSM2_H
+#define _SOFTHSM_V2_MIZARUSM2_H
+
+#include "config.h"
+#include "MizaruECDSA.h"
+#include "HashAlgorithm.h"
+#include <openssl/ec.h>
+
+class MizaruSM2 : public MizaruECDSA
+{
+public:
+	// Constructor
+	MizaruSM2();
+
+	// Destructor
+	virtual ~MizaruSM2();
+
+	// Signing functions
+	virtual bool sign(PrivateKey* privateKey, const ByteString& dataToSign, ByteString& signature, const AsymMech::Type mechanism, const void* param = NULL, const size_t paramLen = 0);
+	virtual bool signInit(PrivateKey* privateKey, const AsymMech::Type mechanism, const void* param = NULL, const size_t paramLen = 0);
+	virtual bool signUpdate(const ByteString& dataToSign);
+	virtual bool signFinal(ByteString& signature);
+
+	// Verification functions
+	virtual bool verify(PublicKey* publicKey, const ByteString& originalData, const ByteString& signature, const AsymMech::Type mechanism, const void* param = NULL, const size_t paramLen = 0);
+	virtual bool verifyInit(PublicKey* publicKey, const AsymMech::Type mechanism, const void* param = NULL, const size_t paramLen = 0);
+	virtual bool verifyUpdate(const ByteString& originalData);
+	virtual bool verifyFinal(const ByteString& signature);
+	virtual bool verifyBatch(std::vector<AsymVerifyItem>& items, const AsymMech::Type mechanism);
+
+	// Encryption functions
+	virtual bool encrypt(PublicKey* publicKey, const ByteString& data, ByteString& encryptedData, const AsymMech::Type padding);
+
+	// Decryption functions
+	virtual bool decrypt(PrivateKey* privateKey, const ByteString& encryptedData, ByteString& data, const AsymMech::Type padding);
+
+	// Key factory
+	virtual bool generateKeyPair(AsymmetricKeyPair** ppKeyPair, AsymmetricParameters* parameters, RNG* rng = NULL);
+	virtual unsigned long getMinKeySize();
+	virtual unsigned long getMaxKeySize();
+
+private:
+	// Starts the SM3 hash of Z and the message for the key and signer ID
+	bool hashInit(EC_KEY* key, const void* id, size_t idLen);
+
+	// Signs or verifies a 32 byte digest, on the chip if possible
+	bool signDigest(PrivateKey* privateKey, const ByteString& digest, ByteString& signature);
+	bool verifyDigest(PublicKey* publicKey, const ByteString& digest, const ByteString& signature);
+
+	// The hash of a signature with SM3
+	HashAlgorithm* pCurrentHash;
+};
+
+#endif // !_SOFTHSM_V2_MIZARUSM2_H
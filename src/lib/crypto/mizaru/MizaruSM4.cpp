@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruSM4.cpp
+
+ Mizaru SM4 implementation
+ *****************************************************************************/
+
+#include "config.h"
+#include "MizaruSM4.h"
+#include "MizaruDevicePool.h"
+#include "MizaruOffload.h"
+#include "mizar_api.h"
+
+bool MizaruSM4::wrapKey(const SymmetricKey* /*key*/, const SymWrap::Type /*mode*/, const ByteString& /*in*/, ByteString& /*out*/)
+{
+	ERROR_MSG("SM4 does not support key wrapping");
+
+	return false;
+}
+
+bool MizaruSM4::unwrapKey(const SymmetricKey* /*key*/, const SymWrap::Type /*mode*/, const ByteString& /*in*/, ByteString& /*out*/)
+{
+	ERROR_MSG("SM4 does not support key unwrapping");
+
+	return false;
+}
+
+const EVP_CIPHER* MizaruSM4::getCipher() const
+{
+	if (currentKey == NULL) return NULL;
+
+	// SM4 only supports 128-bit keys
+	if (currentKey->getBitLen() != 128)
+	{
+		ERROR_MSG("Invalid SM4 currentKey length (%d bits)", currentKey->getBitLen());
+
+		return NULL;
+	}
+
+	// Determine the cipher mode
+	switch (currentCipherMode)
+	{
+		case SymMode::ECB:
+			return EVP_sm4_ecb();
+		case SymMode::CBC:
+			return EVP_sm4_cbc();
+		case SymMode::OFB:
+			return EVP_sm4_ofb();
+		case SymMode::CTR:
+			return EVP_sm4_ctr();
+		default:
+			break;
+	};
+
+	ERROR_MSG("Invalid SM4 cipher mode %i", currentCipherMode);
+
+	return NULL;
+}
+
+size_t MizaruSM4::getBlockSize() const
+{
+	// The block size is 128 bits
+	return 128 >> 3;
+}
+
+// Runs whole ECB or CBC blocks on the chip
+bool MizaruSM4::chipCrypt(bool encrypt, SymMode::Type mode, const ByteString& iv, const ByteString& in, ByteString& out)
+{
+	if (!MizaruOffload::i()->useChip(MizaruOffload::SM4, in.size()))
+	{
+		return false;
+	}
+
+	// The chip does not change its inputs
+	mizar_uint8* key = (mizar_uint8*) currentKey->getKeyBits().const_byte_str();
+	mizar_uint8* data = (mizar_uint8*) in.const_byte_str();
+	mizar_uint8* chainIV = (mizar_uint8*) iv.const_byte_str();
+	mizar_uint32 mizarMode = encrypt ? 0 : 1;
+
+	out.resize(in.size());
+	mizar_uint32 outLen = out.size();
+	mizar_uint32 rv;
+
+	if (mode == SymMode::ECB)
+	{
+		rv = MizaruDevicePool::i()->run([&] { return MizarSM4Ecb(mizarMode, key, in.size(), data, &outLen, &out[0]); });
+	}
+	else
+	{
+		rv = MizaruDevicePool::i()->run([&] { return MizarSM4Modes(mizarMode, 0, chainIV, key, in.size(), data, &outLen, &out[0]); });
+	}
+
+	if (rv != 0 || outLen != in.size())
+	{
+		WARNING_MSG("SM4 operation on the Mizar chip failed (0x%08X), using OpenSSL", rv);
+
+		MizaruOffload::i()->fallBack(MizaruOffload::SM4);
+
+		return false;
+	}
+
+	return true;
+}
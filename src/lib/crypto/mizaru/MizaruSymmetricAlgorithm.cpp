@@ -37,6 +37,7 @@
 #include "OSSLUtil.h"
 #include "salloc.h"
 #include <openssl/err.h>
+#include <string.h>
 
 // Constructor
 MizaruSymmetricAlgorithm::MizaruSymmetricAlgorithm()
@@ -44,6 +45,7 @@ MizaruSymmetricAlgorithm::MizaruSymmetricAlgorithm()
 	pCurCTX = NULL;
 	maximumBytes = NULL;
 	counterBytes = NULL;
+	blockMode = SymMode::Unknown;
 }
 
 // Destructor
@@ -104,6 +106,12 @@ void MizaruSymmetricAlgorithm::clean()
 		maximumBytes = NULL;
 		BN_free(counterBytes);
 		counterBytes = NULL;
+		blockMode = SymMode::Unknown;
+		blockIV.wipe();
+		pending.wipe();
+		ccmNonce.wipe();
+		ccmAAD.wipe();
+		ccmData.wipe();
 }
 
 // Encryption functions
@@ -116,7 +124,7 @@ bool MizaruSymmetricAlgorithm::encryptInit(const SymmetricKey* key, const SymMod
 	}
 
 	// Check the IV
-	if (mode != SymMode::GCM && (IV.size() > 0) && (IV.size() != getBlockSize()))
+	if (mode != SymMode::GCM && mode != SymMode::CCM && (IV.size() > 0) && (IV.size() != getBlockSize()))
 	{
 		ERROR_MSG("Invalid IV size (%d bytes, expected %d bytes)", IV.size(), getBlockSize());
 
@@ -126,6 +134,26 @@ bool MizaruSymmetricAlgorithm::encryptInit(const SymmetricKey* key, const SymMod
 		return false;
 	}
 
+	// CCM is run at the end, when the length of the data is known
+	if (mode == SymMode::CCM)
+	{
+		if (getCipher() == NULL || IV.size() < 7 || IV.size() > 13)
+		{
+			ERROR_MSG("Failed to initialise CCM encrypt operation");
+
+			ByteString dummy;
+			SymmetricAlgorithm::encryptFinal(dummy);
+
+			return false;
+		}
+
+		ccmNonce = IV;
+		ccmAAD = aad;
+		ccmData.wipe();
+
+		return true;
+	}
+
 	ByteString iv;
 
 	if (IV.size() > 0)
@@ -193,7 +221,15 @@ bool MizaruSymmetricAlgorithm::encryptInit(const SymmetricKey* key, const SymMod
 		return false;
 	}
 
-	EVP_CIPHER_CTX_set_padding(pCurCTX, padding ? 1 : 0);
+	// The host pads in ECB and CBC mode
+	if (mode == SymMode::ECB || mode == SymMode::CBC)
+	{
+		blockMode = mode;
+		blockIV = iv;
+		pending.wipe();
+	}
+
+	EVP_CIPHER_CTX_set_padding(pCurCTX, padding && blockMode == SymMode::Unknown ? 1 : 0);
 
 	if (mode == SymMode::GCM)
 	{
@@ -222,6 +258,19 @@ bool MizaruSymmetricAlgorithm::encryptUpdate(const ByteString& data, ByteString&
 		return false;
 	}
 
+	if (blockMode != SymMode::Unknown)
+	{
+		return blockEncryptUpdate(data, encryptedData);
+	}
+
+	if (currentCipherMode == SymMode::CCM)
+	{
+		ccmData += data;
+		encryptedData.wipe();
+
+		return true;
+	}
+
 	if (data.size() == 0)
 	{
 		encryptedData.resize(0);
@@ -260,6 +309,28 @@ bool MizaruSymmetricAlgorithm::encryptUpdate(const ByteString& data, ByteString&
 
 bool MizaruSymmetricAlgorithm::encryptFinal(ByteString& encryptedData)
 {
+	if (blockMode != SymMode::Unknown && currentOperation == ENCRYPT)
+	{
+		bool rv = blockEncryptFinal(encryptedData);
+
+		ByteString dummy;
+		SymmetricAlgorithm::encryptFinal(dummy);
+		clean();
+
+		return rv;
+	}
+
+	if (currentCipherMode == SymMode::CCM && currentOperation == ENCRYPT)
+	{
+		bool rv = ccmCrypt(true, ccmData, currentTagBytes, encryptedData);
+
+		ByteString dummy;
+		SymmetricAlgorithm::encryptFinal(dummy);
+		clean();
+
+		return rv;
+	}
+
 	SymMode::Type mode = currentCipherMode;
 	size_t tagBytes = currentTagBytes;
 
@@ -309,7 +380,7 @@ bool MizaruSymmetricAlgorithm::decryptInit(const SymmetricKey* key, const SymMod
 	}
 
 	// Check the IV
-	if (mode != SymMode::GCM && (IV.size() > 0) && (IV.size() != getBlockSize()))
+	if (mode != SymMode::GCM && mode != SymMode::CCM && (IV.size() > 0) && (IV.size() != getBlockSize()))
 	{
 		ERROR_MSG("Invalid IV size (%d bytes, expected %d bytes)", IV.size(), getBlockSize());
 
@@ -319,6 +390,26 @@ bool MizaruSymmetricAlgorithm::decryptInit(const SymmetricKey* key, const SymMod
 		return false;
 	}
 
+	// CCM is run at the end, when the length of the data is known
+	if (mode == SymMode::CCM)
+	{
+		if (getCipher() == NULL || IV.size() < 7 || IV.size() > 13)
+		{
+			ERROR_MSG("Failed to initialise CCM decrypt operation");
+
+			ByteString dummy;
+			SymmetricAlgorithm::decryptFinal(dummy);
+
+			return false;
+		}
+
+		ccmNonce = IV;
+		ccmAAD = aad;
+		ccmData.wipe();
+
+		return true;
+	}
+
 	ByteString iv;
 
 	if (IV.size() > 0)
@@ -386,7 +477,15 @@ bool MizaruSymmetricAlgorithm::decryptInit(const SymmetricKey* key, const SymMod
 		return false;
 	}
 
-	EVP_CIPHER_CTX_set_padding(pCurCTX, padding ? 1 : 0);
+	// The host pads in ECB and CBC mode
+	if (mode == SymMode::ECB || mode == SymMode::CBC)
+	{
+		blockMode = mode;
+		blockIV = iv;
+		pending.wipe();
+	}
+
+	EVP_CIPHER_CTX_set_padding(pCurCTX, padding && blockMode == SymMode::Unknown ? 1 : 0);
 
 	if (mode == SymMode::GCM)
 	{
@@ -415,8 +514,13 @@ bool MizaruSymmetricAlgorithm::decryptUpdate(const ByteString& encryptedData, By
 		return false;
 	}
 
+	if (blockMode != SymMode::Unknown)
+	{
+		return blockDecryptUpdate(encryptedData, data);
+	}
+
 	// AEAD ciphers should not return decrypted data until final is called
-	if (currentCipherMode == SymMode::GCM)
+	if (currentCipherMode == SymMode::GCM || currentCipherMode == SymMode::CCM)
 	{
 		data.resize(0);
 		return true;
@@ -458,6 +562,28 @@ bool MizaruSymmetricAlgorithm::decryptUpdate(const ByteString& encryptedData, By
 
 bool MizaruSymmetricAlgorithm::decryptFinal(ByteString& data)
 {
+	if (blockMode != SymMode::Unknown && currentOperation == DECRYPT)
+	{
+		bool rv = blockDecryptFinal(data);
+
+		ByteString dummy;
+		SymmetricAlgorithm::decryptFinal(dummy);
+		clean();
+
+		return rv;
+	}
+
+	if (currentCipherMode == SymMode::CCM && currentOperation == DECRYPT)
+	{
+		bool rv = ccmCrypt(false, currentAEADBuffer, currentTagBytes, data);
+
+		ByteString dummy;
+		SymmetricAlgorithm::decryptFinal(dummy);
+		clean();
+
+		return rv;
+	}
+
 	SymMode::Type mode = currentCipherMode;
 	size_t tagBytes = currentTagBytes;
 	ByteString aeadBuffer = currentAEADBuffer;
@@ -524,6 +650,181 @@ bool MizaruSymmetricAlgorithm::decryptFinal(ByteString& data)
 	return true;
 }
 
+// Whole blocks are left to OpenSSL unless an algorithm can use the chip
+bool MizaruSymmetricAlgorithm::chipCrypt(bool /*encrypt*/, SymMode::Type /*mode*/, const ByteString& /*iv*/, const ByteString& /*in*/, ByteString& /*out*/)
+{
+	return false;
+}
+
+// CCM is left to OpenSSL unless an algorithm can use the chip
+bool MizaruSymmetricAlgorithm::chipCcm(bool /*encrypt*/, const ByteString& /*nonce*/, const ByteString& /*aad*/, size_t /*tagBytes*/, const ByteString& /*in*/, ByteString& /*out*/)
+{
+	return false;
+}
+
+// Runs whole blocks through the chip or OpenSSL and chains the IV
+bool MizaruSymmetricAlgorithm::cryptBlocks(bool encrypt, const ByteString& in, ByteString& out)
+{
+	if (in.size() == 0)
+	{
+		out.wipe();
+
+		return true;
+	}
+
+	if (!chipCrypt(encrypt, blockMode, blockIV, in, out))
+	{
+		// The chip may have run the earlier parts, so OpenSSL gets the IV again
+		out.resize(in.size());
+
+		int outLen = 0;
+
+		if ((blockMode == SymMode::CBC && !EVP_CipherInit_ex(pCurCTX, NULL, NULL, NULL, blockIV.const_byte_str(), -1)) ||
+		    !EVP_CipherUpdate(pCurCTX, &out[0], &outLen, in.const_byte_str(), in.size()) ||
+		    (size_t) outLen != in.size())
+		{
+			ERROR_MSG("EVP_CipherUpdate failed: %s", ERR_error_string(ERR_get_error(), NULL));
+
+			return false;
+		}
+	}
+
+	// The next IV is the last ciphertext block
+	if (blockMode == SymMode::CBC)
+	{
+		const ByteString& cipherText = encrypt ? out : in;
+
+		blockIV = cipherText.substr(cipherText.size() - getBlockSize());
+	}
+
+	return true;
+}
+
+bool MizaruSymmetricAlgorithm::blockEncryptUpdate(const ByteString& data, ByteString& encryptedData)
+{
+	pending += data;
+
+	size_t whole = pending.size() - pending.size() % getBlockSize();
+
+	if (!cryptBlocks(true, pending.substr(0, whole), encryptedData))
+	{
+		clean();
+
+		ByteString dummy;
+		SymmetricAlgorithm::encryptFinal(dummy);
+
+		return false;
+	}
+
+	pending.split(whole);
+	currentBufferSize = pending.size();
+
+	return true;
+}
+
+bool MizaruSymmetricAlgorithm::blockEncryptFinal(ByteString& encryptedData)
+{
+	size_t blockSize = getBlockSize();
+	ByteString last = pending;
+
+	encryptedData.wipe();
+
+	if (currentPaddingMode)
+	{
+		// PKCS #7 padding, a whole block if the data is block aligned
+		size_t padLen = blockSize - last.size();
+
+		last.resize(blockSize);
+		memset(&last[blockSize - padLen], (int) padLen, padLen);
+	}
+	else if (last.size() != 0)
+	{
+		ERROR_MSG("Data is not a multiple of the block size");
+
+		return false;
+	}
+
+	return cryptBlocks(true, last, encryptedData);
+}
+
+bool MizaruSymmetricAlgorithm::blockDecryptUpdate(const ByteString& encryptedData, ByteString& data)
+{
+	size_t blockSize = getBlockSize();
+
+	// Only the padding check needs the data of earlier parts
+	currentAEADBuffer.wipe();
+	pending += encryptedData;
+
+	size_t whole = pending.size() - pending.size() % blockSize;
+
+	// Hold back the last block, it may contain the padding
+	if (currentPaddingMode && whole == pending.size() && whole > 0)
+	{
+		whole -= blockSize;
+	}
+
+	if (!cryptBlocks(false, pending.substr(0, whole), data))
+	{
+		clean();
+
+		ByteString dummy;
+		SymmetricAlgorithm::decryptFinal(dummy);
+
+		return false;
+	}
+
+	pending.split(whole);
+	currentBufferSize = pending.size();
+
+	return true;
+}
+
+bool MizaruSymmetricAlgorithm::blockDecryptFinal(ByteString& data)
+{
+	size_t blockSize = getBlockSize();
+	ByteString last = pending;
+
+	data.wipe();
+
+	if (last.size() % blockSize != 0 || (currentPaddingMode && last.size() != blockSize))
+	{
+		ERROR_MSG("Encrypted data is not a multiple of the block size");
+
+		return false;
+	}
+
+	if (!cryptBlocks(false, last, data))
+	{
+		return false;
+	}
+
+	if (!currentPaddingMode)
+	{
+		return true;
+	}
+
+	// Remove and check the PKCS #7 padding
+	size_t padLen = data[blockSize - 1];
+	bool valid = padLen > 0 && padLen <= blockSize;
+
+	for (size_t i = 0; valid && i < padLen; i++)
+	{
+		valid = data[blockSize - 1 - i] == padLen;
+	}
+
+	if (!valid)
+	{
+		ERROR_MSG("Invalid padding");
+		data.wipe();
+
+		return false;
+	}
+
+	data.resize(blockSize - padLen);
+
+	return true;
+}
+
 // Check if more bytes of data can be encrypted
 bool MizaruSymmetricAlgorithm::checkMaximumBytes(unsigned long bytes)
 {
@@ -540,3 +841,86 @@ bool MizaruSymmetricAlgorithm::checkMaximumBytes(unsigned long bytes)
 
 	return rv;
 }
+
+// Runs the buffered CCM data through the chip or OpenSSL
+bool MizaruSymmetricAlgorithm::ccmCrypt(bool encrypt, const ByteString& in, size_t tagBytes, ByteString& out)
+{
+	out.wipe();
+
+	if (!encrypt && in.size() < tagBytes)
+	{
+		ERROR_MSG("Tag bytes (%d) does not fit in AEAD buffer (%d)", tagBytes, in.size());
+
+		return false;
+	}
+
+	if (chipCcm(encrypt, ccmNonce, ccmAAD, tagBytes, in, out))
+	{
+		return true;
+	}
+
+	const EVP_CIPHER* cipher = getCipher();
+	EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+
+	if (cipher == NULL || ctx == NULL)
+	{
+		ERROR_MSG("Failed to initialise EVP CCM operation");
+
+		EVP_CIPHER_CTX_free(ctx);
+
+		return false;
+	}
+
+	// OpenSSL wants the nonce and tag length, then the data length, then
+	// the AAD and the data in one update
+	size_t dataLen = encrypt ? in.size() : in.size() - tagBytes;
+	unsigned char empty = 0;
+	const unsigned char* inData = dataLen > 0 ? in.const_byte_str() : &empty;
+	int outLen = 0;
+
+	out.resize(dataLen + (encrypt ? tagBytes : 0));
+	unsigned char* outData = out.size() > 0 ? &out[0] : &empty;
+
+	int rv = EVP_CipherInit_ex(ctx, cipher, NULL, NULL, NULL, encrypt ? 1 : 0) &&
+		 EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_CCM_SET_IVLEN, ccmNonce.size(), NULL) &&
+		 EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_CCM_SET_TAG, tagBytes, encrypt ? NULL : (void*) (in.const_byte_str() + dataLen)) &&
+		 EVP_CipherInit_ex(ctx, NULL, NULL, currentKey->getKeyBits().const_byte_str(), ccmNonce.const_byte_str(), -1) &&
+		 EVP_CipherUpdate(ctx, NULL, &outLen, NULL, dataLen) &&
+		 (ccmAAD.size() == 0 || EVP_CipherUpdate(ctx, NULL, &outLen, ccmAAD.const_byte_str(), ccmAAD.size()));
+
+	if (!rv)
+	{
+		ERROR_MSG("Failed to initialise EVP CCM operation: %s", ERR_error_string(ERR_get_error(), NULL));
+
+		EVP_CIPHER_CTX_free(ctx);
+		out.wipe();
+
+		return false;
+	}
+
+	// Decryption fails here if the tag does not match
+	if (EVP_CipherUpdate(ctx, outData, &outLen, inData, dataLen) <= 0)
+	{
+		ERROR_MSG("EVP_CipherUpdate failed: %s", ERR_error_string(ERR_get_error(), NULL));
+
+		EVP_CIPHER_CTX_free(ctx);
+		out.wipe();
+
+		return false;
+	}
+
+	if (encrypt && (EVP_CipherFinal_ex(ctx, outData + dataLen, &outLen) <= 0 ||
+			EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_CCM_GET_TAG, tagBytes, &out[dataLen]) <= 0))
+	{
+		ERROR_MSG("Failed to get the CCM tag: %s", ERR_error_string(ERR_get_error(), NULL));
+
+		EVP_CIPHER_CTX_free(ctx);
+		out.wipe();
+
+		return false;
+	}
+
+	EVP_CIPHER_CTX_free(ctx);
+
+	return true;
+}
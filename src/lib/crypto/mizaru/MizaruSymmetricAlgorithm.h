@@ -27,7 +27,10 @@
 /*****************************************************************************
  MizaruSymmetricAlgorithm.h
 
- OpenSSL symmetric algorithm implementation
+ Mizaru symmetric algorithm implementation. ECB and CBC are buffered and
+ padded on the host, so that each part of the data can be run by the chip
+ or by OpenSSL. CCM needs the length of the data up front and is run at the
+ end, on the chip or by OpenSSL; the other modes are left to OpenSSL.
  *****************************************************************************/
 
 #ifndef _SOFTHSM_V2_MIZARUSYMMETRICALGORITHM_H
@@ -68,16 +71,51 @@ protected:
 	// Return the right EVP cipher for the operation
 	virtual const EVP_CIPHER* getCipher() const = 0;
 
+	// Runs whole blocks of an ECB or CBC operation with the current key on
+	// the chip. Returns false to leave them to OpenSSL.
+	virtual bool chipCrypt(bool encrypt, SymMode::Type mode, const ByteString& iv, const ByteString& in, ByteString& out);
+
+	// Runs a whole CCM operation with the current key on the chip; the
+	// tag follows the ciphertext. Returns false to leave it to OpenSSL.
+	virtual bool chipCcm(bool encrypt, const ByteString& nonce, const ByteString& aad, size_t tagBytes, const ByteString& in, ByteString& out);
+
 private:
 	void counterBitsInit(const ByteString& IV, size_t counterBits);
 	void clean();
 
+	// Host buffering and padding of ECB and CBC
+	bool blockEncryptUpdate(const ByteString& data, ByteString& encryptedData);
+	bool blockEncryptFinal(ByteString& encryptedData);
+	bool blockDecryptUpdate(const ByteString& encryptedData, ByteString& data);
+	bool blockDecryptFinal(ByteString& data);
+
+	// Runs whole blocks through the chip or OpenSSL and chains the IV
+	bool cryptBlocks(bool encrypt, const ByteString& in, ByteString& out);
+
+	// Runs the buffered CCM data through the chip or OpenSSL
+	bool ccmCrypt(bool encrypt, const ByteString& in, size_t tagBytes, ByteString& out);
+
 	// The current EVP context
 	EVP_CIPHER_CTX* pCurCTX;
 
 	// The maximum bytes to encrypt/decrypt
 	BIGNUM* maximumBytes;
 	BIGNUM* counterBytes;
+
+	// ECB or CBC if the host does the buffering, otherwise Unknown
+	SymMode::Type blockMode;
+
+	// The chained IV in CBC mode
+	ByteString blockIV;
+
+	// Data that does not yet fill a block
+	ByteString pending;
+
+	// The nonce and AAD of a CCM operation, and the plaintext to encrypt;
+	// the ciphertext to decrypt is in the AEAD buffer
+	ByteString ccmNonce;
+	ByteString ccmAAD;
+	ByteString ccmData;
 };
 
 #endif // !_SOFTHSM_V2_MIZARUSYMMETRICALGORITHM_H
@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruZUC.cpp
+
+ Mizaru ZUC implementation
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "MizaruZUC.h"
+#include "MizaruDevicePool.h"
+#include "mizar_api.h"
+
+// Encryption functions
+bool MizaruZUC::encryptInit(const SymmetricKey* key, const SymMode::Type mode /* = SymMode::CBC */, const ByteString& IV /* = ByteString()*/, bool padding /* = true */, size_t counterBits /* = 0 */, const ByteString& aad /* = ByteString() */, size_t tagBytes /* = 0 */)
+{
+	if (!SymmetricAlgorithm::encryptInit(key, mode, IV, padding, counterBits, aad, tagBytes))
+	{
+		return false;
+	}
+
+	if (key->getKeyBits().size() != 16 || IV.size() != ZUC_IV_LEN)
+	{
+		ERROR_MSG("Invalid ZUC key or IV size (%d and %d bytes)", key->getKeyBits().size(), IV.size());
+
+		ByteString dummy;
+		SymmetricAlgorithm::encryptFinal(dummy);
+
+		return false;
+	}
+
+	currentIV = IV;
+	pending.wipe();
+
+	return true;
+}
+
+bool MizaruZUC::encryptUpdate(const ByteString& data, ByteString& encryptedData)
+{
+	if (!SymmetricAlgorithm::encryptUpdate(data, encryptedData))
+	{
+		return false;
+	}
+
+	pending += data;
+	encryptedData.wipe();
+
+	return true;
+}
+
+bool MizaruZUC::encryptFinal(ByteString& encryptedData)
+{
+	if (currentOperation != ENCRYPT)
+	{
+		return false;
+	}
+
+	bool rv = crypt(currentKey->getKeyBits(), currentIV, pending, encryptedData);
+
+	pending.wipe();
+	ByteString dummy;
+	SymmetricAlgorithm::encryptFinal(dummy);
+
+	return rv;
+}
+
+// Decryption functions
+bool MizaruZUC::decryptInit(const SymmetricKey* key, const SymMode::Type mode /* = SymMode::CBC */, const ByteString& IV /* = ByteString() */, bool padding /* = true */, size_t counterBits /* = 0 */, const ByteString& aad /* = ByteString() */, size_t tagBytes /* = 0 */)
+{
+	if (!SymmetricAlgorithm::decryptInit(key, mode, IV, padding, counterBits, aad, tagBytes))
+	{
+		return false;
+	}
+
+	if (key->getKeyBits().size() != 16 || IV.size() != ZUC_IV_LEN)
+	{
+		ERROR_MSG("Invalid ZUC key or IV size (%d and %d bytes)", key->getKeyBits().size(), IV.size());
+
+		ByteString dummy;
+		SymmetricAlgorithm::decryptFinal(dummy);
+
+		return false;
+	}
+
+	currentIV = IV;
+
+	return true;
+}
+
+bool MizaruZUC::decryptUpdate(const ByteString& encryptedData, ByteString& data)
+{
+	if (!SymmetricAlgorithm::decryptUpdate(encryptedData, data))
+	{
+		return false;
+	}
+
+	data.wipe();
+
+	return true;
+}
+
+bool MizaruZUC::decryptFinal(ByteString& data)
+{
+	if (currentOperation != DECRYPT)
+	{
+		return false;
+	}
+
+	bool rv = crypt(currentKey->getKeyBits(), currentIV, currentAEADBuffer, data);
+
+	ByteString dummy;
+	SymmetricAlgorithm::decryptFinal(dummy);
+
+	return rv;
+}
+
+bool MizaruZUC::wrapKey(const SymmetricKey* /*key*/, const SymWrap::Type /*mode*/, const ByteString& /*in*/, ByteString& /*out*/)
+{
+	ERROR_MSG("ZUC does not support key wrapping");
+
+	return false;
+}
+
+bool MizaruZUC::unwrapKey(const SymmetricKey* /*key*/, const SymWrap::Type /*mode*/, const ByteString& /*in*/, ByteString& /*out*/)
+{
+	ERROR_MSG("ZUC does not support key unwrapping");
+
+	return false;
+}
+
+size_t MizaruZUC::getBlockSize() const
+{
+	// A stream cipher
+	return 1;
+}
+
+bool MizaruZUC::checkMaximumBytes(unsigned long bytes)
+{
+	return currentBufferSize + bytes <= ZUC_MAX_DATA_LEN;
+}
+
+// Runs 128-EEA3 on the chip
+bool MizaruZUC::crypt(const ByteString& key, const ByteString& iv, const ByteString& in, ByteString& out)
+{
+	out.wipe();
+
+	if (in.size() > ZUC_MAX_DATA_LEN)
+	{
+		ERROR_MSG("Too much data for ZUC (%d bytes)", in.size());
+
+		return false;
+	}
+
+	if (in.size() == 0)
+	{
+		return true;
+	}
+
+	// The chip does not change its inputs
+	mizar_uint8* chipKey = (mizar_uint8*) key.const_byte_str();
+	mizar_uint8* count = (mizar_uint8*) iv.const_byte_str();
+	mizar_uint8* data = (mizar_uint8*) in.const_byte_str();
+
+	out.resize(in.size());
+
+	mizar_uint32 rv = MizaruDevicePool::i()->run([&] { return MizarZucEnc(count, count[4], count[5], in.size(), data, chipKey, &out[0]); });
+
+	if (rv != 0)
+	{
+		ERROR_MSG("MizarZucEnc failed (0x%08X)", rv);
+
+		out.wipe();
+
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruZUC.h
+
+ Mizaru ZUC implementation of 128-EEA3. The IV is COUNT (4 bytes), BEARER
+ and DIRECTION. The chip takes the whole message at once, so the data is
+ collected until the end; OpenSSL has no ZUC, so there is no software
+ route.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_MIZARUZUC_H
+#define _SOFTHSM_V2_MIZARUZUC_H
+
+#include "config.h"
+#include "SymmetricAlgorithm.h"
+
+// The length of the IV and the most data one operation can take
+#define ZUC_IV_LEN 6
+#define ZUC_MAX_DATA_LEN 2000
+
+class MizaruZUC : public SymmetricAlgorithm
+{
+public:
+	// Destructor
+	virtual ~MizaruZUC() { }
+
+	// Encryption functions
+	virtual bool encryptInit(const SymmetricKey* key, const SymMode::Type mode = SymMode::CBC, const ByteString& IV = ByteString(), bool padding = true, size_t counterBits = 0, const ByteString& aad = ByteString(), size_t tagBytes = 0);
+	virtual bool encryptUpdate(const ByteString& data, ByteString& encryptedData);
+	virtual bool encryptFinal(ByteString& encryptedData);
+
+	// Decryption functions
+	virtual bool decryptInit(const SymmetricKey* key, const SymMode::Type mode = SymMode::CBC, const ByteString& IV = ByteString(), bool padding = true, size_t counterBits = 0, const ByteString& aad = ByteString(), size_t tagBytes = 0);
+	virtual bool decryptUpdate(const ByteString& encryptedData, ByteString& data);
+	virtual bool decryptFinal(ByteString& data);
+
+	// Wrap/Unwrap keys
+	virtual bool wrapKey(const SymmetricKey* key, const SymWrap::Type mode, const ByteString& in, ByteString& out);
+
+	virtual bool unwrapKey(const SymmetricKey* key, const SymWrap::Type mode, const ByteString& in, ByteString& out);
+
+	// Return the block size
+	virtual size_t getBlockSize() const;
+
+	// Check if more bytes of data can be encrypted
+	virtual bool checkMaximumBytes(unsigned long bytes);
+
+	// Runs 128-EEA3 on the chip
+	static bool crypt(const ByteString& key, const ByteString& iv, const ByteString& in, ByteString& out);
+
+private:
+	// The IV of the current operation
+	ByteString currentIV;
+
+	// The plaintext to encrypt; the ciphertext to decrypt is in the AEAD
+	// buffer
+	ByteString pending;
+};
+
+#endif // !_SOFTHSM_V2_MIZARUZUC_H
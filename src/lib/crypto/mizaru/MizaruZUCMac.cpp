@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruZUCMac.cpp
+
+ Mizaru ZUC MAC implementation
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "MizaruZUCMac.h"
+#include "MizaruZUC.h"
+#include "MizaruDevicePool.h"
+#include "mizar_api.h"
+#include <openssl/crypto.h>
+
+// Sets COUNT (4 bytes), BEARER and DIRECTION
+bool MizaruZUCMac::setIV(const ByteString& iv)
+{
+	if (iv.size() != ZUC_IV_LEN)
+	{
+		ERROR_MSG("Invalid ZUC IV size (%d bytes)", iv.size());
+
+		return false;
+	}
+
+	currentIV = iv;
+
+	return true;
+}
+
+// Signing functions
+bool MizaruZUCMac::signInit(const SymmetricKey* key)
+{
+	if (currentIV.size() != ZUC_IV_LEN || key == NULL || key->getKeyBits().size() != 16)
+	{
+		ERROR_MSG("ZUC needs a 16 byte key and an IV");
+
+		return false;
+	}
+
+	if (!MacAlgorithm::signInit(key))
+	{
+		return false;
+	}
+
+	pending.wipe();
+
+	return true;
+}
+
+bool MizaruZUCMac::signUpdate(const ByteString& dataToSign)
+{
+	if (!MacAlgorithm::signUpdate(dataToSign))
+	{
+		return false;
+	}
+
+	if (pending.size() + dataToSign.size() > ZUC_MAX_DATA_LEN)
+	{
+		ERROR_MSG("Too much data for ZUC");
+
+		ByteString dummy;
+		MacAlgorithm::signFinal(dummy);
+
+		return false;
+	}
+
+	pending += dataToSign;
+
+	return true;
+}
+
+bool MizaruZUCMac::signFinal(ByteString& signature)
+{
+	bool rv = currentKey != NULL && mac(signature);
+
+	ByteString dummy;
+	if (!MacAlgorithm::signFinal(dummy))
+	{
+		return false;
+	}
+
+	pending.wipe();
+
+	return rv;
+}
+
+// Verification functions
+bool MizaruZUCMac::verifyInit(const SymmetricKey* key)
+{
+	if (currentIV.size() != ZUC_IV_LEN || key == NULL || key->getKeyBits().size() != 16)
+	{
+		ERROR_MSG("ZUC needs a 16 byte key and an IV");
+
+		return false;
+	}
+
+	if (!MacAlgorithm::verifyInit(key))
+	{
+		return false;
+	}
+
+	pending.wipe();
+
+	return true;
+}
+
+bool MizaruZUCMac::verifyUpdate(const ByteString& originalData)
+{
+	if (!MacAlgorithm::verifyUpdate(originalData))
+	{
+		return false;
+	}
+
+	if (pending.size() + originalData.size() > ZUC_MAX_DATA_LEN)
+	{
+		ERROR_MSG("Too much data for ZUC");
+
+		ByteString dummy;
+		MacAlgorithm::verifyFinal(dummy);
+
+		return false;
+	}
+
+	pending += originalData;
+
+	return true;
+}
+
+bool MizaruZUCMac::verifyFinal(ByteString& signature)
+{
+	ByteString macResult;
+	bool rv = currentKey != NULL && mac(macResult);
+
+	ByteString dummy;
+	if (!MacAlgorithm::verifyFinal(dummy))
+	{
+		return false;
+	}
+
+	pending.wipe();
+
+	return rv && signature.size() == macResult.size() &&
+	       CRYPTO_memcmp(signature.const_byte_str(), macResult.const_byte_str(), macResult.size()) == 0;
+}
+
+unsigned long MizaruZUCMac::getMinKeySize()
+{
+	return 128;
+}
+
+unsigned long MizaruZUCMac::getMaxKeySize()
+{
+	return 128;
+}
+
+size_t MizaruZUCMac::getMacSize() const
+{
+	return 4;
+}
+
+// Runs 128-EIA3 on the chip over the collected data
+bool MizaruZUCMac::mac(ByteString& result)
+{
+	// The chip does not change its inputs
+	mizar_uint8* key = (mizar_uint8*) currentKey->getKeyBits().const_byte_str();
+	mizar_uint8* count = (mizar_uint8*) currentIV.const_byte_str();
+	mizar_uint8* data = (mizar_uint8*) pending.const_byte_str();
+
+	result.resize(getMacSize());
+
+	mizar_uint32 rv = MizaruDevicePool::i()->run([&] { return MizarZucMac(count, count[4], count[5], pending.size(), data, key, &result[0]); });
+
+	if (rv != 0)
+	{
+		ERROR_MSG("MizarZucMac failed (0x%08X)", rv);
+
+		result.wipe();
+
+		return false;
+	}
+
+	return true;
+}
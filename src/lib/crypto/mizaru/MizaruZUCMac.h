@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruZUCMac.h
+
+ Mizaru ZUC implementation of 128-EIA3. COUNT, BEARER and DIRECTION are set
+ with setIV before an operation. Like 128-EEA3 it runs only on the chip.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_MIZARUZUCMAC_H
+#define _SOFTHSM_V2_MIZARUZUCMAC_H
+
+#include "config.h"
+#include "MacAlgorithm.h"
+
+class MizaruZUCMac : public MacAlgorithm
+{
+public:
+	// Destructor
+	virtual ~MizaruZUCMac() { }
+
+	// Sets COUNT (4 bytes), BEARER and DIRECTION
+	bool setIV(const ByteString& iv);
+
+	// Signing functions
+	virtual bool signInit(const SymmetricKey* key);
+	virtual bool signUpdate(const ByteString& dataToSign);
+	virtual bool signFinal(ByteString& signature);
+
+	// Verification functions
+	virtual bool verifyInit(const SymmetricKey* key);
+	virtual bool verifyUpdate(const ByteString& originalData);
+	virtual bool verifyFinal(ByteString& signature);
+
+	// Key
+	virtual unsigned long getMinKeySize();
+	virtual unsigned long getMaxKeySize();
+
+	// Return the MAC size
+	virtual size_t getMacSize() const;
+
+private:
+	// Runs 128-EIA3 on the chip over the collected data
+	bool mac(ByteString& result);
+
+	// COUNT, BEARER and DIRECTION
+	ByteString currentIV;
+
+	// The data so far
+	ByteString pending;
+};
+
+#endif // !_SOFTHSM_V2_MIZARUZUCMAC_H
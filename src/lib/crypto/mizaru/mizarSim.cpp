@@ -0,0 +1,1002 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ mizarSim.cpp
+
+ The host side of the simulated Mizar chip. Each API call is framed as a
+ TMizarMsg, sent over the loopback channel to MizarSimDevice and its
+ response is unpacked. Data that does not fit in one message is split
+ the way the SDK does for the real chip. Like those of the SDK, the API
+ calls take no channel and go to the chip on channel 0; the other chips
+ are only reached through MizarSendRecvSn.
+ *****************************************************************************/
+
+#include "mizar_api.h"
+#include "mizar_msg.h"
+#include "MizarSimDevice.h"
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+// The firmware version reported by the simulated chip
+#define SIM_FIRMWARE_VERSION "mizaru_sim_V1.0"
+
+// The selected channel type and the message body it carries
+static mizar_uint32 deviceType = DEVICE_TYPE_SPI;
+
+static mizar_uint32 maxBody()
+{
+	return deviceType == DEVICE_TYPE_SDIO ? MAX_SDIO_BODY_LEN : MAX_BODY_LEN;
+}
+
+// The payload of one data message: the body less the other fields, in whole blocks
+static mizar_uint32 maxChunk(mizar_uint32 overhead)
+{
+	return (maxBody() - overhead) & ~0x0Fu;
+}
+
+/*****************************************************************************
+ Message channel
+ *****************************************************************************/
+
+mizar_uint32 MizarSendRecvSn(mizar_int32 nSPISn, TMizarMsg* pSndMsg, TMizarMsg* pResMsg)
+{
+	if (pSndMsg == NULL || pResMsg == NULL) return ERR_PARAMETER;
+	if (MizarSimDevice::bodyLength(pSndMsg) > maxBody()) return ERR_MSG_BODY_LEN;
+
+	MizarSimDevice* device = MizarSimDevice::get(nSPISn);
+	if (device == NULL) return ERR_OPENDEV;
+
+	std::unique_ptr<mizar_uint8[]> request(new mizar_uint8[MAX_SDIO_MSG_LEN]);
+	std::unique_ptr<mizar_uint8[]> response(new mizar_uint8[MAX_SDIO_MSG_LEN]);
+	mizar_uint32 requestLen = MizarSimDevice::encode(pSndMsg, request.get());
+	mizar_uint32 responseLen = 0;
+
+	mizar_uint32 rv = device->transfer(request.get(), requestLen, response.get(), &responseLen);
+	if (rv != SUCCESS) return rv;
+
+	return MizarSimDevice::decode(response.get(), responseLen, pResMsg);
+}
+
+mizar_uint32 MizarSendRecv(TMizarMsg* pSndMsg, TMizarMsg* pResMsg)
+{
+	return MizarSendRecvSn(0, pSndMsg, pResMsg);
+}
+
+mizar_uint8 MizarGetMizarMsgRetCode(TMizarMsg* pMsg)
+{
+	return pMsg->retcode;
+}
+
+// Runs a command whose body has been written to *req
+static mizar_uint32 call(mizar_uint8 ins, mizar_uint8 p1, mizar_uint8 p2, const MizarSimWriter& body, TMizarMsg* req, TMizarMsg* res)
+{
+	if (!body.ok()) return ERR_MSG_BODY_LEN;
+
+	req->ins = ins;
+	req->p1 = p1;
+	req->p2 = p2;
+	req->retcode = 0;
+
+	mizar_uint32 rv = MizarSendRecv(req, res);
+	if (rv != SUCCESS) return rv;
+
+	return MizarGetMizarMsgRetCode(res);
+}
+
+// A request and its response; too large for small thread stacks
+struct Exchange
+{
+	TMizarMsg req;
+	TMizarMsg res;
+};
+
+#define EXCHANGE(name) \
+	std::unique_ptr<Exchange> name##Holder(new Exchange); \
+	TMizarMsg* name##Req = &name##Holder->req; \
+	TMizarMsg* name##Res = &name##Holder->res; \
+	MizarSimWriter name(name##Req, maxBody())
+
+#define CALL(name, ins, p1, p2) call(ins, p1, p2, name, name##Req, name##Res)
+
+/*****************************************************************************
+ Chip management
+ *****************************************************************************/
+
+mizar_uint32 MizarSetDeviceType(mizar_uint32 nType)
+{
+	if (nType > DEVICE_TYPE_SOCK) return ERR_PARAMETER;
+
+	deviceType = nType;
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarSdkInit(mizar_uint32 /*nAutoVerifyPinFlag*/, mizar_char* /*szPin*/)
+{
+	return MizarSimDevice::get(0) == NULL ? ERR_OPENDEV : SUCCESS;
+}
+
+mizar_uint32 MizarDeleteShareObject(void)
+{
+	return SUCCESS;
+}
+
+mizar_uint32 MizarGetSdkVersion(mizar_char* szVersion)
+{
+	if (szVersion == NULL) return ERR_PARAMETER;
+
+	strcpy(szVersion, SDK_VERSION);
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarGetState(mizar_uint32* pState, mizar_char* szVersion)
+{
+	if (pState == NULL) return ERR_PARAMETER;
+
+	EXCHANGE(msg);
+
+	mizar_uint32 rv = CALL(msg, MIZAR_INS_GET_STATE, 0, 0);
+	if (rv != SUCCESS) return rv;
+
+	MizarSimReader out(msgRes);
+	if (!out.u32(*pState)) return ERR_MSG_FORMAT;
+	if (szVersion != NULL) strcpy(szVersion, SIM_FIRMWARE_VERSION);
+
+	return SUCCESS;
+}
+
+// One chip per channel, each with its own semaphore
+mizar_uint32 MizarDevLock(mizar_uint32 nSn)
+{
+	if (nSn >= MIZAR_SIM_MAX_DEVICES) return ERR_PARAMETER;
+
+	MizarSimDevice::get(nSn)->lockChannel();
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarDevUnlock(mizar_uint32 nSn)
+{
+	if (nSn >= MIZAR_SIM_MAX_DEVICES) return ERR_PARAMETER;
+
+	MizarSimDevice::get(nSn)->unlockChannel();
+
+	return SUCCESS;
+}
+
+/*****************************************************************************
+ Random numbers and digests
+ *****************************************************************************/
+
+mizar_uint32 MizarGenRnd(mizar_uint32 /*flag*/, mizar_uint32 nLen, mizar_uint8* ucRND)
+{
+	if (ucRND == NULL && nLen > 0) return ERR_PARAMETER;
+
+	mizar_uint32 chunk = maxChunk(4);
+
+	for (mizar_uint32 done = 0; done < nLen; )
+	{
+		mizar_uint32 len = nLen - done < chunk ? nLen - done : chunk;
+
+		EXCHANGE(msg);
+		msg.u32(len);
+
+		mizar_uint32 rv = CALL(msg, MIZAR_INS_GEN_RND, 0, 0);
+		if (rv != SUCCESS) return rv;
+
+		mizar_uint32 outLen = len;
+		MizarSimReader out(msgRes);
+		if (!out.copy(ucRND + done, &outLen) || outLen != len) return ERR_MSG_FORMAT;
+
+		done += len;
+	}
+
+	return SUCCESS;
+}
+
+// Like the real chip, each chip has a single digest stream; the caller
+// holds the channel from the Init to the Final
+mizar_uint32 MizarShaInit(mizar_uint32 nAlg)
+{
+	EXCHANGE(msg);
+	msg.u32(nAlg);
+
+	return CALL(msg, MIZAR_INS_SHA_INIT, 0, 0);
+}
+
+mizar_uint32 MizarShaUpdate(mizar_uint32 /*nAlg*/, mizar_uint32 nDatalen, mizar_uint8* ucData)
+{
+	if (ucData == NULL && nDatalen != 0) return ERR_PARAMETER;
+
+	mizar_uint32 chunk = maxChunk(4);
+
+	for (mizar_uint32 done = 0; done < nDatalen; )
+	{
+		mizar_uint32 len = nDatalen - done < chunk ? nDatalen - done : chunk;
+
+		EXCHANGE(msg);
+		msg.bytes(ucData + done, len);
+
+		mizar_uint32 rv = CALL(msg, MIZAR_INS_SHA_UPDATE, 0, 0);
+		if (rv != SUCCESS) return rv;
+
+		done += len;
+	}
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarShaFinal(mizar_uint32 /*nAlg*/, mizar_uint32* nHashlen, mizar_uint8* ucHash)
+{
+	if (nHashlen == NULL || ucHash == NULL) return ERR_PARAMETER;
+
+	EXCHANGE(msg);
+
+	mizar_uint32 rv = CALL(msg, MIZAR_INS_SHA_FINAL, 0, 0);
+	if (rv != SUCCESS) return rv;
+
+	mizar_uint32 len = EVP_MAX_MD_SIZE;
+	MizarSimReader out(msgRes);
+	if (!out.copy(ucHash, &len)) return ERR_MSG_FORMAT;
+
+	*nHashlen = len;
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarSHA(
+    mizar_uint32 nAlg, mizar_uint32 nDatalen, mizar_uint8* ucData, mizar_uint32* nHashlen, mizar_uint8* ucHash)
+{
+	mizar_uint32 rv = MizarShaInit(nAlg);
+
+	if (rv == SUCCESS) rv = MizarShaUpdate(nAlg, nDatalen, ucData);
+	if (rv == SUCCESS) rv = MizarShaFinal(nAlg, nHashlen, ucHash);
+
+	return rv;
+}
+
+// SM3 is algorithm 16 of the digest stream
+mizar_uint32 MizarSM3Init(void)
+{
+	return MizarShaInit(16);
+}
+
+mizar_uint32 MizarSM3Update(mizar_uint32 nDataLen, mizar_uint8* szData)
+{
+	return MizarShaUpdate(16, nDataLen, szData);
+}
+
+mizar_uint32 MizarSM3Final(mizar_uint8* szHash)
+{
+	mizar_uint32 hashLen = 0;
+
+	return MizarShaFinal(16, &hashLen, szHash);
+}
+
+mizar_uint32 MizarSM3(mizar_uint32 nDatalen, mizar_uint8* szData, mizar_uint8* szHash)
+{
+	mizar_uint32 hashLen = 0;
+
+	return MizarSHA(16, nDatalen, szData, &hashLen, szHash);
+}
+
+/*****************************************************************************
+ RSA
+ *****************************************************************************/
+
+mizar_uint32 MizarGenRsaKeyIndex(mizar_uint32 nKeyIndex, mizar_uint32 nModlen, mizar_uint32 nElen, mizar_uint8* szE,
+    mizar_uint32* pNlen, mizar_uint8* szN)
+{
+	if (szE == NULL || pNlen == NULL || szN == NULL) return ERR_PARAMETER;
+
+	EXCHANGE(msg);
+	msg.u32(nKeyIndex);
+	msg.u32(nModlen);
+	msg.bytes(szE, nElen);
+
+	mizar_uint32 rv = CALL(msg, MIZAR_INS_GEN_RSA_KEY, 0, 0);
+	if (rv != SUCCESS) return rv;
+
+	MizarSimReader out(msgRes);
+	if (!out.copy(szN, pNlen)) return ERR_DATA_LEN;
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarDeleteRsaKey(mizar_uint32 nKeyIndex)
+{
+	EXCHANGE(msg);
+	msg.u32(nKeyIndex);
+
+	return CALL(msg, MIZAR_INS_DEL_RSA_KEY, 0, 0);
+}
+
+mizar_uint32 MizarQueryRsaKey(
+    mizar_uint32 nKeyIndex, mizar_uint32* pNlen, mizar_uint8* szN, mizar_uint32* pElen, mizar_uint8* szE)
+{
+	if (pNlen == NULL || szN == NULL || pElen == NULL || szE == NULL) return ERR_PARAMETER;
+
+	EXCHANGE(msg);
+	msg.u32(nKeyIndex);
+
+	mizar_uint32 rv = CALL(msg, MIZAR_INS_QUERY_RSA_KEY, 0, 0);
+	if (rv != SUCCESS) return rv;
+
+	MizarSimReader out(msgRes);
+	if (!out.copy(szN, pNlen) || !out.copy(szE, pElen)) return ERR_DATA_LEN;
+
+	return SUCCESS;
+}
+
+static mizar_uint32 rsaSkIndex(mizar_uint8 p1,
+    mizar_uint32 nKeyIndex, mizar_uint32 nDatalen, mizar_uint8* ucData, mizar_uint32* pOutlen, mizar_uint8* ucOutData)
+{
+	if (ucData == NULL || pOutlen == NULL || ucOutData == NULL) return ERR_PARAMETER;
+
+	EXCHANGE(msg);
+	msg.u32(nKeyIndex);
+	msg.bytes(ucData, nDatalen);
+
+	mizar_uint32 rv = CALL(msg, MIZAR_INS_RSA_SK_INDEX, p1, 0);
+	if (rv != SUCCESS) return rv;
+
+	MizarSimReader out(msgRes);
+	if (!out.copy(ucOutData, pOutlen)) return ERR_DATA_LEN;
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarRsaSkEncIndex(
+    mizar_uint32 nKeyIndex, mizar_uint32 nDatalen, mizar_uint8* ucData, mizar_uint32* pOutlen, mizar_uint8* ucOutData)
+{
+	return rsaSkIndex(0, nKeyIndex, nDatalen, ucData, pOutlen, ucOutData);
+}
+
+mizar_uint32 MizarRsaSkDecIndex(
+    mizar_uint32 nKeyIndex, mizar_uint32 nDatalen, mizar_uint8* ucData, mizar_uint32* nOutlen, mizar_uint8* ucOutData)
+{
+	return rsaSkIndex(1, nKeyIndex, nDatalen, ucData, nOutlen, ucOutData);
+}
+
+// The simulated chip takes an external private key as a DER encoded PKCS #1
+// RSAPrivateKey
+static mizar_uint32 rsaSk(mizar_uint8 p1, mizar_uint32 nDatalen, mizar_uint8* ucData, mizar_uint32 nSKlen, mizar_uint8* ucSK,
+    mizar_uint32* pOutlen, mizar_uint8* ucOutData)
+{
+	if (ucData == NULL || ucSK == NULL || pOutlen == NULL || ucOutData == NULL) return ERR_PARAMETER;
+
+	EXCHANGE(msg);
+	msg.bytes(ucSK, nSKlen);
+	msg.bytes(ucData, nDatalen);
+
+	mizar_uint32 rv = CALL(msg, MIZAR_INS_RSA_SK, p1, 0);
+	if (rv != SUCCESS) return rv;
+
+	MizarSimReader out(msgRes);
+	if (!out.copy(ucOutData, pOutlen)) return ERR_DATA_LEN;
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarRsaSkEnc(mizar_uint32 nDatalen, mizar_uint8* ucData, mizar_uint32 nSKlen, mizar_uint8* ucSK,
+    mizar_uint32* nOutlen, mizar_uint8* ucOutData)
+{
+	return rsaSk(0, nDatalen, ucData, nSKlen, ucSK, nOutlen, ucOutData);
+}
+
+mizar_uint32 MizarRsaSkDec(mizar_uint32 nDatalen, mizar_uint8* ucData, mizar_uint32 nSKlen, mizar_uint8* ucSK,
+    mizar_uint32* pOutlen, mizar_uint8* ucOutData)
+{
+	return rsaSk(1, nDatalen, ucData, nSKlen, ucSK, pOutlen, ucOutData);
+}
+
+static mizar_uint32 rsaPk(mizar_uint32 nNlen, mizar_uint8* ucN, mizar_uint32 nElen, mizar_uint8* ucE,
+    mizar_uint32 nDatalen, mizar_uint8* ucData, mizar_uint32* pOutlen, mizar_uint8* ucOutData)
+{
+	if (ucN == NULL || ucE == NULL || ucData == NULL || pOutlen == NULL || ucOutData == NULL) return ERR_PARAMETER;
+
+	EXCHANGE(msg);
+	msg.bytes(ucN, nNlen);
+	msg.bytes(ucE, nElen);
+	msg.bytes(ucData, nDatalen);
+
+	mizar_uint32 rv = CALL(msg, MIZAR_INS_RSA_PK, 0, 0);
+	if (rv != SUCCESS) return rv;
+
+	MizarSimReader out(msgRes);
+	if (!out.copy(ucOutData, pOutlen)) return ERR_DATA_LEN;
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarRsaPkDec(mizar_uint32 nNlen, mizar_uint8* ucN, mizar_uint32 nElen, mizar_uint8* ucE,
+    mizar_uint32 nDatalen, mizar_uint8* ucData, mizar_uint32* pOutlen, mizar_uint8* ucOutData)
+{
+	return rsaPk(nNlen, ucN, nElen, ucE, nDatalen, ucData, pOutlen, ucOutData);
+}
+
+mizar_uint32 MizarRsaPkEnc(mizar_uint32 nNlen, mizar_uint8* ucN, mizar_uint32 nElen, mizar_uint8* ucE,
+    mizar_uint32 nDatalen, mizar_uint8* ucData, mizar_uint32* nOutlen, mizar_uint8* ucOutData)
+{
+	return rsaPk(nNlen, ucN, nElen, ucE, nDatalen, ucData, nOutlen, ucOutData);
+}
+
+/*****************************************************************************
+ ECC
+ *****************************************************************************/
+
+mizar_uint32 MizarGenEccKeyIndex(mizar_uint32 nKeyIndex, mizar_uint32 nGroup, mizar_uint32* pXlen, mizar_uint8* szX,
+    mizar_uint32* pYlen, mizar_uint8* szY)
+{
+	if (pXlen == NULL || szX == NULL || pYlen == NULL || szY == NULL) return ERR_PARAMETER;
+
+	EXCHANGE(msg);
+	msg.u32(nKeyIndex);
+	msg.u32(nGroup);
+
+	mizar_uint32 rv = CALL(msg, MIZAR_INS_GEN_ECC_KEY, 0, 0);
+	if (rv != SUCCESS) return rv;
+
+	MizarSimReader out(msgRes);
+	if (!out.copy(szX, pXlen) || !out.copy(szY, pYlen)) return ERR_DATA_LEN;
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarDeleteEccKey(mizar_uint32 nKeyIndex)
+{
+	EXCHANGE(msg);
+	msg.u32(nKeyIndex);
+
+	return CALL(msg, MIZAR_INS_DEL_ECC_KEY, 0, 0);
+}
+
+mizar_uint32 MizarQueryEccKey(mizar_uint32 nKeyIndex, mizar_uint32* nGroupID, mizar_uint32* nXlen, mizar_uint8* szX,
+    mizar_uint32* nYlen, mizar_uint8* szY)
+{
+	if (nGroupID == NULL || nXlen == NULL || szX == NULL || nYlen == NULL || szY == NULL) return ERR_PARAMETER;
+
+	EXCHANGE(msg);
+	msg.u32(nKeyIndex);
+
+	mizar_uint32 rv = CALL(msg, MIZAR_INS_QUERY_ECC_KEY, 0, 0);
+	if (rv != SUCCESS) return rv;
+
+	MizarSimReader out(msgRes);
+	if (!out.u32(*nGroupID) || !out.copy(szX, nXlen) || !out.copy(szY, nYlen)) return ERR_DATA_LEN;
+
+	return SUCCESS;
+}
+
+// An external private key is the big endian private scalar
+mizar_uint32 MizarEccSign(mizar_uint32 nGroup, mizar_uint32 nHashFlag, mizar_uint32 nKeyLen, mizar_uint8* ucKey,
+    mizar_uint32 nDataLen, mizar_uint8* ucData, mizar_uint32* nRlen, mizar_uint8* ucR, mizar_uint32* nSlen,
+    mizar_uint8* ucS)
+{
+	if (ucKey == NULL || ucData == NULL || nRlen == NULL || ucR == NULL || nSlen == NULL || ucS == NULL) return ERR_PARAMETER;
+
+	EXCHANGE(msg);
+	msg.u32(nGroup);
+	msg.u32(nHashFlag);
+	msg.bytes(ucKey, nKeyLen);
+	msg.bytes(ucData, nDataLen);
+
+	mizar_uint32 rv = CALL(msg, MIZAR_INS_ECC_SIGN, 0, 0);
+	if (rv != SUCCESS) return rv;
+
+	MizarSimReader out(msgRes);
+	if (!out.copy(ucR, nRlen) || !out.copy(ucS, nSlen)) return ERR_DATA_LEN;
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarEccSignIndex(mizar_uint32 nKeyIndex, mizar_uint32 nHashFlag, mizar_uint32 nDataLen,
+    mizar_uint8* ucData, mizar_uint32* nRlen, mizar_uint8* ucR, mizar_uint32* nSlen, mizar_uint8* ucS)
+{
+	if (ucData == NULL || nRlen == NULL || ucR == NULL || nSlen == NULL || ucS == NULL) return ERR_PARAMETER;
+
+	EXCHANGE(msg);
+	msg.u32(nKeyIndex);
+	msg.u32(nHashFlag);
+	msg.bytes(ucData, nDataLen);
+
+	mizar_uint32 rv = CALL(msg, MIZAR_INS_ECC_SIGN_INDEX, 0, 0);
+	if (rv != SUCCESS) return rv;
+
+	MizarSimReader out(msgRes);
+	if (!out.copy(ucR, nRlen) || !out.copy(ucS, nSlen)) return ERR_DATA_LEN;
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarEccVerify(mizar_uint32 nGroup, mizar_uint32 nHashFlag, mizar_uint32 nXlen, mizar_uint8* ucX,
+    mizar_uint32 nYlen, mizar_uint8* ucY, mizar_uint32 nRlen, mizar_uint8* ucR, mizar_uint32 nSlen, mizar_uint8* ucS,
+    mizar_uint32 nDataLen, mizar_uint8* ucData)
+{
+	if (ucX == NULL || ucY == NULL || ucR == NULL || ucS == NULL || ucData == NULL) return ERR_PARAMETER;
+
+	EXCHANGE(msg);
+	msg.u32(nGroup);
+	msg.u32(nHashFlag);
+	msg.bytes(ucX, nXlen);
+	msg.bytes(ucY, nYlen);
+	msg.bytes(ucR, nRlen);
+	msg.bytes(ucS, nSlen);
+	msg.bytes(ucData, nDataLen);
+
+	return CALL(msg, MIZAR_INS_ECC_VERIFY, 0, 0);
+}
+
+/*****************************************************************************
+ SM2
+ *****************************************************************************/
+
+// The SM2 keys, coordinates and signature halves are 32 bytes
+#define SM2_LEN 32
+
+mizar_uint32 MizarSM2Sign(mizar_uint8* szSK, mizar_uint32 nHashFlag, mizar_uint32 nDataLen, mizar_uint8* szData,
+    mizar_uint8* szR, mizar_uint8* szS)
+{
+	if (szSK == NULL || szData == NULL || szR == NULL || szS == NULL) return ERR_PARAMETER;
+
+	EXCHANGE(msg);
+	msg.u32(nHashFlag);
+	msg.bytes(szSK, SM2_LEN);
+	msg.bytes(szData, nDataLen);
+
+	mizar_uint32 rv = CALL(msg, MIZAR_INS_SM2_SIGN, 0, 0);
+	if (rv != SUCCESS) return rv;
+
+	mizar_uint32 rLen = SM2_LEN;
+	mizar_uint32 sLen = SM2_LEN;
+	MizarSimReader out(msgRes);
+	if (!out.copy(szR, &rLen) || !out.copy(szS, &sLen) || rLen != SM2_LEN || sLen != SM2_LEN) return ERR_MSG_FORMAT;
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarSM2Verify(mizar_uint32 nHashFlag, mizar_uint8* szX, mizar_uint8* szY, mizar_uint8* szR,
+    mizar_uint8* szS, mizar_uint32 nDataLen, mizar_uint8* szData)
+{
+	if (szX == NULL || szY == NULL || szR == NULL || szS == NULL || szData == NULL) return ERR_PARAMETER;
+
+	EXCHANGE(msg);
+	msg.u32(nHashFlag);
+	msg.bytes(szX, SM2_LEN);
+	msg.bytes(szY, SM2_LEN);
+	msg.bytes(szR, SM2_LEN);
+	msg.bytes(szS, SM2_LEN);
+	msg.bytes(szData, nDataLen);
+
+	return CALL(msg, MIZAR_INS_SM2_VERIFY, 0, 0);
+}
+
+// The ciphertext is C1 || C2 || C3, C1 the uncompressed point, so it is
+// 97 bytes longer than the data
+mizar_uint32 MizarSM2PkEnc(mizar_uint8* szX, mizar_uint8* szY, mizar_uint32 nDataLen, mizar_uint8* szData,
+    mizar_uint32* pOutLen, mizar_uint8* szOutData)
+{
+	if (szX == NULL || szY == NULL || szData == NULL || pOutLen == NULL || szOutData == NULL) return ERR_PARAMETER;
+
+	EXCHANGE(msg);
+	msg.bytes(szX, SM2_LEN);
+	msg.bytes(szY, SM2_LEN);
+	msg.bytes(szData, nDataLen);
+
+	mizar_uint32 rv = CALL(msg, MIZAR_INS_SM2_ENC, 0, 0);
+	if (rv != SUCCESS) return rv;
+
+	MizarSimReader out(msgRes);
+	if (!out.copy(szOutData, pOutLen)) return ERR_DATA_LEN;
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarSM2SkDec(
+    mizar_uint8* szSK, mizar_uint32 nDataLen, mizar_uint8* szData, mizar_uint32* pOutLen, mizar_uint8* szOutData)
+{
+	if (szSK == NULL || szData == NULL || pOutLen == NULL || szOutData == NULL) return ERR_PARAMETER;
+
+	EXCHANGE(msg);
+	msg.bytes(szSK, SM2_LEN);
+	msg.bytes(szData, nDataLen);
+
+	mizar_uint32 rv = CALL(msg, MIZAR_INS_SM2_DEC, 0, 0);
+	if (rv != SUCCESS) return rv;
+
+	MizarSimReader out(msgRes);
+	if (!out.copy(szOutData, pOutLen)) return ERR_DATA_LEN;
+
+	return SUCCESS;
+}
+
+/*****************************************************************************
+ Symmetric keys
+ *****************************************************************************/
+
+mizar_uint32 MizarImportSymmKey(mizar_uint32 nAlg, mizar_uint32 nKeyIndex, mizar_uint32 nLock, mizar_uint32 nKeyLen,
+    mizar_uint8* szKey, mizar_uint8* /*szMac*/)
+{
+	if (szKey == NULL) return ERR_PARAMETER;
+
+	EXCHANGE(msg);
+	msg.u32(nAlg);
+	msg.u32(nKeyIndex);
+	msg.u32(nLock);
+	msg.bytes(szKey, nKeyLen);
+
+	mizar_uint32 rv = CALL(msg, MIZAR_INS_IMPORT_SYMM_KEY, 0, 0);
+
+	// The plaintext key must not linger in host memory
+	OPENSSL_cleanse(msgReq->body, MizarSimDevice::bodyLength(msgReq));
+
+	return rv;
+}
+
+mizar_uint32 MizarGenSymmKey(
+    mizar_uint32 nAlg, mizar_uint32 nKeyIndex, mizar_uint32 nLock, mizar_uint32 nKeylen, mizar_uint8* /*szMac*/)
+{
+	EXCHANGE(msg);
+	msg.u32(nAlg);
+	msg.u32(nKeyIndex);
+	msg.u32(nLock);
+	msg.u32(nKeylen);
+
+	return CALL(msg, MIZAR_INS_GEN_SYMM_KEY, 0, 0);
+}
+
+mizar_uint32 MizarDeleteSymmKey(mizar_uint32 nKeyIndex)
+{
+	EXCHANGE(msg);
+	msg.u32(nKeyIndex);
+
+	return CALL(msg, MIZAR_INS_DEL_SYMM_KEY, 0, 0);
+}
+
+mizar_uint32 MizarQuerySymmKey(
+    mizar_uint32 nKeyIndex, mizar_uint32* nKeyLen, mizar_uint32* nAlg, mizar_uint32* nLock, mizar_uint8* szCV)
+{
+	if (nKeyLen == NULL || nAlg == NULL || nLock == NULL || szCV == NULL) return ERR_PARAMETER;
+
+	EXCHANGE(msg);
+	msg.u32(nKeyIndex);
+
+	mizar_uint32 rv = CALL(msg, MIZAR_INS_QUERY_SYMM_KEY, 0, 0);
+	if (rv != SUCCESS) return rv;
+
+	mizar_uint32 cvLen = 3;
+	MizarSimReader out(msgRes);
+	if (!out.u32(*nKeyLen) || !out.u32(*nAlg) || !out.u32(*nLock) || !out.copy(szCV, &cvLen)) return ERR_MSG_FORMAT;
+
+	return SUCCESS;
+}
+
+#define SYMM_ALG_DES 1
+#define SYMM_ALG_AES 2
+#define SYMM_ALG_SM4 3
+
+// ECB, CBC or for SM4 also OFB and CTR with a key slot, or with the key in
+// the message if ucKey is set; long data is sent in several messages
+static mizar_uint32 symm(mizar_uint32 nAlg, mizar_uint32 nMode, mizar_uint8 cipherMode, mizar_uint8* ucIV,
+    mizar_uint8* ucKey, mizar_uint32 nKeylen, mizar_uint32 nKeyIndex,
+    mizar_uint32 nDatalen, mizar_uint8* ucData, mizar_uint32* pOutlen, mizar_uint8* ucOutData)
+{
+	if (nMode > 1 || ucData == NULL || pOutlen == NULL || ucOutData == NULL) return ERR_PARAMETER;
+	if (*pOutlen < nDatalen) return ERR_DATA_LEN;
+
+	const mizar_uint32 blockSize = nAlg == SYMM_ALG_DES ? 8 : 16;
+	mizar_uint8 iv[16] = { 0 };
+	mizar_uint32 ivLen = 0;
+
+	if (cipherMode != MIZAR_SIM_MODE_ECB)
+	{
+		if (ucIV == NULL) return ERR_PARAMETER;
+
+		memcpy(iv, ucIV, blockSize);
+		ivLen = blockSize;
+	}
+
+	// Algorithm, key or key index, IV and data length
+	mizar_uint32 keyField = ucKey != NULL ? 4 + nKeylen : 4;
+	mizar_uint32 chunk = maxChunk(4 + keyField + 4 + blockSize + 4);
+
+	// The stream modes take any length
+	bool stream = cipherMode == MIZAR_SIM_MODE_OFB || cipherMode == MIZAR_SIM_MODE_CTR;
+
+	if (!stream && nDatalen % blockSize != 0) return ERR_DATA_LEN;
+
+	for (mizar_uint32 done = 0; done < nDatalen; )
+	{
+		mizar_uint32 len = nDatalen - done < chunk ? nDatalen - done : chunk;
+		bool more = done + len < nDatalen;
+
+		// Keep the last input block, the output may overwrite it; all
+		// messages but the last carry whole blocks
+		mizar_uint8 lastIn[16];
+		if (more) memcpy(lastIn, ucData + done + len - blockSize, blockSize);
+
+		EXCHANGE(msg);
+		msg.u32(nAlg);
+		if (ucKey != NULL)
+		{
+			msg.bytes(ucKey, nKeylen);
+		}
+		else
+		{
+			msg.u32(nKeyIndex);
+		}
+		msg.bytes(iv, ivLen);
+		msg.bytes(ucData + done, len);
+
+		mizar_uint32 rv = CALL(msg, ucKey != NULL ? MIZAR_INS_SYMM : MIZAR_INS_SYMM_INDEX, (mizar_uint8) nMode, cipherMode);
+		if (rv != SUCCESS) return rv;
+
+		mizar_uint32 outLen = len;
+		MizarSimReader out(msgRes);
+		if (!out.copy(ucOutData + done, &outLen) || outLen != len) return ERR_MSG_FORMAT;
+
+		// Chain the IV into the next message
+		if (more && cipherMode == MIZAR_SIM_MODE_CBC)
+		{
+			memcpy(iv, nMode == 0 ? ucOutData + done + len - blockSize : lastIn, blockSize);
+		}
+		else if (more && cipherMode == MIZAR_SIM_MODE_OFB)
+		{
+			// The last key stream block
+			for (mizar_uint32 i = 0; i < blockSize; i++)
+			{
+				iv[i] = ucOutData[done + len - blockSize + i] ^ lastIn[i];
+			}
+		}
+		else if (more && cipherMode == MIZAR_SIM_MODE_CTR)
+		{
+			// Advance the big endian counter by the blocks sent
+			mizar_uint32 carry = len / blockSize;
+
+			for (int i = blockSize - 1; i >= 0 && carry > 0; i--)
+			{
+				carry += iv[i];
+				iv[i] = (mizar_uint8) carry;
+				carry >>= 8;
+			}
+		}
+
+		done += len;
+	}
+
+	*pOutlen = nDatalen;
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarAesEcb(mizar_uint32 nMode, mizar_uint32 nDatalen, mizar_uint8* ucData, mizar_uint32 nKeylen,
+    mizar_uint8* ucKey, mizar_uint32* pOutlen, mizar_uint8* ucOutData)
+{
+	if (ucKey == NULL) return ERR_PARAMETER;
+
+	return symm(SYMM_ALG_AES, nMode, MIZAR_SIM_MODE_ECB, NULL, ucKey, nKeylen, 0, nDatalen, ucData, pOutlen, ucOutData);
+}
+
+mizar_uint32 MizarAesCbc(mizar_uint32 nMode, mizar_uint8* ucIV, mizar_uint32 nDatalen, mizar_uint8* ucData,
+    mizar_uint32 nKeylen, mizar_uint8* ucKey, mizar_uint32* pOutlen, mizar_uint8* ucOutData)
+{
+	if (ucKey == NULL) return ERR_PARAMETER;
+
+	return symm(SYMM_ALG_AES, nMode, MIZAR_SIM_MODE_CBC, ucIV, ucKey, nKeylen, 0, nDatalen, ucData, pOutlen, ucOutData);
+}
+
+mizar_uint32 MizarDesEcb(mizar_uint32 nMode, mizar_uint32 nDatalen, mizar_uint8* ucData, mizar_uint32 nKeylen,
+    mizar_uint8* ucKey, mizar_uint32* pOutlen, mizar_uint8* ucOutData)
+{
+	if (ucKey == NULL) return ERR_PARAMETER;
+
+	return symm(SYMM_ALG_DES, nMode, MIZAR_SIM_MODE_ECB, NULL, ucKey, nKeylen, 0, nDatalen, ucData, pOutlen, ucOutData);
+}
+
+mizar_uint32 MizarDesCbc(mizar_uint32 nMode, mizar_uint8* ucIV, mizar_uint32 nDatalen, mizar_uint8* ucData,
+    mizar_uint32 nKeylen, mizar_uint8* ucKey, mizar_uint32* pOutlen, mizar_uint8* ucOutData)
+{
+	if (ucKey == NULL) return ERR_PARAMETER;
+
+	return symm(SYMM_ALG_DES, nMode, MIZAR_SIM_MODE_CBC, ucIV, ucKey, nKeylen, 0, nDatalen, ucData, pOutlen, ucOutData);
+}
+
+mizar_uint32 MizarAesEcbIndex(mizar_uint32 nMode, mizar_uint32 nKeyIndex, mizar_uint32 nDatalen, mizar_uint8* ucData,
+    mizar_uint32* pOutlen, mizar_uint8* ucOutData)
+{
+	return symm(SYMM_ALG_AES, nMode, MIZAR_SIM_MODE_ECB, NULL, NULL, 0, nKeyIndex, nDatalen, ucData, pOutlen, ucOutData);
+}
+
+mizar_uint32 MizarAesCbcIndex(mizar_uint32 nMode, mizar_uint8* ucIV, mizar_uint32 nKeyIndex, mizar_uint32 nDatalen,
+    mizar_uint8* ucData, mizar_uint32* pOutlen, mizar_uint8* ucOutData)
+{
+	return symm(SYMM_ALG_AES, nMode, MIZAR_SIM_MODE_CBC, ucIV, NULL, 0, nKeyIndex, nDatalen, ucData, pOutlen, ucOutData);
+}
+
+mizar_uint32 MizarSM4EcbIndex(mizar_uint32 nMode, mizar_uint32 nKeyIndex, mizar_uint32 nDataLen, mizar_uint8* szData,
+    mizar_uint32* pOutLen, mizar_uint8* szOutData)
+{
+	return symm(SYMM_ALG_SM4, nMode, MIZAR_SIM_MODE_ECB, NULL, NULL, 0, nKeyIndex, nDataLen, szData, pOutLen, szOutData);
+}
+
+mizar_uint32 MizarSM4CbcIndex(mizar_uint32 nMode, mizar_uint32 nKeyIndex, mizar_uint8* szIV, mizar_uint32 nDatalen,
+    mizar_uint8* szData, mizar_uint32* nOutlen, mizar_uint8* szOutData)
+{
+	return symm(SYMM_ALG_SM4, nMode, MIZAR_SIM_MODE_CBC, szIV, NULL, 0, nKeyIndex, nDatalen, szData, nOutlen, szOutData);
+}
+
+mizar_uint32 MizarSM4Ecb(mizar_uint32 nMode, mizar_uint8* szKey, mizar_uint32 nDataLen, mizar_uint8* szData,
+    mizar_uint32* pOutLen, mizar_uint8* szOutData)
+{
+	if (szKey == NULL) return ERR_PARAMETER;
+
+	return symm(SYMM_ALG_SM4, nMode, MIZAR_SIM_MODE_ECB, NULL, szKey, 16, 0, nDataLen, szData, pOutLen, szOutData);
+}
+
+mizar_uint32 MizarSM4Cbc(mizar_uint32 nMode, mizar_uint8* szKey, mizar_uint8* szIV, mizar_uint32 nDatalen,
+    mizar_uint8* szData, mizar_uint32* nOutlen, mizar_uint8* szOutData)
+{
+	if (szKey == NULL) return ERR_PARAMETER;
+
+	return symm(SYMM_ALG_SM4, nMode, MIZAR_SIM_MODE_CBC, szIV, szKey, 16, 0, nDatalen, szData, nOutlen, szOutData);
+}
+
+// nAlg 0 is CBC, 1 OFB and 2 CTR
+mizar_uint32 MizarSM4Modes(mizar_uint32 nMode, mizar_uint32 nAlg, mizar_uint8* szIV, mizar_uint8* szKey,
+    mizar_uint32 nDataLen, mizar_uint8* szData, mizar_uint32* pOutLen, mizar_uint8* szOutData)
+{
+	static const mizar_uint8 modes[] = { MIZAR_SIM_MODE_CBC, MIZAR_SIM_MODE_OFB, MIZAR_SIM_MODE_CTR };
+
+	if (szKey == NULL || nAlg >= sizeof(modes)) return ERR_PARAMETER;
+
+	return symm(SYMM_ALG_SM4, nMode, modes[nAlg], szIV, szKey, 16, 0, nDataLen, szData, pOutLen, szOutData);
+}
+
+mizar_uint32 MizarAesCcm(mizar_uint32 nMode, mizar_uint8* ucKey, mizar_uint32 nKeyLen, mizar_uint8* ucNonce,
+    mizar_uint32 nDatalen, mizar_uint8* ucData, mizar_uint32* pOutlen, mizar_uint8* ucOutData)
+{
+	if (nMode > 1 || ucKey == NULL || ucNonce == NULL || ucData == NULL || pOutlen == NULL || ucOutData == NULL)
+	{
+		return ERR_PARAMETER;
+	}
+
+	EXCHANGE(msg);
+	msg.bytes(ucKey, nKeyLen);
+	msg.bytes(ucNonce, 12);
+	msg.bytes(ucData, nDatalen);
+
+	mizar_uint32 rv = CALL(msg, MIZAR_INS_AES_CCM, (mizar_uint8) nMode, 0);
+	if (rv != SUCCESS) return rv;
+
+	MizarSimReader out(msgRes);
+	if (!out.copy(ucOutData, pOutlen)) return ERR_DATA_LEN;
+
+	return SUCCESS;
+}
+
+/*****************************************************************************
+ ZUC
+ *****************************************************************************/
+
+// The data length is in bytes; the data has to fit into one message
+static mizar_uint32 zuc(mizar_uint8 ins, mizar_uint8* szCount, mizar_uint8 nBearer, mizar_uint8 nDirection,
+    mizar_uint32 nDataLen, mizar_uint8* szData, mizar_uint8* szKey, mizar_uint32 outLen, mizar_uint8* szOut)
+{
+	if (szCount == NULL || (szData == NULL && nDataLen > 0) || szKey == NULL || szOut == NULL) return ERR_PARAMETER;
+
+	EXCHANGE(msg);
+	msg.bytes(szKey, 16);
+	msg.bytes(szCount, 4);
+	msg.u32(nBearer);
+	msg.u32(nDirection);
+	msg.bytes(szData, nDataLen);
+
+	mizar_uint32 rv = CALL(msg, ins, 0, 0);
+	if (rv != SUCCESS) return rv;
+
+	mizar_uint32 len = outLen;
+	MizarSimReader out(msgRes);
+	if (!out.copy(szOut, &len) || len != outLen) return ERR_MSG_FORMAT;
+
+	return SUCCESS;
+}
+
+mizar_uint32 MizarZucEnc(mizar_uint8* szCount, mizar_uint8 nBearer, mizar_uint8 nDirection, mizar_uint32 nDataLen,
+    mizar_uint8* szData, mizar_uint8* szKey, mizar_uint8* szOutData)
+{
+	return zuc(MIZAR_INS_ZUC_ENC, szCount, nBearer, nDirection, nDataLen, szData, szKey, nDataLen, szOutData);
+}
+
+mizar_uint32 MizarZucMac(mizar_uint8* szCount, mizar_uint8 nBearer, mizar_uint8 nDirection, mizar_uint32 nDatalen,
+    mizar_uint8* szData, mizar_uint8* szKey, mizar_uint8* szMac)
+{
+	return zuc(MIZAR_INS_ZUC_MAC, szCount, nBearer, nDirection, nDatalen, szData, szKey, 4, szMac);
+}
+
+/*****************************************************************************
+ Certificates
+ *****************************************************************************/
+
+mizar_uint32 MizarImportCert(
+    mizar_uint32 nCertIndex, mizar_uint32 nKeyIndex, mizar_uint32 nCertType, mizar_uint32 nLen, mizar_uint8* szCert)
+{
+	if (szCert == NULL) return ERR_PARAMETER;
+
+	EXCHANGE(msg);
+	msg.u32(nCertIndex);
+	msg.u32(nKeyIndex);
+	msg.u32(nCertType);
+	msg.bytes(szCert, nLen);
+
+	return CALL(msg, MIZAR_INS_IMPORT_CERT, 0, 0);
+}
+
+mizar_uint32 MizarDeleteCert(mizar_uint32 nCertIndex, mizar_uint32 nCertType)
+{
+	EXCHANGE(msg);
+	msg.u32(nCertIndex);
+	msg.u32(nCertType);
+
+	return CALL(msg, MIZAR_INS_DEL_CERT, 0, 0);
+}
+
+// *pCertLen is the size of szCert on input
+mizar_uint32 MizarGetCert(mizar_uint32 nCertIndex, mizar_uint32 nCertType, mizar_uint32* pKeyIndex,
+    mizar_uint32* pCertLen, mizar_uint8* szCert)
+{
+	if (pKeyIndex == NULL || pCertLen == NULL || szCert == NULL) return ERR_PARAMETER;
+
+	EXCHANGE(msg);
+	msg.u32(nCertIndex);
+	msg.u32(nCertType);
+
+	mizar_uint32 rv = CALL(msg, MIZAR_INS_GET_CERT, 0, 0);
+	if (rv != SUCCESS) return rv;
+
+	MizarSimReader out(msgRes);
+	if (!out.u32(*pKeyIndex) || !out.copy(szCert, pCertLen)) return ERR_MSG_FORMAT;
+
+	return SUCCESS;
+}
+
+// *pListlen is the size of szList on input
+mizar_uint32 MizarGetCertList(mizar_uint32* pListlen, mizar_uint8* szList)
+{
+	if (pListlen == NULL || szList == NULL) return ERR_PARAMETER;
+
+	EXCHANGE(msg);
+
+	mizar_uint32 rv = CALL(msg, MIZAR_INS_GET_CERT_LIST, 0, 0);
+	if (rv != SUCCESS) return rv;
+
+	MizarSimReader out(msgRes);
+	if (!out.copy(szList, pListlen)) return ERR_MSG_FORMAT;
+
+	return SUCCESS;
+}
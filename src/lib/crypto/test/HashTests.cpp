@@ -31,6 +31,9 @@
  *****************************************************************************/
 
 #include <stdlib.h>
+#include <chrono>
+#include <thread>
+#include <vector>
 #include <cppunit/extensions/HelperMacros.h>
 #include "HashTests.h"
 #include "CryptoFactory.h"
@@ -40,6 +43,14 @@
 
 CPPUNIT_TEST_SUITE_REGISTRATION(HashTests);
 
+// The number of threads and rounds used to check concurrent hashing
+#define CONCURRENT_THREADS 8
+#define CONCURRENT_ROUNDS 200
+
+// The message size and the number of digests per benchmark thread
+#define BENCH_MESSAGE_SIZE 1024
+#define BENCH_ITERATIONS 20000
+
 void HashTests::setUp()
 {
 	hash = NULL;
@@ -198,6 +209,177 @@ void HashTests::testSHA256()
 	rng = NULL;
 }
 
+// Builds a message that differs per thread and round
+static ByteString concurrentMessage(size_t thread, size_t round)
+{
+	ByteString message;
+
+	message.resize(100 + (thread * 37 + round * 13) % 400);
+
+	for (size_t i = 0; i < message.size(); i++)
+	{
+		message[i] = (unsigned char) (thread * 31 + round * 7 + i);
+	}
+
+	return message;
+}
+
+// Hashes a message in parts of irregular size
+static bool hashInParts(HashAlgorithm* hash, const ByteString& message, ByteString& hashedData)
+{
+	if (!hash->hashInit()) return false;
+
+	size_t offset = 0;
+	size_t part = 1;
+
+	while (offset < message.size())
+	{
+		size_t len = message.size() - offset;
+
+		if (len > part) len = part;
+
+		if (!hash->hashUpdate(message.substr(offset, len))) return false;
+
+		offset += len;
+		part = part * 3 + 1;
+	}
+
+	return hash->hashFinal(hashedData);
+}
+
+struct ConcurrentHashState
+{
+	size_t thread;
+	std::vector<ByteString>* expected;
+	size_t failures;
+};
+
+static void concurrentHashThread(ConcurrentHashState* state)
+{
+	HashAlgorithm* hash = CryptoFactory::i()->getHashAlgorithm(HashAlgo::SHA256);
+
+	if (hash == NULL)
+	{
+		state->failures = CONCURRENT_ROUNDS;
+
+		return;
+	}
+
+	for (size_t round = 0; round < CONCURRENT_ROUNDS; round++)
+	{
+		ByteString hashedData;
+
+		if (!hashInParts(hash, concurrentMessage(state->thread, round), hashedData) ||
+		    hashedData != (*state->expected)[round])
+		{
+			state->failures++;
+		}
+	}
+
+	CryptoFactory::i()->recycleHashAlgorithm(hash);
+}
+
+void HashTests::testSHA256Concurrent()
+{
+	std::vector<ByteString> expected[CONCURRENT_THREADS];
+	ConcurrentHashState states[CONCURRENT_THREADS];
+
+	CPPUNIT_ASSERT((hash = CryptoFactory::i()->getHashAlgorithm(HashAlgo::SHA256)) != NULL);
+
+	// Compute the reference digests one at a time
+	for (size_t t = 0; t < CONCURRENT_THREADS; t++)
+	{
+		for (size_t round = 0; round < CONCURRENT_ROUNDS; round++)
+		{
+			ByteString message = concurrentMessage(t, round);
+			ByteString hashedData;
+
+			CPPUNIT_ASSERT(hash->hashInit());
+			CPPUNIT_ASSERT(hash->hashUpdate(message));
+			CPPUNIT_ASSERT(hash->hashFinal(hashedData));
+
+			expected[t].push_back(hashedData);
+		}
+
+		states[t].thread = t;
+		states[t].expected = &expected[t];
+		states[t].failures = 0;
+	}
+
+	// Now hash the same messages from all threads at once
+	std::vector<std::thread> threads;
+
+	for (size_t t = 0; t < CONCURRENT_THREADS; t++)
+	{
+		threads.push_back(std::thread(concurrentHashThread, &states[t]));
+	}
+
+	for (size_t t = 0; t < threads.size(); t++)
+	{
+		threads[t].join();
+	}
+
+	for (size_t t = 0; t < CONCURRENT_THREADS; t++)
+	{
+		CPPUNIT_ASSERT(states[t].failures == 0);
+	}
+
+	CryptoFactory::i()->recycleHashAlgorithm(hash);
+
+	hash = NULL;
+}
+
+static void benchHashThread()
+{
+	HashAlgorithm* hash = CryptoFactory::i()->getHashAlgorithm(HashAlgo::SHA256);
+	ByteString message;
+	ByteString hashedData;
+
+	if (hash == NULL) return;
+
+	message.resize(BENCH_MESSAGE_SIZE);
+
+	for (size_t n = 0; n < BENCH_ITERATIONS; n++)
+	{
+		hash->hashInit();
+		hash->hashUpdate(message);
+		hash->hashFinal(hashedData);
+	}
+
+	CryptoFactory::i()->recycleHashAlgorithm(hash);
+}
+
+void HashTests::testSHA256Throughput()
+{
+	size_t threadCounts[] = { 1, 2, 4, 8 };
+
+	printf("\n");
+
+	for (size_t t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]); t++)
+	{
+		std::vector<std::thread> threads;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		for (size_t i = 0; i < threadCounts[t]; i++)
+		{
+			threads.push_back(std::thread(benchHashThread));
+		}
+
+		for (size_t i = 0; i < threads.size(); i++)
+		{
+			threads[i].join();
+		}
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		double digests = (double) threadCounts[t] * BENCH_ITERATIONS;
+
+		printf("SHA256: %lu thread(s), %.0f digests of %d bytes per second\n",
+			(unsigned long) threadCounts[t], seconds > 0 ? digests / seconds : 0,
+			BENCH_MESSAGE_SIZE);
+	}
+}
+
 void HashTests::testSHA384()
 {
 	char testData[4096] = "11FCD8770F582C2D9C860D1EB4FDBFE40C551C6F3AF41A2540A39BA3A121BFEF995F1727A8703C29D0A44EB85B339F27955E1C679796A72980BB1D1BEF4D51A73174A983D36CDAD56BC1EEBA5DDD642094996531EEC94DE2FB6E0ED4F23BCB2F1D0B25505EB16306473DA17F809BD994FD9A737D29819BCCF94CA225D2EBB9D89DDA6E03E80A9DE87E44B72EFD397F9F344122B6591CED9BFDE8C0C42D8C17223A93F33B7D569291F91B619297F233C1454A168AAE126E89B0ED32B0B69AB095A1BB24BB7F1AAF8EE0BDBB43025EF3339F96C9EA352E78BA0661DE896E8F4DFAA7EF623F2B5305AD338448C5FCBDD6CC1F1222ED1D8F4C634B82591F8906DA8DDA9A0FFB0F1499B5BD08239F7EB3A02ACEC60FB76754D0AC5077C3B733D346F0BDE654CD612F60E2284115297A1557679901A911C2AC7323DA2FF3CD57895D7D181AD43AB7068609CE046B96B445EA08CDF50C40DFAFBA9F7082707A813B9C8E4E9D7F0230D5AFE40174693512DE96E3FAB1C8F6548880823645A0AD811694B293F788D0D523EBD81851594733EF45FC763B956044E29B29C195BDB317FBF97F41C601A2873C25557C3149F648424380FE79E4DC407A9CECD8F14B843C642FD9921F12786C8A1C6F8514C99672038693C5CF1FBE91F903E4ABC9E55B967B2F72FDF1A2EC09C14C94C001BAC47A0C36E9E6F34431381069CFD64D85F11285391A4DC7419B2EE8062F344538413E757EC258192B90F2CCC1186AB9A4ED5CE1290644CDEDAF03A4BF3E94B9F9D132ED159CE03586C5A69EF0A471146378BCCE799A3CD8D627B688BB28C9288F44D1218BC34A05BEAA398371ADC60CA8A2557AB69BE7B737F84BFFA93A1E1115F498600F52144E0D61055A2FC0CD45E20962CB2FF475896D733C74C2E95986389ED74B1497A35E73FEE0F36270CC65D76C1FE27A35E8F1FA0C5CA7F2C6003E21BD6677502CE268EB55B16DA863FA291AA111F338F10592AF86DFC297718365C04839748195E20A64BF42020846A46C94F1728549B8310A7FBCBA2C1441B033639CE52B6DBDA69F6ACC57F2DE6BAC57755734AFE4B77869C4D9B0DC56B115476A86A82F816CB148CDFD2B1DCCBEFCD4559B59AA88C6429F4A9EBB43B641144752A5E6F8BE1B739AA69FEBCB8D7439E5D917CA759982146E627FF81E80CEBC37BE0CF2A6C12A3E84A389FFD25013C491AE90A395D4DBCA81340E86848217AC426603CCAC981B5ED701CE9AB2851DC5F2ED72484FE99767C0FDB6F122B0C67926A637B57EC4F047804BC3A9BD55CBD78B83154BC27B6F8A66085EF02A206F329F3B1531ED657C75E29DF4276070AE5054F484A12990A9DD13C112FB6D3D57AE42E6A048870FDAABA48F73E03344C0E13832BAFCA2AF81AF19E5C28983F7BAAA5135803E78FBDDF7FB53C9B9B709274F05C774C77F0B84";
@@ -46,6 +46,8 @@ class HashTests : public CppUnit::TestFixture
 	// CPPUNIT_TEST(testSHA1);
 	// CPPUNIT_TEST(testSHA224);
 	CPPUNIT_TEST(testSHA256);
+	CPPUNIT_TEST(testSHA256Concurrent);
+	CPPUNIT_TEST(testSHA256Throughput);
 	// CPPUNIT_TEST(testSHA384);
 	// CPPUNIT_TEST(testSHA512);
 	CPPUNIT_TEST_SUITE_END();
@@ -57,6 +59,8 @@ public:
 	void testSHA1();
 	void testSHA224();
 	void testSHA256();
+	void testSHA256Concurrent();
+	void testSHA256Throughput();
 	void testSHA384();
 	void testSHA512();
 
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizarSimTests.cpp
+
+ Contains test cases for the simulated Mizar chip
+ *****************************************************************************/
+
+#include <chrono>
+#include <memory>
+#include <cppunit/extensions/HelperMacros.h>
+#include "MizarSimTests.h"
+#include "ByteString.h"
+#include "mizaru/MizarSimDevice.h"
+#include "mizaru/mizar_api.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(MizarSimTests);
+
+#define TEST_AES_INDEX 43
+
+void MizarSimTests::setUp()
+{
+	CPPUNIT_ASSERT(MizarSdkInit(0, NULL) == SUCCESS);
+}
+
+void MizarSimTests::tearDown()
+{
+	MizarSimDevice* device = MizarSimDevice::get(0);
+
+	device->setSpiSpeed(0);
+	device->setLatency(MIZAR_INS_GEN_RND, 0);
+
+	MizarSetDeviceType(DEVICE_TYPE_SPI);
+	MizarDeleteSymmKey(TEST_AES_INDEX);
+
+	fflush(stdout);
+}
+
+static mizar_uint64 elapsedMs(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void MizarSimTests::testFraming()
+{
+	std::unique_ptr<TMizarMsg> msg(new TMizarMsg);
+	std::unique_ptr<TMizarMsg> copy(new TMizarMsg);
+	mizar_uint8 wire[64];
+
+	// CRC-16/CCITT-FALSE check value
+	CPPUNIT_ASSERT(MizarSimDevice::crc16((const mizar_uint8*) "123456789", 9) == 0x29B1);
+
+	MizarSimWriter body(msg.get(), MAX_BODY_LEN);
+	body.u32(MIZAR_SIM_MODE_CBC);
+	body.bytes((const mizar_uint8*) "abc", 3);
+	msg->ins = MIZAR_INS_GET_STATE;
+	msg->p1 = 1;
+	msg->p2 = 2;
+	msg->retcode = 0;
+
+	mizar_uint32 len = MizarSimDevice::encode(msg.get(), wire);
+	CPPUNIT_ASSERT(len == MSG_HEAD_LEN + 11);
+	CPPUNIT_ASSERT(MizarSimDevice::decode(wire, len, copy.get()) == SUCCESS);
+	CPPUNIT_ASSERT(copy->ins == MIZAR_INS_GET_STATE && copy->p1 == 1 && copy->p2 == 2);
+
+	MizarSimReader reader(copy.get());
+	mizar_uint32 value;
+	mizar_uint8 text[3];
+	mizar_uint32 textLen = sizeof(text);
+	CPPUNIT_ASSERT(reader.u32(value) && value == MIZAR_SIM_MODE_CBC);
+	CPPUNIT_ASSERT(reader.copy(text, &textLen) && textLen == 3 && !memcmp(text, "abc", 3));
+	CPPUNIT_ASSERT(!reader.u32(value));
+
+	// A damaged frame is refused by both sides
+	wire[MSG_HEAD_LEN + 5] ^= 0x01;
+	CPPUNIT_ASSERT(MizarSimDevice::decode(wire, len, copy.get()) == ERR_MSG_CRC);
+
+	mizar_uint8 response[64];
+	mizar_uint32 responseLen = 0;
+	CPPUNIT_ASSERT(MizarSimDevice::get(0)->transfer(wire, len, response, &responseLen) == SUCCESS);
+	CPPUNIT_ASSERT(MizarSimDevice::decode(response, responseLen, copy.get()) == SUCCESS);
+	CPPUNIT_ASSERT(copy->retcode == ERR_MSG_CRC);
+
+	// Unknown commands and channels
+	msg->ins = 0xFF;
+	CPPUNIT_ASSERT(MizarSendRecv(msg.get(), copy.get()) == SUCCESS);
+	CPPUNIT_ASSERT(MizarGetMizarMsgRetCode(copy.get()) == ERR_NOT_SUPPORT);
+	CPPUNIT_ASSERT(MizarSendRecvSn(MIZAR_SIM_MAX_DEVICES, msg.get(), copy.get()) == ERR_OPENDEV);
+
+	mizar_uint32 state = 1;
+	CPPUNIT_ASSERT(MizarGetState(&state, NULL) == SUCCESS);
+	CPPUNIT_ASSERT(state == 0);
+}
+
+void MizarSimTests::testChunking()
+{
+	// Random data longer than one message
+	ByteString random;
+	random.resize(5000);
+	CPPUNIT_ASSERT(MizarGenRnd(0, random.size(), &random[0]) == SUCCESS);
+	CPPUNIT_ASSERT(random.substr(0, 16) != random.substr(4984, 16));
+
+	ByteString plainKey("0020");
+	plainKey += random.substr(0, 32);
+	CPPUNIT_ASSERT(MizarImportSymmKey(2, TEST_AES_INDEX, 0, plainKey.size(), &plainKey[0], NULL) == SUCCESS);
+
+	// The CBC chain is the same whatever the size of the messages
+	ByteString iv = random.substr(32, 16);
+	ByteString data = random.substr(48, 4800);
+	ByteString spi, sdio, decrypted;
+	spi.resize(data.size());
+	sdio.resize(data.size());
+	decrypted.resize(data.size());
+	mizar_uint32 outLen;
+
+	outLen = spi.size();
+	CPPUNIT_ASSERT(MizarAesCbcIndex(0, &iv[0], TEST_AES_INDEX, data.size(), &data[0], &outLen, &spi[0]) == SUCCESS);
+	CPPUNIT_ASSERT(outLen == data.size());
+
+	CPPUNIT_ASSERT(MizarSetDeviceType(DEVICE_TYPE_SDIO) == SUCCESS);
+	outLen = sdio.size();
+	CPPUNIT_ASSERT(MizarAesCbcIndex(0, &iv[0], TEST_AES_INDEX, data.size(), &data[0], &outLen, &sdio[0]) == SUCCESS);
+	CPPUNIT_ASSERT(spi == sdio);
+
+	// Decrypt in place
+	CPPUNIT_ASSERT(MizarSetDeviceType(DEVICE_TYPE_SPI) == SUCCESS);
+	decrypted = spi;
+	outLen = decrypted.size();
+	CPPUNIT_ASSERT(MizarAesCbcIndex(1, &iv[0], TEST_AES_INDEX, decrypted.size(), &decrypted[0], &outLen, &decrypted[0]) == SUCCESS);
+	CPPUNIT_ASSERT(decrypted == data);
+
+	// Partial blocks are refused
+	outLen = spi.size();
+	CPPUNIT_ASSERT(MizarAesEcbIndex(0, TEST_AES_INDEX, 15, &data[0], &outLen, &spi[0]) != SUCCESS);
+}
+
+void MizarSimTests::testLatency()
+{
+	MizarSimDevice* device = MizarSimDevice::get(0);
+	mizar_uint8 buf[2000];
+
+	CPPUNIT_ASSERT(!device->setLatency("no_such_command", 1));
+	CPPUNIT_ASSERT(device->setLatency("rnd", 20000));
+
+	mizar_uint64 before = device->getCommandCount();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	CPPUNIT_ASSERT(MizarGenRnd(0, 16, buf) == SUCCESS);
+	CPPUNIT_ASSERT(elapsedMs(start) >= 20);
+	CPPUNIT_ASSERT(device->getCommandCount() == before + 1);
+
+	device->setLatency(MIZAR_INS_GEN_RND, 0);
+
+	// 2000 bytes at 1 MHz take at least 16 ms on the wire
+	device->setSpiSpeed(1000000);
+	start = std::chrono::steady_clock::now();
+	CPPUNIT_ASSERT(MizarGenRnd(0, sizeof(buf), buf) == SUCCESS);
+	CPPUNIT_ASSERT(elapsedMs(start) >= 16);
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruDevicePoolTests.cpp
+
+ Contains test cases for running operations on the Mizar message channels
+ *****************************************************************************/
+
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cppunit/extensions/HelperMacros.h>
+#include "MizaruDevicePoolTests.h"
+#include "mizaru/MizaruDevicePool.h"
+#include "mizaru/MizarSimDevice.h"
+#include "mizaru/mizar_api.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(MizaruDevicePoolTests);
+
+// The chips that the tests touch
+#define TEST_CHANNELS 2
+
+void MizaruDevicePoolTests::setUp()
+{
+	// The pools of these tests run without the crypto factory
+	MizarSimDevice::createLocks();
+
+	for (int c = 0; c < TEST_CHANNELS; c++)
+	{
+		MizarSimDevice::get(c)->setOnline(true);
+	}
+}
+
+void MizaruDevicePoolTests::tearDown()
+{
+	for (int c = 0; c < TEST_CHANNELS; c++)
+	{
+		MizarSimDevice::get(c)->setOnline(true);
+		MizarSimDevice::get(c)->setLatency(MIZAR_INS_GEN_RND, 0);
+	}
+
+	fflush(stdout);
+}
+
+static mizar_uint32 generate()
+{
+	mizar_uint8 rnd[32];
+
+	return MizarGenRnd(0, sizeof(rnd), rnd);
+}
+
+// Runs count operations from each of nThreads threads and returns the time taken in ms
+static long long runConcurrently(MizaruDevicePool* pool, int nThreads, int count, bool* allOK)
+{
+	std::vector<std::thread> threads;
+	std::vector<int> failures(nThreads, 0);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (int t = 0; t < nThreads; t++)
+	{
+		threads.push_back(std::thread([pool, count, t, &failures]
+		{
+			for (int n = 0; n < count; n++)
+			{
+				if (pool->run(generate) != SUCCESS) failures[t]++;
+			}
+		}));
+	}
+
+	for (size_t t = 0; t < threads.size(); t++)
+	{
+		threads[t].join();
+	}
+
+	*allOK = true;
+	for (int t = 0; t < nThreads; t++)
+	{
+		if (failures[t] != 0) *allOK = false;
+	}
+
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void MizaruDevicePoolTests::testDispatch()
+{
+	MizaruDevicePool pool(1);
+	bool allOK;
+
+	CPPUNIT_ASSERT(pool.getChannelCount() == 1);
+
+	runConcurrently(&pool, 4, 4, &allOK);
+	CPPUNIT_ASSERT(allOK);
+
+	// Everything ran and nothing is left in flight
+	CPPUNIT_ASSERT(pool.getCompleted(0) == 16);
+	CPPUNIT_ASSERT(pool.getOutstanding(0) == 0);
+	CPPUNIT_ASSERT(pool.isHealthy(0));
+
+	// The API calls go to the default chip, not to another one
+	int channel = -1;
+	mizar_uint64 commands = MizarSimDevice::get(0)->getCommandCount();
+	mizar_uint64 otherCommands = MizarSimDevice::get(1)->getCommandCount();
+	CPPUNIT_ASSERT(pool.run(generate, &channel) == SUCCESS);
+	CPPUNIT_ASSERT(channel == 0);
+	CPPUNIT_ASSERT(pool.runOn(0, generate) == SUCCESS);
+	CPPUNIT_ASSERT(MizarSimDevice::get(0)->getCommandCount() == commands + 2);
+	CPPUNIT_ASSERT(MizarSimDevice::get(1)->getCommandCount() == otherCommands);
+	CPPUNIT_ASSERT(pool.runOn(1, generate) == ERR_SPI_SN);
+
+	// Command errors are not retried
+	unsigned long long before = pool.getCompleted(0);
+	CPPUNIT_ASSERT(pool.run([] { return MizarGenRnd(0, 16, NULL); }) == ERR_PARAMETER);
+	CPPUNIT_ASSERT(pool.getCompleted(0) == before + 1);
+}
+
+void MizaruDevicePoolTests::testSerialisation()
+{
+	MizaruDevicePool pool(1);
+	bool allOK;
+
+	MizarSimDevice::get(0)->setLatency(MIZAR_INS_GEN_RND, 5000);
+
+	// 16 operations of 5 ms, one at a time on the chip
+	long long ms = runConcurrently(&pool, 4, 4, &allOK);
+	CPPUNIT_ASSERT(allOK);
+	CPPUNIT_ASSERT(ms >= 80);
+}
+
+void MizaruDevicePoolTests::testHealth()
+{
+	MizaruDevicePool pool(1);
+
+	MizarSimDevice::get(0)->setOnline(false);
+
+	// Transport errors take the channel out of service
+	for (int n = 0; n < MIZARU_CHANNEL_MAX_FAILURES; n++)
+	{
+		CPPUNIT_ASSERT(pool.run(generate) == ERR_OPENDEV);
+	}
+
+	CPPUNIT_ASSERT(!pool.isHealthy(0));
+
+	// Out of service, so no longer tried
+	unsigned long long tried = pool.getCompleted(0);
+	CPPUNIT_ASSERT(pool.run(generate) == ERR_OPENDEV);
+	CPPUNIT_ASSERT(pool.getCompleted(0) == tried);
+
+	// Used again once it has recovered
+	MizarSimDevice::get(0)->setOnline(true);
+	std::this_thread::sleep_for(std::chrono::milliseconds(MIZARU_CHANNEL_RETRY_MS + 50));
+	CPPUNIT_ASSERT(pool.isHealthy(0));
+
+	CPPUNIT_ASSERT(pool.run(generate) == SUCCESS);
+	CPPUNIT_ASSERT(pool.getCompleted(0) == tried + 1);
+	CPPUNIT_ASSERT(pool.isHealthy(0));
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruECDSATests.cpp
+
+ Contains test cases for batched ECDSA verification on the Mizar chip
+ *****************************************************************************/
+
+#include <vector>
+#include <cppunit/extensions/HelperMacros.h>
+#include "MizaruECDSATests.h"
+#include "CryptoFactory.h"
+#include "DerUtil.h"
+#include "mizaru/MizaruDevicePool.h"
+#include "mizaru/MizaruECPublicKey.h"
+#include "mizaru/MizarSimDevice.h"
+#include "mizaru/mizar_api.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(MizaruECDSATests);
+
+#define TEST_ECC_INDEX 4
+#define TEST_ECC_GROUP 415
+#define TEST_BATCH_SIZE 16
+
+void MizaruECDSATests::setUp()
+{
+	ecdsa = NULL;
+	publicKey = NULL;
+
+	CPPUNIT_ASSERT(MizarSdkInit(0, NULL) == SUCCESS);
+
+	ecdsa = CryptoFactory::i()->getAsymmetricAlgorithm(AsymAlgo::ECDSA);
+	CPPUNIT_ASSERT(ecdsa != NULL);
+
+	// Generate a P-256 key in a slot and make a public key of its point
+	mizar_uint8 x[66], y[66];
+	mizar_uint32 xLen = sizeof(x), yLen = sizeof(y);
+	CPPUNIT_ASSERT(MizarGenEccKeyIndex(TEST_ECC_INDEX, TEST_ECC_GROUP, &xLen, x, &yLen, y) == SUCCESS);
+
+	ByteString point("04");
+	point += ByteString(x, xLen);
+	point += ByteString(y, yLen);
+
+	MizaruECPublicKey* key = (MizaruECPublicKey*) ecdsa->newPublicKey();
+	CPPUNIT_ASSERT(key != NULL);
+	key->setEC(ByteString("06082a8648ce3d030107"));
+	key->setQ(DERUTIL::raw2Octet(point));
+	CPPUNIT_ASSERT(key->getGroup() == TEST_ECC_GROUP);
+	CPPUNIT_ASSERT(key->getX().size() == 32);
+
+	publicKey = key;
+}
+
+void MizaruECDSATests::tearDown()
+{
+	MizarDeleteEccKey(TEST_ECC_INDEX);
+
+	if (ecdsa != NULL)
+	{
+		ecdsa->recyclePublicKey(publicKey);
+		CryptoFactory::i()->recycleAsymmetricAlgorithm(ecdsa);
+	}
+
+	fflush(stdout);
+}
+
+// Signs a random digest with the key in the slot
+static void makeItem(PublicKey* publicKey, AsymVerifyItem& item)
+{
+	item.publicKey = publicKey;
+	item.data.resize(32);
+	item.valid = false;
+	CPPUNIT_ASSERT(MizarGenRnd(0, item.data.size(), &item.data[0]) == SUCCESS);
+
+	mizar_uint8 r[66], s[66];
+	mizar_uint32 rLen = sizeof(r), sLen = sizeof(s);
+	CPPUNIT_ASSERT(MizarEccSignIndex(TEST_ECC_INDEX, 0, item.data.size(), &item.data[0], &rLen, r, &sLen, s) == SUCCESS);
+
+	item.signature = ByteString(r, rLen) + ByteString(s, sLen);
+}
+
+void MizaruECDSATests::testVerifyBatch()
+{
+	std::vector<AsymVerifyItem> items(TEST_BATCH_SIZE);
+
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		makeItem(publicKey, items[i]);
+	}
+
+	// Damage some of the signatures
+	items[3].signature[5] ^= 0x01;
+	items[7].data[0] ^= 0x80;
+	items[11].signature.resize(63);
+
+	CPPUNIT_ASSERT(ecdsa->verifyBatch(items, AsymMech::ECDSA));
+
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		CPPUNIT_ASSERT(items[i].valid == (i != 3 && i != 7 && i != 11));
+	}
+
+	// Single verification goes through the same path
+	CPPUNIT_ASSERT(ecdsa->verify(publicKey, items[0].data, items[0].signature, AsymMech::ECDSA));
+	CPPUNIT_ASSERT(!ecdsa->verify(publicKey, items[3].data, items[3].signature, AsymMech::ECDSA));
+
+	// Only ECDSA is batched
+	CPPUNIT_ASSERT(!ecdsa->verifyBatch(items, AsymMech::RSA_PKCS));
+}
+
+// The commands handled and the operations run by all channels
+static void countWork(mizar_uint64& commands, unsigned long long& operations)
+{
+	MizaruDevicePool* pool = MizaruDevicePool::i();
+
+	commands = 0;
+	operations = 0;
+
+	for (unsigned i = 0; i < pool->getChannelCount(); i++)
+	{
+		commands += MizarSimDevice::get(i)->getCommandCount();
+		operations += pool->getCompleted(i);
+	}
+}
+
+void MizaruECDSATests::testBatchChannel()
+{
+	std::vector<AsymVerifyItem> items(TEST_BATCH_SIZE);
+
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		makeItem(publicKey, items[i]);
+	}
+
+	mizar_uint64 commandsBefore, commandsAfter;
+	unsigned long long operationsBefore, operationsAfter;
+
+	countWork(commandsBefore, operationsBefore);
+	CPPUNIT_ASSERT(ecdsa->verifyBatch(items, AsymMech::ECDSA));
+	countWork(commandsAfter, operationsAfter);
+
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		CPPUNIT_ASSERT(items[i].valid);
+	}
+
+	// One verify command per signature, all on one hold of a channel
+	CPPUNIT_ASSERT(commandsAfter == commandsBefore + TEST_BATCH_SIZE);
+	CPPUNIT_ASSERT(operationsAfter == operationsBefore + 1);
+}
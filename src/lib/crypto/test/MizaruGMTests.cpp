@@ -0,0 +1,463 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruGMTests.cpp
+
+ Contains test cases for AES-CCM and the SM2, SM3, SM4 and ZUC algorithms
+ of the Mizaru backend
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include "MizaruGMTests.h"
+#include "CryptoFactory.h"
+#include "AESKey.h"
+#include "ECParameters.h"
+#include "mizaru/MizaruECPrivateKey.h"
+#include "mizaru/MizaruECPublicKey.h"
+#include "mizaru/MizaruOffload.h"
+#include "mizaru/MizaruZUCMac.h"
+#include "mizaru/MizarSimDevice.h"
+#include "mizaru/mizar_api.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(MizaruGMTests);
+
+void MizaruGMTests::setUp()
+{
+	CPPUNIT_ASSERT(MizarSdkInit(0, NULL) == SUCCESS);
+}
+
+void MizaruGMTests::tearDown()
+{
+	MizaruOffload::reset();
+
+	fflush(stdout);
+}
+
+// Sends everything or nothing to the chip
+static void forceChip(bool chip)
+{
+	for (int op = 0; op < MizaruOffload::OPERATION_COUNT; op++)
+	{
+		MizaruOffload::i()->setCrossover((MizaruOffload::Operation) op, chip ? 0 : MIZARU_OFFLOAD_NEVER);
+	}
+}
+
+static mizar_uint64 commandCount()
+{
+	return MizarSimDevice::get(0)->getCommandCount();
+}
+
+// Hashes in one and in three parts
+static void hash(const ByteString& data, ByteString& result)
+{
+	HashAlgorithm* sm3 = CryptoFactory::i()->getHashAlgorithm(HashAlgo::SM3);
+	CPPUNIT_ASSERT(sm3 != NULL);
+	CPPUNIT_ASSERT(sm3->getHashSize() == 32);
+
+	ByteString parts;
+	size_t split = data.size() / 3;
+
+	CPPUNIT_ASSERT(sm3->hashInit());
+	CPPUNIT_ASSERT(sm3->hashUpdate(data));
+	CPPUNIT_ASSERT(sm3->hashFinal(result));
+
+	CPPUNIT_ASSERT(sm3->hashInit());
+	CPPUNIT_ASSERT(sm3->hashUpdate(data.substr(0, split)));
+	CPPUNIT_ASSERT(sm3->hashUpdate(data.substr(split, split)));
+	CPPUNIT_ASSERT(sm3->hashUpdate(data.substr(2 * split)));
+	CPPUNIT_ASSERT(sm3->hashFinal(parts));
+
+	CPPUNIT_ASSERT(parts == result);
+
+	CryptoFactory::i()->recycleHashAlgorithm(sm3);
+}
+
+void MizaruGMTests::testSM3()
+{
+	ByteString abc((const unsigned char*) "abc", 3);
+	ByteString result;
+
+	// The example of GB/T 32905
+	forceChip(true);
+	mizar_uint64 before = commandCount();
+	hash(abc, result);
+	CPPUNIT_ASSERT(commandCount() > before);
+	CPPUNIT_ASSERT(result == ByteString("66c7f0f462eeedd9d1f2d46bdc10e4e24167c4875cf2f7a2297da02b8f4ba8e0"));
+
+	forceChip(false);
+	before = commandCount();
+	hash(abc, result);
+	CPPUNIT_ASSERT(commandCount() == before);
+	CPPUNIT_ASSERT(result == ByteString("66c7f0f462eeedd9d1f2d46bdc10e4e24167c4875cf2f7a2297da02b8f4ba8e0"));
+
+	// Larger data gives the same on both
+	ByteString data, expected;
+	CPPUNIT_ASSERT(CryptoFactory::i()->getRNG()->generateRandom(data, 5000));
+	hash(data, expected);
+	forceChip(true);
+	hash(data, result);
+	CPPUNIT_ASSERT(result == expected);
+}
+
+// Encrypts and decrypts in two parts, the first one not a whole block
+static void crypt(SymAlgo::Type algorithm, SymmetricKey* key, SymMode::Type mode, const ByteString& iv, bool padding, const ByteString& data, ByteString& encrypted)
+{
+	SymmetricAlgorithm* cipher = CryptoFactory::i()->getSymmetricAlgorithm(algorithm);
+	CPPUNIT_ASSERT(cipher != NULL);
+
+	ByteString part;
+	size_t split = data.size() / 2 + 3;
+
+	encrypted.wipe();
+	CPPUNIT_ASSERT(cipher->encryptInit(key, mode, iv, padding));
+	CPPUNIT_ASSERT(cipher->encryptUpdate(data.substr(0, split), part));
+	encrypted += part;
+	CPPUNIT_ASSERT(cipher->encryptUpdate(data.substr(split), part));
+	encrypted += part;
+	CPPUNIT_ASSERT(cipher->encryptFinal(part));
+	encrypted += part;
+
+	ByteString decrypted;
+	CPPUNIT_ASSERT(cipher->decryptInit(key, mode, iv, padding));
+	CPPUNIT_ASSERT(cipher->decryptUpdate(encrypted.substr(0, split), part));
+	decrypted += part;
+	CPPUNIT_ASSERT(cipher->decryptUpdate(encrypted.substr(split), part));
+	decrypted += part;
+	CPPUNIT_ASSERT(cipher->decryptFinal(part));
+	decrypted += part;
+
+	CPPUNIT_ASSERT(decrypted == data);
+
+	CryptoFactory::i()->recycleSymmetricAlgorithm(cipher);
+}
+
+void MizaruGMTests::testSM4()
+{
+	// The example of GB/T 32907
+	SymmetricKey key(128);
+	CPPUNIT_ASSERT(key.setKeyBits(ByteString("0123456789abcdeffedcba9876543210")));
+
+	ByteString encrypted;
+	forceChip(true);
+	mizar_uint64 before = commandCount();
+	crypt(SymAlgo::SM4, &key, SymMode::ECB, ByteString(), false, ByteString("0123456789abcdeffedcba9876543210"), encrypted);
+	CPPUNIT_ASSERT(commandCount() > before);
+	CPPUNIT_ASSERT(encrypted == ByteString("681edf34d206965e86b3e94f536e4246"));
+
+	forceChip(false);
+	before = commandCount();
+	crypt(SymAlgo::SM4, &key, SymMode::ECB, ByteString(), false, ByteString("0123456789abcdeffedcba9876543210"), encrypted);
+	CPPUNIT_ASSERT(commandCount() == before);
+	CPPUNIT_ASSERT(encrypted == ByteString("681edf34d206965e86b3e94f536e4246"));
+
+	// The chip and OpenSSL give the same result
+	ByteString iv, data;
+	CPPUNIT_ASSERT(CryptoFactory::i()->getRNG()->generateRandom(iv, 16));
+	CPPUNIT_ASSERT(CryptoFactory::i()->getRNG()->generateRandom(data, 1500));
+
+	SymMode::Type modes[] = { SymMode::ECB, SymMode::CBC };
+
+	for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+	{
+		ByteString software, chip;
+
+		forceChip(false);
+		crypt(SymAlgo::SM4, &key, modes[i], iv, true, data, software);
+		forceChip(true);
+		crypt(SymAlgo::SM4, &key, modes[i], iv, true, data, chip);
+
+		CPPUNIT_ASSERT(chip == software);
+		CPPUNIT_ASSERT(chip.size() == (data.size() / 16 + 1) * 16);
+	}
+
+	// The stream modes are left to OpenSSL
+	before = commandCount();
+	crypt(SymAlgo::SM4, &key, SymMode::OFB, iv, false, data, encrypted);
+	CPPUNIT_ASSERT(encrypted.size() == data.size());
+	crypt(SymAlgo::SM4, &key, SymMode::CTR, iv, false, data, encrypted);
+	CPPUNIT_ASSERT(encrypted.size() == data.size());
+	CPPUNIT_ASSERT(commandCount() == before);
+
+	// Only 128-bit keys
+	SymmetricKey longKey(256);
+	CPPUNIT_ASSERT(longKey.setKeyBits(ByteString("0123456789abcdeffedcba98765432100123456789abcdeffedcba9876543210")));
+	SymmetricAlgorithm* sm4 = CryptoFactory::i()->getSymmetricAlgorithm(SymAlgo::SM4);
+	CPPUNIT_ASSERT(!sm4->encryptInit(&longKey, SymMode::ECB));
+	CryptoFactory::i()->recycleSymmetricAlgorithm(sm4);
+}
+
+// Verifies an SM3 with SM2 signature with OpenSSL only
+static bool opensslVerify(PublicKey* publicKey, const ByteString& id, const ByteString& data, const ByteString& signature)
+{
+	EC_KEY* eckey = EC_KEY_dup(((OSSLECPublicKey*) publicKey)->getOSSLKey());
+	EVP_PKEY* pkey = EVP_PKEY_new();
+	EVP_PKEY_set1_EC_KEY(pkey, eckey);
+	EC_KEY_free(eckey);
+
+	ECDSA_SIG* sig = ECDSA_SIG_new();
+	ECDSA_SIG_set0(sig, BN_bin2bn(signature.const_byte_str(), 32, NULL), BN_bin2bn(signature.const_byte_str() + 32, 32, NULL));
+	unsigned char* der = NULL;
+	int derLen = i2d_ECDSA_SIG(sig, &der);
+	ECDSA_SIG_free(sig);
+
+	EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new(pkey, NULL);
+	EVP_MD_CTX* mctx = EVP_MD_CTX_new();
+	EVP_PKEY_CTX_set1_id(pctx, id.const_byte_str(), id.size());
+	EVP_MD_CTX_set_pkey_ctx(mctx, pctx);
+
+	bool rv = EVP_DigestVerifyInit(mctx, NULL, EVP_sm3(), NULL, pkey) == 1 &&
+		  EVP_DigestVerify(mctx, der, derLen, data.const_byte_str(), data.size()) == 1;
+
+	EVP_MD_CTX_free(mctx);
+	EVP_PKEY_CTX_free(pctx);
+	OPENSSL_free(der);
+	EVP_PKEY_free(pkey);
+
+	return rv;
+}
+
+void MizaruGMTests::testSM2()
+{
+	AsymmetricAlgorithm* sm2 = CryptoFactory::i()->getAsymmetricAlgorithm(AsymAlgo::SM2);
+	CPPUNIT_ASSERT(sm2 != NULL);
+
+	// Only the SM2 curve
+	AsymmetricKeyPair* kp;
+	ECParameters p;
+	p.setEC(ByteString("06082a8648ce3d030107"));
+	CPPUNIT_ASSERT(!sm2->generateKeyPair(&kp, &p));
+
+	// An SM2 key pair, rebuilt as keys the chip can use
+	p.setEC(ByteString("06082a811ccf5501822d"));
+	CPPUNIT_ASSERT(sm2->generateKeyPair(&kp, &p));
+
+	MizaruECPrivateKey* priv = (MizaruECPrivateKey*) sm2->newPrivateKey();
+	priv->setEC(((ECPrivateKey*) kp->getPrivateKey())->getEC());
+	priv->setD(((ECPrivateKey*) kp->getPrivateKey())->getD());
+	CPPUNIT_ASSERT(priv->getGroup() == 1172);
+
+	MizaruECPublicKey* pub = (MizaruECPublicKey*) sm2->newPublicKey();
+	pub->setEC(((ECPublicKey*) kp->getPublicKey())->getEC());
+	pub->setQ(((ECPublicKey*) kp->getPublicKey())->getQ());
+	CPPUNIT_ASSERT(pub->getGroup() == 1172);
+
+	ByteString digest;
+	CPPUNIT_ASSERT(CryptoFactory::i()->getRNG()->generateRandom(digest, 32));
+
+	// Signed on the chip, verified by OpenSSL and the other way around
+	ByteString signature;
+	forceChip(true);
+	mizar_uint64 before = commandCount();
+	CPPUNIT_ASSERT(sm2->sign(priv, digest, signature, AsymMech::SM2));
+	CPPUNIT_ASSERT(commandCount() > before);
+	CPPUNIT_ASSERT(signature.size() == 64);
+	forceChip(false);
+	before = commandCount();
+	CPPUNIT_ASSERT(sm2->verify(pub, digest, signature, AsymMech::SM2));
+	CPPUNIT_ASSERT(commandCount() == before);
+
+	CPPUNIT_ASSERT(sm2->sign(priv, digest, signature, AsymMech::SM2));
+	forceChip(true);
+	CPPUNIT_ASSERT(sm2->verify(pub, digest, signature, AsymMech::SM2));
+	CPPUNIT_ASSERT(commandCount() > before);
+	signature[10] ^= 0x01;
+	CPPUNIT_ASSERT(!sm2->verify(pub, digest, signature, AsymMech::SM2));
+
+	// With SM3 the signer ID is part of the hash, as for OpenSSL
+	ByteString data, id((const unsigned char*) "ALICE123@YAHOO.COM", 18), defaultID((const unsigned char*) "1234567812345678", 16);
+	CPPUNIT_ASSERT(CryptoFactory::i()->getRNG()->generateRandom(data, 300));
+
+	CPPUNIT_ASSERT(sm2->signInit(priv, AsymMech::SM2_SM3, id.const_byte_str(), id.size()));
+	CPPUNIT_ASSERT(sm2->signUpdate(data.substr(0, 100)));
+	CPPUNIT_ASSERT(sm2->signUpdate(data.substr(100)));
+	CPPUNIT_ASSERT(sm2->signFinal(signature));
+	CPPUNIT_ASSERT(opensslVerify(pub, id, data, signature));
+	CPPUNIT_ASSERT(!opensslVerify(pub, defaultID, data, signature));
+	forceChip(false);
+	CPPUNIT_ASSERT(sm2->verify(pub, data, signature, AsymMech::SM2_SM3, id.const_byte_str(), id.size()));
+	CPPUNIT_ASSERT(!sm2->verify(pub, data, signature, AsymMech::SM2_SM3));
+
+	CPPUNIT_ASSERT(sm2->sign(priv, data, signature, AsymMech::SM2_SM3));
+	CPPUNIT_ASSERT(opensslVerify(pub, defaultID, data, signature));
+
+	// Encrypted by OpenSSL, decrypted on the chip and the other way around
+	ByteString encrypted, decrypted;
+	forceChip(false);
+	CPPUNIT_ASSERT(sm2->encrypt(pub, data, encrypted, AsymMech::SM2_ENCRYPT));
+	CPPUNIT_ASSERT(encrypted.size() == data.size() + 97);
+	CPPUNIT_ASSERT(encrypted[0] == 0x04);
+	forceChip(true);
+	before = commandCount();
+	CPPUNIT_ASSERT(sm2->decrypt(priv, encrypted, decrypted, AsymMech::SM2_ENCRYPT));
+	CPPUNIT_ASSERT(commandCount() > before);
+	CPPUNIT_ASSERT(decrypted == data);
+
+	CPPUNIT_ASSERT(sm2->encrypt(pub, data, encrypted, AsymMech::SM2_ENCRYPT));
+	CPPUNIT_ASSERT(encrypted.size() == data.size() + 97);
+	forceChip(false);
+	CPPUNIT_ASSERT(sm2->decrypt(priv, encrypted, decrypted, AsymMech::SM2_ENCRYPT));
+	CPPUNIT_ASSERT(decrypted == data);
+	encrypted[encrypted.size() - 1] ^= 0x01;
+	CPPUNIT_ASSERT(!sm2->decrypt(priv, encrypted, decrypted, AsymMech::SM2_ENCRYPT));
+
+	sm2->recyclePrivateKey(priv);
+	sm2->recyclePublicKey(pub);
+	sm2->recycleKeyPair(kp);
+	CryptoFactory::i()->recycleAsymmetricAlgorithm(sm2);
+}
+
+void MizaruGMTests::testZUC()
+{
+	// Test set 3 of the 128-EEA3 specification
+	SymmetricKey key(128);
+	CPPUNIT_ASSERT(key.setKeyBits(ByteString("e5bd3ea0eb55ade866c6ac58bd54302a")));
+	ByteString iv("000568231801");
+	ByteString plain("14a8ef693d678507bbe7270a7f67ff5006c3525b9807e467c4e56000ba338f5d"
+			 "429559036751822246c80d3b38f07f4be2d8ff5805f5132229bde93bbbdcaf38"
+			 "2bf1ee972fbf9977bada8945847a2a6c9ad34a667554e04d1f7fa2c33241bd8f"
+			 "01ba220d");
+	ByteString expected("131d43e0dea1be5c5a1bfd971d852cbf712d7b4f57961fea3208afa8bca433f4"
+			    "56ad09c7417e58bc69cf8866d1353f74865e80781d202dfb3ecff7fcbc3b190f"
+			    "e82a204ed0e350fc0f6f2613b2f2bca6df5a473a57a4a00d985ebad880d6f238"
+			    "64a07b01");
+
+	ByteString encrypted;
+	crypt(SymAlgo::ZUC, &key, SymMode::Unknown, iv, false, plain, encrypted);
+	CPPUNIT_ASSERT(encrypted == expected);
+
+	// The chip takes at most 2000 bytes
+	SymmetricAlgorithm* zuc = CryptoFactory::i()->getSymmetricAlgorithm(SymAlgo::ZUC);
+	CPPUNIT_ASSERT(zuc != NULL);
+	CPPUNIT_ASSERT(!zuc->encryptInit(&key, SymMode::Unknown, ByteString("0005682318")));
+	CPPUNIT_ASSERT(zuc->encryptInit(&key, SymMode::Unknown, iv));
+	CPPUNIT_ASSERT(zuc->checkMaximumBytes(2000));
+	CPPUNIT_ASSERT(!zuc->checkMaximumBytes(2001));
+	CryptoFactory::i()->recycleSymmetricAlgorithm(zuc);
+
+	// The MAC is over the data and the same IV
+	MizaruZUCMac* mac = (MizaruZUCMac*) CryptoFactory::i()->getMacAlgorithm(MacAlgo::ZUC_EIA3);
+	CPPUNIT_ASSERT(mac != NULL);
+	CPPUNIT_ASSERT(mac->getMacSize() == 4);
+	CPPUNIT_ASSERT(!mac->setIV(ByteString("00056823")));
+	CPPUNIT_ASSERT(mac->setIV(iv));
+
+	ByteString signature, other;
+	CPPUNIT_ASSERT(mac->signInit(&key));
+	CPPUNIT_ASSERT(mac->signUpdate(plain.substr(0, 33)));
+	CPPUNIT_ASSERT(mac->signUpdate(plain.substr(33)));
+	CPPUNIT_ASSERT(mac->signFinal(signature));
+	CPPUNIT_ASSERT(signature.size() == 4);
+
+	CPPUNIT_ASSERT(mac->verifyInit(&key));
+	CPPUNIT_ASSERT(mac->verifyUpdate(plain));
+	CPPUNIT_ASSERT(mac->verifyFinal(signature));
+
+	CPPUNIT_ASSERT(mac->setIV(ByteString("000568231001")));
+	CPPUNIT_ASSERT(mac->signInit(&key));
+	CPPUNIT_ASSERT(mac->signUpdate(plain));
+	CPPUNIT_ASSERT(mac->signFinal(other));
+	CPPUNIT_ASSERT(other != signature);
+
+	CPPUNIT_ASSERT(mac->verifyInit(&key));
+	CPPUNIT_ASSERT(mac->verifyUpdate(plain));
+	CPPUNIT_ASSERT(!mac->verifyFinal(signature));
+
+	CryptoFactory::i()->recycleMacAlgorithm(mac);
+}
+
+// Encrypts and decrypts with CCM, the data in two parts
+static bool ccm(SymmetricKey* key, const ByteString& nonce, const ByteString& aad, size_t tagBytes, const ByteString& data, ByteString& encrypted)
+{
+	SymmetricAlgorithm* aes = CryptoFactory::i()->getSymmetricAlgorithm(SymAlgo::AES);
+	CPPUNIT_ASSERT(aes != NULL);
+
+	ByteString part;
+	size_t split = data.size() / 2;
+
+	encrypted.wipe();
+	CPPUNIT_ASSERT(aes->encryptInit(key, SymMode::CCM, nonce, false, 0, aad, tagBytes));
+	CPPUNIT_ASSERT(aes->encryptUpdate(data.substr(0, split), part));
+	encrypted += part;
+	CPPUNIT_ASSERT(aes->encryptUpdate(data.substr(split), part));
+	encrypted += part;
+	CPPUNIT_ASSERT(aes->encryptFinal(part));
+	encrypted += part;
+	CPPUNIT_ASSERT(encrypted.size() == data.size() + tagBytes);
+
+	ByteString decrypted;
+	bool rv = aes->decryptInit(key, SymMode::CCM, nonce, false, 0, aad, tagBytes) &&
+		  aes->decryptUpdate(encrypted, part) &&
+		  aes->decryptFinal(decrypted);
+
+	CryptoFactory::i()->recycleSymmetricAlgorithm(aes);
+
+	return rv && decrypted == data;
+}
+
+void MizaruGMTests::testCCM()
+{
+	// Example 1 of NIST SP 800-38C
+	AESKey key(128);
+	CPPUNIT_ASSERT(key.setKeyBits(ByteString("404142434445464748494a4b4c4d4e4f")));
+
+	ByteString encrypted;
+	CPPUNIT_ASSERT(ccm(&key, ByteString("10111213141516"), ByteString("0001020304050607"), 4, ByteString("20212223"), encrypted));
+	CPPUNIT_ASSERT(encrypted == ByteString("7162015b4dac255d"));
+
+	// The chip and OpenSSL give the same result
+	ByteString nonce, data;
+	CPPUNIT_ASSERT(CryptoFactory::i()->getRNG()->generateRandom(nonce, 12));
+	CPPUNIT_ASSERT(CryptoFactory::i()->getRNG()->generateRandom(data, 1000));
+
+	ByteString software, chip;
+	forceChip(false);
+	mizar_uint64 before = commandCount();
+	CPPUNIT_ASSERT(ccm(&key, nonce, ByteString(), 16, data, software));
+	CPPUNIT_ASSERT(commandCount() == before);
+	forceChip(true);
+	CPPUNIT_ASSERT(ccm(&key, nonce, ByteString(), 16, data, chip));
+	CPPUNIT_ASSERT(commandCount() > before);
+	CPPUNIT_ASSERT(chip == software);
+
+	// A changed tag is rejected
+	SymmetricAlgorithm* aes = CryptoFactory::i()->getSymmetricAlgorithm(SymAlgo::AES);
+	ByteString decrypted;
+	chip[chip.size() - 1] ^= 0x01;
+	CPPUNIT_ASSERT(aes->decryptInit(&key, SymMode::CCM, nonce, false, 0, ByteString(), 16));
+	CPPUNIT_ASSERT(aes->decryptUpdate(chip, decrypted));
+	CPPUNIT_ASSERT(!aes->decryptFinal(decrypted));
+
+	// The nonce is 7 to 13 bytes
+	CPPUNIT_ASSERT(!aes->encryptInit(&key, SymMode::CCM, ByteString("000102030405"), false, 0, ByteString(), 16));
+	CPPUNIT_ASSERT(!aes->encryptInit(&key, SymMode::CCM, ByteString("0001020304050607080910111213"), false, 0, ByteString(), 16));
+	CPPUNIT_ASSERT(aes->encryptInit(&key, SymMode::CCM, ByteString("00010203040506070809101112"), false, 0, ByteString(), 16));
+	CryptoFactory::i()->recycleSymmetricAlgorithm(aes);
+}
@@ -0,0 +1,316 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruIndexedTests.cpp
+
+ Contains test cases for the algorithms that use keys in Mizar key slots
+ *****************************************************************************/
+
+#include <cppunit/extensions/HelperMacros.h>
+#include "MizaruIndexedTests.h"
+#include "mizaru/MizaruCryptoFactory.h"
+#include "mizaru/MizaruIndexedPrivateKey.h"
+#include "mizaru/MizaruIndexedSymmetricKey.h"
+#include "mizaru/mizar_api.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(MizaruIndexedTests);
+
+// The key slots used by the tests
+#define TEST_RSA_INDEX 7
+#define TEST_ECC_INDEX 3
+#define TEST_AES_INDEX 42
+
+void MizaruIndexedTests::setUp()
+{
+	asym = MizaruCryptoFactory::i()->getIndexedAsymmetricAlgorithm(AsymAlgo::RSA);
+	aes = MizaruCryptoFactory::i()->getIndexedSymmetricAlgorithm(SymAlgo::AES);
+
+	CPPUNIT_ASSERT(asym != NULL);
+	CPPUNIT_ASSERT(aes != NULL);
+}
+
+void MizaruIndexedTests::tearDown()
+{
+	MizaruCryptoFactory::i()->recycleAsymmetricAlgorithm(asym);
+	MizaruCryptoFactory::i()->recycleSymmetricAlgorithm(aes);
+
+	MizarDeleteRsaKey(TEST_RSA_INDEX);
+	MizarDeleteEccKey(TEST_ECC_INDEX);
+	MizarDeleteSymmKey(TEST_AES_INDEX);
+
+	fflush(stdout);
+}
+
+// Generates an RSA key in the test slot and returns the public key
+static void genRSA(ByteString& n, ByteString& e)
+{
+	ByteString exponent("010001");
+	mizar_uint32 nLen = 128;
+	n.resize(nLen);
+
+	CPPUNIT_ASSERT(MizarGenRsaKeyIndex(TEST_RSA_INDEX, 1024, exponent.size(), &exponent[0], &nLen, &n[0]) == 0);
+	CPPUNIT_ASSERT(nLen == 128);
+
+	e = exponent;
+}
+
+// The raw RSA public key operation
+static ByteString rsaPublic(ByteString& n, ByteString& e, ByteString& in)
+{
+	ByteString out;
+	out.resize(n.size());
+	mizar_uint32 outLen = out.size();
+
+	CPPUNIT_ASSERT(MizarRsaPkEnc(n.size(), &n[0], e.size(), &e[0], in.size(), &in[0], &outLen, &out[0]) == 0);
+
+	return out;
+}
+
+void MizaruIndexedTests::testRSASign()
+{
+	ByteString n, e;
+	genRSA(n, e);
+
+	MizaruIndexedPrivateKey key(AsymAlgo::RSA, TEST_RSA_INDEX);
+	CPPUNIT_ASSERT(key.load());
+	CPPUNIT_ASSERT(key.getBitLength() == 1024);
+	CPPUNIT_ASSERT(key.getOutputLength() == 128);
+	CPPUNIT_ASSERT(key.PKCS8Encode().size() == 0);
+
+	// PKCS #1 v1.5 over a SHA-256 digest
+	ByteString data("0102030405060708090a0b0c0d0e0f");
+	ByteString sig;
+	CPPUNIT_ASSERT(asym->signInit(&key, AsymMech::RSA_SHA256_PKCS));
+	CPPUNIT_ASSERT(asym->signUpdate(data.substr(0, 7)));
+	CPPUNIT_ASSERT(asym->signUpdate(data.substr(7)));
+	CPPUNIT_ASSERT(asym->signFinal(sig));
+	CPPUNIT_ASSERT(sig.size() == 128);
+
+	ByteString em = rsaPublic(n, e, sig);
+	ByteString digestInfo("3031300d060960864801650304020105000420");
+	CPPUNIT_ASSERT(em.substr(0, 2) == ByteString("0001"));
+	CPPUNIT_ASSERT(em.substr(128 - 32 - digestInfo.size() - 1, digestInfo.size() + 1) == ByteString("00") + digestInfo);
+
+	// Single part PKCS #1 v1.5 over the data itself
+	CPPUNIT_ASSERT(asym->sign(&key, data, sig, AsymMech::RSA_PKCS));
+	em = rsaPublic(n, e, sig);
+	CPPUNIT_ASSERT(em.substr(128 - data.size()) == data);
+	CPPUNIT_ASSERT(em[128 - data.size() - 1] == 0x00);
+
+	// Raw RSA needs data as long as the modulus
+	CPPUNIT_ASSERT(!asym->sign(&key, data, sig, AsymMech::RSA));
+
+	// Unsupported mechanisms are refused
+	CPPUNIT_ASSERT(!asym->signInit(&key, AsymMech::RSA_PKCS_PSS));
+	CPPUNIT_ASSERT(!asym->signInit(&key, AsymMech::ECDSA));
+}
+
+void MizaruIndexedTests::testRSADecrypt()
+{
+	ByteString n, e;
+	genRSA(n, e);
+
+	MizaruIndexedPrivateKey key(AsymAlgo::RSA, TEST_RSA_INDEX);
+	CPPUNIT_ASSERT(key.load());
+
+	// 0x00 || 0x02 || PS || 0x00 || data
+	ByteString data("cafebabe");
+	ByteString em("0002");
+	while (em.size() < 128 - data.size() - 1) em += ByteString("5a");
+	em += ByteString("00") + data;
+
+	ByteString cipherText = rsaPublic(n, e, em);
+	ByteString plainText;
+
+	CPPUNIT_ASSERT(asym->decrypt(&key, cipherText, plainText, AsymMech::RSA_PKCS));
+	CPPUNIT_ASSERT(plainText == data);
+
+	CPPUNIT_ASSERT(asym->decrypt(&key, cipherText, plainText, AsymMech::RSA));
+	CPPUNIT_ASSERT(plainText == em);
+
+	// An empty message
+	ByteString full = em;
+	for (size_t i = 2; i < full.size() - 1; i++) full[i] = 0x5a;
+	full[full.size() - 1] = 0x00;
+	cipherText = rsaPublic(n, e, full);
+	CPPUNIT_ASSERT(asym->decrypt(&key, cipherText, plainText, AsymMech::RSA_PKCS));
+	CPPUNIT_ASSERT(plainText.size() == 0);
+
+	// No separator
+	full[full.size() - 1] = 0x5a;
+	cipherText = rsaPublic(n, e, full);
+	CPPUNIT_ASSERT(!asym->decrypt(&key, cipherText, plainText, AsymMech::RSA_PKCS));
+
+	// Less than 8 bytes of padding
+	full[9] = 0x00;
+	cipherText = rsaPublic(n, e, full);
+	CPPUNIT_ASSERT(!asym->decrypt(&key, cipherText, plainText, AsymMech::RSA_PKCS));
+	full[10] = 0x00;
+	cipherText = rsaPublic(n, e, full);
+	CPPUNIT_ASSERT(!asym->decrypt(&key, cipherText, plainText, AsymMech::RSA_PKCS));
+	full[9] = 0x5a;
+	cipherText = rsaPublic(n, e, full);
+	CPPUNIT_ASSERT(asym->decrypt(&key, cipherText, plainText, AsymMech::RSA_PKCS));
+	CPPUNIT_ASSERT(plainText.size() == full.size() - 11);
+
+	// A padding that is not type 2
+	em[1] = 0x01;
+	cipherText = rsaPublic(n, e, em);
+	CPPUNIT_ASSERT(!asym->decrypt(&key, cipherText, plainText, AsymMech::RSA_PKCS));
+
+	CPPUNIT_ASSERT(!asym->decrypt(&key, cipherText, plainText, AsymMech::RSA_PKCS_OAEP));
+}
+
+void MizaruIndexedTests::testECDSASign()
+{
+	mizar_uint8 x[32], y[32];
+	mizar_uint32 xLen = sizeof(x);
+	mizar_uint32 yLen = sizeof(y);
+
+	// prime256v1
+	CPPUNIT_ASSERT(MizarGenEccKeyIndex(TEST_ECC_INDEX, 415, &xLen, x, &yLen, y) == 0);
+
+	MizaruIndexedPrivateKey key(AsymAlgo::ECDSA, TEST_ECC_INDEX);
+	CPPUNIT_ASSERT(key.load());
+	CPPUNIT_ASSERT(key.getBitLength() == 256);
+	CPPUNIT_ASSERT(key.getOutputLength() == 64);
+
+	ByteString hash("9834876dcfb05cb167a5c24953eba58c4ac89b1adf57f28f2f9d09af107ee8f0");
+	ByteString sig1, sig2;
+
+	CPPUNIT_ASSERT(asym->sign(&key, hash, sig1, AsymMech::ECDSA));
+	CPPUNIT_ASSERT(asym->sign(&key, hash, sig2, AsymMech::ECDSA));
+	CPPUNIT_ASSERT(sig1.size() == 64);
+	CPPUNIT_ASSERT(sig1 != sig2);
+
+	CPPUNIT_ASSERT(!asym->sign(&key, hash, sig1, AsymMech::RSA_PKCS));
+	CPPUNIT_ASSERT(!asym->decrypt(&key, sig1, sig2, AsymMech::RSA));
+}
+
+void MizaruIndexedTests::testAES()
+{
+	// FIPS-197 appendix C.1
+	ByteString plainKey("0010000102030405060708090a0b0c0d0e0f");
+	ByteString block("00112233445566778899aabbccddeeff");
+	ByteString expected("69c4e0d86a7b0430d8cdb78070b4c55a");
+
+	CPPUNIT_ASSERT(MizarImportSymmKey(2, TEST_AES_INDEX, 0, plainKey.size(), &plainKey[0], NULL) == 0);
+
+	MizaruIndexedSymmetricKey key(SymAlgo::AES, TEST_AES_INDEX);
+	CPPUNIT_ASSERT(key.load());
+	CPPUNIT_ASSERT(key.getBitLen() == 128);
+	CPPUNIT_ASSERT(key.getKeyBits().size() == 0);
+
+	// ECB without padding
+	ByteString cipherText, part;
+	CPPUNIT_ASSERT(aes->encryptInit(&key, SymMode::ECB, ByteString(), false));
+	CPPUNIT_ASSERT(aes->encryptUpdate(block.substr(0, 5), part));
+	CPPUNIT_ASSERT(part.size() == 0);
+	CPPUNIT_ASSERT(aes->getBufferSize() == 5);
+	CPPUNIT_ASSERT(aes->encryptUpdate(block.substr(5), cipherText));
+	CPPUNIT_ASSERT(aes->encryptFinal(part));
+	CPPUNIT_ASSERT(part.size() == 0);
+	CPPUNIT_ASSERT(cipherText == expected);
+
+	// CBC with padding in irregular parts
+	ByteString iv("000102030405060708090a0b0c0d0e0f");
+	ByteString data;
+	for (size_t i = 0; i < 77; i++) data += (unsigned char) i;
+
+	cipherText.wipe();
+	CPPUNIT_ASSERT(aes->encryptInit(&key, SymMode::CBC, iv, true));
+	for (size_t i = 0; i < data.size(); i += 13)
+	{
+		CPPUNIT_ASSERT(aes->encryptUpdate(data.substr(i, 13), part));
+		cipherText += part;
+	}
+	CPPUNIT_ASSERT(aes->encryptFinal(part));
+	cipherText += part;
+	CPPUNIT_ASSERT(cipherText.size() == 80);
+
+	// Chaining the IV gives the same result as a single call
+	ByteString single;
+	single.resize(80);
+	ByteString padded = data + ByteString("030303");
+	mizar_uint32 outLen = single.size();
+	ByteString chipIV = iv;
+	CPPUNIT_ASSERT(MizarAesCbcIndex(0, &chipIV[0], TEST_AES_INDEX, padded.size(), &padded[0], &outLen, &single[0]) == 0);
+	CPPUNIT_ASSERT(cipherText == single);
+
+	ByteString plainText;
+	CPPUNIT_ASSERT(aes->decryptInit(&key, SymMode::CBC, iv, true));
+	for (size_t i = 0; i < cipherText.size(); i += 16)
+	{
+		CPPUNIT_ASSERT(aes->decryptUpdate(cipherText.substr(i, 16), part));
+		plainText += part;
+	}
+	CPPUNIT_ASSERT(aes->getBufferSize() == 16);
+	CPPUNIT_ASSERT(aes->decryptFinal(part));
+	plainText += part;
+	CPPUNIT_ASSERT(plainText == data);
+
+	// Modes the chip does not offer
+	CPPUNIT_ASSERT(!aes->encryptInit(&key, SymMode::CTR, iv, false));
+	CPPUNIT_ASSERT(!aes->encryptInit(&key, SymMode::GCM, iv, false));
+}
+
+void MizaruIndexedTests::testGenerate()
+{
+	// RSA, with the modulus returned for the public key
+	MizaruIndexedPrivateKey rsaKey(AsymAlgo::RSA, TEST_RSA_INDEX);
+	ByteString n;
+	CPPUNIT_ASSERT(rsaKey.generateRSA(1024, ByteString("010001"), n));
+	CPPUNIT_ASSERT(n.size() == 128);
+	CPPUNIT_ASSERT(rsaKey.getBitLength() == 1024);
+
+	// An occupied slot is not overwritten
+	ByteString other;
+	CPPUNIT_ASSERT(!rsaKey.generateRSA(1024, ByteString("010001"), other));
+	CPPUNIT_ASSERT(rsaKey.load());
+
+	CPPUNIT_ASSERT(rsaKey.remove());
+	CPPUNIT_ASSERT(!rsaKey.load());
+
+	// EC on P-256, with the point as a DER octet string
+	MizaruIndexedPrivateKey ecKey(AsymAlgo::ECDSA, TEST_ECC_INDEX);
+	ByteString point;
+	CPPUNIT_ASSERT(ecKey.generateEC(ByteString("06082a8648ce3d030107"), point));
+	CPPUNIT_ASSERT(point.size() == 67);
+	CPPUNIT_ASSERT(point.substr(0, 3) == ByteString("044104"));
+	CPPUNIT_ASSERT(!ecKey.generateEC(ByteString("06082a8648ce3d030107"), other));
+	CPPUNIT_ASSERT(ecKey.remove());
+	CPPUNIT_ASSERT(!ecKey.load());
+
+	// AES
+	MizaruIndexedSymmetricKey aesKey(SymAlgo::AES, TEST_AES_INDEX);
+	CPPUNIT_ASSERT(aesKey.generate(32));
+	CPPUNIT_ASSERT(aesKey.getBitLen() == 256);
+	CPPUNIT_ASSERT(aesKey.getKeyCheckValue().size() == 3);
+	CPPUNIT_ASSERT(!aesKey.generate(16));
+	CPPUNIT_ASSERT(aesKey.remove());
+	CPPUNIT_ASSERT(!aesKey.load());
+}
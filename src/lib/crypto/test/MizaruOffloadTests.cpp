@@ -0,0 +1,418 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruOffloadTests.cpp
+
+ Contains test cases for the operations the Mizaru backend hands to the chip
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "MizaruOffloadTests.h"
+#include "CryptoFactory.h"
+#include "AESKey.h"
+#include "DESKey.h"
+#include "ECParameters.h"
+#include "RSAParameters.h"
+#include "mizaru/MizaruCalibration.h"
+#include "mizaru/MizaruECPrivateKey.h"
+#include "mizaru/MizaruECPublicKey.h"
+#include "mizaru/MizaruOffload.h"
+#include "mizaru/MizarSimDevice.h"
+#include "mizaru/mizar_api.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(MizaruOffloadTests);
+
+void MizaruOffloadTests::setUp()
+{
+	CPPUNIT_ASSERT(MizarSdkInit(0, NULL) == SUCCESS);
+}
+
+void MizaruOffloadTests::tearDown()
+{
+	MizarSimDevice::get(0)->setFrameOverhead(0);
+	MizaruOffload::reset();
+
+	fflush(stdout);
+}
+
+// Sends everything or nothing to the chip
+static void forceChip(bool chip)
+{
+	for (int op = 0; op < MizaruOffload::OPERATION_COUNT; op++)
+	{
+		MizaruOffload::i()->setCrossover((MizaruOffload::Operation) op, chip ? 0 : MIZARU_OFFLOAD_NEVER);
+	}
+}
+
+static mizar_uint64 commandCount()
+{
+	return MizarSimDevice::get(0)->getCommandCount();
+}
+
+// Encrypts and decrypts in two parts, the first one not a whole block
+static void crypt(SymAlgo::Type algorithm, SymmetricKey* key, SymMode::Type mode, const ByteString& iv, const ByteString& data, ByteString& encrypted)
+{
+	SymmetricAlgorithm* cipher = CryptoFactory::i()->getSymmetricAlgorithm(algorithm);
+	CPPUNIT_ASSERT(cipher != NULL);
+
+	ByteString part;
+	size_t split = data.size() / 2 + 3;
+
+	encrypted.wipe();
+	CPPUNIT_ASSERT(cipher->encryptInit(key, mode, iv));
+	CPPUNIT_ASSERT(cipher->encryptUpdate(data.substr(0, split), part));
+	encrypted += part;
+	CPPUNIT_ASSERT(cipher->encryptUpdate(data.substr(split), part));
+	encrypted += part;
+	CPPUNIT_ASSERT(cipher->encryptFinal(part));
+	encrypted += part;
+
+	ByteString decrypted;
+	CPPUNIT_ASSERT(cipher->decryptInit(key, mode, iv));
+	CPPUNIT_ASSERT(cipher->decryptUpdate(encrypted.substr(0, split), part));
+	decrypted += part;
+	CPPUNIT_ASSERT(cipher->decryptUpdate(encrypted.substr(split), part));
+	decrypted += part;
+	CPPUNIT_ASSERT(cipher->decryptFinal(part));
+	decrypted += part;
+
+	CPPUNIT_ASSERT(decrypted == data);
+
+	CryptoFactory::i()->recycleSymmetricAlgorithm(cipher);
+}
+
+// The chip and OpenSSL give the same result, the chip is only used when allowed
+static void compareSymmetric(SymAlgo::Type algorithm, SymmetricKey* key, size_t blockSize)
+{
+	ByteString iv;
+	ByteString data;
+	CPPUNIT_ASSERT(CryptoFactory::i()->getRNG()->generateRandom(iv, blockSize));
+	CPPUNIT_ASSERT(CryptoFactory::i()->getRNG()->generateRandom(data, 5000));
+
+	SymMode::Type modes[] = { SymMode::ECB, SymMode::CBC };
+
+	for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+	{
+		ByteString software, chip;
+
+		forceChip(false);
+		mizar_uint64 before = commandCount();
+		crypt(algorithm, key, modes[i], iv, data, software);
+		CPPUNIT_ASSERT(commandCount() == before);
+
+		forceChip(true);
+		crypt(algorithm, key, modes[i], iv, data, chip);
+		CPPUNIT_ASSERT(commandCount() > before);
+
+		CPPUNIT_ASSERT(chip == software);
+		CPPUNIT_ASSERT(chip.size() == (data.size() / blockSize + 1) * blockSize);
+	}
+}
+
+void MizaruOffloadTests::testCrossover()
+{
+	MizaruOffload offload;
+
+	CPPUNIT_ASSERT(offload.getCrossover(MizaruOffload::AES) == DEFAULT_MIZARU_OFFLOAD_AES);
+	CPPUNIT_ASSERT(offload.useChip(MizaruOffload::AES, DEFAULT_MIZARU_OFFLOAD_AES));
+	CPPUNIT_ASSERT(!offload.useChip(MizaruOffload::AES, DEFAULT_MIZARU_OFFLOAD_AES - 1));
+	CPPUNIT_ASSERT(!offload.useChip(MizaruOffload::RSA_PUBLIC, 4096));
+
+	offload.setCrossover(MizaruOffload::RSA_PUBLIC, 1024);
+	CPPUNIT_ASSERT(offload.useChip(MizaruOffload::RSA_PUBLIC, 2048));
+	CPPUNIT_ASSERT(!offload.useChip(MizaruOffload::RSA_PUBLIC, 512));
+
+	// The decisions are counted
+	offload.fallBack(MizaruOffload::AES);
+	CPPUNIT_ASSERT(offload.getCount(MizaruOffload::AES, MizaruOffload::CHIP) == 1);
+	CPPUNIT_ASSERT(offload.getCount(MizaruOffload::AES, MizaruOffload::SOFTWARE) == 1);
+	CPPUNIT_ASSERT(offload.getCount(MizaruOffload::AES, MizaruOffload::FALLBACK) == 1);
+	CPPUNIT_ASSERT(offload.getCount(MizaruOffload::RSA_PUBLIC, MizaruOffload::SOFTWARE) == 2);
+
+	CPPUNIT_ASSERT(!strcmp(MizaruOffload::getName(MizaruOffload::ECDSA_VERIFY), "ecdsa_verify"));
+
+	// The chip is used from where it is faster for all larger sizes
+	MizaruOffloadSample faster[] = { { 16, 50, 1 }, { 256, 50, 20 }, { 1024, 60, 80 }, { 4096, 90, 300 } };
+	std::vector<MizaruOffloadSample> samples(faster, faster + 4);
+	CPPUNIT_ASSERT(MizaruCalibration::crossover(samples) == 1024);
+
+	samples[1].chipTime = 10;
+	CPPUNIT_ASSERT(MizaruCalibration::crossover(samples) == 256);
+
+	samples[0].chipTime = 0.5;
+	CPPUNIT_ASSERT(MizaruCalibration::crossover(samples) == 0);
+
+	samples[3].chipTime = -1;
+	CPPUNIT_ASSERT(MizaruCalibration::crossover(samples) == MIZARU_OFFLOAD_NEVER);
+}
+
+void MizaruOffloadTests::testCalibration()
+{
+	MizaruOffload offload;
+	std::vector<MizaruOffloadSample> samples;
+
+	CPPUNIT_ASSERT(MizaruCalibration::measure(MizaruOffload::ECDSA_VERIFY, samples));
+	CPPUNIT_ASSERT(samples.size() == 3);
+	CPPUNIT_ASSERT(samples[0].size == 256);
+
+	for (size_t i = 0; i < samples.size(); i++)
+	{
+		CPPUNIT_ASSERT(samples[i].chipTime > 0);
+		CPPUNIT_ASSERT(samples[i].softwareTime > 0);
+	}
+
+	// With a slow link the chip never pays off for small operations
+	MizarSimDevice::get(0)->setFrameOverhead(5000);
+	CPPUNIT_ASSERT(MizaruCalibration::measure(MizaruOffload::AES, samples));
+	CPPUNIT_ASSERT(samples.size() == 6);
+	CPPUNIT_ASSERT(samples[0].chipTime > samples[0].softwareTime);
+
+	offload.setSamples(MizaruOffload::AES, samples);
+	offload.setCrossover(MizaruOffload::AES, MizaruCalibration::crossover(samples));
+	offload.setCrossover(MizaruOffload::DES, 512);
+
+	// A saved calibration loads the same
+	char path[] = "/tmp/mizaru-calibration-XXXXXX";
+	int fd = mkstemp(path);
+	CPPUNIT_ASSERT(fd >= 0);
+	close(fd);
+
+	CPPUNIT_ASSERT(MizaruCalibration::save(path, &offload));
+
+	MizaruOffload loaded;
+	CPPUNIT_ASSERT(MizaruCalibration::load(path, &loaded));
+	CPPUNIT_ASSERT(loaded.getCrossover(MizaruOffload::AES) == offload.getCrossover(MizaruOffload::AES));
+	CPPUNIT_ASSERT(loaded.getSamples(MizaruOffload::AES).size() == 6);
+	CPPUNIT_ASSERT(loaded.getSamples(MizaruOffload::AES)[5].size == 16384);
+
+	// Only calibrated operations are saved
+	CPPUNIT_ASSERT(loaded.getCrossover(MizaruOffload::DES) == DEFAULT_MIZARU_OFFLOAD_DES);
+
+	FILE* fp = fopen(path, "a");
+	CPPUNIT_ASSERT(fp != NULL);
+	fprintf(fp, "blowfish = 16\n");
+	fclose(fp);
+	CPPUNIT_ASSERT(!MizaruCalibration::load(path, &loaded));
+
+	unlink(path);
+	CPPUNIT_ASSERT(!MizaruCalibration::load(path, &loaded));
+}
+
+void MizaruOffloadTests::testAES()
+{
+	ByteString keyData;
+	CPPUNIT_ASSERT(CryptoFactory::i()->getRNG()->generateRandom(keyData, 32));
+
+	AESKey key(256);
+	CPPUNIT_ASSERT(key.setKeyBits(keyData));
+
+	compareSymmetric(SymAlgo::AES, &key, 16);
+}
+
+void MizaruOffloadTests::testDES()
+{
+	ByteString keyData;
+	CPPUNIT_ASSERT(CryptoFactory::i()->getRNG()->generateRandom(keyData, 24));
+
+	DESKey key(168);
+	CPPUNIT_ASSERT(key.setKeyBits(keyData));
+
+	compareSymmetric(SymAlgo::DES3, &key, 8);
+}
+
+// Hashes in one and in three parts
+static void hash(const ByteString& data, ByteString& result)
+{
+	HashAlgorithm* sha256 = CryptoFactory::i()->getHashAlgorithm(HashAlgo::SHA256);
+	CPPUNIT_ASSERT(sha256 != NULL);
+
+	ByteString parts;
+	size_t split = data.size() / 3;
+
+	CPPUNIT_ASSERT(sha256->hashInit());
+	CPPUNIT_ASSERT(sha256->hashUpdate(data));
+	CPPUNIT_ASSERT(sha256->hashFinal(result));
+
+	CPPUNIT_ASSERT(sha256->hashInit());
+	CPPUNIT_ASSERT(sha256->hashUpdate(data.substr(0, split)));
+	CPPUNIT_ASSERT(sha256->hashUpdate(data.substr(split, split)));
+	CPPUNIT_ASSERT(sha256->hashUpdate(data.substr(2 * split)));
+	CPPUNIT_ASSERT(sha256->hashFinal(parts));
+
+	CPPUNIT_ASSERT(parts == result);
+
+	CryptoFactory::i()->recycleHashAlgorithm(sha256);
+}
+
+void MizaruOffloadTests::testSHA256()
+{
+	MizaruOffload* offload = MizaruOffload::i();
+	offload->setCrossover(MizaruOffload::SHA256, 1000);
+
+	ByteString small, large;
+	CPPUNIT_ASSERT(CryptoFactory::i()->getRNG()->generateRandom(small, 999));
+	CPPUNIT_ASSERT(CryptoFactory::i()->getRNG()->generateRandom(large, 1000));
+
+	// Below the crossover the chip is not used
+	ByteString result, expected;
+	mizar_uint64 before = commandCount();
+	unsigned long long chip = offload->getCount(MizaruOffload::SHA256, MizaruOffload::CHIP);
+	hash(small, result);
+	CPPUNIT_ASSERT(commandCount() == before);
+	CPPUNIT_ASSERT(offload->getCount(MizaruOffload::SHA256, MizaruOffload::SOFTWARE) == 2);
+
+	forceChip(true);
+	hash(small, expected);
+	CPPUNIT_ASSERT(result == expected);
+	CPPUNIT_ASSERT(commandCount() > before);
+
+	// From the crossover on it is, also when reached in parts
+	offload->setCrossover(MizaruOffload::SHA256, 1000);
+	hash(large, result);
+	CPPUNIT_ASSERT(offload->getCount(MizaruOffload::SHA256, MizaruOffload::CHIP) == chip + 4);
+
+	forceChip(false);
+	hash(large, expected);
+	CPPUNIT_ASSERT(result == expected);
+
+	// The empty hash
+	forceChip(true);
+	hash(ByteString(), result);
+	forceChip(false);
+	hash(ByteString(), expected);
+	CPPUNIT_ASSERT(result == expected);
+	CPPUNIT_ASSERT(result == ByteString("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"));
+}
+
+void MizaruOffloadTests::testRSA()
+{
+	AsymmetricAlgorithm* rsa = CryptoFactory::i()->getAsymmetricAlgorithm(AsymAlgo::RSA);
+	CPPUNIT_ASSERT(rsa != NULL);
+
+	AsymmetricKeyPair* kp;
+	RSAParameters p;
+	p.setE("010001");
+	p.setBitLength(2048);
+	CPPUNIT_ASSERT(rsa->generateKeyPair(&kp, &p));
+
+	ByteString data;
+	CPPUNIT_ASSERT(CryptoFactory::i()->getRNG()->generateRandom(data, 32));
+
+	// Signed on the chip, verified by OpenSSL and the other way around
+	ByteString signature;
+	mizar_uint64 before = commandCount();
+	forceChip(true);
+	CPPUNIT_ASSERT(rsa->sign(kp->getPrivateKey(), data, signature, AsymMech::RSA_PKCS));
+	CPPUNIT_ASSERT(commandCount() > before);
+	forceChip(false);
+	before = commandCount();
+	CPPUNIT_ASSERT(rsa->verify(kp->getPublicKey(), data, signature, AsymMech::RSA_PKCS));
+	CPPUNIT_ASSERT(commandCount() == before);
+
+	CPPUNIT_ASSERT(rsa->sign(kp->getPrivateKey(), data, signature, AsymMech::RSA_PKCS));
+	forceChip(true);
+	CPPUNIT_ASSERT(rsa->verify(kp->getPublicKey(), data, signature, AsymMech::RSA_PKCS));
+	CPPUNIT_ASSERT(commandCount() > before);
+
+	// Encrypted by OpenSSL, decrypted on the chip
+	ByteString encrypted, decrypted;
+	AsymMech::Type paddings[] = { AsymMech::RSA_PKCS, AsymMech::RSA_PKCS_OAEP };
+
+	for (size_t i = 0; i < sizeof(paddings) / sizeof(paddings[0]); i++)
+	{
+		forceChip(false);
+		CPPUNIT_ASSERT(rsa->encrypt(kp->getPublicKey(), data, encrypted, paddings[i]));
+		forceChip(true);
+		before = commandCount();
+		CPPUNIT_ASSERT(rsa->decrypt(kp->getPrivateKey(), encrypted, decrypted, paddings[i]));
+		CPPUNIT_ASSERT(commandCount() > before);
+		CPPUNIT_ASSERT(decrypted == data);
+	}
+
+	rsa->recycleKeyPair(kp);
+	CryptoFactory::i()->recycleAsymmetricAlgorithm(rsa);
+}
+
+void MizaruOffloadTests::testECDSA()
+{
+	AsymmetricAlgorithm* ecdsa = CryptoFactory::i()->getAsymmetricAlgorithm(AsymAlgo::ECDSA);
+	CPPUNIT_ASSERT(ecdsa != NULL);
+
+	// A P-256 key pair, rebuilt as keys the chip can use
+	AsymmetricKeyPair* kp;
+	ECParameters p;
+	p.setEC(ByteString("06082a8648ce3d030107"));
+	CPPUNIT_ASSERT(ecdsa->generateKeyPair(&kp, &p));
+
+	MizaruECPrivateKey* priv = (MizaruECPrivateKey*) ecdsa->newPrivateKey();
+	priv->setEC(((ECPrivateKey*) kp->getPrivateKey())->getEC());
+	priv->setD(((ECPrivateKey*) kp->getPrivateKey())->getD());
+	CPPUNIT_ASSERT(priv->getGroup() == 415);
+
+	MizaruECPublicKey* pub = (MizaruECPublicKey*) ecdsa->newPublicKey();
+	pub->setEC(((ECPublicKey*) kp->getPublicKey())->getEC());
+	pub->setQ(((ECPublicKey*) kp->getPublicKey())->getQ());
+	CPPUNIT_ASSERT(pub->getGroup() == 415);
+
+	ByteString data;
+	CPPUNIT_ASSERT(CryptoFactory::i()->getRNG()->generateRandom(data, 32));
+
+	// Signed on the chip, verified by OpenSSL and the other way around
+	ByteString signature;
+	mizar_uint64 before = commandCount();
+	forceChip(true);
+	CPPUNIT_ASSERT(ecdsa->sign(priv, data, signature, AsymMech::ECDSA));
+	CPPUNIT_ASSERT(commandCount() > before);
+	CPPUNIT_ASSERT(signature.size() == 64);
+	forceChip(false);
+	before = commandCount();
+	CPPUNIT_ASSERT(ecdsa->verify(pub, data, signature, AsymMech::ECDSA));
+	CPPUNIT_ASSERT(ecdsa->verify(kp->getPublicKey(), data, signature, AsymMech::ECDSA));
+	CPPUNIT_ASSERT(commandCount() == before);
+
+	CPPUNIT_ASSERT(ecdsa->sign(priv, data, signature, AsymMech::ECDSA));
+	CPPUNIT_ASSERT(commandCount() == before);
+	forceChip(true);
+	CPPUNIT_ASSERT(ecdsa->verify(pub, data, signature, AsymMech::ECDSA));
+	CPPUNIT_ASSERT(commandCount() > before);
+	signature[10] ^= 0x01;
+	CPPUNIT_ASSERT(!ecdsa->verify(pub, data, signature, AsymMech::ECDSA));
+
+	// Keys of OpenSSL are left to OpenSSL
+	before = commandCount();
+	CPPUNIT_ASSERT(ecdsa->sign(kp->getPrivateKey(), data, signature, AsymMech::ECDSA));
+	CPPUNIT_ASSERT(ecdsa->verify(kp->getPublicKey(), data, signature, AsymMech::ECDSA));
+	CPPUNIT_ASSERT(commandCount() == before);
+
+	ecdsa->recyclePrivateKey(priv);
+	ecdsa->recyclePublicKey(pub);
+	ecdsa->recycleKeyPair(kp);
+	CryptoFactory::i()->recycleAsymmetricAlgorithm(ecdsa);
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruOffloadTests.h
+
+ Contains test cases for the operations the Mizaru backend hands to the chip
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_MIZARUOFFLOADTESTS_H
+#define _SOFTHSM_V2_MIZARUOFFLOADTESTS_H
+
+#include <cppunit/extensions/HelperMacros.h>
+#include "SymmetricAlgorithm.h"
+#include "AsymmetricAlgorithm.h"
+
+class MizaruOffloadTests : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(MizaruOffloadTests);
+	CPPUNIT_TEST(testCrossover);
+	CPPUNIT_TEST(testCalibration);
+	CPPUNIT_TEST(testAES);
+	CPPUNIT_TEST(testDES);
+	CPPUNIT_TEST(testSHA256);
+	CPPUNIT_TEST(testRSA);
+	CPPUNIT_TEST(testECDSA);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void testCrossover();
+	void testCalibration();
+	void testAES();
+	void testDES();
+	void testSHA256();
+	void testRSA();
+	void testECDSA();
+
+	void setUp();
+	void tearDown();
+};
+
+#endif // !_SOFTHSM_V2_MIZARUOFFLOADTESTS_H
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruRNGTests.cpp
+
+ Contains test cases for the pooled Mizaru random number generator
+ *****************************************************************************/
+
+#include <chrono>
+#include <thread>
+#include <cppunit/extensions/HelperMacros.h>
+#include "MizaruRNGTests.h"
+#include "ByteString.h"
+#include "mizaru/MizaruRNG.h"
+#include "mizaru/MizarSimDevice.h"
+#include "mizaru/mizar_api.h"
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+CPPUNIT_TEST_SUITE_REGISTRATION(MizaruRNGTests);
+
+void MizaruRNGTests::setUp()
+{
+	CPPUNIT_ASSERT(MizarSdkInit(0, NULL) == SUCCESS);
+}
+
+void MizaruRNGTests::tearDown()
+{
+	MizaruRNG::setRefillThread(true);
+
+	fflush(stdout);
+}
+
+// Waits for the refill thread to fill the pool
+static void waitForPool(MizaruRNG& rng, size_t level)
+{
+	for (int i = 0; i < 1000 && rng.getPoolLevel() < level; i++)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+void MizaruRNGTests::testPooling()
+{
+	MizarSimDevice* device = MizarSimDevice::get(0);
+	MizaruRNG rng(4096, 1024);
+	ByteString iv, previous;
+
+	mizar_uint64 before = device->getCommandCount();
+
+	// Many small draws, like IVs and salts, cost only a few chip commands
+	for (int i = 0; i < 1000; i++)
+	{
+		CPPUNIT_ASSERT(rng.generateRandom(iv, 16));
+		CPPUNIT_ASSERT(iv.size() == 16);
+		CPPUNIT_ASSERT(iv != previous);
+		previous = iv;
+	}
+
+	CPPUNIT_ASSERT(rng.getReseedCount() == 1);
+	CPPUNIT_ASSERT(device->getCommandCount() - before < 10);
+
+	// Requests larger than the DRBG limit are served in parts
+	ByteString large;
+	CPPUNIT_ASSERT(rng.generateRandom(large, 200000));
+	CPPUNIT_ASSERT(large.size() == 200000);
+	CPPUNIT_ASSERT(large.substr(0, 16) != large.substr(65536, 16));
+	CPPUNIT_ASSERT(large.substr(199984, 16) != ByteString("00000000000000000000000000000000"));
+}
+
+void MizaruRNGTests::testReseed()
+{
+	MizarSimDevice* device = MizarSimDevice::get(0);
+	MizaruRNG rng(1024, 10);
+	ByteString data;
+
+	CPPUNIT_ASSERT(rng.generateRandom(data, 32));
+	CPPUNIT_ASSERT(rng.getReseedCount() == 1);
+
+	// The reseeds come from the pool once it has been filled
+	waitForPool(rng, 1024);
+	CPPUNIT_ASSERT(rng.getPoolLevel() == 1024);
+
+	mizar_uint64 before = device->getCommandCount();
+
+	for (int i = 0; i < 99; i++)
+	{
+		CPPUNIT_ASSERT(rng.generateRandom(data, 32));
+	}
+
+	CPPUNIT_ASSERT(rng.getReseedCount() == 10);
+	CPPUNIT_ASSERT(device->getCommandCount() - before <= 1);
+
+	// Seeding mixes in data without a round-trip
+	ByteString seed("0102030405060708");
+	rng.seed(seed);
+	CPPUNIT_ASSERT(rng.getReseedCount() == 10);
+}
+
+void MizaruRNGTests::testDirect()
+{
+	MizarSimDevice* device = MizarSimDevice::get(0);
+	MizaruRNG rng(0, 1024);
+	ByteString data;
+
+	// Without a pool every request goes to the chip
+	mizar_uint64 before = device->getCommandCount();
+
+	for (int i = 0; i < 5; i++)
+	{
+		CPPUNIT_ASSERT(rng.generateRandom(data, 16));
+	}
+
+	CPPUNIT_ASSERT(device->getCommandCount() == before + 5);
+	CPPUNIT_ASSERT(rng.getReseedCount() == 0);
+}
+
+void MizaruRNGTests::testNoThread()
+{
+	MizarSimDevice* device = MizarSimDevice::get(0);
+	ByteString data;
+
+	MizaruRNG::setRefillThread(false);
+	MizaruRNG rng(1024, 10);
+
+	// The first reseed fills the whole pool in one round-trip
+	mizar_uint64 before = device->getCommandCount();
+	CPPUNIT_ASSERT(rng.generateRandom(data, 32));
+	CPPUNIT_ASSERT(device->getCommandCount() == before + 1);
+	CPPUNIT_ASSERT(rng.getPoolLevel() == 1024 - 48);
+
+	for (int i = 0; i < 99; i++)
+	{
+		CPPUNIT_ASSERT(rng.generateRandom(data, 32));
+	}
+
+	// The next reseeds are taken from it
+	CPPUNIT_ASSERT(rng.getReseedCount() == 10);
+	CPPUNIT_ASSERT(device->getCommandCount() == before + 1);
+	CPPUNIT_ASSERT(rng.getPoolLevel() == 1024 - 10 * 48);
+}
+
+void MizaruRNGTests::testFork()
+{
+#ifndef _WIN32
+	MizaruRNG* rng = new MizaruRNG(4096, 1024);
+	ByteString data;
+	int fds[2];
+
+	CPPUNIT_ASSERT(rng->generateRandom(data, 16));
+	CPPUNIT_ASSERT(pipe(fds) == 0);
+
+	pid_t child = fork();
+	CPPUNIT_ASSERT(child >= 0);
+
+	if (child == 0)
+	{
+		// The child must not repeat the output of the parent
+		alarm(10);
+		ByteString childData;
+		// and fills its pool without a thread of its own
+		bool ok = rng->generateRandom(childData, 16) && rng->getPoolLevel() > 0 &&
+			  write(fds[1], childData.const_byte_str(), 16) == 16;
+
+		// and lets go of it without waiting for the parent's thread
+		delete rng;
+
+		_exit(ok ? 0 : 1);
+	}
+
+	ByteString parentData;
+	CPPUNIT_ASSERT(rng->generateRandom(parentData, 16));
+
+	int status;
+	CPPUNIT_ASSERT(waitpid(child, &status, 0) == child);
+	CPPUNIT_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	ByteString childData;
+	childData.resize(16);
+	CPPUNIT_ASSERT(read(fds[0], &childData[0], 16) == 16);
+	CPPUNIT_ASSERT(childData != parentData);
+
+	close(fds[0]);
+	close(fds[1]);
+
+	delete rng;
+#endif
+}
@@ -46,6 +46,8 @@
 
 #if defined(WITH_MIZARU)
 #include "mizaru/MizaruCryptoFactory.h"
+#include "mizaru/MizaruDevicePool.h"
+#include "mizaru/MizaruOffload.h"
 #elif defined(WITH_OPENSSL)
 #include "OSSLCryptoFactory.h"
 #else
@@ -58,6 +60,8 @@
 std::unique_ptr<MutexFactory> MutexFactory::instance(nullptr);
 std::unique_ptr<SecureMemoryRegistry> SecureMemoryRegistry::instance(nullptr);
 #if defined(WITH_MIZARU)
+std::unique_ptr<MizaruDevicePool> MizaruDevicePool::instance(nullptr);
+std::unique_ptr<MizaruOffload> MizaruOffload::instance(nullptr);
 std::unique_ptr<MizaruCryptoFactory> MizaruCryptoFactory::instance(nullptr);
 #elif defined(WITH_OPENSSL)
 std::unique_ptr<OSSLCryptoFactory> OSSLCryptoFactory::instance(nullptr);
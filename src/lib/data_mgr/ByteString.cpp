@@ -32,34 +32,41 @@
 
 #include <algorithm>
 #include <string>
+#include <string.h>
 #include <stdio.h>
 #include "config.h"
 #include "log.h"
 #include "ByteString.h"
 
-/**
- * Backward compatible fix: byte_str()/const_byte_str() to
- * return a non-NULL pointer, even if size() == 0, and yet
- * be compatible with -Wp,-D_GLIBCXX_ASSERTIONS stricter
- * bounds checking
- */
-static unsigned char sentinel[1];
+// The buffer of empty byte strings
+unsigned char ByteString::emptyData[1] = { 0 };
 
 // Constructors
 ByteString::ByteString()
 {
+	secureData = NULL;
+	length = 0;
+	capacity = 0;
 }
 
 ByteString::ByteString(const unsigned char* bytes, const size_t bytesLen)
 {
-	byteString.resize(bytesLen);
+	secureData = NULL;
+	length = 0;
+	capacity = 0;
+
+	resize(bytesLen);
 
 	if (bytesLen > 0)
-		memcpy(&byteString[0], bytes, bytesLen);
+		memcpy(buffer(), bytes, bytesLen);
 }
 
 ByteString::ByteString(const char* hexString)
 {
+	secureData = NULL;
+	length = 0;
+	capacity = 0;
+
 	std::string hex = std::string(hexString);
 
 	if (hex.size() % 2 != 0)
@@ -67,6 +74,8 @@ ByteString::ByteString(const char* hexString)
 		hex = "0" + hex;
 	}
 
+	reserve(hex.size() / 2);
+
 	for (size_t i = 0; i < hex.size(); i += 2)
 	{
 		std::string byteStr;
@@ -81,6 +90,10 @@ ByteString::ByteString(const char* hexString)
 
 ByteString::ByteString(const unsigned long longValue)
 {
+	secureData = NULL;
+	length = 0;
+	capacity = 0;
+
 	unsigned long setValue = longValue;
 
 	// Convert the value to a big-endian byte string; N.B.: this code assumes that unsigned long
@@ -102,40 +115,137 @@ ByteString::ByteString(const unsigned long longValue)
 		setValue >>= 8;
 	}
 
-	byteString.resize(8);
-	memcpy(&byteString[0], byteStrIn, 8);
+	resize(8);
+	memcpy(buffer(), byteStrIn, 8);
 }
 
 ByteString::ByteString(const ByteString& in)
 {
-	this->byteString = in.byteString;
+	secureData = NULL;
+	length = 0;
+	capacity = 0;
+
+	resize(in.length);
+
+	if (in.length > 0)
+		memcpy(buffer(), in.buffer(), in.length);
+}
+
+#ifdef HAVE_CXX11
+ByteString::ByteString(ByteString&& in)
+{
+	secureData = NULL;
+	length = 0;
+	capacity = 0;
+
+	*this = std::move(in);
+}
+#endif
+
+// Destructor
+ByteString::~ByteString()
+{
+	release();
 }
 
 // Assignment
 ByteString& ByteString::operator=(const ByteString& in)
 {
-	this->byteString = in.byteString;
+	if (this == &in) return *this;
+
+	resize(in.length);
+
+	if (in.length > 0)
+		memcpy(buffer(), in.buffer(), in.length);
+
+	return *this;
+}
+
+#ifdef HAVE_CXX11
+ByteString& ByteString::operator=(ByteString&& in)
+{
+	if (this == &in) return *this;
+
+	// Take over the securely allocated buffer
+	release();
+
+	secureData = in.secureData;
+	length = in.length;
+	capacity = in.capacity;
+
+	in.secureData = NULL;
+	in.length = 0;
+	in.capacity = 0;
+
 	return *this;
 }
+#endif
+
+// Make sure the buffer can hold at least the specified number of bytes
+void ByteString::reserve(size_t newCapacity)
+{
+	if (newCapacity <= capacity) return;
+
+	// Grow geometrically to keep appending byte by byte cheap, starting
+	// with the smallest block of the secure pool
+	newCapacity = std::max(newCapacity, std::max(capacity * 2, (size_t) SECURE_POOL_MIN_BLOCK));
+
+	unsigned char* newData = SecureAllocator<unsigned char>().allocate(newCapacity);
+
+	if (newData == NULL)
+	{
+		throw std::bad_alloc();
+	}
+
+	if (length > 0)
+		memcpy(newData, buffer(), length);
+
+	release();
+
+	secureData = newData;
+	capacity = newCapacity;
+}
+
+// Wipe and release the buffer
+void ByteString::release()
+{
+	if (secureData != NULL)
+	{
+		// The secure allocator wipes the memory
+		SecureAllocator<unsigned char>().deallocate(secureData, capacity);
+
+		secureData = NULL;
+		capacity = 0;
+	}
+}
 
 // Append data
 ByteString& ByteString::operator+=(const ByteString& append)
 {
-	size_t curLen = byteString.size();
-	size_t toAdd = append.byteString.size();
-	size_t newLen = curLen + toAdd;
+	size_t curLen = length;
+	size_t toAdd = append.length;
+
+	// Appending to itself; the source may move when the buffer grows
+	if (this == &append)
+	{
+		ByteString copy(append);
+
+		return *this += copy;
+	}
 
-	byteString.resize(newLen);
+	resize(curLen + toAdd);
 
 	if (toAdd > 0)
-		memcpy(&byteString[curLen], &append.byteString[0], toAdd);
+		memcpy(buffer() + curLen, append.buffer(), toAdd);
 
 	return *this;
 }
 
 ByteString& ByteString::operator+=(const unsigned char byte)
 {
-	byteString.push_back(byte);
+	reserve(length + 1);
+
+	buffer()[length++] = byte;
 
 	return *this;
 }
@@ -144,10 +254,12 @@ ByteString& ByteString::operator+=(const unsigned char byte)
 ByteString& ByteString::operator^=(const ByteString& rhs)
 {
 	size_t xorLen = std::min(this->size(), rhs.size());
+	unsigned char* data = buffer();
+	const unsigned char* rhsData = rhs.buffer();
 
 	for (size_t i = 0; i < xorLen; i++)
 	{
-		byteString[i] ^= rhs.const_byte_str()[i];
+		data[i] ^= rhsData[i];
 	}
 
 	return *this;
@@ -156,15 +268,15 @@ ByteString& ByteString::operator^=(const ByteString& rhs)
 // Return a substring
 ByteString ByteString::substr(const size_t start, const size_t len /* = SIZE_T_MAX */) const
 {
-	size_t retLen = std::min(len, byteString.size() - start);
-
-	if (start >= byteString.size())
+	if (start >= length)
 	{
 		return ByteString();
 	}
 	else
 	{
-		return ByteString(&byteString[start], retLen);
+		size_t retLen = std::min(len, length - start);
+
+		return ByteString(buffer() + start, retLen);
 	}
 }
 
@@ -196,58 +308,31 @@ ByteString operator+(const ByteString& lhs, const unsigned char rhs)
 // Array operator
 unsigned char& ByteString::operator[](size_t pos)
 {
-	return byteString[pos];
+	return buffer()[pos];
 }
 
-// Return the byte string data
+// Return the byte string data; never NULL, even if size() == 0
 unsigned char* ByteString::byte_str()
 {
-	if (byteString.size() != 0) {
-		return &byteString[0];
-	} else {
-		return (unsigned char*) sentinel;
-	}
+	return buffer();
 }
 
-// Return the const byte string
+// Return the const byte string; never NULL, even if size() == 0
 const unsigned char* ByteString::const_byte_str() const
 {
-	if (byteString.size() != 0) {
-		return (const unsigned char*) &byteString[0];
-	} else {
-		return (const unsigned char*) sentinel;
-	}
+	return buffer();
 }
 
 // Return a hexadecimal character representation of the string
 std::string ByteString::hex_str() const
 {
-	std::string rv;
-	char hex[3];
-
-	for (size_t i = 0; i < byteString.size(); i++)
-	{
-		sprintf(hex, "%02X", byteString[i]);
-
-		rv += hex;
-	}
-
-	return rv;
+	return ByteStringView(*this).hex_str();
 }
 
 // Return the long value
 unsigned long ByteString::long_val() const
 {
-	// Convert the first 8 bytes of the string to an unsigned long value
-	unsigned long rv = 0;
-
-	for (size_t i = 0; i < std::min(size_t(8), byteString.size()); i++)
-	{
-		rv <<= 8;
-		rv += byteString[i];
-	}
-
-	return rv;
+	return ByteStringView(*this).long_val();
 }
 
 // Cut of the first part of the string and convert it to a long value
@@ -265,17 +350,14 @@ ByteString ByteString::split(size_t len)
 {
 	ByteString rv = substr(0, len);
 
-	size_t newSize = (byteString.size() > len) ? (byteString.size() - len) : 0;
+	size_t newSize = (length > len) ? (length - len) : 0;
 
 	if (newSize > 0)
 	{
-		for (size_t i = 0; i < newSize; i++)
-		{
-			byteString[i] = byteString[i + len];
-		}
+		memmove(buffer(), buffer() + len, newSize);
 	}
 
-	byteString.resize(newSize);
+	resize(newSize);
 
 	return rv;
 }
@@ -283,13 +365,15 @@ ByteString ByteString::split(size_t len)
 // The size of the byte string in bits
 size_t ByteString::bits() const
 {
-	size_t bits = byteString.size() * 8;
+	size_t bits = length * 8;
 
 	if (bits == 0) return 0;
 
-	for (size_t i = 0; i < byteString.size(); i++)
+	const unsigned char* data = buffer();
+
+	for (size_t i = 0; i < length; i++)
 	{
-		unsigned char byte = byteString[i];
+		unsigned char byte = data[i];
 
 		for (unsigned char mask = 0x80; mask > 0; mask >>= 1)
 		{
@@ -310,49 +394,43 @@ size_t ByteString::bits() const
 // The size of the byte string in bytes
 size_t ByteString::size() const
 {
-	return byteString.size();
+	return length;
 }
 
+// Resize; new bytes are zero and bytes that are cut off are wiped
 void ByteString::resize(const size_t newSize)
 {
-	byteString.resize(newSize);
+	if (newSize > length)
+	{
+		reserve(newSize);
+
+		memset(buffer() + length, 0x00, newSize - length);
+	}
+	else if (newSize < length)
+	{
+		memset(buffer() + newSize, 0x00, length - newSize);
+	}
+
+	length = newSize;
 }
 
 void ByteString::wipe(const size_t newSize /* = 0 */)
 {
 	this->resize(newSize);
 
-	if (!byteString.empty())
-		memset(&byteString[0], 0x00, byteString.size());
+	if (length > 0)
+		memset(buffer(), 0x00, length);
 }
 
 // Comparison
 bool ByteString::operator==(const ByteString& compareTo) const
 {
-	if (compareTo.size() != this->size())
-	{
-		return false;
-	}
-	else if (this->size() == 0)
-	{
-		return true;
-	}
-
-	return (memcmp(&byteString[0], &compareTo.byteString[0], this->size()) == 0);
+	return ByteStringView(*this) == ByteStringView(compareTo);
 }
 
 bool ByteString::operator!=(const ByteString& compareTo) const
 {
-	if (compareTo.size() != this->size())
-	{
-		return true;
-	}
-	else if (this->size() == 0)
-	{
-		return false;
-	}
-
-	return (memcmp(&byteString[0], &compareTo.byteString[0], this->size()) != 0);
+	return ByteStringView(*this) != ByteStringView(compareTo);
 }
 
 // XOR data
@@ -361,9 +439,11 @@ ByteString operator^(const ByteString& lhs, const ByteString& rhs)
 	size_t xorLen = std::min(lhs.size(), rhs.size());
 	ByteString rv;
 
+	rv.resize(xorLen);
+
 	for (size_t i = 0; i < xorLen; i++)
 	{
-		rv += lhs.const_byte_str()[i] ^ rhs.const_byte_str()[i];
+		rv[i] = lhs.const_byte_str()[i] ^ rhs.const_byte_str()[i];
 	}
 
 	return rv;
@@ -386,3 +466,103 @@ ByteString ByteString::serialise() const
 	return rv;
 }
 
+// Constructors
+ByteStringView::ByteStringView()
+{
+	bytes = NULL;
+	length = 0;
+}
+
+ByteStringView::ByteStringView(const unsigned char* inBytes, const size_t bytesLen)
+{
+	bytes = inBytes;
+	length = (inBytes != NULL) ? bytesLen : 0;
+}
+
+ByteStringView::ByteStringView(const ByteString& in)
+{
+	bytes = in.const_byte_str();
+	length = in.size();
+}
+
+// Return the const byte string
+const unsigned char* ByteStringView::const_byte_str() const
+{
+	return bytes;
+}
+
+// Return the size in bytes
+size_t ByteStringView::size() const
+{
+	return length;
+}
+
+// Return a view on a part of the bytes
+ByteStringView ByteStringView::substr(const size_t start, const size_t len /* = SIZE_T_MAX */) const
+{
+	if (start >= length)
+	{
+		return ByteStringView();
+	}
+
+	return ByteStringView(bytes + start, std::min(len, length - start));
+}
+
+// Return a hexadecimal character representation of the bytes
+std::string ByteStringView::hex_str() const
+{
+	std::string rv;
+	char hex[3];
+
+	rv.reserve(length * 2);
+
+	for (size_t i = 0; i < length; i++)
+	{
+		sprintf(hex, "%02X", bytes[i]);
+
+		rv += hex;
+	}
+
+	return rv;
+}
+
+// Return the long value
+unsigned long ByteStringView::long_val() const
+{
+	// Convert the first 8 bytes of the string to an unsigned long value
+	unsigned long rv = 0;
+
+	for (size_t i = 0; i < std::min(size_t(8), length); i++)
+	{
+		rv <<= 8;
+		rv += bytes[i];
+	}
+
+	return rv;
+}
+
+// Return an owning copy
+ByteString ByteStringView::toByteString() const
+{
+	return ByteString(bytes, length);
+}
+
+// Comparison
+bool ByteStringView::operator==(const ByteStringView& compareTo) const
+{
+	if (compareTo.length != length)
+	{
+		return false;
+	}
+	else if (length == 0)
+	{
+		return true;
+	}
+
+	return (memcmp(bytes, compareTo.bytes, length) == 0);
+}
+
+bool ByteStringView::operator!=(const ByteStringView& compareTo) const
+{
+	return !(*this == compareTo);
+}
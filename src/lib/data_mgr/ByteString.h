@@ -34,6 +34,7 @@
 #define _SOFTHSM_V2_BYTESTRING_H
 
 #include <cstddef>
+#include <new>
 #include <vector>
 #include <string>
 #include <stdlib.h>
@@ -60,12 +61,20 @@ public:
 
 	ByteString(const ByteString& in);
 
+#ifdef HAVE_CXX11
+	ByteString(ByteString&& in);
+#endif
+
 	// Destructor
-	virtual ~ByteString() { }
+	virtual ~ByteString();
 
 	// Assignment
 	ByteString& operator=(const ByteString& in);
 
+#ifdef HAVE_CXX11
+	ByteString& operator=(ByteString&& in);
+#endif
+
 	// Append data
 	ByteString& operator+=(const ByteString& append);
 	ByteString& operator+=(const unsigned char byte);
@@ -119,7 +128,65 @@ public:
 	static ByteString chainDeserialise(ByteString& serialised);
 
 private:
-	std::vector<unsigned char, SecureAllocator<unsigned char> > byteString;
+	// Return the active buffer
+	unsigned char* buffer() { return secureData != NULL ? secureData : emptyData; }
+	const unsigned char* buffer() const { return secureData != NULL ? secureData : emptyData; }
+
+	// Make sure the buffer can hold at least the specified number of bytes
+	void reserve(size_t newCapacity);
+
+	// Wipe and release the buffer
+	void release();
+
+	// The bytes are always kept in securely allocated memory, so they are
+	// locked and wiped on a fatal error however small the string is; small
+	// strings come from the secure pool
+	unsigned char* secureData;
+
+	// The buffer of empty byte strings; nothing is ever stored in it
+	static unsigned char emptyData[1];
+
+	size_t length;
+	size_t capacity;
+};
+
+// A non-owning, read-only view on a sequence of bytes; the viewed memory must
+// remain valid and unchanged for as long as the view is used
+class ByteStringView
+{
+public:
+	// Constructors
+	ByteStringView();
+
+	ByteStringView(const unsigned char* bytes, const size_t bytesLen);
+
+	ByteStringView(const ByteString& in);
+
+	// Return the const byte string
+	const unsigned char* const_byte_str() const;
+
+	// Return the size in bytes
+	size_t size() const;
+
+	// Return a view on a part of the bytes
+	ByteStringView substr(const size_t start, const size_t len = SIZE_T_MAX) const;
+
+	// Return a hexadecimal character representation of the bytes
+	std::string hex_str() const;
+
+	// Return the long value
+	unsigned long long_val() const;
+
+	// Return an owning copy
+	ByteString toByteString() const;
+
+	// Comparison
+	bool operator==(const ByteStringView& compareTo) const;
+	bool operator!=(const ByteStringView& compareTo) const;
+
+private:
+	const unsigned char* bytes;
+	size_t length;
 };
 
 // Add data
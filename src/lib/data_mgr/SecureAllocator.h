@@ -45,6 +45,7 @@
 #include "config.h"
 #include "log.h"
 #include "SecureMemoryRegistry.h"
+#include "SecurePool.h"
 
 template<class T> class SecureAllocator
 {
@@ -94,6 +95,14 @@ public:
 	// Allocate n elements of type T
 	inline pointer allocate(size_type n, const void* = NULL)
 	{
+		// Small blocks are served from the secure pool
+		pointer p = (pointer) SecurePool::i()->allocate(n * sizeof(T));
+
+		if (p != NULL)
+		{
+			return p;
+		}
+
 #ifdef SENSITIVE_NON_PAGED
 		// Allocate memory on a page boundary
 #ifndef _WIN32
@@ -152,6 +161,12 @@ public:
 	// Deallocate n elements of type T
 	inline void deallocate(pointer p, size_type n)
 	{
+		// Blocks from the secure pool are wiped by the pool
+		if (SecurePool::i()->release(p))
+		{
+			return;
+		}
+
 #ifdef PARANOID
 		// First toggle all bits on
 		memset(p, 0xFF, n * sizeof(T));
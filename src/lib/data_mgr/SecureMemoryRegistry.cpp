@@ -29,28 +29,44 @@
 
  Implements a singleton class that keeps track of all securely allocated
  memory. This registry can be used to wipe securely allocated memory in case
- of a fatal exception
+ of a fatal exception.
+
+ The registry is split into a fixed number of shards selected by hashing the
+ block address, each with its own lock, so that concurrent allocations from
+ different threads rarely contend for the same lock
  *****************************************************************************/
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include "log.h"
 #include "SecureMemoryRegistry.h"
 
 // Constructor
 SecureMemoryRegistry::SecureMemoryRegistry()
 {
-	SecMemRegistryMutex = MutexFactory::i()->getMutex();
+	for (size_t i = 0; i < SECMEM_REGISTRY_SHARDS; i++)
+	{
+		shards[i].SecMemRegistryMutex = MutexFactory::i()->getMutex();
+	}
 }
 
 // Destructor
 SecureMemoryRegistry::~SecureMemoryRegistry()
 {
-	if (!registry.empty())
+	bool leak = false;
+
+	for (size_t i = 0; i < SECMEM_REGISTRY_SHARDS; i++)
+	{
+		leak = leak || !shards[i].registry.empty();
+
+		MutexFactory::i()->recycleMutex(shards[i].SecMemRegistryMutex);
+	}
+
+	if (leak)
 	{
 		ERROR_MSG("SecureMemoryRegistry is not empty: leak!");
 	}
-	MutexFactory::i()->recycleMutex(SecMemRegistryMutex);
 }
 
 // Return the one-and-only instance
@@ -77,12 +93,26 @@ void SecureMemoryRegistry::reset()
 	instance.reset();
 }
 
+// Select the shard for a block of memory
+size_t SecureMemoryRegistry::shardOf(void* pointer)
+{
+	// Blocks are at least 16-byte aligned, so drop the low bits and mix in
+	// the higher ones to spread page aligned blocks over the shards
+	uintptr_t value = (uintptr_t) pointer >> 4;
+
+	value ^= (value >> 7) ^ (value >> 13);
+
+	return (size_t) (value & (SECMEM_REGISTRY_SHARDS - 1));
+}
+
 // Register a block of memory
 void SecureMemoryRegistry::add(void* pointer, size_t blocksize)
 {
-	MutexLocker lock(SecMemRegistryMutex);
+	Shard& shard = shards[shardOf(pointer)];
+
+	MutexLocker lock(shard.SecMemRegistryMutex);
 
-	registry[pointer] = blocksize;
+	shard.registry[pointer] = blocksize;
 
 	//DEBUG_MSG("Registered block of %d bytes at 0x%x", blocksize, pointer);
 }
@@ -90,13 +120,22 @@ void SecureMemoryRegistry::add(void* pointer, size_t blocksize)
 // Unregister a block of memory
 size_t SecureMemoryRegistry::remove(void* pointer)
 {
-	//DEBUG_MSG("Unregistered block of %d bytes at 0x%x", registry[pointer], pointer);
+	Shard& shard = shards[shardOf(pointer)];
+
+	//DEBUG_MSG("Unregistered block of %d bytes at 0x%x", shard.registry[pointer], pointer);
 
-	MutexLocker lock(SecMemRegistryMutex);
+	MutexLocker lock(shard.SecMemRegistryMutex);
+
+	std::map<void*, size_t>::iterator i = shard.registry.find(pointer);
+
+	if (i == shard.registry.end())
+	{
+		return 0;
+	}
 
-	size_t rv = registry[pointer];
+	size_t rv = i->second;
 
-	registry.erase(pointer);
+	shard.registry.erase(i);
 
 	return rv;
 }
@@ -104,14 +143,23 @@ size_t SecureMemoryRegistry::remove(void* pointer)
 // Wipe all registered blocks of memory
 void SecureMemoryRegistry::wipe()
 {
-	MutexLocker lock(SecMemRegistryMutex);
+	for (size_t s = 0; s < SECMEM_REGISTRY_SHARDS; s++)
+	{
+		wipeShard(shards[s]);
+	}
+}
+
+// Wipe the registered blocks of memory in a single shard
+void SecureMemoryRegistry::wipeShard(Shard& shard)
+{
+	MutexLocker lock(shard.SecMemRegistryMutex);
 
 	// Be very careful in this method to catch any weird exceptions that
 	// may occur since if we're in this method it means something has already
 	// gone pear shaped once before and we're exiting on a fatal exception
 	try
 	{
-		for (std::map<void*, size_t>::iterator i = registry.begin(); i != registry.end(); i++)
+		for (std::map<void*, size_t>::iterator i = shard.registry.begin(); i != shard.registry.end(); i++)
 		{
 			try
 			{
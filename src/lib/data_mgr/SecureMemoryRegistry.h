@@ -29,7 +29,11 @@
 
  Implements a singleton class that keeps track of all securely allocated
  memory. This registry can be used to wipe securely allocated memory in case
- of a fatal exception
+ of a fatal exception.
+
+ The registry is split into a fixed number of shards selected by hashing the
+ block address, each with its own lock, so that concurrent allocations from
+ different threads rarely contend for the same lock
  *****************************************************************************/
 
 #ifndef _SOFTHSM_V2_SECUREMEMORYREGISTRY_H
@@ -40,6 +44,9 @@
 #include <memory>
 #include "MutexFactory.h"
 
+// The number of registry shards; must be a power of two
+#define SECMEM_REGISTRY_SHARDS 64
+
 class SecureMemoryRegistry
 {
 public:
@@ -64,9 +71,20 @@ private:
 	static std::auto_ptr<SecureMemoryRegistry> instance;
 #endif
 
-	std::map<void*, size_t> registry;
+	struct Shard
+	{
+		std::map<void*, size_t> registry;
+
+		Mutex* SecMemRegistryMutex;
+	};
+
+	// Select the shard for a block of memory
+	static size_t shardOf(void* pointer);
+
+	// Wipe the blocks registered in a single shard
+	void wipeShard(Shard& shard);
 
-	Mutex* SecMemRegistryMutex;
+	Shard shards[SECMEM_REGISTRY_SHARDS];
 };
 
 #endif // !_SOFTHSM_V2_SECUREMEMORYREGISTRY_H
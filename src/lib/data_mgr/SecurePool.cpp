@@ -0,0 +1,447 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ SecurePool.cpp
+
+ Implements a pool allocator for small blocks of secure memory. Blocks are
+ carved from large regions in a number of size classes, so that allocating
+ a small block does not require its own page and mlock call. Blocks are
+ zeroed when they are released and all regions can be wiped in case of a
+ fatal exception
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "SecurePool.h"
+#include <string.h>
+#include <stdint.h>
+#if defined(SENSITIVE_NON_PAGED) && !defined(_WIN32)
+#include <sys/mman.h>
+#endif // SENSITIVE_NON_PAGED
+
+// Return the one-and-only instance
+SecurePool* SecurePool::i()
+{
+	static SecurePool* instance = new SecurePool();
+
+	return instance;
+}
+
+// Release all regions back to the system if no blocks are in use and drop
+// the mutexes
+void SecurePool::reset()
+{
+#if defined(HAVE_CXX11) && !defined(_WIN32)
+	SecurePool* pool = i();
+
+	pool->takeMutexes();
+
+	for (int c = 0; c < SECURE_POOL_CLASSES; c++)
+	{
+		pool->classes[c].classMutex->lock();
+	}
+
+	size_t liveBlocks = 0;
+
+	for (int c = 0; c < SECURE_POOL_CLASSES; c++)
+	{
+		liveBlocks += pool->classes[c].liveBlocks;
+	}
+
+	if (liveBlocks == 0)
+	{
+		pool->releaseRegions();
+	}
+	else
+	{
+		DEBUG_MSG("Keeping the secure pool regions, %lu blocks are still in use", (unsigned long) liveBlocks);
+	}
+
+	for (int c = SECURE_POOL_CLASSES - 1; c >= 0; c--)
+	{
+		pool->classes[c].classMutex->unlock();
+	}
+
+	pool->dropMutexes();
+#endif
+}
+
+// The largest block served by the pool
+size_t SecurePool::maxBlockSize()
+{
+	return SECURE_POOL_MIN_BLOCK << (SECURE_POOL_CLASSES - 1);
+}
+
+#if defined(HAVE_CXX11) && !defined(_WIN32)
+
+// Constructor
+SecurePool::SecurePool()
+{
+	for (int c = 0; c < SECURE_POOL_CLASSES; c++)
+	{
+		classes[c].freeList = NULL;
+		classes[c].liveBlocks = 0;
+		classes[c].classMutex = NULL;
+	}
+
+	regionMutex = NULL;
+	hasMutexes.store(false);
+
+	for (size_t n = 0; n < SECURE_POOL_MAX_REGIONS; n++)
+	{
+		regionTable[n].store(0);
+	}
+
+	allocationCount.store(0);
+}
+
+// Destructor
+SecurePool::~SecurePool()
+{
+	dropMutexes();
+}
+
+// Take mutexes from the mutex factory if the pool has none
+void SecurePool::takeMutexes()
+{
+	if (hasMutexes.load(std::memory_order_acquire)) return;
+
+	std::lock_guard<std::mutex> lock(setupMutex);
+
+	if (hasMutexes.load(std::memory_order_relaxed)) return;
+
+	for (int c = 0; c < SECURE_POOL_CLASSES; c++)
+	{
+		classes[c].classMutex = MutexFactory::i()->getMutex();
+	}
+
+	regionMutex = MutexFactory::i()->getMutex();
+
+	hasMutexes.store(true, std::memory_order_release);
+}
+
+// Recycle the mutexes; nothing may use the pool meanwhile
+void SecurePool::dropMutexes()
+{
+	std::lock_guard<std::mutex> lock(setupMutex);
+
+	if (!hasMutexes.load(std::memory_order_relaxed)) return;
+
+	hasMutexes.store(false, std::memory_order_release);
+
+	for (int c = 0; c < SECURE_POOL_CLASSES; c++)
+	{
+		MutexFactory::i()->recycleMutex(classes[c].classMutex);
+		classes[c].classMutex = NULL;
+	}
+
+	MutexFactory::i()->recycleMutex(regionMutex);
+	regionMutex = NULL;
+}
+
+// Allocate a zeroed block of at least len bytes
+void* SecurePool::allocate(size_t len)
+{
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+
+	if (len == 0 || len > maxBlockSize()) return NULL;
+
+	takeMutexes();
+
+	int c = 0;
+
+	while ((size_t) (SECURE_POOL_MIN_BLOCK << c) < len) c++;
+
+	SizeClass& sizeClass = classes[c];
+
+	MutexLocker lock(sizeClass.classMutex);
+
+	if (sizeClass.freeList == NULL && !grow(c))
+	{
+		return NULL;
+	}
+
+	void* block = sizeClass.freeList;
+
+	// Unlink the block and clear the link so the whole block is zero
+	memcpy(&sizeClass.freeList, block, sizeof(void*));
+	memset(block, 0x00, sizeof(void*));
+
+	sizeClass.liveBlocks++;
+
+	return block;
+}
+
+// Zero and release a block
+bool SecurePool::release(void* pointer)
+{
+	if (pointer == NULL) return false;
+
+	int c = classOf(pointer);
+
+	if (c < 0) return false;
+
+	size_t blockSize = SECURE_POOL_MIN_BLOCK << c;
+
+#ifdef PARANOID
+	// First toggle all bits on
+	memset(pointer, 0xFF, blockSize);
+#endif // PARANOID
+
+	// Toggle all bits off
+	memset(pointer, 0x00, blockSize);
+
+	takeMutexes();
+
+	SizeClass& sizeClass = classes[c];
+
+	MutexLocker lock(sizeClass.classMutex);
+
+	memcpy(pointer, &sizeClass.freeList, sizeof(void*));
+	sizeClass.freeList = pointer;
+
+	sizeClass.liveBlocks--;
+
+	return true;
+}
+
+// Wipe all regions
+void SecurePool::wipe()
+{
+	// Do not take any locks; this is called on a fatal exception
+	try
+	{
+		for (size_t n = 0; n < SECURE_POOL_MAX_REGIONS; n++)
+		{
+			size_t entry = regionTable[n].load();
+
+			if (entry == 0) continue;
+
+			void* base = (void*) (entry & ~((size_t) SECURE_POOL_REGION_SIZE - 1));
+
+#ifdef PARANOID
+			memset(base, 0xFF, SECURE_POOL_REGION_SIZE);
+#endif // PARANOID
+			memset(base, 0x00, SECURE_POOL_REGION_SIZE);
+		}
+	}
+	catch (...)
+	{
+		ERROR_MSG("Failed to wipe the secure pool");
+	}
+}
+
+// Statistics
+size_t SecurePool::getLiveBlocks()
+{
+	size_t liveBlocks = 0;
+
+	takeMutexes();
+
+	for (int c = 0; c < SECURE_POOL_CLASSES; c++)
+	{
+		MutexLocker lock(classes[c].classMutex);
+
+		liveBlocks += classes[c].liveBlocks;
+	}
+
+	return liveBlocks;
+}
+
+size_t SecurePool::getRegionCount()
+{
+	takeMutexes();
+
+	MutexLocker lock(regionMutex);
+
+	return regions.size();
+}
+
+size_t SecurePool::getAllocationCount()
+{
+	return allocationCount.load(std::memory_order_relaxed);
+}
+
+// Find the size class of a block, or -1 if it is not pool memory
+int SecurePool::classOf(void* pointer)
+{
+	size_t base = (size_t) (uintptr_t) pointer & ~((size_t) SECURE_POOL_REGION_SIZE - 1);
+	size_t n = ((base / SECURE_POOL_REGION_SIZE) * 2654435761UL) & (SECURE_POOL_MAX_REGIONS - 1);
+
+	for (size_t probes = 0; probes < SECURE_POOL_MAX_REGIONS; probes++)
+	{
+		size_t entry = regionTable[n].load(std::memory_order_acquire);
+
+		// Regions are never removed while blocks are in use, so an empty
+		// slot terminates the probe sequence
+		if (entry == 0) return -1;
+
+		if ((entry & ~((size_t) SECURE_POOL_REGION_SIZE - 1)) == base)
+		{
+			return (int) (entry & (SECURE_POOL_REGION_SIZE - 1)) - 1;
+		}
+
+		n = (n + 1) & (SECURE_POOL_MAX_REGIONS - 1);
+	}
+
+	return -1;
+}
+
+// Add a new region to a size class
+bool SecurePool::grow(int sizeClass)
+{
+	MutexLocker lock(regionMutex);
+
+	// Keep the table at most half full so that probe sequences stay short
+	if (regions.size() >= SECURE_POOL_MAX_REGIONS / 2)
+	{
+		return false;
+	}
+
+	void* region = NULL;
+
+	if (posix_memalign(&region, SECURE_POOL_REGION_SIZE, SECURE_POOL_REGION_SIZE) != 0 || region == NULL)
+	{
+		ERROR_MSG("Out of memory");
+
+		return false;
+	}
+
+#ifdef SENSITIVE_NON_PAGED
+	// Lock the memory so it doesn't get swapped out
+	if (mlock((const void*) region, SECURE_POOL_REGION_SIZE) != 0)
+	{
+		ERROR_MSG("Could not allocate non-paged memory for secure storage");
+
+		free(region);
+
+		return false;
+	}
+#endif // SENSITIVE_NON_PAGED
+
+	memset(region, 0x00, SECURE_POOL_REGION_SIZE);
+
+	// Chain all blocks of the region into the free list
+	size_t blockSize = SECURE_POOL_MIN_BLOCK << sizeClass;
+	unsigned char* blocks = (unsigned char*) region;
+
+	for (size_t offset = 0; offset < SECURE_POOL_REGION_SIZE; offset += blockSize)
+	{
+		void* block = blocks + offset;
+
+		memcpy(block, &classes[sizeClass].freeList, sizeof(void*));
+		classes[sizeClass].freeList = block;
+	}
+
+	// Publish the region
+	size_t base = (size_t) (uintptr_t) region;
+	size_t n = ((base / SECURE_POOL_REGION_SIZE) * 2654435761UL) & (SECURE_POOL_MAX_REGIONS - 1);
+
+	while (regionTable[n].load() != 0)
+	{
+		n = (n + 1) & (SECURE_POOL_MAX_REGIONS - 1);
+	}
+
+	regionTable[n].store(base | (size_t) (sizeClass + 1), std::memory_order_release);
+
+	regions.push_back(std::make_pair(region, sizeClass));
+
+	return true;
+}
+
+// Release all regions
+void SecurePool::releaseRegions()
+{
+	MutexLocker lock(regionMutex);
+
+	for (size_t n = 0; n < SECURE_POOL_MAX_REGIONS; n++)
+	{
+		regionTable[n].store(0);
+	}
+
+	for (size_t r = 0; r < regions.size(); r++)
+	{
+		memset(regions[r].first, 0x00, SECURE_POOL_REGION_SIZE);
+
+#ifdef SENSITIVE_NON_PAGED
+		munlock((const void*) regions[r].first, SECURE_POOL_REGION_SIZE);
+#endif // SENSITIVE_NON_PAGED
+
+		free(regions[r].first);
+	}
+
+	regions.clear();
+
+	for (int c = 0; c < SECURE_POOL_CLASSES; c++)
+	{
+		classes[c].freeList = NULL;
+	}
+}
+
+#else
+
+// The pool is not available on this platform; all requests fall back to
+// the regular secure allocation functions
+SecurePool::SecurePool()
+{
+}
+
+SecurePool::~SecurePool()
+{
+}
+
+void* SecurePool::allocate(size_t)
+{
+	return NULL;
+}
+
+bool SecurePool::release(void*)
+{
+	return false;
+}
+
+void SecurePool::wipe()
+{
+}
+
+size_t SecurePool::getLiveBlocks()
+{
+	return 0;
+}
+
+size_t SecurePool::getRegionCount()
+{
+	return 0;
+}
+
+size_t SecurePool::getAllocationCount()
+{
+	return 0;
+}
+
+#endif
+
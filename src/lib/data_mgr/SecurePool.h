@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ SecurePool.h
+
+ Implements a pool allocator for small blocks of secure memory. Blocks are
+ carved from large regions in a number of size classes, so that allocating
+ a small block does not require its own page and mlock call. Blocks are
+ zeroed when they are released and all regions can be wiped in case of a
+ fatal exception
+
+ The pool outlives the initialisations of the library, but its mutexes come
+ from the mutex factory as it is set up by one C_Initialize. They are taken
+ on first use and dropped again by reset() in C_Finalize, so that every
+ initialisation locks the pool with its own mutexes.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_SECUREPOOL_H
+#define _SOFTHSM_V2_SECUREPOOL_H
+
+#include "config.h"
+#include "MutexFactory.h"
+#include <stdlib.h>
+#include <vector>
+#ifdef HAVE_CXX11
+#include <atomic>
+#include <mutex>
+#endif
+
+// The size of a region; regions are aligned on this size
+#define SECURE_POOL_REGION_SIZE		(64 * 1024)
+
+// The size classes: 16, 32, ... up to 2048 bytes
+#define SECURE_POOL_MIN_BLOCK		16
+#define SECURE_POOL_CLASSES		8
+
+// The maximum number of regions tracked by the pool
+#define SECURE_POOL_MAX_REGIONS		4096
+
+class SecurePool
+{
+public:
+	// Return the one-and-only instance
+	static SecurePool* i();
+
+	// Release all regions back to the system if no blocks are in use and
+	// drop the mutexes; the next use takes new ones from the mutex factory
+	static void reset();
+
+	// Allocate a zeroed block of at least len bytes; returns NULL if the
+	// request cannot be served from the pool
+	void* allocate(size_t len);
+
+	// Zero and release a block; returns false if the block was not
+	// allocated from the pool
+	bool release(void* pointer);
+
+	// Wipe all regions
+	void wipe();
+
+	// Statistics
+	size_t getLiveBlocks();
+	size_t getRegionCount();
+
+	// The number of allocation requests, including the ones that were not
+	// served from the pool
+	size_t getAllocationCount();
+
+	// The largest block served by the pool
+	static size_t maxBlockSize();
+
+private:
+	// The pool is never destroyed, since blocks may still be released
+	// by static destructors that run after a singleton would have been
+	SecurePool();
+
+	~SecurePool();
+
+#if defined(HAVE_CXX11) && !defined(_WIN32)
+	struct SizeClass
+	{
+		// Free blocks are chained through their first bytes
+		void* freeList;
+
+		// The number of blocks handed out
+		size_t liveBlocks;
+
+		Mutex* classMutex;
+	};
+
+	// Find the size class of a block, or -1 if it is not pool memory
+	int classOf(void* pointer);
+
+	// Add a new region to a size class; called with the class locked
+	bool grow(int sizeClass);
+
+	// Release all regions; called with all classes locked
+	void releaseRegions();
+
+	// Take mutexes from the mutex factory if the pool has none
+	void takeMutexes();
+
+	// Recycle the mutexes
+	void dropMutexes();
+
+	SizeClass classes[SECURE_POOL_CLASSES];
+
+	// Open addressed table of region base addresses; lookups are lock-free
+	std::atomic<size_t> regionTable[SECURE_POOL_MAX_REGIONS];
+
+	// The regions and their size class, in order of creation
+	std::vector<std::pair<void*, int> > regions;
+
+	Mutex* regionMutex;
+
+	// Whether the mutexes above have been taken, and the lock for taking
+	// and dropping them
+	std::atomic<bool> hasMutexes;
+	std::mutex setupMutex;
+
+	std::atomic<size_t> allocationCount;
+#endif
+};
+
+#endif // !_SOFTHSM_V2_SECUREPOOL_H
+
@@ -39,10 +39,19 @@
 #endif // SENSITIVE_NON_PAGED
 #include <string.h>
 #include "SecureMemoryRegistry.h"
+#include "SecurePool.h"
 
 // Allocate memory
 void* salloc(size_t len)
 {
+	// Small blocks are served from the secure pool
+	void* block = SecurePool::i()->allocate(len);
+
+	if (block != NULL)
+	{
+		return block;
+	}
+
 #ifdef SENSITIVE_NON_PAGED
 	// Allocate memory on a page boundary
 #ifndef _WIN32
@@ -101,6 +110,12 @@ void* salloc(size_t len)
 // Free memory
 void sfree(void* ptr)
 {
+	// Blocks from the secure pool are wiped by the pool
+	if (SecurePool::i()->release(ptr))
+	{
+		return;
+	}
+
 	// Unregister the memory from the secure memory registry
 	size_t len = SecureMemoryRegistry::i()->remove(ptr);
 
@@ -32,10 +32,13 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <cppunit/extensions/HelperMacros.h>
 #include <string>
+#include <utility>
 #include "ByteStringTests.h"
 #include "ByteString.h"
+#include "SecurePool.h"
 
 CPPUNIT_TEST_SUITE_REGISTRATION(ByteStringTests);
 
@@ -354,3 +357,119 @@ void ByteStringTests::testSerialising()
 	CPPUNIT_ASSERT(d3 == b1);
 }
 
+
+void ByteStringTests::testSecureStorage()
+{
+	unsigned char data[256];
+
+	for (size_t i = 0; i < sizeof(data); i++) data[i] = (unsigned char) i;
+
+	// Grow a string byte by byte across several buffer sizes
+	ByteString b;
+
+	for (size_t i = 0; i < sizeof(data); i++)
+	{
+		b += data[i];
+
+		CPPUNIT_ASSERT(b.size() == i + 1);
+		CPPUNIT_ASSERT(!memcmp(b.const_byte_str(), data, i + 1));
+	}
+
+	// Shrink it and grow again
+	b.resize(10);
+	CPPUNIT_ASSERT(!memcmp(b.const_byte_str(), data, 10));
+	b.resize(74);
+	CPPUNIT_ASSERT(!memcmp(b.const_byte_str(), data, 10));
+
+	// New bytes are zero
+	for (size_t i = 10; i < b.size(); i++)
+	{
+		CPPUNIT_ASSERT(b[i] == 0x00);
+	}
+
+	// Appending a string to itself
+	ByteString c(data, 40);
+	c += c;
+	CPPUNIT_ASSERT(c.size() == 80);
+	CPPUNIT_ASSERT(!memcmp(c.const_byte_str(), data, 40));
+	CPPUNIT_ASSERT(!memcmp(c.const_byte_str() + 40, data, 40));
+
+	// Even the smallest strings are kept in the secure pool, so they are
+	// locked and wiped on a fatal error; empty ones allocate nothing
+	size_t liveBlocks = SecurePool::i()->getLiveBlocks();
+	{
+		ByteString empty;
+		CPPUNIT_ASSERT(empty.const_byte_str() != NULL);
+		CPPUNIT_ASSERT(SecurePool::i()->getLiveBlocks() == liveBlocks);
+
+		ByteString small(data, 1);
+		ByteString copy = small;
+		ByteString part = ByteString(data, 64).substr(8, 16);
+		CPPUNIT_ASSERT(SecurePool::i()->getLiveBlocks() == liveBlocks + 3);
+		CPPUNIT_ASSERT(copy == small);
+		CPPUNIT_ASSERT(part == ByteString(data + 8, 16));
+	}
+	CPPUNIT_ASSERT(SecurePool::i()->getLiveBlocks() == liveBlocks);
+}
+
+void ByteStringTests::testMove()
+{
+	unsigned char data[128];
+
+	for (size_t i = 0; i < sizeof(data); i++) data[i] = (unsigned char) (0xFF - i);
+
+	// Moving a string takes over its buffer
+	ByteString large(data, sizeof(data));
+	const unsigned char* buffer = large.const_byte_str();
+	size_t allocations = SecurePool::i()->getAllocationCount();
+
+	ByteString moved(std::move(large));
+
+	CPPUNIT_ASSERT(SecurePool::i()->getAllocationCount() == allocations);
+	CPPUNIT_ASSERT(moved.const_byte_str() == buffer);
+	CPPUNIT_ASSERT(moved == ByteString(data, sizeof(data)));
+	CPPUNIT_ASSERT(large.size() == 0);
+
+	// Also when it is small
+	ByteString small(data, 16);
+	ByteString target;
+	buffer = small.const_byte_str();
+
+	target = std::move(small);
+
+	CPPUNIT_ASSERT(target.const_byte_str() == buffer);
+	CPPUNIT_ASSERT(target == ByteString(data, 16));
+	CPPUNIT_ASSERT(small.size() == 0);
+
+	// Move assignment over an existing buffer
+	ByteString other(data, sizeof(data));
+	other = std::move(moved);
+	CPPUNIT_ASSERT(other == ByteString(data, sizeof(data)));
+	CPPUNIT_ASSERT(moved.size() == 0);
+}
+
+void ByteStringTests::testView()
+{
+	ByteString b("0102030405060708090A");
+
+	ByteStringView v(b);
+
+	CPPUNIT_ASSERT(v.size() == b.size());
+	CPPUNIT_ASSERT(v.const_byte_str() == b.const_byte_str());
+	CPPUNIT_ASSERT(v == ByteStringView(b));
+	CPPUNIT_ASSERT(v.hex_str() == "0102030405060708090A");
+	CPPUNIT_ASSERT(v.long_val() == 0x0102030405060708UL);
+
+	// Sub views share the memory of the string
+	ByteStringView part = v.substr(2, 3);
+	CPPUNIT_ASSERT(part.size() == 3);
+	CPPUNIT_ASSERT(part.const_byte_str() == b.const_byte_str() + 2);
+	CPPUNIT_ASSERT(part.toByteString() == ByteString("030405"));
+	CPPUNIT_ASSERT(v.substr(20).size() == 0);
+
+	// Views on raw memory
+	unsigned char raw[] = { 0x03, 0x04, 0x05 };
+	CPPUNIT_ASSERT(part == ByteStringView(raw, sizeof(raw)));
+	CPPUNIT_ASSERT(part != ByteStringView(raw, 2));
+	CPPUNIT_ASSERT(ByteStringView() == ByteStringView(NULL, 0));
+}
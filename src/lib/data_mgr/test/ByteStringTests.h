@@ -48,6 +48,9 @@ class ByteStringTests : public CppUnit::TestFixture
 	CPPUNIT_TEST(testSplitting);
 	CPPUNIT_TEST(testBits);
 	CPPUNIT_TEST(testSerialising);
+	CPPUNIT_TEST(testSecureStorage);
+	CPPUNIT_TEST(testMove);
+	CPPUNIT_TEST(testView);
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -61,6 +64,9 @@ public:
 	void testSplitting();
 	void testBits();
 	void testSerialising();
+	void testSecureStorage();
+	void testMove();
+	void testView();
 
 	void setUp();
 	void tearDown();
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ SecureMemoryRegistryTests.cpp
+
+ Contains test cases to test the secure memory registry, including a
+ microbenchmark of the registration throughput for multiple threads
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "SecureMemoryRegistryTests.h"
+#include "SecureMemoryRegistry.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(SecureMemoryRegistryTests);
+
+// The number of blocks and iterations used by each benchmark thread
+#define BENCH_BLOCKS 64
+#define BENCH_ITERATIONS 100000
+
+void SecureMemoryRegistryTests::setUp()
+{
+}
+
+void SecureMemoryRegistryTests::tearDown()
+{
+	fflush(stdout);
+}
+
+void SecureMemoryRegistryTests::testAddRemove()
+{
+	SecureMemoryRegistry registry;
+	std::vector<void*> blocks;
+
+	for (size_t i = 0; i < 256; i++)
+	{
+		blocks.push_back(malloc(i + 1));
+		registry.add(blocks[i], i + 1);
+	}
+
+	// Every block must report the size it was registered with
+	for (size_t i = 0; i < 256; i++)
+	{
+		CPPUNIT_ASSERT(registry.remove(blocks[i]) == i + 1);
+	}
+
+	// Removing an unknown block yields a size of zero
+	CPPUNIT_ASSERT(registry.remove(blocks[0]) == 0);
+
+	for (size_t i = 0; i < 256; i++)
+	{
+		free(blocks[i]);
+	}
+}
+
+void SecureMemoryRegistryTests::testWipe()
+{
+	SecureMemoryRegistry registry;
+	std::vector<unsigned char*> blocks;
+
+	for (size_t i = 0; i < 32; i++)
+	{
+		blocks.push_back((unsigned char*) malloc(64));
+		memset(blocks[i], 0x5A, 64);
+		registry.add(blocks[i], 64);
+	}
+
+	registry.wipe();
+
+	// All blocks must have been wiped, regardless of their shard
+	for (size_t i = 0; i < 32; i++)
+	{
+		for (size_t j = 0; j < 64; j++)
+		{
+			CPPUNIT_ASSERT(blocks[i][j] == 0x00);
+		}
+
+		registry.remove(blocks[i]);
+		free(blocks[i]);
+	}
+}
+
+static void benchThread(SecureMemoryRegistry* registry)
+{
+	void* blocks[BENCH_BLOCKS];
+
+	for (size_t i = 0; i < BENCH_BLOCKS; i++)
+	{
+		blocks[i] = malloc(32);
+	}
+
+	for (size_t n = 0; n < BENCH_ITERATIONS; n++)
+	{
+		void* block = blocks[n % BENCH_BLOCKS];
+
+		registry->add(block, 32);
+		registry->remove(block);
+	}
+
+	for (size_t i = 0; i < BENCH_BLOCKS; i++)
+	{
+		free(blocks[i]);
+	}
+}
+
+void SecureMemoryRegistryTests::testThroughput()
+{
+	SecureMemoryRegistry registry;
+	size_t threadCounts[] = { 1, 2, 4, 8 };
+
+	printf("\n");
+
+	for (size_t t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]); t++)
+	{
+		std::vector<std::thread> threads;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		for (size_t i = 0; i < threadCounts[t]; i++)
+		{
+			threads.push_back(std::thread(benchThread, &registry));
+		}
+
+		for (size_t i = 0; i < threads.size(); i++)
+		{
+			threads[i].join();
+		}
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		double operations = (double) threadCounts[t] * BENCH_ITERATIONS * 2;
+
+		printf("SecureMemoryRegistry: %lu thread(s), %.0f add/remove operations per second\n",
+			(unsigned long) threadCounts[t], seconds > 0 ? operations / seconds : 0);
+	}
+}
+
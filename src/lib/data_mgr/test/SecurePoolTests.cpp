@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ SecurePoolTests.cpp
+
+ Contains test cases to test the secure pool allocator
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <vector>
+#include "SecurePoolTests.h"
+#include "SecurePool.h"
+#include "ByteString.h"
+#include "MutexFactory.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(SecurePoolTests);
+
+void SecurePoolTests::setUp()
+{
+}
+
+void SecurePoolTests::tearDown()
+{
+}
+
+void SecurePoolTests::testAllocateRelease()
+{
+	SecurePool* pool = SecurePool::i();
+	size_t liveBlocks = pool->getLiveBlocks();
+	std::vector<unsigned char*> blocks;
+
+	// Allocate blocks of every size served by the pool
+	for (size_t len = 1; len <= SecurePool::maxBlockSize(); len += 7)
+	{
+		unsigned char* block = (unsigned char*) pool->allocate(len);
+
+		CPPUNIT_ASSERT(block != NULL);
+
+		// The block must be zeroed and writable
+		for (size_t n = 0; n < len; n++)
+		{
+			CPPUNIT_ASSERT(block[n] == 0x00);
+		}
+		memset(block, 0xA5, len);
+
+		blocks.push_back(block);
+	}
+
+	CPPUNIT_ASSERT(pool->getLiveBlocks() == liveBlocks + blocks.size());
+
+	for (size_t n = 0; n < blocks.size(); n++)
+	{
+		CPPUNIT_ASSERT(pool->release(blocks[n]));
+	}
+
+	CPPUNIT_ASSERT(pool->getLiveBlocks() == liveBlocks);
+
+	// Requests beyond the largest size class are not served
+	CPPUNIT_ASSERT(pool->allocate(SecurePool::maxBlockSize() + 1) == NULL);
+	CPPUNIT_ASSERT(pool->allocate(0) == NULL);
+}
+
+void SecurePoolTests::testZeroOnRelease()
+{
+	SecurePool* pool = SecurePool::i();
+
+	unsigned char* block = (unsigned char*) pool->allocate(64);
+	CPPUNIT_ASSERT(block != NULL);
+
+	memset(block, 0xFF, 64);
+	CPPUNIT_ASSERT(pool->release(block));
+
+	// The free list link may occupy the first bytes; the rest must be zero
+	for (size_t n = sizeof(void*); n < 64; n++)
+	{
+		CPPUNIT_ASSERT(block[n] == 0x00);
+	}
+
+	// The same block is handed out again, fully zeroed
+	unsigned char* again = (unsigned char*) pool->allocate(64);
+	CPPUNIT_ASSERT(again == block);
+
+	for (size_t n = 0; n < 64; n++)
+	{
+		CPPUNIT_ASSERT(again[n] == 0x00);
+	}
+
+	CPPUNIT_ASSERT(pool->release(again));
+}
+
+void SecurePoolTests::testForeignPointer()
+{
+	SecurePool* pool = SecurePool::i();
+
+	void* foreign = malloc(32);
+
+	CPPUNIT_ASSERT(!pool->release(foreign));
+	CPPUNIT_ASSERT(!pool->release(NULL));
+
+	free(foreign);
+}
+
+void SecurePoolTests::testByteString()
+{
+	SecurePool* pool = SecurePool::i();
+	size_t liveBlocks = pool->getLiveBlocks();
+
+	{
+		// Byte strings are allocated from the pool
+		ByteString value;
+		value.resize(1);
+
+		CPPUNIT_ASSERT(pool->getLiveBlocks() > liveBlocks);
+	}
+
+	CPPUNIT_ASSERT(pool->getLiveBlocks() == liveBlocks);
+}
+
+void SecurePoolTests::testWipe()
+{
+	SecurePool* pool = SecurePool::i();
+
+	unsigned char* block = (unsigned char*) pool->allocate(128);
+	CPPUNIT_ASSERT(block != NULL);
+
+	memset(block, 0x5A, 128);
+
+	pool->wipe();
+
+	for (size_t n = 0; n < 128; n++)
+	{
+		CPPUNIT_ASSERT(block[n] == 0x00);
+	}
+
+	// Wiping also truncates the free lists, which only leaks the free
+	// blocks; the pool keeps working
+	CPPUNIT_ASSERT(pool->release(block));
+	block = (unsigned char*) pool->allocate(128);
+	CPPUNIT_ASSERT(block != NULL);
+	CPPUNIT_ASSERT(pool->release(block));
+}
+
+
+void SecurePoolTests::testReset()
+{
+	SecurePool* pool = SecurePool::i();
+
+	// An initialisation without locking
+	SecurePool::reset();
+	MutexFactory::i()->disable();
+
+	void* block = pool->allocate(32);
+	CPPUNIT_ASSERT(block != NULL);
+	CPPUNIT_ASSERT(pool->release(block));
+
+	// The next one locks with the mutexes it takes then
+	SecurePool::reset();
+	MutexFactory::i()->enable();
+
+	block = pool->allocate(32);
+	CPPUNIT_ASSERT(block != NULL);
+	CPPUNIT_ASSERT(pool->getLiveBlocks() > 0);
+	CPPUNIT_ASSERT(pool->release(block));
+}
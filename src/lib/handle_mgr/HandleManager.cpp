@@ -41,6 +41,12 @@
  use the same handle manager and therefore there will never be e.g. a session
  with the same handle as an object.
 
+ Handles index a table of entries. An entry is only reused once enough other
+ entries have been released, and every reuse bumps the generation that is
+ part of the handle, so a stale handle never matches the new occupant.
+ Lookups read the table without taking the mutex; changes take the mutex
+ and maintain per slot and per session indexes of the issued handles.
+
  *****************************************************************************/
 
 #include "HandleManager.h"
@@ -50,34 +56,151 @@
 HandleManager::HandleManager()
 {
 	handlesMutex = MutexFactory::i()->getMutex();
-	handleCounter = 0;
+	for (CK_ULONG i = 0; i < HANDLE_CHUNKS; i++)
+		chunks[i] = NULL;
+	// Entry zero is never used, so no handle equals CK_INVALID_HANDLE
+	nextIndex = 1;
 }
 
 // Destructor
 HandleManager::~HandleManager()
 {
+	for (CK_ULONG i = 0; i < HANDLE_CHUNKS; i++)
+		delete [] (Entry*)chunks[i];
 
 	MutexFactory::i()->recycleMutex(handlesMutex);
 }
 
+HandleManager::Entry* HandleManager::findEntry(const CK_ULONG handle)
+{
+	CK_ULONG index = handle & HANDLE_INDEX_MASK;
+	Entry* chunk = chunks[index / HANDLE_CHUNK_SIZE];
+	if (chunk == NULL)
+		return NULL;
+
+	Entry* entry = &chunk[index % HANDLE_CHUNK_SIZE];
+	if (entry->handle != handle || handle == CK_INVALID_HANDLE)
+		return NULL;
+	return entry;
+}
+
+CK_VOID_PTR HandleManager::lookup(const CK_ULONG handle, CK_HANDLE_KIND kind)
+{
+#ifndef HAVE_CXX11
+	MutexLocker lock(handlesMutex);
+#endif
+
+	Entry* entry = findEntry(handle);
+	if (entry == NULL)
+		return NULL_PTR;
+
+	CK_HANDLE_KIND entryKind = entry->kind;
+	CK_VOID_PTR object = entry->object;
+
+	// The entry may have been released while it was read
+	if (entry->handle != handle || entryKind != kind)
+		return NULL_PTR;
+	return object;
+}
+
+CK_ULONG HandleManager::issue(const Handle &h)
+{
+	CK_ULONG index;
+	if (freeIndices.size() > HANDLE_MIN_FREE || nextIndex > HANDLE_INDEX_MASK) {
+		if (freeIndices.empty()) {
+			ERROR_MSG("The handle table is full");
+			return CK_INVALID_HANDLE;
+		}
+		index = freeIndices.front();
+		freeIndices.pop_front();
+	} else {
+		index = nextIndex++;
+	}
+
+	Entry* chunk = chunks[index / HANDLE_CHUNK_SIZE];
+	if (chunk == NULL) {
+		chunk = new Entry[HANDLE_CHUNK_SIZE];
+		for (CK_ULONG i = 0; i < HANDLE_CHUNK_SIZE; i++) {
+			chunk[i].handle = CK_INVALID_HANDLE;
+			chunk[i].kind = CKH_INVALID;
+			chunk[i].object = NULL_PTR;
+			chunk[i].generation = 0;
+		}
+		chunks[index / HANDLE_CHUNK_SIZE] = chunk;
+	}
+
+	Entry* entry = &chunk[index % HANDLE_CHUNK_SIZE];
+	entry->info = h;
+	entry->kind = h.kind;
+	entry->object = h.object;
+	// Publish the handle last, readers check it before and after reading the entry
+	CK_ULONG handle = (entry->generation << HANDLE_INDEX_BITS) | index;
+	entry->handle = handle;
+
+	SlotHandles &slot = slots[h.slotID];
+	if (CKH_SESSION == h.kind) {
+		slot.sessions.insert(handle);
+	} else {
+		slot.objects.insert(handle);
+		if (h.isPrivate)
+			slot.privateObjects.insert(handle);
+		if (h.hSession != CK_INVALID_HANDLE)
+			sessionObjects[h.hSession].insert(handle);
+		objects[h.object] = handle;
+	}
+
+	return handle;
+}
+
+void HandleManager::release(const CK_ULONG handle)
+{
+	Entry* entry = findEntry(handle);
+	if (entry == NULL)
+		return;
+
+	Handle &h = entry->info;
+	std::map< CK_SLOT_ID, SlotHandles>::iterator sit = slots.find(h.slotID);
+	if (sit != slots.end()) {
+		sit->second.sessions.erase(handle);
+		sit->second.objects.erase(handle);
+		sit->second.privateObjects.erase(handle);
+	}
+	if (CKH_OBJECT == h.kind) {
+		if (h.hSession != CK_INVALID_HANDLE) {
+			std::map< CK_SESSION_HANDLE, std::set<CK_ULONG> >::iterator oit = sessionObjects.find(h.hSession);
+			if (oit != sessionObjects.end()) {
+				oit->second.erase(handle);
+				if (oit->second.empty())
+					sessionObjects.erase(oit);
+			}
+		}
+		std::map< CK_VOID_PTR, CK_ULONG>::iterator it = objects.find(h.object);
+		if (it != objects.end() && it->second == handle)
+			objects.erase(it);
+	}
+
+	// Invalidate the handle before the rest of the entry
+	entry->handle = CK_INVALID_HANDLE;
+	entry->kind = CKH_INVALID;
+	entry->object = NULL_PTR;
+	entry->info = Handle();
+	entry->generation = (entry->generation + 1) & (~(CK_ULONG)0 >> HANDLE_INDEX_BITS);
+
+	freeIndices.push_back(handle & HANDLE_INDEX_MASK);
+}
+
 CK_SESSION_HANDLE HandleManager::addSession(CK_SLOT_ID slotID, CK_VOID_PTR session)
 {
 	MutexLocker lock(handlesMutex);
 
 	Handle h( CKH_SESSION, slotID );
 	h.object = session;
-	handles[++handleCounter] = h;
-	return (CK_SESSION_HANDLE)handleCounter;
+	return (CK_SESSION_HANDLE)issue(h);
 }
 
 CK_VOID_PTR HandleManager::getSession(const CK_SESSION_HANDLE hSession)
 {
-	MutexLocker lock(handlesMutex);
-
-	std::map< CK_ULONG, Handle>::iterator it = handles.find(hSession);
-	if (it == handles.end() || CKH_SESSION != it->second.kind)
-		return NULL_PTR;
-	return it->second.object;
+	return lookup(hSession, CKH_SESSION);
 }
 
 CK_OBJECT_HANDLE HandleManager::addSessionObject(CK_SLOT_ID slotID, CK_SESSION_HANDLE hSession, bool isPrivate, CK_VOID_PTR object)
@@ -87,8 +210,8 @@ CK_OBJECT_HANDLE HandleManager::addSessionObject(CK_SLOT_ID slotID, CK_SESSION_H
 	// Return existing handle when the object has already been registered.
 	std::map< CK_VOID_PTR, CK_ULONG>::iterator oit = objects.find(object);
 	if (oit != objects.end()) {
-		std::map< CK_ULONG, Handle>::iterator hit = handles.find(oit->second);
-		if (hit == handles.end() || CKH_OBJECT != hit->second.kind || slotID != hit->second.slotID) {
+		Entry* entry = findEntry(oit->second);
+		if (entry == NULL || CKH_OBJECT != entry->info.kind || slotID != entry->info.slotID) {
 			objects.erase(oit);
 			return CK_INVALID_HANDLE;
 		} else
@@ -98,9 +221,7 @@ CK_OBJECT_HANDLE HandleManager::addSessionObject(CK_SLOT_ID slotID, CK_SESSION_H
 	Handle h( CKH_OBJECT, slotID, hSession );
 	h.isPrivate = isPrivate;
 	h.object = object;
-	handles[++handleCounter] = h;
-	objects[object] = handleCounter;
-	return (CK_OBJECT_HANDLE)handleCounter;
+	return (CK_OBJECT_HANDLE)issue(h);
 }
 
 CK_OBJECT_HANDLE HandleManager::addTokenObject(CK_SLOT_ID slotID, bool isPrivate, CK_VOID_PTR object)
@@ -110,8 +231,8 @@ CK_OBJECT_HANDLE HandleManager::addTokenObject(CK_SLOT_ID slotID, bool isPrivate
 	// Return existing handle when the object has already been registered.
 	std::map< CK_VOID_PTR, CK_ULONG>::iterator oit = objects.find(object);
 	if (oit != objects.end()) {
-		std::map< CK_ULONG, Handle>::iterator hit = handles.find(oit->second);
-		if (hit == handles.end() || CKH_OBJECT != hit->second.kind || slotID != hit->second.slotID) {
+		Entry* entry = findEntry(oit->second);
+		if (entry == NULL || CKH_OBJECT != entry->info.kind || slotID != entry->info.slotID) {
 			objects.erase(oit);
 			return CK_INVALID_HANDLE;
 		} else
@@ -122,19 +243,12 @@ CK_OBJECT_HANDLE HandleManager::addTokenObject(CK_SLOT_ID slotID, bool isPrivate
 	Handle h( CKH_OBJECT, slotID );
 	h.isPrivate = isPrivate;
 	h.object = object;
-	handles[++handleCounter] = h;
-	objects[object] = handleCounter;
-	return (CK_OBJECT_HANDLE)handleCounter;
+	return (CK_OBJECT_HANDLE)issue(h);
 }
 
 CK_VOID_PTR HandleManager::getObject(const CK_OBJECT_HANDLE hObject)
 {
-	MutexLocker lock(handlesMutex);
-
-	std::map< CK_ULONG, Handle>::iterator it = handles.find(hObject);
-	if (it == handles.end() || CKH_OBJECT != it->second.kind )
-		return NULL_PTR;
-	return it->second.object;
+	return lookup(hObject, CKH_OBJECT);
 }
 
 CK_OBJECT_HANDLE HandleManager::getObjectHandle(CK_VOID_PTR object)
@@ -151,47 +265,35 @@ void HandleManager::destroyObject(const CK_OBJECT_HANDLE hObject)
 {
 	MutexLocker lock(handlesMutex);
 
-	std::map< CK_ULONG, Handle>::iterator it = handles.find(hObject);
-	if (it != handles.end() && CKH_OBJECT == it->second.kind) {
-		objects.erase(it->second.object);
-		handles.erase(it);
-	}
+	Entry* entry = findEntry(hObject);
+	if (entry != NULL && CKH_OBJECT == entry->info.kind)
+		release(hObject);
 }
 
 void HandleManager::sessionClosed(const CK_SESSION_HANDLE hSession)
 {
-	CK_SLOT_ID slotID;
 	MutexLocker lock(handlesMutex);
 
-	std::map< CK_ULONG, Handle>::iterator it = handles.find(hSession);
-	if (it == handles.end() || CKH_SESSION != it->second.kind)
+	Entry* entry = findEntry(hSession);
+	if (entry == NULL || CKH_SESSION != entry->info.kind)
 		return; // Unable to find the specified session.
 
-	slotID = it->second.slotID;
+	CK_SLOT_ID slotID = entry->info.slotID;
 
 	// session closed, so we can erase information about it.
-	handles.erase(it);
+	release(hSession);
 
 	// Erase all session object handles associated with the given session handle.
-	CK_ULONG openSessionCount = 0;
-	for (it = handles.begin(); it != handles.end(); ) {
-		Handle &h = it->second;
-		if (CKH_SESSION == h.kind && slotID == h.slotID) {
-			++openSessionCount; // another session is open for this slotID.
-		} else {
-			if (CKH_OBJECT == h.kind && hSession == h.hSession) {
-				// A session object is present for the given session, so erase it.
-				objects.erase(it->second.object);
-				// Iterator post-incrementing (it++) will return a copy of the original it (which points to handle to be deleted).
-				handles.erase(it++);
-				continue;
-			}
-		}
-		++it;
+	std::map< CK_SESSION_HANDLE, std::set<CK_ULONG> >::iterator oit = sessionObjects.find(hSession);
+	if (oit != sessionObjects.end()) {
+		std::set<CK_ULONG> sessionHandles = oit->second;
+		for (std::set<CK_ULONG>::iterator it = sessionHandles.begin(); it != sessionHandles.end(); ++it)
+			release(*it);
 	}
 
 	 // We are done when there are still sessions open.
-	if (openSessionCount)
+	std::map< CK_SLOT_ID, SlotHandles>::iterator sit = slots.find(slotID);
+	if (sit != slots.end() && !sit->second.sessions.empty())
 		return;
 
 	// No more sessions open for this token, so remove all object handles that are still valid for the given slotID.
@@ -202,36 +304,31 @@ void HandleManager::allSessionsClosed(const CK_SLOT_ID slotID, bool isLocked)
 {
 	MutexLocker lock(isLocked ? NULL : handlesMutex);
 
+	std::map< CK_SLOT_ID, SlotHandles>::iterator sit = slots.find(slotID);
+	if (sit == slots.end())
+		return;
+
 	// Erase all "session", "session object" and "token object" handles for a given slot id.
-	std::map< CK_ULONG, Handle>::iterator it;
-	for (it = handles.begin(); it != handles.end(); ) {
-		Handle &h = it->second;
-		if (slotID == h.slotID) {
-			if (CKH_OBJECT == it->second.kind)
-				objects.erase(it->second.object);
-			// Iterator post-incrementing (it++) will return a copy of the original it (which points to handle to be deleted).
-			handles.erase(it++);
-			continue;
-		}
-		++it;
-	}
+	SlotHandles slot = sit->second;
+	std::set<CK_ULONG>::iterator it;
+	for (it = slot.sessions.begin(); it != slot.sessions.end(); ++it)
+		release(*it);
+	for (it = slot.objects.begin(); it != slot.objects.end(); ++it)
+		release(*it);
+
+	slots.erase(slotID);
 }
 
 void HandleManager::tokenLoggedOut(const CK_SLOT_ID slotID)
 {
 	MutexLocker lock(handlesMutex);
 
+	std::map< CK_SLOT_ID, SlotHandles>::iterator sit = slots.find(slotID);
+	if (sit == slots.end())
+		return;
+
 	// Erase all private "token object" or "session object" handles for a given slot id.
-	std::map< CK_ULONG, Handle>::iterator it;
-	for (it = handles.begin(); it != handles.end(); ) {
-		Handle &h = it->second;
-		if (CKH_OBJECT == h.kind && slotID == h.slotID && h.isPrivate) {
-			// A private object is present for the given slotID so we need to remove it.
-			objects.erase(it->second.object);
-			// Iterator post-incrementing (it++) will return a copy of the original it (which points to handle to be deleted).
-			handles.erase(it++);
-			continue;
-		}
-		++it;
-	}
+	std::set<CK_ULONG> privateObjects = sit->second.privateObjects;
+	for (std::set<CK_ULONG>::iterator it = privateObjects.begin(); it != privateObjects.end(); ++it)
+		release(*it);
 }
@@ -33,14 +33,30 @@
 #ifndef _SOFTHSM_V2_HANDLEMANAGER_H
 #define _SOFTHSM_V2_HANDLEMANAGER_H
 
+#include "config.h"
 #include "MutexFactory.h"
 #include "Handle.h"
 #include "cryptoki.h"
 
+#include <deque>
 #include <map>
+#include <set>
+#ifdef HAVE_CXX11
+#include <atomic>
+#endif
 
 #define CK_INTERNAL_SESSION_HANDLE CK_SESSION_HANDLE
 
+// The low bits of a handle select the entry in the handle table, the high
+// bits hold the generation of the entry so stale handles are detected
+#define HANDLE_INDEX_BITS 22
+#define HANDLE_INDEX_MASK ((1UL << HANDLE_INDEX_BITS) - 1)
+#define HANDLE_CHUNK_SIZE 1024
+#define HANDLE_CHUNKS ((HANDLE_INDEX_MASK + 1) / HANDLE_CHUNK_SIZE)
+
+// The number of released entries kept before entries are reused
+#define HANDLE_MIN_FREE 1024
+
 class HandleManager
 {
 public:
@@ -84,10 +100,58 @@ public:
     void tokenLoggedOut(const CK_SLOT_ID slotID);
 
 private:
+    // An entry of the handle table. The handle, kind and object are read
+    // without holding the mutex; everything else is only used by writers.
+    struct Entry
+    {
+#ifdef HAVE_CXX11
+        std::atomic<CK_ULONG> handle;
+        std::atomic<CK_HANDLE_KIND> kind;
+        std::atomic<CK_VOID_PTR> object;
+#else
+        CK_ULONG handle;
+        CK_HANDLE_KIND kind;
+        CK_VOID_PTR object;
+#endif
+        Handle info;
+        CK_ULONG generation;
+    };
+
+    // The handles per slot
+    struct SlotHandles
+    {
+        std::set<CK_ULONG> sessions;
+        std::set<CK_ULONG> objects;
+        std::set<CK_ULONG> privateObjects;
+    };
+
+    // Look up a handle of the given kind
+    CK_VOID_PTR lookup(const CK_ULONG handle, CK_HANDLE_KIND kind);
+
+    // Find the entry of a handle, if it is still valid
+    Entry* findEntry(const CK_ULONG handle);
+
+    // Issue a new handle; returns CK_INVALID_HANDLE if the table is full
+    CK_ULONG issue(const Handle &h);
+
+    // Release a handle and remove it from the secondary indexes
+    void release(const CK_ULONG handle);
+
     Mutex* handlesMutex;
-    std::map< CK_ULONG, Handle> handles;
+
+    // The handle table, allocated in chunks that are never moved
+#ifdef HAVE_CXX11
+    std::atomic<Entry*> chunks[HANDLE_CHUNKS];
+#else
+    Entry* chunks[HANDLE_CHUNKS];
+#endif
+    CK_ULONG nextIndex;
+    std::deque<CK_ULONG> freeIndices;
+
+    // Secondary indexes
     std::map< CK_VOID_PTR, CK_ULONG> objects;
-    CK_ULONG handleCounter;
+    std::map< CK_SLOT_ID, SlotHandles> slots;
+    std::map< CK_SESSION_HANDLE, std::set<CK_ULONG> > sessionObjects;
 };
 
 #endif // !_SOFTHSM_V2_HANDLEMANAGER_H
@@ -34,6 +34,11 @@
 #include <string.h>
 #include <cppunit/extensions/HelperMacros.h>
 #include "HandleManagerTests.h"
+#ifdef HAVE_CXX11
+#include <atomic>
+#include <thread>
+#include <vector>
+#endif
 
 CPPUNIT_TEST_SUITE_REGISTRATION(HandleManagerTests);
 
@@ -176,3 +181,115 @@ void HandleManagerTests::testHandleManager()
 	CPPUNIT_ASSERT(NULL == handleManager->getSession(hSession));
 	CPPUNIT_ASSERT(NULL == handleManager->getSession(hSession2));
 }
+
+void HandleManagerTests::testStaleHandles()
+{
+	CK_SLOT_ID slotID = 1234;
+	CK_ULONG objects[HANDLE_MIN_FREE + 1];
+
+	// Release enough handles to make the handle manager reuse entries
+	CK_OBJECT_HANDLE hFirst = handleManager->addTokenObject(slotID, false, &objects[0]);
+	CPPUNIT_ASSERT(hFirst != CK_INVALID_HANDLE);
+	handleManager->destroyObject(hFirst);
+
+	std::set<CK_OBJECT_HANDLE> issued;
+	issued.insert(hFirst);
+	for (CK_ULONG i = 1; i <= HANDLE_MIN_FREE; i++) {
+		CK_OBJECT_HANDLE hObject = handleManager->addTokenObject(slotID, false, &objects[i]);
+		CPPUNIT_ASSERT(hObject != CK_INVALID_HANDLE);
+		CPPUNIT_ASSERT(issued.insert(hObject).second);
+		handleManager->destroyObject(hObject);
+	}
+
+	// The entry of the first handle is in use again, under a new handle
+	CK_OBJECT_HANDLE hReused = handleManager->addTokenObject(slotID, false, &objects[0]);
+	CPPUNIT_ASSERT(hReused != CK_INVALID_HANDLE);
+	CPPUNIT_ASSERT((hReused & HANDLE_INDEX_MASK) == (hFirst & HANDLE_INDEX_MASK));
+	CPPUNIT_ASSERT(hReused != hFirst);
+
+	// The stale handle does not resolve to the new occupant
+	CPPUNIT_ASSERT(NULL == handleManager->getObject(hFirst));
+	CPPUNIT_ASSERT(&objects[0] == handleManager->getObject(hReused));
+	CPPUNIT_ASSERT(hReused == handleManager->getObjectHandle(&objects[0]));
+
+	// Handles of one kind are not accepted as the other kind
+	CPPUNIT_ASSERT(NULL == handleManager->getSession(hReused));
+	CPPUNIT_ASSERT(NULL == handleManager->getObject(CK_INVALID_HANDLE));
+}
+
+void HandleManagerTests::testSessionClose()
+{
+	CK_SLOT_ID slotID = 1234;
+	CK_SLOT_ID otherSlotID = 5678;
+	CK_ULONG sessions[3];
+	CK_ULONG objects[4];
+
+	CK_SESSION_HANDLE hSession = handleManager->addSession(slotID, &sessions[0]);
+	CK_SESSION_HANDLE hSession2 = handleManager->addSession(slotID, &sessions[1]);
+	CK_SESSION_HANDLE hOther = handleManager->addSession(otherSlotID, &sessions[2]);
+
+	CK_OBJECT_HANDLE hObject = handleManager->addSessionObject(slotID, hSession, false, &objects[0]);
+	CK_OBJECT_HANDLE hObject2 = handleManager->addSessionObject(slotID, hSession2, false, &objects[1]);
+	CK_OBJECT_HANDLE hToken = handleManager->addTokenObject(slotID, true, &objects[2]);
+	CK_OBJECT_HANDLE hOtherToken = handleManager->addTokenObject(otherSlotID, true, &objects[3]);
+
+	// Closing a session only removes its own session objects
+	handleManager->sessionClosed(hSession);
+	CPPUNIT_ASSERT(NULL == handleManager->getSession(hSession));
+	CPPUNIT_ASSERT(NULL == handleManager->getObject(hObject));
+	CPPUNIT_ASSERT(&objects[1] == handleManager->getObject(hObject2));
+	CPPUNIT_ASSERT(&objects[2] == handleManager->getObject(hToken));
+	CPPUNIT_ASSERT(CK_INVALID_HANDLE == handleManager->getObjectHandle(&objects[0]));
+
+	// A logout only affects the slot that was logged out
+	handleManager->tokenLoggedOut(slotID);
+	CPPUNIT_ASSERT(NULL == handleManager->getObject(hToken));
+	CPPUNIT_ASSERT(&objects[3] == handleManager->getObject(hOtherToken));
+
+	// Closing the last session of a slot removes all of its handles
+	handleManager->sessionClosed(hSession2);
+	CPPUNIT_ASSERT(NULL == handleManager->getObject(hObject2));
+	CPPUNIT_ASSERT(&sessions[2] == handleManager->getSession(hOther));
+	CPPUNIT_ASSERT(&objects[3] == handleManager->getObject(hOtherToken));
+}
+
+#ifdef HAVE_CXX11
+void HandleManagerTests::testConcurrentLookup()
+{
+	const CK_SLOT_ID slotID = 1234;
+	const int nReaders = 4;
+	CK_ULONG session;
+	CK_ULONG objects[64];
+
+	CK_SESSION_HANDLE hSession = handleManager->addSession(slotID, &session);
+	CK_OBJECT_HANDLE hObject = handleManager->addTokenObject(slotID, false, &objects[0]);
+
+	// Readers keep resolving the handles while a writer churns the table
+	std::atomic<bool> stop(false);
+	std::atomic<int> failures(0);
+	std::vector<std::thread> readers;
+	for (int i = 0; i < nReaders; i++) {
+		readers.push_back(std::thread([&]() {
+			while (!stop) {
+				if (handleManager->getSession(hSession) != &session) failures++;
+				if (handleManager->getObject(hObject) != &objects[0]) failures++;
+			}
+		}));
+	}
+
+	for (int round = 0; round < 200; round++) {
+		std::vector<CK_OBJECT_HANDLE> handles;
+		for (int i = 1; i < 64; i++)
+			handles.push_back(handleManager->addSessionObject(slotID, hSession, i % 2 == 0, &objects[i]));
+		handleManager->tokenLoggedOut(slotID);
+		for (size_t i = 0; i < handles.size(); i++)
+			handleManager->destroyObject(handles[i]);
+	}
+
+	stop = true;
+	for (size_t i = 0; i < readers.size(); i++)
+		readers[i].join();
+
+	CPPUNIT_ASSERT(failures == 0);
+}
+#endif
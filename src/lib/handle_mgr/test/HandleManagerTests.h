@@ -34,6 +34,7 @@
 #define _SOFTHSM_V2_HANDLEMANAGERTESTS_H
 
 #include <cppunit/extensions/HelperMacros.h>
+#include "config.h"
 #include "RNG.h"
 #include "HandleManager.h"
 
@@ -41,10 +42,20 @@ class HandleManagerTests : public CppUnit::TestFixture
 {
 	CPPUNIT_TEST_SUITE(HandleManagerTests);
 	CPPUNIT_TEST(testHandleManager);
+	CPPUNIT_TEST(testStaleHandles);
+	CPPUNIT_TEST(testSessionClose);
+#ifdef HAVE_CXX11
+	CPPUNIT_TEST(testConcurrentLookup);
+#endif
 	CPPUNIT_TEST_SUITE_END();
 
 public:
 	void testHandleManager();
+	void testStaleHandles();
+	void testSessionClose();
+#ifdef HAVE_CXX11
+	void testConcurrentLookup();
+#endif
 
 	void setUp();
 	void tearDown();
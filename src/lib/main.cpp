@@ -39,6 +39,7 @@
 #include "log.h"
 #include "fatal.h"
 #include "cryptoki.h"
+#include "vendor_defines.h"
 #include "MizaruHSM.h"
 
 #if defined(__GNUC__) && \
@@ -1185,3 +1186,107 @@ PKCS_API CK_RV C_WaitForSlotEvent(CK_FLAGS flags, CK_SLOT_ID_PTR pSlot, CK_VOID_
 	return CKR_FUNCTION_FAILED;
 }
 
+// Verify a batch of independent signatures (vendor extension)
+PKCS_API CK_RV C_VerifyBatch(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_ULONG ulCount, CK_OBJECT_HANDLE_PTR phKeys, CK_BYTE_PTR* ppData, CK_ULONG_PTR pulDataLen, CK_BYTE_PTR* ppSignature, CK_ULONG_PTR pulSignatureLen, CK_RV* pResults)
+{
+	try
+	{
+		return MizaruHSM::i()->C_VerifyBatch(hSession, pMechanism, ulCount, phKeys, ppData, pulDataLen, ppSignature, pulSignatureLen, pResults);
+	}
+	catch (...)
+	{
+		FatalException();
+	}
+
+	return CKR_FUNCTION_FAILED;
+}
+
+// Queue a single part signature (vendor extension)
+PKCS_API CK_RV C_SignAsync(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey, CK_BYTE_PTR pData, CK_ULONG ulDataLen, CK_ULONG_PTR pulTicket)
+{
+	try
+	{
+		return MizaruHSM::i()->C_SignAsync(hSession, pMechanism, hKey, pData, ulDataLen, pulTicket);
+	}
+	catch (...)
+	{
+		FatalException();
+	}
+
+	return CKR_FUNCTION_FAILED;
+}
+
+// Queue a single part verification (vendor extension)
+PKCS_API CK_RV C_VerifyAsync(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey, CK_BYTE_PTR pData, CK_ULONG ulDataLen, CK_BYTE_PTR pSignature, CK_ULONG ulSignatureLen, CK_ULONG_PTR pulTicket)
+{
+	try
+	{
+		return MizaruHSM::i()->C_VerifyAsync(hSession, pMechanism, hKey, pData, ulDataLen, pSignature, ulSignatureLen, pulTicket);
+	}
+	catch (...)
+	{
+		FatalException();
+	}
+
+	return CKR_FUNCTION_FAILED;
+}
+
+// Queue a single part encryption (vendor extension)
+PKCS_API CK_RV C_EncryptAsync(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey, CK_BYTE_PTR pData, CK_ULONG ulDataLen, CK_ULONG_PTR pulTicket)
+{
+	try
+	{
+		return MizaruHSM::i()->C_EncryptAsync(hSession, pMechanism, hKey, pData, ulDataLen, pulTicket);
+	}
+	catch (...)
+	{
+		FatalException();
+	}
+
+	return CKR_FUNCTION_FAILED;
+}
+
+// Collect the result of a queued operation if it has completed (vendor extension)
+PKCS_API CK_RV C_PollAsync(CK_SESSION_HANDLE hSession, CK_ULONG ulTicket, CK_BYTE_PTR pOutput, CK_ULONG_PTR pulOutputLen)
+{
+	try
+	{
+		return MizaruHSM::i()->C_PollAsync(hSession, ulTicket, pOutput, pulOutputLen);
+	}
+	catch (...)
+	{
+		FatalException();
+	}
+
+	return CKR_FUNCTION_FAILED;
+}
+
+// Wait for the result of a queued operation (vendor extension)
+PKCS_API CK_RV C_WaitAsync(CK_SESSION_HANDLE hSession, CK_ULONG ulTicket, CK_ULONG ulTimeout, CK_BYTE_PTR pOutput, CK_ULONG_PTR pulOutputLen)
+{
+	try
+	{
+		return MizaruHSM::i()->C_WaitAsync(hSession, ulTicket, ulTimeout, pOutput, pulOutputLen);
+	}
+	catch (...)
+	{
+		FatalException();
+	}
+
+	return CKR_FUNCTION_FAILED;
+}
+
+// Return the routing of an operation of the Mizaru backend (vendor extension)
+PKCS_API CK_RV C_GetOffloadInfo(CK_ULONG ulOperation, CK_MIZARU_OFFLOAD_INFO_PTR pInfo)
+{
+	try
+	{
+		return MizaruHSM::i()->C_GetOffloadInfo(ulOperation, pInfo);
+	}
+	catch (...)
+	{
+		FatalException();
+	}
+
+	return CKR_FUNCTION_FAILED;
+}
@@ -47,13 +47,13 @@
 
 // Create an object that can access a record, but don't do anything yet.
 DBObject::DBObject(DB::Connection *connection, ObjectStoreToken *token)
-	: _mutex(MutexFactory::i()->getMutex()), _connection(connection), _token(token), _objectId(0), _transaction(NULL)
+	: _mutex(MutexFactory::i()->getMutex()), _connection(connection), _token(token), _objectId(0), _revision(nextRevision()), _transaction(NULL)
 {
 
 }
 
 DBObject::DBObject(DB::Connection *connection, ObjectStoreToken *token, long long objectId)
-	: _mutex(MutexFactory::i()->getMutex()), _connection(connection), _token(token), _objectId(objectId), _transaction(NULL)
+	: _mutex(MutexFactory::i()->getMutex()), _connection(connection), _token(token), _objectId(objectId), _revision(nextRevision()), _transaction(NULL)
 {
 }
 
@@ -1197,6 +1197,7 @@ bool DBObject::setAttribute(CK_ATTRIBUTE_TYPE type, const OSAttribute& attribute
 					(*_transaction)[type] = new OSAttribute(attribute);
 			} else
 				*attr = attribute;
+			_revision = nextRevision();
 			return true;
 		}
 	}
@@ -1274,6 +1275,7 @@ bool DBObject::setAttribute(CK_ATTRIBUTE_TYPE type, const OSAttribute& attribute
 			(*_transaction)[type] = new OSAttribute(attribute);
 		else
 			_attributes[type] = new OSAttribute(attribute);
+		_revision = nextRevision();
 		return true;
 	}
 
@@ -1357,6 +1359,7 @@ bool DBObject::deleteAttribute(CK_ATTRIBUTE_TYPE type)
 			}
 		}
 
+		_revision = nextRevision();
 		return true;
 	}
 
@@ -1371,6 +1374,14 @@ bool DBObject::isValid()
 	return _objectId != 0 && _connection != NULL;
 }
 
+// Retrieve the revision of the object
+unsigned long DBObject::getRevision()
+{
+	MutexLocker lock(_mutex);
+
+	return _revision;
+}
+
 // Start an attribute set transaction; this method is used when - for
 // example - a key is generated and all its attributes need to be
 // persisted in one go.
@@ -1450,6 +1461,7 @@ bool DBObject::commitTransaction()
 	}
 	delete _transaction;
 	_transaction = NULL;
+	_revision = nextRevision();
 	return true;
 }
 
@@ -1475,6 +1487,8 @@ bool DBObject::abortTransaction()
 		_transaction = NULL;
 	}
 
+	_revision = nextRevision();
+
 	return _connection->rollbackTransaction();
 }
 
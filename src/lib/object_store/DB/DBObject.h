@@ -98,6 +98,9 @@ public:
 	// The validity state of the object
 	virtual bool isValid();
 
+	// Retrieve the revision of the object
+	virtual unsigned long getRevision();
+
 	// Start an attribute set transaction; this method is used when - for
 	// example - a key is generated and all its attributes need to be
 	// persisted in one go.
@@ -130,6 +133,7 @@ private:
 	DB::Connection *_connection;
 	ObjectStoreToken *_token;
 	long long _objectId;
+	unsigned long _revision;
 
 	std::map<CK_ATTRIBUTE_TYPE,OSAttribute*> _attributes;
 	std::map<CK_ATTRIBUTE_TYPE,OSAttribute*> *_transaction;
@@ -541,6 +541,73 @@ bool DBToken::getTokenSerial(ByteString& serial)
 	return true;
 }
 
+// Get the record of the Mizar key slots claimed by the token
+bool DBToken::getKeySlots(ByteString& keySlots)
+{
+	if (_connection == NULL) return false;
+
+	// Create a DBObject for the established connection to the token object in the database
+	DBObject tokenObject(_connection);
+
+	if (!tokenObject.startTransaction(DBObject::ReadOnly))
+	{
+		ERROR_MSG("Unable to start a transaction for getting the KEYSLOTS from token database at \"%s\"", _connection->dbpath().c_str());
+		return false;
+	}
+
+	// First find the token object in the database.
+	if (!tokenObject.find(DBTOKEN_OBJECT_TOKENINFO))
+	{
+		ERROR_MSG("Token object not found in token database at \"%s\"", _connection->dbpath().c_str());
+		tokenObject.abortTransaction();
+		return false;
+	}
+
+	keySlots = tokenObject.getByteStringValue(CKA_OS_KEYSLOTS);
+	tokenObject.commitTransaction();
+	return true;
+}
+
+// Set the record of the Mizar key slots claimed by the token
+bool DBToken::setKeySlots(const ByteString& keySlots)
+{
+	if (_connection == NULL) return false;
+
+	// Create a DBObject for the established connection to the token object in the database
+	DBObject tokenObject(_connection);
+
+	if (!tokenObject.startTransaction(DBObject::ReadWrite))
+	{
+		ERROR_MSG("Unable to start a transaction for setting the KEYSLOTS in token database at \"%s\"", _connection->dbpath().c_str());
+		return false;
+	}
+
+	// First find the token object in the database.
+	if (!tokenObject.find(DBTOKEN_OBJECT_TOKENINFO))
+	{
+		ERROR_MSG("Token object not found in token database at \"%s\"", _connection->dbpath().c_str());
+		tokenObject.abortTransaction();
+		return false;
+	}
+
+	OSAttribute slots(keySlots);
+	if (!tokenObject.setAttribute(CKA_OS_KEYSLOTS, slots))
+	{
+		ERROR_MSG("Error while setting KEYSLOTS in token database at \"%s\"", _connection->dbpath().c_str());
+		tokenObject.abortTransaction();
+		return false;
+	}
+
+	if (!tokenObject.commitTransaction())
+	{
+		ERROR_MSG("Error while committing KEYSLOTS changes to token database at \"%s\"", _connection->dbpath().c_str());
+		tokenObject.abortTransaction();
+		return false;
+	}
+
+	return true;
+}
+
 // Get the token flags
 bool DBToken::getTokenFlags(CK_ULONG& flags)
 {
@@ -28,13 +28,15 @@
  FindOperation.cpp
 
  This class represents the find operation that can be used to collect
- objects that match the attributes contained in a given template.
+ objects that match the attributes contained in a given template. It either
+ holds the handles of all matching objects, or acts as a cursor over the
+ objects still to be matched against a copy of the template.
  *****************************************************************************/
 
 #include "config.h"
 #include "FindOperation.h"
 
-FindOperation::FindOperation()
+FindOperation::FindOperation() : _position(0)
 {
 }
 
@@ -78,3 +80,46 @@ CK_ULONG FindOperation::eraseHandles(CK_ULONG ulIndex, CK_ULONG ulCount)
     }
     return ulReturn;
 }
+
+void FindOperation::setObjects(const std::set<OSObject*> &objects)
+{
+    _objects.assign(objects.begin(), objects.end());
+    _position = 0;
+}
+
+void FindOperation::setTemplate(const CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount)
+{
+    // Copy all values first; the attributes must not point into a vector that still grows.
+    _values.clear();
+    _values.resize(ulCount);
+    for (CK_ULONG i = 0; i < ulCount; ++i) {
+        if (pTemplate[i].pValue != NULL_PTR) {
+            _values[i] = ByteString((const unsigned char*)pTemplate[i].pValue, pTemplate[i].ulValueLen);
+        }
+    }
+
+    _template.resize(ulCount);
+    for (CK_ULONG i = 0; i < ulCount; ++i) {
+        _template[i].type = pTemplate[i].type;
+        _template[i].ulValueLen = pTemplate[i].ulValueLen;
+        _template[i].pValue = (pTemplate[i].pValue == NULL_PTR) ? NULL_PTR : (CK_VOID_PTR)_values[i].const_byte_str();
+    }
+}
+
+CK_ATTRIBUTE_PTR FindOperation::getTemplate()
+{
+    return _template.empty() ? NULL_PTR : &_template[0];
+}
+
+CK_ULONG FindOperation::getTemplateCount()
+{
+    return _template.size();
+}
+
+bool FindOperation::nextObject(OSObject* &object)
+{
+    if (_position >= _objects.size()) return false;
+
+    object = _objects[_position++];
+    return true;
+}
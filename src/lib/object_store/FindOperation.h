@@ -28,7 +28,9 @@
  FindOperation.h
 
  This class represents the find operation that can be used to collect
- objects that match the attributes contained in a given template.
+ objects that match the attributes contained in a given template. It either
+ holds the handles of all matching objects, or acts as a cursor over the
+ objects still to be matched against a copy of the template.
  *****************************************************************************/
 
 #ifndef _SOFTHSM_V2_FINDOPERATION_H
@@ -37,6 +39,8 @@
 #include "config.h"
 
 #include <set>
+#include <vector>
+#include "ByteString.h"
 #include "OSObject.h"
 
 class FindOperation
@@ -57,11 +61,32 @@ public:
     // Erase handles from the handles set.
     CK_ULONG eraseHandles(CK_ULONG ulIndex, CK_ULONG ulCount);
 
+    // Set the objects that will be matched lazily, in order.
+    void setObjects(const std::set<OSObject*> &objects);
+
+    // Keep a copy of the template the objects are matched against.
+    void setTemplate(const CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount);
+
+    // Retrieve the copy of the template.
+    CK_ATTRIBUTE_PTR getTemplate();
+    CK_ULONG getTemplateCount();
+
+    // Retrieve the next object to match; returns false when there are no more objects.
+    bool nextObject(OSObject* &object);
+
 protected:
     // Use a protected constructor to force creation via factory method.
     FindOperation();
 
     std::set<CK_OBJECT_HANDLE> _handles;
+
+    // The objects still to be matched and the position of the cursor.
+    std::vector<OSObject*> _objects;
+    size_t _position;
+
+    // The copy of the template; the attributes point into the values.
+    std::vector<CK_ATTRIBUTE> _template;
+    std::vector<ByteString> _values;
 };
 
 #endif // _SOFTHSM_V2_FINDOPERATION_H
@@ -0,0 +1,414 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ LogObject.cpp
+
+ An object of a token in an object log
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "LogObject.h"
+
+// Constructor
+LogObject::LogObject(ObjectLog* inLog, ObjectStoreToken* inToken, unsigned long long inId)
+{
+	log = inLog;
+	token = inToken;
+	id = inId;
+	valid = true;
+	sequence = log->getSequence(id);
+	revision = nextRevision();
+	inTransaction = false;
+	transactionAccess = ReadOnly;
+	objectMutex = MutexFactory::i()->getMutex();
+}
+
+// Destructor
+LogObject::~LogObject()
+{
+	clearTransaction();
+
+	for (std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator i = cache.begin(); i != cache.end(); ++i)
+	{
+		delete i->second;
+	}
+
+	MutexFactory::i()->recycleMutex(objectMutex);
+}
+
+unsigned long long LogObject::getId()
+{
+	return id;
+}
+
+void LogObject::refresh()
+{
+	unsigned long long current = log->getSequence(id);
+	if (current == sequence) return;
+
+	for (std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator i = cache.begin(); i != cache.end(); ++i)
+	{
+		delete i->second;
+	}
+	cache.clear();
+
+	sequence = current;
+	revision = nextRevision();
+}
+
+OSAttribute* LogObject::accessAttribute(CK_ATTRIBUTE_TYPE type)
+{
+	if (inTransaction)
+	{
+		if (transactionDeleted.find(type) != transactionDeleted.end()) return NULL;
+
+		std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator i = transactionSet.find(type);
+		if (i != transactionSet.end()) return i->second;
+	}
+
+	refresh();
+
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator i = cache.find(type);
+	if (i != cache.end()) return i->second;
+
+	OSAttribute* attr = log->getAttribute(id, type);
+	if (attr != NULL) cache[type] = attr;
+
+	return attr;
+}
+
+// Check if the specified attribute exists
+bool LogObject::attributeExists(CK_ATTRIBUTE_TYPE type)
+{
+	MutexLocker lock(objectMutex);
+
+	if (inTransaction)
+	{
+		if (transactionDeleted.find(type) != transactionDeleted.end()) return false;
+		if (transactionSet.find(type) != transactionSet.end()) return true;
+	}
+
+	return valid && log->attributeExists(id, type);
+}
+
+// Retrieve the specified attribute
+OSAttribute LogObject::getAttribute(CK_ATTRIBUTE_TYPE type)
+{
+	MutexLocker lock(objectMutex);
+
+	OSAttribute* attr = accessAttribute(type);
+	if (attr == NULL)
+	{
+		ERROR_MSG("The attribute does not exist: 0x%08X", type);
+
+		return OSAttribute((unsigned long) 0);
+	}
+
+	return *attr;
+}
+
+bool LogObject::getBooleanValue(CK_ATTRIBUTE_TYPE type, bool val)
+{
+	MutexLocker lock(objectMutex);
+
+	OSAttribute* attr = accessAttribute(type);
+	if (attr == NULL) return val;
+
+	if (attr->isBooleanAttribute())
+	{
+		return attr->getBooleanValue();
+	}
+	else
+	{
+		ERROR_MSG("The attribute is not a boolean: 0x%08X", type);
+		return val;
+	}
+}
+
+unsigned long LogObject::getUnsignedLongValue(CK_ATTRIBUTE_TYPE type, unsigned long val)
+{
+	MutexLocker lock(objectMutex);
+
+	OSAttribute* attr = accessAttribute(type);
+	if (attr == NULL) return val;
+
+	if (attr->isUnsignedLongAttribute())
+	{
+		return attr->getUnsignedLongValue();
+	}
+	else
+	{
+		ERROR_MSG("The attribute is not an unsigned long: 0x%08X", type);
+		return val;
+	}
+}
+
+ByteString LogObject::getByteStringValue(CK_ATTRIBUTE_TYPE type)
+{
+	MutexLocker lock(objectMutex);
+
+	ByteString val;
+
+	OSAttribute* attr = accessAttribute(type);
+	if (attr == NULL) return val;
+
+	if (attr->isByteStringAttribute())
+	{
+		return attr->getByteStringValue();
+	}
+	else
+	{
+		ERROR_MSG("The attribute is not a byte string: 0x%08X", type);
+		return val;
+	}
+}
+
+// Retrieve the next attribute type
+CK_ATTRIBUTE_TYPE LogObject::nextAttributeType(CK_ATTRIBUTE_TYPE type)
+{
+	MutexLocker lock(objectMutex);
+
+	// The next attribute in the log that was not deleted in the transaction
+	CK_ATTRIBUTE_TYPE next = type;
+	do
+	{
+		next = log->nextAttributeType(id, next);
+	}
+	while (next != CKA_CLASS && inTransaction && transactionDeleted.find(next) != transactionDeleted.end());
+
+	if (!inTransaction) return next;
+
+	// Or an attribute that was added in the transaction
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator i = transactionSet.upper_bound(type);
+	if (i != transactionSet.end() && (next == CKA_CLASS || i->first < next))
+	{
+		next = i->first;
+	}
+
+	// return type or CKA_CLASS (= 0)
+	return next;
+}
+
+// Set the specified attribute
+bool LogObject::setAttribute(CK_ATTRIBUTE_TYPE type, const OSAttribute& attribute)
+{
+	MutexLocker lock(objectMutex);
+
+	if (!valid)
+	{
+		DEBUG_MSG("Cannot update invalid object %llu", id);
+
+		return false;
+	}
+
+	if (inTransaction)
+	{
+		if (transactionAccess != ReadWrite)
+		{
+			ERROR_MSG("Cannot set an attribute in a read-only transaction");
+			return false;
+		}
+
+		std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator i = transactionSet.find(type);
+		if (i != transactionSet.end())
+		{
+			delete i->second;
+		}
+		transactionSet[type] = new OSAttribute(attribute);
+		transactionDeleted.erase(type);
+
+		return true;
+	}
+
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*> set;
+	set[type] = const_cast<OSAttribute*>(&attribute);
+
+	return log->update(id, set, std::set<CK_ATTRIBUTE_TYPE>());
+}
+
+// Delete the specified attribute
+bool LogObject::deleteAttribute(CK_ATTRIBUTE_TYPE type)
+{
+	MutexLocker lock(objectMutex);
+
+	if (!valid)
+	{
+		DEBUG_MSG("Cannot update invalid object %llu", id);
+
+		return false;
+	}
+
+	if (inTransaction)
+	{
+		if (transactionAccess != ReadWrite)
+		{
+			ERROR_MSG("Cannot delete an attribute in a read-only transaction");
+			return false;
+		}
+
+		std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator i = transactionSet.find(type);
+		if (i != transactionSet.end())
+		{
+			delete i->second;
+			transactionSet.erase(i);
+		}
+		transactionDeleted.insert(type);
+
+		return true;
+	}
+
+	if (!log->attributeExists(id, type))
+	{
+		ERROR_MSG("Attribute does not exist 0x%08X", type);
+
+		return false;
+	}
+
+	std::set<CK_ATTRIBUTE_TYPE> deleted;
+	deleted.insert(type);
+
+	return log->update(id, std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>(), deleted);
+}
+
+// The validity state of the object
+bool LogObject::isValid()
+{
+	MutexLocker lock(objectMutex);
+
+	return valid && log->exists(id);
+}
+
+// Retrieve the revision of the object
+unsigned long LogObject::getRevision()
+{
+	MutexLocker lock(objectMutex);
+
+	refresh();
+
+	return revision;
+}
+
+// Start an attribute set transaction
+bool LogObject::startTransaction(Access access)
+{
+	MutexLocker lock(objectMutex);
+
+	if (inTransaction)
+	{
+		ERROR_MSG("Transaction is already active.");
+
+		return false;
+	}
+
+	// Pick up changes made by other processes
+	if (!log->sync()) return false;
+
+	inTransaction = true;
+	transactionAccess = access;
+
+	return true;
+}
+
+// Commit an attribute transaction
+bool LogObject::commitTransaction()
+{
+	MutexLocker lock(objectMutex);
+
+	if (!inTransaction)
+	{
+		ERROR_MSG("No transaction is active.");
+
+		return false;
+	}
+
+	bool rv = true;
+
+	if (!transactionSet.empty() || !transactionDeleted.empty())
+	{
+		// Deleting an attribute that was never set is not a change
+		std::set<CK_ATTRIBUTE_TYPE> deleted;
+		for (std::set<CK_ATTRIBUTE_TYPE>::iterator i = transactionDeleted.begin(); i != transactionDeleted.end(); ++i)
+		{
+			if (log->attributeExists(id, *i)) deleted.insert(*i);
+		}
+
+		rv = valid && log->update(id, transactionSet, deleted);
+	}
+
+	clearTransaction();
+
+	return rv;
+}
+
+// Abort an attribute transaction
+bool LogObject::abortTransaction()
+{
+	MutexLocker lock(objectMutex);
+
+	if (!inTransaction)
+	{
+		ERROR_MSG("No transaction is active.");
+
+		return false;
+	}
+
+	clearTransaction();
+
+	return true;
+}
+
+void LogObject::clearTransaction()
+{
+	for (std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator i = transactionSet.begin(); i != transactionSet.end(); ++i)
+	{
+		delete i->second;
+	}
+	transactionSet.clear();
+	transactionDeleted.clear();
+	inTransaction = false;
+}
+
+// Destroys the object
+bool LogObject::destroyObject()
+{
+	if (token == NULL)
+	{
+		ERROR_MSG("Cannot destroy an object that is not associated with a token");
+		return false;
+	}
+
+	return token->deleteObject(this);
+}
+
+// Invalidate the object
+void LogObject::invalidate()
+{
+	MutexLocker lock(objectMutex);
+
+	valid = false;
+}
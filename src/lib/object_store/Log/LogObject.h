@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ LogObject.h
+
+ An object of a token in an object log. The attributes are read from the
+ log and decoded values are kept until the object is changed; the changes
+ made in a transaction are written as a single record on commit.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_LOGOBJECT_H
+#define _SOFTHSM_V2_LOGOBJECT_H
+
+#include "config.h"
+#include "OSAttribute.h"
+#include "cryptoki.h"
+#include "OSObject.h"
+#include "ObjectStoreToken.h"
+#include "ObjectLog.h"
+#include "MutexFactory.h"
+#include <map>
+#include <set>
+
+class LogObject : public OSObject
+{
+public:
+	// Constructor
+	LogObject(ObjectLog* inLog, ObjectStoreToken* inToken, unsigned long long inId);
+
+	// Destructor
+	virtual ~LogObject();
+
+	// The id of the object in the log
+	unsigned long long getId();
+
+	// Check if the specified attribute exists
+	virtual bool attributeExists(CK_ATTRIBUTE_TYPE type);
+
+	// Retrieve the specified attribute
+	virtual OSAttribute getAttribute(CK_ATTRIBUTE_TYPE type);
+	virtual bool getBooleanValue(CK_ATTRIBUTE_TYPE type, bool val);
+	virtual unsigned long getUnsignedLongValue(CK_ATTRIBUTE_TYPE type, unsigned long val);
+	virtual ByteString getByteStringValue(CK_ATTRIBUTE_TYPE type);
+
+	// Retrieve the next attribute type
+	virtual CK_ATTRIBUTE_TYPE nextAttributeType(CK_ATTRIBUTE_TYPE type);
+
+	// Set the specified attribute
+	virtual bool setAttribute(CK_ATTRIBUTE_TYPE type, const OSAttribute& attribute);
+
+	// Delete the specified attribute
+	virtual bool deleteAttribute(CK_ATTRIBUTE_TYPE type);
+
+	// The validity state of the object
+	virtual bool isValid();
+
+	// Retrieve the revision of the object
+	virtual unsigned long getRevision();
+
+	// Start an attribute set transaction
+	virtual bool startTransaction(Access access);
+
+	// Commit an attribute transaction
+	virtual bool commitTransaction();
+
+	// Abort an attribute transaction
+	virtual bool abortTransaction();
+
+	// Destroys the object (warning, any pointers to the object are no longer
+	// valid after this call because delete is called!)
+	virtual bool destroyObject();
+
+	// Invalidate the object
+	void invalidate();
+
+private:
+	// Disable copy constructor and assignment
+	LogObject();
+	LogObject(const LogObject&);
+	LogObject& operator=(const LogObject&);
+
+	// Drops the cached values if the object was changed in the log
+	void refresh();
+
+	// Returns the attribute, or NULL if it does not exist; the mutex is held
+	OSAttribute* accessAttribute(CK_ATTRIBUTE_TYPE type);
+
+	// Clears the changes of a transaction
+	void clearTransaction();
+
+	ObjectLog* log;
+	ObjectStoreToken* token;
+	unsigned long long id;
+	bool valid;
+
+	// The sequence of the object in the log the cache belongs to
+	unsigned long long sequence;
+	unsigned long revision;
+
+	// Decoded attribute values
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*> cache;
+
+	// The changes of the transaction in progress
+	bool inTransaction;
+	Access transactionAccess;
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*> transactionSet;
+	std::set<CK_ATTRIBUTE_TYPE> transactionDeleted;
+
+	// For thread safeness
+	Mutex* objectMutex;
+};
+
+#endif // !_SOFTHSM_V2_LOGOBJECT_H
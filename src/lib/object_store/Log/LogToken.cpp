@@ -0,0 +1,569 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ LogToken.cpp
+
+ The token class; a token is stored in a directory containing a single
+ object log. The token information is kept in the first object of the log.
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "OSAttributes.h"
+#include "OSAttribute.h"
+#include "OSPathSep.h"
+
+#include "cryptoki.h"
+#include "LogToken.h"
+#include "LogObject.h"
+
+#include "Directory.h"
+
+#include <vector>
+#include <string>
+#include <set>
+#include <map>
+#include <cstdio>
+#include <sys/stat.h>
+#include <errno.h>
+
+const char * const LOGTOKEN_FILE = "token.log";
+const unsigned long long LOGTOKEN_OBJECT_TOKENINFO = 0;
+
+// Constructor for creating a new token.
+LogToken::LogToken(const std::string &baseDir, const std::string &tokenName, int umask, const ByteString &label, const ByteString &serial)
+	: _log(NULL), _valid(false), _tokenMutex(NULL)
+{
+	_tokenDir = baseDir + OS_PATHSEP + tokenName;
+	std::string tokenPath = _tokenDir + OS_PATHSEP + LOGTOKEN_FILE;
+
+	// First create the directory for the token, we expect basePath to already exist
+	if (::mkdir(_tokenDir.c_str(), S_IFDIR | ((S_IRWXU | S_IRWXG | S_IRWXO) & ~umask)))
+	{
+		// Allow the directory to exists already.
+		if (errno != EEXIST)
+		{
+			ERROR_MSG("Unable to create directory \"%s\"", _tokenDir.c_str());
+			return;
+		}
+	}
+
+	// The log refuses to overwrite an existing file
+	_log = new ObjectLog(tokenPath, umask, true);
+	if (!_log->isValid())
+	{
+		ERROR_MSG("Failed to create the object log at \"%s\"", tokenPath.c_str());
+		return;
+	}
+
+	unsigned long long tokenObject;
+	if (!_log->createObject(tokenObject) || tokenObject != LOGTOKEN_OBJECT_TOKENINFO)
+	{
+		ERROR_MSG("Failed to create the token object in the object log at \"%s\"", tokenPath.c_str());
+		return;
+	}
+
+	// Set the initial attributes
+	CK_ULONG flags =
+		CKF_RNG |
+		CKF_LOGIN_REQUIRED | // FIXME: check
+		CKF_RESTORE_KEY_NOT_NEEDED |
+		CKF_TOKEN_INITIALIZED |
+		CKF_SO_PIN_LOCKED |
+		CKF_SO_PIN_TO_BE_CHANGED;
+
+	OSAttribute tokenLabel(label);
+	OSAttribute tokenSerial(serial);
+	OSAttribute tokenFlags(flags);
+
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*> set;
+	set[CKA_OS_TOKENLABEL] = &tokenLabel;
+	set[CKA_OS_TOKENSERIAL] = &tokenSerial;
+	set[CKA_OS_TOKENFLAGS] = &tokenFlags;
+
+	if (!_log->update(LOGTOKEN_OBJECT_TOKENINFO, set, std::set<CK_ATTRIBUTE_TYPE>()))
+	{
+		ERROR_MSG("Failed to set the token attributes in the object log at \"%s\"", tokenPath.c_str());
+
+		delete _log;
+		_log = NULL;
+
+		// Now remove the token file
+		if (remove(tokenPath.c_str()))
+		{
+			ERROR_MSG("Failed to remove the token file at \"%s\"", tokenPath.c_str());
+		}
+		return;
+	}
+
+	_tokenMutex = MutexFactory::i()->getMutex();
+	_valid = true;
+	// Success!
+}
+
+// Constructor for accessing an existing token.
+LogToken::LogToken(const std::string &baseDir, const std::string &tokenName, int umask)
+	: _log(NULL), _valid(false), _tokenMutex(NULL)
+{
+	_tokenDir = baseDir + OS_PATHSEP + tokenName;
+	std::string tokenPath = _tokenDir + OS_PATHSEP + LOGTOKEN_FILE;
+
+	FILE *f = fopen(tokenPath.c_str(),"r");
+	if (f == NULL)
+	{
+		ERROR_MSG("Refusing to open a non-existant object log at \"%s\"", tokenPath.c_str());
+		return;
+	}
+	fclose(f);
+
+	_log = new ObjectLog(tokenPath, umask, false);
+	if (!_log->isValid() || !_log->exists(LOGTOKEN_OBJECT_TOKENINFO))
+	{
+		ERROR_MSG("Failed to open token object in the object log at \"%s\"", tokenPath.c_str());
+		return;
+	}
+
+	_tokenMutex = MutexFactory::i()->getMutex();
+	_valid = true;
+
+	// Success!
+}
+
+LogToken *LogToken::createToken(const std::string basePath, const std::string tokenDir, int umask, const ByteString &label, const ByteString &serial)
+{
+	Directory baseDir(basePath);
+
+	if (!baseDir.isValid())
+	{
+		return NULL;
+	}
+
+	// Create the token directory
+	if (!baseDir.mkdir(tokenDir, umask))
+	{
+		return NULL;
+	}
+
+	LogToken *token = new LogToken(basePath, tokenDir, umask, label, serial);
+	if (!token->isValid())
+	{
+		baseDir.rmdir(tokenDir);
+
+		delete token;
+		return NULL;
+	}
+
+	DEBUG_MSG("Created new token %s", tokenDir.c_str());
+
+	return token;
+}
+
+LogToken *LogToken::accessToken(const std::string &basePath, const std::string &tokenDir, int umask)
+{
+	return new LogToken(basePath, tokenDir, umask);
+}
+
+// Destructor
+LogToken::~LogToken()
+{
+	if (_tokenMutex)
+	{
+		MutexFactory::i()->recycleMutex(_tokenMutex);
+		_tokenMutex = NULL;
+	}
+
+	std::map<unsigned long long, LogObject*> cleanUp = _allObjects;
+	_allObjects.clear();
+	for (std::map<unsigned long long, LogObject*>::iterator i = cleanUp.begin(); i != cleanUp.end(); ++i)
+	{
+		delete i->second;
+	}
+
+	delete _log;
+}
+
+bool LogToken::getInfo(CK_ATTRIBUTE_TYPE type, ByteString& value)
+{
+	if (_log == NULL || !_log->sync()) return false;
+
+	OSAttribute* attr = _log->getAttribute(LOGTOKEN_OBJECT_TOKENINFO, type);
+	if (attr == NULL || !attr->isByteStringAttribute())
+	{
+		delete attr;
+		return false;
+	}
+
+	value = attr->getByteStringValue();
+	delete attr;
+
+	return true;
+}
+
+bool LogToken::getInfo(CK_ATTRIBUTE_TYPE type, CK_ULONG& value)
+{
+	if (_log == NULL || !_log->sync()) return false;
+
+	OSAttribute* attr = _log->getAttribute(LOGTOKEN_OBJECT_TOKENINFO, type);
+	if (attr == NULL || !attr->isUnsignedLongAttribute())
+	{
+		delete attr;
+		return false;
+	}
+
+	value = attr->getUnsignedLongValue();
+	delete attr;
+
+	return true;
+}
+
+bool LogToken::setInfo(const std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>& set, const std::set<CK_ATTRIBUTE_TYPE>& deleted, CK_ULONG clearFlags, CK_ULONG setFlags)
+{
+	if (_log == NULL) return false;
+
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*> changes = set;
+
+	CK_ULONG flags;
+	if (!getInfo(CKA_OS_TOKENFLAGS, flags))
+	{
+		ERROR_MSG("Error while getting TOKENFLAGS from the object log at \"%s\"", _log->getPath().c_str());
+		return false;
+	}
+
+	OSAttribute changedTokenFlags((flags & ~clearFlags) | setFlags);
+	changes[CKA_OS_TOKENFLAGS] = &changedTokenFlags;
+
+	if (!_log->update(LOGTOKEN_OBJECT_TOKENINFO, changes, deleted))
+	{
+		ERROR_MSG("Error while updating the token object in the object log at \"%s\"", _log->getPath().c_str());
+		return false;
+	}
+
+	return true;
+}
+
+// Set the SO PIN
+bool LogToken::setSOPIN(const ByteString& soPINBlob)
+{
+	OSAttribute soPIN(soPINBlob);
+
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*> set;
+	set[CKA_OS_SOPIN] = &soPIN;
+
+	// Reset flags related to tries and expiration of the SOPIN.
+	return setInfo(set, std::set<CK_ATTRIBUTE_TYPE>(),
+		CKF_SO_PIN_COUNT_LOW | CKF_SO_PIN_FINAL_TRY | CKF_SO_PIN_LOCKED | CKF_SO_PIN_TO_BE_CHANGED, 0);
+}
+
+// Get the SO PIN
+bool LogToken::getSOPIN(ByteString& soPINBlob)
+{
+	return getInfo(CKA_OS_SOPIN, soPINBlob);
+}
+
+// Set the user PIN
+bool LogToken::setUserPIN(ByteString userPINBlob)
+{
+	OSAttribute userPIN(userPINBlob);
+
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*> set;
+	set[CKA_OS_USERPIN] = &userPIN;
+
+	// Reset flags related to tries and expiration of the user PIN.
+	return setInfo(set, std::set<CK_ATTRIBUTE_TYPE>(),
+		CKF_USER_PIN_COUNT_LOW | CKF_USER_PIN_FINAL_TRY | CKF_USER_PIN_LOCKED | CKF_USER_PIN_TO_BE_CHANGED,
+		CKF_USER_PIN_INITIALIZED);
+}
+
+// Get the user PIN
+bool LogToken::getUserPIN(ByteString& userPINBlob)
+{
+	return getInfo(CKA_OS_USERPIN, userPINBlob);
+}
+
+// Retrieve the token label
+bool LogToken::getTokenLabel(ByteString& label)
+{
+	return getInfo(CKA_OS_TOKENLABEL, label);
+}
+
+// Retrieve the token serial
+bool LogToken::getTokenSerial(ByteString& serial)
+{
+	return getInfo(CKA_OS_TOKENSERIAL, serial);
+}
+
+// Get the record of the Mizar key slots claimed by the token
+bool LogToken::getKeySlots(ByteString& keySlots)
+{
+	if (_log == NULL || !_log->sync()) return false;
+
+	OSAttribute* attr = _log->getAttribute(LOGTOKEN_OBJECT_TOKENINFO, CKA_OS_KEYSLOTS);
+	keySlots = (attr != NULL && attr->isByteStringAttribute()) ? attr->getByteStringValue() : ByteString();
+	delete attr;
+
+	return true;
+}
+
+// Set the record of the Mizar key slots claimed by the token
+bool LogToken::setKeySlots(const ByteString& keySlots)
+{
+	if (_log == NULL) return false;
+
+	OSAttribute slots(keySlots);
+
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*> set;
+	set[CKA_OS_KEYSLOTS] = &slots;
+
+	if (!_log->update(LOGTOKEN_OBJECT_TOKENINFO, set, std::set<CK_ATTRIBUTE_TYPE>()))
+	{
+		ERROR_MSG("Error while updating the token object in the object log at \"%s\"", _log->getPath().c_str());
+		return false;
+	}
+
+	return true;
+}
+
+// Get the token flags
+bool LogToken::getTokenFlags(CK_ULONG& flags)
+{
+	return getInfo(CKA_OS_TOKENFLAGS, flags);
+}
+
+// Set the token flags
+bool LogToken::setTokenFlags(const CK_ULONG flags)
+{
+	if (_log == NULL) return false;
+
+	OSAttribute tokenFlags(flags);
+
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*> set;
+	set[CKA_OS_TOKENFLAGS] = &tokenFlags;
+
+	if (!_log->update(LOGTOKEN_OBJECT_TOKENINFO, set, std::set<CK_ATTRIBUTE_TYPE>()))
+	{
+		ERROR_MSG("Error while setting TOKENFLAGS in the object log at \"%s\"", _log->getPath().c_str());
+		return false;
+	}
+
+	return true;
+}
+
+// Retrieve objects
+std::set<OSObject *> LogToken::getObjects()
+{
+	std::set<OSObject*> objects;
+	getObjects(objects);
+
+	return objects;
+}
+
+void LogToken::getObjects(std::set<OSObject*> &objects)
+{
+	if (_log == NULL || !_log->sync()) return;
+
+	std::vector<unsigned long long> ids;
+	_log->getObjects(ids);
+
+	MutexLocker lock(_tokenMutex);
+
+	for (std::vector<unsigned long long>::iterator i = ids.begin(); i != ids.end(); ++i)
+	{
+		if (*i == LOGTOKEN_OBJECT_TOKENINFO) continue;
+
+		std::map<unsigned long long, LogObject*>::iterator it = _allObjects.find(*i);
+		if (it == _allObjects.end())
+		{
+			LogObject *object = new LogObject(_log, this, *i);
+			_allObjects[*i] = object;
+			objects.insert(object);
+		}
+		else
+		{
+			objects.insert(it->second);
+		}
+	}
+}
+
+// Create a new object
+OSObject *LogToken::createObject()
+{
+	if (_log == NULL) return NULL;
+
+	unsigned long long objectId;
+	if (!_log->createObject(objectId))
+	{
+		ERROR_MSG("Unable to create an object in the object log at \"%s\"", _log->getPath().c_str());
+		return NULL;
+	}
+
+	LogObject *newObject = new LogObject(_log, this, objectId);
+
+	// Now add the new object to the list of existing objects.
+	{
+		MutexLocker lock(_tokenMutex);
+		_allObjects[objectId] = newObject;
+	}
+
+	return newObject;
+}
+
+bool LogToken::deleteObject(OSObject *object)
+{
+	if (_log == NULL) return false;
+
+	if (object == NULL)
+	{
+		ERROR_MSG("Object passed in as a parameter is NULL");
+		return false;
+	}
+
+	LogObject *logObject = static_cast<LogObject *>(object);
+
+	if (!_log->deleteObject(logObject->getId()))
+	{
+		ERROR_MSG("Error while deleting an existing object from the object log at \"%s\"", _log->getPath().c_str());
+		return false;
+	}
+
+	logObject->invalidate();
+
+	return true;
+}
+
+// Checks if the token is consistent
+bool LogToken::isValid()
+{
+	return _valid && _log != NULL && _log->isValid() && _log->exists(LOGTOKEN_OBJECT_TOKENINFO);
+}
+
+// Invalidate the token (for instance if it is deleted)
+void LogToken::invalidate()
+{
+	_valid = false;
+
+	MutexLocker lock(_tokenMutex);
+
+	for (std::map<unsigned long long, LogObject*>::iterator i = _allObjects.begin(); i != _allObjects.end(); ++i)
+	{
+		i->second->invalidate();
+	}
+}
+
+// Delete the token.
+bool LogToken::clearToken()
+{
+	if (_log == NULL) return false;
+
+	invalidate();
+
+	// The objects still read from the log until they are discarded
+	std::map<unsigned long long, LogObject*> cleanUp;
+	{
+		MutexLocker lock(_tokenMutex);
+		cleanUp.swap(_allObjects);
+	}
+	for (std::map<unsigned long long, LogObject*>::iterator i = cleanUp.begin(); i != cleanUp.end(); ++i)
+	{
+		delete i->second;
+	}
+
+	delete _log;
+	_log = NULL;
+
+	// Remove all files from the token directory, even ones not placed there by us.
+	Directory dir(_tokenDir);
+	std::vector<std::string> tokenFiles = dir.getFiles();
+
+	for (std::vector<std::string>::iterator i = tokenFiles.begin(); i != tokenFiles.end(); i++)
+	{
+		if (!dir.remove(*i))
+		{
+			ERROR_MSG("Failed to remove \"%s\" from token directory \"%s\"", i->c_str(), _tokenDir.c_str());
+
+			return false;
+		}
+	}
+
+	// Now remove the token directory
+	if (!dir.rmdir(""))
+	{
+		ERROR_MSG("Failed to remove the token directory \"%s\"", _tokenDir.c_str());
+
+		return false;
+	}
+
+	DEBUG_MSG("Token instance %s was succesfully cleared", _tokenDir.c_str());
+
+	return true;
+}
+
+// Reset the token
+bool LogToken::resetToken(const ByteString& label)
+{
+	if (_log == NULL) return false;
+
+	// Clean up
+	std::set<OSObject*> cleanUp = getObjects();
+
+	for (std::set<OSObject*>::iterator i = cleanUp.begin(); i != cleanUp.end(); i++)
+	{
+		if (!deleteObject(*i))
+		{
+			ERROR_MSG("Unable to delete all objects in the object log at \"%s\"", _log->getPath().c_str());
+
+			return false;
+		}
+	}
+
+	OSAttribute tokenLabel(label);
+
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*> set;
+	set[CKA_OS_TOKENLABEL] = &tokenLabel;
+
+	std::set<CK_ATTRIBUTE_TYPE> deleted;
+	if (_log->attributeExists(LOGTOKEN_OBJECT_TOKENINFO, CKA_OS_USERPIN))
+	{
+		deleted.insert(CKA_OS_USERPIN);
+	}
+
+	// Reset flags related to tries and expiration of the user PIN.
+	if (!setInfo(set, deleted,
+		CKF_USER_PIN_INITIALIZED | CKF_USER_PIN_COUNT_LOW | CKF_USER_PIN_FINAL_TRY | CKF_USER_PIN_LOCKED | CKF_USER_PIN_TO_BE_CHANGED, 0))
+	{
+		return false;
+	}
+
+	DEBUG_MSG("Token instance %s was succesfully reset", _tokenDir.c_str());
+
+	return true;
+}
+
+// Compact the object log of the token
+bool LogToken::compact()
+{
+	return _log != NULL && _log->compact();
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ LogToken.h
+
+ The token class; a token is stored in a directory containing a single
+ object log (see ObjectLog.h). The token information is kept in the first
+ object of the log.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_LOGTOKEN_H
+#define _SOFTHSM_V2_LOGTOKEN_H
+
+#include "config.h"
+#include "ByteString.h"
+#include "MutexFactory.h"
+#include "OSAttribute.h"
+#include "cryptoki.h"
+#include "OSObject.h"
+#include "ObjectStoreToken.h"
+#include "ObjectLog.h"
+#include "LogObject.h"
+
+#include <string>
+#include <map>
+#include <set>
+
+class LogToken : public ObjectStoreToken
+{
+public:
+	// Constructor to create a new token
+	LogToken(const std::string &baseDir, const std::string &tokenName, int umask, const ByteString& label, const ByteString& serial);
+
+	// Constructor to access an existing token
+	LogToken(const std::string &baseDir, const std::string &tokenName, int umask);
+
+	// Create a new token
+	static LogToken* createToken(const std::string basePath, const std::string tokenDir, int umask, const ByteString& label, const ByteString& serial);
+
+	// Access an existing token
+	static LogToken* accessToken(const std::string &basePath, const std::string &tokenDir, int umask);
+
+	// Destructor
+	virtual ~LogToken();
+
+	// Set the SO PIN
+	virtual bool setSOPIN(const ByteString& soPINBlob);
+
+	// Get the SO PIN
+	virtual bool getSOPIN(ByteString& soPINBlob);
+
+	// Set the user PIN
+	virtual bool setUserPIN(ByteString userPINBlob);
+
+	// Get the user PIN
+	virtual bool getUserPIN(ByteString& userPINBlob);
+
+	// Get the token flags
+	virtual bool getTokenFlags(CK_ULONG& flags);
+
+	// Set the token flags
+	virtual bool setTokenFlags(const CK_ULONG flags);
+
+	// Retrieve the token label
+	virtual bool getTokenLabel(ByteString& label);
+
+	// Retrieve the token serial
+	virtual bool getTokenSerial(ByteString& serial);
+
+	// Get and set the record of the Mizar key slots claimed by the token
+	virtual bool getKeySlots(ByteString& keySlots);
+	virtual bool setKeySlots(const ByteString& keySlots);
+
+	// Retrieve objects
+	virtual std::set<OSObject*> getObjects();
+
+	// Insert objects into the given set
+	virtual void getObjects(std::set<OSObject*> &objects);
+
+	// Create a new object
+	virtual OSObject* createObject();
+
+	// Delete an object
+	virtual bool deleteObject(OSObject* object);
+
+	// Checks if the token is consistent
+	virtual bool isValid();
+
+	// Invalidate the token (for instance if it is deleted)
+	virtual void invalidate();
+
+	// Delete the token
+	virtual bool clearToken();
+
+	// Reset the token
+	virtual bool resetToken(const ByteString& label);
+
+	// Compact the object log of the token
+	bool compact();
+
+private:
+	// Read an attribute of the token information
+	bool getInfo(CK_ATTRIBUTE_TYPE type, ByteString& value);
+	bool getInfo(CK_ATTRIBUTE_TYPE type, CK_ULONG& value);
+
+	// Change the token information in one record; the flags are updated
+	// by clearing and then setting the given bits
+	bool setInfo(const std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>& set, const std::set<CK_ATTRIBUTE_TYPE>& deleted, CK_ULONG clearFlags, CK_ULONG setFlags);
+
+	ObjectLog* _log;
+
+	std::string _tokenDir;
+
+	bool _valid;
+
+	// All the objects ever associated with this token
+	//
+	// This map is kept to be able to clean up when the token
+	// instance is discarded; in case the contents of a token
+	// change, some objects may disappear but we cannot simply
+	// delete them since they may still be referenced from an
+	// object outside of this class.
+	std::map<unsigned long long, LogObject*> _allObjects;
+
+	// For thread safeness
+	Mutex* _tokenMutex;
+};
+
+#endif // !_SOFTHSM_V2_LOGTOKEN_H
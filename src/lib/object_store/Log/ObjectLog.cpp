@@ -0,0 +1,1053 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ ObjectLog.cpp
+
+ The store of a token in a single memory-mapped, append-only file
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "ObjectLog.h"
+#include "FileSync.h"
+#include "OSPathSep.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <system_error>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// The file header: magic, version, reserved and the next object id
+static const unsigned char LOG_MAGIC[8] = { 'S', 'H', 'S', 'M', 'L', 'O', 'G', 0 };
+#define LOG_VERSION		1
+#define LOG_HEADER_LEN		24
+
+// A record is its payload length, the CRC of the payload and the payload;
+// the payload is the operation, the object id and the operation data
+#define LOG_RECORD_HEADER_LEN	8
+#define LOG_PAYLOAD_HEADER_LEN	9
+
+#define LOG_OP_CREATE		1
+#define LOG_OP_UPDATE		2
+#define LOG_OP_DELETE		3
+
+// An attribute in an update: its type, whether it is set and its value
+#define LOG_CHANGE_HEADER_LEN	9
+
+// The encoded attribute kinds
+#define LOG_ATTR_BOOL		0
+#define LOG_ATTR_ULONG		1
+#define LOG_ATTR_BYTESTR	2
+#define LOG_ATTR_MECHSET	3
+#define LOG_ATTR_ATTRMAP	4
+
+// The file is mapped in steps of this size
+#define LOG_MAP_CHUNK		(1024 * 1024)
+
+// Writes to the compacted file are buffered up to this size
+#define LOG_WRITE_BUFFER	(1024 * 1024)
+
+// The overhead of an object in a compacted log: a create record and the
+// header of an update record
+#define LOG_OBJECT_OVERHEAD	(2 * (LOG_RECORD_HEADER_LEN + LOG_PAYLOAD_HEADER_LEN) + 4)
+
+/*****************************************************************************
+ Encoding
+ *****************************************************************************/
+
+static void put32(ByteString& out, unsigned long value)
+{
+	for (int i = 3; i >= 0; i--) out += (unsigned char) (value >> (8 * i));
+}
+
+static void put64(ByteString& out, unsigned long long value)
+{
+	for (int i = 7; i >= 0; i--) out += (unsigned char) (value >> (8 * i));
+}
+
+static unsigned long get32(const unsigned char* p)
+{
+	return ((unsigned long) p[0] << 24) | ((unsigned long) p[1] << 16) | ((unsigned long) p[2] << 8) | p[3];
+}
+
+static unsigned long long get64(const unsigned char* p)
+{
+	return ((unsigned long long) get32(p) << 32) | get32(p + 4);
+}
+
+// CRC-32 (IEEE 802.3)
+static unsigned long crc32(const unsigned char* data, size_t len)
+{
+	static struct Table
+	{
+		unsigned long entries[256];
+
+		Table()
+		{
+			for (unsigned long i = 0; i < 256; i++)
+			{
+				unsigned long c = i;
+				for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+				entries[i] = c;
+			}
+		}
+	}
+	table;
+
+	unsigned long crc = 0xFFFFFFFFUL;
+	for (size_t i = 0; i < len; i++) crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+	return crc ^ 0xFFFFFFFFUL;
+}
+
+// Writes all of a buffer
+static bool writeAll(int fd, const unsigned char* data, size_t len, off_t offset)
+{
+	while (len > 0)
+	{
+		ssize_t n = pwrite(fd, data, len, offset);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+
+		data += n;
+		len -= n;
+		offset += n;
+	}
+
+	return true;
+}
+
+// Adds a record with the given payload to a buffer
+static void addRecord(ByteString& out, const ByteString& payload)
+{
+	put32(out, payload.size());
+	put32(out, crc32(payload.const_byte_str(), payload.size()));
+	out += payload;
+}
+
+void ObjectLog::encode(const OSAttribute& attribute, ByteString& out)
+{
+	if (attribute.isBooleanAttribute())
+	{
+		out += (unsigned char) LOG_ATTR_BOOL;
+		out += (unsigned char) (attribute.getBooleanValue() ? 1 : 0);
+	}
+	else if (attribute.isUnsignedLongAttribute())
+	{
+		out += (unsigned char) LOG_ATTR_ULONG;
+		put64(out, attribute.getUnsignedLongValue());
+	}
+	else if (attribute.isByteStringAttribute())
+	{
+		out += (unsigned char) LOG_ATTR_BYTESTR;
+		put32(out, attribute.getByteStringValue().size());
+		out += attribute.getByteStringValue();
+	}
+	else if (attribute.isMechanismTypeSetAttribute())
+	{
+		const std::set<CK_MECHANISM_TYPE>& value = attribute.getMechanismTypeSetValue();
+
+		out += (unsigned char) LOG_ATTR_MECHSET;
+		put32(out, value.size());
+		for (std::set<CK_MECHANISM_TYPE>::const_iterator i = value.begin(); i != value.end(); ++i)
+		{
+			put64(out, *i);
+		}
+	}
+	else if (attribute.isAttributeMapAttribute())
+	{
+		const std::map<CK_ATTRIBUTE_TYPE,OSAttribute>& value = attribute.getAttributeMapValue();
+
+		out += (unsigned char) LOG_ATTR_ATTRMAP;
+		put32(out, value.size());
+		for (std::map<CK_ATTRIBUTE_TYPE,OSAttribute>::const_iterator i = value.begin(); i != value.end(); ++i)
+		{
+			put64(out, i->first);
+			encode(i->second, out);
+		}
+	}
+}
+
+size_t ObjectLog::skip(const unsigned char* data, size_t len)
+{
+	if (len < 1) return 0;
+
+	switch (data[0])
+	{
+		case LOG_ATTR_BOOL:
+			return len >= 2 ? 2 : 0;
+		case LOG_ATTR_ULONG:
+			return len >= 9 ? 9 : 0;
+		case LOG_ATTR_BYTESTR:
+		{
+			if (len < 5) return 0;
+			size_t size = get32(data + 1);
+			return size <= len - 5 ? 5 + size : 0;
+		}
+		case LOG_ATTR_MECHSET:
+		{
+			if (len < 5) return 0;
+			size_t count = get32(data + 1);
+			return count <= (len - 5) / 8 ? 5 + 8 * count : 0;
+		}
+		case LOG_ATTR_ATTRMAP:
+		{
+			if (len < 5) return 0;
+			size_t count = get32(data + 1);
+			size_t pos = 5;
+			for (size_t i = 0; i < count; i++)
+			{
+				if (len - pos < 8) return 0;
+				pos += 8;
+
+				size_t size = skip(data + pos, len - pos);
+				if (size == 0) return 0;
+				pos += size;
+			}
+			return pos;
+		}
+		default:
+			return 0;
+	}
+}
+
+OSAttribute* ObjectLog::decode(const unsigned char* data, size_t len)
+{
+	if (skip(data, len) == 0) return NULL;
+
+	switch (data[0])
+	{
+		case LOG_ATTR_BOOL:
+			return new OSAttribute(data[1] != 0);
+		case LOG_ATTR_ULONG:
+			return new OSAttribute((unsigned long) get64(data + 1));
+		case LOG_ATTR_BYTESTR:
+			return new OSAttribute(ByteString(data + 5, get32(data + 1)));
+		case LOG_ATTR_MECHSET:
+		{
+			std::set<CK_MECHANISM_TYPE> value;
+			size_t count = get32(data + 1);
+			for (size_t i = 0; i < count; i++)
+			{
+				value.insert(get64(data + 5 + 8 * i));
+			}
+			return new OSAttribute(value);
+		}
+		case LOG_ATTR_ATTRMAP:
+		{
+			std::map<CK_ATTRIBUTE_TYPE,OSAttribute> value;
+			size_t count = get32(data + 1);
+			size_t pos = 5;
+			for (size_t i = 0; i < count; i++)
+			{
+				CK_ATTRIBUTE_TYPE type = get64(data + pos);
+				pos += 8;
+
+				size_t size = skip(data + pos, len - pos);
+				OSAttribute* attr = decode(data + pos, size);
+				if (attr == NULL) return NULL;
+
+				value.insert(std::make_pair(type, *attr));
+				delete attr;
+				pos += size;
+			}
+			return new OSAttribute(value);
+		}
+		default:
+			return NULL;
+	}
+}
+
+/*****************************************************************************
+ The log
+ *****************************************************************************/
+
+// Constructor
+// Whether logs compact in a thread of their own
+bool ObjectLog::compactionThread = true;
+
+/*static*/ void ObjectLog::setCompactionThread(bool enabled)
+{
+	compactionThread = enabled;
+}
+
+ObjectLog::ObjectLog(const std::string& inPath, int inUmask, bool create)
+{
+	logMutex = MutexFactory::i()->getMutex();
+	path = inPath;
+	umask = inUmask;
+	fd = -1;
+	dev = 0;
+	ino = 0;
+	base = NULL;
+	mapped = 0;
+	end = 0;
+	garbage = 0;
+	nextId = 0;
+	nextSequence = 0;
+	valid = false;
+	compactThread = NULL;
+	compactCondition = new std::condition_variable_any();
+	compactRequested = false;
+	stopping = false;
+	ownerPid = getpid();
+
+	MutexLocker lock(logMutex);
+
+	if (create)
+	{
+		int newFd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH) & ~umask);
+		if (newFd == -1)
+		{
+			ERROR_MSG("Could not create the object log (%s): %s", strerror(errno), path.c_str());
+			return;
+		}
+
+		ByteString header(LOG_MAGIC, sizeof(LOG_MAGIC));
+		put32(header, LOG_VERSION);
+		put32(header, 0);
+		put64(header, 0);
+
+		bool written = writeAll(newFd, header.const_byte_str(), header.size(), 0) && fsync(newFd) == 0;
+		::close(newFd);
+
+		if (!written)
+		{
+			ERROR_MSG("Could not write the header of the object log %s", path.c_str());
+			unlink(path.c_str());
+			return;
+		}
+	}
+
+	valid = load();
+}
+
+// Destructor
+ObjectLog::~ObjectLog()
+{
+	checkFork();
+
+	{
+		MutexLocker lock(logMutex);
+
+		stopping = true;
+	}
+	compactCondition->notify_all();
+
+	if (compactThread != NULL)
+	{
+		compactThread->join();
+		delete compactThread;
+		compactThread = NULL;
+	}
+
+	close();
+
+	delete compactCondition;
+	MutexFactory::i()->recycleMutex(logMutex);
+}
+
+bool ObjectLog::isValid()
+{
+	checkFork();
+	MutexLocker lock(logMutex);
+
+	return valid;
+}
+
+bool ObjectLog::load()
+{
+	close();
+	objects.clear();
+	garbage = 0;
+
+	fd = open(path.c_str(), O_RDWR);
+	if (fd == -1)
+	{
+		ERROR_MSG("Could not open the object log (%s): %s", strerror(errno), path.c_str());
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size < LOG_HEADER_LEN || !map(st.st_size))
+	{
+		ERROR_MSG("The object log %s is too short", path.c_str());
+		close();
+		return false;
+	}
+
+	dev = st.st_dev;
+	ino = st.st_ino;
+
+	if (memcmp(base, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0 || get32(base + 8) != LOG_VERSION)
+	{
+		ERROR_MSG("%s is not an object log of a supported version", path.c_str());
+		close();
+		return false;
+	}
+
+	nextId = get64(base + 16);
+	end = LOG_HEADER_LEN;
+
+	return replay();
+}
+
+void ObjectLog::close()
+{
+	if (base != NULL) munmap(base, mapped);
+	if (fd != -1) ::close(fd);
+
+	base = NULL;
+	mapped = 0;
+	fd = -1;
+}
+
+bool ObjectLog::map(size_t size)
+{
+	if (size <= mapped) return true;
+
+	// Leave room to grow; the pages past the end of the file are never read
+	size_t capacity = ((size + size / 2) / LOG_MAP_CHUNK + 1) * LOG_MAP_CHUNK;
+
+	if (base != NULL) munmap(base, mapped);
+	base = NULL;
+	mapped = 0;
+
+	void* p = mmap(NULL, capacity, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+	{
+		ERROR_MSG("Could not map the object log (%s): %s", strerror(errno), path.c_str());
+		return false;
+	}
+
+	base = (unsigned char*) p;
+	mapped = capacity;
+
+	return true;
+}
+
+bool ObjectLog::replay()
+{
+	struct stat st;
+	if (fstat(fd, &st) != 0) return false;
+
+	size_t size = st.st_size;
+	if (size <= end) return true;
+	if (!map(size)) return false;
+
+	// Stop at a record that is incomplete or damaged; it is either being
+	// written or was cut short by a crash
+	while (size - end >= LOG_RECORD_HEADER_LEN)
+	{
+		size_t len = get32(base + end);
+		size_t offset = end + LOG_RECORD_HEADER_LEN;
+
+		if (len > size - offset) break;
+		if (crc32(base + offset, len) != get32(base + end + 4)) break;
+		if (!apply(offset, len))
+		{
+			WARNING_MSG("Malformed record at offset %zu of the object log %s", end, path.c_str());
+			break;
+		}
+
+		end = offset + len;
+	}
+
+	return true;
+}
+
+bool ObjectLog::apply(size_t offset, size_t len)
+{
+	const unsigned char* p = base + offset;
+	size_t recordLen = LOG_RECORD_HEADER_LEN + len;
+
+	if (len < LOG_PAYLOAD_HEADER_LEN) return false;
+
+	unsigned char op = p[0];
+	unsigned long long id = get64(p + 1);
+	std::map<unsigned long long, Entry>::iterator it = objects.find(id);
+
+	switch (op)
+	{
+		case LOG_OP_CREATE:
+		{
+			if (len != LOG_PAYLOAD_HEADER_LEN) return false;
+
+			Entry& entry = objects[id];
+			entry.attributes.clear();
+			entry.sequence = ++nextSequence;
+			if (id >= nextId) nextId = id + 1;
+
+			garbage += recordLen;
+			return true;
+		}
+		case LOG_OP_UPDATE:
+		{
+			if (len < LOG_PAYLOAD_HEADER_LEN + 4) return false;
+
+			// Check the whole record before it is applied
+			struct Change
+			{
+				CK_ATTRIBUTE_TYPE type;
+				bool isSet;
+				Value value;
+			};
+			std::vector<Change> changes(get32(p + LOG_PAYLOAD_HEADER_LEN));
+			size_t pos = LOG_PAYLOAD_HEADER_LEN + 4;
+
+			for (size_t i = 0; i < changes.size(); i++)
+			{
+				if (len - pos < LOG_CHANGE_HEADER_LEN) return false;
+
+				changes[i].type = get64(p + pos);
+				changes[i].isSet = p[pos + 8] != 0;
+				pos += LOG_CHANGE_HEADER_LEN;
+
+				changes[i].value.offset = offset + pos;
+				changes[i].value.len = 0;
+				if (changes[i].isSet)
+				{
+					changes[i].value.len = skip(p + pos, len - pos);
+					if (changes[i].value.len == 0) return false;
+					pos += changes[i].value.len;
+				}
+			}
+			if (pos != len) return false;
+
+			// Only the attribute values are live
+			garbage += recordLen;
+			if (it == objects.end()) return true;
+
+			for (size_t i = 0; i < changes.size(); i++)
+			{
+				std::map<CK_ATTRIBUTE_TYPE, Value>::iterator old = it->second.attributes.find(changes[i].type);
+				if (old != it->second.attributes.end())
+				{
+					garbage += LOG_CHANGE_HEADER_LEN + old->second.len;
+					it->second.attributes.erase(old);
+				}
+
+				if (changes[i].isSet)
+				{
+					it->second.attributes[changes[i].type] = changes[i].value;
+					garbage -= LOG_CHANGE_HEADER_LEN + changes[i].value.len;
+				}
+			}
+			it->second.sequence = ++nextSequence;
+
+			return true;
+		}
+		case LOG_OP_DELETE:
+		{
+			if (len != LOG_PAYLOAD_HEADER_LEN) return false;
+
+			garbage += recordLen;
+			if (it == objects.end()) return true;
+
+			for (std::map<CK_ATTRIBUTE_TYPE, Value>::iterator i = it->second.attributes.begin(); i != it->second.attributes.end(); ++i)
+			{
+				garbage += LOG_CHANGE_HEADER_LEN + i->second.len;
+			}
+			objects.erase(it);
+
+			return true;
+		}
+		default:
+			return false;
+	}
+}
+
+bool ObjectLog::lockForWrite()
+{
+	for (;;)
+	{
+		struct flock fl;
+		memset(&fl, 0, sizeof(fl));
+		fl.l_type = F_WRLCK;
+		fl.l_whence = SEEK_SET;
+
+		if (fcntl(fd, F_SETLKW, &fl) != 0)
+		{
+			if (errno == EINTR) continue;
+
+			ERROR_MSG("Could not lock the object log (%s): %s", strerror(errno), path.c_str());
+			return false;
+		}
+
+		// Follow a compaction by another process
+		struct stat st;
+		if (stat(path.c_str(), &st) != 0)
+		{
+			ERROR_MSG("The object log %s is gone", path.c_str());
+			unlockForWrite();
+			valid = false;
+			return false;
+		}
+		if (st.st_dev == dev && st.st_ino == ino) break;
+
+		unlockForWrite();
+		if (!load())
+		{
+			valid = false;
+			return false;
+		}
+	}
+
+	if (!replay())
+	{
+		unlockForWrite();
+		return false;
+	}
+
+	// Cut off a record that was cut short by a crash
+	struct stat st;
+	if (fstat(fd, &st) == 0 && (size_t) st.st_size > end)
+	{
+		WARNING_MSG("Discarding %zu bytes at the end of the object log %s", (size_t) st.st_size - end, path.c_str());
+
+		if (ftruncate(fd, end) != 0)
+		{
+			unlockForWrite();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void ObjectLog::unlockForWrite()
+{
+	struct flock fl;
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_UNLCK;
+	fl.l_whence = SEEK_SET;
+
+	fcntl(fd, F_SETLK, &fl);
+}
+
+bool ObjectLog::append(const ByteString& payload)
+{
+	ByteString record;
+	addRecord(record, payload);
+
+	size_t expected = end + record.size();
+
+	if (!writeAll(fd, record.const_byte_str(), record.size(), end))
+	{
+		ERROR_MSG("Could not write to the object log (%s): %s", strerror(errno), path.c_str());
+
+		if (ftruncate(fd, end) != 0)
+		{
+			valid = false;
+		}
+
+		return false;
+	}
+
+	// Get the record on disk as far as objectstore.durability asks; a
+	// record that may not be durable is taken back
+	if (!FileSync::i()->syncFile(fd))
+	{
+		ERROR_MSG("Could not flush the object log to disk: %s", path.c_str());
+
+		if (ftruncate(fd, end) != 0)
+		{
+			valid = false;
+		}
+
+		return false;
+	}
+
+	return replay() && end == expected;
+}
+
+bool ObjectLog::sync()
+{
+	checkFork();
+	MutexLocker lock(logMutex);
+
+	if (!valid) return false;
+
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+	{
+		valid = false;
+		return false;
+	}
+
+	// The file was replaced by a compaction
+	if (st.st_dev != dev || st.st_ino != ino)
+	{
+		valid = load();
+		return valid;
+	}
+
+	return replay();
+}
+
+bool ObjectLog::exists(unsigned long long id)
+{
+	checkFork();
+	MutexLocker lock(logMutex);
+
+	return objects.find(id) != objects.end();
+}
+
+void ObjectLog::getObjects(std::vector<unsigned long long>& ids)
+{
+	checkFork();
+	MutexLocker lock(logMutex);
+
+	ids.reserve(ids.size() + objects.size());
+	for (std::map<unsigned long long, Entry>::iterator it = objects.begin(); it != objects.end(); ++it)
+	{
+		ids.push_back(it->first);
+	}
+}
+
+unsigned long long ObjectLog::getSequence(unsigned long long id)
+{
+	checkFork();
+	MutexLocker lock(logMutex);
+
+	std::map<unsigned long long, Entry>::iterator it = objects.find(id);
+
+	return it == objects.end() ? 0 : it->second.sequence;
+}
+
+bool ObjectLog::attributeExists(unsigned long long id, CK_ATTRIBUTE_TYPE type)
+{
+	checkFork();
+	MutexLocker lock(logMutex);
+
+	std::map<unsigned long long, Entry>::iterator it = objects.find(id);
+
+	return it != objects.end() && it->second.attributes.find(type) != it->second.attributes.end();
+}
+
+OSAttribute* ObjectLog::getAttribute(unsigned long long id, CK_ATTRIBUTE_TYPE type)
+{
+	checkFork();
+	MutexLocker lock(logMutex);
+
+	std::map<unsigned long long, Entry>::iterator it = objects.find(id);
+	if (it == objects.end()) return NULL;
+
+	std::map<CK_ATTRIBUTE_TYPE, Value>::iterator attr = it->second.attributes.find(type);
+	if (attr == it->second.attributes.end()) return NULL;
+
+	return decode(base + attr->second.offset, attr->second.len);
+}
+
+CK_ATTRIBUTE_TYPE ObjectLog::nextAttributeType(unsigned long long id, CK_ATTRIBUTE_TYPE type)
+{
+	checkFork();
+	MutexLocker lock(logMutex);
+
+	std::map<unsigned long long, Entry>::iterator it = objects.find(id);
+	if (it == objects.end()) return CKA_CLASS;
+
+	std::map<CK_ATTRIBUTE_TYPE, Value>::iterator n = it->second.attributes.upper_bound(type);
+
+	// return type or CKA_CLASS (= 0)
+	return n == it->second.attributes.end() ? CKA_CLASS : n->first;
+}
+
+bool ObjectLog::createObject(unsigned long long& id)
+{
+	checkFork();
+	MutexLocker lock(logMutex);
+
+	if (!valid || !lockForWrite()) return false;
+
+	id = nextId;
+
+	ByteString payload;
+	payload += (unsigned char) LOG_OP_CREATE;
+	put64(payload, id);
+
+	bool rv = append(payload);
+
+	unlockForWrite();
+
+	return rv;
+}
+
+bool ObjectLog::update(unsigned long long id, const std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>& set, const std::set<CK_ATTRIBUTE_TYPE>& deleted)
+{
+	checkFork();
+	MutexLocker lock(logMutex);
+
+	if (!valid || !lockForWrite()) return false;
+
+	if (objects.find(id) == objects.end())
+	{
+		unlockForWrite();
+		return false;
+	}
+
+	ByteString payload;
+	payload += (unsigned char) LOG_OP_UPDATE;
+	put64(payload, id);
+	put32(payload, set.size() + deleted.size());
+
+	for (std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::const_iterator i = set.begin(); i != set.end(); ++i)
+	{
+		put64(payload, i->first);
+		payload += (unsigned char) 1;
+		encode(*i->second, payload);
+	}
+	for (std::set<CK_ATTRIBUTE_TYPE>::const_iterator i = deleted.begin(); i != deleted.end(); ++i)
+	{
+		put64(payload, *i);
+		payload += (unsigned char) 0;
+	}
+
+	bool rv = append(payload);
+
+	unlockForWrite();
+	checkGarbage();
+
+	return rv;
+}
+
+bool ObjectLog::deleteObject(unsigned long long id)
+{
+	checkFork();
+	MutexLocker lock(logMutex);
+
+	if (!valid || !lockForWrite()) return false;
+
+	if (objects.find(id) == objects.end())
+	{
+		unlockForWrite();
+		return false;
+	}
+
+	ByteString payload;
+	payload += (unsigned char) LOG_OP_DELETE;
+	put64(payload, id);
+
+	bool rv = append(payload);
+
+	unlockForWrite();
+	checkGarbage();
+
+	return rv;
+}
+
+bool ObjectLog::compact()
+{
+	checkFork();
+	MutexLocker lock(logMutex);
+
+	if (!valid || !lockForWrite()) return false;
+
+	bool rv = rewrite();
+
+	// Closing the old file has released the lock
+	if (!rv) unlockForWrite();
+
+	return rv;
+}
+
+bool ObjectLog::rewrite()
+{
+	std::string tmpPath = path + ".tmp";
+	int tmpFd = open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH) & ~umask);
+	if (tmpFd == -1)
+	{
+		ERROR_MSG("Could not create %s: %s", tmpPath.c_str(), strerror(errno));
+		return false;
+	}
+
+	// The next id is kept, so that ids of deleted objects are not reused
+	ByteString buffer(LOG_MAGIC, sizeof(LOG_MAGIC));
+	put32(buffer, LOG_VERSION);
+	put32(buffer, 0);
+	put64(buffer, nextId);
+
+	off_t written = 0;
+	bool ok = true;
+
+	for (std::map<unsigned long long, Entry>::iterator it = objects.begin(); ok && it != objects.end(); ++it)
+	{
+		ByteString payload;
+		payload += (unsigned char) LOG_OP_CREATE;
+		put64(payload, it->first);
+		addRecord(buffer, payload);
+
+		if (!it->second.attributes.empty())
+		{
+			payload.wipe();
+			payload += (unsigned char) LOG_OP_UPDATE;
+			put64(payload, it->first);
+			put32(payload, it->second.attributes.size());
+
+			for (std::map<CK_ATTRIBUTE_TYPE, Value>::iterator i = it->second.attributes.begin(); i != it->second.attributes.end(); ++i)
+			{
+				put64(payload, i->first);
+				payload += (unsigned char) 1;
+				payload += ByteString(base + i->second.offset, i->second.len);
+			}
+			addRecord(buffer, payload);
+			payload.wipe();
+		}
+
+		if (buffer.size() >= LOG_WRITE_BUFFER)
+		{
+			ok = writeAll(tmpFd, buffer.const_byte_str(), buffer.size(), written);
+			written += buffer.size();
+			buffer.wipe();
+		}
+	}
+
+	if (ok) ok = writeAll(tmpFd, buffer.const_byte_str(), buffer.size(), written);
+	buffer.wipe();
+
+	// The new file has to be on disk before it replaces the old one
+	if (ok) ok = fsync(tmpFd) == 0;
+	::close(tmpFd);
+
+	if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0)
+	{
+		ERROR_MSG("Could not compact the object log %s: %s", path.c_str(), strerror(errno));
+		unlink(tmpPath.c_str());
+		return false;
+	}
+
+	size_t sep = path.find_last_of(OS_PATHSEP);
+	std::string dirPath = sep == std::string::npos ? "." : path.substr(0, sep);
+	int dirFd = open(dirPath.c_str(), O_RDONLY);
+	if (dirFd != -1)
+	{
+		fsync(dirFd);
+		::close(dirFd);
+	}
+
+	size_t before = end;
+	valid = load();
+
+	DEBUG_MSG("Compacted the object log %s from %zu to %zu bytes", path.c_str(), before, end);
+
+	return valid;
+}
+
+void ObjectLog::checkGarbage()
+{
+	if (garbage < OBJECTLOG_COMPACT_MIN || garbage < end / 2) return;
+
+	// Without a thread of our own, do it now
+	if (!compactionThread)
+	{
+		if (valid && lockForWrite() && !rewrite())
+		{
+			unlockForWrite();
+		}
+
+		return;
+	}
+
+	compactRequested = true;
+
+	if (compactThread == NULL)
+	{
+		try
+		{
+			compactThread = new std::thread(&ObjectLog::compactor, this);
+		}
+		catch (const std::system_error& e)
+		{
+			WARNING_MSG("Could not start the compaction thread of %s: %s", path.c_str(), e.what());
+
+			compactRequested = false;
+
+			return;
+		}
+	}
+
+	compactCondition->notify_one();
+}
+
+void ObjectLog::compactor()
+{
+	std::unique_lock<Mutex> lock(*logMutex);
+
+	for (;;)
+	{
+		compactCondition->wait(lock, [this] { return compactRequested || stopping; });
+		if (stopping) break;
+
+		compactRequested = false;
+
+		if (!valid || !lockForWrite()) continue;
+
+		// Another process may have compacted in the meantime
+		if (garbage < OBJECTLOG_COMPACT_MIN || garbage < end / 2 || !rewrite())
+		{
+			unlockForWrite();
+		}
+	}
+}
+
+// Lets go of the compaction thread and its lock in a forked child
+void ObjectLog::checkFork()
+{
+	if (getpid() == ownerPid) return;
+
+	// The thread does not exist here, and it may have been holding the lock
+	// or waiting on the condition; destroying either could block, so both
+	// are leaked
+	ownerPid = getpid();
+	compactThread = NULL;
+	compactRequested = false;
+	logMutex = MutexFactory::i()->getMutex();
+	compactCondition = new std::condition_variable_any();
+}
+
+size_t ObjectLog::getSize()
+{
+	checkFork();
+	MutexLocker lock(logMutex);
+
+	return end;
+}
+
+size_t ObjectLog::getGarbage()
+{
+	checkFork();
+	MutexLocker lock(logMutex);
+
+	return garbage;
+}
+
+std::string ObjectLog::getPath()
+{
+	return path;
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ ObjectLog.h
+
+ The store of a token in a single file: an append-only log of records that
+ create objects, set or delete their attributes and delete them. The file
+ is memory-mapped and an index keeps, per object, the offset of the latest
+ value of every attribute, so an attribute is decoded straight from the
+ mapping. A change of one or more attributes is one record, written with a
+ single write and flushed to disk as objectstore.durability asks.
+
+ Every record carries a CRC; a record that was cut short by a crash ends
+ the log and is cut off by the next writer. Records that were superseded
+ are garbage; once they make up half of the file it is compacted by a
+ background thread into a new file that replaces the old one. When the
+ library may not create threads, the write that finds enough garbage
+ compacts the log itself. A forked child leaves the parent's thread and lock
+ alone and starts with its own.
+
+ Several processes can share the log. Writers hold an fcntl lock on the
+ file; everyone picks up the records of others in sync(), and reloads the
+ file when it was replaced by a compaction.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_OBJECTLOG_H
+#define _SOFTHSM_V2_OBJECTLOG_H
+
+#include "config.h"
+#include "ByteString.h"
+#include "OSAttribute.h"
+#include "cryptoki.h"
+#include "MutexFactory.h"
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+
+// The garbage that has to be present before the log is compacted
+#define OBJECTLOG_COMPACT_MIN	(256 * 1024)
+
+class ObjectLog
+{
+public:
+	// Opens the log at the given path; a new log is created if create is set
+	ObjectLog(const std::string& inPath, int inUmask, bool create);
+
+	// Destructor
+	virtual ~ObjectLog();
+
+	// Is the log usable?
+	bool isValid();
+
+	// Picks up the records written by other processes
+	bool sync();
+
+	// The objects in the log
+	bool exists(unsigned long long id);
+	void getObjects(std::vector<unsigned long long>& ids);
+
+	// A counter that changes whenever the object is changed
+	unsigned long long getSequence(unsigned long long id);
+
+	// Attribute access; getAttribute returns a new attribute or NULL
+	bool attributeExists(unsigned long long id, CK_ATTRIBUTE_TYPE type);
+	OSAttribute* getAttribute(unsigned long long id, CK_ATTRIBUTE_TYPE type);
+	CK_ATTRIBUTE_TYPE nextAttributeType(unsigned long long id, CK_ATTRIBUTE_TYPE type);
+
+	// Creates an object with a new id; ids start at 0 and are never reused
+	bool createObject(unsigned long long& id);
+
+	// Sets and deletes attributes of an object in one record
+	bool update(unsigned long long id, const std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>& set, const std::set<CK_ATTRIBUTE_TYPE>& deleted);
+
+	// Deletes an object
+	bool deleteObject(unsigned long long id);
+
+	// Rewrites the log with only the live records
+	bool compact();
+
+	// Sizes, in bytes
+	size_t getSize();
+	size_t getGarbage();
+
+	// The file of the log
+	std::string getPath();
+
+	// Attribute encoding
+	static void encode(const OSAttribute& attribute, ByteString& out);
+	static OSAttribute* decode(const unsigned char* data, size_t len);
+
+	// Whether logs compact in a thread of their own
+	static void setCompactionThread(bool enabled);
+
+private:
+	// The location of an attribute value in the file
+	struct Value
+	{
+		size_t offset;
+		size_t len;
+	};
+
+	struct Entry
+	{
+		std::map<CK_ATTRIBUTE_TYPE, Value> attributes;
+		unsigned long long sequence;
+	};
+
+	// Opens the file and reads it from the start; the mutex is held
+	bool load();
+
+	// Closes the file; the mutex is held
+	void close();
+
+	// Maps the file up to at least the given size; the mutex is held
+	bool map(size_t size);
+
+	// Applies the records after the end of the log; the mutex is held
+	bool replay();
+
+	// Applies one record; false if it is malformed
+	bool apply(size_t offset, size_t len);
+
+	// Locks the file for writing and brings the log up to date
+	bool lockForWrite();
+	void unlockForWrite();
+
+	// Appends a record and applies it; the file lock is held
+	bool append(const ByteString& payload);
+
+	// Writes the live records to a new file and switches to it; the
+	// mutex and the file lock are held
+	bool rewrite();
+
+	// Compacts, in the background if possible, if there is enough garbage;
+	// the mutex is held
+	void checkGarbage();
+
+	// The loop of the compaction thread
+	void compactor();
+
+	// Lets go of the compaction thread and its lock in a forked child
+	void checkFork();
+
+	// Skips an encoded attribute, returns its length or 0 if it is malformed
+	static size_t skip(const unsigned char* data, size_t len);
+
+	std::string path;
+	int umask;
+
+	// The open file and its identity
+	int fd;
+	dev_t dev;
+	ino_t ino;
+
+	// The mapping
+	unsigned char* base;
+	size_t mapped;
+
+	// The end of the last valid record
+	size_t end;
+
+	// Bytes of records that have been superseded
+	size_t garbage;
+
+	// The index of the live objects
+	std::map<unsigned long long, Entry> objects;
+	unsigned long long nextId;
+	unsigned long long nextSequence;
+
+	bool valid;
+
+	Mutex* logMutex;
+
+	// Whether logs compact in a thread of their own
+	static bool compactionThread;
+
+	// Background compaction
+	std::thread* compactThread;
+	std::condition_variable_any* compactCondition;
+	bool compactRequested;
+	bool stopping;
+	pid_t ownerPid;
+};
+
+#endif // !_SOFTHSM_V2_OBJECTLOG_H
@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruCertObject.cpp
+
+ A certificate held by the Mizar chip, presented as a read-only token object
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "MizaruCertObject.h"
+#include "MizaruDevicePool.h"
+#include "mizar_api.h"
+#include "mizar_errcode.h"
+#include "vendor_defines.h"
+#include <cstdio>
+#include <cstring>
+#include <openssl/x509.h>
+
+// The largest PKI certificate the chip holds
+#define MIZARU_CERT_MAX_LEN 2000
+
+// DER encodes an OpenSSL object into a ByteString
+template <typename T>
+static ByteString toDER(const T* object, int (*i2d)(const T*, unsigned char**))
+{
+	ByteString der;
+	int len = i2d(object, NULL);
+	if (len <= 0) return der;
+
+	der.resize(len);
+	unsigned char* p = &der[0];
+	i2d(object, &p);
+
+	return der;
+}
+
+// Constructor
+MizaruCertObject::MizaruCertObject(unsigned long inCertIndex, unsigned long inKeyIndex, unsigned long inCertType)
+{
+	certIndex = inCertIndex;
+	keyIndex = inKeyIndex;
+	certType = inCertType;
+	loaded = false;
+	objectMutex = MutexFactory::i()->getMutex();
+	valid = (objectMutex != NULL);
+	revision = nextRevision();
+
+	char label[32];
+	snprintf(label, sizeof(label), "Mizar certificate %lu", certIndex);
+
+	// The certificate is paired with its private key by the key index
+	ByteString id;
+	if (keyIndex != MIZARU_CERT_NO_KEY)
+	{
+		id.resize(1);
+		id[0] = (unsigned char) keyIndex;
+		store(CKA_MIZAR_KEY_INDEX, OSAttribute(keyIndex));
+	}
+
+	store(CKA_CLASS, OSAttribute((unsigned long) CKO_CERTIFICATE));
+	store(CKA_TOKEN, OSAttribute(true));
+	store(CKA_PRIVATE, OSAttribute(false));
+	store(CKA_MODIFIABLE, OSAttribute(false));
+	store(CKA_COPYABLE, OSAttribute(false));
+	store(CKA_DESTROYABLE, OSAttribute(false));
+	store(CKA_LABEL, OSAttribute(ByteString((const unsigned char*) label, strlen(label))));
+	store(CKA_CERTIFICATE_TYPE, OSAttribute((unsigned long) CKC_X_509));
+	store(CKA_TRUSTED, OSAttribute(false));
+	store(CKA_CERTIFICATE_CATEGORY, OSAttribute((unsigned long) 0));
+	store(CKA_CHECK_VALUE, OSAttribute(ByteString("")));
+	store(CKA_START_DATE, OSAttribute(ByteString("")));
+	store(CKA_END_DATE, OSAttribute(ByteString("")));
+	store(CKA_PUBLIC_KEY_INFO, OSAttribute(ByteString("")));
+	store(CKA_ID, OSAttribute(id));
+	store(CKA_URL, OSAttribute(ByteString("")));
+	store(CKA_HASH_OF_SUBJECT_PUBLIC_KEY, OSAttribute(ByteString("")));
+	store(CKA_HASH_OF_ISSUER_PUBLIC_KEY, OSAttribute(ByteString("")));
+	store(CKA_JAVA_MIDP_SECURITY_DOMAIN, OSAttribute((unsigned long) 0));
+	store(CKA_NAME_HASH_ALGORITHM, OSAttribute((unsigned long) CKM_SHA_1));
+
+	// Filled in by load()
+	store(CKA_VALUE, OSAttribute(ByteString("")));
+	store(CKA_SUBJECT, OSAttribute(ByteString("")));
+	store(CKA_ISSUER, OSAttribute(ByteString("")));
+	store(CKA_SERIAL_NUMBER, OSAttribute(ByteString("")));
+}
+
+// Destructor
+MizaruCertObject::~MizaruCertObject()
+{
+	for (std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator it = attributes.begin(); it != attributes.end(); ++it)
+	{
+		delete it->second;
+	}
+
+	MutexFactory::i()->recycleMutex(objectMutex);
+}
+
+// Replace an attribute; the object lock is held, or the object is being constructed
+void MizaruCertObject::store(CK_ATTRIBUTE_TYPE type, const OSAttribute& attribute)
+{
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator it = attributes.find(type);
+	if (it != attributes.end())
+	{
+		delete it->second;
+		it->second = new OSAttribute(attribute);
+	}
+	else
+	{
+		attributes[type] = new OSAttribute(attribute);
+	}
+}
+
+bool MizaruCertObject::isLazy(CK_ATTRIBUTE_TYPE type)
+{
+	return type == CKA_VALUE || type == CKA_SUBJECT || type == CKA_ISSUER || type == CKA_SERIAL_NUMBER;
+}
+
+bool MizaruCertObject::load()
+{
+	if (loaded) return true;
+
+	ByteString cert;
+	mizar_uint32 chipKeyIndex = 0;
+	mizar_uint32 certLen = MIZARU_CERT_MAX_LEN;
+	cert.resize(MIZARU_CERT_MAX_LEN);
+
+	mizar_uint32 rv = MizaruDevicePool::i()->run([&]
+	{
+		return MizarGetCert(certIndex, certType, &chipKeyIndex, &certLen, &cert[0]);
+	});
+	if (rv != SUCCESS)
+	{
+		ERROR_MSG("Could not read certificate %lu from the Mizar chip (0x%08X)", certIndex, rv);
+		return false;
+	}
+	cert.resize(certLen);
+
+	store(CKA_VALUE, OSAttribute(cert));
+
+	const unsigned char* p = cert.const_byte_str();
+	X509* x509 = d2i_X509(NULL, &p, cert.size());
+	if (x509 == NULL)
+	{
+		WARNING_MSG("Certificate %lu on the Mizar chip is not a valid X.509 certificate", certIndex);
+	}
+	else
+	{
+		store(CKA_SUBJECT, OSAttribute(toDER(X509_get_subject_name(x509), i2d_X509_NAME)));
+		store(CKA_ISSUER, OSAttribute(toDER(X509_get_issuer_name(x509), i2d_X509_NAME)));
+		store(CKA_SERIAL_NUMBER, OSAttribute(toDER(X509_get_serialNumber(x509), i2d_ASN1_INTEGER)));
+		X509_free(x509);
+	}
+
+	loaded = true;
+
+	return true;
+}
+
+// Check if the specified attribute exists
+bool MizaruCertObject::attributeExists(CK_ATTRIBUTE_TYPE type)
+{
+	MutexLocker lock(objectMutex);
+
+	return valid && attributes.find(type) != attributes.end();
+}
+
+// Retrieve the specified attribute
+OSAttribute MizaruCertObject::getAttribute(CK_ATTRIBUTE_TYPE type)
+{
+	MutexLocker lock(objectMutex);
+
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator it = attributes.find(type);
+	if (it == attributes.end())
+	{
+		ERROR_MSG("The attribute does not exist: 0x%08X", type);
+		return OSAttribute((unsigned long)0);
+	}
+
+	// load() replaces the entry
+	if (isLazy(type) && load())
+	{
+		it = attributes.find(type);
+	}
+
+	return *it->second;
+}
+
+bool MizaruCertObject::getBooleanValue(CK_ATTRIBUTE_TYPE type, bool val)
+{
+	MutexLocker lock(objectMutex);
+
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator it = attributes.find(type);
+	if (it == attributes.end())
+	{
+		ERROR_MSG("The attribute does not exist: 0x%08X", type);
+		return val;
+	}
+
+	if (it->second->isBooleanAttribute())
+	{
+		return it->second->getBooleanValue();
+	}
+	else
+	{
+		ERROR_MSG("The attribute is not a boolean: 0x%08X", type);
+		return val;
+	}
+}
+
+unsigned long MizaruCertObject::getUnsignedLongValue(CK_ATTRIBUTE_TYPE type, unsigned long val)
+{
+	MutexLocker lock(objectMutex);
+
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator it = attributes.find(type);
+	if (it == attributes.end())
+	{
+		ERROR_MSG("The attribute does not exist: 0x%08X", type);
+		return val;
+	}
+
+	if (it->second->isUnsignedLongAttribute())
+	{
+		return it->second->getUnsignedLongValue();
+	}
+	else
+	{
+		ERROR_MSG("The attribute is not an unsigned long: 0x%08X", type);
+		return val;
+	}
+}
+
+ByteString MizaruCertObject::getByteStringValue(CK_ATTRIBUTE_TYPE type)
+{
+	OSAttribute attr = getAttribute(type);
+
+	if (attr.isByteStringAttribute())
+	{
+		return attr.getByteStringValue();
+	}
+	else
+	{
+		ERROR_MSG("The attribute is not a byte string: 0x%08X", type);
+		return ByteString();
+	}
+}
+
+// Retrieve the next attribute type
+CK_ATTRIBUTE_TYPE MizaruCertObject::nextAttributeType(CK_ATTRIBUTE_TYPE type)
+{
+	MutexLocker lock(objectMutex);
+
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator n = attributes.upper_bound(type);
+
+	// return type or CKA_CLASS (= 0)
+	if (n == attributes.end())
+	{
+		return CKA_CLASS;
+	}
+	else
+	{
+		return n->first;
+	}
+}
+
+bool MizaruCertObject::setAttribute(CK_ATTRIBUTE_TYPE type, const OSAttribute& /*attribute*/)
+{
+	ERROR_MSG("Cannot set attribute 0x%08X of a certificate on the Mizar chip", type);
+
+	return false;
+}
+
+bool MizaruCertObject::deleteAttribute(CK_ATTRIBUTE_TYPE type)
+{
+	ERROR_MSG("Cannot delete attribute 0x%08X of a certificate on the Mizar chip", type);
+
+	return false;
+}
+
+// The validity state of the object
+bool MizaruCertObject::isValid()
+{
+	MutexLocker lock(objectMutex);
+
+	return valid;
+}
+
+// Retrieve the revision of the object
+unsigned long MizaruCertObject::getRevision()
+{
+	return revision;
+}
+
+bool MizaruCertObject::startTransaction(Access access)
+{
+	return access == ReadOnly;
+}
+
+bool MizaruCertObject::commitTransaction()
+{
+	return true;
+}
+
+bool MizaruCertObject::abortTransaction()
+{
+	return true;
+}
+
+bool MizaruCertObject::destroyObject()
+{
+	ERROR_MSG("Certificate %lu can only be deleted on the Mizar chip", certIndex);
+
+	return false;
+}
+
+bool MizaruCertObject::isEntry(unsigned long inKeyIndex, unsigned long inCertType)
+{
+	return keyIndex == inKeyIndex && certType == inCertType;
+}
+
+bool MizaruCertObject::isLoaded()
+{
+	MutexLocker lock(objectMutex);
+
+	return loaded;
+}
+
+void MizaruCertObject::invalidate()
+{
+	MutexLocker lock(objectMutex);
+
+	valid = false;
+}
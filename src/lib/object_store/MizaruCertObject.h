@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruCertObject.h
+
+ A certificate held by the Mizar chip, presented as a read-only token
+ object. The attributes that follow from the certificate list are known up
+ front; the certificate itself is read from the chip the first time
+ CKA_VALUE, CKA_SUBJECT, CKA_ISSUER or CKA_SERIAL_NUMBER is asked for, and
+ is kept from then on.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_MIZARUCERTOBJECT_H
+#define _SOFTHSM_V2_MIZARUCERTOBJECT_H
+
+#include "config.h"
+#include "ByteString.h"
+#include "OSAttribute.h"
+#include "OSObject.h"
+#include "MutexFactory.h"
+#include "cryptoki.h"
+#include <map>
+
+// The key index of a certificate without a key on the chip
+#define MIZARU_CERT_NO_KEY 0xFF
+
+class MizaruCertObject : public OSObject
+{
+public:
+	// Constructor
+	MizaruCertObject(unsigned long inCertIndex, unsigned long inKeyIndex, unsigned long inCertType);
+
+	// Destructor
+	virtual ~MizaruCertObject();
+
+	// Check if the specified attribute exists
+	virtual bool attributeExists(CK_ATTRIBUTE_TYPE type);
+
+	// Retrieve the specified attribute
+	virtual OSAttribute getAttribute(CK_ATTRIBUTE_TYPE type);
+	virtual bool getBooleanValue(CK_ATTRIBUTE_TYPE type, bool val);
+	virtual unsigned long getUnsignedLongValue(CK_ATTRIBUTE_TYPE type, unsigned long val);
+	virtual ByteString getByteStringValue(CK_ATTRIBUTE_TYPE type);
+
+	// Retrieve the next attribute type
+	virtual CK_ATTRIBUTE_TYPE nextAttributeType(CK_ATTRIBUTE_TYPE type);
+
+	// The object is read-only; these always fail
+	virtual bool setAttribute(CK_ATTRIBUTE_TYPE type, const OSAttribute& attribute);
+	virtual bool deleteAttribute(CK_ATTRIBUTE_TYPE type);
+
+	// The validity state of the object
+	virtual bool isValid();
+
+	// Retrieve the revision of the object
+	virtual unsigned long getRevision();
+
+	// A read-only transaction is allowed, there is nothing to commit
+	virtual bool startTransaction(Access access);
+	virtual bool commitTransaction();
+	virtual bool abortTransaction();
+
+	// The certificate can only be removed on the chip
+	virtual bool destroyObject();
+
+	// Does the object stand for the given entry of the certificate list?
+	bool isEntry(unsigned long inKeyIndex, unsigned long inCertType);
+
+	// Has the certificate been read from the chip?
+	bool isLoaded();
+
+	// Called by the certificate store when the certificate is gone from the chip
+	void invalidate();
+
+private:
+	// Is the attribute taken from the certificate itself?
+	static bool isLazy(CK_ATTRIBUTE_TYPE type);
+
+	// Replace an attribute
+	void store(CK_ATTRIBUTE_TYPE type, const OSAttribute& attribute);
+
+	// Reads the certificate from the chip if that has not been done yet;
+	// the object lock is held
+	bool load();
+
+	// The object's attributes
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*> attributes;
+
+	// The certificate list entry
+	unsigned long certIndex;
+	unsigned long keyIndex;
+	unsigned long certType;
+
+	// The certificate has been read
+	bool loaded;
+
+	// The object's validity state
+	bool valid;
+
+	// The revision of the object's attributes
+	unsigned long revision;
+
+	// Mutex object for thread-safeness
+	Mutex* objectMutex;
+};
+
+#endif // !_SOFTHSM_V2_MIZARUCERTOBJECT_H
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruCertStore.cpp
+
+ The certificates held by the Mizar chip, as seen by one token
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "MizaruCertStore.h"
+#include "MizaruDevicePool.h"
+#include "mizar_api.h"
+#include "mizar_errcode.h"
+
+// The first card verifiable certificate type
+#define MIZARU_CERT_TYPE_CAR 3
+
+// Constructor
+MizaruCertStore::MizaruCertStore()
+{
+	storeMutex = MutexFactory::i()->getMutex();
+}
+
+// Destructor
+MizaruCertStore::~MizaruCertStore()
+{
+	for (std::set<MizaruCertObject*>::iterator it = allObjects.begin(); it != allObjects.end(); ++it)
+	{
+		delete *it;
+	}
+
+	MutexFactory::i()->recycleMutex(storeMutex);
+}
+
+// Insert the certificates that are on the chip into the given set
+void MizaruCertStore::getObjects(std::set<OSObject*> &inObjects)
+{
+	refresh();
+
+	MutexLocker lock(storeMutex);
+
+	for (std::map<unsigned long, MizaruCertObject*>::iterator it = objects.begin(); it != objects.end(); ++it)
+	{
+		inObjects.insert(it->second);
+	}
+}
+
+// Read the certificate list of the chip
+bool MizaruCertStore::refresh()
+{
+	mizar_uint8 list[MAX_CERT_NUM * 3];
+	mizar_uint32 listLen = sizeof(list);
+
+	mizar_uint32 rv = MizaruDevicePool::i()->run([&]
+	{
+		return MizarGetCertList(&listLen, list);
+	});
+	if (rv != SUCCESS)
+	{
+		DEBUG_MSG("Could not read the certificate list of the Mizar chip (0x%08X)", rv);
+		return false;
+	}
+
+	MutexLocker lock(storeMutex);
+
+	std::map<unsigned long, MizaruCertObject*> current;
+
+	for (mizar_uint32 i = 0; i + 3 <= listLen; i += 3)
+	{
+		unsigned long certIndex = list[i];
+		unsigned long keyIndex = list[i + 1];
+		unsigned long certType = list[i + 2];
+
+		if (certType >= MIZARU_CERT_TYPE_CAR) continue;
+
+		// Keep the object, and what has been read of it, while the entry is unchanged
+		std::map<unsigned long, MizaruCertObject*>::iterator it = objects.find(certIndex);
+		if (it != objects.end() && it->second->isEntry(keyIndex, certType))
+		{
+			current[certIndex] = it->second;
+			objects.erase(it);
+			continue;
+		}
+
+		MizaruCertObject* object = new MizaruCertObject(certIndex, keyIndex, certType);
+		allObjects.insert(object);
+		current[certIndex] = object;
+	}
+
+	// The remaining objects are gone from the chip or were replaced
+	for (std::map<unsigned long, MizaruCertObject*>::iterator it = objects.begin(); it != objects.end(); ++it)
+	{
+		it->second->invalidate();
+	}
+
+	objects.swap(current);
+
+	return true;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruCertStore.h
+
+ The certificates held by the Mizar chip, as seen by one token. The
+ certificate list of the chip is read whenever the token objects are
+ enumerated; it only carries the index, key index and type of every
+ certificate, so this is one short command. An object is created for every
+ new entry and invalidated when its entry goes away. Objects are kept until
+ the store is destroyed, so that handles to them stay safe to look at.
+
+ Only PKI certificates are X.509 certificates; the card verifiable (CAR)
+ certificates are not shown.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_MIZARUCERTSTORE_H
+#define _SOFTHSM_V2_MIZARUCERTSTORE_H
+
+#include "config.h"
+#include "MizaruCertObject.h"
+#include "MutexFactory.h"
+#include <map>
+#include <set>
+
+class MizaruCertStore
+{
+public:
+	// Constructor
+	MizaruCertStore();
+
+	// Destructor
+	virtual ~MizaruCertStore();
+
+	// Insert the certificates that are on the chip into the given set
+	void getObjects(std::set<OSObject*> &inObjects);
+
+	// Read the certificate list of the chip; returns false if the chip
+	// could not be asked, in which case the objects are left as they are
+	bool refresh();
+
+private:
+	// The objects of the certificates on the chip, by certificate index
+	std::map<unsigned long, MizaruCertObject*> objects;
+
+	// All objects ever created
+	std::set<MizaruCertObject*> allObjects;
+
+	Mutex* storeMutex;
+};
+
+#endif // !_SOFTHSM_V2_MIZARUCERTSTORE_H
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ BodyCache.cpp
+
+ Keeps track of the memory used by the attribute bodies of lazily loaded
+ object files and drops the least recently used ones over the budget.
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "BodyCache.h"
+#include "ObjectFile.h"
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// Initialise the one-and-only instance
+std::unique_ptr<BodyCache> BodyCache::instance(nullptr);
+
+// The clock for tick()
+std::atomic<unsigned long> BodyCache::clock(0);
+
+// Return the one-and-only instance
+BodyCache* BodyCache::i()
+{
+	if (!instance.get())
+	{
+		instance.reset(new BodyCache());
+	}
+
+	return instance.get();
+}
+
+// This will destroy the one-and-only instance.
+void BodyCache::reset()
+{
+	instance.reset();
+}
+
+// Constructor
+BodyCache::BodyCache()
+{
+	cacheMutex = MutexFactory::i()->getMutex();
+	total = 0;
+	budget = DEFAULT_OBJECTSTORE_LAZY_BUDGET * 1024;
+}
+
+// Destructor
+BodyCache::~BodyCache()
+{
+	MutexFactory::i()->recycleMutex(cacheMutex);
+}
+
+// The time of a use of a body
+/*static*/ unsigned long BodyCache::tick()
+{
+	return ++clock;
+}
+
+// Set the budget
+void BodyCache::setBudget(size_t bytes)
+{
+	MutexLocker lock(cacheMutex);
+
+	budget = bytes;
+
+	evict(NULL);
+}
+
+size_t BodyCache::getBudget()
+{
+	MutexLocker lock(cacheMutex);
+
+	return budget;
+}
+
+// An object file has loaded its body
+void BodyCache::loaded(ObjectFile* object, size_t size)
+{
+	MutexLocker lock(cacheMutex);
+
+	std::map<ObjectFile*, size_t>::iterator i = bodies.find(object);
+
+	if (i != bodies.end())
+	{
+		total -= i->second;
+	}
+
+	bodies[object] = size;
+	total += size;
+
+	evict(object);
+}
+
+// An object file no longer has its body
+void BodyCache::released(ObjectFile* object)
+{
+	MutexLocker lock(cacheMutex);
+
+	std::map<ObjectFile*, size_t>::iterator i = bodies.find(object);
+
+	if (i != bodies.end())
+	{
+		total -= i->second;
+		bodies.erase(i);
+	}
+}
+
+// The number of bytes that are loaded
+size_t BodyCache::getSize()
+{
+	MutexLocker lock(cacheMutex);
+
+	return total;
+}
+
+// The number of bodies that are loaded
+size_t BodyCache::getCount()
+{
+	MutexLocker lock(cacheMutex);
+
+	return bodies.size();
+}
+
+// Drop bodies until they fit in the budget. The mutex of an object file
+// is taken with the lock held, so object files never call the cache with
+// their own mutex held.
+void BodyCache::evict(ObjectFile* keep)
+{
+	if ((budget == 0) || (total <= budget))
+	{
+		return;
+	}
+
+	std::vector<std::pair<unsigned long, ObjectFile*> > byUse;
+
+	for (std::map<ObjectFile*, size_t>::iterator i = bodies.begin(); i != bodies.end(); i++)
+	{
+		if (i->first != keep)
+		{
+			byUse.push_back(std::make_pair(i->first->lastUse.load(), i->first));
+		}
+	}
+
+	std::sort(byUse.begin(), byUse.end());
+
+	size_t dropped = 0;
+
+	for (size_t n = 0; (n < byUse.size()) && (total > budget); n++)
+	{
+		// Bodies of objects in a transaction stay
+		if (!byUse[n].second->evictBody())
+		{
+			continue;
+		}
+
+		std::map<ObjectFile*, size_t>::iterator i = bodies.find(byUse[n].second);
+
+		total -= i->second;
+		bodies.erase(i);
+
+		dropped++;
+	}
+
+	DEBUG_MSG("Dropped %zu attribute bodies, %zu bytes remain loaded", dropped, total);
+}
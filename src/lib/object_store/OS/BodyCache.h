@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ BodyCache.h
+
+ Keeps track of the memory used by the attribute bodies of object files that
+ are loaded lazily. When the bodies use more than the budget, the ones that
+ were used least recently are dropped; they are read again when needed.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_BODYCACHE_H
+#define _SOFTHSM_V2_BODYCACHE_H
+
+#include "config.h"
+#include "MutexFactory.h"
+#include <atomic>
+#include <map>
+#include <memory>
+
+// The default budget for attribute bodies in kilobytes; 0 means no limit
+#define DEFAULT_OBJECTSTORE_LAZY_BUDGET 0
+
+class ObjectFile;
+
+class BodyCache
+{
+public:
+	// Return the one-and-only instance
+	static BodyCache* i();
+
+	// This will destroy the one-and-only instance; the next one takes its
+	// mutex from the mutex factory of that initialisation. No object file
+	// may have a body loaded.
+	static void reset();
+
+	// Set the budget in bytes; 0 means no limit
+	void setBudget(size_t bytes);
+	size_t getBudget();
+
+	// An object file has loaded its body of the given size. Bodies of other
+	// object files are dropped to stay within the budget. Must not be
+	// called with the mutex of an object file held.
+	void loaded(ObjectFile* object, size_t size);
+
+	// An object file no longer has its body or is destroyed
+	void released(ObjectFile* object);
+
+	// The number of bytes and bodies that are loaded
+	size_t getSize();
+	size_t getCount();
+
+	// The time of a use of a body, for finding the least recently used ones
+	static unsigned long tick();
+
+	// Destructor
+	virtual ~BodyCache();
+
+private:
+	// Constructor
+	BodyCache();
+
+	// Drop bodies until they fit in the budget; called with the lock held
+	void evict(ObjectFile* keep);
+
+	// The one-and-only instance
+	static std::unique_ptr<BodyCache> instance;
+
+	// The clock for tick()
+	static std::atomic<unsigned long> clock;
+
+	Mutex* cacheMutex;
+
+	// The loaded bodies and their sizes
+	std::map<ObjectFile*, size_t> bodies;
+	size_t total;
+	size_t budget;
+};
+
+#endif // !_SOFTHSM_V2_BODYCACHE_H
@@ -32,6 +32,7 @@
 
 #include "config.h"
 #include "File.h"
+#include "FileSync.h"
 #include "log.h"
 #include <string>
 #include <stdio.h>
@@ -657,6 +658,14 @@ bool File::seek(long offset /* = -1 */)
 	}
 }
 
+// Return the current position in the file
+long File::tell()
+{
+	if (!valid) return -1;
+
+	return ftell(stream);
+}
+
 // Lock the file
 bool File::lock(bool block /* = true */)
 {
@@ -766,3 +775,36 @@ bool File::flush()
 	return valid && !fflush(stream);
 }
 
+
+// Flush the buffered stream and have the file written to disk
+bool File::sync()
+{
+	if (!flush()) return false;
+
+#ifndef _WIN32
+	return FileSync::i()->syncFile(fileno(stream));
+#else
+	return FileSync::i()->syncFile(_fileno(stream));
+#endif
+}
+
+// Check if the file is still the one at its path
+bool File::isCurrent()
+{
+	if (!valid) return false;
+
+#ifndef _WIN32
+	struct stat opened, atPath;
+
+	if ((fstat(fileno(stream), &opened) != 0) ||
+	    (stat(path.c_str(), &atPath) != 0))
+	{
+		return false;
+	}
+
+	return (opened.st_dev == atPath.st_dev) && (opened.st_ino == atPath.st_ino);
+#else
+	// Files that are open cannot be replaced on Windows
+	return true;
+#endif
+}
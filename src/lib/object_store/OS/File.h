@@ -108,6 +108,9 @@ public:
 	// argument is specified this operation seeks to the end of the file
 	bool seek(long offset = -1);
 
+	// Return the current position in the file, or -1 on error
+	long tell();
+
 	// Lock the file
 	bool lock(bool block = true);
 
@@ -117,6 +120,13 @@ public:
 	// Flush the buffered stream to background storage
 	bool flush();
 
+	// Flush the buffered stream and have the file written to disk
+	bool sync();
+
+	// Check if the file is still the one at its path; it is not when it
+	// was deleted or replaced after it was opened
+	bool isCurrent();
+
 private:
 	// The file path
 	std::string path;
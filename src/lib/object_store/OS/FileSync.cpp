@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ FileSync.cpp
+
+ Makes writes to object files durable, sharing the syncs of sessions that
+ write at the same time.
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "FileSync.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+
+// Initialise the one-and-only instance
+std::unique_ptr<FileSync> FileSync::instance(nullptr);
+
+// Return the one-and-only instance
+FileSync* FileSync::i()
+{
+	if (!instance.get())
+	{
+		instance.reset(new FileSync());
+	}
+
+	return instance.get();
+}
+
+// This will destroy the one-and-only instance.
+void FileSync::reset()
+{
+	instance.reset();
+}
+
+// Constructor
+FileSync::FileSync()
+{
+	syncMutex = MutexFactory::i()->getMutex();
+	durability = DURABILITY_GROUP;
+	syncing = false;
+	rounds = 0;
+}
+
+// Destructor
+FileSync::~FileSync()
+{
+	MutexFactory::i()->recycleMutex(syncMutex);
+}
+
+// Set the durability level from its name in the configuration
+bool FileSync::setDurability(const std::string& level)
+{
+	if (level == "none")
+	{
+		setDurability(DURABILITY_NONE);
+	}
+	else if (level == "group")
+	{
+		setDurability(DURABILITY_GROUP);
+	}
+	else if (level == "full")
+	{
+		setDurability(DURABILITY_FULL);
+	}
+	else
+	{
+		ERROR_MSG("Unknown value (%s) for objectstore.durability in configuration", level.c_str());
+
+		return false;
+	}
+
+	return true;
+}
+
+void FileSync::setDurability(Durability level)
+{
+	MutexLocker lock(syncMutex);
+
+	durability = level;
+}
+
+FileSync::Durability FileSync::getDurability()
+{
+	MutexLocker lock(syncMutex);
+
+	return durability;
+}
+
+// Flush the content of the open file to disk
+bool FileSync::syncFile(int fd)
+{
+	return submit(fd, "");
+}
+
+// Flush the entries of the directory to disk
+bool FileSync::syncDirectory(const std::string& path)
+{
+	return submit(-1, path.empty() ? "." : path);
+}
+
+// The number of rounds
+unsigned long FileSync::getRounds()
+{
+	MutexLocker lock(syncMutex);
+
+	return rounds;
+}
+
+// Wait until the file or the directory has been flushed
+bool FileSync::submit(int fd, const std::string& directory)
+{
+	std::set<int> files;
+	std::set<std::string> directories;
+
+	if (fd != -1) files.insert(fd);
+	if (!directory.empty()) directories.insert(directory);
+
+	std::unique_lock<Mutex> lock(*syncMutex);
+
+	if (durability == DURABILITY_NONE)
+	{
+		return true;
+	}
+
+	if (durability == DURABILITY_FULL)
+	{
+		rounds++;
+		lock.unlock();
+
+		return flush(files, directories);
+	}
+
+	// Join the batch of the next round
+	if (!pending)
+	{
+		pending = std::make_shared<Batch>();
+	}
+
+	std::shared_ptr<Batch> batch = pending;
+
+	batch->files.insert(files.begin(), files.end());
+	batch->directories.insert(directories.begin(), directories.end());
+
+	while (!batch->done)
+	{
+		if (syncing)
+		{
+			syncDone.wait(lock);
+
+			continue;
+		}
+
+		// No round is running, so this batch is still the pending one;
+		// flush it for everyone in it and let the next one fill up
+		pending.reset();
+		syncing = true;
+		rounds++;
+
+		lock.unlock();
+		bool ok = flush(batch->files, batch->directories);
+		lock.lock();
+
+		batch->ok = ok;
+		batch->done = true;
+		syncing = false;
+
+		syncDone.notify_all();
+	}
+
+	return batch->ok;
+}
+
+// Flush a set of files and directories
+/*static*/ bool FileSync::flush(const std::set<int>& files, const std::set<std::string>& directories)
+{
+	bool ok = true;
+
+	for (std::set<int>::const_iterator i = files.begin(); i != files.end(); i++)
+	{
+#ifndef _WIN32
+		if (fsync(*i) != 0)
+#else
+		if (_commit(*i) != 0)
+#endif
+		{
+			ERROR_MSG("Could not flush a file to disk: %s", strerror(errno));
+
+			ok = false;
+		}
+	}
+
+#ifndef _WIN32
+	for (std::set<std::string>::const_iterator i = directories.begin(); i != directories.end(); i++)
+	{
+		int dirFd = open(i->c_str(), O_RDONLY);
+
+		if ((dirFd == -1) || (fsync(dirFd) != 0))
+		{
+			ERROR_MSG("Could not flush the directory %s to disk: %s", i->c_str(), strerror(errno));
+
+			ok = false;
+		}
+
+		if (dirFd != -1)
+		{
+			close(dirFd);
+		}
+	}
+#else
+	// Directory entries cannot be flushed on Windows
+	(void) directories;
+#endif
+
+	return ok;
+}
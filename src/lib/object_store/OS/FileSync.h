@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ FileSync.h
+
+ Makes writes to object files durable. Sessions that need a file or a
+ directory flushed to disk at the same time are served by one sync: the
+ first one to arrive syncs for all that are waiting, and the ones that
+ arrive meanwhile are served by the next round (group commit).
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_FILESYNC_H
+#define _SOFTHSM_V2_FILESYNC_H
+
+#include "config.h"
+#include "MutexFactory.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+
+// The default durability level
+#define DEFAULT_OBJECTSTORE_DURABILITY "group"
+
+class FileSync
+{
+public:
+	// How far the object store goes to get a write on disk
+	enum Durability
+	{
+		// Leave it to the operating system; a crash can lose recent
+		// writes, but never leaves a partially written object
+		DURABILITY_NONE,
+		// Sync before returning, sharing syncs between sessions
+		DURABILITY_GROUP,
+		// Sync before returning, once for every write
+		DURABILITY_FULL
+	};
+
+	// Return the one-and-only instance
+	static FileSync* i();
+
+	// This will destroy the one-and-only instance; the next one takes its
+	// mutex from the mutex factory of that initialisation
+	static void reset();
+
+	// Set the durability level from its name in the configuration
+	bool setDurability(const std::string& level);
+	void setDurability(Durability level);
+	Durability getDurability();
+
+	// Flush the content of the open file to disk; returns when it is
+	// durable. The descriptor must stay open until then.
+	bool syncFile(int fd);
+
+	// Flush the entries of the directory, like a renamed file, to disk
+	bool syncDirectory(const std::string& path);
+
+	// The number of times the files and directories of waiting sessions
+	// were flushed together
+	unsigned long getRounds();
+
+	// Destructor
+	virtual ~FileSync();
+
+private:
+	// The files and directories to flush in one round
+	struct Batch
+	{
+		std::set<int> files;
+		std::set<std::string> directories;
+		bool done;
+		bool ok;
+
+		Batch() : done(false), ok(true) { }
+	};
+
+	// Constructor
+	FileSync();
+
+	// Wait until the file or the directory has been flushed
+	bool submit(int fd, const std::string& directory);
+
+	// Flush a set of files and directories
+	static bool flush(const std::set<int>& files, const std::set<std::string>& directories);
+
+	// The one-and-only instance
+	static std::unique_ptr<FileSync> instance;
+
+	Durability durability;
+
+	Mutex* syncMutex;
+	std::condition_variable_any syncDone;
+
+	// The batch that new requests join and whether a round is running
+	std::shared_ptr<Batch> pending;
+	bool syncing;
+
+	unsigned long rounds;
+};
+
+#endif // !_SOFTHSM_V2_FILESYNC_H
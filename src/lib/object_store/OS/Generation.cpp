@@ -33,12 +33,39 @@
 #include "config.h"
 #include "log.h"
 #include "Generation.h"
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+// Minimum interval between two checks of the same file
+unsigned long Generation::checkInterval = 0;
+
+// Set the minimum interval between two checks
+/*static*/ void Generation::setCheckInterval(unsigned long ms)
+{
+	checkInterval = ms;
+}
+
+#ifndef _WIN32
+// Monotonic clock in milliseconds
+static unsigned long long monotonicMillis()
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+	{
+		return 0;
+	}
+
+	return (unsigned long long) ts.tv_sec * 1000ULL + (unsigned long long) ts.tv_nsec / 1000000ULL;
+}
+#endif
 
 // Factory
 Generation* Generation::create(const std::string path, int umask, bool isToken /* = false */)
 {
 	Generation* gen = new Generation(path, umask, isToken);
-	if ((gen != NULL) && isToken && (gen->genMutex == NULL))
+	if ((gen != NULL) && (gen->genMutex == NULL))
 	{
 		delete gen;
 
@@ -50,10 +77,7 @@ Generation* Generation::create(const std::string path, int umask, bool isToken /
 // Destructor
 Generation::~Generation()
 {
-	if (isToken)
-	{
-		MutexFactory::i()->recycleMutex(genMutex);
-	}
+	MutexFactory::i()->recycleMutex(genMutex);
 }
 
 // Synchronize from locked disk file
@@ -66,6 +90,8 @@ bool Generation::sync(File &objectFile)
 		return false;
 	}
 
+	MutexLocker lock(genMutex);
+
 	unsigned long onDisk;
 
 	if (!objectFile.readULong(onDisk))
@@ -81,6 +107,7 @@ bool Generation::sync(File &objectFile)
 	}
 
 	currentValue = onDisk;
+	haveSnapshot = false;
 
 	return objectFile.seek(0L);
 }
@@ -92,6 +119,13 @@ bool Generation::wasUpdated()
 	{
 		MutexLocker lock(genMutex);
 
+		if (isUnchanged())
+		{
+			return false;
+		}
+
+		takeSnapshot();
+
 		File genFile(path, umask);
 
 		if (!genFile.isValid())
@@ -114,10 +148,21 @@ bool Generation::wasUpdated()
 			return true;
 		}
 
+		keepSnapshot();
+
 		return false;
 	}
 	else
 	{
+		MutexLocker lock(genMutex);
+
+		if (isUnchanged())
+		{
+			return false;
+		}
+
+		takeSnapshot();
+
 		File objectFile(path, umask);
 
 		if (!objectFile.isValid())
@@ -134,10 +179,108 @@ bool Generation::wasUpdated()
 			return true;
 		}
 
-		return (onDisk != currentValue);
+		if (onDisk != currentValue)
+		{
+			return true;
+		}
+
+		keepSnapshot();
+
+		return false;
 	}
 }
 
+// Cheap check if the file is known to be unchanged. Another process
+// always rewrites the file when it changes the generation, so unchanged
+// metadata means an unchanged value. Within the check interval the file
+// is not even looked at.
+bool Generation::isUnchanged()
+{
+#ifndef _WIN32
+	if (!haveSnapshot)
+	{
+		return false;
+	}
+
+	unsigned long long now = monotonicMillis();
+
+	if ((checkInterval > 0) && (now - lastCheck < checkInterval))
+	{
+		return true;
+	}
+
+	struct stat st;
+
+	if ((stat(path.c_str(), &st) != 0) ||
+	    (st.st_dev != snapDev) ||
+	    (st.st_ino != snapIno) ||
+	    (st.st_size != snapSize) ||
+	    (st.st_mtime != snapMtime) ||
+	    (st.st_ctime != snapCtime))
+	{
+		haveSnapshot = false;
+
+		return false;
+	}
+
+	lastCheck = now;
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+// Take a snapshot of the file metadata before reading it
+bool Generation::takeSnapshot()
+{
+	haveSnapshot = false;
+	pendingSnapshot = false;
+
+#ifndef _WIN32
+	// Timestamps only have a granularity of one second on some file
+	// systems. A file modified in the current second could be modified
+	// again without its metadata changing, so it is not cached.
+	time_t now = time(NULL);
+
+	struct stat st;
+
+	if (stat(path.c_str(), &st) != 0)
+	{
+		return false;
+	}
+
+	if (st.st_mtime >= now - 1)
+	{
+		return false;
+	}
+
+	snapDev = st.st_dev;
+	snapIno = st.st_ino;
+	snapSize = st.st_size;
+	snapMtime = st.st_mtime;
+	snapCtime = st.st_ctime;
+	pendingSnapshot = true;
+#endif
+
+	return pendingSnapshot;
+}
+
+// Keep the snapshot once the current value is known to match it
+void Generation::keepSnapshot()
+{
+	if (!pendingSnapshot)
+	{
+		return;
+	}
+
+	pendingSnapshot = false;
+	haveSnapshot = true;
+#ifndef _WIN32
+	lastCheck = monotonicMillis();
+#endif
+}
+
 // Update
 void Generation::update()
 {
@@ -151,6 +294,8 @@ void Generation::commit()
 	{
 		MutexLocker lock(genMutex);
 
+		haveSnapshot = false;
+
 		File genFile(path, umask, true, true, true, false);
 
 		if (!genFile.isValid())
@@ -211,13 +356,19 @@ void Generation::commit()
 // Set the current value when read from disk
 void Generation::set(unsigned long onDisk)
 {
+	MutexLocker lock(genMutex);
+
 	currentValue = onDisk;
+	haveSnapshot = false;
 }
 
 // Return new value
 unsigned long Generation::get()
 {
+	MutexLocker lock(genMutex);
+
 	pendingUpdate = false;
+	haveSnapshot = false;
 
 	currentValue++;
 
@@ -232,7 +383,10 @@ unsigned long Generation::get()
 // Rollback (called when the new value failed to be written)
 void Generation::rollback()
 {
+	MutexLocker lock(genMutex);
+
 	pendingUpdate = true;
+	haveSnapshot = false;
 
 	if (currentValue != 1)
 	{
@@ -248,15 +402,18 @@ Generation::Generation(const std::string inPath, int inUmask, bool inIsToken)
 	isToken = inIsToken;
 	pendingUpdate = false;
 	currentValue = 0;
-	genMutex = NULL;
-
-	if (isToken)
+	genMutex = MutexFactory::i()->getMutex();
+	haveSnapshot = false;
+	pendingSnapshot = false;
+	snapDev = 0;
+	snapIno = 0;
+	snapSize = 0;
+	snapMtime = 0;
+	snapCtime = 0;
+	lastCheck = 0;
+
+	if (isToken && (genMutex != NULL))
 	{
-		genMutex = MutexFactory::i()->getMutex();
-
-		if (genMutex != NULL)
-		{
-			commit();
-		}
+		commit();
 	}
 }
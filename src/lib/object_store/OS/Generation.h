@@ -35,9 +35,14 @@
 
 #include "config.h"
 #include <string>
+#include <sys/types.h>
+#include <time.h>
 #include "File.h"
 #include "MutexFactory.h"
 
+// Default minimum interval between two change checks (in milliseconds)
+#define DEFAULT_GENERATION_CHECK_INTERVAL 0
+
 class Generation
 {
 public:
@@ -68,6 +73,10 @@ public:
 	// Rollback (called when the new value failed to be written)
 	void rollback();
 
+	// Set the minimum interval in milliseconds between two checks of
+	// the same file for changes made by other processes (0 = always)
+	static void setCheckInterval(unsigned long ms);
+
 private:
 	// Constructor
 	Generation(const std::string path, int umask, bool isToken);
@@ -89,6 +98,31 @@ private:
 
 	// For thread safeness
 	Mutex* genMutex;
+
+	// Cheap check if the file is known to be unchanged since the
+	// current value was last verified against it
+	bool isUnchanged();
+
+	// Take a snapshot of the file metadata before reading it
+	bool takeSnapshot();
+
+	// Keep the snapshot once the current value is known to match it
+	void keepSnapshot();
+
+	// Cached file metadata
+	bool haveSnapshot;
+	bool pendingSnapshot;
+	dev_t snapDev;
+	ino_t snapIno;
+	off_t snapSize;
+	time_t snapMtime;
+	time_t snapCtime;
+
+	// Time of the last successful check (monotonic, in milliseconds)
+	unsigned long long lastCheck;
+
+	// Minimum interval between two checks (in milliseconds)
+	static unsigned long checkInterval;
 };
 
 #endif // !_SOFTHSM_V2_GENERATION_H
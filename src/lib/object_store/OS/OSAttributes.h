@@ -45,6 +45,7 @@
 #define CKA_OS_TOKENFLAGS	(CKA_VENDOR_SOFTHSM + 3)
 #define CKA_OS_SOPIN		(CKA_VENDOR_SOFTHSM + 4)
 #define CKA_OS_USERPIN		(CKA_VENDOR_SOFTHSM + 5)
+#define CKA_OS_KEYSLOTS		(CKA_VENDOR_SOFTHSM + 6)
 
 #endif // !_SOFTHSM_V2_OSATTRIBUTES_H
 
@@ -38,6 +38,9 @@
 #include "config.h"
 #include "OSAttribute.h"
 #include "cryptoki.h"
+#ifdef HAVE_CXX11
+#include <atomic>
+#endif
 
 class OSObject
 {
@@ -66,6 +69,11 @@ public:
 	// The validity state of the object
 	virtual bool isValid() = 0;
 
+	// Retrieve the revision of the object; the revision changes whenever the
+	// attributes of the object are modified or reloaded. Revisions are unique
+	// within the process, so a revision is never reused by another object
+	virtual unsigned long getRevision() = 0;
+
 	// Start an attribute set transaction; this method is used when - for
 	// example - a key is generated and all its attributes need to be
 	// persisted in one go.
@@ -89,6 +97,21 @@ public:
 	// Destroys the object (warning, any pointers to the object are no longer
 	// valid after this call because delete is called!)
 	virtual bool destroyObject() = 0;
+
+protected:
+	// Hand out a new process-wide unique revision number
+	static unsigned long nextRevision()
+	{
+#ifdef HAVE_CXX11
+		static std::atomic<unsigned long> revisionCounter(0);
+
+		return ++revisionCounter;
+#else
+		static unsigned long revisionCounter = 0;
+
+		return __sync_add_and_fetch(&revisionCounter, 1);
+#endif
+	}
 };
 
 #endif // !_SOFTHSM_V2_OSOBJECT_H
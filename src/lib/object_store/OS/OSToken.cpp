@@ -43,6 +43,7 @@
 #include "cryptoki.h"
 #include "OSToken.h"
 #include "OSPathSep.h"
+#include "ObjectLoader.h"
 #include <vector>
 #include <string>
 #include <set>
@@ -57,7 +58,7 @@ OSToken::OSToken(const std::string inTokenPath, int inUmask)
 	umask = inUmask;
 
 	tokenDir = new Directory(tokenPath);
-	gen = Generation::create(tokenPath + OS_PATHSEP + "generation", true);
+	gen = Generation::create(tokenPath + OS_PATHSEP + "generation", umask, true);
 	tokenObject = new ObjectFile(this, tokenPath + OS_PATHSEP + "token.object", umask, tokenPath + OS_PATHSEP + "token.lock");
 	tokenMutex = MutexFactory::i()->getMutex();
 	valid = (gen != NULL) && (tokenMutex != NULL) && tokenDir->isValid() && tokenObject->valid;
@@ -280,6 +281,29 @@ bool OSToken::getTokenSerial(ByteString& serial)
 	}
 }
 
+// Get the record of the Mizar key slots claimed by the token
+bool OSToken::getKeySlots(ByteString& keySlots)
+{
+	if (!valid || !tokenObject->isValid())
+	{
+		return false;
+	}
+
+	keySlots = tokenObject->getByteStringValue(CKA_OS_KEYSLOTS);
+
+	return true;
+}
+
+// Set the record of the Mizar key slots claimed by the token
+bool OSToken::setKeySlots(const ByteString& keySlots)
+{
+	if (!valid) return false;
+
+	OSAttribute slots(keySlots);
+
+	return tokenObject->setAttribute(CKA_OS_KEYSLOTS, slots);
+}
+
 // Get the token flags
 bool OSToken::getTokenFlags(CK_ULONG& flags)
 {
@@ -663,7 +687,10 @@ bool OSToken::index(bool isFirstTime /* = false */)
 
 	// Now update the set of objects
 
-	// Add new objects
+	// Add new objects; they are read in parallel when the object store
+	// is being loaded
+	std::vector<std::string> newFiles;
+
 	for (std::set<std::string>::iterator i = addedFiles.begin(); i != addedFiles.end(); i++)
 	{
 		if ((i->find_last_of('.') == std::string::npos) ||
@@ -672,18 +699,34 @@ bool OSToken::index(bool isFirstTime /* = false */)
 			continue;
 		}
 
-		std::string lockName(*i);
-		lockName.replace(lockName.find_last_of('.'), std::string::npos, ".lock");
+		newFiles.push_back(*i);
+	}
+
+	std::vector<ObjectFile*> loadedObjects(newFiles.size(), NULL);
+	std::vector<ObjectLoader::Job> jobs;
 
-		// Create a new token object for the added file
-		ObjectFile* newObject = new ObjectFile(this, tokenPath + OS_PATHSEP + *i, umask, tokenPath + OS_PATHSEP + lockName);
+	for (size_t n = 0; n < newFiles.size(); n++)
+	{
+		jobs.push_back([this, n, &newFiles, &loadedObjects]
+		{
+			std::string lockName(newFiles[n]);
+			lockName.replace(lockName.find_last_of('.'), std::string::npos, ".lock");
+
+			// Create a new token object for the added file
+			loadedObjects[n] = new ObjectFile(this, tokenPath + OS_PATHSEP + newFiles[n], umask, tokenPath + OS_PATHSEP + lockName, false, ObjectFile::getLazyLoading());
+		});
+	}
+
+	ObjectLoader::run(jobs);
 
+	for (size_t n = 0; n < loadedObjects.size(); n++)
+	{
 		// Add the object, even invalid ones.
 		// This is so the we can read the attributes once
 		// the other process has finished writing to disc.
-		DEBUG_MSG("(0x%08X) New object %s (0x%08X) added", this, newObject->getFilename().c_str(), newObject);
-		objects.insert(newObject);
-		allObjects.insert(newObject);
+		DEBUG_MSG("(0x%08X) New object %s (0x%08X) added", this, loadedObjects[n]->getFilename().c_str(), loadedObjects[n]);
+		objects.insert(loadedObjects[n]);
+		allObjects.insert(loadedObjects[n]);
 	}
 
 	// Remove deleted objects
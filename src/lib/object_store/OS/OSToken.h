@@ -88,6 +88,10 @@ public:
 	// Retrieve the token serial
 	virtual bool getTokenSerial(ByteString& serial);
 
+	// Get and set the record of the Mizar key slots claimed by the token
+	virtual bool getKeySlots(ByteString& keySlots);
+	virtual bool setKeySlots(const ByteString& keySlots);
+
 	// Retrieve objects
 	virtual std::set<OSObject*> getObjects();
 
@@ -34,12 +34,18 @@
 #include "ObjectFile.h"
 #include "OSToken.h"
 #include "OSPathSep.h"
+#include "OSAttributes.h"
+#include "FileSync.h"
+#include "BodyCache.h"
 #ifndef _WIN32
 #include <unistd.h>
 #endif
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <set>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
 
 // Attribute types
 #define BOOLEAN_ATTR			0x1
@@ -48,8 +54,168 @@
 #define ATTRMAP_ATTR			0x4
 #define MECHSET_ATTR			0x5
 
+// The record of an attribute that was deleted; it has no value
+#define DELETED_ATTR			0x6
+
+// Object files in the record format have a header after the generation
+// number: a marker that cannot be an attribute type and the version.
+// Files without it hold every attribute exactly once; in the record
+// format a change of a single attribute is appended as a new record
+#define OBJECTFILE_FORMAT_MARKER	(CKA_VENDOR_SOFTHSM + 0x4F46) // 'OF'
+#define OBJECTFILE_FORMAT_RECORDS	1
+
+// The number of superseded records from which an object file is
+// rewritten in full once they outnumber the attributes of the object
+#define OBJECTFILE_COMPACT_RECORDS	16
+
+// The number of times a writer opens the object file again when it was
+// replaced while the writer waited for the lock
+#define OBJECTFILE_LOCK_ATTEMPTS	64
+
+// Read the value of an attribute of the given type; returns NULL if it
+// cannot be read
+static OSAttribute* readValue(File& objectFile, unsigned long osAttrType)
+{
+	if (osAttrType == BOOLEAN_ATTR)
+	{
+		bool value;
+
+		if (objectFile.readBool(value)) return new OSAttribute(value);
+	}
+	else if (osAttrType == ULONG_ATTR)
+	{
+		unsigned long value;
+
+		if (objectFile.readULong(value)) return new OSAttribute(value);
+	}
+	else if (osAttrType == BYTESTR_ATTR)
+	{
+		ByteString value;
+
+		if (objectFile.readByteString(value)) return new OSAttribute(value);
+	}
+	else if (osAttrType == MECHSET_ATTR)
+	{
+		std::set<CK_MECHANISM_TYPE> value;
+
+		if (objectFile.readMechanismTypeSet(value)) return new OSAttribute(value);
+	}
+	else if (osAttrType == ATTRMAP_ATTR)
+	{
+		std::map<CK_ATTRIBUTE_TYPE,OSAttribute> value;
+
+		if (objectFile.readAttributeMap(value)) return new OSAttribute(value);
+	}
+
+	return NULL;
+}
+
+// Write the type and the value of an attribute
+static bool writeValue(File& objectFile, const OSAttribute& attr)
+{
+	if (attr.isBooleanAttribute())
+	{
+		return objectFile.writeULong(BOOLEAN_ATTR) && objectFile.writeBool(attr.getBooleanValue());
+	}
+	else if (attr.isUnsignedLongAttribute())
+	{
+		return objectFile.writeULong(ULONG_ATTR) && objectFile.writeULong(attr.getUnsignedLongValue());
+	}
+	else if (attr.isByteStringAttribute())
+	{
+		return objectFile.writeULong(BYTESTR_ATTR) && objectFile.writeByteString(attr.getByteStringValue());
+	}
+	else if (attr.isMechanismTypeSetAttribute())
+	{
+		return objectFile.writeULong(MECHSET_ATTR) && objectFile.writeMechanismTypeSet(attr.getMechanismTypeSetValue());
+	}
+	else if (attr.isAttributeMapAttribute())
+	{
+		return objectFile.writeULong(ATTRMAP_ATTR) && objectFile.writeAttributeMap(attr.getAttributeMapValue());
+	}
+
+	ERROR_MSG("Unknown attribute type");
+
+	return false;
+}
+
+// Skip the value of an attribute of the given type without reading it.
+// Returns false if it is unknown or does not fit in the file, which ends
+// at the given offset; the file is then positioned at the end
+static bool skipValue(File& objectFile, unsigned long osAttrType, long end)
+{
+	unsigned long len = 0;
+	unsigned long unit = 1;
+
+	if (osAttrType == BOOLEAN_ATTR)
+	{
+		len = 1;
+	}
+	else if (osAttrType == ULONG_ATTR)
+	{
+		len = 8;
+	}
+	else if ((osAttrType == BYTESTR_ATTR) || (osAttrType == ATTRMAP_ATTR))
+	{
+		if (!objectFile.readULong(len)) return false;
+	}
+	else if (osAttrType == MECHSET_ATTR)
+	{
+		if (!objectFile.readULong(len)) return false;
+
+		unit = 8;
+	}
+	else
+	{
+		return false;
+	}
+
+	long pos = objectFile.tell();
+
+	if ((pos < 0) || (pos > end) || (len > (unsigned long) (end - pos) / unit))
+	{
+		objectFile.seek(end);
+
+		return false;
+	}
+
+	return objectFile.seek(pos + (long) (len * unit));
+}
+
+// Whether tokens load their objects lazily
+bool ObjectFile::lazyLoading = false;
+
+// Have tokens load their objects lazily
+/*static*/ void ObjectFile::setLazyLoading(bool enable)
+{
+	lazyLoading = enable;
+}
+
+/*static*/ bool ObjectFile::getLazyLoading()
+{
+	return lazyLoading;
+}
+
+// Check if the attribute is read by lazy objects before their body is;
+// these are what objects are usually looked up by
+/*static*/ bool ObjectFile::isHeaderAttribute(CK_ATTRIBUTE_TYPE type)
+{
+	switch (type)
+	{
+		case CKA_CLASS:
+		case CKA_KEY_TYPE:
+		case CKA_TOKEN:
+		case CKA_PRIVATE:
+		case CKA_ID:
+		case CKA_LABEL:
+			return true;
+		default:
+			return false;
+	}
+}
+
 // Constructor
-ObjectFile::ObjectFile(OSToken* parent, std::string inPath, int inUmask, std::string inLockpath, bool isNew /* = false */)
+ObjectFile::ObjectFile(OSToken* parent, std::string inPath, int inUmask, std::string inLockpath, bool isNew /* = false */, bool isLazy /* = false */)
 {
 	path = inPath;
 	umask = inUmask;
@@ -60,6 +226,15 @@ ObjectFile::ObjectFile(OSToken* parent, std::string inPath, int inUmask, std::st
 	inTransaction = false;
 	transactionLockFile = NULL;
 	lockpath = inLockpath;
+	revision = nextRevision();
+	fileGen = 0;
+	fileSize = 0;
+	isRecordFormat = false;
+	supersededRecords = 0;
+	lazy = isLazy && !isNew;
+	bodyLoaded = !lazy;
+	pins = 0;
+	lastUse = 0;
 
 	if (!valid) return;
 
@@ -82,6 +257,11 @@ ObjectFile::ObjectFile(OSToken* parent, std::string inPath, int inUmask, std::st
 // Destructor
 ObjectFile::~ObjectFile()
 {
+	if (lazy)
+	{
+		BodyCache::i()->released(this);
+	}
+
 	discardAttributes();
 
 	if (gen != NULL)
@@ -97,14 +277,24 @@ bool ObjectFile::attributeExists(CK_ATTRIBUTE_TYPE type)
 {
 	MutexLocker lock(objectMutex);
 
+	// The body does not have to be loaded to know what it holds
+	if (!bodyLoaded && !isHeaderAttribute(type))
+	{
+		return valid && (bodyTypes.find(type) != bodyTypes.end());
+	}
+
 	return valid && (attributes[type] != NULL);
 }
 
 // Retrieve the specified attribute
 OSAttribute ObjectFile::getAttribute(CK_ATTRIBUTE_TYPE type)
 {
+	bool pinned = needAttribute(type);
+
 	MutexLocker lock(objectMutex);
 
+	if (pinned) pins--;
+
 	OSAttribute* attr = attributes[type];
 	if (attr == NULL)
 	{
@@ -117,8 +307,12 @@ OSAttribute ObjectFile::getAttribute(CK_ATTRIBUTE_TYPE type)
 
 bool ObjectFile::getBooleanValue(CK_ATTRIBUTE_TYPE type, bool val)
 {
+	bool pinned = needAttribute(type);
+
 	MutexLocker lock(objectMutex);
 
+	if (pinned) pins--;
+
 	OSAttribute* attr = attributes[type];
 	if (attr == NULL)
 	{
@@ -139,8 +333,12 @@ bool ObjectFile::getBooleanValue(CK_ATTRIBUTE_TYPE type, bool val)
 
 unsigned long ObjectFile::getUnsignedLongValue(CK_ATTRIBUTE_TYPE type, unsigned long val)
 {
+	bool pinned = needAttribute(type);
+
 	MutexLocker lock(objectMutex);
 
+	if (pinned) pins--;
+
 	OSAttribute* attr = attributes[type];
 	if (attr == NULL)
 	{
@@ -161,8 +359,12 @@ unsigned long ObjectFile::getUnsignedLongValue(CK_ATTRIBUTE_TYPE type, unsigned
 
 ByteString ObjectFile::getByteStringValue(CK_ATTRIBUTE_TYPE type)
 {
+	bool pinned = needAttribute(type);
+
 	MutexLocker lock(objectMutex);
 
+	if (pinned) pins--;
+
 	ByteString val;
 
 	OSAttribute* attr = attributes[type];
@@ -186,8 +388,12 @@ ByteString ObjectFile::getByteStringValue(CK_ATTRIBUTE_TYPE type)
 // Retrieve the next attribute type
 CK_ATTRIBUTE_TYPE ObjectFile::nextAttributeType(CK_ATTRIBUTE_TYPE type)
 {
+	bool pinned = pinBody();
+
 	MutexLocker lock(objectMutex);
 
+	if (pinned) pins--;
+
 	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator n = attributes.upper_bound(type);
 
 	// skip null attributes
@@ -215,6 +421,11 @@ bool ObjectFile::setAttribute(CK_ATTRIBUTE_TYPE type, const OSAttribute& attribu
 		return false;
 	}
 
+	// The whole object may have to be written
+	bool pinned = pinBody();
+
+	bool replaced = false;
+
 	{
 		MutexLocker lock(objectMutex);
 
@@ -223,12 +434,18 @@ bool ObjectFile::setAttribute(CK_ATTRIBUTE_TYPE type, const OSAttribute& attribu
 			delete attributes[type];
 
 			attributes[type] = NULL;
+
+			replaced = true;
 		}
 
 		attributes[type] = new OSAttribute(attribute);
+
+		revision = nextRevision();
 	}
 
-	store();
+	storeAttribute(type, replaced);
+
+	unpinBody(pinned);
 
 	return valid;
 }
@@ -243,6 +460,8 @@ bool ObjectFile::deleteAttribute(CK_ATTRIBUTE_TYPE type)
 		return false;
 	}
 
+	bool pinned = pinBody();
+
 	{
 		MutexLocker lock(objectMutex);
 
@@ -250,14 +469,20 @@ bool ObjectFile::deleteAttribute(CK_ATTRIBUTE_TYPE type)
 		{
 			DEBUG_MSG("Cannot delete attribute that doesn't exist in object %s", path.c_str());
 
+			if (pinned) pins--;
+
 			return false;
 		}
 
 		delete attributes[type];
 		attributes.erase(type);
+
+		revision = nextRevision();
 	}
 
-	store();
+	storeAttribute(type, true);
+
+	unpinBody(pinned);
 
 	return valid;
 }
@@ -270,6 +495,14 @@ bool ObjectFile::isValid()
 	return valid;
 }
 
+// Retrieve the revision of the object
+unsigned long ObjectFile::getRevision()
+{
+	MutexLocker lock(objectMutex);
+
+	return revision;
+}
+
 // Invalidate the object file externally; this method is normally
 // only called by the OSToken class in case an object file has
 // been deleted.
@@ -277,11 +510,112 @@ void ObjectFile::invalidate()
 {
 	valid = false;
 
+	if (lazy)
+	{
+		BodyCache::i()->released(this);
+	}
+
 	discardAttributes();
 }
 
+// Make sure the attribute is loaded, if it exists; returns true if the
+// body was pinned for it
+bool ObjectFile::needAttribute(CK_ATTRIBUTE_TYPE type)
+{
+	if (isHeaderAttribute(type))
+	{
+		return false;
+	}
+
+	return pinBody();
+}
+
+// Load the body of a lazy object if needed and keep it from being dropped
+// until it is unpinned; returns false for objects that are not lazy
+bool ObjectFile::pinBody()
+{
+	if (!lazy)
+	{
+		return false;
+	}
+
+	lastUse = BodyCache::tick();
+
+	{
+		MutexLocker lock(objectMutex);
+
+		pins++;
+
+		if (bodyLoaded)
+		{
+			return true;
+		}
+	}
+
+	DEBUG_MSG("Loading the body of object %s", path.c_str());
+
+	refresh(true, true);
+
+	return true;
+}
+
+// Allow the body to be dropped again
+void ObjectFile::unpinBody(bool pinned)
+{
+	if (!pinned)
+	{
+		return;
+	}
+
+	MutexLocker lock(objectMutex);
+
+	pins--;
+}
+
+// Drop the body of a lazy object; the header attributes stay, and the
+// object keeps its revision since its content does not change
+bool ObjectFile::evictBody()
+{
+	MutexLocker lock(objectMutex);
+
+	if (inTransaction || (pins > 0))
+	{
+		return false;
+	}
+
+	if (!bodyLoaded)
+	{
+		return true;
+	}
+
+	bodyTypes.clear();
+
+	for (std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator i = attributes.begin(); i != attributes.end();)
+	{
+		if (isHeaderAttribute(i->first))
+		{
+			i++;
+
+			continue;
+		}
+
+		if (i->second != NULL)
+		{
+			bodyTypes.insert(i->first);
+
+			delete i->second;
+		}
+
+		attributes.erase(i++);
+	}
+
+	bodyLoaded = false;
+
+	return true;
+}
+
 // Refresh the object if necessary
-void ObjectFile::refresh(bool isFirstTime /* = false */)
+void ObjectFile::refresh(bool isFirstTime /* = false */, bool withBody /* = false */)
 {
 	// Check if we're in the middle of a transaction
 	if (inTransaction)
@@ -330,34 +664,66 @@ void ObjectFile::refresh(bool isFirstTime /* = false */)
 
 	DEBUG_MSG("Object %s has changed", path.c_str());
 
-	// Discard the existing set of attributes
-	discardAttributes();
+	// Without its body, a lazy object only reads the header attributes
+	// and skips over the values of the others
+	bool headerOnly;
+	unsigned long oldGen;
+	long oldSize;
+	bool wasValid;
 
-	MutexLocker lock(objectMutex);
+	{
+		MutexLocker lock(objectMutex);
+
+		headerOnly = lazy && !bodyLoaded && !withBody;
+		oldGen = fileGen;
+		oldSize = fileSize;
+		wasValid = valid;
+	}
+
+	long end = -1;
+
+	if (!objectFile.seek() || ((end = objectFile.tell()) < 0) || !objectFile.seek(0L))
+	{
+		DEBUG_MSG("Corrupt object file %s", path.c_str());
+
+		discardAttributes();
+
+		valid = false;
+
+		objectFile.unlock();
+
+		return;
+	}
+
+	// The attributes are read aside, so other threads keep seeing the
+	// current ones until the new ones replace them
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*> newAttributes;
+	std::set<CK_ATTRIBUTE_TYPE> newBodyTypes;
+	bool newIsRecordFormat = false;
+	unsigned long newSuperseded = 0;
+	bool corrupt = false;
 
 	// Read back the generation number
 	unsigned long curGen;
 
 	if (!objectFile.readULong(curGen))
 	{
-		if (!objectFile.isEOF())
-		{
-			DEBUG_MSG("Corrupt object file %s", path.c_str());
-
-			valid = false;
-
-			objectFile.unlock();
+		corrupt = !objectFile.isEOF();
 
-			return;
-		}
+		curGen = 0;
 	}
 	else
 	{
 		gen->set(curGen);
 	}
 
-	// Read back the attributes
-	while (!objectFile.isEOF())
+	long newSize = objectFile.tell();
+
+	// Read back the attributes; a later record for an attribute replaces
+	// an earlier one
+	bool isFirst = true;
+
+	while (!corrupt && !objectFile.isEOF())
 	{
 		unsigned long p11AttrType;
 		unsigned long osAttrType;
@@ -369,156 +735,154 @@ void ObjectFile::refresh(bool isFirstTime /* = false */)
 				break;
 			}
 
-			DEBUG_MSG("Corrupt object file %s", path.c_str());
+			corrupt = true;
 
-			valid = false;
-
-			objectFile.unlock();
-
-			return;
+			break;
 		}
 
-		if (!objectFile.readULong(osAttrType))
+		// Files in the record format start with a versioned header
+		if (isFirst && (p11AttrType == OBJECTFILE_FORMAT_MARKER))
 		{
-			DEBUG_MSG("Corrupt object file %s", path.c_str());
-
-			valid = false;
+			unsigned long version;
 
-			objectFile.unlock();
+			isFirst = false;
 
-			return;
-		}
-
-		// Depending on the type, read back the actual value
-		if (osAttrType == BOOLEAN_ATTR)
-		{
-			bool value;
-
-			if (!objectFile.readBool(value))
+			if (!objectFile.readULong(version) || (version != OBJECTFILE_FORMAT_RECORDS))
 			{
-				DEBUG_MSG("Corrupt object file %s", path.c_str());
-
-				valid = false;
+				DEBUG_MSG("Object file %s has an unsupported format", path.c_str());
 
-				objectFile.unlock();
+				corrupt = true;
 
-				return;
+				break;
 			}
 
-			if (attributes[p11AttrType] != NULL)
-			{
-				delete attributes[p11AttrType];
-			}
+			newIsRecordFormat = true;
+			newSize = objectFile.tell();
 
-			attributes[p11AttrType] = new OSAttribute(value);
+			continue;
 		}
-		else if (osAttrType == ULONG_ATTR)
-		{
-			unsigned long value;
 
-			if (!objectFile.readULong(value))
-			{
-				DEBUG_MSG("Corrupt object file %s", path.c_str());
-
-				valid = false;
+		isFirst = false;
 
-				objectFile.unlock();
+		OSAttribute* value = NULL;
+		bool skip = headerOnly && !isHeaderAttribute(p11AttrType);
 
-				return;
-			}
-
-			if (attributes[p11AttrType] != NULL)
-			{
-				delete attributes[p11AttrType];
-			}
-
-			attributes[p11AttrType] = new OSAttribute(value);
-		}
-		else if (osAttrType == BYTESTR_ATTR)
+		if (!objectFile.readULong(osAttrType) ||
+		    ((osAttrType == DELETED_ATTR) && !newIsRecordFormat) ||
+		    ((osAttrType != DELETED_ATTR) && skip && !skipValue(objectFile, osAttrType, end)) ||
+		    ((osAttrType != DELETED_ATTR) && !skip && ((value = readValue(objectFile, osAttrType)) == NULL)))
 		{
-			ByteString value;
-
-			if (!objectFile.readByteString(value))
+			// A record that was cut short while it was appended
+			if (newIsRecordFormat && (objectFile.isEOF() || (objectFile.tell() == end)))
 			{
-				DEBUG_MSG("Corrupt object file %s", path.c_str());
+				WARNING_MSG("Ignoring an incomplete record at the end of object %s", path.c_str());
 
-				valid = false;
-
-				objectFile.unlock();
-
-				return;
+				break;
 			}
 
-			if (attributes[p11AttrType] != NULL)
-			{
-				delete attributes[p11AttrType];
-			}
+			corrupt = true;
 
-			attributes[p11AttrType] = new OSAttribute(value);
+			break;
 		}
-		else if (osAttrType == MECHSET_ATTR)
+
+		if ((newAttributes.find(p11AttrType) != newAttributes.end()) ||
+		    (newBodyTypes.find(p11AttrType) != newBodyTypes.end()))
 		{
-			std::set<CK_MECHANISM_TYPE> value;
+			delete newAttributes[p11AttrType];
+			newAttributes.erase(p11AttrType);
+			newBodyTypes.erase(p11AttrType);
 
-			if (!objectFile.readMechanismTypeSet(value))
-			{
-				DEBUG_MSG("Corrupt object file %s", path.c_str());
+			newSuperseded++;
+		}
 
-				valid = false;
+		if (osAttrType == DELETED_ATTR)
+		{
+			newSuperseded++;
+		}
+		else if (skip)
+		{
+			newBodyTypes.insert(p11AttrType);
+		}
+		else
+		{
+			newAttributes[p11AttrType] = value;
+		}
 
-				objectFile.unlock();
+		newSize = objectFile.tell();
+	}
 
-				return;
-			}
+	objectFile.unlock();
 
-			if (attributes[p11AttrType] != NULL)
-			{
-				delete attributes[p11AttrType];
-			}
+	if (corrupt)
+	{
+		DEBUG_MSG("Corrupt object file %s", path.c_str());
 
-			attributes[p11AttrType] = new OSAttribute(value);
-		}
-		else if (osAttrType == ATTRMAP_ATTR)
+		for (std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator i = newAttributes.begin(); i != newAttributes.end(); i++)
 		{
-			std::map<CK_ATTRIBUTE_TYPE,OSAttribute> value;
+			delete i->second;
+		}
 
-			if (!objectFile.readAttributeMap(value))
-			{
-				DEBUG_MSG("Corrupt object file %s", path.c_str());
+		discardAttributes();
 
-				valid = false;
+		valid = false;
 
-				objectFile.unlock();
+		return;
+	}
 
-				return;
-			}
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*> oldAttributes;
+	bool withoutBody = false;
 
-			if (attributes[p11AttrType] != NULL)
-			{
-				delete attributes[p11AttrType];
-			}
+	{
+		MutexLocker lock(objectMutex);
 
-			attributes[p11AttrType] = new OSAttribute(value);
+		// The body was loaded meanwhile; it may not be replaced by the
+		// header alone
+		if (headerOnly && bodyLoaded)
+		{
+			oldAttributes.swap(newAttributes);
+			withoutBody = true;
 		}
 		else
 		{
-			DEBUG_MSG("Corrupt object file %s with unknown attribute of type %d", path.c_str(), osAttrType);
-
-			valid = false;
-
-			objectFile.unlock();
+			oldAttributes.swap(attributes);
+			attributes.swap(newAttributes);
+			bodyTypes.swap(newBodyTypes);
+			bodyLoaded = !headerOnly;
+
+			fileGen = curGen;
+			fileSize = newSize;
+			isRecordFormat = newIsRecordFormat;
+			supersededRecords = newSuperseded;
+
+			// Loading the body of an unchanged object does not change it
+			if (!withBody || !wasValid || (curGen != oldGen) || (newSize != oldSize))
+			{
+				revision = nextRevision();
+			}
 
-			return;
+			valid = true;
 		}
 	}
 
-	objectFile.unlock();
+	for (std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator i = oldAttributes.begin(); i != oldAttributes.end(); i++)
+	{
+		delete i->second;
+	}
 
-	valid = true;
+	if (withoutBody)
+	{
+		refresh(true, true);
+	}
+	else if (lazy && !headerOnly)
+	{
+		BodyCache::i()->loaded(this, (size_t) newSize);
+	}
 }
 
 // Common write part in store()
-// called with objectFile locked and returns with objectFile unlocked
+// called with objectFile locked and returns with objectFile unlocked.
+// The object is written to a new file that then replaces the object
+// file, so after a crash the object is either the old or the new one
 bool ObjectFile::writeAttributes(File &objectFile)
 {
 	if (!gen->sync(objectFile))
@@ -530,22 +894,56 @@ bool ObjectFile::writeAttributes(File &objectFile)
 		return false;
 	}
 
-	if (!objectFile.truncate())
+	gen->update();
+
+	unsigned long newGen = gen->get();
+	long newSize = -1;
+	bool bOK = true;
+
+#ifndef _WIN32
+	std::string tmpPath = path + ".tmp";
+
+	{
+		File tmpFile(tmpPath, umask, true, true, true, true);
+
+		// The new file has to be on disk before it replaces the old one
+		bOK = bOK && tmpFile.isValid();
+		bOK = bOK && writeObject(tmpFile, newGen);
+		bOK = bOK && tmpFile.sync();
+
+		newSize = tmpFile.tell();
+	}
+
+	if (!bOK || (::rename(tmpPath.c_str(), path.c_str()) != 0))
 	{
-		DEBUG_MSG("Failed to reset object %s", path.c_str());
+		ERROR_MSG("Failed to write object %s: %s", path.c_str(), strerror(errno));
+
+		::unlink(tmpPath.c_str());
+
+		gen->rollback();
 
 		objectFile.unlock();
 
 		return false;
 	}
 
-	gen->update();
-
-	unsigned long newGen = gen->get();
+	// The rename is only durable once the directory is
+	std::string::size_type sep = path.find_last_of(OS_PATHSEP);
 
-	if (!objectFile.writeULong(newGen))
+	if (!FileSync::i()->syncDirectory((sep == std::string::npos) ? "." : path.substr(0, sep)))
 	{
-		DEBUG_MSG("Failed to write new generation number to object %s", path.c_str());
+		WARNING_MSG("Object %s was written but may not be on disk yet", path.c_str());
+	}
+#else
+	// An open file cannot be replaced on Windows, so the object file
+	// is rewritten in place
+	bOK = bOK && objectFile.truncate();
+	bOK = bOK && writeObject(objectFile, newGen);
+	bOK = bOK && objectFile.sync();
+
+	if (!bOK)
+	{
+		DEBUG_MSG("Failed to write object %s", path.c_str());
 
 		gen->rollback();
 
@@ -554,6 +952,31 @@ bool ObjectFile::writeAttributes(File &objectFile)
 		return false;
 	}
 
+	newSize = objectFile.tell();
+#endif
+
+	fileGen = newGen;
+	fileSize = newSize;
+	isRecordFormat = true;
+	supersededRecords = 0;
+
+	objectFile.unlock();
+
+	return true;
+}
+
+// Write the whole object: the generation number, the header and the
+// records of all attributes
+bool ObjectFile::writeObject(File &objectFile, unsigned long newGen)
+{
+	if (!objectFile.writeULong(newGen) ||
+	    !objectFile.writeULong(OBJECTFILE_FORMAT_MARKER) ||
+	    !objectFile.writeULong(OBJECTFILE_FORMAT_RECORDS))
+	{
+		DEBUG_MSG("Failed to write the header of object %s", path.c_str());
+
+		return false;
+	}
 
 	for (std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator i = attributes.begin(); i != attributes.end(); i++)
 	{
@@ -562,100 +985,95 @@ bool ObjectFile::writeAttributes(File &objectFile)
 			continue;
 		}
 
-		unsigned long p11AttrType = i->first;
-
-		if (!objectFile.writeULong(p11AttrType))
+		if (!writeRecord(objectFile, i->first, i->second))
 		{
-			DEBUG_MSG("Failed to write PKCS #11 attribute type to object %s", path.c_str());
-
-			objectFile.unlock();
+			DEBUG_MSG("Failed to write attribute to object %s", path.c_str());
 
 			return false;
 		}
+	}
 
-		if (i->second->isBooleanAttribute())
-		{
-			unsigned long osAttrType = BOOLEAN_ATTR;
-			bool value = i->second->getBooleanValue();
+	return true;
+}
 
-			if (!objectFile.writeULong(osAttrType) || !objectFile.writeBool(value))
-			{
-				DEBUG_MSG("Failed to write attribute to object %s", path.c_str());
+// Append the record of one attribute; called with objectFile locked and
+// returns with it still locked. Returns false, with the file positioned
+// at the start, if the object file has to be rewritten instead
+bool ObjectFile::appendAttribute(File &objectFile, CK_ATTRIBUTE_TYPE type)
+{
+	// Compact the file once it holds more superseded records than live ones
+	if (!isRecordFormat ||
+	    ((supersededRecords >= OBJECTFILE_COMPACT_RECORDS) && (supersededRecords >= attributes.size())))
+	{
+		return false;
+	}
 
-				objectFile.unlock();
+	// The file must be exactly as this instance last left it
+	unsigned long onDisk;
 
-				return false;
-			}
-		}
-		else if (i->second->isUnsignedLongAttribute())
-		{
-			unsigned long osAttrType = ULONG_ATTR;
-			unsigned long value = i->second->getUnsignedLongValue();
+	if (!objectFile.readULong(onDisk) || (onDisk != fileGen) ||
+	    !objectFile.seek() || (objectFile.tell() != fileSize))
+	{
+		objectFile.seek(0L);
 
-			if (!objectFile.writeULong(osAttrType) || !objectFile.writeULong(value))
-			{
-				DEBUG_MSG("Failed to write attribute to object %s", path.c_str());
+		return false;
+	}
 
-				objectFile.unlock();
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator i = attributes.find(type);
 
-				return false;
-			}
-		}
-		else if (i->second->isByteStringAttribute())
-		{
-			unsigned long osAttrType = BYTESTR_ATTR;
-			const ByteString& value = i->second->getByteStringValue();
+	// The record has to be on disk before the generation number that
+	// makes other instances read it
+	if (!writeRecord(objectFile, type, (i == attributes.end()) ? NULL : i->second) ||
+	    !objectFile.sync())
+	{
+		DEBUG_MSG("Failed to append attribute to object %s", path.c_str());
 
-			if (!objectFile.writeULong(osAttrType) || !objectFile.writeByteString(value))
-			{
-				DEBUG_MSG("Failed to write attribute to object %s", path.c_str());
+		objectFile.seek(0L);
 
-				objectFile.unlock();
+		return false;
+	}
 
-				return false;
-			}
-		}
-		else if (i->second->isMechanismTypeSetAttribute())
-		{
-			unsigned long osAttrType = MECHSET_ATTR;
-			const std::set<CK_MECHANISM_TYPE>& value = i->second->getMechanismTypeSetValue();
+	long newSize = objectFile.tell();
 
-			if (!objectFile.writeULong(osAttrType) || !objectFile.writeMechanismTypeSet(value))
-			{
-				DEBUG_MSG("Failed to write attribute to object %s", path.c_str());
+	// The new generation number is written last, so other instances
+	// only pick up complete records
+	gen->set(onDisk);
 
-				objectFile.unlock();
+	unsigned long newGen = gen->get();
 
-				return false;
-			}
-		}
-		else if (i->second->isAttributeMapAttribute())
-		{
-			unsigned long osAttrType = ATTRMAP_ATTR;
-			const std::map<CK_ATTRIBUTE_TYPE,OSAttribute>& value = i->second->getAttributeMapValue();
+	if (!objectFile.seek(0L) || !objectFile.writeULong(newGen) || !objectFile.sync())
+	{
+		DEBUG_MSG("Failed to write new generation number to object %s", path.c_str());
 
-			if (!objectFile.writeULong(osAttrType) || !objectFile.writeAttributeMap(value))
-			{
-				DEBUG_MSG("Failed to write attribute to object %s", path.c_str());
+		gen->rollback();
 
-				objectFile.unlock();
+		objectFile.seek(0L);
 
-				return false;
-			}
-		}
-		else
-		{
-			DEBUG_MSG("Unknown attribute type for object %s", path.c_str());
+		return false;
+	}
 
-			objectFile.unlock();
+	fileGen = newGen;
+	fileSize = newSize;
 
-			return false;
-		}
+	return true;
+}
+
+// Write the record of one attribute; a NULL value records its deletion
+bool ObjectFile::writeRecord(File &objectFile, CK_ATTRIBUTE_TYPE type, OSAttribute* value)
+{
+	unsigned long p11AttrType = type;
+
+	if (!objectFile.writeULong(p11AttrType))
+	{
+		return false;
 	}
 
-	objectFile.unlock();
+	if (value == NULL)
+	{
+		return objectFile.writeULong(DELETED_ATTR);
+	}
 
-	return true;
+	return writeValue(objectFile, *value);
 }
 
 // Write the object to background storage
@@ -674,9 +1092,9 @@ void ObjectFile::store(bool isCommit /* = false */)
 		return;
 	}
 
-	File objectFile(path, umask, true, true, true, false);
+	File* objectFile = lockForWriting();
 
-	if (!objectFile.isValid())
+	if (objectFile == NULL)
 	{
 		DEBUG_MSG("Cannot open object %s for writing", path.c_str());
 
@@ -685,30 +1103,100 @@ void ObjectFile::store(bool isCommit /* = false */)
 		return;
 	}
 
-	objectFile.lock();
-
 	if (!isCommit) {
 		MutexLocker lock(objectMutex);
 		File lockFile(lockpath, umask, false, true, true);
 
-		if (!writeAttributes(objectFile))
-		{
-			valid = false;
+		valid = writeAttributes(*objectFile);
+	}
+	else
+	{
+		valid = writeAttributes(*objectFile);
+	}
 
-			return;
-		}
+	delete objectFile;
+}
+
+// Write a change of one attribute to background storage
+void ObjectFile::storeAttribute(CK_ATTRIBUTE_TYPE type, bool replaced)
+{
+	// Check if we're in the middle of a transaction
+	if (inTransaction)
+	{
+		return;
+	}
+
+	if (!valid)
+	{
+		DEBUG_MSG("Cannot write back an invalid object %s", path.c_str());
+
+		return;
+	}
+
+	File* objectFile = lockForWriting();
+
+	if (objectFile == NULL)
+	{
+		DEBUG_MSG("Cannot open object %s for writing", path.c_str());
+
+		valid = false;
+
+		return;
+	}
+
+	MutexLocker lock(objectMutex);
+	File lockFile(lockpath, umask, false, true, true);
+
+	if (appendAttribute(*objectFile, type))
+	{
+		// The old record and, for a deletion, the deletion record
+		std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator i = attributes.find(type);
+
+		if (replaced) supersededRecords++;
+		if ((i == attributes.end()) || (i->second == NULL)) supersededRecords++;
+
+		objectFile->unlock();
+
+		valid = true;
 	}
 	else
 	{
-		if (!writeAttributes(objectFile))
+		valid = writeAttributes(*objectFile);
+	}
+
+	delete objectFile;
+}
+
+// Open the object file for writing and lock it. Another instance may
+// have replaced the file while this one waited for the lock; the lock
+// is then held on the old file, and the new one is opened instead.
+// Returns NULL if the file cannot be opened
+File* ObjectFile::lockForWriting()
+{
+	for (int attempt = 0; attempt < OBJECTFILE_LOCK_ATTEMPTS; attempt++)
+	{
+		File* objectFile = new File(path, umask, true, true, true, false);
+
+		if (!objectFile->isValid())
 		{
-			valid = false;
+			delete objectFile;
+
+			return NULL;
+		}
+
+		objectFile->lock();
 
-			return;
+		if (objectFile->isCurrent())
+		{
+			return objectFile;
 		}
+
+		delete objectFile;
 	}
 
-	valid = true;
+	ERROR_MSG("Object %s keeps being replaced while it is locked", path.c_str());
+
+	return NULL;
 }
 
 // Discard the cached attributes
@@ -718,6 +1206,9 @@ void ObjectFile::discardAttributes()
 
 	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*> cleanUp = attributes;
 	attributes.clear();
+	bodyTypes.clear();
+
+	revision = nextRevision();
 
 	for (std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator i = cleanUp.begin(); i != cleanUp.end(); i++)
 	{
@@ -767,8 +1258,13 @@ std::string ObjectFile::getLockname() const
 // N.B.: Starting a transaction locks the object!
 bool ObjectFile::startTransaction(Access)
 {
+	// The body stays loaded during the transaction
+	bool pinned = pinBody();
+
 	MutexLocker lock(objectMutex);
 
+	if (pinned) pins--;
+
 	if (inTransaction)
 	{
 		return false;
@@ -39,8 +39,10 @@
 #include "ByteString.h"
 #include "OSAttribute.h"
 #include "MutexFactory.h"
+#include <atomic>
 #include <string>
 #include <map>
+#include <set>
 #include <time.h>
 #include "cryptoki.h"
 #include "OSObject.h"
@@ -51,8 +53,9 @@ class OSToken;
 class ObjectFile : public OSObject
 {
 public:
-	// Constructor
-	ObjectFile(OSToken* parent, const std::string inPath, int inUmask, const std::string inLockpath, bool isNew = false);
+	// Constructor; a lazy object only reads the attributes that objects
+	// are usually looked up by until any other attribute is needed
+	ObjectFile(OSToken* parent, const std::string inPath, int inUmask, const std::string inLockpath, bool isNew = false, bool isLazy = false);
 
 	// Destructor
 	virtual ~ObjectFile();
@@ -78,6 +81,9 @@ public:
 	// The validity state of the object (refresh from disk as a side effect)
 	virtual bool isValid();
 
+	// Retrieve the revision of the object
+	virtual unsigned long getRevision();
+
 	// Invalidate the object file externally; this method is normally
 	// only called by the OSToken class in case an object file has
 	// been deleted.
@@ -109,18 +115,49 @@ public:
 	// call!
 	virtual bool destroyObject();
 
+	// Have tokens load their objects lazily
+	static void setLazyLoading(bool enable);
+	static bool getLazyLoading();
+
+	// Check if the attribute is read by lazy objects before their body is
+	static bool isHeaderAttribute(CK_ATTRIBUTE_TYPE type);
+
 private:
 	// OSToken instances can read valid (vs calling IsValid() from index())
 	friend class OSToken;
 
-	// Refresh the object if necessary
-	void refresh(bool isFirstTime = false);
+	// The body cache drops the bodies of lazy objects
+	friend class BodyCache;
+
+	// Refresh the object if necessary; a lazy object that has no body
+	// only reads the header attributes unless withBody is set
+	void refresh(bool isFirstTime = false, bool withBody = false);
+
+	// Make sure the attribute is loaded, if it exists; returns true if
+	// the body was pinned for it
+	bool needAttribute(CK_ATTRIBUTE_TYPE type);
+
+	// Load the body of a lazy object and keep it until it is unpinned;
+	// returns false if the object is not lazy
+	bool pinBody();
+	void unpinBody(bool pinned);
+
+	// Drop the body of a lazy object; returns false if it is in use
+	bool evictBody();
 
 	// Write the object to background storage
 	void store(bool isCommit = false);
 
-	// Store subroutine
+	// Write a change of one attribute to background storage; the change
+	// is appended to the object file when possible
+	void storeAttribute(CK_ATTRIBUTE_TYPE type, bool replaced);
+
+	// Store subroutines
+	File* lockForWriting();
 	bool writeAttributes(File &objectFile);
+	bool writeObject(File &objectFile, unsigned long newGen);
+	bool appendAttribute(File &objectFile, CK_ATTRIBUTE_TYPE type);
+	bool writeRecord(File &objectFile, CK_ATTRIBUTE_TYPE type, OSAttribute* value);
 
 	// Discard the cached attributes
 	void discardAttributes();
@@ -141,6 +178,30 @@ private:
 	// The object's validity state
 	bool valid;
 
+	// The object file as this instance last read or wrote it: its
+	// generation number, its size, whether it is in the record format
+	// and how many of its records have been superseded
+	unsigned long fileGen;
+	long fileSize;
+	bool isRecordFormat;
+	unsigned long supersededRecords;
+
+	// The revision of the cached attributes
+	unsigned long revision;
+
+	// Whether the object is lazy and has its body loaded, the attributes
+	// in the body when it is not, and when the body was last used
+	bool lazy;
+	bool bodyLoaded;
+	std::set<CK_ATTRIBUTE_TYPE> bodyTypes;
+	std::atomic<unsigned long> lastUse;
+
+	// The number of uses of the body under way; it is not dropped meanwhile
+	unsigned long pins;
+
+	// Whether tokens load their objects lazily
+	static bool lazyLoading;
+
 	// The token this object is associated with
 	OSToken* token;
 
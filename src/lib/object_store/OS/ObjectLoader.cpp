@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ ObjectLoader.cpp
+
+ Loads tokens and objects in parallel.
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "ObjectLoader.h"
+#include <system_error>
+
+// The configured number of threads
+unsigned long ObjectLoader::threads = DEFAULT_OBJECTSTORE_LOAD_THREADS;
+
+// The loader of the process
+ObjectLoader* ObjectLoader::active = NULL;
+
+// Set the number of threads that load the object store
+/*static*/ void ObjectLoader::setThreads(unsigned long n)
+{
+	threads = n;
+}
+
+// The number of threads a new loader uses
+/*static*/ unsigned long ObjectLoader::getThreads()
+{
+	if (threads > 0)
+	{
+		return threads;
+	}
+
+	unsigned long processors = std::thread::hardware_concurrency();
+
+	return (processors > 0) ? processors : 1;
+}
+
+// Constructor
+ObjectLoader::ObjectLoader()
+{
+	stopping = false;
+	queueMutex = MutexFactory::i()->getMutex();
+
+	unsigned long n = getThreads();
+
+	// Only one loader is used at a time, and a single thread does not
+	// need one at all
+	if ((active != NULL) || (n < 2))
+	{
+		return;
+	}
+
+	active = this;
+
+	// The thread that calls run() is one of the loading threads
+	try
+	{
+		for (unsigned long i = 1; i < n; i++)
+		{
+			workers.push_back(std::thread(&ObjectLoader::worker, this));
+		}
+	}
+	catch (const std::system_error& e)
+	{
+		WARNING_MSG("Could not start all object store loading threads: %s", e.what());
+	}
+
+	DEBUG_MSG("Loading the object store with %lu threads", (unsigned long) workers.size() + 1);
+}
+
+// Destructor
+ObjectLoader::~ObjectLoader()
+{
+	{
+		MutexLocker lock(queueMutex);
+
+		stopping = true;
+	}
+
+	queueChanged.notify_all();
+
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+
+	if (active == this)
+	{
+		active = NULL;
+	}
+
+	MutexFactory::i()->recycleMutex(queueMutex);
+}
+
+// Run the jobs and return once they have all completed
+/*static*/ void ObjectLoader::run(std::vector<Job>& jobs)
+{
+	ObjectLoader* loader = active;
+
+	// The loader outlives the jobs of the thread that created it, and
+	// other threads only get here from within such jobs
+	if ((loader == NULL) || (jobs.size() < 2))
+	{
+		for (size_t i = 0; i < jobs.size(); i++)
+		{
+			jobs[i]();
+		}
+
+		return;
+	}
+
+	loader->execute(jobs);
+}
+
+// Queue the jobs and help running them until they have completed
+void ObjectLoader::execute(std::vector<Job>& jobs)
+{
+	Group group;
+	group.remaining = jobs.size();
+
+	std::unique_lock<Mutex> lock(*queueMutex);
+
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		Task task;
+		task.job = &jobs[i];
+		task.group = &group;
+
+		queue.push_back(task);
+	}
+
+	queueChanged.notify_all();
+
+	// Jobs of other calls may be run meanwhile; they complete just the same
+	while (group.remaining > 0)
+	{
+		if (!queue.empty())
+		{
+			runTask(lock);
+		}
+		else
+		{
+			queueChanged.wait(lock);
+		}
+	}
+}
+
+// Run the first queued job
+void ObjectLoader::runTask(std::unique_lock<Mutex>& lock)
+{
+	Task task = queue.front();
+	queue.pop_front();
+
+	lock.unlock();
+	(*task.job)();
+	lock.lock();
+
+	if (--task.group->remaining == 0)
+	{
+		queueChanged.notify_all();
+	}
+}
+
+// Worker thread
+void ObjectLoader::worker()
+{
+	std::unique_lock<Mutex> lock(*queueMutex);
+
+	for (;;)
+	{
+		if (!queue.empty())
+		{
+			runTask(lock);
+		}
+		else if (stopping)
+		{
+			return;
+		}
+		else
+		{
+			queueChanged.wait(lock);
+		}
+	}
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ ObjectLoader.h
+
+ Loads tokens and objects in parallel. While an ObjectLoader exists, its
+ worker threads run the jobs passed to run() from any thread; the thread
+ that calls run() works along until its own jobs have completed, so jobs
+ can start jobs of their own (like a token that loads its objects).
+ Without a loader, run() simply runs the jobs one after the other; this is
+ also the case when the loader may use a single thread only, like when the
+ application does not let the library create threads.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_OBJECTLOADER_H
+#define _SOFTHSM_V2_OBJECTLOADER_H
+
+#include "config.h"
+#include "MutexFactory.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// The default number of threads that load the object store; 0 means one
+// per processor
+#define DEFAULT_OBJECTSTORE_LOAD_THREADS 0
+
+class ObjectLoader
+{
+public:
+	// A job loads one token or object; it must not throw
+	typedef std::function<void()> Job;
+
+	// Starts the worker threads and makes this the loader of the process
+	ObjectLoader();
+
+	// Stops the worker threads
+	virtual ~ObjectLoader();
+
+	// Run the jobs and return once they have all completed
+	static void run(std::vector<Job>& jobs);
+
+	// Set the number of threads that load the object store, including the
+	// one that creates the loader; 0 means one per processor. This is set
+	// while no loader exists.
+	static void setThreads(unsigned long n);
+
+	// The number of threads a new loader uses
+	static unsigned long getThreads();
+
+private:
+	// The jobs of one run() call that have not completed
+	struct Group
+	{
+		size_t remaining;
+	};
+
+	struct Task
+	{
+		Job* job;
+		Group* group;
+	};
+
+	// Queue the jobs and help running them until they have completed
+	void execute(std::vector<Job>& jobs);
+
+	// Run the first queued job; called and returns with the lock held
+	void runTask(std::unique_lock<Mutex>& lock);
+
+	// Worker thread
+	void worker();
+
+	// The configured number of threads
+	static unsigned long threads;
+
+	// The loader of the process, if any. It is set before its workers start
+	// and cleared after they have stopped, by the thread that loads the
+	// object store before the application can call in.
+	static ObjectLoader* active;
+
+	Mutex* queueMutex;
+	std::condition_variable_any queueChanged;
+	std::deque<Task> queue;
+	bool stopping;
+
+	std::vector<std::thread> workers;
+};
+
+#endif // !_SOFTHSM_V2_OBJECTLOADER_H
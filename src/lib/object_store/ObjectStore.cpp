@@ -40,6 +40,7 @@
 #include "ObjectStoreToken.h"
 #include "OSPathSep.h"
 #include "UUID.h"
+#include "ObjectLoader.h"
 #include <stdio.h>
 
 // Constructor
@@ -65,14 +66,31 @@ ObjectStore::ObjectStore(std::string inStorePath, int inUmask)
 	// Assume that all subdirectories are tokens
 	std::vector<std::string> dirs = storeDir.getSubDirs();
 
-	for (std::vector<std::string>::iterator i = dirs.begin(); i != dirs.end(); i++)
+	// Load the tokens, and their objects, in parallel
+	std::vector<ObjectStoreToken*> loaded(dirs.size(), NULL);
+	std::vector<ObjectLoader::Job> jobs;
+
+	for (size_t n = 0; n < dirs.size(); n++)
+	{
+		jobs.push_back([this, n, &dirs, &loaded]
+		{
+			loaded[n] = ObjectStoreToken::accessToken(storePath, dirs[n], umask);
+		});
+	}
+
+	{
+		ObjectLoader loader;
+
+		ObjectLoader::run(jobs);
+	}
+
+	for (size_t n = 0; n < dirs.size(); n++)
 	{
-		// Create a token instance
-		ObjectStoreToken* token = ObjectStoreToken::accessToken(storePath, *i, umask);
+		ObjectStoreToken* token = loaded[n];
 
 		if (!token->isValid())
 		{
-			ERROR_MSG("Failed to open token %s", i->c_str());
+			ERROR_MSG("Failed to open token %s", dirs[n].c_str());
 
 			delete token;
 
@@ -42,6 +42,11 @@
 #include "DBToken.h"
 #endif
 
+#ifdef HAVE_OBJECTSTORE_BACKEND_LOG
+// LogToken is a concrete implementation of ObjectStoreToken that stores the objects and attributes in a single append-only log file.
+#include "LogToken.h"
+#endif
+
 typedef ObjectStoreToken* (*CreateToken)(const std::string , const std::string , int , const ByteString& , const ByteString& );
 typedef ObjectStoreToken* (*AccessToken)(const std::string &, const std::string &, int);
 
@@ -62,6 +67,13 @@ static AccessToken static_accessToken = reinterpret_cast<AccessToken>(OSToken::a
 		static_createToken = reinterpret_cast<CreateToken>(DBToken::createToken);
 		static_accessToken = reinterpret_cast<AccessToken>(DBToken::accessToken);
 	}
+#endif
+#ifdef HAVE_OBJECTSTORE_BACKEND_LOG
+	else if (backend == "log")
+	{
+		static_createToken = reinterpret_cast<CreateToken>(LogToken::createToken);
+		static_accessToken = reinterpret_cast<AccessToken>(LogToken::accessToken);
+	}
 #endif
 	else
 	{
@@ -72,6 +84,16 @@ static AccessToken static_accessToken = reinterpret_cast<AccessToken>(OSToken::a
 	return true;
 }
 
+// Select whether the backends may use threads of their own
+/*static*/ void ObjectStoreToken::setBackgroundThreads(bool enabled)
+{
+#ifdef HAVE_OBJECTSTORE_BACKEND_LOG
+	ObjectLog::setCompactionThread(enabled);
+#else
+	(void) enabled;
+#endif
+}
+
 ObjectStoreToken* ObjectStoreToken::createToken(const std::string basePath, const std::string tokenDir, int umask, const ByteString& label, const ByteString& serial)
 {
 	return static_createToken(basePath, tokenDir, umask, label, serial);
@@ -44,6 +44,10 @@ public:
 	// Select the type of backend to use for storing token objects.
 	static bool selectBackend(const std::string& backend);
 
+	// Select whether the backends may do their housekeeping in threads of
+	// their own
+	static void setBackgroundThreads(bool enabled);
+
 	// Create a new token
 	static ObjectStoreToken* createToken(const std::string basePath, const std::string tokenDir, int umask, const ByteString& label, const ByteString& serial);
 
@@ -74,6 +78,11 @@ public:
 	// Retrieve the token serial
 	virtual bool getTokenSerial(ByteString& serial) = 0;
 
+	// Get and set the record of the Mizar key slots claimed by the token;
+	// the record is empty if the token has not claimed any
+	virtual bool getKeySlots(ByteString& keySlots) = 0;
+	virtual bool setKeySlots(const ByteString& keySlots) = 0;
+
 	// Retrieve objects
 	virtual std::set<OSObject*> getObjects() = 0;
 
@@ -43,6 +43,7 @@ SessionObject::SessionObject(SessionObjectStore* inParent, CK_SLOT_ID inSlotID,
 	objectMutex = MutexFactory::i()->getMutex();
 	valid = (objectMutex != NULL);
 	parent = inParent;
+	revision = nextRevision();
 }
 
 // Destructor
@@ -188,6 +189,8 @@ bool SessionObject::setAttribute(CK_ATTRIBUTE_TYPE type, const OSAttribute& attr
 
 	attributes[type] = new OSAttribute(attribute);
 
+	revision = nextRevision();
+
 	return true;
 }
 
@@ -213,6 +216,8 @@ bool SessionObject::deleteAttribute(CK_ATTRIBUTE_TYPE type)
 	delete attributes[type];
 	attributes.erase(type);
 
+	revision = nextRevision();
+
 	return true;
 }
 
@@ -222,6 +227,14 @@ bool SessionObject::isValid()
     return valid;
 }
 
+// Retrieve the revision of the object
+unsigned long SessionObject::getRevision()
+{
+	MutexLocker lock(objectMutex);
+
+	return revision;
+}
+
 bool SessionObject::hasSlotID(CK_SLOT_ID inSlotID)
 {
     return slotID == inSlotID;
@@ -285,6 +298,8 @@ void SessionObject::discardAttributes()
 	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*> cleanUp = attributes;
 	attributes.clear();
 
+	revision = nextRevision();
+
 	for (std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator i = cleanUp.begin(); i != cleanUp.end(); i++)
 	{
 		if (i->second == NULL)
@@ -75,6 +75,9 @@ public:
 	// The validity state of the object
 	virtual bool isValid();
 
+	// Retrieve the revision of the object
+	virtual unsigned long getRevision();
+
 	bool hasSlotID(CK_SLOT_ID inSlotID);
 
 	// Called by the session object store when a session is closed. If it's the
@@ -112,6 +115,9 @@ private:
 	// The object's validity state
 	bool valid;
 
+	// The revision of the object's attributes
+	unsigned long revision;
+
 	// Mutex object for thread-safeness
 	Mutex* objectMutex;
 
@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ BodyCacheTests.cpp
+
+ Contains test cases to test the budget for the attribute bodies of lazily
+ loaded object files
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <cppunit/extensions/HelperMacros.h>
+#include "BodyCacheTests.h"
+#include "BodyCache.h"
+#include "MutexFactory.h"
+#include "ObjectFile.h"
+#include "OSAttribute.h"
+#include "cryptoki.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(BodyCacheTests);
+
+// The number of objects and the size of their values
+#define TEST_OBJECTS 8
+#define TEST_VALUE_SIZE 1000
+
+// FIXME: all pathnames in this file are *NIX/BSD specific
+
+static std::string objectPath(int n)
+{
+	return "testdir/test" + std::to_string(n) + ".object";
+}
+
+void BodyCacheTests::setUp()
+{
+#ifndef _WIN32
+	int rv = system("rm -rf testdir");
+#else
+	int rv = system("rmdir /s /q testdir 2> nul");
+#endif
+	(void) rv;
+
+	CPPUNIT_ASSERT(!system("mkdir testdir"));
+
+	ByteString value;
+	value.resize(TEST_VALUE_SIZE);
+	memset(&value[0], 0x5A, value.size());
+
+	for (int n = 0; n < TEST_OBJECTS; n++)
+	{
+		ObjectFile testObject(NULL, objectPath(n), DEFAULT_UMASK, "testdir/test.lock", true);
+
+		CPPUNIT_ASSERT(testObject.startTransaction(ObjectFile::ReadWrite));
+		CPPUNIT_ASSERT(testObject.setAttribute(CKA_CLASS, OSAttribute((unsigned long) CKO_DATA)));
+		CPPUNIT_ASSERT(testObject.setAttribute(CKA_VALUE, OSAttribute(value)));
+		CPPUNIT_ASSERT(testObject.commitTransaction());
+	}
+}
+
+void BodyCacheTests::tearDown()
+{
+	BodyCache::i()->setBudget(DEFAULT_OBJECTSTORE_LAZY_BUDGET * 1024);
+
+#ifndef _WIN32
+	CPPUNIT_ASSERT(!system("rm -rf testdir"));
+#else
+	CPPUNIT_ASSERT(!system("rmdir /s /q testdir 2> nul"));
+#endif
+}
+
+void BodyCacheTests::testBudget()
+{
+	std::vector<ObjectFile*> objects;
+
+	for (int n = 0; n < TEST_OBJECTS; n++)
+	{
+		objects.push_back(new ObjectFile(NULL, objectPath(n), DEFAULT_UMASK, "testdir/test.lock", false, true));
+	}
+
+	size_t loaded = BodyCache::i()->getCount();
+	size_t used = BodyCache::i()->getSize();
+
+	// Without a limit every body that is used stays
+	for (int n = 0; n < TEST_OBJECTS; n++)
+	{
+		CPPUNIT_ASSERT_EQUAL((size_t) TEST_VALUE_SIZE, objects[n]->getByteStringValue(CKA_VALUE).size());
+	}
+
+	CPPUNIT_ASSERT_EQUAL(loaded + TEST_OBJECTS, BodyCache::i()->getCount());
+
+	size_t bodySize = (BodyCache::i()->getSize() - used) / TEST_OBJECTS;
+
+	CPPUNIT_ASSERT(bodySize >= TEST_VALUE_SIZE);
+
+	// A budget for three bodies drops the others
+	BodyCache::i()->setBudget(used + 3 * bodySize);
+
+	CPPUNIT_ASSERT_EQUAL(loaded + 3, BodyCache::i()->getCount());
+	CPPUNIT_ASSERT(BodyCache::i()->getSize() <= BodyCache::i()->getBudget());
+
+	// The bodies are read again when needed, within the budget
+	for (int n = 0; n < TEST_OBJECTS; n++)
+	{
+		CPPUNIT_ASSERT_EQUAL((size_t) TEST_VALUE_SIZE, objects[n]->getByteStringValue(CKA_VALUE).size());
+		CPPUNIT_ASSERT(BodyCache::i()->getSize() <= BodyCache::i()->getBudget());
+	}
+
+	// Objects that are gone do not count
+	for (int n = 0; n < TEST_OBJECTS; n++)
+	{
+		delete objects[n];
+	}
+
+	CPPUNIT_ASSERT_EQUAL(loaded, BodyCache::i()->getCount());
+	CPPUNIT_ASSERT_EQUAL(used, BodyCache::i()->getSize());
+}
+
+void BodyCacheTests::testLeastRecentlyUsed()
+{
+	std::vector<ObjectFile*> objects;
+
+	for (int n = 0; n < TEST_OBJECTS; n++)
+	{
+		objects.push_back(new ObjectFile(NULL, objectPath(n), DEFAULT_UMASK, "testdir/test.lock", false, true));
+		CPPUNIT_ASSERT(objects[n]->getByteStringValue(CKA_VALUE).size() == TEST_VALUE_SIZE);
+	}
+
+	size_t bodySize = BodyCache::i()->getSize() / BodyCache::i()->getCount();
+
+	// Use the first object again, then make room for two bodies only
+	CPPUNIT_ASSERT(objects[0]->getByteStringValue(CKA_VALUE).size() == TEST_VALUE_SIZE);
+
+	size_t loaded = BodyCache::i()->getCount();
+
+	BodyCache::i()->setBudget(BodyCache::i()->getSize() - (TEST_OBJECTS - 2) * bodySize);
+
+	CPPUNIT_ASSERT_EQUAL(loaded - (TEST_OBJECTS - 2), BodyCache::i()->getCount());
+
+	// The first and the last object were used most recently; using them
+	// loads nothing
+	CPPUNIT_ASSERT(objects[0]->getByteStringValue(CKA_VALUE).size() == TEST_VALUE_SIZE);
+	CPPUNIT_ASSERT(objects[TEST_OBJECTS - 1]->getByteStringValue(CKA_VALUE).size() == TEST_VALUE_SIZE);
+	CPPUNIT_ASSERT_EQUAL(loaded - (TEST_OBJECTS - 2), BodyCache::i()->getCount());
+
+	// Dropped bodies leave the header
+	CPPUNIT_ASSERT_EQUAL((unsigned long) CKO_DATA, objects[1]->getUnsignedLongValue(CKA_CLASS, CKO_VENDOR_DEFINED));
+	CPPUNIT_ASSERT(objects[1]->attributeExists(CKA_VALUE));
+	CPPUNIT_ASSERT_EQUAL(loaded - (TEST_OBJECTS - 2), BodyCache::i()->getCount());
+
+	for (int n = 0; n < TEST_OBJECTS; n++)
+	{
+		delete objects[n];
+	}
+}
+
+void BodyCacheTests::testReset()
+{
+	// An initialisation without locking
+	BodyCache::reset();
+	MutexFactory::i()->disable();
+
+	ObjectFile* object = new ObjectFile(NULL, objectPath(0), DEFAULT_UMASK, "testdir/test.lock", false, true);
+	CPPUNIT_ASSERT(object->getByteStringValue(CKA_VALUE).size() == TEST_VALUE_SIZE);
+	CPPUNIT_ASSERT_EQUAL((size_t) 1, BodyCache::i()->getCount());
+	delete object;
+
+	// The next one locks with the mutex it takes then, and starts with the
+	// default budget
+	BodyCache::i()->setBudget(TEST_VALUE_SIZE);
+	BodyCache::reset();
+	MutexFactory::i()->enable();
+
+	CPPUNIT_ASSERT_EQUAL((size_t) DEFAULT_OBJECTSTORE_LAZY_BUDGET * 1024, BodyCache::i()->getBudget());
+
+	object = new ObjectFile(NULL, objectPath(0), DEFAULT_UMASK, "testdir/test.lock", false, true);
+	CPPUNIT_ASSERT(object->getByteStringValue(CKA_VALUE).size() == TEST_VALUE_SIZE);
+	CPPUNIT_ASSERT_EQUAL((size_t) 1, BodyCache::i()->getCount());
+	delete object;
+
+	CPPUNIT_ASSERT_EQUAL((size_t) 0, BodyCache::i()->getCount());
+}
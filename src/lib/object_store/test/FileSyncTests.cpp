@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ FileSyncTests.cpp
+
+ Contains test cases to test the group commit of object file writes
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include <cppunit/extensions/HelperMacros.h>
+#include "FileSyncTests.h"
+#include "FileSync.h"
+#include "File.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(FileSyncTests);
+
+// FIXME: all pathnames in this file are *NIX/BSD specific
+
+void FileSyncTests::setUp()
+{
+#ifndef _WIN32
+	int rv = system("rm -rf testdir");
+#else
+	int rv = system("rmdir /s /q testdir 2> nul");
+#endif
+	(void) rv;
+
+	CPPUNIT_ASSERT(!system("mkdir testdir"));
+}
+
+void FileSyncTests::tearDown()
+{
+	CPPUNIT_ASSERT(FileSync::i()->setDurability(DEFAULT_OBJECTSTORE_DURABILITY));
+
+#ifndef _WIN32
+	CPPUNIT_ASSERT(!system("rm -rf testdir"));
+#else
+	CPPUNIT_ASSERT(!system("rmdir /s /q testdir 2> nul"));
+#endif
+}
+
+void FileSyncTests::testDurability()
+{
+	FileSync* fileSync = FileSync::i();
+
+	CPPUNIT_ASSERT(fileSync->getDurability() == FileSync::DURABILITY_GROUP);
+
+	File testFile("testdir/test.object", DEFAULT_UMASK, true, true, true);
+
+	CPPUNIT_ASSERT(testFile.isValid());
+	CPPUNIT_ASSERT(testFile.writeULong(1));
+
+	// Nothing is flushed to disk
+	CPPUNIT_ASSERT(fileSync->setDurability("none"));
+	CPPUNIT_ASSERT(fileSync->getDurability() == FileSync::DURABILITY_NONE);
+
+	unsigned long rounds = fileSync->getRounds();
+	CPPUNIT_ASSERT(testFile.sync());
+	CPPUNIT_ASSERT(fileSync->syncDirectory("testdir"));
+	CPPUNIT_ASSERT_EQUAL(rounds, fileSync->getRounds());
+
+	// Every request is flushed on its own
+	CPPUNIT_ASSERT(fileSync->setDurability("full"));
+	CPPUNIT_ASSERT(testFile.writeULong(2));
+	CPPUNIT_ASSERT(testFile.sync());
+	CPPUNIT_ASSERT(fileSync->syncDirectory("testdir"));
+	CPPUNIT_ASSERT_EQUAL(rounds + 2, fileSync->getRounds());
+
+	// Without other sessions a request is a round of its own
+	CPPUNIT_ASSERT(fileSync->setDurability("group"));
+	CPPUNIT_ASSERT(testFile.sync());
+	CPPUNIT_ASSERT_EQUAL(rounds + 3, fileSync->getRounds());
+
+	// Unknown levels are refused and leave the level as it was
+	CPPUNIT_ASSERT(!fileSync->setDurability("sometimes"));
+	CPPUNIT_ASSERT(fileSync->getDurability() == FileSync::DURABILITY_GROUP);
+
+	// A failed flush is reported
+	CPPUNIT_ASSERT(!fileSync->syncDirectory("testdir/missing"));
+}
+
+void FileSyncTests::testGroupCommit()
+{
+	const int threads = 8;
+	const int writes = 32;
+
+	std::vector<std::thread> writers;
+	std::vector<int> failures(threads, 0);
+
+	unsigned long rounds = FileSync::i()->getRounds();
+
+	for (int t = 0; t < threads; t++)
+	{
+		writers.push_back(std::thread([t, &failures]
+		{
+			std::string path = "testdir/test" + std::to_string(t) + ".object";
+			File testFile(path, DEFAULT_UMASK, true, true, true);
+
+			for (int i = 0; i < writes; i++)
+			{
+				if (!testFile.writeULong(i) || !testFile.sync() ||
+				    !FileSync::i()->syncDirectory("testdir"))
+				{
+					failures[t]++;
+				}
+			}
+		}));
+	}
+
+	for (size_t t = 0; t < writers.size(); t++)
+	{
+		writers[t].join();
+	}
+
+	for (int t = 0; t < threads; t++)
+	{
+		CPPUNIT_ASSERT_EQUAL(0, failures[t]);
+	}
+
+	// Requests that arrive during a round share the next one
+	unsigned long used = FileSync::i()->getRounds() - rounds;
+
+	CPPUNIT_ASSERT(used > 0);
+	CPPUNIT_ASSERT(used <= (unsigned long) (threads * writes * 2));
+}
+
+void FileSyncTests::testReset()
+{
+	CPPUNIT_ASSERT(FileSync::i()->setDurability("none"));
+	CPPUNIT_ASSERT(FileSync::i()->syncDirectory("testdir"));
+
+	// The next instance starts afresh
+	FileSync::reset();
+	CPPUNIT_ASSERT(FileSync::i()->getDurability() == FileSync::DURABILITY_GROUP);
+	CPPUNIT_ASSERT(FileSync::i()->getRounds() == 0);
+}
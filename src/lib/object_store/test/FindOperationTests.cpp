@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ FindOperationTests.cpp
+
+ Contains test cases to test the find operation
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "FindOperationTests.h"
+#include "FindOperation.h"
+#include "SessionObject.h"
+#include "cryptoki.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(FindOperationTests);
+
+void FindOperationTests::setUp()
+{
+}
+
+void FindOperationTests::tearDown()
+{
+}
+
+void FindOperationTests::testHandles()
+{
+	FindOperation* findOp = FindOperation::create();
+
+	CPPUNIT_ASSERT(findOp != NULL);
+
+	std::set<CK_OBJECT_HANDLE> handles;
+	handles.insert(1);
+	handles.insert(2);
+	handles.insert(3);
+	findOp->setHandles(handles);
+
+	CK_OBJECT_HANDLE retrieved[2];
+
+	CPPUNIT_ASSERT(findOp->retrieveHandles(retrieved, 2) == 2);
+	CPPUNIT_ASSERT(retrieved[0] == 1);
+	CPPUNIT_ASSERT(retrieved[1] == 2);
+	CPPUNIT_ASSERT(findOp->eraseHandles(0, 2) == 2);
+	CPPUNIT_ASSERT(findOp->retrieveHandles(retrieved, 2) == 1);
+	CPPUNIT_ASSERT(retrieved[0] == 3);
+
+	findOp->recycle();
+}
+
+void FindOperationTests::testCursor()
+{
+	FindOperation* findOp = FindOperation::create();
+	SessionObject first(NULL, 1, 1);
+	SessionObject second(NULL, 1, 1);
+
+	std::set<OSObject*> objects;
+	objects.insert(&first);
+	objects.insert(&second);
+	findOp->setObjects(objects);
+
+	// Every object is returned exactly once
+	std::set<OSObject*> seen;
+	OSObject* object;
+
+	CPPUNIT_ASSERT(findOp->nextObject(object));
+	seen.insert(object);
+	CPPUNIT_ASSERT(findOp->nextObject(object));
+	seen.insert(object);
+	CPPUNIT_ASSERT(!findOp->nextObject(object));
+	CPPUNIT_ASSERT(seen == objects);
+
+	// An empty search has no objects
+	findOp->setObjects(std::set<OSObject*>());
+	CPPUNIT_ASSERT(!findOp->nextObject(object));
+
+	findOp->recycle();
+}
+
+void FindOperationTests::testTemplate()
+{
+	FindOperation* findOp = FindOperation::create();
+
+	CPPUNIT_ASSERT(findOp->getTemplate() == NULL_PTR);
+	CPPUNIT_ASSERT(findOp->getTemplateCount() == 0);
+
+	CK_OBJECT_CLASS objClass = CKO_SECRET_KEY;
+	char label[] = "label";
+	CK_ATTRIBUTE pTemplate[] = {
+		{ CKA_CLASS, &objClass, sizeof(objClass) },
+		{ CKA_LABEL, label, 5 },
+		{ CKA_ID, NULL_PTR, 0 }
+	};
+
+	findOp->setTemplate(pTemplate, 3);
+
+	// The operation keeps its own copy of the values
+	objClass = CKO_DATA;
+	memset(label, 0, sizeof(label));
+
+	CK_ATTRIBUTE_PTR copy = findOp->getTemplate();
+
+	CPPUNIT_ASSERT(findOp->getTemplateCount() == 3);
+	CPPUNIT_ASSERT(copy[0].type == CKA_CLASS);
+	CPPUNIT_ASSERT(copy[0].ulValueLen == sizeof(CK_OBJECT_CLASS));
+	CPPUNIT_ASSERT(*(CK_OBJECT_CLASS*)copy[0].pValue == CKO_SECRET_KEY);
+	CPPUNIT_ASSERT(copy[1].type == CKA_LABEL);
+	CPPUNIT_ASSERT(copy[1].ulValueLen == 5);
+	CPPUNIT_ASSERT(!memcmp(copy[1].pValue, "label", 5));
+	CPPUNIT_ASSERT(copy[2].type == CKA_ID);
+	CPPUNIT_ASSERT(copy[2].pValue == NULL_PTR);
+	CPPUNIT_ASSERT(copy[2].ulValueLen == 0);
+
+	findOp->recycle();
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ GenerationTests.cpp
+
+ Contains test cases to test the generation number handling
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+# include <sys/time.h>
+#endif
+#include <cppunit/extensions/HelperMacros.h>
+#include "GenerationTests.h"
+#include "Generation.h"
+#include "File.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(GenerationTests);
+
+// FIXME: all pathnames in this file are *NIX/BSD specific
+
+void GenerationTests::setUp()
+{
+#ifndef _WIN32
+	int rv = system("rm -rf testdir");
+#else
+	int rv = system("rmdir /s /q testdir 2> nul");
+#endif
+	(void) rv;
+
+	CPPUNIT_ASSERT(!system("mkdir testdir"));
+}
+
+void GenerationTests::tearDown()
+{
+	Generation::setCheckInterval(DEFAULT_GENERATION_CHECK_INTERVAL);
+
+#ifndef _WIN32
+	CPPUNIT_ASSERT(!system("rm -rf testdir"));
+#else
+	CPPUNIT_ASSERT(!system("rmdir /s /q testdir 2> nul"));
+#endif
+}
+
+void GenerationTests::testToken()
+{
+	// Two instances on the same file act like two processes
+	Generation* gen1 = Generation::create("testdir/generation", DEFAULT_UMASK, true);
+	Generation* gen2 = Generation::create("testdir/generation", DEFAULT_UMASK, true);
+
+	CPPUNIT_ASSERT(gen1 != NULL);
+	CPPUNIT_ASSERT(gen2 != NULL);
+
+	// Both start from the value on disk
+	CPPUNIT_ASSERT(!gen1->wasUpdated());
+	CPPUNIT_ASSERT(!gen2->wasUpdated());
+
+	// An update by one is seen by the other, once
+	gen1->update();
+	gen1->commit();
+
+	CPPUNIT_ASSERT(!gen1->wasUpdated());
+	CPPUNIT_ASSERT(gen2->wasUpdated());
+	CPPUNIT_ASSERT(!gen2->wasUpdated());
+
+	delete gen1;
+	delete gen2;
+}
+
+#ifndef _WIN32
+void GenerationTests::testObjectCached()
+{
+	writeValue("testdir/test.object", 5);
+	makeOld("testdir/test.object");
+
+	Generation* gen = Generation::create("testdir/test.object", DEFAULT_UMASK);
+
+	CPPUNIT_ASSERT(gen != NULL);
+
+	gen->set(4);
+	CPPUNIT_ASSERT(gen->wasUpdated());
+
+	// The first check reads the file, the second one only looks at it
+	gen->set(5);
+	CPPUNIT_ASSERT(!gen->wasUpdated());
+	CPPUNIT_ASSERT(!gen->wasUpdated());
+
+	// A change by another process is still seen
+	writeValue("testdir/test.object", 6);
+
+	CPPUNIT_ASSERT(gen->wasUpdated());
+
+	// A recently modified file is not trusted on its metadata alone
+	gen->set(6);
+	CPPUNIT_ASSERT(!gen->wasUpdated());
+
+	writeValue("testdir/test.object", 7);
+
+	CPPUNIT_ASSERT(gen->wasUpdated());
+
+	delete gen;
+}
+
+void GenerationTests::testCheckInterval()
+{
+	writeValue("testdir/test.object", 5);
+	makeOld("testdir/test.object");
+
+	Generation::setCheckInterval(60000);
+
+	Generation* gen = Generation::create("testdir/test.object", DEFAULT_UMASK);
+
+	CPPUNIT_ASSERT(gen != NULL);
+
+	gen->set(5);
+	CPPUNIT_ASSERT(!gen->wasUpdated());
+
+	// Within the interval the file is not looked at
+	writeValue("testdir/test.object", 6);
+
+	CPPUNIT_ASSERT(!gen->wasUpdated());
+
+	// Without an interval the change is seen
+	Generation::setCheckInterval(0);
+
+	CPPUNIT_ASSERT(gen->wasUpdated());
+
+	delete gen;
+}
+
+void GenerationTests::makeOld(std::string path)
+{
+	struct timeval times[2];
+
+	CPPUNIT_ASSERT(!gettimeofday(&times[0], NULL));
+	times[0].tv_sec -= 3600;
+	times[1] = times[0];
+
+	CPPUNIT_ASSERT(!utimes(path.c_str(), times));
+}
+#endif
+
+void GenerationTests::writeValue(std::string path, unsigned long value)
+{
+	File file(path, DEFAULT_UMASK, true, true, true);
+
+	CPPUNIT_ASSERT(file.isValid());
+	CPPUNIT_ASSERT(file.lock());
+	CPPUNIT_ASSERT(file.writeULong(value));
+	CPPUNIT_ASSERT(file.unlock());
+}
@@ -0,0 +1,497 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ LogTokenTests.cpp
+
+ Contains test cases to test the object log token implementation
+ *****************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "LogTokenTests.h"
+#include "LogToken.h"
+#include "ObjectLog.h"
+#include "OSAttributes.h"
+#include "FileSync.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(test_a_logtoken);
+
+void test_a_logtoken::setUp()
+{
+	CPPUNIT_ASSERT(!system("mkdir testdir"));
+}
+
+void test_a_logtoken::tearDown()
+{
+	CPPUNIT_ASSERT(!system("rm -rf testdir"));
+
+	ObjectLog::setCompactionThread(true);
+	CPPUNIT_ASSERT(FileSync::i()->setDurability(DEFAULT_OBJECTSTORE_DURABILITY));
+}
+
+void test_a_logtoken::should_be_creatable()
+{
+	ByteString label = "40414243"; // ABCD
+	ByteString serial = "0102030405060708";
+
+	ObjectStoreToken* newToken = new LogToken("testdir", "newToken", DEFAULT_UMASK, label, serial);
+
+	CPPUNIT_ASSERT(newToken != NULL);
+	CPPUNIT_ASSERT(newToken->isValid());
+
+	delete newToken;
+
+	// Refuses to overwrite an existing token
+	newToken = new LogToken("testdir", "newToken", DEFAULT_UMASK, label, serial);
+	CPPUNIT_ASSERT(!newToken->isValid());
+	delete newToken;
+
+	newToken = new LogToken("testdir", "newToken", DEFAULT_UMASK);
+	CPPUNIT_ASSERT(newToken->isValid());
+
+	ByteString retrievedLabel, retrievedSerial;
+	CK_ULONG flags;
+
+	CPPUNIT_ASSERT(newToken->getTokenLabel(retrievedLabel));
+	CPPUNIT_ASSERT(newToken->getTokenSerial(retrievedSerial));
+	CPPUNIT_ASSERT(newToken->getTokenFlags(flags));
+	CPPUNIT_ASSERT(retrievedLabel == label);
+	CPPUNIT_ASSERT(retrievedSerial == serial);
+	CPPUNIT_ASSERT(flags & CKF_TOKEN_INITIALIZED);
+
+	delete newToken;
+}
+
+void test_a_logtoken::should_support_pin_setting_getting()
+{
+	ByteString label = "40414243"; // ABCD
+	ByteString serial = "0102030405060708";
+
+	ObjectStoreToken* newToken = new LogToken("testdir", "pinToken", DEFAULT_UMASK, label, serial);
+	CPPUNIT_ASSERT(newToken->isValid());
+
+	ByteString soPIN = "0102030405060708090A0B0C0D0E0F";
+	ByteString userPIN = "0F0E0D0C0B0A09080706050403020100";
+	ByteString retrieved;
+	CK_ULONG flags;
+
+	CPPUNIT_ASSERT(!newToken->getUserPIN(retrieved));
+	CPPUNIT_ASSERT(newToken->setSOPIN(soPIN));
+	CPPUNIT_ASSERT(newToken->setUserPIN(userPIN));
+
+	CPPUNIT_ASSERT(newToken->getTokenFlags(flags));
+	CPPUNIT_ASSERT(flags & CKF_USER_PIN_INITIALIZED);
+	CPPUNIT_ASSERT(!(flags & CKF_SO_PIN_LOCKED));
+
+	delete newToken;
+
+	newToken = new LogToken("testdir", "pinToken", DEFAULT_UMASK);
+	CPPUNIT_ASSERT(newToken->getSOPIN(retrieved) && retrieved == soPIN);
+	CPPUNIT_ASSERT(newToken->getUserPIN(retrieved) && retrieved == userPIN);
+
+	// Resetting drops the user PIN and the objects
+	CPPUNIT_ASSERT(newToken->createObject() != NULL);
+	CPPUNIT_ASSERT(newToken->resetToken(ByteString("41424344")));
+	CPPUNIT_ASSERT(!newToken->getUserPIN(retrieved));
+	CPPUNIT_ASSERT(newToken->getObjects().empty());
+	CPPUNIT_ASSERT(newToken->getTokenFlags(flags));
+	CPPUNIT_ASSERT(!(flags & CKF_USER_PIN_INITIALIZED));
+	CPPUNIT_ASSERT(newToken->getTokenLabel(retrieved) && retrieved == ByteString("41424344"));
+
+	delete newToken;
+}
+
+void test_a_logtoken::should_store_objects()
+{
+	ByteString label = "40414243"; // ABCD
+	ByteString serial = "0102030405060708";
+
+	ObjectStoreToken* newToken = new LogToken("testdir", "objectToken", DEFAULT_UMASK, label, serial);
+
+	OSObject* object = newToken->createObject();
+	CPPUNIT_ASSERT(object != NULL);
+	CPPUNIT_ASSERT(object->isValid());
+
+	std::set<CK_MECHANISM_TYPE> mechanisms;
+	mechanisms.insert(CKM_RSA_PKCS);
+	mechanisms.insert(CKM_AES_CBC);
+	std::map<CK_ATTRIBUTE_TYPE,OSAttribute> wrapTemplate;
+	wrapTemplate.insert(std::make_pair(CKA_TOKEN, OSAttribute(true)));
+	wrapTemplate.insert(std::make_pair(CKA_VALUE, OSAttribute(ByteString("AABB"))));
+
+	unsigned long revision = object->getRevision();
+
+	CPPUNIT_ASSERT(object->startTransaction(OSObject::ReadWrite));
+	CPPUNIT_ASSERT(object->setAttribute(CKA_TOKEN, OSAttribute(true)));
+	CPPUNIT_ASSERT(object->setAttribute(CKA_CLASS, OSAttribute((unsigned long) CKO_SECRET_KEY)));
+	CPPUNIT_ASSERT(object->setAttribute(CKA_ID, OSAttribute(ByteString("0102"))));
+	CPPUNIT_ASSERT(object->setAttribute(CKA_ALLOWED_MECHANISMS, OSAttribute(mechanisms)));
+	CPPUNIT_ASSERT(object->setAttribute(CKA_WRAP_TEMPLATE, OSAttribute(wrapTemplate)));
+	CPPUNIT_ASSERT(object->setAttribute(CKA_LABEL, OSAttribute(ByteString("AA"))));
+	CPPUNIT_ASSERT(object->deleteAttribute(CKA_LABEL));
+
+	// Changes are visible in the transaction only
+	CPPUNIT_ASSERT(object->getBooleanValue(CKA_TOKEN, false));
+	CPPUNIT_ASSERT(!object->attributeExists(CKA_LABEL));
+	CPPUNIT_ASSERT_EQUAL(object->getRevision(), revision);
+	CPPUNIT_ASSERT(object->commitTransaction());
+	CPPUNIT_ASSERT(object->getRevision() != revision);
+
+	// An aborted transaction leaves the object alone
+	CPPUNIT_ASSERT(object->startTransaction(OSObject::ReadWrite));
+	CPPUNIT_ASSERT(object->setAttribute(CKA_TOKEN, OSAttribute(false)));
+	CPPUNIT_ASSERT(!object->getBooleanValue(CKA_TOKEN, true));
+	CPPUNIT_ASSERT(object->abortTransaction());
+	CPPUNIT_ASSERT(object->getBooleanValue(CKA_TOKEN, false));
+
+	// Outside a transaction changes are written right away
+	CPPUNIT_ASSERT(object->setAttribute(CKA_LABEL, OSAttribute(ByteString("4142"))));
+
+	OSObject* second = newToken->createObject();
+	CPPUNIT_ASSERT(second != NULL);
+	CPPUNIT_ASSERT(newToken->getObjects().size() == 2);
+	CPPUNIT_ASSERT(second->destroyObject());
+	CPPUNIT_ASSERT(!second->isValid());
+	CPPUNIT_ASSERT(newToken->getObjects().size() == 1);
+
+	delete newToken;
+
+	newToken = new LogToken("testdir", "objectToken", DEFAULT_UMASK);
+	std::set<OSObject*> objects = newToken->getObjects();
+	CPPUNIT_ASSERT(objects.size() == 1);
+
+	object = *objects.begin();
+	CPPUNIT_ASSERT(object->getBooleanValue(CKA_TOKEN, false));
+	CPPUNIT_ASSERT_EQUAL(object->getUnsignedLongValue(CKA_CLASS, 0), (unsigned long) CKO_SECRET_KEY);
+	CPPUNIT_ASSERT(object->getByteStringValue(CKA_ID) == ByteString("0102"));
+	CPPUNIT_ASSERT(object->getByteStringValue(CKA_LABEL) == ByteString("4142"));
+	CPPUNIT_ASSERT(object->getAttribute(CKA_ALLOWED_MECHANISMS).getMechanismTypeSetValue() == mechanisms);
+
+	std::map<CK_ATTRIBUTE_TYPE,OSAttribute> retrievedTemplate = object->getAttribute(CKA_WRAP_TEMPLATE).getAttributeMapValue();
+	CPPUNIT_ASSERT(retrievedTemplate.size() == 2);
+	CPPUNIT_ASSERT(retrievedTemplate.find(CKA_TOKEN)->second.getBooleanValue());
+	CPPUNIT_ASSERT(retrievedTemplate.find(CKA_VALUE)->second.getByteStringValue() == ByteString("AABB"));
+
+	// Attributes are enumerated in order
+	CK_ATTRIBUTE_TYPE type = object->nextAttributeType(CKA_CLASS);
+	CPPUNIT_ASSERT_EQUAL(type, (CK_ATTRIBUTE_TYPE) CKA_TOKEN);
+	type = object->nextAttributeType(CKA_ID);
+	CPPUNIT_ASSERT_EQUAL(type, (CK_ATTRIBUTE_TYPE) CKA_WRAP_TEMPLATE);
+
+	delete newToken;
+}
+
+void test_a_logtoken::should_flush_records()
+{
+	ByteString label = "40414243"; // ABCD
+	ByteString serial = "0102030405060708";
+
+	ObjectStoreToken* newToken = new LogToken("testdir", "flushToken", DEFAULT_UMASK, label, serial);
+	CPPUNIT_ASSERT(newToken->isValid());
+
+	OSObject* object = newToken->createObject();
+	CPPUNIT_ASSERT(object != NULL);
+
+	// Every record is flushed
+	FileSync::i()->setDurability(FileSync::DURABILITY_FULL);
+	unsigned long rounds = FileSync::i()->getRounds();
+	CPPUNIT_ASSERT(object->setAttribute(CKA_LABEL, OSAttribute(ByteString("AA"))));
+	CPPUNIT_ASSERT(FileSync::i()->getRounds() == rounds + 1);
+	CK_ULONG flags;
+	CPPUNIT_ASSERT(newToken->getTokenFlags(flags));
+	CPPUNIT_ASSERT(newToken->setTokenFlags(flags | CKF_USER_PIN_COUNT_LOW));
+	CPPUNIT_ASSERT(FileSync::i()->getRounds() == rounds + 2);
+
+	// Or left to the operating system
+	FileSync::i()->setDurability(FileSync::DURABILITY_NONE);
+	CPPUNIT_ASSERT(object->setAttribute(CKA_LABEL, OSAttribute(ByteString("BB"))));
+	CPPUNIT_ASSERT(FileSync::i()->getRounds() == rounds + 2);
+
+	delete newToken;
+}
+
+void test_a_logtoken::should_see_changes_of_other_instances()
+{
+	ByteString label = "40414243"; // ABCD
+	ByteString serial = "0102030405060708";
+
+	ObjectStoreToken* first = new LogToken("testdir", "sharedToken", DEFAULT_UMASK, label, serial);
+	ObjectStoreToken* second = new LogToken("testdir", "sharedToken", DEFAULT_UMASK);
+
+	OSObject* object = first->createObject();
+	CPPUNIT_ASSERT(object->setAttribute(CKA_LABEL, OSAttribute(ByteString("01"))));
+
+	std::set<OSObject*> objects = second->getObjects();
+	CPPUNIT_ASSERT(objects.size() == 1);
+
+	OSObject* other = *objects.begin();
+	CPPUNIT_ASSERT(other->getByteStringValue(CKA_LABEL) == ByteString("01"));
+
+	unsigned long revision = other->getRevision();
+	CPPUNIT_ASSERT(object->setAttribute(CKA_LABEL, OSAttribute(ByteString("02"))));
+	second->getObjects();
+	CPPUNIT_ASSERT(other->getRevision() != revision);
+	CPPUNIT_ASSERT(other->getByteStringValue(CKA_LABEL) == ByteString("02"));
+
+	// A compaction by one instance is followed by the other
+	CPPUNIT_ASSERT(static_cast<LogToken*>(first)->compact());
+	CPPUNIT_ASSERT(other->setAttribute(CKA_LABEL, OSAttribute(ByteString("03"))));
+	first->getObjects();
+	CPPUNIT_ASSERT(object->getByteStringValue(CKA_LABEL) == ByteString("03"));
+
+	CPPUNIT_ASSERT(object->destroyObject());
+	CPPUNIT_ASSERT(second->getObjects().empty());
+	CPPUNIT_ASSERT(!other->isValid());
+
+	delete second;
+	delete first;
+}
+
+void test_a_logtoken::should_cut_off_a_torn_record()
+{
+	ByteString label = "40414243"; // ABCD
+	ByteString serial = "0102030405060708";
+
+	ObjectStoreToken* newToken = new LogToken("testdir", "tornToken", DEFAULT_UMASK, label, serial);
+	OSObject* object = newToken->createObject();
+	CPPUNIT_ASSERT(object->setAttribute(CKA_LABEL, OSAttribute(ByteString("01"))));
+	delete newToken;
+
+	// The start of a record that never made it to disk completely
+	int fd = open("testdir/tornToken/token.log", O_WRONLY | O_APPEND);
+	CPPUNIT_ASSERT(fd != -1);
+	const unsigned char torn[] = { 0x00, 0x00, 0x01, 0x00, 0x12, 0x34, 0x56, 0x78, 0x02 };
+	CPPUNIT_ASSERT(write(fd, torn, sizeof(torn)) == (ssize_t) sizeof(torn));
+	close(fd);
+
+	newToken = new LogToken("testdir", "tornToken", DEFAULT_UMASK);
+	CPPUNIT_ASSERT(newToken->isValid());
+
+	std::set<OSObject*> objects = newToken->getObjects();
+	CPPUNIT_ASSERT(objects.size() == 1);
+	object = *objects.begin();
+	CPPUNIT_ASSERT(object->getByteStringValue(CKA_LABEL) == ByteString("01"));
+
+	// The next write replaces the torn record
+	CPPUNIT_ASSERT(object->setAttribute(CKA_LABEL, OSAttribute(ByteString("02"))));
+	delete newToken;
+
+	newToken = new LogToken("testdir", "tornToken", DEFAULT_UMASK);
+	objects = newToken->getObjects();
+	CPPUNIT_ASSERT(objects.size() == 1);
+	CPPUNIT_ASSERT((*objects.begin())->getByteStringValue(CKA_LABEL) == ByteString("02"));
+	delete newToken;
+}
+
+void test_a_logtoken::should_compact()
+{
+	ByteString label = "40414243"; // ABCD
+	ByteString serial = "0102030405060708";
+
+	ObjectLog* log = new ObjectLog("testdir/compact.log", DEFAULT_UMASK, true);
+	CPPUNIT_ASSERT(log->isValid());
+
+	unsigned long long first, second;
+	CPPUNIT_ASSERT(log->createObject(first));
+	CPPUNIT_ASSERT(log->createObject(second));
+	CPPUNIT_ASSERT_EQUAL(first, 0ULL);
+	CPPUNIT_ASSERT_EQUAL(second, 1ULL);
+
+	ByteString value;
+	value.resize(1000);
+	memset(&value[0], 0x5A, value.size());
+	OSAttribute attr(value);
+
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*> set;
+	set[CKA_VALUE] = &attr;
+
+	for (int i = 0; i < 100; i++)
+	{
+		CPPUNIT_ASSERT(log->update(first, set, std::set<CK_ATTRIBUTE_TYPE>()));
+	}
+	CPPUNIT_ASSERT(log->deleteObject(second));
+	CPPUNIT_ASSERT(log->getGarbage() > 99 * value.size());
+
+	size_t before = log->getSize();
+	CPPUNIT_ASSERT(log->compact());
+	CPPUNIT_ASSERT(log->getSize() < before / 50);
+	CPPUNIT_ASSERT(log->getGarbage() < 100);
+
+	OSAttribute* retrieved = log->getAttribute(first, CKA_VALUE);
+	CPPUNIT_ASSERT(retrieved != NULL && retrieved->getByteStringValue() == value);
+	delete retrieved;
+
+	// Ids are not reused after a compaction
+	delete log;
+	log = new ObjectLog("testdir/compact.log", DEFAULT_UMASK, false);
+	CPPUNIT_ASSERT(log->exists(first));
+	CPPUNIT_ASSERT(!log->exists(second));
+	CPPUNIT_ASSERT(log->createObject(second));
+	CPPUNIT_ASSERT_EQUAL(second, 2ULL);
+
+	// Enough garbage starts a compaction in the background
+	value.resize(64 * 1024);
+	OSAttribute large(value);
+	set[CKA_VALUE] = &large;
+	for (int i = 0; i < 16; i++)
+	{
+		CPPUNIT_ASSERT(log->update(second, set, std::set<CK_ATTRIBUTE_TYPE>()));
+	}
+	for (int i = 0; i < 100 && log->getSize() > 8 * value.size(); i++)
+	{
+		usleep(10000);
+		log->sync();
+	}
+	CPPUNIT_ASSERT(log->getSize() < 8 * value.size());
+
+	retrieved = log->getAttribute(second, CKA_VALUE);
+	CPPUNIT_ASSERT(retrieved != NULL && retrieved->getByteStringValue() == value);
+	delete retrieved;
+
+	delete log;
+}
+
+void test_a_logtoken::should_compact_without_a_thread()
+{
+	ObjectLog::setCompactionThread(false);
+
+	ObjectLog* log = new ObjectLog("testdir/inline.log", DEFAULT_UMASK, true);
+	CPPUNIT_ASSERT(log->isValid());
+
+	unsigned long long id;
+	CPPUNIT_ASSERT(log->createObject(id));
+
+	ByteString value;
+	value.resize(64 * 1024);
+	memset(&value[0], 0xA5, value.size());
+	OSAttribute large(value);
+
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*> set;
+	set[CKA_VALUE] = &large;
+
+	// The write that leaves enough garbage compacts the log before it returns
+	for (int i = 0; i < 16; i++)
+	{
+		CPPUNIT_ASSERT(log->update(id, set, std::set<CK_ATTRIBUTE_TYPE>()));
+		CPPUNIT_ASSERT(log->getSize() < 8 * value.size());
+	}
+
+	OSAttribute* retrieved = log->getAttribute(id, CKA_VALUE);
+	CPPUNIT_ASSERT(retrieved != NULL && retrieved->getByteStringValue() == value);
+	delete retrieved;
+
+	delete log;
+}
+
+void test_a_logtoken::should_compact_in_a_forked_child()
+{
+	ObjectLog* log = new ObjectLog("testdir/fork.log", DEFAULT_UMASK, true);
+	CPPUNIT_ASSERT(log->isValid());
+
+	unsigned long long id;
+	CPPUNIT_ASSERT(log->createObject(id));
+
+	ByteString value;
+	value.resize(64 * 1024);
+	memset(&value[0], 0x3C, value.size());
+	OSAttribute large(value);
+
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*> set;
+	set[CKA_VALUE] = &large;
+
+	// Start the compaction thread of the parent
+	for (int i = 0; i < 16; i++)
+	{
+		CPPUNIT_ASSERT(log->update(id, set, std::set<CK_ATTRIBUTE_TYPE>()));
+	}
+
+	pid_t pid = fork();
+	CPPUNIT_ASSERT(pid >= 0);
+
+	if (pid == 0)
+	{
+		// The child compacts with a thread of its own and lets go of the
+		// log without waiting for the parent's
+		alarm(10);
+		bool ok = true;
+		for (int i = 0; i < 16; i++)
+		{
+			ok = ok && log->update(id, set, std::set<CK_ATTRIBUTE_TYPE>());
+		}
+		for (int i = 0; i < 100 && log->getSize() > 8 * value.size(); i++)
+		{
+			usleep(10000);
+			log->sync();
+		}
+		ok = ok && log->getSize() < 8 * value.size();
+		delete log;
+		_exit(ok ? 0 : 1);
+	}
+
+	int status = 0;
+	CPPUNIT_ASSERT(waitpid(pid, &status, 0) == pid);
+	CPPUNIT_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	log->sync();
+	OSAttribute* retrieved = log->getAttribute(id, CKA_VALUE);
+	CPPUNIT_ASSERT(retrieved != NULL && retrieved->getByteStringValue() == value);
+	delete retrieved;
+
+	delete log;
+}
+
+void test_a_logtoken::should_fail_to_open_nonexistant_tokens()
+{
+	ObjectStoreToken* newToken = new LogToken("testdir", "nonExistantToken", DEFAULT_UMASK);
+
+	CPPUNIT_ASSERT(!newToken->isValid());
+
+	delete newToken;
+}
+
+void test_a_logtoken::support_clearing_a_token()
+{
+	ByteString label = "40414243"; // ABCD
+	ByteString serial = "0102030405060708";
+
+	ObjectStoreToken* newToken = new LogToken("testdir", "clearToken", DEFAULT_UMASK, label, serial);
+	CPPUNIT_ASSERT(newToken->createObject() != NULL);
+	CPPUNIT_ASSERT(newToken->clearToken());
+	delete newToken;
+
+	struct stat st;
+	CPPUNIT_ASSERT(stat("testdir/clearToken", &st) != 0);
+
+	newToken = new LogToken("testdir", "clearToken", DEFAULT_UMASK);
+	CPPUNIT_ASSERT(!newToken->isValid());
+	delete newToken;
+}
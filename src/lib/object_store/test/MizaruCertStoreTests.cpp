@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MizaruCertStoreTests.cpp
+
+ Contains test cases for the certificates on the Mizar chip
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "MizaruCertStoreTests.h"
+#include "MizaruCertStore.h"
+#include "MizarSimDevice.h"
+#include "mizar_api.h"
+#include "vendor_defines.h"
+#include "cryptoki.h"
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+
+CPPUNIT_TEST_SUITE_REGISTRATION(MizaruCertStoreTests);
+
+#define TEST_CERT_INDEX 7
+#define TEST_KEY_INDEX 12
+#define TEST_CAR_INDEX 8
+
+// A self-signed P-256 certificate with the given common name and serial
+static ByteString makeCert(const char* cn, long serial, ByteString& subject, ByteString& serialDER)
+{
+	ByteString der;
+	EVP_PKEY* pkey = EVP_EC_gen("P-256");
+	X509* x509 = X509_new();
+	CPPUNIT_ASSERT(pkey != NULL && x509 != NULL);
+
+	X509_NAME* name = X509_get_subject_name(x509);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*) cn, -1, -1, 0);
+	X509_set_issuer_name(x509, name);
+	ASN1_INTEGER_set(X509_get_serialNumber(x509), serial);
+	X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+	X509_gmtime_adj(X509_getm_notAfter(x509), 3600);
+	X509_set_pubkey(x509, pkey);
+	CPPUNIT_ASSERT(X509_sign(x509, pkey, EVP_sha256()) > 0);
+
+	unsigned char* p;
+	der.resize(i2d_X509(x509, NULL));
+	p = &der[0];
+	i2d_X509(x509, &p);
+	subject.resize(i2d_X509_NAME(name, NULL));
+	p = &subject[0];
+	i2d_X509_NAME(name, &p);
+	serialDER.resize(i2d_ASN1_INTEGER(X509_get_serialNumber(x509), NULL));
+	p = &serialDER[0];
+	i2d_ASN1_INTEGER(X509_get_serialNumber(x509), &p);
+
+	X509_free(x509);
+	EVP_PKEY_free(pkey);
+
+	return der;
+}
+
+// The certificate objects in the store
+static std::set<OSObject*> certificates(MizaruCertStore& store)
+{
+	std::set<OSObject*> objects;
+	store.getObjects(objects);
+
+	return objects;
+}
+
+void MizaruCertStoreTests::setUp()
+{
+	CPPUNIT_ASSERT(MizarSdkInit(0, NULL) == SUCCESS);
+}
+
+void MizaruCertStoreTests::tearDown()
+{
+	MizarSimDevice::get(0)->clearKeys();
+
+	fflush(stdout);
+}
+
+void MizaruCertStoreTests::testLazyValue()
+{
+	ByteString subject, serial;
+	ByteString cert = makeCert("Mizar test", 4711, subject, serial);
+
+	CPPUNIT_ASSERT(MizarImportCert(TEST_CERT_INDEX, TEST_KEY_INDEX, 1, cert.size(), &cert[0]) == SUCCESS);
+
+	MizaruCertStore store;
+	std::set<OSObject*> objects = certificates(store);
+	CPPUNIT_ASSERT(objects.size() == 1);
+
+	MizaruCertObject* object = (MizaruCertObject*) *objects.begin();
+	CPPUNIT_ASSERT(object->isValid());
+
+	// Searching does not read the certificate
+	const char* label = "Mizar certificate 7";
+	CPPUNIT_ASSERT(object->getUnsignedLongValue(CKA_CLASS, 0) == CKO_CERTIFICATE);
+	CPPUNIT_ASSERT(object->getUnsignedLongValue(CKA_CERTIFICATE_TYPE, 0) == CKC_X_509);
+	CPPUNIT_ASSERT(object->getBooleanValue(CKA_TOKEN, false));
+	CPPUNIT_ASSERT(!object->getBooleanValue(CKA_PRIVATE, true));
+	CPPUNIT_ASSERT(!object->getBooleanValue(CKA_MODIFIABLE, true));
+	CPPUNIT_ASSERT(object->getByteStringValue(CKA_LABEL) == ByteString((const unsigned char*) label, strlen(label)));
+	CPPUNIT_ASSERT(object->getByteStringValue(CKA_ID) == ByteString("0c"));
+	CPPUNIT_ASSERT(object->getUnsignedLongValue(CKA_MIZAR_KEY_INDEX, 0) == TEST_KEY_INDEX);
+	CPPUNIT_ASSERT(object->attributeExists(CKA_VALUE));
+	CPPUNIT_ASSERT(!object->isLoaded());
+
+	mizar_uint64 commands = MizarSimDevice::get(0)->getCommandCount();
+	CPPUNIT_ASSERT(object->getByteStringValue(CKA_VALUE) == cert);
+	CPPUNIT_ASSERT(object->isLoaded());
+	CPPUNIT_ASSERT(MizarSimDevice::get(0)->getCommandCount() == commands + 1);
+
+	// Read once, then served from the object
+	CPPUNIT_ASSERT(object->getByteStringValue(CKA_SUBJECT) == subject);
+	CPPUNIT_ASSERT(object->getByteStringValue(CKA_ISSUER) == subject);
+	CPPUNIT_ASSERT(object->getByteStringValue(CKA_SERIAL_NUMBER) == serial);
+	CPPUNIT_ASSERT(object->getByteStringValue(CKA_VALUE) == cert);
+	CPPUNIT_ASSERT(MizarSimDevice::get(0)->getCommandCount() == commands + 1);
+}
+
+void MizaruCertStoreTests::testRefresh()
+{
+	ByteString subject, serial;
+	ByteString cert = makeCert("Mizar refresh", 1, subject, serial);
+	ByteString car("7f2181e47f4e819d5f2901");
+
+	CPPUNIT_ASSERT(MizarImportCert(TEST_CERT_INDEX, 0xFF, 0, cert.size(), &cert[0]) == SUCCESS);
+	CPPUNIT_ASSERT(MizarImportCert(TEST_CAR_INDEX, 0xFF, 3, car.size(), &car[0]) == SUCCESS);
+
+	// CAR certificates are not X.509 certificates and are left out
+	MizaruCertStore store;
+	std::set<OSObject*> objects = certificates(store);
+	CPPUNIT_ASSERT(objects.size() == 1);
+
+	MizaruCertObject* object = (MizaruCertObject*) *objects.begin();
+	CPPUNIT_ASSERT(object->getByteStringValue(CKA_ID).size() == 0);
+	CPPUNIT_ASSERT(!object->attributeExists(CKA_MIZAR_KEY_INDEX));
+	CPPUNIT_ASSERT(object->getByteStringValue(CKA_VALUE) == cert);
+
+	// An unchanged entry keeps its object and what has been read of it
+	objects = certificates(store);
+	CPPUNIT_ASSERT(objects.size() == 1);
+	CPPUNIT_ASSERT(*objects.begin() == object);
+	CPPUNIT_ASSERT(object->isLoaded());
+
+	// A replaced entry gets a new object
+	CPPUNIT_ASSERT(MizarImportCert(TEST_CERT_INDEX, TEST_KEY_INDEX, 0, cert.size(), &cert[0]) == SUCCESS);
+	objects = certificates(store);
+	CPPUNIT_ASSERT(objects.size() == 1);
+	CPPUNIT_ASSERT(*objects.begin() != object);
+	CPPUNIT_ASSERT(!object->isValid());
+	object = (MizaruCertObject*) *objects.begin();
+
+	// A deleted entry is invalidated
+	CPPUNIT_ASSERT(MizarDeleteCert(TEST_CERT_INDEX, 0) == SUCCESS);
+	CPPUNIT_ASSERT(certificates(store).empty());
+	CPPUNIT_ASSERT(!object->isValid());
+}
+
+void MizaruCertStoreTests::testReadOnly()
+{
+	ByteString subject, serial;
+	ByteString cert = makeCert("Mizar read-only", 2, subject, serial);
+
+	CPPUNIT_ASSERT(MizarImportCert(TEST_CERT_INDEX, 0xFF, 1, cert.size(), &cert[0]) == SUCCESS);
+
+	MizaruCertStore store;
+	std::set<OSObject*> objects = certificates(store);
+	CPPUNIT_ASSERT(objects.size() == 1);
+
+	OSObject* object = *objects.begin();
+	OSAttribute label(ByteString("00"));
+
+	CPPUNIT_ASSERT(!object->setAttribute(CKA_LABEL, label));
+	CPPUNIT_ASSERT(!object->deleteAttribute(CKA_LABEL));
+	CPPUNIT_ASSERT(!object->startTransaction(OSObject::ReadWrite));
+	CPPUNIT_ASSERT(!object->destroyObject());
+	CPPUNIT_ASSERT(object->isValid());
+
+	// The chip knows the certificate under its type only
+	CPPUNIT_ASSERT(MizarDeleteCert(TEST_CERT_INDEX, 0) != SUCCESS);
+	CPPUNIT_ASSERT(MizarDeleteCert(TEST_CERT_INDEX, 1) == SUCCESS);
+}
@@ -33,9 +33,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
 #include <cppunit/extensions/HelperMacros.h>
 #include "ObjectFileTests.h"
 #include "ObjectFile.h"
+#include "BodyCache.h"
 #include "File.h"
 #include "Directory.h"
 #include "OSAttribute.h"
@@ -58,6 +62,8 @@ void ObjectFileTests::setUp()
 
 void ObjectFileTests::tearDown()
 {
+	BodyCache::i()->setBudget(DEFAULT_OBJECTSTORE_LAZY_BUDGET * 1024);
+
 #ifndef _WIN32
 	CPPUNIT_ASSERT(!system("rm -rf testdir"));
 #else
@@ -913,3 +919,258 @@ void ObjectFileTests::testDestroyObjectFails()
 	CPPUNIT_ASSERT(!testIF->destroyObject());
 }
 
+
+#ifndef _WIN32
+static long fileSize(const char* path)
+{
+	struct stat st;
+
+	if (stat(path, &st) != 0) return -1;
+
+	return st.st_size;
+}
+
+static ino_t fileInode(const char* path)
+{
+	struct stat st;
+
+	if (stat(path, &st) != 0) return 0;
+
+	return st.st_ino;
+}
+
+void ObjectFileTests::testDeltaWrites()
+{
+	ByteString value;
+	value.resize(512);
+	memset(&value[0], 0x5A, value.size());
+
+	ObjectFile testObject(NULL, "testdir/test.object", DEFAULT_UMASK, "testdir/test.lock", true);
+
+	CPPUNIT_ASSERT(testObject.isValid());
+	CPPUNIT_ASSERT(testObject.setAttribute(CKA_VALUE, OSAttribute(value)));
+	CPPUNIT_ASSERT(testObject.setAttribute(CKA_LABEL, OSAttribute(ByteString("0102"))));
+
+	long size = fileSize("testdir/test.object");
+
+	// Changing the label appends its record only: type, kind, length and value
+	CPPUNIT_ASSERT(testObject.setAttribute(CKA_LABEL, OSAttribute(ByteString("0304"))));
+	CPPUNIT_ASSERT_EQUAL(size + 26, fileSize("testdir/test.object"));
+
+	// A deletion is a record without a value
+	CPPUNIT_ASSERT(testObject.deleteAttribute(CKA_LABEL));
+	CPPUNIT_ASSERT_EQUAL(size + 42, fileSize("testdir/test.object"));
+
+	{
+		ObjectFile testObject2(NULL, "testdir/test.object", DEFAULT_UMASK, "testdir/test.lock");
+
+		CPPUNIT_ASSERT(testObject2.isValid());
+		CPPUNIT_ASSERT(!testObject2.attributeExists(CKA_LABEL));
+		CPPUNIT_ASSERT(testObject2.getByteStringValue(CKA_VALUE) == value);
+
+		// The other instance follows the changes of this one
+		CPPUNIT_ASSERT(testObject2.setAttribute(CKA_ID, OSAttribute(ByteString("01"))));
+		CPPUNIT_ASSERT(testObject.isValid());
+		CPPUNIT_ASSERT(testObject.getByteStringValue(CKA_ID) == ByteString("01"));
+	}
+
+	// Superseded records are eventually compacted away
+	for (int i = 0; i < 40; i++)
+	{
+		CPPUNIT_ASSERT(testObject.setAttribute(CKA_LABEL, OSAttribute(ByteString("0506"))));
+	}
+	CPPUNIT_ASSERT(fileSize("testdir/test.object") < size + 20 * 26);
+
+	ObjectFile testObject3(NULL, "testdir/test.object", DEFAULT_UMASK, "testdir/test.lock");
+
+	CPPUNIT_ASSERT(testObject3.isValid());
+	CPPUNIT_ASSERT(testObject3.getByteStringValue(CKA_LABEL) == ByteString("0506"));
+	CPPUNIT_ASSERT(testObject3.getByteStringValue(CKA_ID) == ByteString("01"));
+	CPPUNIT_ASSERT(testObject3.getByteStringValue(CKA_VALUE) == value);
+}
+
+void ObjectFileTests::testOldFormat()
+{
+	// An object file without the header of the record format
+	{
+		File oldFile("testdir/test.object", DEFAULT_UMASK, true, true, true);
+
+		CPPUNIT_ASSERT(oldFile.isValid());
+		CPPUNIT_ASSERT(oldFile.writeULong(7));
+		CPPUNIT_ASSERT(oldFile.writeULong(CKA_TOKEN));
+		CPPUNIT_ASSERT(oldFile.writeULong(0x1));
+		CPPUNIT_ASSERT(oldFile.writeBool(true));
+		CPPUNIT_ASSERT(oldFile.writeULong(CKA_LABEL));
+		CPPUNIT_ASSERT(oldFile.writeULong(0x3));
+		CPPUNIT_ASSERT(oldFile.writeByteString(ByteString("0102")));
+	}
+
+	{
+		ObjectFile testObject(NULL, "testdir/test.object", DEFAULT_UMASK, "testdir/test.lock");
+
+		CPPUNIT_ASSERT(testObject.isValid());
+		CPPUNIT_ASSERT(testObject.getBooleanValue(CKA_TOKEN, false));
+		CPPUNIT_ASSERT(testObject.getByteStringValue(CKA_LABEL) == ByteString("0102"));
+
+		// The first change converts the file
+		CPPUNIT_ASSERT(testObject.setAttribute(CKA_LABEL, OSAttribute(ByteString("0304"))));
+	}
+
+	ObjectFile testObject(NULL, "testdir/test.object", DEFAULT_UMASK, "testdir/test.lock");
+
+	CPPUNIT_ASSERT(testObject.isValid());
+	CPPUNIT_ASSERT(testObject.getBooleanValue(CKA_TOKEN, false));
+	CPPUNIT_ASSERT(testObject.getByteStringValue(CKA_LABEL) == ByteString("0304"));
+
+	long size = fileSize("testdir/test.object");
+	CPPUNIT_ASSERT(testObject.setAttribute(CKA_TOKEN, OSAttribute(false)));
+	CPPUNIT_ASSERT_EQUAL(size + 17, fileSize("testdir/test.object"));
+}
+
+void ObjectFileTests::testIncompleteRecord()
+{
+	{
+		ObjectFile testObject(NULL, "testdir/test.object", DEFAULT_UMASK, "testdir/test.lock", true);
+
+		CPPUNIT_ASSERT(testObject.setAttribute(CKA_LABEL, OSAttribute(ByteString("0102"))));
+		CPPUNIT_ASSERT(testObject.setAttribute(CKA_LABEL, OSAttribute(ByteString("0304"))));
+	}
+
+	// A record that was cut short by a crash
+	FILE* stream = fopen("testdir/test.object", "a");
+	const unsigned char partial[] = { 0, 0, 0, 0, 0, 0, 0, 3, 0, 0, 0, 0 };
+	CPPUNIT_ASSERT(stream != NULL);
+	CPPUNIT_ASSERT(fwrite(partial, 1, sizeof(partial), stream) == sizeof(partial));
+	CPPUNIT_ASSERT(!fclose(stream));
+
+	{
+		ObjectFile testObject(NULL, "testdir/test.object", DEFAULT_UMASK, "testdir/test.lock");
+
+		CPPUNIT_ASSERT(testObject.isValid());
+		CPPUNIT_ASSERT(testObject.getByteStringValue(CKA_LABEL) == ByteString("0304"));
+
+		// The next change does not go after the incomplete record
+		CPPUNIT_ASSERT(testObject.setAttribute(CKA_ID, OSAttribute(ByteString("01"))));
+	}
+
+	ObjectFile testObject(NULL, "testdir/test.object", DEFAULT_UMASK, "testdir/test.lock");
+
+	CPPUNIT_ASSERT(testObject.isValid());
+	CPPUNIT_ASSERT(testObject.getByteStringValue(CKA_LABEL) == ByteString("0304"));
+	CPPUNIT_ASSERT(testObject.getByteStringValue(CKA_ID) == ByteString("01"));
+}
+
+void ObjectFileTests::testAtomicWrites()
+{
+	ObjectFile testObject(NULL, "testdir/test.object", DEFAULT_UMASK, "testdir/test.lock", true);
+
+	CPPUNIT_ASSERT(testObject.isValid());
+	CPPUNIT_ASSERT(testObject.setAttribute(CKA_LABEL, OSAttribute(ByteString("0102"))));
+
+	// Appending a record changes the file in place
+	ino_t inode = fileInode("testdir/test.object");
+	CPPUNIT_ASSERT(testObject.setAttribute(CKA_LABEL, OSAttribute(ByteString("0304"))));
+	CPPUNIT_ASSERT(fileInode("testdir/test.object") == inode);
+
+	// Writing the whole object replaces the file, leaving nothing behind
+	CPPUNIT_ASSERT(testObject.startTransaction(OSObject::ReadWrite));
+	CPPUNIT_ASSERT(testObject.setAttribute(CKA_ID, OSAttribute(ByteString("01"))));
+	CPPUNIT_ASSERT(testObject.commitTransaction());
+	CPPUNIT_ASSERT(fileInode("testdir/test.object") != inode);
+	CPPUNIT_ASSERT_EQUAL(-1L, fileSize("testdir/test.object.tmp"));
+
+	// A file opened before the object was written again is no longer the
+	// object file; writers check this once they have the lock
+	File staleFile("testdir/test.object", DEFAULT_UMASK, true, true);
+	CPPUNIT_ASSERT(staleFile.isCurrent());
+
+	CPPUNIT_ASSERT(testObject.startTransaction(OSObject::ReadWrite));
+	CPPUNIT_ASSERT(testObject.setAttribute(CKA_ID, OSAttribute(ByteString("02"))));
+	CPPUNIT_ASSERT(testObject.commitTransaction());
+	CPPUNIT_ASSERT(!staleFile.isCurrent());
+
+	CPPUNIT_ASSERT(testObject.setAttribute(CKA_LABEL, OSAttribute(ByteString("0506"))));
+
+	ObjectFile testObject2(NULL, "testdir/test.object", DEFAULT_UMASK, "testdir/test.lock");
+
+	CPPUNIT_ASSERT(testObject2.isValid());
+	CPPUNIT_ASSERT(testObject2.getByteStringValue(CKA_LABEL) == ByteString("0506"));
+	CPPUNIT_ASSERT(testObject2.getByteStringValue(CKA_ID) == ByteString("02"));
+
+	// A temporary file left by a crash is simply overwritten
+	{
+		File leftOver("testdir/test.object.tmp", DEFAULT_UMASK, true, true, true);
+
+		CPPUNIT_ASSERT(leftOver.writeULong(0x1234));
+	}
+	CPPUNIT_ASSERT(testObject2.startTransaction(OSObject::ReadWrite));
+	CPPUNIT_ASSERT(testObject2.setAttribute(CKA_ID, OSAttribute(ByteString("03"))));
+	CPPUNIT_ASSERT(testObject2.commitTransaction());
+	CPPUNIT_ASSERT_EQUAL(-1L, fileSize("testdir/test.object.tmp"));
+	CPPUNIT_ASSERT(testObject.isValid());
+	CPPUNIT_ASSERT(testObject.getByteStringValue(CKA_ID) == ByteString("03"));
+	CPPUNIT_ASSERT(testObject.getByteStringValue(CKA_LABEL) == ByteString("0506"));
+}
+
+void ObjectFileTests::testLazyLoading()
+{
+	ByteString value;
+	value.resize(4096);
+	memset(&value[0], 0x5A, value.size());
+
+	{
+		ObjectFile testObject(NULL, "testdir/test.object", DEFAULT_UMASK, "testdir/test.lock", true);
+
+		CPPUNIT_ASSERT(testObject.startTransaction(OSObject::ReadWrite));
+		CPPUNIT_ASSERT(testObject.setAttribute(CKA_CLASS, OSAttribute((unsigned long) CKO_CERTIFICATE)));
+		CPPUNIT_ASSERT(testObject.setAttribute(CKA_LABEL, OSAttribute(ByteString("0102"))));
+		CPPUNIT_ASSERT(testObject.setAttribute(CKA_VALUE, OSAttribute(value)));
+		CPPUNIT_ASSERT(testObject.setAttribute(CKA_SUBJECT, OSAttribute(ByteString("0304"))));
+		CPPUNIT_ASSERT(testObject.commitTransaction());
+
+		// A record that replaces the value is skipped just the same
+		CPPUNIT_ASSERT(testObject.setAttribute(CKA_SUBJECT, OSAttribute(ByteString("0506"))));
+	}
+
+	size_t loaded = BodyCache::i()->getCount();
+
+	ObjectFile lazyObject(NULL, "testdir/test.object", DEFAULT_UMASK, "testdir/test.lock", false, true);
+
+	// The header is read, the body is not
+	CPPUNIT_ASSERT(lazyObject.isValid());
+	CPPUNIT_ASSERT_EQUAL((unsigned long) CKO_CERTIFICATE, lazyObject.getUnsignedLongValue(CKA_CLASS, CKO_VENDOR_DEFINED));
+	CPPUNIT_ASSERT(lazyObject.getByteStringValue(CKA_LABEL) == ByteString("0102"));
+	CPPUNIT_ASSERT(lazyObject.attributeExists(CKA_VALUE));
+	CPPUNIT_ASSERT(!lazyObject.attributeExists(CKA_ISSUER));
+	CPPUNIT_ASSERT_EQUAL(loaded, BodyCache::i()->getCount());
+
+	// Using any other attribute loads the body, which does not change the object
+	unsigned long revision = lazyObject.getRevision();
+
+	CPPUNIT_ASSERT(lazyObject.getByteStringValue(CKA_VALUE) == value);
+	CPPUNIT_ASSERT(lazyObject.getByteStringValue(CKA_SUBJECT) == ByteString("0506"));
+	CPPUNIT_ASSERT_EQUAL(loaded + 1, BodyCache::i()->getCount());
+	CPPUNIT_ASSERT_EQUAL(revision, lazyObject.getRevision());
+
+	// A budget that is exceeded drops the body; the object is written
+	// with it all the same
+	BodyCache::i()->setBudget(1);
+	CPPUNIT_ASSERT_EQUAL(loaded, BodyCache::i()->getCount());
+	CPPUNIT_ASSERT(lazyObject.attributeExists(CKA_VALUE));
+	CPPUNIT_ASSERT(lazyObject.setAttribute(CKA_LABEL, OSAttribute(ByteString("0708"))));
+
+	// The body of an object in a transaction stays
+	CPPUNIT_ASSERT(lazyObject.startTransaction(OSObject::ReadWrite));
+	BodyCache::i()->setBudget(1);
+	CPPUNIT_ASSERT_EQUAL(loaded + 1, BodyCache::i()->getCount());
+	CPPUNIT_ASSERT(lazyObject.deleteAttribute(CKA_SUBJECT));
+	CPPUNIT_ASSERT(lazyObject.commitTransaction());
+
+	ObjectFile testObject(NULL, "testdir/test.object", DEFAULT_UMASK, "testdir/test.lock");
+
+	CPPUNIT_ASSERT(testObject.isValid());
+	CPPUNIT_ASSERT(testObject.getByteStringValue(CKA_LABEL) == ByteString("0708"));
+	CPPUNIT_ASSERT(testObject.getByteStringValue(CKA_VALUE) == value);
+	CPPUNIT_ASSERT(!testObject.attributeExists(CKA_SUBJECT));
+}
+#endif
@@ -49,6 +49,13 @@ class ObjectFileTests : public CppUnit::TestFixture
 	CPPUNIT_TEST(testCorruptFile);
 	CPPUNIT_TEST(testTransactions);
 	CPPUNIT_TEST(testDestroyObjectFails);
+#ifndef _WIN32
+	CPPUNIT_TEST(testDeltaWrites);
+	CPPUNIT_TEST(testOldFormat);
+	CPPUNIT_TEST(testIncompleteRecord);
+	CPPUNIT_TEST(testAtomicWrites);
+	CPPUNIT_TEST(testLazyLoading);
+#endif
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -63,6 +70,13 @@ public:
 	void testCorruptFile();
 	void testTransactions();
 	void testDestroyObjectFails();
+#ifndef _WIN32
+	void testDeltaWrites();
+	void testOldFormat();
+	void testIncompleteRecord();
+	void testAtomicWrites();
+	void testLazyLoading();
+#endif
 
 	void setUp();
 	void tearDown();
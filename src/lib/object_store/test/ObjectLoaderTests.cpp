@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ ObjectLoaderTests.cpp
+
+ Contains test cases to test the parallel loading of the object store,
+ including a benchmark of the start-up time for several thread counts
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <thread>
+#include <cppunit/extensions/HelperMacros.h>
+#include "ObjectLoaderTests.h"
+#include "ObjectLoader.h"
+#include "ObjectStore.h"
+#include "FileSync.h"
+#include "OSAttribute.h"
+#include "cryptoki.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ObjectLoaderTests);
+
+// The size of the object store loaded by the benchmark
+#define BENCH_TOKENS 4
+#define BENCH_OBJECTS 250
+
+// FIXME: all pathnames in this file are *NIX/BSD specific
+
+void ObjectLoaderTests::setUp()
+{
+#ifndef _WIN32
+	int rv = system("rm -rf testdir");
+#else
+	int rv = system("rmdir /s /q testdir 2> nul");
+#endif
+	(void) rv;
+
+	CPPUNIT_ASSERT(!system("mkdir testdir"));
+}
+
+void ObjectLoaderTests::tearDown()
+{
+	ObjectLoader::setThreads(DEFAULT_OBJECTSTORE_LOAD_THREADS);
+	CPPUNIT_ASSERT(FileSync::i()->setDurability(DEFAULT_OBJECTSTORE_DURABILITY));
+
+	fflush(stdout);
+
+#ifndef _WIN32
+	CPPUNIT_ASSERT(!system("rm -rf testdir"));
+#else
+	CPPUNIT_ASSERT(!system("rmdir /s /q testdir 2> nul"));
+#endif
+}
+
+void ObjectLoaderTests::testRun()
+{
+	unsigned long threadCounts[] = { 1, 4 };
+
+	for (size_t t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]); t++)
+	{
+		ObjectLoader::setThreads(threadCounts[t]);
+		CPPUNIT_ASSERT_EQUAL(threadCounts[t], ObjectLoader::getThreads());
+
+		std::vector<int> runs(100, 0);
+		std::vector<std::thread::id> runners(runs.size());
+		std::vector<ObjectLoader::Job> jobs;
+
+		for (size_t i = 0; i < runs.size(); i++)
+		{
+			jobs.push_back([i, &runs, &runners] { runs[i]++; runners[i] = std::this_thread::get_id(); });
+		}
+
+		// Without a loader the jobs run in the calling thread
+		ObjectLoader::run(jobs);
+
+		{
+			ObjectLoader loader;
+
+			ObjectLoader::run(jobs);
+		}
+
+		for (size_t i = 0; i < runs.size(); i++)
+		{
+			CPPUNIT_ASSERT_EQUAL(2, runs[i]);
+
+			// A single loading thread is the one that calls run()
+			if (threadCounts[t] == 1)
+			{
+				CPPUNIT_ASSERT(runners[i] == std::this_thread::get_id());
+			}
+		}
+	}
+
+	// One thread per processor
+	ObjectLoader::setThreads(0);
+	CPPUNIT_ASSERT(ObjectLoader::getThreads() >= 1);
+}
+
+void ObjectLoaderTests::testNestedRun()
+{
+	ObjectLoader::setThreads(4);
+
+	std::atomic<int> runs(0);
+	std::mutex threadsMutex;
+	std::set<std::thread::id> threads;
+
+	std::vector<ObjectLoader::Job> outer;
+
+	// Like tokens that load their objects
+	for (int i = 0; i < 8; i++)
+	{
+		outer.push_back([&]
+		{
+			std::vector<ObjectLoader::Job> inner;
+
+			for (int j = 0; j < 50; j++)
+			{
+				inner.push_back([&]
+				{
+					{
+						std::lock_guard<std::mutex> lock(threadsMutex);
+
+						threads.insert(std::this_thread::get_id());
+					}
+
+					std::this_thread::sleep_for(std::chrono::microseconds(100));
+					runs++;
+				});
+			}
+
+			ObjectLoader::run(inner);
+		});
+	}
+
+	{
+		ObjectLoader loader;
+
+		ObjectLoader::run(outer);
+	}
+
+	CPPUNIT_ASSERT_EQUAL(8 * 50, runs.load());
+	CPPUNIT_ASSERT(threads.size() > 1);
+	CPPUNIT_ASSERT(threads.size() <= 4);
+}
+
+void ObjectLoaderTests::testLoadStore()
+{
+	// The benchmark is about reading, not about getting the writes on disk
+	CPPUNIT_ASSERT(FileSync::i()->setDurability("none"));
+
+	{
+		ObjectStore store("./testdir", DEFAULT_UMASK);
+
+		for (int t = 0; t < BENCH_TOKENS; t++)
+		{
+			ObjectStoreToken* token = store.newToken(ByteString("DEADBEEF"));
+
+			CPPUNIT_ASSERT(token != NULL);
+
+			for (int o = 0; o < BENCH_OBJECTS; o++)
+			{
+				OSObject* object = token->createObject();
+
+				CPPUNIT_ASSERT(object != NULL);
+				CPPUNIT_ASSERT(object->startTransaction());
+				CPPUNIT_ASSERT(object->setAttribute(CKA_CLASS, OSAttribute((unsigned long) CKO_CERTIFICATE)));
+				CPPUNIT_ASSERT(object->setAttribute(CKA_ID, OSAttribute(ByteString((unsigned long) o))));
+				CPPUNIT_ASSERT(object->setAttribute(CKA_LABEL, OSAttribute(ByteString("6365727469666963617465"))));
+				CPPUNIT_ASSERT(object->setAttribute(CKA_VALUE, OSAttribute(ByteString(std::string(2048, '3').c_str()))));
+				CPPUNIT_ASSERT(object->commitTransaction());
+			}
+		}
+	}
+
+	unsigned long threadCounts[] = { 1, 2, 4, 8 };
+
+	printf("\n");
+
+	for (size_t t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]); t++)
+	{
+		ObjectLoader::setThreads(threadCounts[t]);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		ObjectStore store("./testdir", DEFAULT_UMASK);
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		// Every thread count loads the same store
+		CPPUNIT_ASSERT(store.isValid());
+		CPPUNIT_ASSERT_EQUAL((size_t) BENCH_TOKENS, store.getTokenCount());
+
+		for (size_t n = 0; n < store.getTokenCount(); n++)
+		{
+			std::set<OSObject*> objects = store.getToken(n)->getObjects();
+
+			CPPUNIT_ASSERT_EQUAL((size_t) BENCH_OBJECTS, objects.size());
+
+			for (std::set<OSObject*>::iterator i = objects.begin(); i != objects.end(); i++)
+			{
+				CPPUNIT_ASSERT((*i)->isValid());
+				CPPUNIT_ASSERT_EQUAL((unsigned long) CKO_CERTIFICATE, (*i)->getUnsignedLongValue(CKA_CLASS, CKO_VENDOR_DEFINED));
+			}
+		}
+
+		printf("ObjectLoader: %lu thread(s), %d tokens of %d objects loaded in %.1f ms\n",
+			threadCounts[t], BENCH_TOKENS, BENCH_OBJECTS, seconds * 1000);
+	}
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ ObjectLoaderTests.h
+
+ Contains test cases to test the parallel loading of the object store,
+ including a benchmark of the start-up time for several thread counts
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_OBJECTLOADERTESTS_H
+#define _SOFTHSM_V2_OBJECTLOADERTESTS_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class ObjectLoaderTests : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(ObjectLoaderTests);
+	CPPUNIT_TEST(testRun);
+	CPPUNIT_TEST(testNestedRun);
+	CPPUNIT_TEST(testLoadStore);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void testRun();
+	void testNestedRun();
+	void testLoadStore();
+
+	void setUp();
+	void tearDown();
+};
+
+#endif // !_SOFTHSM_V2_OBJECTLOADERTESTS_H
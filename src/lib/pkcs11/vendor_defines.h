@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ vendor_defines.h
+
+ Vendor defined PKCS#11 constants of MizaruHSM
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_VENDOR_DEFINES_H
+#define _SOFTHSM_V2_VENDOR_DEFINES_H
+
+#include "pkcs11.h"
+
+// Base of the MizaruHSM vendor defined attributes
+#define CKA_VENDOR_MIZARU		(CKA_VENDOR_DEFINED + 0x4D5A0000UL)
+
+// The Mizar key slot holding the private or secret part of a key; such a
+// key has no key material in the object store and is only usable on the chip
+#define CKA_MIZAR_KEY_INDEX		(CKA_VENDOR_MIZARU + 0x01)
+
+// Base of the MizaruHSM vendor defined return values
+#define CKR_VENDOR_MIZARU		(CKR_VENDOR_DEFINED + 0x4D5A0000UL)
+
+// The asynchronous operation has not completed yet
+#define CKR_MIZARU_PENDING		(CKR_VENDOR_MIZARU + 0x01)
+
+// Base of the MizaruHSM vendor defined key types
+#define CKK_VENDOR_MIZARU		(CKK_VENDOR_DEFINED + 0x4D5A0000UL)
+
+// SM2 key pairs have the attributes of EC keys on the SM2 curve
+#define CKK_SM2				(CKK_VENDOR_MIZARU + 0x01)
+#define CKK_SM4				(CKK_VENDOR_MIZARU + 0x02)
+#define CKK_ZUC				(CKK_VENDOR_MIZARU + 0x03)
+
+// Base of the MizaruHSM vendor defined mechanisms
+#define CKM_VENDOR_MIZARU		(CKM_VENDOR_DEFINED + 0x4D5A0000UL)
+
+#define CKM_SM2_KEY_PAIR_GEN		(CKM_VENDOR_MIZARU + 0x01)
+// Signs a 32 byte digest; the signature is r || s
+#define CKM_SM2				(CKM_VENDOR_MIZARU + 0x02)
+// Signs the SM3 digest of Z || M, where the optional parameter is the
+// signer ID (default "1234567812345678")
+#define CKM_SM2_SM3			(CKM_VENDOR_MIZARU + 0x03)
+// The ciphertext is C1 || C2 || C3 with C1 an uncompressed point
+#define CKM_SM2_ENCRYPT			(CKM_VENDOR_MIZARU + 0x04)
+#define CKM_SM3				(CKM_VENDOR_MIZARU + 0x10)
+#define CKM_SM4_KEY_GEN			(CKM_VENDOR_MIZARU + 0x20)
+#define CKM_SM4_ECB			(CKM_VENDOR_MIZARU + 0x21)
+#define CKM_SM4_CBC			(CKM_VENDOR_MIZARU + 0x22)
+#define CKM_SM4_CBC_PAD			(CKM_VENDOR_MIZARU + 0x23)
+#define CKM_SM4_OFB			(CKM_VENDOR_MIZARU + 0x24)
+// The parameter is a CK_AES_CTR_PARAMS
+#define CKM_SM4_CTR			(CKM_VENDOR_MIZARU + 0x25)
+#define CKM_ZUC_KEY_GEN			(CKM_VENDOR_MIZARU + 0x30)
+// 128-EEA3 and 128-EIA3; the parameter is a CK_ZUC_PARAMS
+#define CKM_ZUC_EEA3			(CKM_VENDOR_MIZARU + 0x31)
+#define CKM_ZUC_EIA3			(CKM_VENDOR_MIZARU + 0x32)
+
+// Parameters of CKM_ZUC_EEA3 and CKM_ZUC_EIA3
+typedef struct CK_ZUC_PARAMS {
+	CK_BYTE count[4];
+	CK_BYTE bearer;
+	CK_BYTE direction;
+} CK_ZUC_PARAMS;
+
+typedef CK_ZUC_PARAMS* CK_ZUC_PARAMS_PTR;
+
+// Parameters of CKM_AES_CCM as defined by PKCS#11 v2.40, which our
+// pkcs11.h predates
+typedef struct CK_CCM_PARAMS {
+	CK_ULONG ulDataLen;
+	CK_BYTE_PTR pNonce;
+	CK_ULONG ulNonceLen;
+	CK_BYTE_PTR pAAD;
+	CK_ULONG ulAADLen;
+	CK_ULONG ulMACLen;
+} CK_CCM_PARAMS;
+
+typedef CK_CCM_PARAMS* CK_CCM_PARAMS_PTR;
+
+// How one kind of operation of the Mizaru backend is routed between the
+// chip and the host, as returned by C_GetOffloadInfo
+typedef struct CK_MIZARU_OFFLOAD_INFO {
+	// The name in the mizaru.offload.* configuration keys, e.g. "aes";
+	// NUL terminated
+	CK_CHAR name[16];
+	// The size from which on the chip is used, in bytes for symmetric
+	// ciphers and hashes and in bits for public key operations; -1 if the
+	// chip is never used
+	CK_LONG crossover;
+	// The operations sent to the chip, done by the host because they were
+	// below the crossover, and done by the host after the chip failed
+	CK_ULONG ulChipCount;
+	CK_ULONG ulSoftwareCount;
+	CK_ULONG ulFallbackCount;
+} CK_MIZARU_OFFLOAD_INFO;
+
+typedef CK_MIZARU_OFFLOAD_INFO* CK_MIZARU_OFFLOAD_INFO_PTR;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Verify independent single part signatures in one call, so that the
+// signatures can be passed to the chip together. The outcome of each
+// signature is returned in pResults: CKR_OK if it is valid,
+// CKR_SIGNATURE_INVALID if it is not, or the error that prevented the
+// check. The function returns CKR_OK if every signature was looked at.
+// Only CKM_ECDSA is supported.
+CK_RV C_VerifyBatch
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_ULONG ulCount,
+	CK_OBJECT_HANDLE_PTR phKeys,
+	CK_BYTE_PTR* ppData,
+	CK_ULONG_PTR pulDataLen,
+	CK_BYTE_PTR* ppSignature,
+	CK_ULONG_PTR pulSignatureLen,
+	CK_RV* pResults
+);
+
+typedef CK_RV (*CK_C_VerifyBatch)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_ULONG ulCount,
+	CK_OBJECT_HANDLE_PTR phKeys,
+	CK_BYTE_PTR* ppData,
+	CK_ULONG_PTR pulDataLen,
+	CK_BYTE_PTR* ppSignature,
+	CK_ULONG_PTR pulSignatureLen,
+	CK_RV* pResults
+);
+
+// Asynchronous single part operations. C_SignAsync, C_VerifyAsync and
+// C_EncryptAsync queue the operation and return a ticket for it at once.
+// The operation runs on a worker thread in a session of its own, so that a
+// session can have many operations in flight. The mechanism parameter is
+// copied, but memory it points to must stay valid until the operation has
+// completed.
+//
+// C_PollAsync returns CKR_MIZARU_PENDING while the operation has not
+// completed, and otherwise its result with the output returned like in
+// C_Sign. C_WaitAsync waits up to ulTimeout milliseconds for the result,
+// without limit if ulTimeout is 0. The ticket is released once the result
+// has been collected. For C_VerifyAsync the result is CKR_OK or
+// CKR_SIGNATURE_INVALID and there is no output.
+//
+// C_GetFunctionStatus returns CKR_MIZARU_PENDING while the session has
+// operations that have not completed, and C_CancelFunction cancels those
+// that have not started; they complete with CKR_FUNCTION_CANCELED.
+// Closing the session releases its tickets.
+CK_RV C_SignAsync
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hKey,
+	CK_BYTE_PTR pData,
+	CK_ULONG ulDataLen,
+	CK_ULONG_PTR pulTicket
+);
+
+CK_RV C_VerifyAsync
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hKey,
+	CK_BYTE_PTR pData,
+	CK_ULONG ulDataLen,
+	CK_BYTE_PTR pSignature,
+	CK_ULONG ulSignatureLen,
+	CK_ULONG_PTR pulTicket
+);
+
+CK_RV C_EncryptAsync
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hKey,
+	CK_BYTE_PTR pData,
+	CK_ULONG ulDataLen,
+	CK_ULONG_PTR pulTicket
+);
+
+CK_RV C_PollAsync
+(
+	CK_SESSION_HANDLE hSession,
+	CK_ULONG ulTicket,
+	CK_BYTE_PTR pOutput,
+	CK_ULONG_PTR pulOutputLen
+);
+
+CK_RV C_WaitAsync
+(
+	CK_SESSION_HANDLE hSession,
+	CK_ULONG ulTicket,
+	CK_ULONG ulTimeout,
+	CK_BYTE_PTR pOutput,
+	CK_ULONG_PTR pulOutputLen
+);
+
+typedef CK_RV (*CK_C_SignAsync)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hKey,
+	CK_BYTE_PTR pData,
+	CK_ULONG ulDataLen,
+	CK_ULONG_PTR pulTicket
+);
+
+typedef CK_RV (*CK_C_VerifyAsync)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hKey,
+	CK_BYTE_PTR pData,
+	CK_ULONG ulDataLen,
+	CK_BYTE_PTR pSignature,
+	CK_ULONG ulSignatureLen,
+	CK_ULONG_PTR pulTicket
+);
+
+typedef CK_RV (*CK_C_EncryptAsync)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hKey,
+	CK_BYTE_PTR pData,
+	CK_ULONG ulDataLen,
+	CK_ULONG_PTR pulTicket
+);
+
+typedef CK_RV (*CK_C_PollAsync)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_ULONG ulTicket,
+	CK_BYTE_PTR pOutput,
+	CK_ULONG_PTR pulOutputLen
+);
+
+typedef CK_RV (*CK_C_WaitAsync)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_ULONG ulTicket,
+	CK_ULONG ulTimeout,
+	CK_BYTE_PTR pOutput,
+	CK_ULONG_PTR pulOutputLen
+);
+
+// Return the crossover point and the routing counters of the operation
+// with the given number, for tuning the mizaru.offload.* settings while
+// the library runs. The operations are numbered from 0; past the last one
+// CKR_ARGUMENTS_BAD is returned. The counters are those of this process
+// since C_Initialize. Returns CKR_FUNCTION_NOT_SUPPORTED if the library
+// is not built with the Mizaru backend.
+CK_RV C_GetOffloadInfo
+(
+	CK_ULONG ulOperation,
+	CK_MIZARU_OFFLOAD_INFO_PTR pInfo
+);
+
+typedef CK_RV (*CK_C_GetOffloadInfo)
+(
+	CK_ULONG ulOperation,
+	CK_MIZARU_OFFLOAD_INFO_PTR pInfo
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !_SOFTHSM_V2_VENDOR_DEFINES_H
@@ -0,0 +1,464 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ AsyncManager.cpp
+
+ Runs operations of sessions on a pool of worker threads
+ *****************************************************************************/
+
+#include "AsyncManager.h"
+#include "vendor_defines.h"
+#include "log.h"
+#include <chrono>
+#include <string.h>
+#include <system_error>
+
+// Constructor
+AsyncMechanism::AsyncMechanism()
+{
+	mechanism.mechanism = CKM_VENDOR_DEFINED;
+	mechanism.pParameter = NULL_PTR;
+	mechanism.ulParameterLen = 0;
+}
+
+// Copies the mechanism and what its parameter points to
+CK_RV AsyncMechanism::set(CK_MECHANISM_PTR pMechanism)
+{
+	if (pMechanism == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if (pMechanism->pParameter == NULL_PTR && pMechanism->ulParameterLen != 0) return CKR_ARGUMENTS_BAD;
+
+	mechanism.mechanism = pMechanism->mechanism;
+	parameter.wipe();
+	first.wipe();
+	second.wipe();
+
+	if (pMechanism->ulParameterLen > 0)
+	{
+		parameter = ByteString((unsigned char*)pMechanism->pParameter, pMechanism->ulParameterLen);
+	}
+
+	switch (pMechanism->mechanism)
+	{
+		case CKM_AES_GCM:
+		{
+			if (parameter.size() != sizeof(CK_GCM_PARAMS)) return CKR_MECHANISM_PARAM_INVALID;
+
+			CK_GCM_PARAMS_PTR params = CK_GCM_PARAMS_PTR(pMechanism->pParameter);
+			if (params->pIv == NULL_PTR && params->ulIvLen != 0) return CKR_MECHANISM_PARAM_INVALID;
+			if (params->pAAD == NULL_PTR && params->ulAADLen != 0) return CKR_MECHANISM_PARAM_INVALID;
+
+			if (params->ulIvLen > 0) first = ByteString(params->pIv, params->ulIvLen);
+			if (params->ulAADLen > 0) second = ByteString(params->pAAD, params->ulAADLen);
+			break;
+		}
+		case CKM_AES_CCM:
+		{
+			if (parameter.size() != sizeof(CK_CCM_PARAMS)) return CKR_MECHANISM_PARAM_INVALID;
+
+			CK_CCM_PARAMS_PTR params = CK_CCM_PARAMS_PTR(pMechanism->pParameter);
+			if (params->pNonce == NULL_PTR && params->ulNonceLen != 0) return CKR_MECHANISM_PARAM_INVALID;
+			if (params->pAAD == NULL_PTR && params->ulAADLen != 0) return CKR_MECHANISM_PARAM_INVALID;
+
+			if (params->ulNonceLen > 0) first = ByteString(params->pNonce, params->ulNonceLen);
+			if (params->ulAADLen > 0) second = ByteString(params->pAAD, params->ulAADLen);
+			break;
+		}
+		case CKM_RSA_PKCS_OAEP:
+		{
+			if (parameter.size() != sizeof(CK_RSA_PKCS_OAEP_PARAMS)) return CKR_MECHANISM_PARAM_INVALID;
+
+			CK_RSA_PKCS_OAEP_PARAMS_PTR params = CK_RSA_PKCS_OAEP_PARAMS_PTR(pMechanism->pParameter);
+			if (params->pSourceData == NULL_PTR && params->ulSourceDataLen != 0) return CKR_MECHANISM_PARAM_INVALID;
+
+			if (params->ulSourceDataLen > 0) first = ByteString((unsigned char*)params->pSourceData, params->ulSourceDataLen);
+			break;
+		}
+		default:
+			// The other parameters hold no pointers
+			break;
+	}
+
+	return CKR_OK;
+}
+
+// The mechanism, with the pointers of its parameter into this copy
+CK_MECHANISM_PTR AsyncMechanism::get()
+{
+	mechanism.pParameter = parameter.size() > 0 ? parameter.byte_str() : NULL_PTR;
+	mechanism.ulParameterLen = parameter.size();
+
+	unsigned char* firstData = first.size() > 0 ? first.byte_str() : NULL_PTR;
+	unsigned char* secondData = second.size() > 0 ? second.byte_str() : NULL_PTR;
+
+	switch (mechanism.mechanism)
+	{
+		case CKM_AES_GCM:
+			CK_GCM_PARAMS_PTR(mechanism.pParameter)->pIv = firstData;
+			CK_GCM_PARAMS_PTR(mechanism.pParameter)->pAAD = secondData;
+			break;
+		case CKM_AES_CCM:
+			CK_CCM_PARAMS_PTR(mechanism.pParameter)->pNonce = firstData;
+			CK_CCM_PARAMS_PTR(mechanism.pParameter)->pAAD = secondData;
+			break;
+		case CKM_RSA_PKCS_OAEP:
+			CK_RSA_PKCS_OAEP_PARAMS_PTR(mechanism.pParameter)->pSourceData = firstData;
+			break;
+		default:
+			break;
+	}
+
+	return &mechanism;
+}
+
+// Constructor
+AsyncManager::AsyncManager(unsigned nWorkers)
+{
+	this->nWorkers = nWorkers;
+	mutex = MutexFactory::i()->getMutex();
+	queued = new std::condition_variable_any();
+	completed = new std::condition_variable_any();
+	nextTicket = 1;
+	stopping = false;
+}
+
+// Destructor
+AsyncManager::~AsyncManager()
+{
+	{
+		MutexLocker guard(mutex);
+
+		stopping = true;
+	}
+
+	queued->notify_all();
+
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i]->join();
+		delete workers[i];
+	}
+
+	delete queued;
+	delete completed;
+	MutexFactory::i()->recycleMutex(mutex);
+}
+
+// Queues an operation of a session and returns its ticket
+CK_RV AsyncManager::submit(CK_SLOT_ID slotID, CK_SESSION_HANDLE hSession, const Job& job, CK_ULONG_PTR pulTicket)
+{
+	if (pulTicket == NULL_PTR) return CKR_ARGUMENTS_BAD;
+
+	std::unique_lock<Mutex> guard(*mutex);
+
+	if (stopping) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	if (workers.empty() && nWorkers > 0)
+	{
+		try
+		{
+			for (unsigned i = 0; i < nWorkers; i++)
+			{
+				workers.push_back(new std::thread(&AsyncManager::work, this));
+			}
+		}
+		catch (const std::system_error& e)
+		{
+			ERROR_MSG("Could not start the asynchronous workers: %s", e.what());
+
+			// Carry on with the workers that did start
+			if (workers.empty()) return CKR_GENERAL_ERROR;
+		}
+	}
+
+	CK_ULONG ticket = nextTicket++;
+	if (nextTicket == CK_INVALID_HANDLE) nextTicket = 1;
+
+	Operation& operation = operations[ticket];
+	operation.slotID = slotID;
+	operation.hSession = hSession;
+	operation.job = job;
+	operation.state = QUEUED;
+	operation.rv = CKR_OK;
+
+	*pulTicket = ticket;
+
+	if (!workers.empty())
+	{
+		queue.push_back(ticket);
+		queued->notify_one();
+
+		return CKR_OK;
+	}
+
+	// Without workers it runs now; the result waits for poll() or wait()
+	operation.state = RUNNING;
+
+	guard.unlock();
+
+	ByteString output;
+	CK_RV rv = job(output);
+
+	guard.lock();
+
+	// The session may have been closed while it ran
+	OperationMap::iterator it = operations.find(ticket);
+	if (it != operations.end())
+	{
+		it->second.state = DONE;
+		it->second.rv = rv;
+		it->second.output = output;
+		it->second.job = Job();
+	}
+
+	return CKR_OK;
+}
+
+// Collects the result of an operation
+CK_RV AsyncManager::poll(CK_SESSION_HANDLE hSession, CK_ULONG ulTicket, CK_BYTE_PTR pOutput, CK_ULONG_PTR pulOutputLen)
+{
+	MutexLocker guard(mutex);
+
+	OperationMap::iterator it = find(hSession, ulTicket);
+	if (it == operations.end()) return CKR_OPERATION_NOT_INITIALIZED;
+
+	if (it->second.state != DONE) return CKR_MIZARU_PENDING;
+
+	return collect(it, pOutput, pulOutputLen);
+}
+
+// Waits for an operation to complete and collects its result
+CK_RV AsyncManager::wait(CK_SESSION_HANDLE hSession, CK_ULONG ulTicket, CK_ULONG ulTimeout, CK_BYTE_PTR pOutput, CK_ULONG_PTR pulOutputLen)
+{
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ulTimeout);
+	std::unique_lock<Mutex> guard(*mutex);
+
+	for (;;)
+	{
+		// Look it up again, the session may have been closed meanwhile
+		OperationMap::iterator it = find(hSession, ulTicket);
+		if (it == operations.end()) return CKR_OPERATION_NOT_INITIALIZED;
+
+		if (it->second.state == DONE) return collect(it, pOutput, pulOutputLen);
+
+		if (ulTimeout == 0)
+		{
+			completed->wait(guard);
+		}
+		else if (completed->wait_until(guard, deadline) == std::cv_status::timeout)
+		{
+			it = find(hSession, ulTicket);
+			if (it == operations.end()) return CKR_OPERATION_NOT_INITIALIZED;
+			if (it->second.state != DONE) return CKR_MIZARU_PENDING;
+		}
+	}
+}
+
+// The number of operations of the session that have not completed
+size_t AsyncManager::getPending(CK_SESSION_HANDLE hSession)
+{
+	MutexLocker guard(mutex);
+
+	size_t pending = 0;
+
+	for (OperationMap::iterator it = operations.begin(); it != operations.end(); ++it)
+	{
+		if (it->second.hSession == hSession && it->second.state != DONE) pending++;
+	}
+
+	return pending;
+}
+
+// Cancels the operations of the session that have not started
+size_t AsyncManager::cancel(CK_SESSION_HANDLE hSession)
+{
+	size_t canceled = 0;
+
+	{
+		MutexLocker guard(mutex);
+
+		for (OperationMap::iterator it = operations.begin(); it != operations.end(); ++it)
+		{
+			Operation& operation = it->second;
+
+			if (operation.hSession != hSession || operation.state != QUEUED) continue;
+
+			// The worker skips it when it comes off the queue
+			operation.state = DONE;
+			operation.rv = CKR_FUNCTION_CANCELED;
+			operation.job = Job();
+			canceled++;
+		}
+	}
+
+	if (canceled > 0) completed->notify_all();
+
+	return canceled;
+}
+
+// Forgets the operations of a closed session
+void AsyncManager::sessionClosed(CK_SESSION_HANDLE hSession)
+{
+	{
+		MutexLocker guard(mutex);
+
+		for (OperationMap::iterator it = operations.begin(); it != operations.end();)
+		{
+			if (it->second.hSession == hSession)
+				operations.erase(it++);
+			else
+				++it;
+		}
+	}
+
+	// Wake up anyone waiting for them
+	completed->notify_all();
+}
+
+// Forgets the operations of the sessions of a slot
+void AsyncManager::allSessionsClosed(CK_SLOT_ID slotID)
+{
+	{
+		MutexLocker guard(mutex);
+
+		for (OperationMap::iterator it = operations.begin(); it != operations.end();)
+		{
+			if (it->second.slotID == slotID)
+				operations.erase(it++);
+			else
+				++it;
+		}
+	}
+
+	completed->notify_all();
+}
+
+// Lets go of the workers, which do not exist in a forked child
+void AsyncManager::abandon()
+{
+	// The threads, and the lock and the conditions they may have been
+	// holding or waiting on, are leaked; destroying them here could block
+	workers.clear();
+	mutex = MutexFactory::i()->getMutex();
+	queued = new std::condition_variable_any();
+	completed = new std::condition_variable_any();
+
+	queue.clear();
+	operations.clear();
+}
+
+// The loop of a worker thread
+void AsyncManager::work()
+{
+	std::unique_lock<Mutex> guard(*mutex);
+
+	for (;;)
+	{
+		while (queue.empty() && !stopping)
+		{
+			queued->wait(guard);
+		}
+
+		if (stopping) return;
+
+		CK_ULONG ticket = queue.front();
+		queue.pop_front();
+
+		// Canceled or closed in the meantime
+		OperationMap::iterator it = operations.find(ticket);
+		if (it == operations.end() || it->second.state != QUEUED) continue;
+
+		Job job;
+		job.swap(it->second.job);
+		it->second.state = RUNNING;
+
+		guard.unlock();
+
+		ByteString output;
+		CK_RV rv = job(output);
+
+		guard.lock();
+
+		// The session may have been closed while it ran
+		it = operations.find(ticket);
+		if (it != operations.end())
+		{
+			it->second.state = DONE;
+			it->second.rv = rv;
+			it->second.output = output;
+		}
+
+		completed->notify_all();
+	}
+}
+
+// Finds an operation of the session; the lock must be held
+AsyncManager::OperationMap::iterator AsyncManager::find(CK_SESSION_HANDLE hSession, CK_ULONG ulTicket)
+{
+	OperationMap::iterator it = operations.find(ulTicket);
+
+	if (it != operations.end() && it->second.hSession != hSession) return operations.end();
+
+	return it;
+}
+
+// Hands out the result of a completed operation; the lock must be held
+CK_RV AsyncManager::collect(OperationMap::iterator it, CK_BYTE_PTR pOutput, CK_ULONG_PTR pulOutputLen)
+{
+	Operation& operation = it->second;
+	CK_RV rv = operation.rv;
+
+	if (rv == CKR_OK && operation.output.size() > 0)
+	{
+		if (pulOutputLen == NULL_PTR) return CKR_ARGUMENTS_BAD;
+
+		CK_ULONG size = operation.output.size();
+
+		// Only the size was asked for
+		if (pOutput == NULL_PTR)
+		{
+			*pulOutputLen = size;
+			return CKR_OK;
+		}
+
+		if (*pulOutputLen < size)
+		{
+			*pulOutputLen = size;
+			return CKR_BUFFER_TOO_SMALL;
+		}
+
+		memcpy(pOutput, operation.output.const_byte_str(), size);
+		*pulOutputLen = size;
+	}
+	else if (pulOutputLen != NULL_PTR)
+	{
+		*pulOutputLen = 0;
+	}
+
+	operations.erase(it);
+
+	return rv;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ AsyncManager.h
+
+ Runs operations of sessions on a pool of worker threads. An operation is
+ identified by a ticket; its result is collected with poll() or wait().
+ Operations that have not started can be canceled, and the operations of a
+ session are forgotten when it is closed. Without workers, an operation runs
+ in the thread that submits it and its result waits to be collected.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_ASYNCMANAGER_H
+#define _SOFTHSM_V2_ASYNCMANAGER_H
+
+#include "config.h"
+#include "cryptoki.h"
+#include "ByteString.h"
+#include "MutexFactory.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// The default number of worker threads
+#define DEFAULT_ASYNC_WORKERS 4
+
+// A copy of a mechanism that outlives the caller's buffers. The buffers the
+// parameters of AES-GCM, AES-CCM and RSA-OAEP point to are copied as well.
+class AsyncMechanism
+{
+public:
+	AsyncMechanism();
+
+	// Copies the mechanism; fails with CKR_MECHANISM_PARAM_INVALID if its
+	// parameter is malformed
+	CK_RV set(CK_MECHANISM_PTR pMechanism);
+
+	// The mechanism, pointing into this copy
+	CK_MECHANISM_PTR get();
+
+private:
+	CK_MECHANISM mechanism;
+	ByteString parameter;
+
+	// The buffers the parameter points to
+	ByteString first;
+	ByteString second;
+};
+
+class AsyncManager
+{
+public:
+	// The work of an operation; it fills in the output and returns the result
+	typedef std::function<CK_RV(ByteString& output)> Job;
+
+	// The workers are started when the first operation is submitted; with
+	// no workers the operations run when they are submitted
+	explicit AsyncManager(unsigned nWorkers);
+
+	// Cancels the queued operations and waits for the running ones
+	virtual ~AsyncManager();
+
+	// Queues, or without workers runs, an operation of a session and
+	// returns its ticket
+	CK_RV submit(CK_SLOT_ID slotID, CK_SESSION_HANDLE hSession, const Job& job, CK_ULONG_PTR pulTicket);
+
+	// Collects the result of an operation, CKR_MIZARU_PENDING if it has
+	// not completed. The output is returned like in C_Sign; the ticket is
+	// released once the result has been collected.
+	CK_RV poll(CK_SESSION_HANDLE hSession, CK_ULONG ulTicket, CK_BYTE_PTR pOutput, CK_ULONG_PTR pulOutputLen);
+
+	// As poll(), but waits up to ulTimeout ms for the operation to complete;
+	// a timeout of 0 waits without limit
+	CK_RV wait(CK_SESSION_HANDLE hSession, CK_ULONG ulTicket, CK_ULONG ulTimeout, CK_BYTE_PTR pOutput, CK_ULONG_PTR pulOutputLen);
+
+	// The number of operations of the session that have not completed
+	size_t getPending(CK_SESSION_HANDLE hSession);
+
+	// Cancels the operations of the session that have not started; they
+	// complete with CKR_FUNCTION_CANCELED. Returns the number canceled.
+	size_t cancel(CK_SESSION_HANDLE hSession);
+
+	// Forgets the operations of closed sessions
+	void sessionClosed(CK_SESSION_HANDLE hSession);
+	void allSessionsClosed(CK_SLOT_ID slotID);
+
+	// Lets go of the workers, which do not exist in a forked child, and of
+	// the operations and the locks they shared with the parent
+	void abandon();
+
+private:
+	enum State
+	{
+		QUEUED,
+		RUNNING,
+		DONE
+	};
+
+	struct Operation
+	{
+		CK_SLOT_ID slotID;
+		CK_SESSION_HANDLE hSession;
+		Job job;
+		State state;
+		CK_RV rv;
+		ByteString output;
+	};
+
+	typedef std::map<CK_ULONG, Operation> OperationMap;
+
+	// The loop of a worker thread
+	void work();
+
+	// Finds an operation of the session; the lock must be held
+	OperationMap::iterator find(CK_SESSION_HANDLE hSession, CK_ULONG ulTicket);
+
+	// Hands out the result of a completed operation; the lock must be held
+	CK_RV collect(OperationMap::iterator it, CK_BYTE_PTR pOutput, CK_ULONG_PTR pulOutputLen);
+
+	unsigned nWorkers;
+	std::vector<std::thread*> workers;
+
+	Mutex* mutex;
+
+	// Signalled when an operation is queued or the manager stops
+	std::condition_variable_any* queued;
+
+	// Signalled when an operation completes
+	std::condition_variable_any* completed;
+
+	std::deque<CK_ULONG> queue;
+	OperationMap operations;
+	CK_ULONG nextTicket;
+	bool stopping;
+};
+
+#endif // !_SOFTHSM_V2_ASYNCMANAGER_H
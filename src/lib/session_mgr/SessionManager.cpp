@@ -27,11 +27,15 @@
 /*****************************************************************************
  SessionManager.cpp
 
- Keeps track of the sessions within SoftHSM. The sessions are stored in a 
+ Keeps track of the sessions within SoftHSM. The sessions are stored in a
  vector. When a session is closed, its spot in the vector will be replaced
- with NULL. Because we want to keep track of the session ID which is 
- equal to its location in the vector. New sessions will first fill up the NULL
- locations and if there is no empty spots, then they are added to the end.
+ with NULL. Because we want to keep track of the session ID which is
+ equal to its location in the vector. New sessions will first fill up the
+ NULL locations and if there is no empty spots, then they are added to the end.
+
+ The number of sessions and read-only sessions is kept per slot, together
+ with the handles of the sessions of the slot. Opening and closing sessions
+ is serialised per slot; the table itself is only locked while it changes.
  *****************************************************************************/
 
 #include "SessionManager.h"
@@ -54,9 +58,42 @@ SessionManager::~SessionManager()
 		if (*i != NULL) delete *i;
 	}
 
+	for (std::map<CK_SLOT_ID, SlotSessions>::iterator i = slots.begin(); i != slots.end(); i++)
+	{
+		MutexFactory::i()->recycleMutex(i->second.slotMutex);
+	}
+
 	MutexFactory::i()->recycleMutex(sessionsMutex);
 }
 
+// Get the sessions of a slot
+SessionManager::SlotSessions* SessionManager::getSlotSessions(CK_SLOT_ID slotID)
+{
+	std::map<CK_SLOT_ID, SlotSessions>::iterator i = slots.find(slotID);
+
+	if (i != slots.end()) return &i->second;
+
+	SlotSessions& slotSessions = slots[slotID];
+	slotSessions.count = 0;
+	slotSessions.roCount = 0;
+	slotSessions.slotMutex = MutexFactory::i()->getMutex();
+
+	return &slotSessions;
+}
+
+// Remove a session from the table
+void SessionManager::removeSession(CK_SESSION_HANDLE hSession, SlotSessions* slotSessions)
+{
+	Session* session = sessions[hSession - 1];
+
+	sessions[hSession - 1] = NULL;
+	freePositions.push_back(hSession - 1);
+
+	slotSessions->handles.erase(hSession);
+	slotSessions->count--;
+	if (!session->isRW()) slotSessions->roCount--;
+}
+
 // Open a new session
 CK_RV SessionManager::openSession
 (
@@ -71,8 +108,15 @@ CK_RV SessionManager::openSession
 	if (slot == NULL) return CKR_SLOT_ID_INVALID;
 	if ((flags & CKF_SERIAL_SESSION) == 0) return CKR_SESSION_PARALLEL_NOT_SUPPORTED;
 
-	// Lock access to the vector
-	MutexLocker lock(sessionsMutex);
+	SlotSessions* slotSessions;
+	{
+		MutexLocker lock(sessionsMutex);
+
+		slotSessions = getSlotSessions(slot->getSlotID());
+	}
+
+	// Lock access to the sessions of the slot
+	MutexLocker slotLock(slotSessions->slotMutex);
 
 	// Get the token
 	Token* token = slot->getToken();
@@ -89,24 +133,28 @@ CK_RV SessionManager::openSession
 	bool rwSession = ((flags & CKF_RW_SESSION) == CKF_RW_SESSION) ? true : false;
 	Session* session = new Session(slot, rwSession, pApplication, notify);
 
-	// First fill any empty spot in the list
-	for (size_t i = 0; i < sessions.size(); i++)
-	{
-		if (sessions[i] != NULL)
-		{
-			continue;
-		}
+	// Lock access to the vector
+	MutexLocker lock(sessionsMutex);
 
-		sessions[i] = session;
-		session->setHandle(i + 1);
-		*phSession = session->getHandle();
+	// First fill any empty spot in the list, or add it to the end
+	if (!freePositions.empty())
+	{
+		size_t position = freePositions.back();
+		freePositions.pop_back();
 
-		return CKR_OK;
+		sessions[position] = session;
+		session->setHandle(position + 1);
 	}
+	else
+	{
+		sessions.push_back(session);
+		session->setHandle(sessions.size());
+	}
+
+	slotSessions->handles.insert(session->getHandle());
+	slotSessions->count++;
+	if (!rwSession) slotSessions->roCount++;
 
-	// Or add it to the end
-	sessions.push_back(session);
-	session->setHandle(sessions.size());
 	*phSession = session->getHandle();
 
 	return CKR_OK;
@@ -117,39 +165,46 @@ CK_RV SessionManager::closeSession(CK_SESSION_HANDLE hSession)
 {
 	if (hSession == CK_INVALID_HANDLE) return CKR_SESSION_HANDLE_INVALID;
 
-	// Lock access to the vector
-	MutexLocker lock(sessionsMutex);
+	Session* session;
+	SlotSessions* slotSessions;
+	{
+		// Lock access to the vector
+		MutexLocker lock(sessionsMutex);
 
-	// Check if we are out of range
-	if (hSession > sessions.size()) return CKR_SESSION_HANDLE_INVALID;
+		// Check if we are out of range
+		if (hSession > sessions.size()) return CKR_SESSION_HANDLE_INVALID;
 
-	// Check if it is a closed session
-	unsigned long sessionID = hSession - 1;
-	if (sessions[sessionID] == NULL) return CKR_SESSION_HANDLE_INVALID;
+		// Check if it is a closed session
+		session = sessions[hSession - 1];
+		if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
 
-	// Check if this is the last session on the token
-	bool lastSession = true;
-	const CK_SLOT_ID slotID( sessions[sessionID]->getSlot()->getSlotID() );
-	for (size_t i = 0; i < sessions.size(); i++)
+		slotSessions = getSlotSessions(session->getSlot()->getSlotID());
+	}
+
+	// Lock access to the sessions of the slot
+	MutexLocker slotLock(slotSessions->slotMutex);
+
+	bool lastSession;
 	{
-		if (sessions[i] == NULL) continue;
+		MutexLocker lock(sessionsMutex);
 
-		if (sessions[i]->getSlot()->getSlotID() == slotID && i != sessionID)
-		{
-			lastSession = false;
-			break;
-		}
+		// The session may have been closed in the meantime
+		if (sessions[hSession - 1] != session) return CKR_SESSION_HANDLE_INVALID;
+
+		removeSession(hSession, slotSessions);
+
+		// Check if this is the last session on the token
+		lastSession = (slotSessions->count == 0);
 	}
 
 	// Logout if this is the last session on the token
 	if (lastSession)
 	{
-		sessions[sessionID]->getSlot()->getToken()->logout();
+		session->getSlot()->getToken()->logout();
 	}
 
 	// Close the session
-	delete sessions[sessionID];
-	sessions[sessionID] = NULL;
+	delete session;
 
 	return CKR_OK;
 }
@@ -159,26 +214,39 @@ CK_RV SessionManager::closeAllSessions(Slot* slot)
 {
 	if (slot == NULL) return CKR_SLOT_ID_INVALID;
 
-	// Lock access to the vector
-	MutexLocker lock(sessionsMutex);
+	SlotSessions* slotSessions;
+	{
+		MutexLocker lock(sessionsMutex);
+
+		slotSessions = getSlotSessions(slot->getSlotID());
+	}
+
+	// Lock access to the sessions of the slot
+	MutexLocker slotLock(slotSessions->slotMutex);
 
 	// Get the token
 	Token* token = slot->getToken();
 	if (token == NULL) return CKR_TOKEN_NOT_PRESENT;
 
-	// Close all sessions on this slot
-	const CK_SLOT_ID slotID( slot->getSlotID() );
-	for (std::vector<Session*>::iterator i = sessions.begin(); i != sessions.end(); i++)
+	// Take all sessions on this slot out of the table
+	std::vector<Session*> toDelete;
 	{
-		if (*i == NULL) continue;
+		MutexLocker lock(sessionsMutex);
 
-		if ((*i)->getSlot()->getSlotID() == slotID)
+		std::set<CK_SESSION_HANDLE> handles = slotSessions->handles;
+		for (std::set<CK_SESSION_HANDLE>::iterator i = handles.begin(); i != handles.end(); i++)
 		{
-			delete *i;
-			*i = NULL;
+			toDelete.push_back(sessions[*i - 1]);
+			removeSession(*i, slotSessions);
 		}
 	}
 
+	// Close the sessions
+	for (std::vector<Session*>::iterator i = toDelete.begin(); i != toDelete.end(); i++)
+	{
+		delete *i;
+	}
+
 	// Logout from the token
 	token->logout();
 
@@ -215,17 +283,9 @@ bool SessionManager::haveSession(CK_SLOT_ID slotID)
 	// Lock access to the vector
 	MutexLocker lock(sessionsMutex);
 
-	for (std::vector<Session*>::iterator i = sessions.begin(); i != sessions.end(); i++)
-	{
-		if (*i == NULL) continue;
+	std::map<CK_SLOT_ID, SlotSessions>::iterator i = slots.find(slotID);
 
-		if ((*i)->getSlot()->getSlotID() == slotID)
-		{
-			return true;
-		}
-	}
-
-	return false;
+	return (i != slots.end()) && (i->second.count > 0);
 }
 
 bool SessionManager::haveROSession(CK_SLOT_ID slotID)
@@ -233,14 +293,7 @@ bool SessionManager::haveROSession(CK_SLOT_ID slotID)
 	// Lock access to the vector
 	MutexLocker lock(sessionsMutex);
 
-	for (std::vector<Session*>::iterator i = sessions.begin(); i != sessions.end(); i++)
-	{
-		if (*i == NULL) continue;
-
-		if ((*i)->getSlot()->getSlotID() != slotID) continue;
-
-		if ((*i)->isRW() == false) return true;
-	}
+	std::map<CK_SLOT_ID, SlotSessions>::iterator i = slots.find(slotID);
 
-	return false;
+	return (i != slots.end()) && (i->second.roCount > 0);
 }
@@ -38,7 +38,9 @@
 #include "MutexFactory.h"
 #include "config.h"
 #include "cryptoki.h"
+#include <map>
 #include <memory>
+#include <set>
 #include <vector>
 
 class SessionManager
@@ -57,8 +59,35 @@ public:
 	bool haveROSession(CK_SLOT_ID slotID);
 
 private:
-	// The sessions
+	// The sessions of a slot
+	struct SlotSessions
+	{
+		// The number of open sessions and read-only sessions
+		size_t count;
+		size_t roCount;
+
+		// The handles of the open sessions
+		std::set<CK_SESSION_HANDLE> handles;
+
+		// Serialises opening and closing sessions on the slot
+		Mutex* slotMutex;
+	};
+
+	// Get the sessions of a slot; the table must be locked
+	SlotSessions* getSlotSessions(CK_SLOT_ID slotID);
+
+	// Remove a session from the table; the table must be locked
+	void removeSession(CK_SESSION_HANDLE hSession, SlotSessions* slotSessions);
+
+	// The sessions; the handle of a session is its position plus one
 	std::vector<Session*> sessions;
+
+	// Unused positions in the table
+	std::vector<size_t> freePositions;
+
+	// The sessions per slot
+	std::map<CK_SLOT_ID, SlotSessions> slots;
+
 	Mutex* sessionsMutex;
 };
 
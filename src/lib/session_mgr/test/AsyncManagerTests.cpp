@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ AsyncManagerTests.cpp
+
+ Contains test cases for AsyncManager
+ *****************************************************************************/
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "AsyncManagerTests.h"
+#include "AsyncManager.h"
+#include "vendor_defines.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(AsyncManagerTests);
+
+void AsyncManagerTests::setUp()
+{
+}
+
+void AsyncManagerTests::tearDown()
+{
+}
+
+// A job that holds its worker until it is released
+class Gate
+{
+public:
+	Gate() : open(false), entered(0) { }
+
+	AsyncManager::Job job(const ByteString& result)
+	{
+		return [this, result](ByteString& output)
+		{
+			entered++;
+			while (!open) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			output = result;
+			return (CK_RV) CKR_OK;
+		};
+	}
+
+	std::atomic<bool> open;
+	std::atomic<int> entered;
+};
+
+void AsyncManagerTests::testPollWait()
+{
+	Gate gate;
+	AsyncManager manager(2);
+	CK_ULONG ticket, failed;
+	CK_BYTE buffer[16];
+	CK_ULONG len;
+
+	CPPUNIT_ASSERT(manager.submit(1, 10, gate.job(ByteString("0102030405")), &ticket) == CKR_OK);
+	CPPUNIT_ASSERT(ticket != CK_INVALID_HANDLE);
+	CPPUNIT_ASSERT(manager.submit(1, 10, [](ByteString&) { return (CK_RV) CKR_SIGNATURE_INVALID; }, &failed) == CKR_OK);
+	CPPUNIT_ASSERT(failed != ticket);
+
+	// Not done yet
+	len = sizeof(buffer);
+	CPPUNIT_ASSERT(manager.poll(10, ticket, buffer, &len) == CKR_MIZARU_PENDING);
+	CPPUNIT_ASSERT(manager.wait(10, ticket, 20, buffer, &len) == CKR_MIZARU_PENDING);
+	CPPUNIT_ASSERT(manager.getPending(10) >= 1);
+
+	// Tickets belong to their session
+	CPPUNIT_ASSERT(manager.poll(11, ticket, buffer, &len) == CKR_OPERATION_NOT_INITIALIZED);
+
+	gate.open = true;
+
+	// Size query and a buffer that is too small keep the ticket
+	CPPUNIT_ASSERT(manager.wait(10, ticket, 0, NULL_PTR, &len) == CKR_OK);
+	CPPUNIT_ASSERT(len == 5);
+	len = 4;
+	CPPUNIT_ASSERT(manager.poll(10, ticket, buffer, &len) == CKR_BUFFER_TOO_SMALL);
+	CPPUNIT_ASSERT(len == 5);
+	len = sizeof(buffer);
+	CPPUNIT_ASSERT(manager.poll(10, ticket, buffer, &len) == CKR_OK);
+	CPPUNIT_ASSERT(ByteString(buffer, len) == ByteString("0102030405"));
+
+	// The ticket has been released
+	CPPUNIT_ASSERT(manager.poll(10, ticket, buffer, &len) == CKR_OPERATION_NOT_INITIALIZED);
+
+	// Errors are the result, without output
+	CPPUNIT_ASSERT(manager.wait(10, failed, 0, NULL_PTR, NULL_PTR) == CKR_SIGNATURE_INVALID);
+	CPPUNIT_ASSERT(manager.getPending(10) == 0);
+}
+
+void AsyncManagerTests::testConcurrency()
+{
+	Gate gate;
+	AsyncManager manager(4);
+	CK_ULONG tickets[8];
+
+	for (int i = 0; i < 8; i++)
+	{
+		CPPUNIT_ASSERT(manager.submit(1, 10, gate.job(ByteString("aa")), &tickets[i]) == CKR_OK);
+	}
+
+	// One thread keeps every worker busy
+	for (int i = 0; i < 1000 && gate.entered < 4; i++)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	CPPUNIT_ASSERT(gate.entered == 4);
+	CPPUNIT_ASSERT(manager.getPending(10) == 8);
+
+	gate.open = true;
+
+	for (int i = 0; i < 8; i++)
+	{
+		CK_BYTE out[2];
+		CK_ULONG len = sizeof(out);
+		CPPUNIT_ASSERT(manager.wait(10, tickets[i], 0, out, &len) == CKR_OK);
+		CPPUNIT_ASSERT(len == 1 && out[0] == 0xaa);
+	}
+	CPPUNIT_ASSERT(gate.entered == 8);
+}
+
+void AsyncManagerTests::testCancelClose()
+{
+	Gate gate;
+	AsyncManager manager(1);
+	CK_ULONG running, queued, other, closed;
+
+	CPPUNIT_ASSERT(manager.submit(1, 10, gate.job(ByteString("01")), &running) == CKR_OK);
+	CPPUNIT_ASSERT(manager.submit(1, 10, gate.job(ByteString("02")), &queued) == CKR_OK);
+	CPPUNIT_ASSERT(manager.submit(1, 11, gate.job(ByteString("03")), &other) == CKR_OK);
+	CPPUNIT_ASSERT(manager.submit(2, 12, gate.job(ByteString("04")), &closed) == CKR_OK);
+
+	for (int i = 0; i < 1000 && gate.entered < 1; i++)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	// Only the operation that has not started is canceled
+	CPPUNIT_ASSERT(manager.cancel(10) == 1);
+	CPPUNIT_ASSERT(manager.poll(10, queued, NULL_PTR, NULL_PTR) == CKR_FUNCTION_CANCELED);
+
+	// Closed sessions lose their tickets
+	manager.allSessionsClosed(2);
+	CPPUNIT_ASSERT(manager.poll(12, closed, NULL_PTR, NULL_PTR) == CKR_OPERATION_NOT_INITIALIZED);
+
+	gate.open = true;
+
+	CK_BYTE out[1];
+	CK_ULONG len = sizeof(out);
+	CPPUNIT_ASSERT(manager.wait(10, running, 0, out, &len) == CKR_OK);
+	CPPUNIT_ASSERT(out[0] == 0x01);
+
+	manager.sessionClosed(11);
+	CPPUNIT_ASSERT(manager.wait(11, other, 0, out, &len) == CKR_OPERATION_NOT_INITIALIZED);
+
+	// The canceled and closed operations never ran
+	CPPUNIT_ASSERT(gate.entered <= 2);
+}
+
+void AsyncManagerTests::testNoWorkers()
+{
+	AsyncManager manager(0);
+	std::thread::id caller = std::this_thread::get_id();
+	std::thread::id ranOn;
+	CK_ULONG ticket;
+
+	AsyncManager::Job job = [&ranOn](ByteString& output)
+	{
+		ranOn = std::this_thread::get_id();
+		output = ByteString("abcd");
+		return (CK_RV) CKR_OK;
+	};
+
+	// The operation runs in the call that submits it
+	CPPUNIT_ASSERT(manager.submit(1, 10, job, &ticket) == CKR_OK);
+	CPPUNIT_ASSERT(ranOn == caller);
+	CPPUNIT_ASSERT(manager.getPending(10) == 0);
+	CPPUNIT_ASSERT(manager.cancel(10) == 0);
+
+	CK_BYTE out[2];
+	CK_ULONG len = sizeof(out);
+	CPPUNIT_ASSERT(manager.poll(10, ticket, out, &len) == CKR_OK);
+	CPPUNIT_ASSERT(len == 2 && out[0] == 0xab && out[1] == 0xcd);
+	CPPUNIT_ASSERT(manager.poll(10, ticket, out, &len) == CKR_OPERATION_NOT_INITIALIZED);
+}
+
+void AsyncManagerTests::testFork()
+{
+	Gate gate;
+	AsyncManager* manager = new AsyncManager(1);
+	CK_ULONG running;
+
+	// The parent's worker is busy, and holds its place in the manager
+	CPPUNIT_ASSERT(manager->submit(1, 10, gate.job(ByteString("01")), &running) == CKR_OK);
+	for (int i = 0; i < 1000 && gate.entered < 1; i++)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	pid_t pid = fork();
+	CPPUNIT_ASSERT(pid >= 0);
+
+	if (pid == 0)
+	{
+		// Without the parent's worker the child lets go of it, and then of
+		// the manager, without waiting
+		alarm(10);
+		manager->abandon();
+		bool ok = manager->poll(10, running, NULL_PTR, NULL_PTR) == CKR_OPERATION_NOT_INITIALIZED;
+		delete manager;
+		_exit(ok ? 0 : 1);
+	}
+
+	int status = 0;
+	CPPUNIT_ASSERT(waitpid(pid, &status, 0) == pid);
+	CPPUNIT_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	gate.open = true;
+
+	CK_BYTE out[1];
+	CK_ULONG len = sizeof(out);
+	CPPUNIT_ASSERT(manager->wait(10, running, 0, out, &len) == CKR_OK);
+	CPPUNIT_ASSERT(out[0] == 0x01);
+
+	delete manager;
+}
+
+void AsyncManagerTests::testMechanismCopy()
+{
+	CK_BYTE iv[12] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+	CK_BYTE aad[3] = { 0xA, 0xB, 0xC };
+	CK_GCM_PARAMS gcm = { iv, sizeof(iv), sizeof(iv) * 8, aad, sizeof(aad), 128 };
+	CK_MECHANISM mechanism = { CKM_AES_GCM, &gcm, sizeof(gcm) };
+
+	AsyncMechanism original;
+	CPPUNIT_ASSERT(original.set(&mechanism) == CKR_OK);
+
+	// The caller's buffers are gone by the time the operation runs
+	memset(iv, 0, sizeof(iv));
+	memset(aad, 0, sizeof(aad));
+	gcm.ulTagBits = 0;
+
+	AsyncMechanism copy(original);
+	CK_MECHANISM_PTR pCopy = copy.get();
+	CPPUNIT_ASSERT(pCopy->mechanism == CKM_AES_GCM);
+	CPPUNIT_ASSERT(pCopy->ulParameterLen == sizeof(CK_GCM_PARAMS));
+
+	CK_GCM_PARAMS_PTR params = CK_GCM_PARAMS_PTR(pCopy->pParameter);
+	CPPUNIT_ASSERT(params != &gcm && params->pIv != iv && params->pAAD != aad);
+	CPPUNIT_ASSERT(params->ulIvLen == 12 && params->pIv[0] == 1 && params->pIv[11] == 12);
+	CPPUNIT_ASSERT(params->ulAADLen == 3 && params->pAAD[2] == 0xC);
+	CPPUNIT_ASSERT(params->ulTagBits == 128);
+
+	// OAEP without source data and a plain IV
+	CK_RSA_PKCS_OAEP_PARAMS oaep = { CKM_SHA_1, CKG_MGF1_SHA1, CKZ_DATA_SPECIFIED, NULL_PTR, 0 };
+	mechanism.mechanism = CKM_RSA_PKCS_OAEP;
+	mechanism.pParameter = &oaep;
+	mechanism.ulParameterLen = sizeof(oaep);
+	CPPUNIT_ASSERT(copy.set(&mechanism) == CKR_OK);
+	CPPUNIT_ASSERT(CK_RSA_PKCS_OAEP_PARAMS_PTR(copy.get()->pParameter)->pSourceData == NULL_PTR);
+
+	mechanism.mechanism = CKM_AES_CBC;
+	mechanism.pParameter = iv;
+	mechanism.ulParameterLen = 16;
+	CPPUNIT_ASSERT(copy.set(&mechanism) == CKR_OK);
+	CPPUNIT_ASSERT(copy.get()->ulParameterLen == 16 && copy.get()->pParameter != iv);
+
+	// Malformed parameters are refused
+	CK_CCM_PARAMS ccm = { 16, NULL_PTR, 12, NULL_PTR, 0, 16 };
+	mechanism.mechanism = CKM_AES_CCM;
+	mechanism.pParameter = &ccm;
+	mechanism.ulParameterLen = sizeof(ccm);
+	CPPUNIT_ASSERT(copy.set(&mechanism) == CKR_MECHANISM_PARAM_INVALID);
+
+	mechanism.mechanism = CKM_AES_GCM;
+	mechanism.pParameter = &gcm;
+	mechanism.ulParameterLen = sizeof(gcm) - 1;
+	CPPUNIT_ASSERT(copy.set(&mechanism) == CKR_MECHANISM_PARAM_INVALID);
+}
@@ -258,3 +258,64 @@ void SessionManagerTests::testSessionInfo()
 	rv = sessionManager.closeSession(hSession);
 	CPPUNIT_ASSERT(rv == CKR_OK);
 }
+
+void SessionManagerTests::testSessionCounters()
+{
+	// Create an empty object store
+#ifndef _WIN32
+	ObjectStore store("./testdir", DEFAULT_UMASK);
+#else
+	ObjectStore store(".\\testdir", DEFAULT_UMASK);
+#endif
+
+	// Create the managers
+	SlotManager slotManager(&store);
+	SessionManager sessionManager;
+
+	// Get a slot
+	CK_SLOT_ID slotID = 0;
+	Slot* slot = slotManager.getSlot(slotID);
+
+	// Initialize the token
+	ByteString soPIN((unsigned char*)"1234", 4);
+	CK_UTF8CHAR label[33] = "My test token                   ";
+	CPPUNIT_ASSERT(slot->initToken(soPIN, label) == CKR_OK);
+
+	// Open a mix of read-only and read-write sessions
+	CK_SESSION_HANDLE hRO[4];
+	CK_SESSION_HANDLE hRW[4];
+	for (int i = 0; i < 4; i++)
+	{
+		CPPUNIT_ASSERT(sessionManager.openSession(slot, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &hRO[i]) == CKR_OK);
+		CPPUNIT_ASSERT(sessionManager.openSession(slot, CKF_SERIAL_SESSION | CKF_RW_SESSION, NULL_PTR, NULL_PTR, &hRW[i]) == CKR_OK);
+	}
+	CPPUNIT_ASSERT(sessionManager.haveSession(slotID));
+	CPPUNIT_ASSERT(sessionManager.haveROSession(slotID));
+
+	// Other slots are not affected
+	CPPUNIT_ASSERT(!sessionManager.haveSession(slotID + 1));
+	CPPUNIT_ASSERT(!sessionManager.haveROSession(slotID + 1));
+
+	// The counters follow the sessions that are closed
+	for (int i = 0; i < 4; i++)
+	{
+		CPPUNIT_ASSERT(sessionManager.haveROSession(slotID));
+		CPPUNIT_ASSERT(sessionManager.closeSession(hRO[i]) == CKR_OK);
+	}
+	CPPUNIT_ASSERT(!sessionManager.haveROSession(slotID));
+	CPPUNIT_ASSERT(sessionManager.haveSession(slotID));
+
+	// Handles of closed sessions are handed out again
+	CK_SESSION_HANDLE hSession;
+	CPPUNIT_ASSERT(sessionManager.openSession(slot, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &hSession) == CKR_OK);
+	CPPUNIT_ASSERT(hSession <= 8);
+	CPPUNIT_ASSERT(sessionManager.getSession(hSession) != NULL);
+	CPPUNIT_ASSERT(sessionManager.haveROSession(slotID));
+
+	// Closing all sessions resets the counters
+	CPPUNIT_ASSERT(sessionManager.closeAllSessions(slot) == CKR_OK);
+	CPPUNIT_ASSERT(!sessionManager.haveSession(slotID));
+	CPPUNIT_ASSERT(!sessionManager.haveROSession(slotID));
+	CPPUNIT_ASSERT(sessionManager.getSession(hSession) == NULL);
+	CPPUNIT_ASSERT(sessionManager.closeSession(hRW[0]) == CKR_SESSION_HANDLE_INVALID);
+}
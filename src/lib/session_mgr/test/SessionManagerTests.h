@@ -40,11 +40,13 @@ class SessionManagerTests : public CppUnit::TestFixture
 	CPPUNIT_TEST_SUITE(SessionManagerTests);
 	CPPUNIT_TEST(testOpenClose);
 	CPPUNIT_TEST(testSessionInfo);
+	CPPUNIT_TEST(testSessionCounters);
 	CPPUNIT_TEST_SUITE_END();
 
 public:
 	void testOpenClose();
 	void testSessionInfo();
+	void testSessionCounters();
 
 	void setUp();
 	void tearDown();
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ KeyCache.cpp
+
+ A bounded cache for the decrypted key material of private token objects.
+ Entries are stored in their serialised form in secure memory and are tied
+ to the revision of the object they were read from
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "KeyCache.h"
+
+// Constructor
+KeyCache::KeyCache(size_t inMaxEntries)
+{
+	maxEntries = inMaxEntries;
+	hits = 0;
+	misses = 0;
+
+	cacheMutex = MutexFactory::i()->getMutex();
+}
+
+// Destructor
+KeyCache::~KeyCache()
+{
+	clear();
+
+	MutexFactory::i()->recycleMutex(cacheMutex);
+}
+
+// Retrieve the key material cached for the object at the given revision
+bool KeyCache::get(OSObject* object, unsigned long revision, ByteString& material)
+{
+	MutexLocker lock(cacheMutex);
+
+	if (maxEntries == 0) return false;
+
+	std::map<OSObject*, Entry>::iterator i = entries.find(object);
+
+	if (i == entries.end())
+	{
+		misses++;
+
+		return false;
+	}
+
+	// The object has changed since the entry was stored
+	if (i->second.revision != revision)
+	{
+		lru.erase(i->second.lruPosition);
+		entries.erase(i);
+
+		misses++;
+
+		return false;
+	}
+
+	// Move the entry to the front of the LRU list
+	lru.splice(lru.begin(), lru, i->second.lruPosition);
+
+	material = i->second.material;
+
+	hits++;
+
+	return true;
+}
+
+// Store the key material of the object at the given revision
+void KeyCache::put(OSObject* object, unsigned long revision, const ByteString& material)
+{
+	MutexLocker lock(cacheMutex);
+
+	if (maxEntries == 0) return;
+
+	std::map<OSObject*, Entry>::iterator i = entries.find(object);
+
+	if (i != entries.end())
+	{
+		i->second.revision = revision;
+		i->second.material = material;
+		lru.splice(lru.begin(), lru, i->second.lruPosition);
+
+		return;
+	}
+
+	// Evict the least recently used entry
+	if (entries.size() >= maxEntries)
+	{
+		entries.erase(lru.back());
+		lru.pop_back();
+	}
+
+	lru.push_front(object);
+
+	Entry& entry = entries[object];
+	entry.revision = revision;
+	entry.material = material;
+	entry.lruPosition = lru.begin();
+}
+
+// Remove the entry for the object
+void KeyCache::remove(OSObject* object)
+{
+	MutexLocker lock(cacheMutex);
+
+	std::map<OSObject*, Entry>::iterator i = entries.find(object);
+
+	if (i == entries.end()) return;
+
+	lru.erase(i->second.lruPosition);
+	entries.erase(i);
+}
+
+// Remove all entries
+void KeyCache::clear()
+{
+	MutexLocker lock(cacheMutex);
+
+	if (!entries.empty())
+	{
+		DEBUG_MSG("Clearing %lu cached keys (hits: %lu, misses: %lu)", (unsigned long)entries.size(), hits, misses);
+	}
+
+	// The material is held in secure memory and wiped on release
+	entries.clear();
+	lru.clear();
+}
+
+unsigned long KeyCache::getHits()
+{
+	MutexLocker lock(cacheMutex);
+
+	return hits;
+}
+
+unsigned long KeyCache::getMisses()
+{
+	MutexLocker lock(cacheMutex);
+
+	return misses;
+}
+
+size_t KeyCache::size()
+{
+	MutexLocker lock(cacheMutex);
+
+	return entries.size();
+}
+
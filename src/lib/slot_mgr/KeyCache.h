@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ KeyCache.h
+
+ A bounded cache for the decrypted key material of private token objects.
+ Entries are stored in their serialised form in secure memory and are tied
+ to the revision of the object they were read from
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_KEYCACHE_H
+#define _SOFTHSM_V2_KEYCACHE_H
+
+#include "config.h"
+#include "ByteString.h"
+#include "OSObject.h"
+#include "MutexFactory.h"
+#include <list>
+#include <map>
+
+class KeyCache
+{
+public:
+	// Constructor; a maximum of zero entries disables the cache
+	KeyCache(size_t inMaxEntries);
+
+	// Destructor
+	virtual ~KeyCache();
+
+	// Retrieve the key material cached for the object at the given revision
+	bool get(OSObject* object, unsigned long revision, ByteString& material);
+
+	// Store the key material of the object at the given revision
+	void put(OSObject* object, unsigned long revision, const ByteString& material);
+
+	// Remove the entry for the object
+	void remove(OSObject* object);
+
+	// Remove all entries
+	void clear();
+
+	// Statistics
+	unsigned long getHits();
+	unsigned long getMisses();
+	size_t size();
+
+private:
+	struct Entry
+	{
+		unsigned long revision;
+		ByteString material;
+		std::list<OSObject*>::iterator lruPosition;
+	};
+
+	// The cached entries
+	std::map<OSObject*, Entry> entries;
+
+	// Least recently used order; the front is the most recently used
+	std::list<OSObject*> lru;
+
+	// The maximum number of entries
+	size_t maxEntries;
+
+	// Statistics
+	unsigned long hits;
+	unsigned long misses;
+
+	Mutex* cacheMutex;
+};
+
+#endif // !_SOFTHSM_V2_KEYCACHE_H
+
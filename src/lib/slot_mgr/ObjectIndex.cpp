@@ -0,0 +1,401 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ ObjectIndex.cpp
+
+ Hash indexes on the attributes of the token objects that are commonly used
+ to find objects. Only keyed hashes of the (decrypted) attribute values are
+ kept, and every entry is tied to the revision of the object it was read
+ from. The index is updated whenever an object is created, changed or
+ destroyed, so a search can use it without looking at the other objects.
+ It only narrows down the candidates of a search; they still have to be
+ matched against the full template.
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "ObjectIndex.h"
+#include "CryptoFactory.h"
+#include "RNG.h"
+#include <string.h>
+
+// SipHash-2-4, used as keyed hash so the index does not reveal attribute values
+#define SIPROUND \
+	do { \
+		v0 += v1; v1 = (v1 << 13) | (v1 >> 51); v1 ^= v0; v0 = (v0 << 32) | (v0 >> 32); \
+		v2 += v3; v3 = (v3 << 16) | (v3 >> 48); v3 ^= v2; \
+		v0 += v3; v3 = (v3 << 21) | (v3 >> 43); v3 ^= v0; \
+		v2 += v1; v1 = (v1 << 17) | (v1 >> 47); v1 ^= v2; v2 = (v2 << 32) | (v2 >> 32); \
+	} while (0)
+
+static unsigned long long siphash(const unsigned long long key[2], const unsigned char* data, size_t len)
+{
+	unsigned long long v0 = key[0] ^ 0x736f6d6570736575ULL;
+	unsigned long long v1 = key[1] ^ 0x646f72616e646f6dULL;
+	unsigned long long v2 = key[0] ^ 0x6c7967656e657261ULL;
+	unsigned long long v3 = key[1] ^ 0x7465646279746573ULL;
+
+	size_t i = 0;
+
+	for (; i + 8 <= len; i += 8)
+	{
+		unsigned long long m = 0;
+
+		for (size_t j = 0; j < 8; j++)
+		{
+			m |= (unsigned long long) data[i + j] << (8 * j);
+		}
+
+		v3 ^= m;
+		SIPROUND;
+		SIPROUND;
+		v0 ^= m;
+	}
+
+	unsigned long long b = (unsigned long long) len << 56;
+
+	for (size_t j = 0; i + j < len; j++)
+	{
+		b |= (unsigned long long) data[i + j] << (8 * j);
+	}
+
+	v3 ^= b;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= b;
+
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// Constructor
+ObjectIndex::ObjectIndex()
+{
+	hashKey[0] = 0;
+	hashKey[1] = 0;
+
+	RNG* rng = CryptoFactory::i()->getRNG();
+	ByteString seed;
+
+	if ((rng != NULL) && rng->generateRandom(seed, sizeof(hashKey)))
+	{
+		memcpy(hashKey, seed.const_byte_str(), sizeof(hashKey));
+	}
+	else
+	{
+		WARNING_MSG("Could not generate a key for the object index");
+	}
+
+	indexMutex = MutexFactory::i()->getMutex();
+}
+
+// Destructor
+ObjectIndex::~ObjectIndex()
+{
+	MutexFactory::i()->recycleMutex(indexMutex);
+}
+
+// Is the attribute indexed?
+/*static*/ bool ObjectIndex::isIndexed(CK_ATTRIBUTE_TYPE type)
+{
+	switch (type)
+	{
+		case CKA_CLASS:
+		case CKA_KEY_TYPE:
+		case CKA_ID:
+		case CKA_LABEL:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// Is the attribute stored as an unsigned long?
+/*static*/ bool ObjectIndex::isUnsignedLong(CK_ATTRIBUTE_TYPE type)
+{
+	return (type == CKA_CLASS) || (type == CKA_KEY_TYPE);
+}
+
+// Can the index be used for the template?
+/*static*/ bool ObjectIndex::canLookup(const CK_ATTRIBUTE* pTemplate, CK_ULONG ulCount)
+{
+	for (CK_ULONG i = 0; i < ulCount; i++)
+	{
+		if (isIndexed(pTemplate[i].type) &&
+		    (pTemplate[i].pValue != NULL_PTR || pTemplate[i].ulValueLen == 0))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Is the object indexed at the given revision?
+bool ObjectIndex::isCurrent(OSObject* object, unsigned long revision)
+{
+	MutexLocker lock(indexMutex);
+
+	std::map<OSObject*, Entry>::iterator i = entries.find(object);
+
+	return (i != entries.end()) && (i->second.revision == revision);
+}
+
+// Replace the entries of the object with the given attribute values
+void ObjectIndex::update(OSObject* object, unsigned long revision, const std::vector<std::pair<CK_ATTRIBUTE_TYPE, ByteString> >& values)
+{
+	MutexLocker lock(indexMutex);
+
+	std::map<OSObject*, Entry>::iterator i = entries.find(object);
+
+	if (i != entries.end())
+	{
+		removeEntry(object, i->second);
+	}
+
+	excluded.erase(object);
+
+	Entry& entry = entries[object];
+
+	entry.revision = revision;
+	entry.keys.clear();
+
+	for (size_t n = 0; n < values.size(); n++)
+	{
+		Key key(values[n].first, hash(values[n].second.const_byte_str(), values[n].second.size()));
+
+		entry.keys.push_back(key);
+		buckets[key].insert(object);
+	}
+}
+
+// Remove the entries of the object and return it from every lookup
+void ObjectIndex::exclude(OSObject* object)
+{
+	MutexLocker lock(indexMutex);
+
+	std::map<OSObject*, Entry>::iterator i = entries.find(object);
+
+	if (i != entries.end())
+	{
+		removeEntry(object, i->second);
+		entries.erase(i);
+	}
+
+	excluded.insert(object);
+}
+
+// Remove the entries of the object
+void ObjectIndex::remove(OSObject* object)
+{
+	MutexLocker lock(indexMutex);
+
+	excluded.erase(object);
+
+	std::map<OSObject*, Entry>::iterator i = entries.find(object);
+
+	if (i == entries.end()) return;
+
+	removeEntry(object, i->second);
+	entries.erase(i);
+}
+
+// Forget the objects that are not in the given map and retrieve the ones
+// that were never indexed or whose entry is of an older revision. Excluded
+// objects are matched in full, so they never go stale. Only the pointers
+// are compared, the objects themselves are not accessed.
+void ObjectIndex::sync(const std::map<OSObject*, unsigned long>& objects, std::vector<OSObject*>& stale)
+{
+	MutexLocker lock(indexMutex);
+
+	size_t known = 0;
+
+	for (std::map<OSObject*, unsigned long>::const_iterator i = objects.begin(); i != objects.end(); ++i)
+	{
+		std::map<OSObject*, Entry>::iterator entry = entries.find(i->first);
+
+		if (entry != entries.end())
+		{
+			known++;
+
+			if (entry->second.revision != i->second)
+			{
+				stale.push_back(i->first);
+			}
+		}
+		else if (excluded.find(i->first) != excluded.end())
+		{
+			known++;
+		}
+		else
+		{
+			stale.push_back(i->first);
+		}
+	}
+
+	// All objects in the index are still there
+	if (known == entries.size() + excluded.size()) return;
+
+	std::map<OSObject*, Entry>::iterator i = entries.begin();
+
+	while (i != entries.end())
+	{
+		if (objects.find(i->first) == objects.end())
+		{
+			removeEntry(i->first, i->second);
+			entries.erase(i++);
+		}
+		else
+		{
+			++i;
+		}
+	}
+
+	std::set<OSObject*>::iterator j = excluded.begin();
+
+	while (j != excluded.end())
+	{
+		if (objects.find(*j) == objects.end())
+		{
+			excluded.erase(j++);
+		}
+		else
+		{
+			++j;
+		}
+	}
+}
+
+// Remove all entries
+void ObjectIndex::clear()
+{
+	MutexLocker lock(indexMutex);
+
+	entries.clear();
+	buckets.clear();
+	excluded.clear();
+}
+
+// Retrieve the indexed objects that may match the template
+bool ObjectIndex::lookup(const CK_ATTRIBUTE* pTemplate, CK_ULONG ulCount, std::set<OSObject*>& candidates)
+{
+	std::vector<Key> keys;
+
+	for (CK_ULONG i = 0; i < ulCount; i++)
+	{
+		if (!isIndexed(pTemplate[i].type)) continue;
+
+		// Such a value never matches an unsigned long attribute
+		if (isUnsignedLong(pTemplate[i].type) && pTemplate[i].ulValueLen != sizeof(CK_ULONG))
+		{
+			return true;
+		}
+
+		if (pTemplate[i].pValue == NULL_PTR && pTemplate[i].ulValueLen != 0) continue;
+
+		keys.push_back(Key(pTemplate[i].type, hash((const unsigned char*) pTemplate[i].pValue, pTemplate[i].ulValueLen)));
+	}
+
+	if (keys.empty()) return false;
+
+	MutexLocker lock(indexMutex);
+
+	// The values of the excluded objects are not known
+	candidates.insert(excluded.begin(), excluded.end());
+
+	// Start from the smallest bucket
+	std::vector<const std::set<OSObject*>*> sets;
+	size_t smallest = 0;
+
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		std::map<Key, std::set<OSObject*> >::iterator bucket = buckets.find(keys[i]);
+
+		if (bucket == buckets.end()) return true;
+
+		sets.push_back(&bucket->second);
+
+		if (bucket->second.size() < sets[smallest]->size())
+		{
+			smallest = i;
+		}
+	}
+
+	for (std::set<OSObject*>::const_iterator i = sets[smallest]->begin(); i != sets[smallest]->end(); ++i)
+	{
+		bool inAll = true;
+
+		for (size_t n = 0; inAll && n < sets.size(); n++)
+		{
+			inAll = (n == smallest) || (sets[n]->find(*i) != sets[n]->end());
+		}
+
+		if (inAll)
+		{
+			candidates.insert(*i);
+		}
+	}
+
+	return true;
+}
+
+// The number of indexed objects
+size_t ObjectIndex::size()
+{
+	MutexLocker lock(indexMutex);
+
+	return entries.size();
+}
+
+// Compute the keyed hash of a value
+unsigned long long ObjectIndex::hash(const unsigned char* data, size_t len)
+{
+	return siphash(hashKey, data, len);
+}
+
+// Remove an entry from the buckets
+void ObjectIndex::removeEntry(OSObject* object, const Entry& entry)
+{
+	for (size_t n = 0; n < entry.keys.size(); n++)
+	{
+		std::map<Key, std::set<OSObject*> >::iterator bucket = buckets.find(entry.keys[n]);
+
+		if (bucket == buckets.end()) continue;
+
+		bucket->second.erase(object);
+
+		if (bucket->second.empty())
+		{
+			buckets.erase(bucket);
+		}
+	}
+}
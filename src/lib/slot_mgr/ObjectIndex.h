@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ ObjectIndex.h
+
+ Hash indexes on the attributes of the token objects that are commonly used
+ to find objects. Only keyed hashes of the (decrypted) attribute values are
+ kept, and every entry is tied to the revision of the object it was read
+ from. The index is updated whenever an object is created, changed or
+ destroyed, and a search first indexes again the objects that have a newer
+ revision, such as the ones changed by another process. It only narrows
+ down the candidates of a search; they still have to be matched against
+ the full template.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_OBJECTINDEX_H
+#define _SOFTHSM_V2_OBJECTINDEX_H
+
+#include "config.h"
+#include "ByteString.h"
+#include "OSObject.h"
+#include "MutexFactory.h"
+#include "cryptoki.h"
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+class ObjectIndex
+{
+public:
+	// Constructor
+	ObjectIndex();
+
+	// Destructor
+	virtual ~ObjectIndex();
+
+	// Is the attribute indexed?
+	static bool isIndexed(CK_ATTRIBUTE_TYPE type);
+
+	// Is the attribute stored as an unsigned long?
+	static bool isUnsignedLong(CK_ATTRIBUTE_TYPE type);
+
+	// Can the index be used for the template?
+	static bool canLookup(const CK_ATTRIBUTE* pTemplate, CK_ULONG ulCount);
+
+	// Is the object indexed at the given revision?
+	bool isCurrent(OSObject* object, unsigned long revision);
+
+	// Replace the entries of the object with the given attribute values
+	void update(OSObject* object, unsigned long revision, const std::vector<std::pair<CK_ATTRIBUTE_TYPE, ByteString> >& values);
+
+	// Remove the entries of the object and return it from every lookup,
+	// for objects that cannot be indexed
+	void exclude(OSObject* object);
+
+	// Remove the entries of the object
+	void remove(OSObject* object);
+
+	// Forget the objects that are not in the given map of objects and their
+	// current revisions, and retrieve the ones that were never indexed or
+	// have changed since they were
+	void sync(const std::map<OSObject*, unsigned long>& objects, std::vector<OSObject*>& stale);
+
+	// Remove all entries
+	void clear();
+
+	// Retrieve the objects that may match the template, including the
+	// excluded ones; returns false if the template has no indexed attributes
+	bool lookup(const CK_ATTRIBUTE* pTemplate, CK_ULONG ulCount, std::set<OSObject*>& candidates);
+
+	// The number of indexed objects
+	size_t size();
+
+private:
+	// An attribute type and the keyed hash of its value
+	typedef std::pair<CK_ATTRIBUTE_TYPE, unsigned long long> Key;
+
+	struct Entry
+	{
+		unsigned long revision;
+		std::vector<Key> keys;
+	};
+
+	// Compute the keyed hash of a value
+	unsigned long long hash(const unsigned char* data, size_t len);
+
+	// Remove an entry from the buckets
+	void removeEntry(OSObject* object, const Entry& entry);
+
+	// The indexed objects
+	std::map<OSObject*, Entry> entries;
+
+	// The objects per attribute value
+	std::map<Key, std::set<OSObject*> > buckets;
+
+	// The objects that cannot be indexed
+	std::set<OSObject*> excluded;
+
+	// The secret hash key
+	unsigned long long hashKey[2];
+
+	Mutex* indexMutex;
+};
+
+#endif // !_SOFTHSM_V2_OBJECTINDEX_H
+
@@ -31,6 +31,11 @@
 #include "OSAttribute.h"
 #include "ByteString.h"
 #include "SecureDataManager.h"
+#include "Configuration.h"
+#ifdef WITH_MIZARU
+#include "MizaruIndexedPrivateKey.h"
+#include "MizaruIndexedSymmetricKey.h"
+#endif
 #include <cstdio>
 
 #ifndef _WIN32
@@ -47,6 +52,12 @@ Token::Token()
 	token = NULL;
 	sdm = NULL;
 	valid = false;
+
+	keyCache = new KeyCache(Configuration::i()->getInt("keycache.size", DEFAULT_KEYCACHE_SIZE));
+	objectIndex = new ObjectIndex();
+#ifdef WITH_MIZARU
+	certStore = Configuration::i()->getBool("mizaru.certificates", true) ? new MizaruCertStore() : NULL;
+#endif
 }
 
 // Constructor
@@ -61,6 +72,12 @@ Token::Token(ObjectStoreToken* inToken)
 	valid = token->getSOPIN(soPINBlob) && token->getUserPIN(userPINBlob);
 
 	sdm = new SecureDataManager(soPINBlob, userPINBlob);
+
+	keyCache = new KeyCache(Configuration::i()->getInt("keycache.size", DEFAULT_KEYCACHE_SIZE));
+	objectIndex = new ObjectIndex();
+#ifdef WITH_MIZARU
+	certStore = Configuration::i()->getBool("mizaru.certificates", true) ? new MizaruCertStore() : NULL;
+#endif
 }
 
 // Destructor
@@ -68,6 +85,12 @@ Token::~Token()
 {
 	if (sdm != NULL) delete sdm;
 
+	delete keyCache;
+	delete objectIndex;
+#ifdef WITH_MIZARU
+	if (certStore != NULL) delete certStore;
+#endif
+
 	MutexFactory::i()->recycleMutex(tokenMutex);
 }
 
@@ -182,6 +205,10 @@ CK_RV Token::loginUser(ByteString& pin)
 
 	flags &= ~CKF_USER_PIN_COUNT_LOW;
 	token->setTokenFlags(flags);
+
+	// Private objects could not be indexed before; index everything again
+	objectIndex->clear();
+
 	return CKR_OK;
 }
 
@@ -245,6 +272,11 @@ void Token::logout()
 	// Lock access to the token
 	MutexLocker lock(tokenMutex);
 
+	// Decrypted key material and hashes of private values must not
+	// outlive the login session
+	keyCache->clear();
+	objectIndex->clear();
+
 	if (sdm == NULL) return;
 
 	sdm->logout();
@@ -406,6 +438,9 @@ CK_RV Token::createToken(ObjectStore* objectStore, ByteString& soPIN, CK_UTF8CHA
 		flags &= ~CKF_SO_PIN_COUNT_LOW;
 		token->setTokenFlags(flags);
 
+		// The keys in the Mizar key slots go with the objects of the token
+		removeKeySlots();
+
 		// Reset the token
 		if (!token->resetToken(labelByteStr))
 		{
@@ -455,6 +490,9 @@ CK_RV Token::createToken(ObjectStore* objectStore, ByteString& soPIN, CK_UTF8CHA
 	if (sdm != NULL) delete sdm;
 	sdm = new SecureDataManager(soPINBlob, userPINBlob);
 
+	keyCache->clear();
+	objectIndex->clear();
+
 	return CKR_OK;
 }
 
@@ -550,6 +588,10 @@ OSObject* Token::createObject()
 void Token::getObjects(std::set<OSObject *> &objects)
 {
 	token->getObjects(objects);
+
+#ifdef WITH_MIZARU
+	if (certStore != NULL) certStore->getObjects(objects);
+#endif
 }
 
 bool Token::decrypt(const ByteString &encrypted, ByteString &plaintext)
@@ -571,3 +613,138 @@ bool Token::encrypt(const ByteString &plaintext, ByteString &encrypted)
 
 	return sdm->encrypt(plaintext,encrypted);
 }
+
+// Retrieve the cache for decrypted key material
+KeyCache* Token::getKeyCache()
+{
+	return keyCache;
+}
+
+// Retrieve the attribute index of the token objects
+ObjectIndex* Token::getObjectIndex()
+{
+	return objectIndex;
+}
+
+// The size of the record of a claimed key slot
+#define KEYSLOT_RECORD_SIZE 16
+
+// Delete the key in a Mizar key slot
+static bool deleteKeySlot(CK_KEY_TYPE keyType, CK_ULONG index)
+{
+#ifdef WITH_MIZARU
+	switch (keyType)
+	{
+		case CKK_AES:
+			return MizaruIndexedSymmetricKey(SymAlgo::AES, index).remove();
+		case CKK_RSA:
+			return MizaruIndexedPrivateKey(AsymAlgo::RSA, index).remove();
+		case CKK_EC:
+			return MizaruIndexedPrivateKey(AsymAlgo::ECDSA, index).remove();
+		default:
+			return false;
+	}
+#else
+	(void) keyType; (void) index;
+
+	return false;
+#endif
+}
+
+// The record of a claimed key slot
+ByteString Token::keySlotRecord(CK_KEY_TYPE keyType, CK_ULONG index)
+{
+	return ByteString((unsigned long) keyType) + ByteString((unsigned long) index);
+}
+
+// The position of a record among the claimed key slots, -1 if absent
+long Token::findKeySlot(const ByteString& keySlots, const ByteString& record)
+{
+	for (size_t pos = 0; pos + KEYSLOT_RECORD_SIZE <= keySlots.size(); pos += KEYSLOT_RECORD_SIZE)
+	{
+		if (keySlots.substr(pos, KEYSLOT_RECORD_SIZE) == record) return (long) pos;
+	}
+
+	return -1;
+}
+
+// Claim a key slot for a key of the token
+bool Token::claimKeySlot(CK_KEY_TYPE keyType, CK_ULONG index)
+{
+	// Lock access to the token
+	MutexLocker lock(tokenMutex);
+
+	ByteString keySlots;
+	ByteString record = keySlotRecord(keyType, index);
+
+	if (token == NULL || !token->getKeySlots(keySlots)) return false;
+
+	if (findKeySlot(keySlots, record) >= 0)
+	{
+		ERROR_MSG("Mizar key slot %lu is already claimed", index);
+		return false;
+	}
+
+	return token->setKeySlots(keySlots + record);
+}
+
+// Check if the token holds the claim on a key slot
+bool Token::ownsKeySlot(CK_KEY_TYPE keyType, CK_ULONG index)
+{
+	// Lock access to the token
+	MutexLocker lock(tokenMutex);
+
+	ByteString keySlots;
+
+	if (token == NULL || !token->getKeySlots(keySlots)) return false;
+
+	return findKeySlot(keySlots, keySlotRecord(keyType, index)) >= 0;
+}
+
+// Give up the claim on a key slot
+bool Token::releaseKeySlot(CK_KEY_TYPE keyType, CK_ULONG index)
+{
+	// Lock access to the token
+	MutexLocker lock(tokenMutex);
+
+	ByteString keySlots;
+	ByteString record = keySlotRecord(keyType, index);
+
+	if (token == NULL || !token->getKeySlots(keySlots)) return false;
+
+	long pos = findKeySlot(keySlots, record);
+	if (pos < 0) return true;
+
+	return token->setKeySlots(keySlots.substr(0, pos) + keySlots.substr(pos + KEYSLOT_RECORD_SIZE));
+}
+
+// Delete the key in a claimed key slot and give up the claim
+bool Token::removeKeySlot(CK_KEY_TYPE keyType, CK_ULONG index)
+{
+	if (!deleteKeySlot(keyType, index))
+	{
+		ERROR_MSG("Mizar key slot %lu stays claimed", index);
+		return false;
+	}
+
+	return releaseKeySlot(keyType, index);
+}
+
+// Delete the keys in all claimed key slots and drop the claims; the caller
+// holds the token mutex
+void Token::removeKeySlots()
+{
+	ByteString keySlots;
+
+	if (token == NULL || !token->getKeySlots(keySlots) || keySlots.size() == 0) return;
+
+	for (size_t pos = 0; pos + KEYSLOT_RECORD_SIZE <= keySlots.size(); pos += KEYSLOT_RECORD_SIZE)
+	{
+		CK_KEY_TYPE keyType = keySlots.substr(pos, KEYSLOT_RECORD_SIZE / 2).long_val();
+		CK_ULONG index = keySlots.substr(pos + KEYSLOT_RECORD_SIZE / 2, KEYSLOT_RECORD_SIZE / 2).long_val();
+
+		deleteKeySlot(keyType, index);
+	}
+
+	token->setKeySlots(ByteString());
+}
@@ -38,10 +38,18 @@
 #include "ObjectStore.h"
 #include "ObjectStoreToken.h"
 #include "SecureDataManager.h"
+#include "KeyCache.h"
+#include "ObjectIndex.h"
+#ifdef WITH_MIZARU
+#include "MizaruCertStore.h"
+#endif
 #include "cryptoki.h"
 #include <string>
 #include <vector>
 
+// The default number of decrypted keys cached per token
+#define DEFAULT_KEYCACHE_SIZE 64
+
 class Token
 {
 public:
@@ -86,7 +94,8 @@ public:
 	// Create object
 	OSObject *createObject();
 
-	// Insert all token objects into the given set.
+	// Insert all token objects into the given set; this includes the
+	// certificates on the Mizar chip
 	void getObjects(std::set<OSObject *> &objects);
 
 	// Decrypt the supplied data
@@ -95,7 +104,34 @@ public:
 	// Encrypt the supplied data
 	bool encrypt(const ByteString& plaintext, ByteString& encrypted);
 
+	// Retrieve the cache for decrypted key material
+	KeyCache* getKeyCache();
+
+	// Retrieve the attribute index of the token objects
+	ObjectIndex* getObjectIndex();
+
+	// The Mizar key slots of the keys of the token. The chip keeps RSA, EC
+	// and secret keys apart, so a slot is named by its key type and index.
+	// A slot can only be claimed once, and a key in a slot is only used if
+	// its token holds the claim.
+	bool claimKeySlot(CK_KEY_TYPE keyType, CK_ULONG index);
+	bool ownsKeySlot(CK_KEY_TYPE keyType, CK_ULONG index);
+	bool releaseKeySlot(CK_KEY_TYPE keyType, CK_ULONG index);
+
+	// Delete the key in a claimed key slot and give up the claim; the claim
+	// is kept if the key cannot be deleted
+	bool removeKeySlot(CK_KEY_TYPE keyType, CK_ULONG index);
+
 private:
+	// The record of a claimed key slot
+	static ByteString keySlotRecord(CK_KEY_TYPE keyType, CK_ULONG index);
+
+	// Delete the keys in all claimed key slots and drop the claims
+	void removeKeySlots();
+
+	// The position of a record among the claimed key slots, -1 if absent
+	static long findKeySlot(const ByteString& keySlots, const ByteString& record);
+
 	// Token validity
 	bool valid;
 
@@ -105,6 +141,17 @@ private:
 	// The secure data manager for this token
 	SecureDataManager* sdm;
 
+	// The cache for decrypted key material of this token
+	KeyCache* keyCache;
+
+	// The attribute index of the token objects
+	ObjectIndex* objectIndex;
+
+#ifdef WITH_MIZARU
+	// The certificates on the Mizar chip, NULL if they are not shown
+	MizaruCertStore* certStore;
+#endif
+
 	Mutex* tokenMutex;
 };
 
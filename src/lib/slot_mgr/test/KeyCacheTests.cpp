@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ KeyCacheTests.cpp
+
+ Contains test cases to test the key material cache
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "KeyCacheTests.h"
+#include "KeyCache.h"
+#include "SessionObject.h"
+#include "OSAttribute.h"
+#include "cryptoki.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(KeyCacheTests);
+
+void KeyCacheTests::setUp()
+{
+}
+
+void KeyCacheTests::tearDown()
+{
+}
+
+void KeyCacheTests::testHitAndMiss()
+{
+	KeyCache cache(4);
+	SessionObject object(NULL, 1, 1, true);
+	ByteString material("0102030405060708");
+	ByteString retrieved;
+
+	// Nothing has been cached yet
+	CPPUNIT_ASSERT(!cache.get(&object, object.getRevision(), retrieved));
+	CPPUNIT_ASSERT(cache.getMisses() == 1);
+
+	cache.put(&object, object.getRevision(), material);
+	CPPUNIT_ASSERT(cache.size() == 1);
+
+	CPPUNIT_ASSERT(cache.get(&object, object.getRevision(), retrieved));
+	CPPUNIT_ASSERT(retrieved == material);
+	CPPUNIT_ASSERT(cache.getHits() == 1);
+	CPPUNIT_ASSERT(cache.getMisses() == 1);
+}
+
+void KeyCacheTests::testRevision()
+{
+	KeyCache cache(4);
+	SessionObject object(NULL, 1, 1, true);
+	ByteString material("0102030405060708");
+	ByteString retrieved;
+
+	unsigned long revision = object.getRevision();
+	cache.put(&object, revision, material);
+
+	// Modifying the object must change its revision
+	CPPUNIT_ASSERT(object.setAttribute(CKA_LABEL, OSAttribute(ByteString("abcd"))));
+	CPPUNIT_ASSERT(object.getRevision() != revision);
+
+	// The stale entry is dropped on lookup
+	CPPUNIT_ASSERT(!cache.get(&object, object.getRevision(), retrieved));
+	CPPUNIT_ASSERT(cache.size() == 0);
+
+	// Revisions are never shared between objects
+	SessionObject other(NULL, 1, 1, true);
+	CPPUNIT_ASSERT(other.getRevision() != object.getRevision());
+}
+
+void KeyCacheTests::testEviction()
+{
+	KeyCache cache(2);
+	SessionObject object1(NULL, 1, 1, true);
+	SessionObject object2(NULL, 1, 1, true);
+	SessionObject object3(NULL, 1, 1, true);
+	ByteString retrieved;
+
+	cache.put(&object1, object1.getRevision(), ByteString("01"));
+	cache.put(&object2, object2.getRevision(), ByteString("02"));
+
+	// Make object1 the most recently used entry
+	CPPUNIT_ASSERT(cache.get(&object1, object1.getRevision(), retrieved));
+
+	// Adding a third entry evicts object2
+	cache.put(&object3, object3.getRevision(), ByteString("03"));
+	CPPUNIT_ASSERT(cache.size() == 2);
+
+	CPPUNIT_ASSERT(cache.get(&object1, object1.getRevision(), retrieved));
+	CPPUNIT_ASSERT(retrieved == ByteString("01"));
+	CPPUNIT_ASSERT(!cache.get(&object2, object2.getRevision(), retrieved));
+	CPPUNIT_ASSERT(cache.get(&object3, object3.getRevision(), retrieved));
+	CPPUNIT_ASSERT(retrieved == ByteString("03"));
+}
+
+void KeyCacheTests::testRemoveAndClear()
+{
+	KeyCache cache(4);
+	SessionObject object1(NULL, 1, 1, true);
+	SessionObject object2(NULL, 1, 1, true);
+	ByteString retrieved;
+
+	cache.put(&object1, object1.getRevision(), ByteString("01"));
+	cache.put(&object2, object2.getRevision(), ByteString("02"));
+
+	cache.remove(&object1);
+	CPPUNIT_ASSERT(cache.size() == 1);
+	CPPUNIT_ASSERT(!cache.get(&object1, object1.getRevision(), retrieved));
+
+	cache.clear();
+	CPPUNIT_ASSERT(cache.size() == 0);
+	CPPUNIT_ASSERT(!cache.get(&object2, object2.getRevision(), retrieved));
+}
+
+void KeyCacheTests::testDisabled()
+{
+	KeyCache cache(0);
+	SessionObject object(NULL, 1, 1, true);
+	ByteString retrieved;
+
+	cache.put(&object, object.getRevision(), ByteString("01"));
+	CPPUNIT_ASSERT(cache.size() == 0);
+	CPPUNIT_ASSERT(!cache.get(&object, object.getRevision(), retrieved));
+}
+
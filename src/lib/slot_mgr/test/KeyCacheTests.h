@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ KeyCacheTests.h
+
+ Contains test cases to test the key material cache
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_KEYCACHETESTS_H
+#define _SOFTHSM_V2_KEYCACHETESTS_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class KeyCacheTests : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(KeyCacheTests);
+	CPPUNIT_TEST(testHitAndMiss);
+	CPPUNIT_TEST(testRevision);
+	CPPUNIT_TEST(testEviction);
+	CPPUNIT_TEST(testRemoveAndClear);
+	CPPUNIT_TEST(testDisabled);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void testHitAndMiss();
+	void testRevision();
+	void testEviction();
+	void testRemoveAndClear();
+	void testDisabled();
+
+	void setUp();
+	void tearDown();
+};
+
+#endif // !_SOFTHSM_V2_KEYCACHETESTS_H
+
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ ObjectIndexTests.cpp
+
+ Contains test cases to test the attribute index of token objects
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "ObjectIndexTests.h"
+#include "ObjectIndex.h"
+#include "SessionObject.h"
+#include "cryptoki.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ObjectIndexTests);
+
+typedef std::vector<std::pair<CK_ATTRIBUTE_TYPE, ByteString> > Values;
+
+static ByteString ulongValue(CK_ULONG value)
+{
+	return ByteString((const unsigned char*) &value, sizeof(value));
+}
+
+static Values keyValues(CK_OBJECT_CLASS objClass, const char* id, const char* label)
+{
+	Values values;
+
+	values.push_back(std::make_pair((CK_ATTRIBUTE_TYPE) CKA_CLASS, ulongValue(objClass)));
+	values.push_back(std::make_pair((CK_ATTRIBUTE_TYPE) CKA_ID, ByteString((const unsigned char*) id, strlen(id))));
+	values.push_back(std::make_pair((CK_ATTRIBUTE_TYPE) CKA_LABEL, ByteString((const unsigned char*) label, strlen(label))));
+
+	return values;
+}
+
+void ObjectIndexTests::setUp()
+{
+}
+
+void ObjectIndexTests::tearDown()
+{
+}
+
+void ObjectIndexTests::testLookup()
+{
+	ObjectIndex index;
+	SessionObject pub(NULL, 1, 1, true);
+	SessionObject priv(NULL, 1, 1, true);
+	SessionObject other(NULL, 1, 1, true);
+
+	index.update(&pub, pub.getRevision(), keyValues(CKO_PUBLIC_KEY, "id1", "key"));
+	index.update(&priv, priv.getRevision(), keyValues(CKO_PRIVATE_KEY, "id1", "key"));
+	index.update(&other, other.getRevision(), keyValues(CKO_PRIVATE_KEY, "id2", "key"));
+	CPPUNIT_ASSERT(index.size() == 3);
+
+	CK_OBJECT_CLASS objClass = CKO_PRIVATE_KEY;
+	CK_ATTRIBUTE byClassAndId[] = {
+		{ CKA_CLASS, &objClass, sizeof(objClass) },
+		{ CKA_ID, (CK_VOID_PTR) "id1", 3 }
+	};
+	std::set<OSObject*> candidates;
+
+	CPPUNIT_ASSERT(index.lookup(byClassAndId, 2, candidates));
+	CPPUNIT_ASSERT(candidates.size() == 1);
+	CPPUNIT_ASSERT(candidates.count(&priv) == 1);
+
+	CK_ATTRIBUTE byLabel[] = {
+		{ CKA_LABEL, (CK_VOID_PTR) "key", 3 }
+	};
+
+	candidates.clear();
+	CPPUNIT_ASSERT(index.lookup(byLabel, 1, candidates));
+	CPPUNIT_ASSERT(candidates.size() == 3);
+
+	CK_ATTRIBUTE unknownId[] = {
+		{ CKA_ID, (CK_VOID_PTR) "id3", 3 }
+	};
+
+	candidates.clear();
+	CPPUNIT_ASSERT(index.lookup(unknownId, 1, candidates));
+	CPPUNIT_ASSERT(candidates.empty());
+}
+
+void ObjectIndexTests::testUpdate()
+{
+	ObjectIndex index;
+	SessionObject object(NULL, 1, 1, true);
+
+	unsigned long revision = object.getRevision();
+	CPPUNIT_ASSERT(!index.isCurrent(&object, revision));
+
+	index.update(&object, revision, keyValues(CKO_SECRET_KEY, "old", "key"));
+	CPPUNIT_ASSERT(index.isCurrent(&object, revision));
+
+	// Modifying the object makes the entry stale
+	CPPUNIT_ASSERT(object.setAttribute(CKA_ID, OSAttribute(ByteString("abcd"))));
+	CPPUNIT_ASSERT(!index.isCurrent(&object, object.getRevision()));
+
+	// Updating replaces the old values
+	index.update(&object, object.getRevision(), keyValues(CKO_SECRET_KEY, "new", "key"));
+	CPPUNIT_ASSERT(index.size() == 1);
+
+	CK_ATTRIBUTE oldId[] = { { CKA_ID, (CK_VOID_PTR) "old", 3 } };
+	CK_ATTRIBUTE newId[] = { { CKA_ID, (CK_VOID_PTR) "new", 3 } };
+	std::set<OSObject*> candidates;
+
+	CPPUNIT_ASSERT(index.lookup(oldId, 1, candidates));
+	CPPUNIT_ASSERT(candidates.empty());
+	CPPUNIT_ASSERT(index.lookup(newId, 1, candidates));
+	CPPUNIT_ASSERT(candidates.count(&object) == 1);
+}
+
+void ObjectIndexTests::testRemoveAndSync()
+{
+	ObjectIndex index;
+	SessionObject first(NULL, 1, 1, true);
+	SessionObject second(NULL, 1, 1, true);
+	SessionObject third(NULL, 1, 1, true);
+
+	index.update(&first, first.getRevision(), keyValues(CKO_DATA, "1", "data"));
+	index.update(&second, second.getRevision(), keyValues(CKO_DATA, "2", "data"));
+	index.update(&third, third.getRevision(), keyValues(CKO_DATA, "3", "data"));
+
+	index.remove(&first);
+	CPPUNIT_ASSERT(index.size() == 2);
+	CPPUNIT_ASSERT(!index.isCurrent(&first, first.getRevision()));
+
+	// Objects that are gone are forgotten, new ones are reported
+	SessionObject fourth(NULL, 1, 1, true);
+	std::map<OSObject*, unsigned long> live;
+	std::vector<OSObject*> unknown;
+	live[&third] = third.getRevision();
+	live[&fourth] = fourth.getRevision();
+	index.sync(live, unknown);
+	CPPUNIT_ASSERT(index.size() == 1);
+	CPPUNIT_ASSERT(unknown.size() == 1);
+	CPPUNIT_ASSERT(unknown[0] == &fourth);
+
+	// Objects changed since they were indexed are reported as well
+	CPPUNIT_ASSERT(third.setAttribute(CKA_ID, OSAttribute(ByteString("abcd"))));
+	live[&third] = third.getRevision();
+	unknown.clear();
+	index.sync(live, unknown);
+	CPPUNIT_ASSERT(unknown.size() == 2);
+	index.update(&third, third.getRevision(), keyValues(CKO_DATA, "3", "data"));
+
+	CK_ATTRIBUTE byLabel[] = { { CKA_LABEL, (CK_VOID_PTR) "data", 4 } };
+	std::set<OSObject*> candidates;
+
+	CPPUNIT_ASSERT(index.lookup(byLabel, 1, candidates));
+	CPPUNIT_ASSERT(candidates.size() == 1);
+	CPPUNIT_ASSERT(candidates.count(&third) == 1);
+
+	// Excluded objects are returned by every lookup
+	index.exclude(&fourth);
+	unknown.clear();
+	index.sync(live, unknown);
+	CPPUNIT_ASSERT(unknown.empty());
+
+	CK_ATTRIBUTE unknownLabel[] = { { CKA_LABEL, (CK_VOID_PTR) "none", 4 } };
+
+	candidates.clear();
+	CPPUNIT_ASSERT(index.lookup(unknownLabel, 1, candidates));
+	CPPUNIT_ASSERT(candidates.size() == 1);
+	CPPUNIT_ASSERT(candidates.count(&fourth) == 1);
+
+	// Indexing an excluded object includes it again
+	index.update(&fourth, fourth.getRevision(), keyValues(CKO_DATA, "4", "data"));
+	candidates.clear();
+	CPPUNIT_ASSERT(index.lookup(unknownLabel, 1, candidates));
+	CPPUNIT_ASSERT(candidates.empty());
+	CPPUNIT_ASSERT(index.lookup(byLabel, 1, candidates));
+	CPPUNIT_ASSERT(candidates.size() == 2);
+
+	index.clear();
+	CPPUNIT_ASSERT(index.size() == 0);
+	unknown.clear();
+	index.sync(live, unknown);
+	CPPUNIT_ASSERT(unknown.size() == 2);
+}
+
+void ObjectIndexTests::testTemplate()
+{
+	ObjectIndex index;
+	SessionObject object(NULL, 1, 1, true);
+
+	index.update(&object, object.getRevision(), keyValues(CKO_DATA, "1", "data"));
+
+	// Templates without indexed attributes cannot use the index
+	CK_BBOOL bTrue = CK_TRUE;
+	CK_ATTRIBUTE byToken[] = { { CKA_TOKEN, &bTrue, sizeof(bTrue) } };
+	std::set<OSObject*> candidates;
+
+	CPPUNIT_ASSERT(!ObjectIndex::canLookup(byToken, 1));
+	CPPUNIT_ASSERT(!index.lookup(byToken, 1, candidates));
+	CPPUNIT_ASSERT(!ObjectIndex::canLookup(NULL, 0));
+
+	// An unsigned long attribute with the wrong length never matches
+	CK_BYTE shortClass = 0;
+	CK_ATTRIBUTE badClass[] = { { CKA_CLASS, &shortClass, sizeof(shortClass) } };
+
+	CPPUNIT_ASSERT(ObjectIndex::canLookup(badClass, 1));
+	CPPUNIT_ASSERT(index.lookup(badClass, 1, candidates));
+	CPPUNIT_ASSERT(candidates.empty());
+}
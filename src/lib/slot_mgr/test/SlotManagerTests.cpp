@@ -483,3 +483,55 @@ void SlotManagerTests::testUninitialisedToken()
 	CPPUNIT_ASSERT((tokenInfo.flags & CKF_TOKEN_INITIALIZED) != CKF_TOKEN_INITIALIZED);
 }
 
+void SlotManagerTests::testKeySlots()
+{
+	// Create an object store with a token
+#ifndef _WIN32
+	ObjectStore store("./testdir", DEFAULT_UMASK);
+#else
+	ObjectStore store(".\\testdir", DEFAULT_UMASK);
+#endif
+
+	ByteString label = "DEADBEEF";
+
+	CPPUNIT_ASSERT(store.newToken(label) != NULL);
+
+	CK_SLOT_ID testList[10];
+	CK_ULONG ulCount = 10;
+
+	{
+		SlotManager slotManager(&store);
+
+		CPPUNIT_ASSERT(slotManager.getSlotList(&store, CK_TRUE, testList, &ulCount) == CKR_OK);
+		CPPUNIT_ASSERT(ulCount == 2);
+
+		Token* token = slotManager.getSlots()[testList[0]]->getToken();
+
+		CPPUNIT_ASSERT(token != NULL);
+		CPPUNIT_ASSERT(!token->ownsKeySlot(CKK_RSA, 7));
+
+		// A slot is claimed once
+		CPPUNIT_ASSERT(token->claimKeySlot(CKK_RSA, 7));
+		CPPUNIT_ASSERT(!token->claimKeySlot(CKK_RSA, 7));
+		CPPUNIT_ASSERT(token->ownsKeySlot(CKK_RSA, 7));
+
+		// RSA, EC and secret keys have slots of their own
+		CPPUNIT_ASSERT(!token->ownsKeySlot(CKK_EC, 7));
+		CPPUNIT_ASSERT(token->claimKeySlot(CKK_EC, 7));
+		CPPUNIT_ASSERT(token->claimKeySlot(CKK_AES, 3));
+
+		CPPUNIT_ASSERT(token->releaseKeySlot(CKK_RSA, 7));
+		CPPUNIT_ASSERT(!token->ownsKeySlot(CKK_RSA, 7));
+		CPPUNIT_ASSERT(token->releaseKeySlot(CKK_RSA, 7));
+		CPPUNIT_ASSERT(token->ownsKeySlot(CKK_EC, 7));
+	}
+
+	// The claims are kept with the token
+	SlotManager slotManager(&store);
+	Token* token = slotManager.getSlots()[testList[0]]->getToken();
+
+	CPPUNIT_ASSERT(token != NULL);
+	CPPUNIT_ASSERT(!token->ownsKeySlot(CKK_RSA, 7));
+	CPPUNIT_ASSERT(token->ownsKeySlot(CKK_EC, 7));
+	CPPUNIT_ASSERT(token->ownsKeySlot(CKK_AES, 3));
+}
@@ -43,6 +43,7 @@ class SlotManagerTests : public CppUnit::TestFixture
 	CPPUNIT_TEST(testInitialiseTokenInLastSlot);
 	CPPUNIT_TEST(testReinitialiseExistingToken);
 	CPPUNIT_TEST(testUninitialisedToken);
+	CPPUNIT_TEST(testKeySlots);
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -51,6 +52,7 @@ public:
 	void testInitialiseTokenInLastSlot();
 	void testReinitialiseExistingToken();
 	void testUninitialisedToken();
+	void testKeySlots();
 
 	void setUp();
 	void tearDown();